@@ -0,0 +1,944 @@
+/*!
+ *****************************************************************************
+ @file:    EisArchive.c
+ @brief:   Append-only columnar archive of impedance spectra.
+ -----------------------------------------------------------------------------
+
+*****************************************************************************/
+#include "EisArchive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define EISARC_ALIGN(x)     (((x) + 7u)&~7u)
+
+static const uint8_t EisArcZero[8];
+
+void EisArcLayout(uint32_t Kind, uint32_t Count, uint32_t Points, EisArcLayout_Type *pLayout)
+{
+  uint32_t pos = sizeof(EisArcBlockHdr_Type);
+
+  memset(pLayout, 0, sizeof(*pLayout));
+  pLayout->Time = pos;
+  pos = EISARC_ALIGN(pos + Count*sizeof(uint64_t));
+  if(Kind == EISARC_KIND_SPECTRA)
+  {
+    pLayout->Duration = pos;
+    pos = EISARC_ALIGN(pos + Count*sizeof(uint32_t));
+    pLayout->Channel = pos;
+    pos = EISARC_ALIGN(pos + Count*sizeof(uint16_t));
+    pLayout->Real = pos;
+    pos = EISARC_ALIGN(pos + Count*Points*sizeof(float));
+    pLayout->Image = pos;
+    pos = EISARC_ALIGN(pos + Count*Points*sizeof(float));
+  }
+  else
+  {
+    pLayout->Freq = pos;
+    pos = EISARC_ALIGN(pos + Count*sizeof(float));
+    pLayout->Sweep = pos;
+    pos = EISARC_ALIGN(pos + Count*sizeof(uint16_t));
+    pLayout->Channel = pos;
+    pos = EISARC_ALIGN(pos + Count*sizeof(uint16_t));
+    pLayout->Real = pos;
+    pos = EISARC_ALIGN(pos + Count*sizeof(float));
+    pLayout->Image = pos;
+    pos = EISARC_ALIGN(pos + Count*sizeof(float));
+  }
+  pLayout->Size = pos;
+}
+
+static uint32_t EisArcEntrySize(const EisArcIndex_Type *pEntry)
+{
+  EisArcLayout_Type lay;
+  EisArcLayout(pEntry->Kind, pEntry->Count, pEntry->Points, &lay);
+  return lay.Size;
+}
+
+static uint32_t EisArcHash(const void *pData, uint32_t Len)
+{
+  const uint8_t *p = pData;
+  uint32_t h = 2166136261u;       /* FNV-1a */
+  while(Len--)
+    h = (h ^ *p++)*16777619u;
+  return h;
+}
+
+static int EisArcOpenFile(const char *Dir, const char *Name, int Flags)
+{
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s", Dir, Name);
+  return open(path, Flags|O_CLOEXEC, 0644);
+}
+
+/* Write all bytes, retrying short writes */
+static int EisArcWriteAll(int Fd, struct iovec *pIov, int Count)
+{
+  while(Count)
+  {
+    ssize_t n = writev(Fd, pIov, Count);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0)
+      return -1;
+    while(Count && (size_t)n >= pIov->iov_len)
+    {
+      n -= pIov->iov_len;
+      pIov++;
+      Count--;
+    }
+    if(Count)
+    {
+      pIov->iov_base = (uint8_t*)pIov->iov_base + n;
+      pIov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+/* Add column and padding up to the next 8 byte boundary */
+static int EisArcIov(struct iovec *pIov, const void *pData, uint32_t Len)
+{
+  pIov[0].iov_base = (void*)pData;
+  pIov[0].iov_len = Len;
+  pIov[1].iov_base = (void*)EisArcZero;
+  pIov[1].iov_len = EISARC_ALIGN(Len) - Len;
+  return 2;
+}
+
+static int EisArcHashGrow(EisArc_Type *pArc)
+{
+  uint32_t size = pArc->HashSize ? pArc->HashSize*2 : 1024, i, h;
+  uint32_t *pHash = calloc(size, sizeof(uint32_t));
+
+  if(pHash == NULL)
+    return -1;
+  for(i=0; i<pArc->DevCount; i++)
+  {
+    h = EisArcHash(pArc->pDev[i].Id, strlen(pArc->pDev[i].Id))&(size - 1);
+    while(pHash[h])
+      h = (h + 1)&(size - 1);
+    pHash[h] = i + 1;
+  }
+  free(pArc->pHash);
+  pArc->pHash = pHash;
+  pArc->HashSize = size;
+  return 0;
+}
+
+/* Add device to memory tables. Caller holds the lock or is single threaded. */
+static int EisArcAddDev(EisArc_Type *pArc, const char *Id)
+{
+  uint32_t h;
+
+  if(pArc->DevCount == pArc->DevCap)
+  {
+    uint32_t cap = pArc->DevCap ? pArc->DevCap*2 : 256;
+    EisArcDev_Type *pDev = realloc(pArc->pDev, cap*sizeof(EisArcDev_Type));
+    if(pDev == NULL)
+      return -1;
+    pArc->pDev = pDev;
+    pArc->DevCap = cap;
+  }
+  if((pArc->DevCount + 1)*2 > pArc->HashSize && EisArcHashGrow(pArc) != 0)
+    return -1;
+  memset(&pArc->pDev[pArc->DevCount], 0, sizeof(EisArcDev_Type));
+  strncpy(pArc->pDev[pArc->DevCount].Id, Id, EISARC_ID_LEN - 1);
+  h = EisArcHash(Id, strlen(pArc->pDev[pArc->DevCount].Id))&(pArc->HashSize - 1);
+  while(pArc->pHash[h])
+    h = (h + 1)&(pArc->HashSize - 1);
+  pArc->pHash[h] = ++pArc->DevCount;
+  return 0;
+}
+
+/* Add plan to memory table. Caller holds the lock or is single threaded. */
+static int EisArcAddPlan(EisArc_Type *pArc, const float *pFreq, uint32_t Points)
+{
+  EisArcPlan_Type *pPlan;
+
+  if(pArc->PlanCount == pArc->PlanCap)
+  {
+    uint32_t cap = pArc->PlanCap ? pArc->PlanCap*2 : 16;
+    pPlan = realloc(pArc->pPlan, cap*sizeof(EisArcPlan_Type));
+    if(pPlan == NULL)
+      return -1;
+    pArc->pPlan = pPlan;
+    pArc->PlanCap = cap;
+  }
+  pPlan = &pArc->pPlan[pArc->PlanCount];
+  pPlan->pFreq = malloc(Points*sizeof(float));
+  if(pPlan->pFreq == NULL)
+    return -1;
+  memcpy(pPlan->pFreq, pFreq, Points*sizeof(float));
+  pPlan->Points = Points;
+  pPlan->Hash = EisArcHash(pFreq, Points*sizeof(float));
+  pArc->PlanCount++;
+  return 0;
+}
+
+static int EisArcAddIndex(EisArc_Type *pArc, const EisArcIndex_Type *pEntry)
+{
+  EisArcDev_Type *pDev = &pArc->pDev[pEntry->Device];
+
+  if(pArc->IndexCount == pArc->IndexCap)
+  {
+    uint32_t cap = pArc->IndexCap ? pArc->IndexCap*2 : 1024;
+    EisArcIndex_Type *pIndex = realloc(pArc->pIndex, (size_t)cap*sizeof(EisArcIndex_Type));
+    if(pIndex == NULL)
+      return -1;
+    pArc->pIndex = pIndex;
+    pArc->IndexCap = cap;
+  }
+  pArc->pIndex[pArc->IndexCount++] = *pEntry;
+  pDev->Blocks++;
+  pArc->Blocks++;
+  if(pEntry->Kind == EISARC_KIND_SPECTRA)
+  {
+    pDev->Values += (uint64_t)pEntry->Count*pEntry->Points;
+    pArc->Spectra += pEntry->Count;
+  }
+  else
+  {
+    pDev->Values += pEntry->Count;
+    pArc->Points += pEntry->Count;
+  }
+  return 0;
+}
+
+/* Cut file to Size, counting what was lost */
+static int EisArcCut(EisArc_Type *pArc, int Fd, uint64_t FileSize, uint64_t Size)
+{
+  if(FileSize == Size)
+    return 0;
+  pArc->TornBytes += FileSize - Size;
+  return ftruncate(Fd, Size);
+}
+
+static bool EisArcEntryValid(const EisArc_Type *pArc, const EisArcIndex_Type *pEntry)
+{
+  if(pEntry->Device >= pArc->DevCount || pEntry->Count == 0)
+    return false;
+  if(pEntry->Kind == EISARC_KIND_SPECTRA)
+    return pEntry->Plan < pArc->PlanCount && pEntry->Points == pArc->pPlan[pEntry->Plan].Points;
+  return pEntry->Kind == EISARC_KIND_POINTS;
+}
+
+static int EisArcWriteIndexHdr(int Fd, uint32_t Sorted, uint64_t MaxSpanUs)
+{
+  EisArcIndexHdr_Type hdr;
+  struct iovec iov;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.Magic = EISARC_INDEX_MAGIC;
+  hdr.Version = EISARC_VERSION;
+  hdr.EntrySize = sizeof(EisArcIndex_Type);
+  hdr.Sorted = Sorted;
+  hdr.MaxSpanUs = MaxSpanUs;
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  return EisArcWriteAll(Fd, &iov, 1);
+}
+
+/* Load device table, plans and index, cut off torn tails */
+static int EisArcLoad(EisArc_Type *pArc)
+{
+  struct stat st;
+  char id[EISARC_ID_LEN];
+  EisArcPlanHdr_Type plan;
+  EisArcIndexHdr_Type ihdr;
+  EisArcIndex_Type entry;
+  EisArcBlockHdr_Type bhdr;
+  float *pFreq = NULL;
+  uint64_t data_end = 0, pos, end;
+  uint32_t i, entries;
+
+  if(fstat(pArc->DevFd, &st) != 0)
+    return -1;
+  for(pos=0; pos+EISARC_ID_LEN <= (uint64_t)st.st_size; pos+=EISARC_ID_LEN)
+  {
+    if(pread(pArc->DevFd, id, EISARC_ID_LEN, pos) != EISARC_ID_LEN)
+      return -1;
+    id[EISARC_ID_LEN-1] = 0;
+    if(EisArcAddDev(pArc, id) != 0)
+      return -1;
+  }
+  if(EisArcCut(pArc, pArc->DevFd, st.st_size, pos) != 0)
+    return -1;
+
+  if(fstat(pArc->PlanFd, &st) != 0)
+    return -1;
+  pFreq = malloc(EISARC_MAX_POINTS*sizeof(float));
+  if(pFreq == NULL)
+    return -1;
+  for(pos=0; pos+sizeof(plan) <= (uint64_t)st.st_size; pos=end)
+  {
+    if(pread(pArc->PlanFd, &plan, sizeof(plan), pos) != sizeof(plan))
+      break;
+    end = pos + sizeof(plan) + EISARC_ALIGN(plan.Points*sizeof(float));
+    if(plan.Magic != EISARC_PLAN_MAGIC || plan.Plan != pArc->PlanCount ||
+       plan.Points == 0 || plan.Points > EISARC_MAX_POINTS || end > (uint64_t)st.st_size ||
+       pread(pArc->PlanFd, pFreq, plan.Points*sizeof(float), pos + sizeof(plan)) != (ssize_t)(plan.Points*sizeof(float)) ||
+       EisArcAddPlan(pArc, pFreq, plan.Points) != 0)
+      break;
+  }
+  free(pFreq);
+  if(EisArcCut(pArc, pArc->PlanFd, st.st_size, pos) != 0)
+    return -1;
+
+  if(fstat(pArc->DataFd, &st) != 0)
+    return -1;
+  pArc->DataSize = st.st_size;
+
+  if(fstat(pArc->IndexFd, &st) != 0)
+    return -1;
+  if((uint64_t)st.st_size < sizeof(ihdr))
+  {
+    /* New archive, or crashed while creating it */
+    if(EisArcCut(pArc, pArc->IndexFd, st.st_size, 0) != 0 || EisArcWriteIndexHdr(pArc->IndexFd, 0, 0) != 0)
+      return -1;
+    st.st_size = sizeof(ihdr);
+    memset(&ihdr, 0, sizeof(ihdr));
+  }
+  else if(pread(pArc->IndexFd, &ihdr, sizeof(ihdr), 0) != sizeof(ihdr))
+    return -1;
+  else if(ihdr.Magic != EISARC_INDEX_MAGIC || ihdr.Version != EISARC_VERSION ||
+          ihdr.EntrySize != sizeof(EisArcIndex_Type))
+  {
+    errno = EPROTO;
+    return -1;
+  }
+  entries = (st.st_size - sizeof(ihdr))/sizeof(entry);
+  if(ihdr.Sorted > entries)
+  {
+    errno = EPROTO;
+    return -1;
+  }
+  for(i=0; i<entries; i++)
+  {
+    pos = sizeof(ihdr) + (uint64_t)i*sizeof(entry);
+    if(pread(pArc->IndexFd, &entry, sizeof(entry), pos) != sizeof(entry))
+      return -1;
+    end = entry.Offset + EisArcEntrySize(&entry);
+    if(i < ihdr.Sorted)
+    {
+      /* Compaction only runs after the data is synced */
+      if(!EisArcEntryValid(pArc, &entry) || end > pArc->DataSize)
+      {
+        errno = EPROTO;
+        return -1;
+      }
+      if(end > data_end)
+        data_end = end;
+    }
+    else
+    {
+      /* Entry is written after its block, so only the last ones can be bad */
+      if(!EisArcEntryValid(pArc, &entry) || entry.Offset != data_end || end > pArc->DataSize ||
+         pread(pArc->DataFd, &bhdr, sizeof(bhdr), entry.Offset) != sizeof(bhdr) ||
+         bhdr.Magic != EISARC_MAGIC || bhdr.Count != entry.Count || bhdr.Device != entry.Device)
+        break;
+      data_end = end;
+    }
+    if(EisArcAddIndex(pArc, &entry) != 0)
+      return -1;
+  }
+  pArc->Sorted = ihdr.Sorted;
+  if(EisArcCut(pArc, pArc->IndexFd, st.st_size, sizeof(ihdr) + (uint64_t)i*sizeof(entry)) != 0 ||
+     EisArcCut(pArc, pArc->DataFd, pArc->DataSize, data_end) != 0)
+    return -1;
+  pArc->DataSize = data_end;
+  return 0;
+}
+
+/**
+ * @brief Open archive for appending, create it if needed.
+ * @param Dir: Archive directory, created if missing.
+ * @return 0 on success, -1 with errno set. EPROTO if the files are not
+ *         an archive of this version.
+*/
+int EisArcOpen(EisArc_Type *pArc, const char *Dir)
+{
+  int flags = O_RDWR|O_CREAT|O_APPEND;
+
+  memset(pArc, 0, sizeof(*pArc));
+  pArc->DataFd = pArc->IndexFd = pArc->DevFd = pArc->PlanFd = -1;
+  pthread_mutex_init(&pArc->Lock, NULL);
+  snprintf(pArc->Dir, sizeof(pArc->Dir), "%s", Dir);
+  if(mkdir(Dir, 0755) != 0 && errno != EEXIST)
+    return -1;
+  pArc->DevFd = EisArcOpenFile(Dir, "devices.eisd", flags);
+  pArc->PlanFd = EisArcOpenFile(Dir, "plans.eisp", flags);
+  pArc->DataFd = EisArcOpenFile(Dir, "data.eisa", flags);
+  pArc->IndexFd = EisArcOpenFile(Dir, "index.eisi", flags);
+  if(pArc->DevFd < 0 || pArc->PlanFd < 0 || pArc->DataFd < 0 || pArc->IndexFd < 0 || EisArcLoad(pArc) != 0)
+  {
+    int err = errno;
+    EisArcClose(pArc);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Sort index if it has unsorted entries, sync and close archive.
+*/
+void EisArcClose(EisArc_Type *pArc)
+{
+  uint32_t i;
+
+  if(pArc->DataFd >= 0 && pArc->IndexFd >= 0)
+  {
+    if(pArc->Sorted != pArc->IndexCount)
+      EisArcCompact(pArc);
+    else
+      EisArcSync(pArc);
+  }
+  if(pArc->DevFd >= 0) close(pArc->DevFd);
+  if(pArc->PlanFd >= 0) close(pArc->PlanFd);
+  if(pArc->DataFd >= 0) close(pArc->DataFd);
+  if(pArc->IndexFd >= 0) close(pArc->IndexFd);
+  pArc->DevFd = pArc->PlanFd = pArc->DataFd = pArc->IndexFd = -1;
+  for(i=0; i<pArc->PlanCount; i++)
+    free(pArc->pPlan[i].pFreq);
+  free(pArc->pPlan);
+  free(pArc->pDev);
+  free(pArc->pHash);
+  free(pArc->pIndex);
+  pArc->pPlan = NULL;
+  pArc->pDev = NULL;
+  pArc->pHash = NULL;
+  pArc->pIndex = NULL;
+  pArc->DevCount = pArc->DevCap = pArc->HashSize = 0;
+  pArc->PlanCount = pArc->PlanCap = 0;
+  pArc->IndexCount = pArc->IndexCap = pArc->Sorted = 0;
+  pthread_mutex_destroy(&pArc->Lock);
+}
+
+/**
+ * @brief Look up device number of an ID, add the device if it is new.
+ * @return 0 on success, -1 on write error or out of memory.
+*/
+int EisArcDevice(EisArc_Type *pArc, const char *Id, uint32_t *pDevice)
+{
+  char rec[EISARC_ID_LEN];
+  uint32_t h;
+  int ret = 0;
+
+  memset(rec, 0, sizeof(rec));
+  strncpy(rec, Id, EISARC_ID_LEN - 1);
+  pthread_mutex_lock(&pArc->Lock);
+  if(pArc->HashSize)
+  {
+    h = EisArcHash(rec, strlen(rec))&(pArc->HashSize - 1);
+    while(pArc->pHash[h])
+    {
+      if(strcmp(pArc->pDev[pArc->pHash[h] - 1].Id, rec) == 0)
+      {
+        *pDevice = pArc->pHash[h] - 1;
+        pthread_mutex_unlock(&pArc->Lock);
+        return 0;
+      }
+      h = (h + 1)&(pArc->HashSize - 1);
+    }
+  }
+  if(write(pArc->DevFd, rec, sizeof(rec)) != sizeof(rec) || EisArcAddDev(pArc, rec) != 0)
+    ret = -1;
+  else
+    *pDevice = pArc->DevCount - 1;
+  pthread_mutex_unlock(&pArc->Lock);
+  return ret;
+}
+
+/**
+ * @brief Look up plan number of a frequency grid, add the plan if it is new.
+ * @param pFreq: Frequencies in sweep order.
+ * @return 0 on success, -1 with errno set.
+*/
+int EisArcPlan(EisArc_Type *pArc, const float *pFreq, uint32_t Points, uint32_t *pPlan)
+{
+  EisArcPlanHdr_Type hdr;
+  struct iovec iov[3];
+  uint32_t hash, i;
+  int ret = 0;
+
+  if(Points == 0 || Points > EISARC_MAX_POINTS)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  hash = EisArcHash(pFreq, Points*sizeof(float));
+  pthread_mutex_lock(&pArc->Lock);
+  for(i=0; i<pArc->PlanCount; i++)
+  {
+    if(pArc->pPlan[i].Hash == hash && pArc->pPlan[i].Points == Points &&
+       memcmp(pArc->pPlan[i].pFreq, pFreq, Points*sizeof(float)) == 0)
+    {
+      *pPlan = i;
+      pthread_mutex_unlock(&pArc->Lock);
+      return 0;
+    }
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.Magic = EISARC_PLAN_MAGIC;
+  hdr.Plan = pArc->PlanCount;
+  hdr.Points = Points;
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len = sizeof(hdr);
+  EisArcIov(&iov[1], pFreq, Points*sizeof(float));
+  if(EisArcWriteAll(pArc->PlanFd, iov, 3) != 0 || EisArcAddPlan(pArc, pFreq, Points) != 0)
+    ret = -1;
+  else
+    *pPlan = pArc->PlanCount - 1;
+  pthread_mutex_unlock(&pArc->Lock);
+  return ret;
+}
+
+/**
+ * @brief Frequency grid of a plan.
+ * @return Frequencies, valid until the archive is closed, or NULL.
+*/
+const float *EisArcPlanFreq(EisArc_Type *pArc, uint32_t Plan, uint32_t *pPoints)
+{
+  const float *pFreq = NULL;
+
+  pthread_mutex_lock(&pArc->Lock);
+  if(Plan < pArc->PlanCount)
+  {
+    pFreq = pArc->pPlan[Plan].pFreq;
+    *pPoints = pArc->pPlan[Plan].Points;
+  }
+  pthread_mutex_unlock(&pArc->Lock);
+  return pFreq;
+}
+
+/* Write block then its index entry */
+static int EisArcWriteBlock(EisArc_Type *pArc, EisArcBlockHdr_Type *pHdr, struct iovec *pIov, int Count)
+{
+  EisArcIndex_Type entry;
+  EisArcLayout_Type lay;
+  int ret;
+
+  pHdr->Magic = EISARC_MAGIC;
+  pHdr->Version = EISARC_VERSION;
+  pIov[0].iov_base = pHdr;
+  pIov[0].iov_len = sizeof(*pHdr);
+  if(EisArcWriteAll(pArc->DataFd, pIov, Count) != 0)
+    return -1;
+
+  memset(&entry, 0, sizeof(entry));
+  entry.Device = pHdr->Device;
+  entry.Count = pHdr->Count;
+  entry.Offset = pArc->DataSize;
+  entry.TimeMin = pHdr->TimeMin;
+  entry.TimeMax = pHdr->TimeMax;
+  entry.Plan = pHdr->Plan;
+  entry.Kind = pHdr->Kind;
+  entry.Points = pHdr->Points;
+  EisArcLayout(pHdr->Kind, pHdr->Count, pHdr->Points, &lay);
+  pArc->DataSize += lay.Size;
+  pArc->BytesWritten += lay.Size + sizeof(entry);
+  pIov[0].iov_base = &entry;
+  pIov[0].iov_len = sizeof(entry);
+  if(EisArcWriteAll(pArc->IndexFd, pIov, 1) != 0)
+    return -1;
+  /* Device table may grow on another thread */
+  pthread_mutex_lock(&pArc->Lock);
+  ret = EisArcAddIndex(pArc, &entry);
+  pthread_mutex_unlock(&pArc->Lock);
+  return ret;
+}
+
+static void EisArcTimeRange(const uint64_t *pTime, uint32_t Count, EisArcBlockHdr_Type *pHdr)
+{
+  uint32_t i;
+
+  pHdr->TimeMin = pHdr->TimeMax = pTime[0];
+  for(i=1; i<Count; i++)
+  {
+    if(pTime[i] < pHdr->TimeMin) pHdr->TimeMin = pTime[i];
+    if(pTime[i] > pHdr->TimeMax) pHdr->TimeMax = pTime[i];
+  }
+}
+
+/**
+ * @brief Append one block of loose points and its index entry.
+ * @return 0 on success, -1 with errno set.
+*/
+int EisArcAppend(EisArc_Type *pArc, const EisArcBlock_Type *pBlock)
+{
+  EisArcBlockHdr_Type hdr;
+  struct iovec iov[13];
+  uint32_t n = pBlock->Count;
+  int cnt = 1, ret;
+
+  pthread_mutex_lock(&pArc->Lock);
+  ret = (n == 0 || pBlock->Device >= pArc->DevCount);
+  pthread_mutex_unlock(&pArc->Lock);
+  if(ret)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.Kind = EISARC_KIND_POINTS;
+  hdr.Flags = pBlock->Flags;
+  hdr.Device = pBlock->Device;
+  hdr.Board = pBlock->Board;
+  hdr.Count = n;
+  hdr.Lost = pBlock->Lost;
+  hdr.Plan = EISARC_NO_PLAN;
+  EisArcTimeRange(pBlock->pTime, n, &hdr);
+  cnt += EisArcIov(&iov[cnt], pBlock->pTime, n*sizeof(uint64_t));
+  cnt += EisArcIov(&iov[cnt], pBlock->pFreq, n*sizeof(float));
+  cnt += EisArcIov(&iov[cnt], pBlock->pSweep, n*sizeof(uint16_t));
+  cnt += EisArcIov(&iov[cnt], pBlock->pChannel, n*sizeof(uint16_t));
+  cnt += EisArcIov(&iov[cnt], pBlock->pReal, n*sizeof(float));
+  cnt += EisArcIov(&iov[cnt], pBlock->pImage, n*sizeof(float));
+  return EisArcWriteBlock(pArc, &hdr, iov, cnt);
+}
+
+/**
+ * @brief Append one block of spectra over a plan and its index entry.
+ * @return 0 on success, -1 with errno set.
+*/
+int EisArcAppendSpectra(EisArc_Type *pArc, const EisArcSpectra_Type *pSpectra)
+{
+  EisArcBlockHdr_Type hdr;
+  struct iovec iov[11];
+  uint32_t n = pSpectra->Count, p = pSpectra->Points;
+  int cnt = 1, ret;
+
+  pthread_mutex_lock(&pArc->Lock);
+  ret = (n == 0 || pSpectra->Device >= pArc->DevCount || pSpectra->Plan >= pArc->PlanCount ||
+         pArc->pPlan[pSpectra->Plan].Points != p);
+  pthread_mutex_unlock(&pArc->Lock);
+  if(ret)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.Kind = EISARC_KIND_SPECTRA;
+  hdr.Flags = pSpectra->Flags;
+  hdr.Device = pSpectra->Device;
+  hdr.Board = pSpectra->Board;
+  hdr.Count = n;
+  hdr.Lost = pSpectra->Lost;
+  hdr.Plan = pSpectra->Plan;
+  hdr.Points = p;
+  EisArcTimeRange(pSpectra->pTime, n, &hdr);
+  cnt += EisArcIov(&iov[cnt], pSpectra->pTime, n*sizeof(uint64_t));
+  cnt += EisArcIov(&iov[cnt], pSpectra->pDuration, n*sizeof(uint32_t));
+  cnt += EisArcIov(&iov[cnt], pSpectra->pChannel, n*sizeof(uint16_t));
+  cnt += EisArcIov(&iov[cnt], pSpectra->pReal, n*p*sizeof(float));
+  cnt += EisArcIov(&iov[cnt], pSpectra->pImage, n*p*sizeof(float));
+  return EisArcWriteBlock(pArc, &hdr, iov, cnt);
+}
+
+/**
+ * @brief Flush data to disk: devices, plans and blocks first, so a synced
+ *        index never points past synced data.
+*/
+int EisArcSync(EisArc_Type *pArc)
+{
+  if(fdatasync(pArc->DevFd) != 0 || fdatasync(pArc->PlanFd) != 0 || fdatasync(pArc->DataFd) != 0)
+    return -1;
+  return fdatasync(pArc->IndexFd);
+}
+
+static int EisArcCompare(const void *pA, const void *pB)
+{
+  const EisArcIndex_Type *a = pA, *b = pB;
+
+  if(a->Device != b->Device)
+    return a->Device < b->Device ? -1 : 1;
+  if(a->TimeMin != b->TimeMin)
+    return a->TimeMin < b->TimeMin ? -1 : 1;
+  return a->Offset < b->Offset ? -1 : a->Offset > b->Offset;
+}
+
+/**
+ * @brief Rewrite index sorted by device and time.
+ *        Readers that mapped the old index keep using it until they reopen.
+ * @return 0 on success, -1 with errno set. The old index is kept on failure.
+*/
+int EisArcCompact(EisArc_Type *pArc)
+{
+  char path[1024], tmp[1024];
+  struct iovec iov;
+  uint64_t span = 0;
+  uint32_t i;
+  int fd, dir;
+
+  if(EisArcSync(pArc) != 0)
+    return -1;
+  /* Only the appending thread changes the index */
+  qsort(pArc->pIndex, pArc->IndexCount, sizeof(EisArcIndex_Type), EisArcCompare);
+  for(i=0; i<pArc->IndexCount; i++)
+    if(pArc->pIndex[i].TimeMax - pArc->pIndex[i].TimeMin > span)
+      span = pArc->pIndex[i].TimeMax - pArc->pIndex[i].TimeMin;
+
+  snprintf(path, sizeof(path), "%s/index.eisi", pArc->Dir);
+  snprintf(tmp, sizeof(tmp), "%s/index.eisi.tmp", pArc->Dir);
+  fd = open(tmp, O_RDWR|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0644);
+  if(fd < 0)
+    return -1;
+  iov.iov_base = pArc->pIndex;
+  iov.iov_len = (size_t)pArc->IndexCount*sizeof(EisArcIndex_Type);
+  if(EisArcWriteIndexHdr(fd, pArc->IndexCount, span) != 0 || EisArcWriteAll(fd, &iov, 1) != 0 ||
+     fdatasync(fd) != 0 || rename(tmp, path) != 0)
+  {
+    int err = errno;
+    close(fd);
+    unlink(tmp);
+    errno = err;
+    return -1;
+  }
+  dir = open(pArc->Dir, O_RDONLY|O_CLOEXEC);
+  if(dir >= 0)
+  {
+    fsync(dir);
+    close(dir);
+  }
+  close(pArc->IndexFd);
+  pArc->IndexFd = fd;
+  pArc->Sorted = pArc->IndexCount;
+  return 0;
+}
+
+/* Map a whole file read only, empty files give NULL */
+static int EisArcMap(const char *Dir, const char *Name, const uint8_t **ppMap, size_t *pSize)
+{
+  struct stat st;
+  void *p;
+  int fd = EisArcOpenFile(Dir, Name, O_RDONLY);
+
+  *ppMap = NULL;
+  *pSize = 0;
+  if(fd < 0)
+    return -1;
+  if(fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+  if(st.st_size > 0)
+  {
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED)
+    {
+      close(fd);
+      return -1;
+    }
+    *ppMap = p;
+    *pSize = st.st_size;
+  }
+  close(fd);
+  return 0;
+}
+
+/**
+ * @brief Map archive for reading. Blocks are used in place, nothing is copied.
+ *        An archive that is being written can be read: the reader sees the
+ *        blocks complete at the time it was opened.
+ * @return 0 on success, -1 with errno set.
+*/
+int EisArcReaderOpen(EisArcReader_Type *pRd, const char *Dir)
+{
+  const EisArcIndexHdr_Type *pHdr;
+  const EisArcPlanHdr_Type *pPlan;
+  size_t pos, end;
+  uint32_t i, total;
+
+  memset(pRd, 0, sizeof(*pRd));
+  if(EisArcMap(Dir, "devices.eisd", (const uint8_t**)&pRd->pDevMap, &pRd->DevMapSize) != 0 ||
+     EisArcMap(Dir, "plans.eisp", &pRd->pPlanMap, &pRd->PlanMapSize) != 0 ||
+     EisArcMap(Dir, "data.eisa", &pRd->pData, &pRd->DataSize) != 0 ||
+     EisArcMap(Dir, "index.eisi", &pRd->pIndexMap, &pRd->IndexMapSize) != 0)
+    goto fail;
+  pRd->DevCount = pRd->DevMapSize/EISARC_ID_LEN;
+
+  for(pos=0; pos+sizeof(EisArcPlanHdr_Type) <= pRd->PlanMapSize; pos=end)
+  {
+    pPlan = (const EisArcPlanHdr_Type*)(pRd->pPlanMap + pos);
+    end = pos + sizeof(*pPlan) + EISARC_ALIGN(pPlan->Points*sizeof(float));
+    if(pPlan->Magic != EISARC_PLAN_MAGIC || pPlan->Plan != pRd->PlanCount || end > pRd->PlanMapSize)
+      break;
+    if((pRd->PlanCount&15) == 0)
+    {
+      const EisArcPlanHdr_Type **pp = realloc(pRd->ppPlan, (pRd->PlanCount + 16)*sizeof(*pp));
+      if(pp == NULL)
+        goto fail;
+      pRd->ppPlan = pp;
+    }
+    pRd->ppPlan[pRd->PlanCount++] = pPlan;
+  }
+
+  pHdr = (const EisArcIndexHdr_Type*)pRd->pIndexMap;
+  if(pRd->IndexMapSize < sizeof(*pHdr) || pHdr->Magic != EISARC_INDEX_MAGIC ||
+     pHdr->Version != EISARC_VERSION || pHdr->EntrySize != sizeof(EisArcIndex_Type))
+  {
+    errno = EPROTO;
+    goto fail;
+  }
+  pRd->pIndex = (const EisArcIndex_Type*)(pRd->pIndexMap + sizeof(*pHdr));
+  total = (pRd->IndexMapSize - sizeof(*pHdr))/sizeof(EisArcIndex_Type);
+  pRd->Sorted = pHdr->Sorted < total ? pHdr->Sorted : total;
+  pRd->MaxSpanUs = pHdr->MaxSpanUs;
+  /* Stop at the first entry whose block is not all there */
+  for(i=0; i<total; i++)
+  {
+    const EisArcIndex_Type *pEntry = &pRd->pIndex[i];
+    if(pEntry->Device >= pRd->DevCount || pEntry->Count == 0 ||
+       pEntry->Offset + EisArcEntrySize(pEntry) > pRd->DataSize ||
+       (pEntry->Kind == EISARC_KIND_SPECTRA && (pEntry->Plan >= pRd->PlanCount ||
+        pRd->ppPlan[pEntry->Plan]->Points != pEntry->Points)))
+      break;
+  }
+  pRd->Entries = i;
+  if(pRd->Sorted > i)
+    pRd->Sorted = i;
+  return 0;
+
+fail:
+  {
+    int err = errno;
+    EisArcReaderClose(pRd);
+    errno = err;
+  }
+  return -1;
+}
+
+void EisArcReaderClose(EisArcReader_Type *pRd)
+{
+  if(pRd->pDevMap) munmap((void*)pRd->pDevMap, pRd->DevMapSize);
+  if(pRd->pPlanMap) munmap((void*)pRd->pPlanMap, pRd->PlanMapSize);
+  if(pRd->pData) munmap((void*)pRd->pData, pRd->DataSize);
+  if(pRd->pIndexMap) munmap((void*)pRd->pIndexMap, pRd->IndexMapSize);
+  free(pRd->ppPlan);
+  memset(pRd, 0, sizeof(*pRd));
+}
+
+/**
+ * @brief Device number of an ID.
+ * @return Device number, -1 if the archive has no such device.
+*/
+int EisArcReaderDevice(const EisArcReader_Type *pRd, const char *Id)
+{
+  uint32_t i;
+
+  for(i=0; i<pRd->DevCount; i++)
+    if(strncmp(pRd->pDevMap + (size_t)i*EISARC_ID_LEN, Id, EISARC_ID_LEN - 1) == 0)
+      return i;
+  return -1;
+}
+
+const char *EisArcReaderDeviceId(const EisArcReader_Type *pRd, uint32_t Device)
+{
+  return Device < pRd->DevCount ? pRd->pDevMap + (size_t)Device*EISARC_ID_LEN : NULL;
+}
+
+static int EisArcCompareTime(const void *pA, const void *pB)
+{
+  const EisArcIndex_Type *a = *(const EisArcIndex_Type* const*)pA, *b = *(const EisArcIndex_Type* const*)pB;
+
+  if(a->TimeMin != b->TimeMin)
+    return a->TimeMin < b->TimeMin ? -1 : 1;
+  return a->Offset < b->Offset ? -1 : a->Offset > b->Offset;
+}
+
+/**
+ * @brief Find blocks of a device with results between From and To.
+ * @param From, To: Inclusive time range in microseconds.
+ * @param ppOut: Receives up to Max entries, ordered by TimeMin.
+ * @return Number of matching blocks, which may be more than Max. Call with
+ *         Max 0 to size the output.
+*/
+uint32_t EisArcQuery(const EisArcReader_Type *pRd, uint32_t Device, uint64_t From, uint64_t To,
+                     const EisArcIndex_Type **ppOut, uint32_t Max)
+{
+  const EisArcIndex_Type *pEntry;
+  uint64_t start = From > pRd->MaxSpanUs ? From - pRd->MaxSpanUs : 0;
+  uint32_t lo = 0, hi = pRd->Sorted, mid, n = 0;
+
+  /* First sorted entry at or after (Device, From - MaxSpanUs): no block
+     starting earlier can reach From */
+  while(lo < hi)
+  {
+    mid = lo + (hi - lo)/2;
+    pEntry = &pRd->pIndex[mid];
+    if(pEntry->Device < Device || (pEntry->Device == Device && pEntry->TimeMin < start))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for(; lo<pRd->Sorted; lo++)
+  {
+    pEntry = &pRd->pIndex[lo];
+    if(pEntry->Device != Device || pEntry->TimeMin > To)
+      break;
+    if(pEntry->TimeMax >= From)
+    {
+      if(n < Max)
+        ppOut[n] = pEntry;
+      n++;
+    }
+  }
+  for(lo=pRd->Sorted; lo<pRd->Entries; lo++)
+  {
+    pEntry = &pRd->pIndex[lo];
+    if(pEntry->Device == Device && pEntry->TimeMin <= To && pEntry->TimeMax >= From)
+    {
+      if(n < Max)
+        ppOut[n] = pEntry;
+      n++;
+    }
+  }
+  if(pRd->Entries > pRd->Sorted)
+    qsort(ppOut, n < Max ? n : Max, sizeof(*ppOut), EisArcCompareTime);
+  return n;
+}
+
+/**
+ * @brief Point view columns at a block in the mapped data.
+ * @return 0 on success, -1 if the block is damaged.
+*/
+int EisArcView(const EisArcReader_Type *pRd, const EisArcIndex_Type *pEntry, EisArcView_Type *pView)
+{
+  const uint8_t *pBlock = pRd->pData + pEntry->Offset;
+  const EisArcBlockHdr_Type *pHdr = (const EisArcBlockHdr_Type*)pBlock;
+  EisArcLayout_Type lay;
+
+  memset(pView, 0, sizeof(*pView));
+  if(pHdr->Magic != EISARC_MAGIC || pHdr->Count != pEntry->Count || pHdr->Kind != pEntry->Kind ||
+     pHdr->Points != pEntry->Points)
+    return -1;
+  EisArcLayout(pHdr->Kind, pHdr->Count, pHdr->Points, &lay);
+  pView->pHdr = pHdr;
+  pView->Kind = pHdr->Kind;
+  pView->Count = pHdr->Count;
+  pView->pTime = (const uint64_t*)(pBlock + lay.Time);
+  pView->pChannel = (const uint16_t*)(pBlock + lay.Channel);
+  pView->pReal = (const float*)(pBlock + lay.Real);
+  pView->pImage = (const float*)(pBlock + lay.Image);
+  if(pHdr->Kind == EISARC_KIND_SPECTRA)
+  {
+    pView->Points = pHdr->Points;
+    pView->pFreq = (const float*)(pRd->ppPlan[pHdr->Plan] + 1);
+    pView->pDuration = (const uint32_t*)(pBlock + lay.Duration);
+  }
+  else
+  {
+    pView->Points = 1;
+    pView->pFreq = (const float*)(pBlock + lay.Freq);
+    pView->pSweep = (const uint16_t*)(pBlock + lay.Sweep);
+  }
+  return 0;
+}
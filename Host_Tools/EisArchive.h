@@ -0,0 +1,254 @@
+/*!
+ *****************************************************************************
+ @file:    EisArchive.h
+ @brief:   Append-only columnar archive of impedance spectra.
+ -----------------------------------------------------------------------------
+
+ An archive is a directory of four files, all little endian:
+
+   devices.eisd  One EISARC_ID_LEN byte record per device, the NUL padded
+                 device ID. The record number is the device number.
+   plans.eisp    Frequency grids. Each EisArcPlanHdr_Type is followed by
+                 f32 Freq[Points], padded to 8 bytes. Plans are numbered
+                 in file order and every distinct grid is stored once.
+   data.eisa     Blocks, each with points or spectra of one device.
+   index.eisi    EisArcIndexHdr_Type, then one EisArcIndex_Type per block.
+
+ A spectra block holds Count sweeps over one plan of Points frequencies:
+   EisArcBlockHdr_Type
+   u64 TimeUs[Count]        Time of first point
+   u32 DurationUs[Count]    Last point time minus first
+   u16 Channel[Count]
+   f32 Real[Count][Points]  Each spectrum is contiguous, missing points NaN
+   f32 Image[Count][Points]
+ A points block holds results that do not form a spectrum of a known plan:
+   EisArcBlockHdr_Type
+   u64 TimeUs[Count], f32 Freq[Count], u16 SweepIndex[Count],
+   u16 Channel[Count], f32 Real[Count], f32 Image[Count]
+ Columns start on 8 byte boundaries (EisArcLayout), so a reader maps the
+ data file and uses them in place.
+
+ The first Sorted index entries are ordered by device and TimeMin, so
+ lookups on (device, time) are a binary search. Entries appended since the
+ last EisArcCompact() follow in write order and are scanned. Compaction
+ rewrites the index to a new file and renames it over the old one.
+
+ Files are only appended to, apart from compaction. On open for writing,
+ a torn tail left by a crash is cut off.
+
+ One thread appends blocks. Device and plan lookup are thread safe.
+
+*****************************************************************************/
+#ifndef _EIS_ARCHIVE_H_
+#define _EIS_ARCHIVE_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define EISARC_MAGIC          0x42534945u   /* "EISB" */
+#define EISARC_INDEX_MAGIC    0x49534945u   /* "EISI" */
+#define EISARC_PLAN_MAGIC     0x50534945u   /* "EISP" */
+#define EISARC_VERSION        2
+#define EISARC_ID_LEN         64
+#define EISARC_MAX_POINTS     4096          /* Per plan */
+#define EISARC_NO_PLAN        0xFFFFFFFFu
+
+#define EISARC_KIND_POINTS    1
+#define EISARC_KIND_SPECTRA   2
+
+#define EISARC_FLAG_HOSTTIME  0x0001        /* TimeUs is host clock, see TimeSync.h */
+
+typedef struct
+{
+  uint32_t Magic;
+  uint16_t Version;
+  uint16_t Kind;                /* EISARC_KIND_xxx */
+  uint32_t Device;
+  uint32_t Board;               /* board_type_t of firmware */
+  uint32_t Count;               /* Points or spectra */
+  uint32_t Lost;                /* Result stream frames lost before this block */
+  uint32_t Plan;                /* EISARC_NO_PLAN for points */
+  uint16_t Points;              /* Per spectrum, 0 for points */
+  uint16_t Flags;               /* EISARC_FLAG_xxx */
+  uint64_t TimeMin;
+  uint64_t TimeMax;
+}EisArcBlockHdr_Type;
+
+typedef struct
+{
+  uint32_t Magic;
+  uint16_t Version;
+  uint16_t EntrySize;
+  uint32_t Sorted;              /* Leading entries ordered by Device, TimeMin */
+  uint32_t Reserved;
+  uint64_t MaxSpanUs;           /* Largest TimeMax - TimeMin among sorted entries */
+}EisArcIndexHdr_Type;
+
+typedef struct
+{
+  uint32_t Device;
+  uint32_t Count;
+  uint64_t Offset;              /* Of block header in data.eisa */
+  uint64_t TimeMin;
+  uint64_t TimeMax;
+  uint32_t Plan;
+  uint16_t Kind;
+  uint16_t Points;
+}EisArcIndex_Type;
+
+typedef struct
+{
+  uint32_t Magic;
+  uint32_t Plan;
+  uint32_t Points;
+  uint32_t Reserved;
+}EisArcPlanHdr_Type;
+
+/* Byte offsets of columns from block start */
+typedef struct
+{
+  uint32_t Time;
+  uint32_t Duration;            /* Spectra only */
+  uint32_t Freq;                /* Points only */
+  uint32_t Sweep;               /* Points only */
+  uint32_t Channel;
+  uint32_t Real;
+  uint32_t Image;
+  uint32_t Size;                /* Whole block */
+}EisArcLayout_Type;
+
+/* Points to write, columns are owned by the caller */
+typedef struct
+{
+  uint32_t Device;
+  uint32_t Board;
+  uint16_t Flags;
+  uint32_t Count;
+  uint32_t Lost;
+  const uint64_t *pTime;
+  const float *pFreq;
+  const uint16_t *pSweep;
+  const uint16_t *pChannel;
+  const float *pReal;
+  const float *pImage;
+}EisArcBlock_Type;
+
+/* Spectra to write, Real and Image hold Count rows of Points values */
+typedef struct
+{
+  uint32_t Device;
+  uint32_t Board;
+  uint16_t Flags;
+  uint32_t Plan;
+  uint32_t Points;
+  uint32_t Count;
+  uint32_t Lost;
+  const uint64_t *pTime;
+  const uint32_t *pDuration;
+  const uint16_t *pChannel;
+  const float *pReal;
+  const float *pImage;
+}EisArcSpectra_Type;
+
+typedef struct
+{
+  char Id[EISARC_ID_LEN];
+  uint64_t Blocks;
+  uint64_t Values;              /* Points, or spectra times plan points */
+}EisArcDev_Type;
+
+typedef struct
+{
+  uint32_t Points;
+  uint32_t Hash;
+  float *pFreq;
+}EisArcPlan_Type;
+
+/* Writer */
+typedef struct
+{
+  char Dir[512];
+  int DataFd;
+  int IndexFd;
+  int DevFd;
+  int PlanFd;
+  uint64_t DataSize;
+  pthread_mutex_t Lock;         /* Device and plan tables, index */
+  EisArcDev_Type *pDev;
+  uint32_t DevCount;
+  uint32_t DevCap;
+  uint32_t *pHash;              /* Device number + 1, 0 for free slot */
+  uint32_t HashSize;
+  EisArcPlan_Type *pPlan;
+  uint32_t PlanCount;
+  uint32_t PlanCap;
+  EisArcIndex_Type *pIndex;     /* All entries, for compaction */
+  uint32_t IndexCount;
+  uint32_t IndexCap;
+  uint32_t Sorted;
+/* Statistics */
+  uint64_t Blocks;
+  uint64_t Spectra;
+  uint64_t Points;              /* Loose points */
+  uint64_t BytesWritten;
+  uint64_t TornBytes;           /* Cut off on open */
+}EisArc_Type;
+
+/* Read only view of a block, pointers into the mapped data file */
+typedef struct
+{
+  const EisArcBlockHdr_Type *pHdr;
+  uint32_t Kind;
+  uint32_t Count;
+  uint32_t Points;              /* Per spectrum */
+  const float *pFreq;           /* Plan grid for spectra, one per point otherwise */
+  const uint64_t *pTime;
+  const uint32_t *pDuration;    /* Spectra only */
+  const uint16_t *pSweep;       /* Points only */
+  const uint16_t *pChannel;
+  const float *pReal;
+  const float *pImage;
+}EisArcView_Type;
+
+/* Reader, maps the files and never writes */
+typedef struct
+{
+  const uint8_t *pData;
+  size_t DataSize;
+  const uint8_t *pIndexMap;
+  size_t IndexMapSize;
+  const EisArcIndex_Type *pIndex;
+  uint32_t Entries;             /* Entries whose blocks are complete */
+  uint32_t Sorted;
+  uint64_t MaxSpanUs;
+  const char *pDevMap;
+  size_t DevMapSize;
+  uint32_t DevCount;
+  const uint8_t *pPlanMap;
+  size_t PlanMapSize;
+  const EisArcPlanHdr_Type **ppPlan;
+  uint32_t PlanCount;
+}EisArcReader_Type;
+
+void EisArcLayout(uint32_t Kind, uint32_t Count, uint32_t Points, EisArcLayout_Type *pLayout);
+
+int  EisArcOpen(EisArc_Type *pArc, const char *Dir);
+void EisArcClose(EisArc_Type *pArc);
+int  EisArcDevice(EisArc_Type *pArc, const char *Id, uint32_t *pDevice);
+int  EisArcPlan(EisArc_Type *pArc, const float *pFreq, uint32_t Points, uint32_t *pPlan);
+const float *EisArcPlanFreq(EisArc_Type *pArc, uint32_t Plan, uint32_t *pPoints);
+int  EisArcAppend(EisArc_Type *pArc, const EisArcBlock_Type *pBlock);
+int  EisArcAppendSpectra(EisArc_Type *pArc, const EisArcSpectra_Type *pSpectra);
+int  EisArcSync(EisArc_Type *pArc);
+int  EisArcCompact(EisArc_Type *pArc);
+
+int  EisArcReaderOpen(EisArcReader_Type *pRd, const char *Dir);
+void EisArcReaderClose(EisArcReader_Type *pRd);
+int  EisArcReaderDevice(const EisArcReader_Type *pRd, const char *Id);
+const char *EisArcReaderDeviceId(const EisArcReader_Type *pRd, uint32_t Device);
+uint32_t EisArcQuery(const EisArcReader_Type *pRd, uint32_t Device, uint64_t From, uint64_t To,
+                     const EisArcIndex_Type **ppOut, uint32_t Max);
+int  EisArcView(const EisArcReader_Type *pRd, const EisArcIndex_Type *pEntry, EisArcView_Type *pView);
+
+#endif
@@ -0,0 +1,571 @@
+/*!
+ *****************************************************************************
+ @file:    EisDRT.c
+ @brief:   Distribution of relaxation times of impedance spectra.
+ -----------------------------------------------------------------------------
+
+*****************************************************************************/
+#include "EisDRT.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#define EISDRT_MATH_PI        3.14159265358979323846
+#define EISDRT_COL_TAU        2       /* First gamma column, after R_inf and L */
+#define EISDRT_RIDGE          1e-12   /* Relative damping, keeps the factorization defined */
+#define EISDRT_BATCH_CHUNK    16      /* Jobs a thread takes at a time */
+
+static double EisDRTLambda(uint32_t i)
+{
+  return EISDRT_LAMBDA_MIN*pow(10, i*0.5);
+}
+
+/* Cholesky factor of symmetric positive definite A in place, lower triangle */
+static int EisDRTChol(double *pA, uint32_t P)
+{
+  uint32_t i, j, k;
+  double s;
+
+  for(j=0; j<P; j++)
+  {
+    s = pA[j*P + j];
+    for(k=0; k<j; k++)
+      s -= pA[j*P + k]*pA[j*P + k];
+    if(!(s > 0))
+      return -1;
+    pA[j*P + j] = sqrt(s);
+    for(i=j+1; i<P; i++)
+    {
+      s = pA[i*P + j];
+      for(k=0; k<j; k++)
+        s -= pA[i*P + k]*pA[j*P + k];
+      pA[i*P + j] = s/pA[j*P + j];
+    }
+  }
+  return 0;
+}
+
+/* Solve L L' x = b with the factor of EisDRTChol(), b is overwritten by x */
+static void EisDRTCholSolve(const double *pL, double *pX, uint32_t P)
+{
+  uint32_t i, k;
+  double s;
+
+  for(i=0; i<P; i++)
+  {
+    s = pX[i];
+    for(k=0; k<i; k++)
+      s -= pL[i*P + k]*pX[k];
+    pX[i] = s/pL[i*P + i];
+  }
+  for(i=P; i-- > 0;)
+  {
+    s = pX[i];
+    for(k=i+1; k<P; k++)
+      s -= pL[k*P + i]*pX[k];
+    pX[i] = s/pL[i*P + i];
+  }
+}
+
+/* H = A'A + lambda D'D, damped */
+static void EisDRTHessian(const double *pAtA, const double *pDtD, uint32_t C, double Lambda, double *pH)
+{
+  double dmax = 0;
+  uint32_t k;
+
+  for(k=0; k<C*C; k++)
+    pH[k] = pAtA[k] + Lambda*pDtD[k];
+  for(k=0; k<C; k++)
+    dmax = pH[k*C + k] > dmax ? pH[k*C + k] : dmax;
+  for(k=0; k<C; k++)
+    pH[k*C + k] += EISDRT_RIDGE*dmax + 1e-300;
+}
+
+/* Factor of H for Lambda and trace of the influence matrix A H^-1 A' */
+static int EisDRTFactor(const double *pAtA, const double *pDtD, uint32_t C, double Lambda,
+                        double *pChol, double *pTrace, double *pWork)
+{
+  uint32_t j, k;
+
+  EisDRTHessian(pAtA, pDtD, C, Lambda, pChol);
+  if(EisDRTChol(pChol, C) != 0)
+    return -1;
+  /* tr(H^-1 A'A), one column at a time */
+  *pTrace = 0;
+  for(j=0; j<C; j++)
+  {
+    for(k=0; k<C; k++)
+      pWork[k] = pAtA[k*C + j];
+    EisDRTCholSolve(pChol, pWork, C);
+    *pTrace += pWork[j];
+  }
+  return 0;
+}
+
+/* A'A of the rows of valid points, pValid NULL for all */
+static void EisDRTGram(const EisDRTPlan_Type *pPlan, const uint8_t *pValid, double *pAtA)
+{
+  const uint32_t C = pPlan->Cols;
+  uint32_t n, k, l;
+
+  memset(pAtA, 0, C*C*sizeof(double));
+  for(n=0; n<pPlan->Points; n++)
+  {
+    const double *pRe = &pPlan->pA[(size_t)n*2*C], *pIm = pRe + C;
+    if(pValid && !pValid[n])
+      continue;
+    for(k=0; k<C; k++)
+      for(l=0; l<=k; l++)
+        pAtA[k*C + l] += pRe[k]*pRe[l] + pIm[k]*pIm[l];
+  }
+  for(k=0; k<C; k++)
+    for(l=0; l<k; l++)
+      pAtA[l*C + k] = pAtA[k*C + l];
+}
+
+/**
+ * @brief Compute the solver matrices for a frequency plan.
+ * @param Tau: Tau values, 0 for EISDRT_PER_DECADE per decade, at most EISDRT_MAX_TAU.
+ * @return 0 on success, -1 if frequencies are not positive, not at least
+ *         two different ones, or out of memory.
+*/
+int EisDRTPlanInit(EisDRTPlan_Type *pPlan, const float *pFreq, uint32_t Points, uint32_t Tau)
+{
+  double w_min = INFINITY, w_max = 0, w, wt, ln_lo, *pWork;
+  uint32_t C, n, k, i;
+
+  memset(pPlan, 0, sizeof(*pPlan));
+  for(n=0; n<Points; n++)
+  {
+    if(!(pFreq[n] > 0))
+      return -1;
+    w = 2*EISDRT_MATH_PI*pFreq[n];
+    w_min = w < w_min ? w : w_min;
+    w_max = w > w_max ? w : w_max;
+  }
+  if(!(w_max > w_min))
+    return -1;
+  if(Tau == 0)
+    Tau = (uint32_t)ceil((log10(w_max/w_min) + 2)*EISDRT_PER_DECADE) + 1;
+  if(Tau > EISDRT_MAX_TAU)
+    Tau = EISDRT_MAX_TAU;
+  if(Tau < 3)
+    Tau = 3;
+  C = Tau + EISDRT_COL_TAU;
+  pPlan->Points = Points;
+  pPlan->Tau = Tau;
+  pPlan->Cols = C;
+  pPlan->WMax = w_max;
+  pPlan->pTau = malloc(Tau*sizeof(double));
+  pPlan->pA = malloc((size_t)Points*2*C*sizeof(double));
+  pPlan->pAtA = malloc(C*C*sizeof(double));
+  pPlan->pDtD = calloc(C*C, sizeof(double));
+  pPlan->pChol = malloc((size_t)EISDRT_LAMBDAS*C*C*sizeof(double));
+  pWork = malloc(C*sizeof(double));
+  if(!pPlan->pTau || !pPlan->pA || !pPlan->pAtA || !pPlan->pDtD || !pPlan->pChol || !pWork)
+  {
+    free(pWork);
+    EisDRTPlanFree(pPlan);
+    return -1;
+  }
+  /* A decade beyond the measured range on both sides */
+  ln_lo = -log(w_max) - log(10);
+  pPlan->LnStep = (log(w_max/w_min) + 2*log(10))/(Tau - 1);
+  for(k=0; k<Tau; k++)
+    pPlan->pTau[k] = exp(ln_lo + k*pPlan->LnStep);
+  for(n=0; n<Points; n++)
+  {
+    double *pRe = &pPlan->pA[(size_t)n*2*C], *pIm = pRe + C;
+    w = 2*EISDRT_MATH_PI*pFreq[n];
+    pRe[0] = 1;             pIm[0] = 0;
+    pRe[1] = 0;             pIm[1] = w/w_max;
+    for(k=0; k<Tau; k++)
+    {
+      wt = w*pPlan->pTau[k];
+      pRe[EISDRT_COL_TAU + k] = pPlan->LnStep/(1 + wt*wt);
+      pIm[EISDRT_COL_TAU + k] = -pPlan->LnStep*wt/(1 + wt*wt);
+    }
+  }
+  EisDRTGram(pPlan, NULL, pPlan->pAtA);
+  /* Second differences of gamma */
+  for(k=1; k+1<Tau; k++)
+  {
+    const uint32_t c[3] = {EISDRT_COL_TAU + k - 1, EISDRT_COL_TAU + k, EISDRT_COL_TAU + k + 1};
+    const double d[3] = {1, -2, 1};
+    uint32_t a, b;
+    for(a=0; a<3; a++)
+      for(b=0; b<3; b++)
+        pPlan->pDtD[c[a]*C + c[b]] += d[a]*d[b];
+  }
+  for(i=0; i<EISDRT_LAMBDAS; i++)
+  {
+    if(EisDRTFactor(pPlan->pAtA, pPlan->pDtD, C, EisDRTLambda(i), &pPlan->pChol[(size_t)i*C*C],
+                    &pPlan->Trace[i], pWork) != 0)
+    {
+      free(pWork);
+      EisDRTPlanFree(pPlan);
+      return -1;
+    }
+  }
+  free(pWork);
+  return 0;
+}
+
+void EisDRTPlanFree(EisDRTPlan_Type *pPlan)
+{
+  free(pPlan->pTau);
+  free(pPlan->pA);
+  free(pPlan->pAtA);
+  free(pPlan->pDtD);
+  free(pPlan->pChol);
+  memset(pPlan, 0, sizeof(*pPlan));
+}
+
+/* x'Hx - 2x'b, cost of the quadratic problem without the constant */
+static double EisDRTCost(const double *pH, const double *pB, const double *pX, uint32_t C)
+{
+  double cost = 0, hx;
+  uint32_t k, l;
+
+  for(k=0; k<C; k++)
+  {
+    hx = 0;
+    for(l=0; l<C; l++)
+      hx += pH[k*C + l]*pX[l];
+    cost += pX[k]*(hx - 2*pB[k]);
+  }
+  return cost;
+}
+
+/**
+ * @brief min x'Hx/2 - b'x subject to x >= 0, active set (Bro and de Jong fast NNLS).
+ * @param pPassive: Variables to try free first, e.g. the positive ones of
+ *                  the unconstrained solution. Returns the free variables.
+ * @param pWork: C*C + 5*C doubles.
+ * @return Active set changes, or -1 if a subproblem is singular.
+*/
+static int EisDRTNnls(const double *pH, const double *pB, uint32_t C, double *pX, uint8_t *pPassive,
+                      double *pWork, bool *pbDone)
+{
+  double *pSub = pWork, *pS = pSub + C*C, *pW = pS + C, *pRhs = pW + C;
+  uint32_t *pIdx = (uint32_t*)(pRhs + C);
+  double tol = 0, alpha, wmax;
+  uint32_t p, i, j, k, jmax, max_iter = 3*C;
+  int iter = 0;
+
+  for(k=0; k<C; k++)
+  {
+    pX[k] = 0;
+    pW[k] = pB[k];
+    tol = fabs(pB[k]) > tol ? fabs(pB[k]) : tol;
+  }
+  tol *= 1e-10;
+  *pbDone = false;
+  /* From x = 0 the first pass drops the guessed variables that come out negative */
+  for(k=0; k<C && !pPassive[k]; k++);
+  jmax = k;
+  while((uint32_t)iter < max_iter)
+  {
+    if(jmax == C)
+    {
+      wmax = tol;
+      for(k=0; k<C; k++)
+      {
+        if(!pPassive[k] && pW[k] > wmax)
+        {
+          wmax = pW[k];
+          jmax = k;
+        }
+      }
+      if(jmax == C)
+      {
+        *pbDone = true;
+        break;
+      }
+      pPassive[jmax] = 1;
+    }
+    jmax = C;
+    for(;;)
+    {
+      /* Unconstrained solution over the passive set */
+      for(p=0, k=0; k<C; k++)
+        if(pPassive[k])
+          pIdx[p++] = k;
+      for(i=0; i<p; i++)
+      {
+        for(j=0; j<p; j++)
+          pSub[i*p + j] = pH[pIdx[i]*C + pIdx[j]];
+        pRhs[i] = pB[pIdx[i]];
+      }
+      if(EisDRTChol(pSub, p) != 0)
+        return -1;
+      EisDRTCholSolve(pSub, pRhs, p);
+      for(k=0; k<C; k++)
+        pS[k] = 0;
+      for(i=0; i<p; i++)
+        pS[pIdx[i]] = pRhs[i];
+      iter++;
+      for(i=0; i<p && pRhs[i] > 0; i++);
+      if(i == p || (uint32_t)iter >= max_iter)
+        break;
+      /* Step back to the boundary and drop the variables that reach it */
+      alpha = INFINITY;
+      for(i=0; i<p; i++)
+      {
+        k = pIdx[i];
+        if(pS[k] <= 0 && pX[k] - pS[k] > 0 && pX[k]/(pX[k] - pS[k]) < alpha)
+          alpha = pX[k]/(pX[k] - pS[k]);
+      }
+      if(!(alpha < INFINITY))
+        alpha = 0;
+      for(i=0; i<p; i++)
+      {
+        k = pIdx[i];
+        if(pS[k] <= 0 && !(pX[k]/(pX[k] - pS[k]) > alpha*(1 + 1e-12)))
+        {
+          pX[k] = 0;
+          pPassive[k] = 0;
+        }
+        else
+          pX[k] += alpha*(pS[k] - pX[k]);
+      }
+    }
+    for(k=0; k<C; k++)
+      pX[k] = pS[k] > 0 ? pS[k] : 0;
+    for(k=0; k<C; k++)
+    {
+      pW[k] = pB[k];
+      for(j=0; j<C; j++)
+        pW[k] -= pH[k*C + j]*pX[j];
+    }
+  }
+  return iter;
+}
+
+/**
+ * @brief Solve the DRT of the first Points points of a spectrum over the plan.
+ * @param Lambda: Regularization, 0 to choose it by GCV.
+ * @return 0 if solved, -1 if there are too few valid points, the problem
+ *         is singular or out of memory. pResult->Status tells the same.
+*/
+int EisDRT(const EisDRTPlan_Type *pPlan, uint32_t Points, const float *pReal, const float *pImage,
+           double Lambda, EisDRTResult_Type *pResult)
+{
+  const uint32_t C = pPlan->Cols;
+  const double *pAtA = pPlan->pAtA, *pChol = pPlan->pChol, *pTrace = pPlan->Trace;
+  double *pBuff, *pB, *pX, *pH, *pWork, *pLocal = NULL;
+  double trace[EISDRT_LAMBDAS], scale = 0, zz = 0, best = INFINITY, res;
+  uint8_t *pValid, *pPassive;
+  uint32_t valid = 0, n, k, i;
+  bool done;
+  int iter;
+
+  memset(pResult, 0, sizeof(*pResult));
+  pResult->Status = EISDRT_FAIL;
+  if(Points > pPlan->Points)
+    Points = pPlan->Points;
+  pBuff = malloc((3*C + 2*C*C + 4*C + C)*sizeof(double) + 2*pPlan->Points + C);
+  if(pBuff == NULL)
+    return -1;
+  pB = pBuff;
+  pX = pB + C;
+  pH = pX + C;
+  pWork = pH + C*C;
+  pValid = (uint8_t*)(pWork + C*C + 5*C);
+  pPassive = pValid + pPlan->Points;
+  for(n=0; n<pPlan->Points; n++)
+  {
+    double mag = n < Points ? hypot(pReal[n], pImage[n]) : NAN;
+    pValid[n] = isfinite(mag) ? 1 : 0;
+    valid += pValid[n];
+    if(pValid[n] && mag > scale)
+      scale = mag;
+  }
+  if(valid < 3 || !(scale > 0))
+  {
+    free(pBuff);
+    return -1;
+  }
+  memset(pB, 0, C*sizeof(double));
+  for(n=0; n<pPlan->Points; n++)
+  {
+    const double *pRe = &pPlan->pA[(size_t)n*2*C], *pIm = pRe + C;
+    double zr, zi;
+    if(!pValid[n])
+      continue;
+    zr = pReal[n]/scale;
+    zi = pImage[n]/scale;
+    zz += zr*zr + zi*zi;
+    for(k=0; k<C; k++)
+      pB[k] += pRe[k]*zr + pIm[k]*zi;
+  }
+
+  /* Points missing: the cached matrices don't apply */
+  if(valid < pPlan->Points)
+  {
+    pLocal = malloc((C*C + (Lambda > 0 ? 0 : (size_t)EISDRT_LAMBDAS*C*C))*sizeof(double));
+    if(pLocal == NULL)
+    {
+      free(pBuff);
+      return -1;
+    }
+    EisDRTGram(pPlan, pValid, pLocal);
+    pAtA = pLocal;
+    pChol = pLocal + C*C;
+    pTrace = trace;
+    for(i=0; Lambda <= 0 && i<EISDRT_LAMBDAS; i++)
+    {
+      if(EisDRTFactor(pAtA, pPlan->pDtD, C, EisDRTLambda(i), &pLocal[C*C + (size_t)i*C*C], &trace[i], pWork) != 0)
+        trace[i] = NAN;
+    }
+  }
+
+  /* GCV of the unconstrained solution: n |r|^2 / (n - tr)^2 */
+  for(i=0; Lambda <= 0 && i<EISDRT_LAMBDAS; i++)
+  {
+    double gcv, dof = 2.0*valid - pTrace[i];
+    if(!(dof > 0))
+      continue;
+    memcpy(pX, pB, C*sizeof(double));
+    EisDRTCholSolve(&pChol[(size_t)i*C*C], pX, C);
+    /* |Ax - z|^2 = z'z - x'b - lambda |D gamma|^2 as H x = b */
+    res = zz;
+    for(k=0; k<C; k++)
+      res -= pX[k]*pB[k];
+    for(k=EISDRT_COL_TAU + 1; k+1<C; k++)
+      res -= EisDRTLambda(i)*(pX[k-1] - 2*pX[k] + pX[k+1])*(pX[k-1] - 2*pX[k] + pX[k+1]);
+    gcv = 2.0*valid*(res > 0 ? res : 0)/(dof*dof);
+    if(gcv < best)
+    {
+      best = gcv;
+      pResult->Lambda = EisDRTLambda(i);
+      for(k=0; k<C; k++)
+        pPassive[k] = pX[k] > 0;
+    }
+  }
+  if(Lambda > 0)
+  {
+    pResult->Lambda = Lambda;
+    memset(pPassive, 0, C);
+  }
+  if(!(pResult->Lambda > 0))
+  {
+    free(pLocal);
+    free(pBuff);
+    return -1;
+  }
+
+  EisDRTHessian(pAtA, pPlan->pDtD, C, pResult->Lambda, pH);
+  iter = EisDRTNnls(pH, pB, C, pX, pPassive, pWork, &done);
+  if(iter < 0)
+  {
+    free(pLocal);
+    free(pBuff);
+    return -1;
+  }
+  /* Residual of the data term only */
+  EisDRTHessian(pAtA, pPlan->pDtD, C, 0, pH);
+  res = zz + EisDRTCost(pH, pB, pX, C);
+  pResult->ResNorm = sqrt((res > 0 ? res : 0)/(2.0*valid));
+  pResult->RInf = pX[0]*scale;
+  pResult->L = pX[1]*scale/pPlan->WMax;
+  for(k=0; k<pPlan->Tau; k++)
+  {
+    pResult->Gamma[k] = (float)(pX[EISDRT_COL_TAU + k]*scale);
+    pResult->RPol += pX[EISDRT_COL_TAU + k]*scale*pPlan->LnStep;
+  }
+  pResult->Points = valid;
+  pResult->Iter = (uint32_t)iter;
+  pResult->Status = done ? EISDRT_OK : EISDRT_MAXITER;
+  free(pLocal);
+  free(pBuff);
+  return 0;
+}
+
+/**
+ * @brief Impedance of a solved DRT at one frequency.
+*/
+void EisDRTEval(const EisDRTPlan_Type *pPlan, const EisDRTResult_Type *pResult, double Freq,
+                double *pRe, double *pIm)
+{
+  double w = 2*EISDRT_MATH_PI*Freq, wt;
+  uint32_t k;
+
+  *pRe = pResult->RInf;
+  *pIm = w*pResult->L;
+  for(k=0; k<pPlan->Tau; k++)
+  {
+    wt = w*pPlan->pTau[k];
+    *pRe += pResult->Gamma[k]*pPlan->LnStep/(1 + wt*wt);
+    *pIm -= pResult->Gamma[k]*pPlan->LnStep*wt/(1 + wt*wt);
+  }
+}
+
+typedef struct
+{
+  EisDRTJob_Type *pJob;
+  uint32_t Count;
+  double Lambda;
+  pthread_mutex_t Lock;
+  uint32_t Next;
+}EisDRTBatch_Type;
+
+static void *EisDRTWorker(void *pArg)
+{
+  EisDRTBatch_Type *pB = pArg;
+  uint32_t i, end;
+
+  for(;;)
+  {
+    pthread_mutex_lock(&pB->Lock);
+    i = pB->Next;
+    end = i + EISDRT_BATCH_CHUNK < pB->Count ? i + EISDRT_BATCH_CHUNK : pB->Count;
+    pB->Next = end;
+    pthread_mutex_unlock(&pB->Lock);
+    if(i >= pB->Count)
+      break;
+    for(; i<end; i++)
+      EisDRT(pB->pJob[i].pPlan, pB->pJob[i].Points, pB->pJob[i].pReal, pB->pJob[i].pImage, pB->Lambda,
+             &pB->pJob[i].Result);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Solve many spectra in parallel.
+ * @param Lambda: Regularization, 0 to choose it by GCV for each spectrum.
+ * @param Threads: Worker threads, 0 or 1 solves on the calling thread.
+ * @return 0 on success, -1 if threads could not be started.
+*/
+int EisDRTBatch(EisDRTJob_Type *pJob, uint32_t Count, double Lambda, uint32_t Threads)
+{
+  EisDRTBatch_Type b;
+  pthread_t *pThread;
+  uint32_t i, started = 0;
+
+  memset(&b, 0, sizeof(b));
+  b.pJob = pJob;
+  b.Count = Count;
+  b.Lambda = Lambda;
+  pthread_mutex_init(&b.Lock, NULL);
+  if(Threads <= 1)
+  {
+    EisDRTWorker(&b);
+    pthread_mutex_destroy(&b.Lock);
+    return 0;
+  }
+  pThread = malloc(Threads*sizeof(pthread_t));
+  if(pThread == NULL)
+    return -1;
+  for(i=0; i<Threads; i++)
+    if(pthread_create(&pThread[started], NULL, EisDRTWorker, &b) == 0)
+      started++;
+  if(started == 0)
+    EisDRTWorker(&b);
+  for(i=0; i<started; i++)
+    pthread_join(pThread[i], NULL);
+  free(pThread);
+  pthread_mutex_destroy(&b.Lock);
+  return 0;
+}
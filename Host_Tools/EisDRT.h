@@ -0,0 +1,96 @@
+/*!
+ *****************************************************************************
+ @file:    EisDRT.h
+ @brief:   Distribution of relaxation times of impedance spectra.
+ -----------------------------------------------------------------------------
+
+ The spectrum is modelled as
+
+   Z(w) = R_inf + jwL + sum_k gamma_k dlnTau/(1 + jw tau_k)
+
+ with Tau values tau_k log spaced from a decade below 1/w_max to a decade
+ above 1/w_min. gamma (ohm per unit of ln tau), R_inf and L are found by
+ Tikhonov regularized non-negative least squares:
+
+   min |A x - Z|^2 + lambda |D gamma|^2,   x >= 0
+
+ where D is the second derivative of gamma over ln tau. Residuals of all
+ points have the same weight after dividing the spectrum by its largest
+ |Z|, so A and D only depend on the frequencies.
+
+ lambda is chosen per spectrum by generalized cross validation (GCV) of
+ the problem without the sign constraint, over EISDRT_LAMBDAS values
+ from EISDRT_LAMBDA_MIN up in half decades, or given by the caller. The
+ GCV needs a Cholesky factor and a trace per lambda; EisDRTPlanInit()
+ computes them once per frequency plan, so a spectrum then costs a few
+ triangular solves for the choice of lambda and the active set
+ iterations of the non-negative solve. Spectra with NaN points, e.g.
+ lost in transport, are solved over their valid points with matrices
+ made for them, which is much slower.
+
+ EisDRTBatch() solves many spectra on several threads. A plan may be
+ shared by threads.
+
+*****************************************************************************/
+#ifndef _EIS_DRT_H_
+#define _EIS_DRT_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EISDRT_MAX_TAU        160
+#define EISDRT_PER_DECADE     10      /* Tau values per decade if Tau is 0 */
+#define EISDRT_LAMBDAS        13      /* GCV candidates */
+#define EISDRT_LAMBDA_MIN     1e-6
+
+#define EISDRT_OK             0
+#define EISDRT_MAXITER        1       /* Active set did not settle, result is the last feasible one */
+#define EISDRT_FAIL           2       /* Too few valid points or singular problem */
+
+typedef struct
+{
+  uint32_t Points;
+  uint32_t Tau;                 /* Tau values */
+  uint32_t Cols;                /* Tau + R_inf and L */
+  double WMax;
+  double LnStep;                /* dlnTau */
+  double *pTau;                 /* Tau values in s, ascending */
+  double *pA;                   /* Real and imaginary row of each point, Cols values each */
+  double *pAtA;                 /* A'A, Cols x Cols */
+  double *pDtD;                 /* D'D, Cols x Cols, zero for R_inf and L */
+  double *pChol;                /* Cholesky factor of A'A + lambda D'D for each GCV lambda */
+  double Trace[EISDRT_LAMBDAS]; /* Trace of the influence matrix for each GCV lambda */
+}EisDRTPlan_Type;
+
+typedef struct
+{
+  float Gamma[EISDRT_MAX_TAU];  /* Ohm per unit of ln tau, at pPlan->pTau */
+  double RInf;
+  double L;                     /* H */
+  double RPol;                  /* Sum of gamma dlnTau */
+  double Lambda;
+  double ResNorm;               /* RMS of residuals relative to the largest |Z| */
+  uint32_t Points;              /* Used, NaN points are skipped */
+  uint32_t Iter;                /* Active set changes */
+  uint32_t Status;              /* EISDRT_xxx */
+}EisDRTResult_Type;
+
+/* One spectrum of a batch. Columns may point into a mapped archive. */
+typedef struct
+{
+  const EisDRTPlan_Type *pPlan; /* Plan of the frequencies of the spectrum */
+  uint32_t Points;
+  const float *pReal;
+  const float *pImage;
+  void *pUser;                  /* Caller's data, not used by the solver */
+  EisDRTResult_Type Result;
+}EisDRTJob_Type;
+
+int  EisDRTPlanInit(EisDRTPlan_Type *pPlan, const float *pFreq, uint32_t Points, uint32_t Tau);
+void EisDRTPlanFree(EisDRTPlan_Type *pPlan);
+int  EisDRT(const EisDRTPlan_Type *pPlan, uint32_t Points, const float *pReal, const float *pImage,
+            double Lambda, EisDRTResult_Type *pResult);
+void EisDRTEval(const EisDRTPlan_Type *pPlan, const EisDRTResult_Type *pResult, double Freq,
+                double *pRe, double *pIm);
+int  EisDRTBatch(EisDRTJob_Type *pJob, uint32_t Count, double Lambda, uint32_t Threads);
+
+#endif
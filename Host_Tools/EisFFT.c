@@ -0,0 +1,145 @@
+/*!
+ *****************************************************************************
+ @file:    EisFFT.c
+ @brief:   Discrete Fourier transform of any length, mixed radix FFT.
+ -----------------------------------------------------------------------------
+
+*****************************************************************************/
+#include "EisFFT.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define EISFFT_MATH_PI        3.14159265358979323846
+
+/**
+ * @brief Factor the length and compute the twiddle table.
+ * @return 0 on success, -1 if N is 0 or out of memory.
+*/
+int EisFFTPlanInit(EisFFTPlan_Type *pPlan, uint32_t N)
+{
+  uint32_t n, p, k;
+
+  memset(pPlan, 0, sizeof(*pPlan));
+  if(N == 0)
+    return -1;
+  pPlan->N = N;
+  n = N;
+  for(p=2; n > 1; )
+  {
+    if(n%p)
+    {
+      p = p == 2 ? 3 : p + 2;
+      if(p*p > n)
+        p = n;
+      continue;
+    }
+    pPlan->Factor[pPlan->Factors++] = p;
+    pPlan->MaxFactor = p > pPlan->MaxFactor ? p : pPlan->MaxFactor;
+    n /= p;
+  }
+  if(pPlan->Factors == 0)
+    pPlan->Factor[pPlan->Factors++] = 1;
+  pPlan->pTw = malloc((size_t)N*2*sizeof(double));
+  if(pPlan->pTw == NULL)
+    return -1;
+  for(k=0; k<N; k++)
+  {
+    pPlan->pTw[2*k] = cos(2*EISFFT_MATH_PI*k/N);
+    pPlan->pTw[2*k + 1] = -sin(2*EISFFT_MATH_PI*k/N);
+  }
+  return 0;
+}
+
+void EisFFTPlanFree(EisFFTPlan_Type *pPlan)
+{
+  free(pPlan->pTw);
+  memset(pPlan, 0, sizeof(*pPlan));
+}
+
+/* DFT of the N/Stride values In[0], In[Stride], .. into Out, factors from pFactor on */
+static void EisFFTStep(const EisFFTPlan_Type *pPlan, const double *pIn, double *pOut, uint32_t Stride,
+                       const uint32_t *pFactor, double *pTmp)
+{
+  const double *tw = pPlan->pTw;
+  uint32_t N = pPlan->N, n = N/Stride, p = pFactor[0], m = n/p;
+  uint32_t j, k, q, t;
+  double re, im, wr, wi;
+
+  if(m == 1)
+  {
+    for(j=0; j<p; j++)
+    {
+      pOut[2*j] = pIn[2*(size_t)j*Stride];
+      pOut[2*j + 1] = pIn[2*(size_t)j*Stride + 1];
+    }
+  }
+  else
+  {
+    for(j=0; j<p; j++)
+      EisFFTStep(pPlan, pIn + 2*(size_t)j*Stride, pOut + 2*(size_t)j*m, Stride*p, pFactor + 1, pTmp);
+  }
+  if(p == 1)
+    return;
+
+  /* Out[j*m + k] is value k of sub-transform j. Combine the p of them for each k */
+  for(k=0; k<m; k++)
+  {
+    if(p == 2)
+    {
+      double *a = pOut + 2*k, *b = pOut + 2*(k + m);
+      t = k*Stride;
+      wr = tw[2*t];
+      wi = tw[2*t + 1];
+      re = b[0]*wr - b[1]*wi;
+      im = b[0]*wi + b[1]*wr;
+      b[0] = a[0] - re;
+      b[1] = a[1] - im;
+      a[0] += re;
+      a[1] += im;
+      continue;
+    }
+    for(j=0; j<p; j++)
+    {
+      double *x = pOut + 2*((size_t)j*m + k);
+      t = (uint32_t)(((uint64_t)j*k*Stride)%N);
+      pTmp[2*j] = x[0]*tw[2*t] - x[1]*tw[2*t + 1];
+      pTmp[2*j + 1] = x[0]*tw[2*t + 1] + x[1]*tw[2*t];
+    }
+    for(q=0; q<p; q++)
+    {
+      re = pTmp[0];
+      im = pTmp[1];
+      for(j=1, t=0; j<p; j++)
+      {
+        t += q*(N/p);
+        if(t >= N)
+          t %= N;
+        re += pTmp[2*j]*tw[2*t] - pTmp[2*j + 1]*tw[2*t + 1];
+        im += pTmp[2*j]*tw[2*t + 1] + pTmp[2*j + 1]*tw[2*t];
+      }
+      pOut[2*((size_t)q*m + k)] = re;
+      pOut[2*((size_t)q*m + k) + 1] = im;
+    }
+  }
+}
+
+/**
+ * @brief Transform pPlan->N complex values. pIn and pOut must not overlap.
+ * @return 0 on success, -1 if out of memory.
+*/
+int EisFFT(const EisFFTPlan_Type *pPlan, const double *pIn, double *pOut)
+{
+  double tmp[2*EISFFT_STACK_RADIX], *pTmp = tmp;
+
+  if(pPlan->MaxFactor > EISFFT_STACK_RADIX)
+  {
+    pTmp = malloc((size_t)pPlan->MaxFactor*2*sizeof(double));
+    if(pTmp == NULL)
+      return -1;
+  }
+  EisFFTStep(pPlan, pIn, pOut, 1, pPlan->Factor, pTmp);
+  if(pTmp != tmp)
+    free(pTmp);
+  return 0;
+}
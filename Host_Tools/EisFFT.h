@@ -0,0 +1,43 @@
+/*!
+ *****************************************************************************
+ @file:    EisFFT.h
+ @brief:   Discrete Fourier transform of any length, mixed radix FFT.
+ -----------------------------------------------------------------------------
+
+ Broadband records are a whole number of excitation periods, and a period
+ is whatever number of samples the ADC rate gives (e.g. 250 at 250SPS and
+ 1Hz), so lengths are rarely a power of two. N is factored into 2, 3, 5
+ and larger primes, and the transform is computed recursively, decimation
+ in time, with twiddles from a table made once per length by
+ EisFFTPlanInit(). Cost is O(N * sum of factors): fast for lengths with
+ small factors, O(N^2) for a prime N.
+
+ Data is interleaved complex, real and imaginary part of each value.
+
+   X[k] = sum_n x[n] exp(-2 pi j n k/N)
+
+ EisFFT() needs no allocation as long as no factor is above
+ EISFFT_STACK_RADIX. A plan may be shared by threads.
+
+*****************************************************************************/
+#ifndef _EIS_FFT_H_
+#define _EIS_FFT_H_
+#include <stdint.h>
+
+#define EISFFT_MAX_FACTORS    32
+#define EISFFT_STACK_RADIX    64      /* Larger prime factors take a heap buffer in EisFFT() */
+
+typedef struct
+{
+  uint32_t N;
+  uint32_t Factors;
+  uint32_t Factor[EISFFT_MAX_FACTORS];
+  uint32_t MaxFactor;
+  double *pTw;                  /* exp(-2 pi j k/N), k = 0..N-1, interleaved */
+}EisFFTPlan_Type;
+
+int  EisFFTPlanInit(EisFFTPlan_Type *pPlan, uint32_t N);
+void EisFFTPlanFree(EisFFTPlan_Type *pPlan);
+int  EisFFT(const EisFFTPlan_Type *pPlan, const double *pIn, double *pOut);
+
+#endif
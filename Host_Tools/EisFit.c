@@ -0,0 +1,574 @@
+/*!
+ *****************************************************************************
+ @file:    EisFit.c
+ @brief:   Equivalent circuit fitting of impedance spectra.
+ -----------------------------------------------------------------------------
+
+*****************************************************************************/
+#include "EisFit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <pthread.h>
+
+#define EISFIT_LAMBDA_INIT    1e-3
+#define EISFIT_LAMBDA_MAX     1e12
+#define EISFIT_STEP_TOL       1e-9
+#define EISFIT_MATH_PI        3.14159265358979323846
+
+typedef struct
+{
+  const char *p;
+  EisFitCircuit_Type *pCircuit;
+  uint32_t Depth;               /* Current evaluation stack depth */
+  char *pErr;
+  uint32_t ErrLen;
+}EisFitParser_Type;
+
+/* Number of parameters of an element, 0 if unknown */
+static uint32_t EisFitElemParams(char Elem)
+{
+  switch(Elem)
+  {
+    case 'R': case 'C': case 'L': case 'W': return 1;
+    case 'E': return 2;
+    default: return 0;
+  }
+}
+
+static int EisFitError(EisFitParser_Type *pP, const char *Msg)
+{
+  if(pP->pErr && pP->ErrLen)
+    snprintf(pP->pErr, pP->ErrLen, "%s at '%.16s'", Msg, pP->p);
+  return -1;
+}
+
+static int EisFitAddNode(EisFitParser_Type *pP, uint8_t Op, char Elem, uint8_t Param, uint8_t Count)
+{
+  EisFitCircuit_Type *pC = pP->pCircuit;
+
+  if(pC->NodeCount == EISFIT_MAX_NODE)
+    return EisFitError(pP, "circuit too large");
+  pC->Node[pC->NodeCount].Op = Op;
+  pC->Node[pC->NodeCount].Elem = Elem;
+  pC->Node[pC->NodeCount].Param = Param;
+  pC->Node[pC->NodeCount].Count = Count;
+  pC->NodeCount++;
+  /* Elements push one value, series and parallel replace Count by one */
+  pP->Depth = Op == EISFIT_NODE_ELEM ? pP->Depth + 1 : pP->Depth - Count + 1;
+  if(pP->Depth > pC->Depth)
+    pC->Depth = pP->Depth;
+  return 0;
+}
+
+static void EisFitSpace(EisFitParser_Type *pP)
+{
+  while(*pP->p == ' ' || *pP->p == '\t')
+    pP->p++;
+}
+
+static int EisFitParseExpr(EisFitParser_Type *pP)
+{
+  uint32_t count = 0, n;
+  char c;
+
+  EisFitSpace(pP);
+  c = *pP->p;
+  if((c == 's' || c == 'p') && pP->p[1] == '(')
+  {
+    pP->p += 2;
+    for(;;)
+    {
+      if(EisFitParseExpr(pP) != 0)
+        return -1;
+      count++;
+      EisFitSpace(pP);
+      if(*pP->p == ',')
+        pP->p++;
+      else if(*pP->p == ')')
+        break;
+      else
+        return EisFitError(pP, "expected ',' or ')'");
+    }
+    pP->p++;
+    if(count > 255)
+      return EisFitError(pP, "too many branches");
+    return EisFitAddNode(pP, c == 's' ? EISFIT_NODE_SERIES : EISFIT_NODE_PARALLEL, 0, 0, count);
+  }
+  n = EisFitElemParams(c);
+  if(n == 0)
+    return EisFitError(pP, "unknown element");
+  pP->p++;
+  if(*pP->p < '0' || *pP->p > '9' || (uint32_t)strtoul(pP->p, NULL, 10) != n)
+    return EisFitError(pP, "wrong parameter count of element");
+  while(*pP->p >= '0' && *pP->p <= '9')
+    pP->p++;
+  if(pP->pCircuit->ParamCount + n > EISFIT_MAX_PARAM)
+    return EisFitError(pP, "too many parameters");
+  if(EisFitAddNode(pP, EISFIT_NODE_ELEM, c, pP->pCircuit->ParamCount, 0) != 0)
+    return -1;
+  pP->pCircuit->ParamCount += n;
+  return 0;
+}
+
+/**
+ * @brief Compile circuit string, e.g. "s(R1,p(R1,C1))".
+ * @param pErr: Receives a message on error, may be NULL.
+ * @return 0 on success, -1 on syntax error.
+*/
+int EisFitParse(const char *Str, EisFitCircuit_Type *pCircuit, char *pErr, uint32_t ErrLen)
+{
+  EisFitParser_Type p;
+
+  memset(pCircuit, 0, sizeof(*pCircuit));
+  memset(&p, 0, sizeof(p));
+  p.p = Str;
+  p.pCircuit = pCircuit;
+  p.pErr = pErr;
+  p.ErrLen = ErrLen;
+  if(EisFitParseExpr(&p) != 0)
+    return -1;
+  EisFitSpace(&p);
+  if(*p.p)
+    return EisFitError(&p, "unexpected text");
+  return 0;
+}
+
+/**
+ * @brief Impedance of circuit and, if pdZ is not NULL, its derivatives.
+ * @param pdZ: Receives dZ/dParam[k] for every parameter.
+*/
+static double complex EisFitZ(const EisFitCircuit_Type *pCircuit, const double *pParam, double Omega,
+                              double complex *pdZ)
+{
+  double complex z[EISFIT_MAX_NODE], dz[EISFIT_MAX_NODE][EISFIT_MAX_PARAM];
+  uint32_t P = pCircuit->ParamCount, sp = 0, i, j, k;
+  double complex jw = I*Omega;
+
+  for(i=0; i<pCircuit->NodeCount; i++)
+  {
+    const EisFitNode_Type *pNode = &pCircuit->Node[i];
+    const double *p = &pParam[pNode->Param];
+    double complex *pd;
+
+    if(pNode->Op == EISFIT_NODE_ELEM)
+    {
+      pd = dz[sp];
+      if(pdZ)
+        memset(pd, 0, P*sizeof(double complex));
+      switch(pNode->Elem)
+      {
+        case 'R':
+          z[sp] = p[0];
+          if(pdZ) pd[pNode->Param] = 1;
+          break;
+        case 'C':
+          z[sp] = 1/(jw*p[0]);
+          if(pdZ) pd[pNode->Param] = -z[sp]/p[0];
+          break;
+        case 'L':
+          z[sp] = jw*p[0];
+          if(pdZ) pd[pNode->Param] = jw;
+          break;
+        case 'E':
+          z[sp] = 1/(p[0]*cpow(jw, p[1]));
+          if(pdZ)
+          {
+            pd[pNode->Param] = -z[sp]/p[0];
+            pd[pNode->Param + 1] = -z[sp]*(log(Omega) + I*EISFIT_MATH_PI/2);
+          }
+          break;
+        case 'W':
+          z[sp] = p[0]*(1 - I)/sqrt(Omega);
+          if(pdZ) pd[pNode->Param] = (1 - I)/sqrt(Omega);
+          break;
+      }
+      sp++;
+      continue;
+    }
+    /* Combine the top Count values */
+    sp -= pNode->Count;
+    if(pNode->Op == EISFIT_NODE_SERIES)
+    {
+      for(j=1; j<pNode->Count; j++)
+      {
+        z[sp] += z[sp + j];
+        if(pdZ)
+          for(k=0; k<P; k++)
+            dz[sp][k] += dz[sp + j][k];
+      }
+    }
+    else
+    {
+      double complex y = 0, zp;
+      for(j=0; j<pNode->Count; j++)
+        y += 1/z[sp + j];
+      zp = 1/y;
+      if(pdZ)
+      {
+        /* dZ = Z^2 sum(dZk/Zk^2) */
+        for(k=0; k<P; k++)
+        {
+          double complex s = 0;
+          for(j=0; j<pNode->Count; j++)
+            s += dz[sp + j][k]/(z[sp + j]*z[sp + j]);
+          dz[sp][k] = zp*zp*s;
+        }
+      }
+      z[sp] = zp;
+    }
+    sp++;
+  }
+  if(pdZ)
+    memcpy(pdZ, dz[0], P*sizeof(double complex));
+  return z[0];
+}
+
+void EisFitEval(const EisFitCircuit_Type *pCircuit, const double *pParam, double Freq,
+                double *pRe, double *pIm)
+{
+  double complex z = EisFitZ(pCircuit, pParam, 2*EISFIT_MATH_PI*Freq, NULL);
+  *pRe = creal(z);
+  *pIm = cimag(z);
+}
+
+/**
+ * @brief Default options: fitP weighting, bounds from 1% to 100x of the
+ *        initial guess as in FitModel() of EISApp.m.
+*/
+void EisFitOptInit(EisFitOpt_Type *pOpt, const EisFitCircuit_Type *pCircuit, const double *pInit)
+{
+  uint32_t i;
+
+  memset(pOpt, 0, sizeof(*pOpt));
+  pOpt->Weight = EISFIT_WEIGHT_PROP;
+  pOpt->MaxIter = 500;
+  pOpt->Tol = 1e-10;
+  for(i=0; i<pCircuit->ParamCount; i++)
+  {
+    double a = pInit[i]*0.01, b = pInit[i]*100;
+    pOpt->Init[i] = pInit[i];
+    pOpt->Lower[i] = a < b ? a : b;
+    pOpt->Upper[i] = a < b ? b : a;
+  }
+}
+
+typedef struct
+{
+  const EisFitCircuit_Type *pCircuit;
+  uint32_t N;
+  uint32_t P;
+  const double *pOmega;
+  const double *pZr;
+  const double *pZi;
+  const double *pW;             /* Residual weight per point */
+  bool bLog[EISFIT_MAX_PARAM];  /* Parameter fitted on log scale */
+}EisFitProblem_Type;
+
+static void EisFitParam(const EisFitProblem_Type *pPb, const double *pX, double *pParam)
+{
+  uint32_t k;
+  for(k=0; k<pPb->P; k++)
+    pParam[k] = pPb->bLog[k] ? exp(pX[k]) : pX[k];
+}
+
+/* Cost at x, with gradient g = J'r and A = J'J if pA is not NULL */
+static double EisFitCost(const EisFitProblem_Type *pPb, const double *pX, double *pA, double *pG)
+{
+  double param[EISFIT_MAX_PARAM], jr[EISFIT_MAX_PARAM], ji[EISFIT_MAX_PARAM];
+  double complex dz[EISFIT_MAX_PARAM], z;
+  double cost = 0, rr, ri;
+  uint32_t P = pPb->P, n, k, l;
+
+  EisFitParam(pPb, pX, param);
+  if(pA)
+  {
+    memset(pA, 0, P*P*sizeof(double));
+    memset(pG, 0, P*sizeof(double));
+  }
+  for(n=0; n<pPb->N; n++)
+  {
+    z = EisFitZ(pPb->pCircuit, param, pPb->pOmega[n], pA ? dz : NULL);
+    rr = (creal(z) - pPb->pZr[n])*pPb->pW[n];
+    ri = (cimag(z) - pPb->pZi[n])*pPb->pW[n];
+    cost += rr*rr + ri*ri;
+    if(pA == NULL)
+      continue;
+    for(k=0; k<P; k++)
+    {
+      /* Chain rule for log scale: dr/dlog(p) = p dr/dp */
+      double s = pPb->pW[n]*(pPb->bLog[k] ? param[k] : 1);
+      jr[k] = creal(dz[k])*s;
+      ji[k] = cimag(dz[k])*s;
+      pG[k] += jr[k]*rr + ji[k]*ri;
+    }
+    for(k=0; k<P; k++)
+      for(l=0; l<=k; l++)
+        pA[k*P + l] += jr[k]*jr[l] + ji[k]*ji[l];
+  }
+  if(pA)
+    for(k=0; k<P; k++)
+      for(l=0; l<k; l++)
+        pA[l*P + k] = pA[k*P + l];
+  return isfinite(cost) ? cost : INFINITY;
+}
+
+/* Solve A x = b for symmetric positive definite A by Cholesky, A is overwritten */
+static int EisFitSolve(double *pA, const double *pB, double *pX, uint32_t P)
+{
+  uint32_t i, j, k;
+  double s;
+
+  for(j=0; j<P; j++)
+  {
+    s = pA[j*P + j];
+    for(k=0; k<j; k++)
+      s -= pA[j*P + k]*pA[j*P + k];
+    if(!(s > 0))
+      return -1;
+    pA[j*P + j] = sqrt(s);
+    for(i=j+1; i<P; i++)
+    {
+      s = pA[i*P + j];
+      for(k=0; k<j; k++)
+        s -= pA[i*P + k]*pA[j*P + k];
+      pA[i*P + j] = s/pA[j*P + j];
+    }
+  }
+  for(i=0; i<P; i++)
+  {
+    s = pB[i];
+    for(k=0; k<i; k++)
+      s -= pA[i*P + k]*pX[k];
+    pX[i] = s/pA[i*P + i];
+  }
+  for(i=P; i-- > 0;)
+  {
+    s = pX[i];
+    for(k=i+1; k<P; k++)
+      s -= pA[k*P + i]*pX[k];
+    pX[i] = s/pA[i*P + i];
+  }
+  return 0;
+}
+
+/**
+ * @brief Fit circuit to one spectrum.
+ * @param pStart: Starting parameters, NULL for pOpt->Init.
+ * @param pFreq, pReal, pImage: Spectrum in Hz and ohm. Points with NaN or
+ *        non-positive frequency are skipped.
+ * @return 0 if a result was produced (see pResult->Status), -1 otherwise.
+*/
+int EisFit(const EisFitCircuit_Type *pCircuit, const EisFitOpt_Type *pOpt, const double *pStart,
+           uint32_t Points, const float *pFreq, const float *pReal, const float *pImage,
+           EisFitResult_Type *pResult)
+{
+  EisFitProblem_Type pb;
+  double x[EISFIT_MAX_PARAM], xn[EISFIT_MAX_PARAM], lo[EISFIT_MAX_PARAM], hi[EISFIT_MAX_PARAM];
+  double a[EISFIT_MAX_PARAM*EISFIT_MAX_PARAM], m[EISFIT_MAX_PARAM*EISFIT_MAX_PARAM];
+  double g[EISFIT_MAX_PARAM], d[EISFIT_MAX_PARAM], rhs[EISFIT_MAX_PARAM];
+  double lambda = EISFIT_LAMBDA_INIT, cost, cost_n = 0, mean_r = 0, mean_i = 0, ss_tot = 0, ss_res = 0;
+  double *pBuff;
+  uint32_t P = pCircuit->ParamCount, n, k, l;
+  bool done = false;
+
+  memset(pResult, 0, sizeof(*pResult));
+  pResult->Status = EISFIT_FAIL;
+  pBuff = malloc((size_t)Points*4*sizeof(double));
+  if(pBuff == NULL || P == 0)
+  {
+    free(pBuff);
+    return -1;
+  }
+  memset(&pb, 0, sizeof(pb));
+  pb.pCircuit = pCircuit;
+  pb.P = P;
+  pb.pOmega = pBuff;
+  pb.pZr = pBuff + Points;
+  pb.pZi = pBuff + 2*Points;
+  pb.pW = pBuff + 3*Points;
+  for(n=0; n<Points; n++)
+  {
+    if(!(pFreq[n] > 0) || !isfinite(pReal[n]) || !isfinite(pImage[n]))
+      continue;
+    pBuff[pb.N] = 2*EISFIT_MATH_PI*pFreq[n];
+    pBuff[Points + pb.N] = pReal[n];
+    pBuff[2*Points + pb.N] = pImage[n];
+    pBuff[3*Points + pb.N] = pOpt->Weight == EISFIT_WEIGHT_PROP ? 1/hypot(pReal[n], pImage[n]) : 1;
+    if(isfinite(pBuff[3*Points + pb.N]))
+      pb.N++;
+  }
+  pResult->Points = pb.N;
+  if(pb.N*2 < P)
+  {
+    free(pBuff);
+    return -1;
+  }
+  for(k=0; k<P; k++)
+  {
+    double p0 = pStart ? pStart[k] : pOpt->Init[k];
+    pb.bLog[k] = pOpt->Lower[k] > 0;
+    lo[k] = pb.bLog[k] ? log(pOpt->Lower[k]) : pOpt->Lower[k];
+    hi[k] = pb.bLog[k] ? log(pOpt->Upper[k]) : pOpt->Upper[k];
+    x[k] = pb.bLog[k] ? (p0 > 0 ? log(p0) : lo[k]) : p0;
+    x[k] = x[k] < lo[k] ? lo[k] : x[k] > hi[k] ? hi[k] : x[k];
+  }
+
+  cost = EisFitCost(&pb, x, a, g);
+  while(!done && pResult->Iter < pOpt->MaxIter && isfinite(cost))
+  {
+    pResult->Iter++;
+    /* Raise damping until a step lowers the cost */
+    for(;;)
+    {
+      double dmax = 0;
+      for(k=0; k<P; k++)
+        if(a[k*P + k] > dmax)
+          dmax = a[k*P + k];
+      memcpy(m, a, P*P*sizeof(double));
+      for(k=0; k<P; k++)
+      {
+        m[k*P + k] += lambda*(a[k*P + k] > dmax*1e-12 ? a[k*P + k] : dmax*1e-12 + 1e-300);
+        rhs[k] = -g[k];
+      }
+      /* Hold parameters on a bound that the gradient pushes outwards */
+      for(k=0; k<P; k++)
+      {
+        if(!((x[k] <= lo[k] && g[k] > 0) || (x[k] >= hi[k] && g[k] < 0)))
+          continue;
+        for(l=0; l<P; l++)
+          m[k*P + l] = m[l*P + k] = 0;
+        m[k*P + k] = 1;
+        rhs[k] = 0;
+      }
+      if(EisFitSolve(m, rhs, d, P) == 0)
+      {
+        for(k=0; k<P; k++)
+        {
+          xn[k] = x[k] + d[k];
+          xn[k] = xn[k] < lo[k] ? lo[k] : xn[k] > hi[k] ? hi[k] : xn[k];
+        }
+        cost_n = EisFitCost(&pb, xn, NULL, NULL);
+        if(cost_n < cost)
+          break;
+      }
+      lambda *= 10;
+      if(lambda > EISFIT_LAMBDA_MAX)
+      {
+        /* No step helps: at a minimum, possibly on a bound */
+        done = true;
+        break;
+      }
+    }
+    if(done)
+      break;
+    /* Converged when the cost or the parameters stop changing */
+    done = cost - cost_n <= pOpt->Tol*cost || cost_n == 0;
+    for(k=0; k<P && !done; k++)
+      if(fabs(xn[k] - x[k]) > EISFIT_STEP_TOL*(1 + fabs(x[k])))
+        break;
+    done = done || k == P;
+    memcpy(x, xn, P*sizeof(double));
+    cost = EisFitCost(&pb, x, a, g);
+    lambda = lambda > 1e-12 ? lambda/10 : lambda;
+  }
+
+  EisFitParam(&pb, x, pResult->Param);
+  pResult->Cost = cost;
+  pResult->Status = !isfinite(cost) ? EISFIT_FAIL : done ? EISFIT_OK : EISFIT_MAXITER;
+  for(n=0; n<pb.N; n++)
+  {
+    mean_r += pb.pZr[n];
+    mean_i += pb.pZi[n];
+  }
+  mean_r /= pb.N;
+  mean_i /= pb.N;
+  for(n=0; n<pb.N; n++)
+  {
+    double complex z = EisFitZ(pCircuit, pResult->Param, pb.pOmega[n], NULL);
+    ss_res += (creal(z) - pb.pZr[n])*(creal(z) - pb.pZr[n]) + (cimag(z) - pb.pZi[n])*(cimag(z) - pb.pZi[n]);
+    ss_tot += (pb.pZr[n] - mean_r)*(pb.pZr[n] - mean_r) + (pb.pZi[n] - mean_i)*(pb.pZi[n] - mean_i);
+  }
+  pResult->RSquared = ss_tot > 0 ? 1 - ss_res/ss_tot : 0;
+  free(pBuff);
+  return 0;
+}
+
+typedef struct
+{
+  const EisFitCircuit_Type *pCircuit;
+  const EisFitOpt_Type *pOpt;
+  EisFitJob_Type *pJob;
+  uint32_t Count;
+  pthread_mutex_t Lock;
+  uint32_t Next;                /* First job of next chain to fit */
+}EisFitBatch_Type;
+
+static void *EisFitWorker(void *pArg)
+{
+  EisFitBatch_Type *pB = pArg;
+  uint32_t i, end;
+
+  for(;;)
+  {
+    /* Take a whole chain */
+    pthread_mutex_lock(&pB->Lock);
+    i = pB->Next;
+    for(end=i+1; end<pB->Count && pB->pJob[end].Chain == pB->pJob[i].Chain; end++);
+    pB->Next = end < pB->Count ? end : pB->Count;
+    pthread_mutex_unlock(&pB->Lock);
+    if(i >= pB->Count)
+      break;
+    for(; i<end; i++)
+    {
+      const EisFitResult_Type *pPrev = i > 0 && pB->pJob[i-1].Chain == pB->pJob[i].Chain ? &pB->pJob[i-1].Result : NULL;
+      bool warm = pPrev && pPrev->Status != EISFIT_FAIL;
+      EisFit(pB->pCircuit, pB->pOpt, warm ? pPrev->Param : NULL, pB->pJob[i].Points, pB->pJob[i].pFreq,
+             pB->pJob[i].pReal, pB->pJob[i].pImage, &pB->pJob[i].Result);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Fit many spectra in parallel.
+ * @param pJob: Spectra, those of a chain next to each other and in order.
+ *              Results are stored in the jobs.
+ * @param Threads: Worker threads, 0 or 1 fits on the calling thread.
+ * @return 0 on success, -1 if threads could not be started.
+*/
+int EisFitBatch(const EisFitCircuit_Type *pCircuit, const EisFitOpt_Type *pOpt,
+                EisFitJob_Type *pJob, uint32_t Count, uint32_t Threads)
+{
+  EisFitBatch_Type b;
+  pthread_t *pThread;
+  uint32_t i, started = 0;
+
+  memset(&b, 0, sizeof(b));
+  b.pCircuit = pCircuit;
+  b.pOpt = pOpt;
+  b.pJob = pJob;
+  b.Count = Count;
+  pthread_mutex_init(&b.Lock, NULL);
+  if(Threads <= 1)
+  {
+    EisFitWorker(&b);
+    pthread_mutex_destroy(&b.Lock);
+    return 0;
+  }
+  pThread = malloc(Threads*sizeof(pthread_t));
+  if(pThread == NULL)
+    return -1;
+  for(i=0; i<Threads; i++)
+    if(pthread_create(&pThread[started], NULL, EisFitWorker, &b) == 0)
+      started++;
+  if(started == 0)
+    EisFitWorker(&b);
+  for(i=0; i<started; i++)
+    pthread_join(pThread[i], NULL);
+  free(pThread);
+  pthread_mutex_destroy(&b.Lock);
+  return 0;
+}
@@ -0,0 +1,110 @@
+/*!
+ *****************************************************************************
+ @file:    EisFit.h
+ @brief:   Equivalent circuit fitting of impedance spectra.
+ -----------------------------------------------------------------------------
+
+ Circuits are written like the circuit strings of Zfit, as used by
+ ZfitCircuitStrings in EISApp.m: s(a,b,...) puts elements in series,
+ p(a,b,...) in parallel, and an element is a letter followed by its
+ number of parameters:
+
+   R1   Resistor                   Z = R
+   C1   Capacitor                  Z = 1/(jwC)
+   L1   Inductor                   Z = jwL
+   E2   Constant phase element     Z = 1/(Q(jw)^n), parameters Q, n
+   W1   Semi-infinite Warburg      Z = sigma(1-j)/sqrt(w)
+
+ Parameters are numbered in order of appearance, so s(R1,p(R1,C1)) has
+ Rs, Rct, Cdl.
+
+ The fit is Levenberg-Marquardt on the analytic Jacobian, with parameters
+ kept inside [Lower, Upper]. Parameters with a positive lower bound are
+ fitted on a log scale, which suits values that differ by decades, e.g.
+ ohms and microfarads. EISFIT_WEIGHT_PROP divides residuals by |Z| of the
+ measurement, so every frequency counts alike as with fitP in Zfit.
+
+ EisFitBatch() fits many spectra on several threads. Spectra with the same
+ Chain, e.g. the sweeps of one device, are fitted in order on one thread,
+ each starting from the result of the one before.
+
+*****************************************************************************/
+#ifndef _EIS_FIT_H_
+#define _EIS_FIT_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EISFIT_MAX_PARAM      16
+#define EISFIT_MAX_NODE       48
+
+#define EISFIT_WEIGHT_NONE    0       /* fitNP */
+#define EISFIT_WEIGHT_PROP    1       /* fitP */
+
+#define EISFIT_OK             0       /* Converged */
+#define EISFIT_MAXITER        1       /* Stopped at MaxIter, result is best so far */
+#define EISFIT_FAIL           2       /* No valid points or singular problem */
+
+#define EISFIT_NODE_ELEM      0
+#define EISFIT_NODE_SERIES    1
+#define EISFIT_NODE_PARALLEL  2
+
+/* Node of compiled circuit, in postfix order */
+typedef struct
+{
+  uint8_t Op;                   /* EISFIT_NODE_xxx */
+  char Elem;                    /* Element letter */
+  uint8_t Param;                /* First parameter of element */
+  uint8_t Count;                /* Operands of series and parallel */
+}EisFitNode_Type;
+
+typedef struct
+{
+  EisFitNode_Type Node[EISFIT_MAX_NODE];
+  uint32_t NodeCount;
+  uint32_t ParamCount;
+  uint32_t Depth;               /* Evaluation stack depth */
+}EisFitCircuit_Type;
+
+typedef struct
+{
+  uint32_t Weight;              /* EISFIT_WEIGHT_xxx */
+  uint32_t MaxIter;
+  double Tol;                   /* Stop at this relative decrease of cost */
+  double Init[EISFIT_MAX_PARAM];
+  double Lower[EISFIT_MAX_PARAM];
+  double Upper[EISFIT_MAX_PARAM];
+}EisFitOpt_Type;
+
+typedef struct
+{
+  double Param[EISFIT_MAX_PARAM];
+  double Cost;                  /* Sum of squared weighted residuals */
+  double RSquared;              /* Of complex impedance, as calculateZfitQuality() */
+  uint32_t Points;              /* Used, NaN points are skipped */
+  uint32_t Iter;
+  uint32_t Status;              /* EISFIT_xxx */
+}EisFitResult_Type;
+
+/* One spectrum of a batch. Columns may point into a mapped archive. */
+typedef struct
+{
+  uint32_t Points;
+  const float *pFreq;
+  const float *pReal;
+  const float *pImage;
+  uint64_t Chain;               /* Warm start from previous spectrum of same chain */
+  void *pUser;                  /* Caller's data, not used by the fit */
+  EisFitResult_Type Result;
+}EisFitJob_Type;
+
+int  EisFitParse(const char *Str, EisFitCircuit_Type *pCircuit, char *pErr, uint32_t ErrLen);
+void EisFitEval(const EisFitCircuit_Type *pCircuit, const double *pParam, double Freq,
+                double *pRe, double *pIm);
+void EisFitOptInit(EisFitOpt_Type *pOpt, const EisFitCircuit_Type *pCircuit, const double *pInit);
+int  EisFit(const EisFitCircuit_Type *pCircuit, const EisFitOpt_Type *pOpt, const double *pStart,
+            uint32_t Points, const float *pFreq, const float *pReal, const float *pImage,
+            EisFitResult_Type *pResult);
+int  EisFitBatch(const EisFitCircuit_Type *pCircuit, const EisFitOpt_Type *pOpt,
+                 EisFitJob_Type *pJob, uint32_t Count, uint32_t Threads);
+
+#endif
@@ -0,0 +1,191 @@
+/*!
+ *****************************************************************************
+ @file:    EisKK.c
+ @brief:   Linear Kramers-Kronig test of impedance spectra (Lin-KK).
+ -----------------------------------------------------------------------------
+
+*****************************************************************************/
+#include "EisKK.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define EISKK_MATH_PI         3.14159265358979323846
+#define EISKK_RIDGE           1e-10   /* Relative damping of normal equations, basis columns are close to dependent */
+#define EISKK_COL_RC          3       /* First RC column, after R, L and C */
+
+/**
+ * @brief Compute the basis for a frequency plan.
+ * @param Basis: RC elements, 0 for EISKK_PER_DECADE per decade of the plan.
+ * @return 0 on success, -1 if frequencies are not positive or out of memory.
+*/
+int EisKKPlanInit(EisKKPlan_Type *pPlan, const float *pFreq, uint32_t Points, uint32_t Basis)
+{
+  double w_min = INFINITY, w_max = 0, w, tau, wt;
+  uint32_t n, k;
+  double *pRe, *pIm;
+
+  memset(pPlan, 0, sizeof(*pPlan));
+  for(n=0; n<Points; n++)
+  {
+    if(!(pFreq[n] > 0))
+      return -1;
+    w = 2*EISKK_MATH_PI*pFreq[n];
+    w_min = w < w_min ? w : w_min;
+    w_max = w > w_max ? w : w_max;
+  }
+  if(Points == 0)
+    return -1;
+  if(Basis == 0)
+    Basis = (uint32_t)ceil(log10(w_max/w_min)*EISKK_PER_DECADE) + 1;
+  if(Basis > EISKK_MAX_BASIS)
+    Basis = EISKK_MAX_BASIS;
+  pPlan->Points = Points;
+  pPlan->Basis = Basis;
+  pPlan->Cols = Basis + EISKK_COL_RC;
+  pPlan->pA = malloc((size_t)Points*2*pPlan->Cols*sizeof(double));
+  if(pPlan->pA == NULL)
+    return -1;
+  for(n=0; n<Points; n++)
+  {
+    w = 2*EISKK_MATH_PI*pFreq[n];
+    pRe = &pPlan->pA[(size_t)n*2*pPlan->Cols];
+    pIm = pRe + pPlan->Cols;
+    /* R, L and C, scaled to at most 1 over the plan */
+    pRe[0] = 1;             pIm[0] = 0;
+    pRe[1] = 0;             pIm[1] = w/w_max;
+    pRe[2] = 0;             pIm[2] = -w_min/w;
+    for(k=0; k<Basis; k++)
+    {
+      tau = Basis > 1 ? exp(-log(w_max) + k*log(w_max/w_min)/(Basis - 1)) : 1/sqrt(w_min*w_max);
+      wt = w*tau;
+      pRe[EISKK_COL_RC + k] = 1/(1 + wt*wt);
+      pIm[EISKK_COL_RC + k] = -wt/(1 + wt*wt);
+    }
+  }
+  return 0;
+}
+
+void EisKKPlanFree(EisKKPlan_Type *pPlan)
+{
+  free(pPlan->pA);
+  memset(pPlan, 0, sizeof(*pPlan));
+}
+
+/* Solve A x = b for symmetric positive definite A by Cholesky, A is overwritten */
+static int EisKKSolve(double *pA, double *pX, uint32_t P)
+{
+  uint32_t i, j, k;
+  double s;
+
+  for(j=0; j<P; j++)
+  {
+    s = pA[j*P + j];
+    for(k=0; k<j; k++)
+      s -= pA[j*P + k]*pA[j*P + k];
+    if(!(s > 0))
+      return -1;
+    pA[j*P + j] = sqrt(s);
+    for(i=j+1; i<P; i++)
+    {
+      s = pA[i*P + j];
+      for(k=0; k<j; k++)
+        s -= pA[i*P + k]*pA[j*P + k];
+      pA[i*P + j] = s/pA[j*P + j];
+    }
+  }
+  for(i=0; i<P; i++)
+  {
+    s = pX[i];
+    for(k=0; k<i; k++)
+      s -= pA[i*P + k]*pX[k];
+    pX[i] = s/pA[i*P + i];
+  }
+  for(i=P; i-- > 0;)
+  {
+    s = pX[i];
+    for(k=i+1; k<P; k++)
+      s -= pA[k*P + i]*pX[k];
+    pX[i] = s/pA[i*P + i];
+  }
+  return 0;
+}
+
+/**
+ * @brief Test the first Points points of a spectrum over the plan.
+ * @param Threshold: Largest residual relative to |Z| that passes, e.g. EISKK_THRESHOLD.
+ * @return 0 if the test was done, -1 if there are fewer valid points than basis functions.
+*/
+int EisKKTest(const EisKKPlan_Type *pPlan, uint32_t Points, const float *pReal, const float *pImage,
+              double Threshold, EisKKResult_Type *pResult)
+{
+  const uint32_t C = pPlan->Cols;
+  double m[(EISKK_MAX_BASIS + EISKK_COL_RC)*(EISKK_MAX_BASIS + EISKK_COL_RC)];
+  double x[EISKK_MAX_BASIS + EISKK_COL_RC];
+  double w2, dmax = 0, sum_res = 0, pos = 0, neg = 0;
+  uint32_t n, k, l;
+
+  memset(pResult, 0, sizeof(*pResult));
+  pResult->bPass = true;
+  if(Points > pPlan->Points)
+    Points = pPlan->Points;
+  memset(m, 0, C*C*sizeof(double));
+  memset(x, 0, C*sizeof(double));
+  /* Normal equations of the weighted problem, lower triangle */
+  for(n=0; n<Points; n++)
+  {
+    const double *pRe = &pPlan->pA[(size_t)n*2*C], *pIm = pRe + C;
+    w2 = (double)pReal[n]*pReal[n] + (double)pImage[n]*pImage[n];
+    if(!(w2 > 0) || !isfinite(w2))
+      continue;
+    w2 = 1/w2;
+    pResult->Points++;
+    for(k=0; k<C; k++)
+    {
+      x[k] += (pRe[k]*pReal[n] + pIm[k]*pImage[n])*w2;
+      for(l=0; l<=k; l++)
+        m[k*C + l] += (pRe[k]*pRe[l] + pIm[k]*pIm[l])*w2;
+    }
+  }
+  if(pResult->Points*2 < C)
+    return -1;
+  for(k=0; k<C; k++)
+  {
+    for(l=0; l<k; l++)
+      m[l*C + k] = m[k*C + l];
+    dmax = m[k*C + k] > dmax ? m[k*C + k] : dmax;
+  }
+  for(k=0; k<C; k++)
+    m[k*C + k] += EISKK_RIDGE*dmax + 1e-300;
+  if(EisKKSolve(m, x, C) != 0)
+    return -1;
+
+  for(n=0; n<Points; n++)
+  {
+    const double *pRe = &pPlan->pA[(size_t)n*2*C], *pIm = pRe + C;
+    double zr = 0, zi = 0, mag = hypot(pReal[n], pImage[n]), dr, di;
+    if(!(mag > 0) || !isfinite(mag))
+      continue;
+    for(k=0; k<C; k++)
+    {
+      zr += pRe[k]*x[k];
+      zi += pIm[k]*x[k];
+    }
+    dr = fabs(pReal[n] - zr)/mag;
+    di = fabs(pImage[n] - zi)/mag;
+    sum_res += dr*dr + di*di;
+    pResult->MaxRes = dr > pResult->MaxRes ? dr : pResult->MaxRes;
+    pResult->MaxRes = di > pResult->MaxRes ? di : pResult->MaxRes;
+  }
+  for(k=EISKK_COL_RC; k<C; k++)
+  {
+    if(x[k] < 0)
+      neg -= x[k];
+    else
+      pos += x[k];
+  }
+  pResult->RmsRes = sqrt(sum_res/(2*pResult->Points));
+  pResult->Mu = pos > 0 ? 1 - neg/pos : 0;
+  pResult->bPass = pResult->MaxRes <= Threshold;
+  return 0;
+}
@@ -0,0 +1,57 @@
+/*!
+ *****************************************************************************
+ @file:    EisKK.h
+ @brief:   Linear Kramers-Kronig test of impedance spectra (Lin-KK).
+ -----------------------------------------------------------------------------
+
+ The spectrum is fitted by linear least squares with a fixed basis that is
+ Kramers-Kronig consistent by construction: a series resistance,
+ inductance and capacitance and Basis RC elements R_k/(1 + jw tau_k), tau
+ log spaced from 1/w_max to 1/w_min (Schoenleber et al., Electrochimica
+ Acta 131 (2014) 20-27). Residuals are relative to |Z| of the
+ measurement. A spectrum that is not stationary, or too noisy, leaves
+ residuals the basis can't take up, and fails when the largest of them is
+ above the threshold.
+
+ The basis only depends on the frequencies, so it is computed once per
+ frequency plan with EisKKPlanInit() and kept by the caller, e.g. one per
+ archive plan. EisKKTest() then needs no allocation and takes a few
+ microseconds. A plan may be shared by threads.
+
+ Mu is the measure of over-fitting of the paper, 1 minus the sum of the
+ negative R_k over the sum of the positive ones. It is reported, Basis is
+ not adapted to it.
+
+*****************************************************************************/
+#ifndef _EIS_KK_H_
+#define _EIS_KK_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EISKK_MAX_BASIS       40
+#define EISKK_PER_DECADE      3       /* RC elements per decade of frequency if Basis is 0 */
+#define EISKK_THRESHOLD       0.02    /* Default largest residual relative to |Z| */
+
+typedef struct
+{
+  uint32_t Points;
+  uint32_t Basis;               /* RC elements */
+  uint32_t Cols;                /* Basis + R, L and C */
+  double *pA;                   /* Real and imaginary row of each point, Cols values each */
+}EisKKPlan_Type;
+
+typedef struct
+{
+  double MaxRes;                /* Largest residual of real or imaginary part, relative to |Z| */
+  double RmsRes;
+  double Mu;
+  uint32_t Points;              /* Used, NaN points are skipped */
+  bool bPass;                   /* MaxRes is not above the threshold */
+}EisKKResult_Type;
+
+int  EisKKPlanInit(EisKKPlan_Type *pPlan, const float *pFreq, uint32_t Points, uint32_t Basis);
+void EisKKPlanFree(EisKKPlan_Type *pPlan);
+int  EisKKTest(const EisKKPlan_Type *pPlan, uint32_t Points, const float *pReal, const float *pImage,
+               double Threshold, EisKKResult_Type *pResult);
+
+#endif
@@ -0,0 +1,435 @@
+/*!
+ *****************************************************************************
+ @file:    MqttLite.c
+ @brief:   Minimal MQTT 3.1.1 over TCP for host tools.
+ -----------------------------------------------------------------------------
+
+*****************************************************************************/
+#include "MqttLite.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/**
+ * @brief Connect to a TCP server.
+ * @return Socket, -1 on failure.
+*/
+int MqttTcpOpen(const char *Host, uint16_t Port)
+{
+  struct addrinfo hints, *res, *ai;
+  char port[8];
+  int fd = -1, one = 1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(port, sizeof(port), "%u", Port);
+  if(getaddrinfo(Host, port, &hints, &res) != 0)
+    return -1;
+  for(ai = res; ai; ai = ai->ai_next)
+  {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if(fd < 0)
+      continue;
+    if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if(fd >= 0)
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+/**
+ * @brief Listen for TCP connections on all interfaces.
+ * @return Socket, -1 on failure.
+*/
+int MqttTcpListen(uint16_t Port)
+{
+  struct sockaddr_in addr;
+  int fd, one = 1;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(fd < 0)
+    return -1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(Port);
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Set up connection state for a connected socket, or a file of captured packets.
+ * @param RxSize: Receive buffer size, at least the largest packet expected.
+ * @return -1 if out of memory.
+*/
+int MqttConnInit(MqttConn_Type *pConn, int Fd, uint32_t RxSize)
+{
+  memset(pConn, 0, sizeof(*pConn));
+  pConn->Fd = Fd;
+  pConn->pRx = malloc(RxSize);
+  pConn->RxSize = RxSize;
+  pConn->NextId = 1;
+  return pConn->pRx ? 0 : -1;
+}
+
+void MqttConnClose(MqttConn_Type *pConn)
+{
+  if(pConn->Fd >= 0)
+    close(pConn->Fd);
+  pConn->Fd = -1;
+  free(pConn->pRx);
+  pConn->pRx = NULL;
+}
+
+/**
+ * @brief Read what is available into receive buffer. Blocks if the socket is blocking.
+ * @return Bytes read (1 if a non-blocking socket had none), 0 at end of stream, -1 on error.
+*/
+int MqttFill(MqttConn_Type *pConn)
+{
+  ssize_t n;
+
+  /* Move unread packets to start */
+  if(pConn->RxPos)
+  {
+    memmove(pConn->pRx, pConn->pRx + pConn->RxPos, pConn->RxFill - pConn->RxPos);
+    pConn->RxFill -= pConn->RxPos;
+    pConn->RxPos = 0;
+  }
+  if(pConn->RxFill == pConn->RxSize)
+  {
+    pConn->bError = true;       /* Packet larger than buffer */
+    return -1;
+  }
+  do
+    n = read(pConn->Fd, pConn->pRx + pConn->RxFill, pConn->RxSize - pConn->RxFill);
+  while(n < 0 && errno == EINTR);
+  if(n < 0)
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+  pConn->RxFill += n;
+  return (int)n;
+}
+
+/**
+ * @brief Take next complete packet from receive buffer.
+ * @return false if no complete packet is buffered. Check bError for malformed input.
+*/
+bool MqttNext(MqttConn_Type *pConn, MqttPacket_Type *pPkt)
+{
+  const uint8_t *p = pConn->pRx + pConn->RxPos;
+  uint32_t avail = pConn->RxFill - pConn->RxPos;
+  uint32_t len = 0, shift = 0, i;
+
+  if(avail < 2)
+    return false;
+  /* Remaining length, 1 to 4 bytes of 7 bits */
+  for(i=1;;i++)
+  {
+    if(i > 4)
+    {
+      pConn->bError = true;
+      return false;
+    }
+    if(i >= avail)
+      return false;
+    len |= (uint32_t)(p[i]&0x7F) << shift;
+    shift += 7;
+    if((p[i]&0x80) == 0)
+      break;
+  }
+  if(len > MQTT_MAX_PACKET)
+  {
+    pConn->bError = true;
+    return false;
+  }
+  if(avail < i + 1 + len)
+    return false;
+  pPkt->Type = p[0] >> 4;
+  pPkt->Flags = p[0]&0x0F;
+  pPkt->pBody = p + i + 1;
+  pPkt->Len = len;
+  pConn->RxPos += i + 1 + len;
+  return true;
+}
+
+/**
+ * @brief Block until a packet of given type arrives, for handshakes. Other packets are dropped.
+ * @return 0 on success, -1 on error or end of stream.
+*/
+int MqttWait(MqttConn_Type *pConn, uint8_t Type, MqttPacket_Type *pPkt)
+{
+  while(1)
+  {
+    while(MqttNext(pConn, pPkt))
+      if(pPkt->Type == Type)
+        return 0;
+    if(pConn->bError || MqttFill(pConn) <= 0)
+      return -1;
+  }
+}
+
+static uint16_t MqttGet16(const uint8_t *p)
+{
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/**
+ * @brief Split PUBLISH packet into topic and payload.
+ * @return false if malformed.
+*/
+bool MqttParsePublish(const MqttPacket_Type *pPkt, MqttPublish_Type *pPub)
+{
+  uint32_t pos;
+
+  if(pPkt->Type != MQTT_PKT_PUBLISH || pPkt->Len < 2)
+    return false;
+  pPub->Qos = (pPkt->Flags >> 1)&3;
+  pPub->TopicLen = MqttGet16(pPkt->pBody);
+  pPub->pTopic = (const char*)pPkt->pBody + 2;
+  pos = 2 + pPub->TopicLen;
+  pPub->Id = 0;
+  if(pPub->Qos)
+  {
+    if(pPub->Qos > 1 || pos + 2 > pPkt->Len)
+      return false;
+    pPub->Id = MqttGet16(pPkt->pBody + pos);
+    pos += 2;
+  }
+  if(pos > pPkt->Len)
+    return false;
+  pPub->pPayload = pPkt->pBody + pos;
+  pPub->PayloadLen = pPkt->Len - pos;
+  return true;
+}
+
+/**
+ * @brief Match topic against a filter with + and # wildcards.
+*/
+bool MqttTopicMatch(const char *Filter, const char *pTopic, uint32_t TopicLen)
+{
+  const char *end = pTopic + TopicLen;
+
+  while(*Filter)
+  {
+    if(Filter[0] == '#')
+      return true;
+    if(Filter[0] == '+')
+    {
+      while(pTopic < end && *pTopic != '/')
+        pTopic++;
+      Filter++;
+    }
+    else
+    {
+      if(pTopic == end || *pTopic != *Filter)
+        return false;
+      pTopic++;
+      Filter++;
+    }
+    /* "a/#" also matches "a" */
+    if(pTopic == end && Filter[0] == '/' && Filter[1] == '#')
+      return true;
+  }
+  return pTopic == end;
+}
+
+/* Sockets do not raise SIGPIPE, a capture file is written as is */
+static ssize_t MqttSend(int Fd, const void *pData, size_t Len)
+{
+  ssize_t n = send(Fd, pData, Len, MSG_NOSIGNAL);
+  if(n < 0 && errno == ENOTSOCK)
+    n = write(Fd, pData, Len);
+  return n;
+}
+
+/**
+ * @brief Send transmit buffer.
+ * @return 0 on success, -1 if the connection failed.
+*/
+int MqttFlush(MqttConn_Type *pConn)
+{
+  uint32_t sent = 0;
+  ssize_t n;
+
+  while(sent < pConn->TxFill)
+  {
+    n = MqttSend(pConn->Fd, pConn->Tx + sent, pConn->TxFill - sent);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+    {
+      pConn->bError = true;
+      pConn->TxFill = 0;
+      return -1;
+    }
+    sent += n;
+  }
+  pConn->TxFill = 0;
+  return 0;
+}
+
+/* Append bytes to transmit buffer, large blocks go out directly */
+static int MqttWrite(MqttConn_Type *pConn, const void *pData, uint32_t Len)
+{
+  const uint8_t *p = pData;
+  ssize_t n;
+
+  if(pConn->TxFill + Len > MQTT_TX_BUFF && MqttFlush(pConn) != 0)
+    return -1;
+  if(Len <= MQTT_TX_BUFF)
+  {
+    memcpy(pConn->Tx + pConn->TxFill, p, Len);
+    pConn->TxFill += Len;
+    return 0;
+  }
+  while(Len)
+  {
+    n = MqttSend(pConn->Fd, p, Len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+    {
+      pConn->bError = true;
+      return -1;
+    }
+    p += n;
+    Len -= n;
+  }
+  return 0;
+}
+
+/* Fixed header: type, flags and remaining length */
+static int MqttWriteHeader(MqttConn_Type *pConn, uint8_t Type, uint8_t Flags, uint32_t Len)
+{
+  uint8_t hdr[5];
+  uint32_t n = 0;
+
+  hdr[n++] = (uint8_t)(Type << 4 | Flags);
+  do
+  {
+    hdr[n] = Len&0x7F;
+    Len >>= 7;
+    if(Len)
+      hdr[n] |= 0x80;
+    n++;
+  }while(Len);
+  return MqttWrite(pConn, hdr, n);
+}
+
+static int MqttWriteString(MqttConn_Type *pConn, const char *Str)
+{
+  uint32_t len = strlen(Str);
+  uint8_t hdr[2] = {(uint8_t)(len >> 8), (uint8_t)len};
+  if(MqttWrite(pConn, hdr, 2) != 0)
+    return -1;
+  return MqttWrite(pConn, Str, len);
+}
+
+/**
+ * @brief Send CONNECT with clean session and wait for CONNACK.
+ * @return 0 if accepted, -1 on error, broker return code otherwise.
+*/
+int MqttConnect(MqttConn_Type *pConn, const char *ClientId, uint16_t KeepAliveS)
+{
+  static const uint8_t var[] = {0, 4, 'M', 'Q', 'T', 'T', 4, 0x02};
+  uint8_t keep[2] = {(uint8_t)(KeepAliveS >> 8), (uint8_t)KeepAliveS};
+  MqttPacket_Type pkt;
+
+  if(MqttWriteHeader(pConn, MQTT_PKT_CONNECT, 0, sizeof(var) + 2 + 2 + strlen(ClientId)) != 0 ||
+     MqttWrite(pConn, var, sizeof(var)) != 0 || MqttWrite(pConn, keep, 2) != 0 ||
+     MqttWriteString(pConn, ClientId) != 0 || MqttFlush(pConn) != 0)
+    return -1;
+  if(MqttWait(pConn, MQTT_PKT_CONNACK, &pkt) != 0 || pkt.Len < 2)
+    return -1;
+  return pkt.pBody[1];
+}
+
+/**
+ * @brief Send SUBSCRIBE for one filter. SUBACK is left to the read loop.
+*/
+int MqttSubscribe(MqttConn_Type *pConn, const char *Filter, uint8_t Qos)
+{
+  uint16_t id = pConn->NextId++;
+  uint8_t idb[2] = {(uint8_t)(id >> 8), (uint8_t)id};
+
+  if(pConn->NextId == 0)
+    pConn->NextId = 1;
+  if(MqttWriteHeader(pConn, MQTT_PKT_SUBSCRIBE, 0x02, 2 + 2 + strlen(Filter) + 1) != 0 ||
+     MqttWrite(pConn, idb, 2) != 0 || MqttWriteString(pConn, Filter) != 0 || MqttWrite(pConn, &Qos, 1) != 0)
+    return -1;
+  return MqttFlush(pConn);
+}
+
+/**
+ * @brief Queue a PUBLISH in transmit buffer. Call MqttFlush() to send it now.
+ * @return Packet ID for QoS 1, 0 for QoS 0, -1 on error.
+*/
+int MqttPublish(MqttConn_Type *pConn, const char *Topic, const void *pPayload, uint32_t Len, uint8_t Qos)
+{
+  uint32_t rem = 2 + strlen(Topic) + (Qos ? 2 : 0) + Len;
+  uint16_t id = 0;
+
+  if(MqttWriteHeader(pConn, MQTT_PKT_PUBLISH, Qos ? 0x02 : 0, rem) != 0 || MqttWriteString(pConn, Topic) != 0)
+    return -1;
+  if(Qos)
+  {
+    uint8_t idb[2];
+    id = pConn->NextId++;
+    if(pConn->NextId == 0)
+      pConn->NextId = 1;
+    idb[0] = (uint8_t)(id >> 8);
+    idb[1] = (uint8_t)id;
+    if(MqttWrite(pConn, idb, 2) != 0)
+      return -1;
+  }
+  if(MqttWrite(pConn, pPayload, Len) != 0)
+    return -1;
+  return id;
+}
+
+/**
+ * @brief Queue PUBACK or SUBACK style packet with a packet ID. SUBACK grants QoS 0.
+*/
+int MqttSendAck(MqttConn_Type *pConn, uint8_t Type, uint16_t Id)
+{
+  uint8_t body[3] = {(uint8_t)(Id >> 8), (uint8_t)Id, 0};
+  uint32_t len = (Type == MQTT_PKT_SUBACK) ? 3 : 2;
+  if(MqttWriteHeader(pConn, Type, 0, len) != 0)
+    return -1;
+  return MqttWrite(pConn, body, len);
+}
+
+/**
+ * @brief Queue a packet without body: PINGREQ, PINGRESP or DISCONNECT.
+*/
+int MqttSendEmpty(MqttConn_Type *pConn, uint8_t Type)
+{
+  return MqttWriteHeader(pConn, Type, 0, 0);
+}
+
+/**
+ * @brief Queue CONNACK with return code, 0 accepts.
+*/
+int MqttSendConnack(MqttConn_Type *pConn, uint8_t Code)
+{
+  uint8_t body[2] = {0, Code};
+  if(MqttWriteHeader(pConn, MQTT_PKT_CONNACK, 0, 2) != 0)
+    return -1;
+  return MqttWrite(pConn, body, 2);
+}
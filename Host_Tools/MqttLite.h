@@ -0,0 +1,90 @@
+/*!
+ *****************************************************************************
+ @file:    MqttLite.h
+ @brief:   Minimal MQTT 3.1.1 over TCP for host tools.
+ -----------------------------------------------------------------------------
+
+ Enough of the protocol to subscribe to device topics, publish as a device
+ and stand in for a broker that only receives: CONNECT/CONNACK, PUBLISH
+ with QoS 0 and 1, PUBACK, SUBSCRIBE/SUBACK, PINGREQ/PINGRESP and
+ DISCONNECT. QoS 2 is not supported.
+
+ Reading is split from the socket so one thread can serve many
+ connections with poll(): MqttFill() reads what is available, then
+ MqttNext() returns complete packets until it runs out. Packets point into
+ the receive buffer and stay valid until the next MqttFill().
+
+ Writes go to a transmit buffer that is sent when full or on MqttFlush(),
+ so many small publishes cost few system calls. A connection can also be
+ set up on a file: reading replays captured packets, writing captures them.
+
+*****************************************************************************/
+#ifndef _MQTT_LITE_H_
+#define _MQTT_LITE_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MQTT_PKT_CONNECT      1
+#define MQTT_PKT_CONNACK      2
+#define MQTT_PKT_PUBLISH      3
+#define MQTT_PKT_PUBACK       4
+#define MQTT_PKT_SUBSCRIBE    8
+#define MQTT_PKT_SUBACK       9
+#define MQTT_PKT_PINGREQ      12
+#define MQTT_PKT_PINGRESP     13
+#define MQTT_PKT_DISCONNECT   14
+
+#define MQTT_MAX_PACKET       (1024*1024)   /* Larger packets are a protocol error */
+#define MQTT_TX_BUFF          16384
+
+typedef struct
+{
+  int Fd;
+  uint8_t *pRx;
+  uint32_t RxSize;
+  uint32_t RxFill;
+  uint32_t RxPos;               /* Start of first packet not returned yet */
+  uint8_t Tx[MQTT_TX_BUFF];
+  uint32_t TxFill;
+  uint16_t NextId;
+  bool bError;                  /* Malformed packet or write failure, close connection */
+}MqttConn_Type;
+
+typedef struct
+{
+  uint8_t Type;
+  uint8_t Flags;                /* Low nibble of fixed header */
+  const uint8_t *pBody;
+  uint32_t Len;
+}MqttPacket_Type;
+
+typedef struct
+{
+  const char *pTopic;           /* Not NUL terminated */
+  uint32_t TopicLen;
+  const uint8_t *pPayload;
+  uint32_t PayloadLen;
+  uint8_t Qos;
+  uint16_t Id;                  /* Only for QoS 1 */
+}MqttPublish_Type;
+
+int  MqttTcpOpen(const char *Host, uint16_t Port);
+int  MqttTcpListen(uint16_t Port);
+
+int  MqttConnInit(MqttConn_Type *pConn, int Fd, uint32_t RxSize);
+void MqttConnClose(MqttConn_Type *pConn);
+int  MqttFill(MqttConn_Type *pConn);
+bool MqttNext(MqttConn_Type *pConn, MqttPacket_Type *pPkt);
+int  MqttWait(MqttConn_Type *pConn, uint8_t Type, MqttPacket_Type *pPkt);
+bool MqttParsePublish(const MqttPacket_Type *pPkt, MqttPublish_Type *pPub);
+bool MqttTopicMatch(const char *Filter, const char *pTopic, uint32_t TopicLen);
+
+int  MqttConnect(MqttConn_Type *pConn, const char *ClientId, uint16_t KeepAliveS);
+int  MqttSubscribe(MqttConn_Type *pConn, const char *Filter, uint8_t Qos);
+int  MqttPublish(MqttConn_Type *pConn, const char *Topic, const void *pPayload, uint32_t Len, uint8_t Qos);
+int  MqttSendAck(MqttConn_Type *pConn, uint8_t Type, uint16_t Id);
+int  MqttSendEmpty(MqttConn_Type *pConn, uint8_t Type);
+int  MqttSendConnack(MqttConn_Type *pConn, uint8_t Code);
+int  MqttFlush(MqttConn_Type *pConn);
+
+#endif
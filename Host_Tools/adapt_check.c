@@ -0,0 +1,223 @@
+/*!
+ *****************************************************************************
+ @file:    adapt_check.c
+ @brief:   Check adaptive sweep refinement (SweepAdapt.h) against fixed grids.
+ -----------------------------------------------------------------------------
+
+ Usage: adapt_check [-n spectra] [-p points] [-P max_points] [-d dense] [-F start:stop] [-e noise] [-a phase_deg] [-c curv] [-s seed] [-v]
+   -n spectra      Synthetic spectra, default 1000
+   -p points       Points of the first, coarse pass, log spaced, default 11
+   -P max_points   Point budget of an adaptive sweep, default 64
+   -d dense        Points of the fixed log sweep to compare with, default 101
+   -F start:stop   Frequency range in Hz, default 1:100000
+   -e noise        Relative noise added to each point, default 0.002
+   -a phase_deg    Phase tolerance in degree, default 5
+   -c curv         Curvature tolerance relative to |Z|, default 0.01
+   -s seed         Random seed, default 1
+   -v              CSV row per spectrum to stdout
+
+ Spectra are Rs-p(Rct-W,CPE) from RandlesFitEval() with parameters drawn
+ as kk_check does. Each is swept by lib/SweepAdapt.c, compiled for the
+ host exactly as for the target, on noisy points. Information kept by a
+ grid is rated by how well straight lines between its points (on log
+ frequency) follow the true spectrum: the largest error relative to |Z|
+ over 1000 frequencies. The adaptive grid is compared with a fixed log
+ grid of the same number of points and with the dense fixed grid.
+ Measurement time is estimated as CHECK_PERIODS periods of the
+ excitation plus CHECK_POINT_MS per point, so low frequencies dominate.
+ The exit code is 1 if the adaptive grid is worse than a fixed grid of
+ the same size on average.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "SweepAdapt.h"
+#include "RandlesFit.h"
+
+#define CHECK_TRUTH_POINTS    1000
+#define CHECK_PERIODS         4       /* Excitation periods per point in the time estimate */
+#define CHECK_POINT_MS        5.0     /* Settling, sequencer and transfer per point */
+
+static double Uniform(void)
+{
+  return (rand() + 0.5)/((double)RAND_MAX + 1);
+}
+
+/* Standard normal, Box-Muller */
+static double Gauss(void)
+{
+  return sqrt(-2*log(Uniform()))*cos(2*M_PI*Uniform());
+}
+
+static double LogUniform(double Lo, double Hi)
+{
+  return exp(log(Lo) + Uniform()*(log(Hi) - log(Lo)));
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: adapt_check [-n spectra] [-p points] [-P max_points] [-d dense] [-F start:stop] [-e noise]"
+          " [-a phase_deg] [-c curv] [-s seed] [-v]\n");
+  exit(2);
+}
+
+/* Parameters with the arc inside the frequency range, as kk_check */
+static void DrawParam(float *pParam, double Start, double Stop)
+{
+  double f_arc = LogUniform(Start*10, Stop/10);
+  pParam[RANDLES_RS] = LogUniform(1, 100);
+  pParam[RANDLES_RCT] = LogUniform(10, 10000);
+  pParam[RANDLES_N] = 0.7 + 0.3*Uniform();
+  pParam[RANDLES_Q] = 1/(pParam[RANDLES_RCT]*pow(2*M_PI*f_arc, pParam[RANDLES_N]));
+  pParam[RANDLES_SIGMA] = pParam[RANDLES_RCT]*LogUniform(0.01, 1)*sqrt(2*M_PI*Start);
+}
+
+static double GridTime(const float *pFreq, uint32_t Points)
+{
+  double t = 0;
+  uint32_t n;
+  for(n=0; n<Points; n++)
+    t += CHECK_PERIODS/pFreq[n] + CHECK_POINT_MS*1e-3;
+  return t;
+}
+
+/* Largest error of straight lines between grid points against the true spectrum, relative to |Z| */
+static double GridError(const float *pParam, const float *pFreq, uint32_t Points, double Start, double Stop)
+{
+  fImpCar_Type lo, hi, z;
+  double f, t, err, worst = 0;
+  uint32_t n, k = 0;
+
+  for(n=0; n<CHECK_TRUTH_POINTS; n++)
+  {
+    f = Start*pow(Stop/Start, n/(double)(CHECK_TRUTH_POINTS - 1));
+    while(k + 2 < Points && pFreq[k+1] < f)
+      k++;
+    RandlesFitEval(pParam, pFreq[k], &lo);
+    RandlesFitEval(pParam, pFreq[k+1], &hi);
+    RandlesFitEval(pParam, (float)f, &z);
+    t = log(f/pFreq[k])/log(pFreq[k+1]/(double)pFreq[k]);
+    err = hypot(z.Real - (lo.Real + t*(hi.Real - lo.Real)), z.Image - (lo.Image + t*(hi.Image - lo.Image)));
+    err /= hypot(z.Real, z.Image);
+    worst = err > worst ? err : worst;
+  }
+  return worst;
+}
+
+static void LogGrid(float *pFreq, uint32_t Points, double Start, double Stop)
+{
+  uint32_t n;
+  for(n=0; n<Points; n++)
+    pFreq[n] = (float)(Start*pow(Stop/Start, n/(double)(Points - 1)));
+}
+
+int main(int argc, char **argv)
+{
+  static SweepAdapt_Type adapt;
+  static float grid[SWEEP_ADAPT_MAX_POINTS], dense[4096];
+  SoftSweepCfg_Type sweep;
+  float param[RANDLES_PARAMS];
+  double start = 1, stop = 100000, noise = 0.002, phase = 5, curv = 0.01;
+  double err_ad = 0, err_same = 0, err_dense = 0, worst_ad = 0, worst_dense = 0, e, mag;
+  double t_ad = 0, t_same = 0, t_dense = 0;
+  uint32_t spectra = 1000, points = 11, max_points = 64, dense_points = 101, i, n, passes = 0, total = 0;
+  uint32_t fewest = UINT32_MAX, most = 0, better = 0;
+  int opt_c, seed = 1, verbose = 0;
+
+  while((opt_c = getopt(argc, argv, "n:p:P:d:F:e:a:c:s:v")) != -1)
+  {
+    switch(opt_c)
+    {
+      case 'n': spectra = strtoul(optarg, NULL, 0); break;
+      case 'p': points = strtoul(optarg, NULL, 0); break;
+      case 'P': max_points = strtoul(optarg, NULL, 0); break;
+      case 'd': dense_points = strtoul(optarg, NULL, 0); break;
+      case 'F':
+        if(sscanf(optarg, "%lf:%lf", &start, &stop) != 2 || !(start > 0) || !(stop > start))
+          Usage();
+        break;
+      case 'e': noise = strtod(optarg, NULL); break;
+      case 'a': phase = strtod(optarg, NULL); break;
+      case 'c': curv = strtod(optarg, NULL); break;
+      case 's': seed = atoi(optarg); break;
+      case 'v': verbose = 1; break;
+      default: Usage();
+    }
+  }
+  if(optind != argc || spectra == 0 || points < 2 || max_points < points || max_points > SWEEP_ADAPT_MAX_POINTS ||
+     dense_points < 2 || dense_points > sizeof(dense)/sizeof(dense[0]) || !(phase > 0) || !(curv > 0))
+    Usage();
+  srand(seed);
+  SweepAdaptInit(&adapt);
+  adapt.MaxPoints = max_points;
+  adapt.PhaseTol = (float)(phase*M_PI/180);
+  adapt.CurvTol = (float)curv;
+  memset(&sweep, 0, sizeof(sweep));
+  sweep.SweepEn = bTRUE;
+  sweep.SweepStart = (float)start;
+  sweep.SweepStop = (float)stop;
+  sweep.SweepPoints = points;
+  sweep.SweepLog = bTRUE;
+  LogGrid(dense, dense_points, start, stop);
+  if(verbose)
+    printf("spectrum,points,passes,err,err_same,err_dense,time_s,time_dense_s\n");
+
+  for(i=0; i<spectra; i++)
+  {
+    double ea, es, ed, ta, td;
+    DrawParam(param, start, stop);
+    SweepAdaptBegin(&adapt, &sweep);
+    do
+    {
+      for(n=0; n<adapt.PassCount; n++)
+      {
+        fImpCar_Type z;
+        RandlesFitEval(param, adapt.PassFreq[n], &z);
+        mag = hypot(z.Real, z.Image);
+        z.Real += noise*mag*Gauss();
+        z.Image += noise*mag*Gauss();
+        SweepAdaptAdd(&adapt, adapt.PassFreq[n], &z);
+      }
+    }while(SweepAdaptRefine(&adapt) > 0);
+
+    ea = GridError(param, adapt.Freq, adapt.Count, start, stop);
+    LogGrid(grid, adapt.Count, start, stop);
+    es = GridError(param, grid, adapt.Count, start, stop);
+    ed = GridError(param, dense, dense_points, start, stop);
+    ta = GridTime(adapt.Freq, adapt.Count);
+    t_same += GridTime(grid, adapt.Count);
+    td = GridTime(dense, dense_points);
+    err_ad += ea;
+    err_same += es;
+    err_dense += ed;
+    worst_ad = ea > worst_ad ? ea : worst_ad;
+    worst_dense = ed > worst_dense ? ed : worst_dense;
+    better += ea < es ? 1 : 0;
+    t_ad += ta;
+    t_dense += td;
+    total += adapt.Count;
+    passes += adapt.Pass;
+    fewest = adapt.Count < fewest ? adapt.Count : fewest;
+    most = adapt.Count > most ? adapt.Count : most;
+    if(verbose)
+      printf("%u,%u,%u,%.4g,%.4g,%.4g,%.2f,%.2f\n", i, adapt.Count, adapt.Pass, ea, es, ed, ta, td);
+  }
+
+  e = err_ad/spectra;
+  fprintf(stderr, "%u spectra, %g:%g Hz, noise %g, first pass %u points, budget %u, tolerance %g deg and %g\n",
+          spectra, start, stop, noise, points, max_points, phase, curv);
+  fprintf(stderr, "adaptive: %.1f points (%u to %u), %.2f refinement passes\n", total/(double)spectra, fewest, most,
+          passes/(double)spectra);
+  fprintf(stderr, "largest interpolation error, mean and worst: adaptive %.4f %.4f, fixed of same size %.4f,"
+          " fixed %u points %.4f %.4f\n", e, worst_ad, err_same/spectra, dense_points, err_dense/spectra, worst_dense);
+  fprintf(stderr, "adaptive better than fixed of same size on %u of %u spectra\n", better, spectra);
+  fprintf(stderr, "time per sweep (%u periods + %g ms per point): adaptive %.1f s, fixed of same size %.1f s,"
+          " fixed %u points %.1f s\n", CHECK_PERIODS, CHECK_POINT_MS, t_ad/spectra, t_same/spectra, dense_points,
+          t_dense/spectra);
+  fprintf(stderr, "memory: %u bytes of SweepAdapt_Type for %u points\n", (unsigned)sizeof(SweepAdapt_Type),
+          SWEEP_ADAPT_MAX_POINTS);
+  return e > err_same/spectra ? 1 : 0;
+}
@@ -0,0 +1,257 @@
+/*!
+ *****************************************************************************
+ @file:    eis_archive.c
+ @brief:   Inspect and export an impedance archive (EisArchive.h).
+ -----------------------------------------------------------------------------
+
+ Usage: eis_archive command archive_dir [args]
+   info    dir                          Devices, plans, blocks and sizes
+   blocks  dir device [from [to]]       Index entries of a device
+   export  dir device [from [to]]       Results of a device as CSV
+   plans   dir                          Frequency grid of every plan as CSV
+   scan    dir                          Read every value, report throughput
+   compact dir                          Sort index of an archive not in use
+
+ device is the device ID. from and to are times in microseconds, as in the
+ time_us column, both inclusive. Output goes to stdout.
+
+ Everything except compact maps the archive read only and can run while
+ eis_ingest is writing it.
+
+ Export has one row per point, block by block in order of block start
+ time. Points of spectra share the time of the spectrum and its number in
+ the spectrum column; loose points have spectrum -1. Points lost from a
+ spectrum are exported as nan.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "EisArchive.h"
+
+static uint64_t NowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: eis_archive info|plans|scan|compact archive_dir\n"
+                  "       eis_archive blocks|export archive_dir device [from_us [to_us]]\n");
+  exit(2);
+}
+
+static int Info(const EisArcReader_Type *pRd)
+{
+  uint64_t spectra = 0, points = 0, values = 0;
+  uint32_t i, blocks_s = 0;
+
+  for(i=0; i<pRd->Entries; i++)
+  {
+    const EisArcIndex_Type *pEntry = &pRd->pIndex[i];
+    if(pEntry->Kind == EISARC_KIND_SPECTRA)
+    {
+      blocks_s++;
+      spectra += pEntry->Count;
+      values += (uint64_t)pEntry->Count*pEntry->Points;
+    }
+    else
+      points += pEntry->Count;
+  }
+  printf("devices %u\nplans %u\nblocks %u (%u spectra, %u points)\nindex sorted %u unsorted %u\n"
+         "spectra %llu (%llu values)\nloose points %llu\ndata %.3f MB\n",
+         pRd->DevCount, pRd->PlanCount, pRd->Entries, blocks_s, pRd->Entries - blocks_s,
+         pRd->Sorted, pRd->Entries - pRd->Sorted, (unsigned long long)spectra, (unsigned long long)values,
+         (unsigned long long)points, pRd->DataSize*1e-6);
+  return 0;
+}
+
+static int Plans(const EisArcReader_Type *pRd)
+{
+  uint32_t i, j;
+
+  printf("plan,index,freq_hz\n");
+  for(i=0; i<pRd->PlanCount; i++)
+  {
+    const float *pFreq = (const float*)(pRd->ppPlan[i] + 1);
+    for(j=0; j<pRd->ppPlan[i]->Points; j++)
+      printf("%u,%u,%.4f\n", i, j, pFreq[j]);
+  }
+  return 0;
+}
+
+/* Query blocks of a device, returns NULL if the device is unknown */
+static const EisArcIndex_Type **Query(const EisArcReader_Type *pRd, int argc, char **argv, uint32_t *pCount)
+{
+  const EisArcIndex_Type **ppOut;
+  uint64_t from = 0, to = UINT64_MAX;
+  int device;
+
+  if(argc < 4 || argc > 6)
+    Usage();
+  device = EisArcReaderDevice(pRd, argv[3]);
+  if(device < 0)
+  {
+    fprintf(stderr, "%s: no device %s\n", argv[2], argv[3]);
+    return NULL;
+  }
+  if(argc > 4)
+    from = strtoull(argv[4], NULL, 0);
+  if(argc > 5)
+    to = strtoull(argv[5], NULL, 0);
+  *pCount = EisArcQuery(pRd, device, from, to, NULL, 0);
+  ppOut = malloc((*pCount + 1)*sizeof(*ppOut));
+  if(ppOut)
+    EisArcQuery(pRd, device, from, to, ppOut, *pCount);
+  return ppOut;
+}
+
+static int Blocks(const EisArcReader_Type *pRd, int argc, char **argv)
+{
+  const EisArcIndex_Type **ppEntry;
+  EisArcView_Type view;
+  uint32_t count, i;
+
+  ppEntry = Query(pRd, argc, argv, &count);
+  if(ppEntry == NULL)
+    return 1;
+  printf("offset,kind,count,plan,points,time_min_us,time_max_us,board,lost,host_time\n");
+  for(i=0; i<count; i++)
+  {
+    if(EisArcView(pRd, ppEntry[i], &view) != 0)
+    {
+      fprintf(stderr, "damaged block at %llu\n", (unsigned long long)ppEntry[i]->Offset);
+      continue;
+    }
+    printf("%llu,%s,%u,%d,%u,%llu,%llu,%u,%u,%u\n", (unsigned long long)ppEntry[i]->Offset,
+           view.Kind == EISARC_KIND_SPECTRA ? "spectra" : "points", view.Count,
+           view.Kind == EISARC_KIND_SPECTRA ? (int)view.pHdr->Plan : -1, view.Points,
+           (unsigned long long)view.pHdr->TimeMin, (unsigned long long)view.pHdr->TimeMax,
+           view.pHdr->Board, view.pHdr->Lost, (view.pHdr->Flags & EISARC_FLAG_HOSTTIME) != 0);
+  }
+  free(ppEntry);
+  return 0;
+}
+
+static int Export(const EisArcReader_Type *pRd, int argc, char **argv)
+{
+  const EisArcIndex_Type **ppEntry;
+  EisArcView_Type view;
+  uint64_t from = argc > 4 ? strtoull(argv[4], NULL, 0) : 0;
+  uint64_t to = argc > 5 ? strtoull(argv[5], NULL, 0) : UINT64_MAX;
+  uint32_t count, i, j, k;
+  long spectrum = 0;
+
+  ppEntry = Query(pRd, argc, argv, &count);
+  if(ppEntry == NULL)
+    return 1;
+  printf("time_us,host_time,spectrum,sweep_index,channel,freq_hz,real,image\n");
+  for(i=0; i<count; i++)
+  {
+    if(EisArcView(pRd, ppEntry[i], &view) != 0)
+    {
+      fprintf(stderr, "damaged block at %llu\n", (unsigned long long)ppEntry[i]->Offset);
+      continue;
+    }
+    for(j=0; j<view.Count; j++)
+    {
+      unsigned host = (view.pHdr->Flags & EISARC_FLAG_HOSTTIME) != 0;
+      /* Block overlaps the range, its rows need not */
+      if(view.pTime[j] < from || view.pTime[j] > to)
+        continue;
+      if(view.Kind == EISARC_KIND_SPECTRA)
+      {
+        const float *pRe = &view.pReal[(size_t)j*view.Points], *pIm = &view.pImage[(size_t)j*view.Points];
+        for(k=0; k<view.Points; k++)
+          printf("%llu,%u,%ld,%u,%u,%.4f,%.6g,%.6g\n", (unsigned long long)view.pTime[j], host, spectrum, k,
+                 view.pChannel[j], view.pFreq[k], pRe[k], pIm[k]);
+        spectrum++;
+      }
+      else
+        printf("%llu,%u,-1,%u,%u,%.4f,%.6g,%.6g\n", (unsigned long long)view.pTime[j], host, view.pSweep[j],
+               view.pChannel[j], view.pFreq[j], view.pReal[j], view.pImage[j]);
+    }
+  }
+  free(ppEntry);
+  return 0;
+}
+
+/* Touch every value in place, as an analysis job over the whole archive would */
+static int Scan(const EisArcReader_Type *pRd)
+{
+  EisArcView_Type view;
+  uint64_t t0 = NowUs(), values = 0, bytes = 0, dt;
+  double sum = 0;
+  uint32_t i, j, n;
+
+  for(i=0; i<pRd->Entries; i++)
+  {
+    if(EisArcView(pRd, &pRd->pIndex[i], &view) != 0)
+      continue;
+    n = view.Count*view.Points;
+    for(j=0; j<n; j++)
+      if(view.pReal[j] == view.pReal[j])
+        sum += view.pReal[j]*view.pReal[j] + view.pImage[j]*view.pImage[j];
+    values += n;
+    bytes += 2ull*n*sizeof(float);
+  }
+  dt = NowUs() - t0;
+  printf("values %llu in %.3f s, %.1f M values/s, %.1f MB/s (checksum %.6g)\n", (unsigned long long)values,
+         dt*1e-6, dt ? values/(double)dt : 0, dt ? bytes/(double)dt : 0, sum);
+  return 0;
+}
+
+static int Compact(const char *Dir)
+{
+  EisArc_Type arc;
+
+  if(EisArcOpen(&arc, Dir) != 0)
+  {
+    perror(Dir);
+    return 1;
+  }
+  if(arc.TornBytes)
+    fprintf(stderr, "%s: cut %llu bytes of an unfinished write\n", Dir, (unsigned long long)arc.TornBytes);
+  if(EisArcCompact(&arc) != 0)
+  {
+    perror("compact");
+    EisArcClose(&arc);
+    return 1;
+  }
+  printf("%u index entries sorted\n", arc.IndexCount);
+  EisArcClose(&arc);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  EisArcReader_Type rd;
+  int ret;
+
+  if(argc < 3)
+    Usage();
+  if(strcmp(argv[1], "compact") == 0)
+    return Compact(argv[2]);
+  if(EisArcReaderOpen(&rd, argv[2]) != 0)
+  {
+    perror(argv[2]);
+    return 1;
+  }
+  if(strcmp(argv[1], "info") == 0)
+    ret = Info(&rd);
+  else if(strcmp(argv[1], "plans") == 0)
+    ret = Plans(&rd);
+  else if(strcmp(argv[1], "blocks") == 0)
+    ret = Blocks(&rd, argc, argv);
+  else if(strcmp(argv[1], "export") == 0)
+    ret = Export(&rd, argc, argv);
+  else if(strcmp(argv[1], "scan") == 0)
+    ret = Scan(&rd);
+  else
+    Usage();
+  EisArcReaderClose(&rd);
+  return ret;
+}
@@ -0,0 +1,317 @@
+/*!
+ *****************************************************************************
+ @file:    eis_bb.c
+ @brief:   Broadband impedance spectra from a raw ADC stream (BroadbandImp.h).
+ -----------------------------------------------------------------------------
+
+ Usage: eis_bb [-f freq | -n samples] [-r rcal] [-P periods] [-s settle] [-t level_db] [-k harmonics] [capture file]
+   -f freq         Fundamental in Hz as printed by the target, default 1
+   -n samples      Samples per period as printed by the target, instead of -f
+   -r rcal         RCAL in Ohm, default 10000
+   -P periods      Periods of a record to transform, default as many as there are
+   -s settle       Periods not used after a switch, default 1
+   -t level_db     Harmonics more than this below the fundamental are not
+                   reported, default 40
+   -k harmonics    Highest harmonic, default up to half the sample rate
+
+ Reads the stream of a target running APP_BROADBAND from a capture file
+ or stdin. Frames of channel BBIMP_CH_RCAL and BBIMP_CH_DUT alternate in
+ records. From each record the settling periods are skipped and the FFT
+ (EisFFT.h) is taken over whole periods starting at a sample index that
+ is a multiple of the period, so all records see the excitation at the
+ same phase. Every DUT record and the RCAL record before it give a
+ spectrum:
+
+   Z(k f0) = rcal * I_rcal(k f0)/I_dut(k f0)
+
+ at the harmonics k of the fundamental f0 whose level in the RCAL record
+ is within level_db of the fundamental. The CSV on stdout has one row per
+ harmonic: spectrum, time of the RCAL record, host time flag, harmonic,
+ frequency, real and imaginary part and level in dB. A record with a gap
+ in its samples is transformed over whole periods without it, if there
+ are enough. Leakage, the power of the bins between harmonics relative to
+ the harmonics, is reported to stderr; it is small if the period matches
+ the excitation.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "ResultStream.h"
+#include "BroadbandImp.h"
+#include "EisFFT.h"
+
+#define BB_MAX_GAP            1000000 /* Larger gaps end the record */
+
+typedef struct
+{
+  uint16_t Channel;
+  uint64_t TimeUs;              /* Of first sample */
+  int bHostTime;
+  uint32_t FirstIndex;
+  uint32_t Count;
+  uint32_t Size;
+  float SampleRate;
+  float *pSample;               /* Volt at ADC, NaN for missing samples */
+}BBRecord_Type;
+
+typedef struct
+{
+  int bValid;
+  uint64_t TimeUs;
+  int bHostTime;
+  uint32_t Harmonics;
+  double *pSpec;                /* Complex amplitude of harmonics 1..Harmonics, interleaved */
+  double *pLevel;               /* dB relative to fundamental */
+}BBCurrent_Type;
+
+static struct
+{
+  double Rcal;
+  double Freq;
+  uint32_t PeriodSamples;       /* 0 until the sample rate is known with -f */
+  uint32_t Periods;
+  uint32_t Settle;
+  double LevelDb;
+  uint32_t MaxHarmonic;
+  BBRecord_Type Rec;
+  BBCurrent_Type RcalCur;       /* Current of the last RCAL record */
+  EisFFTPlan_Type Plan;
+  double *pIn;
+  double *pOut;
+  uint32_t Spectra;
+  uint32_t Records;
+  uint32_t Skipped;             /* Records without enough whole periods */
+  double WorstLeak;             /* dB */
+}BB;
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: eis_bb [-f freq | -n samples] [-r rcal] [-P periods] [-s settle] [-t level_db] [-k harmonics]"
+          " [capture file]\n");
+  exit(2);
+}
+
+static void *Grow(void *p, size_t Size)
+{
+  p = realloc(p, Size);
+  if(p == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+/* Transform Periods whole periods of the record, current at harmonic k is pOut[k*Periods] */
+static int BBTransform(BBRecord_Type *pRec, uint32_t *pPeriods, double *pLeak)
+{
+  uint32_t N = BB.PeriodSamples, first, end, start, avail, periods, i, len;
+  double harm = 0, other = 0, p;
+
+  /* First index at the excitation phase of index 0 after settling */
+  first = pRec->FirstIndex + BB.Settle*N;
+  first = (first + N - 1)/N*N;
+  end = pRec->FirstIndex + pRec->Count;
+  for(start=first; start + N <= end; start += N)
+  {
+    avail = (end - start)/N;
+    periods = BB.Periods && BB.Periods < avail ? BB.Periods : avail;
+    len = periods*N;
+    for(i=0; i<len; i++)
+    {
+      if(isnan(pRec->pSample[start - pRec->FirstIndex + i]))
+        break;
+    }
+    if(i < len)
+      continue;
+    if(BB.Plan.N != len)
+    {
+      EisFFTPlanFree(&BB.Plan);
+      BB.pIn = Grow(BB.pIn, (size_t)len*2*sizeof(double));
+      BB.pOut = Grow(BB.pOut, (size_t)len*2*sizeof(double));
+      if(EisFFTPlanInit(&BB.Plan, len) != 0)
+        return -1;
+    }
+    for(i=0; i<len; i++)
+    {
+      BB.pIn[2*i] = pRec->pSample[start - pRec->FirstIndex + i]/len;
+      BB.pIn[2*i + 1] = 0;
+    }
+    if(EisFFT(&BB.Plan, BB.pIn, BB.pOut) != 0)
+      return -1;
+    for(i=1; i<=len/2; i++)
+    {
+      p = BB.pOut[2*i]*BB.pOut[2*i] + BB.pOut[2*i + 1]*BB.pOut[2*i + 1];
+      if(i%periods == 0)
+        harm += p;
+      else
+        other += p;
+    }
+    *pPeriods = periods;
+    *pLeak = periods > 1 && harm > 0 ? 10*log10(other/harm + 1e-30) : -INFINITY;
+    return 0;
+  }
+  return -1;
+}
+
+static void BBRecordEnd(void)
+{
+  BBRecord_Type *pRec = &BB.Rec;
+  BBCurrent_Type *pRcal = &BB.RcalCur;
+  uint32_t periods, harmonics, k;
+  double leak, f0, fund, lr, li, dr, di, den, zr, zi;
+
+  if(pRec->Count == 0)
+    return;
+  BB.Records++;
+  if(BB.PeriodSamples == 0)
+    BB.PeriodSamples = (uint32_t)(pRec->SampleRate/BB.Freq + 0.5);
+  if(pRec->Channel == BBIMP_CH_DUT && pRcal->bValid == 0)
+    goto done;        /* Nothing to pair with */
+  if(BBTransform(pRec, &periods, &leak) != 0)
+  {
+    BB.Skipped++;
+    if(pRec->Channel == BBIMP_CH_RCAL)
+      pRcal->bValid = 0;
+    goto done;
+  }
+  BB.WorstLeak = leak > BB.WorstLeak ? leak : BB.WorstLeak;
+  harmonics = (BB.PeriodSamples - 1)/2;
+  if(BB.MaxHarmonic && BB.MaxHarmonic < harmonics)
+    harmonics = BB.MaxHarmonic;
+  if(pRec->Channel == BBIMP_CH_RCAL)
+  {
+    pRcal->pSpec = Grow(pRcal->pSpec, (harmonics + 1)*2*sizeof(double));
+    pRcal->pLevel = Grow(pRcal->pLevel, (harmonics + 1)*sizeof(double));
+    pRcal->Harmonics = harmonics;
+    pRcal->TimeUs = pRec->TimeUs;
+    pRcal->bHostTime = pRec->bHostTime;
+    fund = hypot(BB.pOut[2*periods], BB.pOut[2*periods + 1]);
+    for(k=1; k<=harmonics; k++)
+    {
+      pRcal->pSpec[2*k] = BB.pOut[2*k*periods];
+      pRcal->pSpec[2*k + 1] = BB.pOut[2*k*periods + 1];
+      pRcal->pLevel[k] = 20*log10(hypot(pRcal->pSpec[2*k], pRcal->pSpec[2*k + 1])/fund + 1e-30);
+    }
+    pRcal->bValid = fund > 0;
+    goto done;
+  }
+  f0 = pRec->SampleRate/BB.PeriodSamples;
+  harmonics = harmonics < pRcal->Harmonics ? harmonics : pRcal->Harmonics;
+  for(k=1; k<=harmonics; k++)
+  {
+    if(!(pRcal->pLevel[k] >= -BB.LevelDb))
+      continue;
+    lr = pRcal->pSpec[2*k];
+    li = pRcal->pSpec[2*k + 1];
+    dr = BB.pOut[2*k*periods];
+    di = BB.pOut[2*k*periods + 1];
+    den = dr*dr + di*di;
+    if(den == 0)
+      continue;
+    zr = BB.Rcal*(lr*dr + li*di)/den;
+    zi = BB.Rcal*(li*dr - lr*di)/den;
+    printf("%u,%llu,%u,%u,%.6g,%.6g,%.6g,%.1f\n", BB.Spectra, (unsigned long long)pRcal->TimeUs, pRcal->bHostTime, k,
+           k*f0, zr, zi, pRcal->pLevel[k]);
+  }
+  BB.Spectra++;
+  pRcal->bValid = 0;
+done:
+  pRec->Count = 0;
+}
+
+static void OnAdc(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamAdc_Type *pAdc, const int16_t *pSample)
+{
+  BBRecord_Type *pRec = &BB.Rec;
+  uint32_t k, gap = 0;
+
+  (void)pUser;
+  (void)pInfo;
+  if(pAdc->Channel != BBIMP_CH_RCAL && pAdc->Channel != BBIMP_CH_DUT)
+    return;
+  if(pRec->Count)
+  {
+    gap = pAdc->FirstIndex - (pRec->FirstIndex + pRec->Count);
+    if(pAdc->Channel != pRec->Channel || gap > BB_MAX_GAP || pAdc->SampleRate != pRec->SampleRate)
+    {
+      BBRecordEnd();
+      gap = 0;
+    }
+  }
+  if(pRec->Count == 0)
+  {
+    pRec->Channel = pAdc->Channel;
+    pRec->TimeUs = pAdc->TimeUs;
+    pRec->bHostTime = pAdc->bHostTime == bTRUE;
+    pRec->FirstIndex = pAdc->FirstIndex;
+    pRec->SampleRate = pAdc->SampleRate;
+  }
+  if(pRec->Count + gap + pAdc->Count > pRec->Size)
+  {
+    pRec->Size = 2*(pRec->Count + gap + pAdc->Count);
+    pRec->pSample = Grow(pRec->pSample, (size_t)pRec->Size*sizeof(float));
+  }
+  for(k=0; k<gap; k++)
+    pRec->pSample[pRec->Count++] = NAN;
+  for(k=0; k<pAdc->Count; k++)
+    pRec->pSample[pRec->Count++] = pSample[k]*pAdc->Scale;
+}
+
+int main(int argc, char **argv)
+{
+  RStreamDec_Type dec;
+  uint8_t buff[1024];
+  size_t len;
+  FILE *in = stdin;
+  int opt_c;
+
+  BB.Rcal = 10000;
+  BB.Freq = 1;
+  BB.Settle = 1;
+  BB.LevelDb = 40;
+  BB.WorstLeak = -INFINITY;
+  while((opt_c = getopt(argc, argv, "f:n:r:P:s:t:k:")) != -1)
+  {
+    switch(opt_c)
+    {
+      case 'f': BB.Freq = strtod(optarg, NULL); break;
+      case 'n': BB.PeriodSamples = strtoul(optarg, NULL, 0); break;
+      case 'r': BB.Rcal = strtod(optarg, NULL); break;
+      case 'P': BB.Periods = strtoul(optarg, NULL, 0); break;
+      case 's': BB.Settle = strtoul(optarg, NULL, 0); break;
+      case 't': BB.LevelDb = strtod(optarg, NULL); break;
+      case 'k': BB.MaxHarmonic = strtoul(optarg, NULL, 0); break;
+      default: Usage();
+    }
+  }
+  if(optind + 1 < argc || !(BB.Freq > 0) || !(BB.Rcal > 0))
+    Usage();
+  if(optind < argc)
+  {
+    in = fopen(argv[optind], "rb");
+    if(in == NULL)
+    {
+      perror(argv[optind]);
+      return 1;
+    }
+  }
+  RStreamDecInit(&dec, NULL, NULL);
+  dec.pOnAdc = OnAdc;
+  printf("spectrum,time_us,host_time,harmonic,freq_hz,real,image,level_db\n");
+  while((len = fread(buff, 1, sizeof(buff), in)) > 0)
+  {
+    RStreamDecFeed(&dec, buff, (uint32_t)len);
+    fflush(stdout);
+  }
+  BBRecordEnd();
+  fprintf(stderr, "frames %lu, crc errors %lu, lost %lu\n", (unsigned long)dec.FrameCount,
+          (unsigned long)dec.CrcErrors, (unsigned long)dec.Lost);
+  fprintf(stderr, "%u records, %u spectra, %u records too short or with gaps, %u samples per period,"
+          " worst leakage %.1f dB\n", BB.Records, BB.Spectra, BB.Skipped, BB.PeriodSamples, BB.WorstLeak);
+  if(in != stdin)
+    fclose(in);
+  return 0;
+}
@@ -0,0 +1,576 @@
+/*!
+ *****************************************************************************
+ @file:    eis_drt.c
+ @brief:   Distribution of relaxation times of spectra (EisDRT.h).
+ -----------------------------------------------------------------------------
+
+ Usage: eis_drt [options] archive_dir [device [from_us [to_us]]]
+        eis_drt [options] -r capture_file
+        eis_drt [options] -f spectrum.csv
+        eis_drt [options] -b spectra
+   -L lambda       Regularization, default chosen per spectrum by GCV
+   -T tau          Tau values, default EISDRT_PER_DECADE per decade and
+                   a decade beyond the frequencies on each side
+   -j threads      Solver threads, default number of processors
+   -g              Write gamma: one row per spectrum and tau
+   -r file         Spectra from a result stream capture (ResultStream.h),
+                   e.g. as saved from the serial port, - for stdin
+   -f file         One spectrum from CSV with columns freq_hz,real,image
+   -b spectra      Benchmark on synthetic spectra
+   -p points       Benchmark points per spectrum, log spaced, default 50
+   -F start:stop   Benchmark frequency range in Hz, default 0.01:10000
+   -e noise        Benchmark relative noise, default 0.002
+
+ Solves every spectrum of the archive, of one device and time range, or
+ of a capture, and writes one CSV row per spectrum to stdout: device,
+ time, channel, lambda, R_inf, L, R_pol, residual norm, points used,
+ active set changes and status (0 solved, 1 iteration limit, 2 failed).
+ With -g the rows are device, time, channel, tau and gamma instead. The
+ solver matrices are computed once per frequency plan and shared by all
+ threads. In a capture, a sweep ends with RSTREAM_FLAG_SWEEPEND or when
+ the sweep index goes back; sweeps on the same frequencies share a plan.
+
+ -b solves spectra of R_inf, L and two ZARC elements with known
+ polarization resistance on one plan and reports time per spectrum with
+ and without the cached plan, and how well R_pol is recovered.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include <unistd.h>
+#include "EisArchive.h"
+#include "EisDRT.h"
+#include "ResultStream.h"
+
+#define DRT_MAX_POINTS        EISARC_MAX_POINTS
+#define DRT_NO_CACHE_SPECTRA  200     /* Benchmark spectra solved with a plan made for each */
+
+typedef struct
+{
+  const char *Device;
+  uint64_t TimeUs;
+  uint16_t Channel;
+}DrtRow_Type;
+
+/* Jobs and rows of everything to solve */
+typedef struct
+{
+  EisDRTJob_Type *pJob;
+  DrtRow_Type *pRow;
+  uint32_t Count;
+  uint32_t Cap;
+}DrtList_Type;
+
+/* Sweep being assembled from a capture and the plans seen so far */
+typedef struct
+{
+  DrtList_Type *pList;
+  const char *Device;
+  float Freq[DRT_MAX_POINTS];
+  float Real[DRT_MAX_POINTS];
+  float Image[DRT_MAX_POINTS];
+  uint64_t TimeUs;
+  uint32_t End;
+  uint32_t Seq;                 /* Frame of the last record */
+  uint32_t Rec;                 /* Records of that frame seen */
+  uint16_t Channel;
+  EisDRTPlan_Type *pPlan;
+  float **ppPlanFreq;
+  uint32_t PlanCount;
+  uint32_t Skipped;             /* Sweeps with lost points on a grid not seen complete */
+  uint32_t Tau;
+}DrtCapture_Type;
+
+static uint64_t NowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: eis_drt [-L lambda] [-T tau] [-j threads] [-g]\n"
+                  "               (archive_dir [device [from_us [to_us]]] | -r capture | -f file.csv |\n"
+                  "                -b spectra [-p points] [-F start:stop] [-e noise])\n");
+  exit(2);
+}
+
+static EisDRTJob_Type *ListAdd(DrtList_Type *pList, const char *Device, uint64_t TimeUs, uint16_t Channel)
+{
+  EisDRTJob_Type *pJob;
+
+  if(pList->Count == pList->Cap)
+  {
+    uint32_t cap = pList->Cap ? pList->Cap*2 : 1024;
+    EisDRTJob_Type *pJ = realloc(pList->pJob, cap*sizeof(EisDRTJob_Type));
+    DrtRow_Type *pR = realloc(pList->pRow, cap*sizeof(DrtRow_Type));
+    if(pJ) pList->pJob = pJ;
+    if(pR) pList->pRow = pR;
+    if(pJ == NULL || pR == NULL)
+      return NULL;
+    pList->Cap = cap;
+  }
+  pJob = &pList->pJob[pList->Count];
+  memset(pJob, 0, sizeof(*pJob));
+  pList->pRow[pList->Count].Device = Device;
+  pList->pRow[pList->Count].TimeUs = TimeUs;
+  pList->pRow[pList->Count].Channel = Channel;
+  pList->Count++;
+  return pJob;
+}
+
+static void PrintHeader(bool bGamma)
+{
+  if(bGamma)
+    printf("device,time_us,channel,tau_s,gamma_ohm\n");
+  else
+    printf("device,time_us,channel,lambda,r_inf,l,r_pol,res_norm,points,iter,status\n");
+}
+
+static void PrintResult(const DrtRow_Type *pRow, const EisDRTJob_Type *pJob, bool bGamma)
+{
+  const EisDRTResult_Type *pR = &pJob->Result;
+  uint32_t k;
+
+  if(bGamma)
+  {
+    for(k=0; pR->Status != EISDRT_FAIL && k<pJob->pPlan->Tau; k++)
+      printf("%s,%llu,%u,%.6g,%.6g\n", pRow->Device, (unsigned long long)pRow->TimeUs, pRow->Channel,
+             pJob->pPlan->pTau[k], pR->Gamma[k]);
+    return;
+  }
+  printf("%s,%llu,%u,%.3g,%.6g,%.6g,%.6g,%.6g,%u,%u,%u\n", pRow->Device, (unsigned long long)pRow->TimeUs,
+         pRow->Channel, pR->Lambda, pR->RInf, pR->L, pR->RPol, pR->ResNorm, pR->Points, pR->Iter, pR->Status);
+}
+
+static int SolveCsv(const char *File, uint32_t Tau, double Lambda)
+{
+  static float freq[DRT_MAX_POINTS], re[DRT_MAX_POINTS], im[DRT_MAX_POINTS];
+  EisDRTPlan_Type plan;
+  EisDRTResult_Type result;
+  char line[256];
+  uint32_t n = 0, k;
+  FILE *in = strcmp(File, "-") == 0 ? stdin : fopen(File, "r");
+
+  if(in == NULL)
+  {
+    perror(File);
+    return 1;
+  }
+  while(fgets(line, sizeof(line), in) && n < DRT_MAX_POINTS)
+  {
+    /* Header and other lines that are not numbers are skipped */
+    if(sscanf(line, "%f,%f,%f", &freq[n], &re[n], &im[n]) == 3)
+      n++;
+  }
+  if(in != stdin)
+    fclose(in);
+  if(EisDRTPlanInit(&plan, freq, n, Tau) != 0 || EisDRT(&plan, n, re, im, Lambda, &result) != 0)
+  {
+    fprintf(stderr, "%s: too few valid points (%u)\n", File, n);
+    EisDRTPlanFree(&plan);
+    return 1;
+  }
+  printf("tau_s,gamma_ohm\n");
+  for(k=0; k<plan.Tau; k++)
+    printf("%.6g,%.6g\n", plan.pTau[k], result.Gamma[k]);
+  fprintf(stderr, "lambda %.3g, r_inf %.6g, l %.6g, r_pol %.6g, res_norm %.6g, %u points\n", result.Lambda,
+          result.RInf, result.L, result.RPol, result.ResNorm, result.Points);
+  EisDRTPlanFree(&plan);
+  return 0;
+}
+
+/* Add spectra of one device in time order, one plan per archive plan */
+static int AddDevice(const EisArcReader_Type *pRd, uint32_t Device, uint64_t From, uint64_t To,
+                     EisDRTPlan_Type *pPlan, uint32_t Tau, DrtList_Type *pList)
+{
+  const EisArcIndex_Type **ppEntry;
+  EisArcView_Type view;
+  uint32_t count = EisArcQuery(pRd, Device, From, To, NULL, 0), i, j;
+
+  ppEntry = malloc((count + 1)*sizeof(*ppEntry));
+  if(ppEntry == NULL)
+    return -1;
+  EisArcQuery(pRd, Device, From, To, ppEntry, count);
+  for(i=0; i<count; i++)
+  {
+    uint32_t plan = ppEntry[i]->Plan;
+    if(EisArcView(pRd, ppEntry[i], &view) != 0 || view.Kind != EISARC_KIND_SPECTRA || plan >= pRd->PlanCount)
+      continue;
+    if(pPlan[plan].pA == NULL && EisDRTPlanInit(&pPlan[plan], view.pFreq, view.Points, Tau) != 0)
+      continue;
+    for(j=0; j<view.Count; j++)
+    {
+      EisDRTJob_Type *pJob;
+      if(view.pTime[j] < From || view.pTime[j] > To)
+        continue;
+      pJob = ListAdd(pList, EisArcReaderDeviceId(pRd, Device), view.pTime[j], view.pChannel[j]);
+      if(pJob == NULL)
+      {
+        free(ppEntry);
+        return -1;
+      }
+      pJob->pPlan = &pPlan[plan];
+      pJob->Points = view.Points;
+      pJob->pReal = &view.pReal[(size_t)j*view.Points];
+      pJob->pImage = &view.pImage[(size_t)j*view.Points];
+    }
+  }
+  free(ppEntry);
+  return 0;
+}
+
+/* Frequencies of the sweep agree with a plan, lost points aside */
+static bool CaptureMatches(const DrtCapture_Type *pCap, uint32_t Plan)
+{
+  uint32_t i;
+
+  if(pCap->pPlan[Plan].Points != pCap->End)
+    return false;
+  for(i=0; i<pCap->End; i++)
+    if(!isnan(pCap->Freq[i]) && pCap->Freq[i] != pCap->ppPlanFreq[Plan][i])
+      return false;
+  return true;
+}
+
+/* Queue the assembled sweep of a capture */
+static void CaptureSweep(DrtCapture_Type *pCap)
+{
+  EisDRTJob_Type *pJob;
+  float *pZ;
+  uint32_t p;
+
+  for(p=0; p<pCap->PlanCount && !CaptureMatches(pCap, p); p++);
+  if(p == pCap->PlanCount)
+  {
+    /* A new grid needs all its points */
+    EisDRTPlan_Type *pPlan = realloc(pCap->pPlan, (p + 1)*sizeof(EisDRTPlan_Type));
+    float **pp = realloc(pCap->ppPlanFreq, (p + 1)*sizeof(float*));
+    if(pPlan) pCap->pPlan = pPlan;
+    if(pp) pCap->ppPlanFreq = pp;
+    if(pPlan == NULL || pp == NULL)
+    {
+      pCap->End = 0;
+      return;
+    }
+    pp[p] = malloc(pCap->End*sizeof(float));
+    if(pp[p] == NULL || EisDRTPlanInit(&pPlan[p], pCap->Freq, pCap->End, pCap->Tau) != 0)
+    {
+      free(pp[p]);
+      pCap->Skipped++;
+      pCap->End = 0;
+      return;
+    }
+    memcpy(pp[p], pCap->Freq, pCap->End*sizeof(float));
+    pCap->PlanCount++;
+  }
+  pJob = ListAdd(pCap->pList, pCap->Device, pCap->TimeUs, pCap->Channel);
+  pZ = malloc(2*pCap->End*sizeof(float));
+  if(pJob && pZ)
+  {
+    memcpy(pZ, pCap->Real, pCap->End*sizeof(float));
+    memcpy(pZ + pCap->End, pCap->Image, pCap->End*sizeof(float));
+    pJob->pPlan = (const EisDRTPlan_Type*)(uintptr_t)p;   /* Index until the plan array stops growing */
+    pJob->Points = pCap->End;
+    pJob->pReal = pZ;
+    pJob->pImage = pZ + pCap->End;
+  }
+  else
+    free(pZ);
+  pCap->End = 0;
+}
+
+static void OnCapturePoint(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamPoint_Type *pPoint)
+{
+  DrtCapture_Type *pCap = pUser;
+  uint32_t i = pPoint->SweepIndex;
+
+  if(pInfo->Seq != pCap->Seq)
+    pCap->Rec = 0;
+  pCap->Seq = pInfo->Seq;
+  pCap->Rec++;
+  if(pCap->End && (i < pCap->End || pPoint->Channel != pCap->Channel))
+    CaptureSweep(pCap);
+  if(i < DRT_MAX_POINTS)
+  {
+    /* Points lost in transport are NaN */
+    for(; pCap->End < i; pCap->End++)
+      pCap->Freq[pCap->End] = pCap->Real[pCap->End] = pCap->Image[pCap->End] = NAN;
+    pCap->Freq[i] = pPoint->Freq;
+    pCap->Real[i] = pPoint->Z.Real;
+    pCap->Image[i] = pPoint->Z.Image;
+    pCap->TimeUs = i == 0 ? pPoint->TimeUs : pCap->TimeUs;
+    pCap->Channel = pPoint->Channel;
+    pCap->End = i + 1;
+  }
+  if((pInfo->Flags & RSTREAM_FLAG_SWEEPEND) && pCap->Rec == pInfo->Count)
+    CaptureSweep(pCap);
+}
+
+static int ReadCapture(const char *File, uint32_t Tau, DrtList_Type *pList, DrtCapture_Type *pCap)
+{
+  RStreamDec_Type dec;
+  uint8_t buff[1024];
+  size_t len;
+  uint32_t i;
+  FILE *in = strcmp(File, "-") == 0 ? stdin : fopen(File, "rb");
+
+  if(in == NULL)
+  {
+    perror(File);
+    return -1;
+  }
+  memset(pCap, 0, sizeof(*pCap));
+  pCap->pList = pList;
+  pCap->Device = File;
+  pCap->Tau = Tau;
+  pCap->Seq = UINT32_MAX;
+  RStreamDecInit(&dec, OnCapturePoint, pCap);
+  while((len = fread(buff, 1, sizeof(buff), in)) > 0)
+    RStreamDecFeed(&dec, buff, (uint32_t)len);
+  if(pCap->End)
+    CaptureSweep(pCap);
+  if(in != stdin)
+    fclose(in);
+  for(i=0; i<pList->Count; i++)
+    pList->pJob[i].pPlan = &pCap->pPlan[(uintptr_t)pList->pJob[i].pPlan];
+  fprintf(stderr, "%s: frames %lu, crc errors %lu, lost %lu, %u sweeps on %u plans, %u without plan\n", File,
+          (unsigned long)dec.FrameCount, (unsigned long)dec.CrcErrors, (unsigned long)dec.Lost, pList->Count,
+          pCap->PlanCount, pCap->Skipped);
+  return 0;
+}
+
+static double Uniform(void)
+{
+  return (rand() + 0.5)/((double)RAND_MAX + 1);
+}
+
+/* Standard normal, Box-Muller */
+static double Gauss(void)
+{
+  return sqrt(-2*log(Uniform()))*cos(2*M_PI*Uniform());
+}
+
+static double LogUniform(double Lo, double Hi)
+{
+  return exp(log(Lo) + Uniform()*(log(Hi) - log(Lo)));
+}
+
+static int Benchmark(uint32_t Spectra, uint32_t Points, double Start, double Stop, double Noise, uint32_t Tau,
+                     double Lambda, uint32_t Threads)
+{
+  static float freq[DRT_MAX_POINTS];
+  EisDRTPlan_Type plan;
+  EisDRTJob_Type *pJob;
+  EisDRTResult_Type res;
+  float *pZ;
+  double *pRPol, err = 0, worst = 0, res_norm = 0, iter = 0;
+  uint64_t t0, t_plan, t_batch, t_nocache;
+  uint32_t i, n, ok = 0, nocache = Spectra < DRT_NO_CACHE_SPECTRA ? Spectra : DRT_NO_CACHE_SPECTRA;
+
+  for(n=0; n<Points; n++)
+    freq[n] = (float)(Start*pow(Stop/Start, n/(double)(Points - 1)));
+  pJob = calloc(Spectra, sizeof(EisDRTJob_Type));
+  pZ = malloc((size_t)Spectra*2*Points*sizeof(float));
+  pRPol = malloc(Spectra*sizeof(double));
+  if(pJob == NULL || pZ == NULL || pRPol == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  srand(1);
+  for(i=0; i<Spectra; i++)
+  {
+    /* R_inf, L and two ZARC with time constants inside the range */
+    double rs = LogUniform(0.01, 0.1), l = LogUniform(1e-8, 1e-7), r1 = LogUniform(0.005, 0.05);
+    double r2 = LogUniform(0.01, 0.1), n1 = 0.8 + 0.2*Uniform(), n2 = 0.7 + 0.3*Uniform();
+    double t1 = 1/(2*M_PI*LogUniform(Stop/1000, Stop/100)), t2 = 1/(2*M_PI*LogUniform(Start*100, Start*1000));
+    float *pRe = &pZ[(size_t)i*2*Points], *pIm = pRe + Points;
+    for(n=0; n<Points; n++)
+    {
+      double w = 2*M_PI*freq[n];
+      double complex z = rs + I*w*l + r1/(1 + cpow(I*w*t1, n1)) + r2/(1 + cpow(I*w*t2, n2));
+      pRe[n] = (float)(creal(z) + Noise*cabs(z)*Gauss());
+      pIm[n] = (float)(cimag(z) + Noise*cabs(z)*Gauss());
+    }
+    pRPol[i] = r1 + r2;
+    pJob[i].pPlan = &plan;
+    pJob[i].Points = Points;
+    pJob[i].pReal = pRe;
+    pJob[i].pImage = pIm;
+  }
+
+  t0 = NowUs();
+  if(EisDRTPlanInit(&plan, freq, Points, Tau) != 0)
+  {
+    fprintf(stderr, "plan failed\n");
+    return 1;
+  }
+  t_plan = NowUs() - t0;
+  t0 = NowUs();
+  EisDRTBatch(pJob, Spectra, Lambda, Threads);
+  t_batch = NowUs() - t0;
+  /* As if each spectrum came with a plan of its own */
+  t0 = NowUs();
+  for(i=0; i<nocache; i++)
+  {
+    EisDRTPlan_Type p;
+    EisDRTPlanInit(&p, freq, Points, Tau);
+    EisDRT(&p, Points, pJob[i].pReal, pJob[i].pImage, Lambda, &res);
+    EisDRTPlanFree(&p);
+  }
+  t_nocache = NowUs() - t0;
+
+  for(i=0; i<Spectra; i++)
+  {
+    double e = fabs(pJob[i].Result.RPol/pRPol[i] - 1);
+    if(pJob[i].Result.Status == EISDRT_FAIL)
+      continue;
+    ok++;
+    err += e;
+    worst = e > worst ? e : worst;
+    res_norm += pJob[i].Result.ResNorm;
+    iter += pJob[i].Result.Iter;
+  }
+  fprintf(stderr, "%u spectra of %u points, %u tau, noise %g, lambda %s\n", Spectra, Points, plan.Tau, Noise,
+          Lambda > 0 ? "fixed" : "by GCV");
+  fprintf(stderr, "plan: %.1f ms, %.0f kB\n", t_plan*1e-3,
+          (plan.Points*2*plan.Cols + (2 + EISDRT_LAMBDAS)*plan.Cols*plan.Cols)*sizeof(double)/1024.0);
+  fprintf(stderr, "batch: %.3f s, %.0f spectra/s on %u threads, %.1f us per spectrum and thread\n", t_batch*1e-6,
+          Spectra/(t_batch*1e-6), Threads ? Threads : 1, t_batch*(Threads ? Threads : 1)/(double)Spectra);
+  fprintf(stderr, "without cached plan: %.1f us per spectrum, one thread\n", t_nocache/(double)nocache);
+  fprintf(stderr, "%u solved, %.1f active set changes, r_pol error mean %.2e max %.2e, residual norm mean %.2e\n",
+          ok, ok ? iter/ok : 0, ok ? err/ok : 0, worst, ok ? res_norm/ok : 0);
+  EisDRTPlanFree(&plan);
+  free(pJob);
+  free(pZ);
+  free(pRPol);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  EisArcReader_Type rd;
+  EisDRTPlan_Type *pPlan = NULL;
+  DrtList_Type list;
+  DrtCapture_Type cap;
+  const char *file = NULL, *capture = NULL;
+  double lambda = 0, start = 0.01, stop = 10000, noise = 0.002;
+  uint32_t tau = 0, threads = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN), bench = 0, points = 50, failed = 0, i;
+  uint64_t from = 0, to = UINT64_MAX, t0;
+  bool gamma = false;
+  int opt_c, device = -1, ret = 0;
+
+  while((opt_c = getopt(argc, argv, "L:T:j:gr:f:b:p:F:e:")) != -1)
+  {
+    switch(opt_c)
+    {
+      case 'L': lambda = strtod(optarg, NULL); break;
+      case 'T': tau = strtoul(optarg, NULL, 0); break;
+      case 'j': threads = atoi(optarg); break;
+      case 'g': gamma = true; break;
+      case 'r': capture = optarg; break;
+      case 'f': file = optarg; break;
+      case 'b': bench = strtoul(optarg, NULL, 0); break;
+      case 'p': points = strtoul(optarg, NULL, 0); break;
+      case 'F':
+        if(sscanf(optarg, "%lf:%lf", &start, &stop) != 2 || !(start > 0) || !(stop > start))
+          Usage();
+        break;
+      case 'e': noise = strtod(optarg, NULL); break;
+      default: Usage();
+    }
+  }
+  if(tau > EISDRT_MAX_TAU || lambda < 0 || points < 3 || points > DRT_MAX_POINTS)
+    Usage();
+  if(bench)
+    return optind == argc ? Benchmark(bench, points, start, stop, noise, tau, lambda, threads) : (Usage(), 2);
+  if(file)
+    return optind == argc ? SolveCsv(file, tau, lambda) : (Usage(), 2);
+
+  memset(&list, 0, sizeof(list));
+  memset(&cap, 0, sizeof(cap));
+  if(capture)
+  {
+    if(optind != argc)
+      Usage();
+    if(ReadCapture(capture, tau, &list, &cap) != 0)
+      return 1;
+  }
+  else
+  {
+    if(optind >= argc || argc - optind > 4)
+      Usage();
+    if(EisArcReaderOpen(&rd, argv[optind]) != 0)
+    {
+      perror(argv[optind]);
+      return 1;
+    }
+    if(argc - optind > 1)
+    {
+      device = EisArcReaderDevice(&rd, argv[optind + 1]);
+      if(device < 0)
+      {
+        fprintf(stderr, "%s: no device %s\n", argv[optind], argv[optind + 1]);
+        EisArcReaderClose(&rd);
+        return 1;
+      }
+    }
+    if(argc - optind > 2)
+      from = strtoull(argv[optind + 2], NULL, 0);
+    if(argc - optind > 3)
+      to = strtoull(argv[optind + 3], NULL, 0);
+    pPlan = calloc(rd.PlanCount + 1, sizeof(EisDRTPlan_Type));
+    for(i=0; pPlan && i<rd.DevCount; i++)
+    {
+      if((device >= 0 && i != (uint32_t)device) || AddDevice(&rd, i, from, to, pPlan, tau, &list) == 0)
+        continue;
+      break;
+    }
+    if(pPlan == NULL || i < rd.DevCount)
+    {
+      fprintf(stderr, "out of memory\n");
+      ret = 1;
+    }
+  }
+
+  t0 = NowUs();
+  EisDRTBatch(list.pJob, list.Count, lambda, threads);
+  t0 = NowUs() - t0;
+  PrintHeader(gamma);
+  for(i=0; i<list.Count; i++)
+  {
+    PrintResult(&list.pRow[i], &list.pJob[i], gamma);
+    failed += list.pJob[i].Result.Status == EISDRT_FAIL;
+  }
+  fprintf(stderr, "%u spectra in %.3f s (%.0f/s, %u threads), %u failed\n", list.Count, t0*1e-6,
+          t0 ? list.Count/(t0*1e-6) : 0, threads, failed);
+
+  if(capture)
+  {
+    for(i=0; i<list.Count; i++)
+      free((void*)list.pJob[i].pReal);
+    for(i=0; i<cap.PlanCount; i++)
+    {
+      EisDRTPlanFree(&cap.pPlan[i]);
+      free(cap.ppPlanFreq[i]);
+    }
+    free(cap.pPlan);
+    free(cap.ppPlanFreq);
+  }
+  else
+  {
+    for(i=0; pPlan && i<rd.PlanCount; i++)
+      EisDRTPlanFree(&pPlan[i]);
+    free(pPlan);
+    EisArcReaderClose(&rd);
+  }
+  free(list.pJob);
+  free(list.pRow);
+  return ret;
+}
@@ -0,0 +1,310 @@
+/*!
+ *****************************************************************************
+ @file:    eis_fit.c
+ @brief:   Fit an equivalent circuit to archived spectra (EisFit.h).
+ -----------------------------------------------------------------------------
+
+ Usage: eis_fit -c circuit -p init[,init...] [options] archive_dir [device [from_us [to_us]]]
+        eis_fit -c circuit -p init[,init...] [options] -f spectrum.csv
+   -c circuit      Circuit string, e.g. "s(R1,p(R1,C1))"
+   -p values       Initial guess, one per parameter
+   -l values       Lower bounds, default 1% of the initial guess
+   -u values       Upper bounds, default 100 times the initial guess
+   -W weight       prop (fitP, default) or none (fitNP)
+   -m iterations   Iteration limit, default 500
+   -j threads      Fitting threads, default number of processors
+   -x              Start every fit from -p instead of the previous sweep
+   -f file         Fit one spectrum from CSV with columns freq_hz,real,image
+
+ Fits every spectrum of the archive, or of one device and time range, and
+ writes one CSV row per spectrum to stdout: device, time, channel, fitted
+ parameters, cost, R squared, points used, iterations and status
+ (0 converged, 1 iteration limit, 2 failed). The sweeps of each device and
+ channel are a chain: each fit starts from the result of the one before.
+ Spectra are read in place from the mapped archive.
+
+ Parameter columns are named after the elements in order, numbered per
+ element type: s(R1,p(R1,C1)) gives R1,R2,C1; a CPE gives Q and n columns.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "EisArchive.h"
+#include "EisFit.h"
+
+#define FIT_MAX_CSV_POINTS    EISARC_MAX_POINTS
+
+typedef struct
+{
+  uint32_t Device;
+  uint64_t TimeUs;
+  uint16_t Channel;
+}FitRow_Type;
+
+static uint64_t NowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: eis_fit -c circuit -p init[,...] [-l lower,...] [-u upper,...] [-W prop|none]\n"
+                  "               [-m iter] [-j threads] [-x] (archive_dir [device [from_us [to_us]]] | -f file.csv)\n");
+  exit(2);
+}
+
+/* Parse comma separated values, returns count */
+static uint32_t ParseList(const char *Str, double *pVal, uint32_t Max)
+{
+  uint32_t n = 0;
+  char *end;
+
+  while(*Str && n < Max)
+  {
+    pVal[n++] = strtod(Str, &end);
+    if(end == Str)
+      Usage();
+    Str = *end == ',' ? end + 1 : end;
+  }
+  return n;
+}
+
+static void PrintHeader(const EisFitCircuit_Type *pCircuit, bool bArchive)
+{
+  uint32_t count[128], i;
+
+  memset(count, 0, sizeof(count));
+  if(bArchive)
+    printf("device,time_us,channel,");
+  for(i=0; i<pCircuit->NodeCount; i++)
+  {
+    const EisFitNode_Type *pNode = &pCircuit->Node[i];
+    if(pNode->Op != EISFIT_NODE_ELEM)
+      continue;
+    count[(uint8_t)pNode->Elem]++;
+    if(pNode->Elem == 'E')
+      printf("Q%u,n%u,", count['E'], count['E']);
+    else
+      printf("%c%u,", pNode->Elem, count[(uint8_t)pNode->Elem]);
+  }
+  printf("cost,rsquared,points,iterations,status\n");
+}
+
+static void PrintResult(const EisFitCircuit_Type *pCircuit, const EisFitResult_Type *pResult)
+{
+  uint32_t k;
+
+  for(k=0; k<pCircuit->ParamCount; k++)
+    printf("%.6g,", pResult->Param[k]);
+  printf("%.6g,%.6f,%u,%u,%u\n", pResult->Cost, pResult->RSquared, pResult->Points, pResult->Iter, pResult->Status);
+}
+
+static int FitCsv(const EisFitCircuit_Type *pCircuit, const EisFitOpt_Type *pOpt, const char *File)
+{
+  static float freq[FIT_MAX_CSV_POINTS], re[FIT_MAX_CSV_POINTS], im[FIT_MAX_CSV_POINTS];
+  EisFitResult_Type result;
+  char line[256];
+  uint32_t n = 0;
+  FILE *in = strcmp(File, "-") == 0 ? stdin : fopen(File, "r");
+
+  if(in == NULL)
+  {
+    perror(File);
+    return 1;
+  }
+  while(fgets(line, sizeof(line), in) && n < FIT_MAX_CSV_POINTS)
+  {
+    /* Header and other lines that are not numbers are skipped */
+    if(sscanf(line, "%f,%f,%f", &freq[n], &re[n], &im[n]) == 3)
+      n++;
+  }
+  if(in != stdin)
+    fclose(in);
+  if(EisFit(pCircuit, pOpt, NULL, n, freq, re, im, &result) != 0)
+  {
+    fprintf(stderr, "%s: too few valid points (%u)\n", File, n);
+    return 1;
+  }
+  PrintHeader(pCircuit, false);
+  PrintResult(pCircuit, &result);
+  return 0;
+}
+
+/* Add spectra of one device to the jobs, in time order */
+static int AddDevice(const EisArcReader_Type *pRd, uint32_t Device, uint64_t From, uint64_t To,
+                     EisFitJob_Type **ppJob, FitRow_Type **ppRow, uint32_t *pCount, uint32_t *pCap)
+{
+  const EisArcIndex_Type **ppEntry;
+  EisArcView_Type view;
+  uint32_t count = EisArcQuery(pRd, Device, From, To, NULL, 0), i, j;
+
+  ppEntry = malloc((count + 1)*sizeof(*ppEntry));
+  if(ppEntry == NULL)
+    return -1;
+  EisArcQuery(pRd, Device, From, To, ppEntry, count);
+  for(i=0; i<count; i++)
+  {
+    if(EisArcView(pRd, ppEntry[i], &view) != 0 || view.Kind != EISARC_KIND_SPECTRA)
+      continue;
+    for(j=0; j<view.Count; j++)
+    {
+      EisFitJob_Type *pJob;
+      if(view.pTime[j] < From || view.pTime[j] > To)
+        continue;
+      if(*pCount == *pCap)
+      {
+        uint32_t cap = *pCap ? *pCap*2 : 1024;
+        EisFitJob_Type *pJ = realloc(*ppJob, cap*sizeof(EisFitJob_Type));
+        FitRow_Type *pR = realloc(*ppRow, cap*sizeof(FitRow_Type));
+        if(pJ) *ppJob = pJ;
+        if(pR) *ppRow = pR;
+        if(pJ == NULL || pR == NULL)
+        {
+          free(ppEntry);
+          return -1;
+        }
+        *pCap = cap;
+      }
+      pJob = &(*ppJob)[*pCount];
+      memset(pJob, 0, sizeof(*pJob));
+      pJob->Points = view.Points;
+      pJob->pFreq = view.pFreq;
+      pJob->pReal = &view.pReal[(size_t)j*view.Points];
+      pJob->pImage = &view.pImage[(size_t)j*view.Points];
+      pJob->Chain = (uint64_t)Device << 16 | view.pChannel[j];
+      (*ppRow)[*pCount].Device = Device;
+      (*ppRow)[*pCount].TimeUs = view.pTime[j];
+      (*ppRow)[*pCount].Channel = view.pChannel[j];
+      (*pCount)++;
+    }
+  }
+  free(ppEntry);
+  return 0;
+}
+
+/* By chain, then in the order the spectra were added */
+static int CompareJob(const void *pA, const void *pB)
+{
+  const EisFitJob_Type *a = pA, *b = pB;
+
+  if(a->Chain != b->Chain)
+    return a->Chain < b->Chain ? -1 : 1;
+  return a->pUser < b->pUser ? -1 : a->pUser > b->pUser;
+}
+
+int main(int argc, char **argv)
+{
+  EisFitCircuit_Type circuit;
+  EisFitOpt_Type opt;
+  EisArcReader_Type rd;
+  EisFitJob_Type *pJob = NULL;
+  FitRow_Type *pRow = NULL;
+  const char *circuit_str = NULL, *file = NULL;
+  double init[EISFIT_MAX_PARAM], lower[EISFIT_MAX_PARAM], upper[EISFIT_MAX_PARAM];
+  uint32_t n_init = 0, n_lower = 0, n_upper = 0, weight = EISFIT_WEIGHT_PROP, max_iter = 500;
+  uint32_t threads = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN), count = 0, cap = 0, i, failed = 0;
+  uint64_t from = 0, to = UINT64_MAX, t0;
+  bool cold = false;
+  char err[128];
+  int opt_c, device = -1;
+
+  while((opt_c = getopt(argc, argv, "c:p:l:u:W:m:j:xf:")) != -1)
+  {
+    switch(opt_c)
+    {
+      case 'c': circuit_str = optarg; break;
+      case 'p': n_init = ParseList(optarg, init, EISFIT_MAX_PARAM); break;
+      case 'l': n_lower = ParseList(optarg, lower, EISFIT_MAX_PARAM); break;
+      case 'u': n_upper = ParseList(optarg, upper, EISFIT_MAX_PARAM); break;
+      case 'W':
+        if(strcmp(optarg, "prop") == 0) weight = EISFIT_WEIGHT_PROP;
+        else if(strcmp(optarg, "none") == 0) weight = EISFIT_WEIGHT_NONE;
+        else Usage();
+        break;
+      case 'm': max_iter = atoi(optarg); break;
+      case 'j': threads = atoi(optarg); break;
+      case 'x': cold = true; break;
+      case 'f': file = optarg; break;
+      default: Usage();
+    }
+  }
+  if(circuit_str == NULL || (file == NULL && (optind >= argc || argc - optind > 4)))
+    Usage();
+  if(EisFitParse(circuit_str, &circuit, err, sizeof(err)) != 0)
+  {
+    fprintf(stderr, "%s: %s\n", circuit_str, err);
+    return 2;
+  }
+  if(n_init != circuit.ParamCount || (n_lower && n_lower != n_init) || (n_upper && n_upper != n_init))
+  {
+    fprintf(stderr, "%s has %u parameters, give as many values\n", circuit_str, circuit.ParamCount);
+    return 2;
+  }
+  EisFitOptInit(&opt, &circuit, init);
+  opt.Weight = weight;
+  opt.MaxIter = max_iter;
+  for(i=0; i<n_lower; i++)
+    opt.Lower[i] = lower[i];
+  for(i=0; i<n_upper; i++)
+    opt.Upper[i] = upper[i];
+  if(file)
+    return FitCsv(&circuit, &opt, file);
+
+  if(EisArcReaderOpen(&rd, argv[optind]) != 0)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+  if(argc - optind > 1)
+  {
+    device = EisArcReaderDevice(&rd, argv[optind + 1]);
+    if(device < 0)
+    {
+      fprintf(stderr, "%s: no device %s\n", argv[optind], argv[optind + 1]);
+      EisArcReaderClose(&rd);
+      return 1;
+    }
+  }
+  if(argc - optind > 2)
+    from = strtoull(argv[optind + 2], NULL, 0);
+  if(argc - optind > 3)
+    to = strtoull(argv[optind + 3], NULL, 0);
+  for(i=0; i<rd.DevCount; i++)
+  {
+    if((device >= 0 && i != (uint32_t)device) || AddDevice(&rd, i, from, to, &pJob, &pRow, &count, &cap) == 0)
+      continue;
+    fprintf(stderr, "out of memory\n");
+    EisArcReaderClose(&rd);
+    return 1;
+  }
+  /* Chains must be contiguous: group channels of a device, keep time order */
+  for(i=0; i<count; i++)
+    pJob[i].pUser = &pRow[i];
+  qsort(pJob, count, sizeof(EisFitJob_Type), CompareJob);
+  if(cold)
+    for(i=0; i<count; i++)
+      pJob[i].Chain = i;
+
+  t0 = NowUs();
+  EisFitBatch(&circuit, &opt, pJob, count, threads);
+  t0 = NowUs() - t0;
+  PrintHeader(&circuit, true);
+  for(i=0; i<count; i++)
+  {
+    const FitRow_Type *pR = pJob[i].pUser;
+    printf("%s,%llu,%u,", EisArcReaderDeviceId(&rd, pR->Device), (unsigned long long)pR->TimeUs, pR->Channel);
+    PrintResult(&circuit, &pJob[i].Result);
+    failed += pJob[i].Result.Status == EISFIT_FAIL;
+  }
+  fprintf(stderr, "%u spectra in %.3f s (%.0f/s, %u threads), %u failed\n", count, t0*1e-6,
+          t0 ? count/(t0*1e-6) : 0, threads, failed);
+  free(pJob);
+  free(pRow);
+  EisArcReaderClose(&rd);
+  return 0;
+}
@@ -0,0 +1,1242 @@
+/*!
+ *****************************************************************************
+ @file:    eis_ingest.c
+ @brief:   Ingest daemon: device data topics to a columnar archive (EisArchive.h).
+ -----------------------------------------------------------------------------
+
+ Usage: eis_ingest [options] archive_dir
+   -b host[:port]  Subscribe at an MQTT broker (default port 1883)
+   -l port         Stand in for a broker: accept device connections directly
+   -f file         Replay captured MQTT PUBLISH packets, - for stdin
+   -t filter       Topic filter, default eis/device/+/data/#
+   -w workers      Decode threads, default 2
+   -n points       Points per archive block, default 4096
+   -a ms           Write a device's block after this age even if not full, default 1000
+   -q depth        Messages queued per worker, default 1024
+   -d              Drop messages when a queue is full instead of waiting
+   -s ms           fdatasync interval, default 1000, 0 only at exit
+   -c s            Index compaction interval, default 600, 0 only at exit
+   -i s            Statistics interval, default 5
+   -k threshold    Lin-KK test of every spectrum (EisKK.h), largest residual
+                   relative to |Z| that passes, e.g. 0.02. Default off
+
+ Pipeline: one receiver thread serves all connections with poll() and
+ hands each data message to a worker chosen by device, so the frames of a
+ device stay in order and its state has a single owner. Workers decode
+ result stream frames (ResultStream.h) and collect points per device in
+ columns. Full or old batches go to one writer thread that appends them
+ to the archive.
+
+ Points are assembled into sweeps by SweepIndex. A sweep ends with the
+ last record of a frame flagged RSTREAM_FLAG_SWEEPEND, when an index
+ repeats or goes back, after a minute without points or at exit. It is
+ stored as one spectrum over the device's current plan if the points it
+ has match the plan's frequencies, with NaN for the points it lacks. So
+ a sweep cut short, e.g. the last one of a stopped job, is stored as a
+ spectrum padded with NaN up to the plan's length. A complete sweep on a
+ new grid starts a new plan. Sweeps that match no plan are stored as
+ loose points. So are sweeps the device flagged RSTREAM_FLAG_KKFAIL and, with -k,
+ sweeps that fail the Lin-KK test here, so spectrum readers such as
+ eis_fit only see Kramers-Kronig consistent spectra. The test basis is
+ computed once per plan and worker.
+
+ Queues are bounded. By default a full queue blocks the receiver, which
+ stops reading sockets and so pushes back on the broker or devices; QoS 1
+ messages are acknowledged only once queued. With -d messages are dropped
+ instead. Statistics report queue depth, time the receiver spent waiting
+ and drops, so a backlog shows before data is lost.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "ResultStream.h"
+#include "MqttLite.h"
+#include "EisArchive.h"
+#include "EisKK.h"
+
+#define INGEST_MAX_WORKERS    64
+#define INGEST_MAX_CONN       4096
+#define INGEST_RX_BUFF        (64*1024)
+#define INGEST_KEEPALIVE_S    30
+#define INGEST_SCAN_MS        100       /* Period of age check on batches */
+#define INGEST_BOARD_UNKNOWN  0xFFFF
+#define INGEST_SWEEP_IDLE_MS  60000     /* Store unfinished sweep after this long without points */
+
+typedef struct
+{
+  const char *Dir;
+  const char *Broker;
+  uint16_t ListenPort;
+  const char *File;
+  const char *Filter;
+  uint32_t Workers;
+  uint32_t BatchPoints;
+  uint32_t BatchAgeMs;
+  uint32_t QueueDepth;
+  bool bDrop;
+  uint32_t SyncMs;
+  uint32_t CompactS;
+  uint32_t StatsS;
+  double KKThreshold;           /* 0 for no Lin-KK test */
+}IngestCfg_Type;
+
+/* Bounded queue of pointers */
+typedef struct
+{
+  pthread_mutex_t Lock;
+  pthread_cond_t NotEmpty;
+  pthread_cond_t NotFull;
+  void **pItem;
+  uint32_t Size;
+  uint32_t Head;
+  uint32_t Count;
+  bool bClosed;
+/* Backpressure statistics */
+  uint64_t Pushed;
+  uint64_t Dropped;
+  uint64_t FullWaits;           /* Pushes that found the queue full */
+  uint64_t WaitUs;              /* Time producers spent waiting for room */
+  uint32_t MaxDepth;
+}IngestQueue_Type;
+
+typedef struct
+{
+  uint64_t RecvUs;
+  uint32_t Board;
+  uint32_t Len;
+  char Id[EISARC_ID_LEN];
+  uint8_t Data[];
+}IngestMsg_Type;
+
+typedef struct
+{
+  uint32_t Kind;                /* EISARC_KIND_xxx */
+  uint32_t Device;
+  uint32_t Board;
+  uint16_t Flags;
+  uint32_t Plan;
+  uint32_t Points;              /* Per spectrum */
+  uint32_t Count;               /* Points or spectra */
+  uint32_t Cap;
+  uint32_t Lost;
+  uint64_t FirstRecvUs;         /* Receive time of oldest message in batch */
+  uint64_t *pTime;
+  uint32_t *pDuration;          /* Spectra only */
+  float *pFreq;                 /* Points only */
+  uint16_t *pSweep;             /* Points only */
+  uint16_t *pChannel;
+  float *pReal;
+  float *pImage;
+}IngestBatch_Type;
+
+/* Sweep being assembled, columns indexed by SweepIndex */
+typedef struct
+{
+  uint32_t Cap;
+  uint32_t Have;                /* Points present */
+  uint32_t End;                 /* Highest index + 1 */
+  uint32_t Last;                /* Index of last point */
+  uint16_t Flags;
+  uint16_t Channel;
+  bool bKKFail;                 /* Device flagged the sweep RSTREAM_FLAG_KKFAIL */
+  uint64_t LastRecvUs;
+  uint8_t *pSeen;
+  uint64_t *pTime;
+  float *pFreq;
+  float *pReal;
+  float *pImage;
+}IngestSweep_Type;
+
+/* Per device and board state, owned by one worker */
+typedef struct
+{
+  char Id[EISARC_ID_LEN];
+  uint32_t Board;
+  uint32_t Device;              /* Archive device number */
+  uint32_t Plan;                /* Plan of last spectrum */
+  RStreamDec_Type Dec;
+  uint32_t FrameRec;            /* Records of current frame seen so far */
+  uint32_t LostReported;        /* Dec.Lost already written to a block */
+  IngestSweep_Type Sweep;
+  IngestBatch_Type *pBatch;     /* Loose points */
+  IngestBatch_Type *pSpec;      /* Spectra */
+}IngestDev_Type;
+
+typedef struct
+{
+  uint32_t Index;
+  pthread_t Thread;
+  IngestQueue_Type Queue;
+  IngestDev_Type **pDev;        /* Open addressing hash table */
+  uint32_t DevSize;
+  uint32_t DevCount;
+  IngestDev_Type *pCur;         /* Device being decoded */
+  uint64_t CurRecvUs;
+  EisKKPlan_Type *pKK;          /* Lin-KK basis by archive plan, made on first use */
+  uint32_t KKCount;
+/* Statistics, read by stats thread without lock */
+  volatile uint64_t Messages;
+  volatile uint64_t Frames;
+  volatile uint64_t Points;
+  volatile uint64_t Spectra;
+  volatile uint64_t Rejected;   /* Sweeps stored as points after failing Lin-KK */
+  volatile uint64_t BadFrames;
+  volatile uint64_t Lost;
+}IngestWorker_Type;
+
+static IngestCfg_Type Cfg = {
+  .Filter = "eis/device/+/data/#",
+  .Workers = 2,
+  .BatchPoints = 4096,
+  .BatchAgeMs = 1000,
+  .QueueDepth = 1024,
+  .SyncMs = 1000,
+  .CompactS = 600,
+  .StatsS = 5,
+};
+
+static EisArc_Type Arc;
+static IngestWorker_Type Worker[INGEST_MAX_WORKERS];
+static IngestQueue_Type WriteQueue;
+static volatile sig_atomic_t bQuit;
+
+/* Receiver statistics */
+static volatile uint64_t RxMessages, RxBytes, RxOther, RxConnections;
+/* Writer statistics */
+static volatile uint64_t WrBatches, WrPoints, WrSpectra, WrErrors, WrLatencySumUs, WrLatencyMaxUs;
+
+static uint64_t NowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void OnSignal(int Sig)
+{
+  (void)Sig;
+  bQuit = 1;
+}
+
+static int QueueInit(IngestQueue_Type *pQ, uint32_t Size)
+{
+  memset(pQ, 0, sizeof(*pQ));
+  pthread_mutex_init(&pQ->Lock, NULL);
+  pthread_cond_init(&pQ->NotEmpty, NULL);
+  pthread_cond_init(&pQ->NotFull, NULL);
+  pQ->pItem = calloc(Size, sizeof(void*));
+  pQ->Size = Size;
+  return pQ->pItem ? 0 : -1;
+}
+
+/**
+ * @brief Add item, waiting for room unless bDrop.
+ * @return -1 if the item was not queued, caller keeps ownership.
+*/
+static int QueuePush(IngestQueue_Type *pQ, void *pItem, bool bDrop)
+{
+  pthread_mutex_lock(&pQ->Lock);
+  if(pQ->Count == pQ->Size && !pQ->bClosed)
+  {
+    pQ->FullWaits++;
+    if(bDrop)
+    {
+      pQ->Dropped++;
+      pthread_mutex_unlock(&pQ->Lock);
+      return -1;
+    }
+    uint64_t t0 = NowUs();
+    while(pQ->Count == pQ->Size && !pQ->bClosed)
+      pthread_cond_wait(&pQ->NotFull, &pQ->Lock);
+    pQ->WaitUs += NowUs() - t0;
+  }
+  if(pQ->bClosed)
+  {
+    pthread_mutex_unlock(&pQ->Lock);
+    return -1;
+  }
+  pQ->pItem[(pQ->Head + pQ->Count)%pQ->Size] = pItem;
+  pQ->Count++;
+  pQ->Pushed++;
+  if(pQ->Count > pQ->MaxDepth)
+    pQ->MaxDepth = pQ->Count;
+  pthread_cond_signal(&pQ->NotEmpty);
+  pthread_mutex_unlock(&pQ->Lock);
+  return 0;
+}
+
+/**
+ * @brief Take item, waiting up to TimeoutMs.
+ * @return NULL on timeout, or when the queue is closed and empty (*pbClosed set).
+*/
+static void *QueuePop(IngestQueue_Type *pQ, uint32_t TimeoutMs, bool *pbClosed)
+{
+  struct timespec ts;
+  void *pItem = NULL;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += TimeoutMs/1000;
+  ts.tv_nsec += (TimeoutMs%1000)*1000000L;
+  if(ts.tv_nsec >= 1000000000L)
+  {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000L;
+  }
+  pthread_mutex_lock(&pQ->Lock);
+  while(pQ->Count == 0 && !pQ->bClosed)
+    if(pthread_cond_timedwait(&pQ->NotEmpty, &pQ->Lock, &ts) == ETIMEDOUT)
+      break;
+  if(pQ->Count)
+  {
+    pItem = pQ->pItem[pQ->Head];
+    pQ->Head = (pQ->Head + 1)%pQ->Size;
+    pQ->Count--;
+    pthread_cond_signal(&pQ->NotFull);
+  }
+  *pbClosed = (pItem == NULL && pQ->bClosed);
+  pthread_mutex_unlock(&pQ->Lock);
+  return pItem;
+}
+
+static void QueueClose(IngestQueue_Type *pQ)
+{
+  pthread_mutex_lock(&pQ->Lock);
+  pQ->bClosed = true;
+  pthread_cond_broadcast(&pQ->NotEmpty);
+  pthread_cond_broadcast(&pQ->NotFull);
+  pthread_mutex_unlock(&pQ->Lock);
+}
+
+static uint32_t HashStr(const char *Str, uint32_t Board)
+{
+  uint32_t h = 2166136261u ^ Board;
+  while(*Str)
+    h = (h ^ (uint8_t)*Str++)*16777619u;
+  return h;
+}
+
+/* ---------------------------------------------------------------- Workers */
+
+static IngestBatch_Type *BatchNew(const IngestDev_Type *pDev, uint32_t Kind, uint32_t Cap, uint32_t Points)
+{
+  size_t rec = Kind == EISARC_KIND_SPECTRA ?
+               sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint16_t) + 2*Points*sizeof(float) :
+               sizeof(uint64_t) + 4*sizeof(float) + 2*sizeof(uint16_t);
+  IngestBatch_Type *pBatch = malloc(sizeof(IngestBatch_Type) + Cap*rec);
+  uint8_t *p;
+
+  if(pBatch == NULL)
+    return NULL;
+  memset(pBatch, 0, sizeof(*pBatch));
+  pBatch->Kind = Kind;
+  pBatch->Device = pDev->Device;
+  pBatch->Board = pDev->Board;
+  pBatch->Plan = EISARC_NO_PLAN;
+  pBatch->Cap = Cap;
+  p = (uint8_t*)(pBatch + 1);
+  pBatch->pTime = (uint64_t*)p;     p += Cap*sizeof(uint64_t);
+  if(Kind == EISARC_KIND_SPECTRA)
+  {
+    pBatch->Points = Points;
+    pBatch->pReal = (float*)p;      p += Cap*Points*sizeof(float);
+    pBatch->pImage = (float*)p;     p += Cap*Points*sizeof(float);
+    pBatch->pDuration = (uint32_t*)p; p += Cap*sizeof(uint32_t);
+  }
+  else
+  {
+    pBatch->pFreq = (float*)p;      p += Cap*sizeof(float);
+    pBatch->pReal = (float*)p;      p += Cap*sizeof(float);
+    pBatch->pImage = (float*)p;     p += Cap*sizeof(float);
+    pBatch->pSweep = (uint16_t*)p;  p += Cap*sizeof(uint16_t);
+  }
+  pBatch->pChannel = (uint16_t*)p;
+  return pBatch;
+}
+
+/* Hand batch to writer */
+static void BatchFlush(IngestDev_Type *pDev, IngestBatch_Type **ppBatch)
+{
+  IngestBatch_Type *pBatch = *ppBatch;
+
+  if(pBatch == NULL)
+    return;
+  *ppBatch = NULL;
+  pBatch->Lost = pDev->Dec.Lost > pDev->LostReported ? pDev->Dec.Lost - pDev->LostReported : 0;
+  pDev->LostReported = pDev->Dec.Lost;
+  /* Writer must not lose data: always wait, also with -d */
+  if(QueuePush(&WriteQueue, pBatch, false) != 0)
+    free(pBatch);
+}
+
+static void PointAdd(IngestWorker_Type *pW, IngestDev_Type *pDev, uint16_t Flags, uint64_t TimeUs, float Freq,
+                     uint16_t SweepIndex, uint16_t Channel, float Real, float Image)
+{
+  IngestBatch_Type *pBatch = pDev->pBatch;
+  uint32_t i;
+
+  if(pBatch && pBatch->Flags != Flags)
+  {
+    BatchFlush(pDev, &pDev->pBatch);
+    pBatch = NULL;
+  }
+  if(pBatch == NULL)
+  {
+    pBatch = pDev->pBatch = BatchNew(pDev, EISARC_KIND_POINTS, Cfg.BatchPoints, 0);
+    if(pBatch == NULL)
+      return;
+    pBatch->Flags = Flags;
+    pBatch->FirstRecvUs = pW->CurRecvUs;
+  }
+  i = pBatch->Count++;
+  pBatch->pTime[i] = TimeUs;
+  pBatch->pFreq[i] = Freq;
+  pBatch->pSweep[i] = SweepIndex;
+  pBatch->pChannel[i] = Channel;
+  pBatch->pReal[i] = Real;
+  pBatch->pImage[i] = Image;
+  if(pBatch->Count == pBatch->Cap)
+    BatchFlush(pDev, &pDev->pBatch);
+}
+
+/* Add the assembled sweep as one spectrum of Points values over Plan */
+static void SpectrumAdd(IngestWorker_Type *pW, IngestDev_Type *pDev, uint32_t Plan, uint32_t Points)
+{
+  IngestSweep_Type *pS = &pDev->Sweep;
+  IngestBatch_Type *pBatch = pDev->pSpec;
+  uint64_t t_min = UINT64_MAX, t_max = 0;
+  float *pRe, *pIm;
+  uint32_t i, n;
+
+  if(pBatch && (pBatch->Plan != Plan || pBatch->Flags != pS->Flags))
+  {
+    BatchFlush(pDev, &pDev->pSpec);
+    pBatch = NULL;
+  }
+  if(pBatch == NULL)
+  {
+    pBatch = pDev->pSpec = BatchNew(pDev, EISARC_KIND_SPECTRA, Cfg.BatchPoints > Points ? Cfg.BatchPoints/Points : 1, Points);
+    if(pBatch == NULL)
+      return;
+    pBatch->Plan = Plan;
+    pBatch->Flags = pS->Flags;
+    pBatch->FirstRecvUs = pW->CurRecvUs;
+  }
+  n = pBatch->Count++;
+  pRe = &pBatch->pReal[(size_t)n*Points];
+  pIm = &pBatch->pImage[(size_t)n*Points];
+  for(i=0; i<Points; i++)
+  {
+    if(i < pS->End && pS->pSeen[i])
+    {
+      pRe[i] = pS->pReal[i];
+      pIm[i] = pS->pImage[i];
+      if(pS->pTime[i] < t_min) t_min = pS->pTime[i];
+      if(pS->pTime[i] > t_max) t_max = pS->pTime[i];
+    }
+    else
+      pRe[i] = pIm[i] = NAN;
+  }
+  pBatch->pTime[n] = t_min;
+  pBatch->pDuration[n] = t_max - t_min > UINT32_MAX ? UINT32_MAX : (uint32_t)(t_max - t_min);
+  pBatch->pChannel[n] = pS->Channel;
+  pW->Spectra++;
+  if(pBatch->Count == pBatch->Cap)
+    BatchFlush(pDev, &pDev->pSpec);
+}
+
+/* Frequencies of the sweep agree with a plan */
+static bool SweepMatches(const IngestSweep_Type *pS, const float *pFreq, uint32_t Points)
+{
+  uint32_t i;
+
+  if(pS->End > Points)
+    return false;
+  for(i=0; i<pS->End; i++)
+    if(pS->pSeen[i] && pS->pFreq[i] != pFreq[i])
+      return false;
+  return true;
+}
+
+/* Lin-KK test of the sweep over Plan, false if it fails */
+static bool SweepKK(IngestWorker_Type *pW, IngestSweep_Type *pS, uint32_t Plan, const float *pFreq, uint32_t Points)
+{
+  EisKKResult_Type res;
+  uint32_t i;
+
+  if(Plan >= pW->KKCount)
+  {
+    uint32_t count = Plan + 16;
+    EisKKPlan_Type *p = realloc(pW->pKK, count*sizeof(EisKKPlan_Type));
+    if(p == NULL)
+      return true;
+    memset(&p[pW->KKCount], 0, (count - pW->KKCount)*sizeof(EisKKPlan_Type));
+    pW->pKK = p;
+    pW->KKCount = count;
+  }
+  if(pW->pKK[Plan].pA == NULL && EisKKPlanInit(&pW->pKK[Plan], pFreq, Points, 0) != 0)
+    return true;
+  /* Lost points are skipped by the test */
+  for(i=0; i<pS->End; i++)
+    if(!pS->pSeen[i])
+      pS->pReal[i] = pS->pImage[i] = NAN;
+  if(EisKKTest(&pW->pKK[Plan], pS->End < Points ? pS->End : Points, pS->pReal, pS->pImage, Cfg.KKThreshold, &res) != 0)
+    return true;
+  return res.bPass;
+}
+
+/**
+ * @brief Store the assembled sweep and start a new one.
+ * @param bEnd: Device marked the sweep as finished, so a complete sweep on
+ *              a new frequency grid may start a new plan.
+*/
+static void SweepFinish(IngestWorker_Type *pW, IngestDev_Type *pDev, bool bEnd)
+{
+  IngestSweep_Type *pS = &pDev->Sweep;
+  const float *pFreq = NULL;
+  uint32_t plan = EISARC_NO_PLAN, points = 0, i;
+
+  if(pS->Have == 0)
+    return;
+  if(pDev->Plan != EISARC_NO_PLAN)
+  {
+    pFreq = EisArcPlanFreq(&Arc, pDev->Plan, &points);
+    if(pFreq && SweepMatches(pS, pFreq, points))
+      plan = pDev->Plan;
+  }
+  if(plan == EISARC_NO_PLAN && bEnd && pS->Have == pS->End &&
+     EisArcPlan(&Arc, pS->pFreq, pS->End, &plan) == 0)
+  {
+    pDev->Plan = plan;
+    points = pS->End;
+    pFreq = pS->pFreq;
+  }
+  if(plan != EISARC_NO_PLAN && (pS->bKKFail || (Cfg.KKThreshold > 0 &&
+     !SweepKK(pW, pS, plan, pFreq, points))))
+  {
+    pW->Rejected++;
+    plan = EISARC_NO_PLAN;
+  }
+  if(plan != EISARC_NO_PLAN)
+    SpectrumAdd(pW, pDev, plan, points);
+  else
+  {
+    for(i=0; i<pS->End; i++)
+      if(pS->pSeen[i])
+        PointAdd(pW, pDev, pS->Flags, pS->pTime[i], pS->pFreq[i], i, pS->Channel, pS->pReal[i], pS->pImage[i]);
+  }
+  memset(pS->pSeen, 0, pS->End);
+  pS->Have = pS->End = 0;
+  pS->bKKFail = false;
+}
+
+/* Make room for sweep index Index */
+static int SweepGrow(IngestSweep_Type *pS, uint32_t Index)
+{
+  uint32_t cap = pS->Cap ? pS->Cap : 64;
+  uint8_t *p, *pOld = pS->pSeen;
+
+  while(cap <= Index)
+    cap *= 2;
+  p = calloc(cap, sizeof(uint64_t) + 3*sizeof(float) + 1);
+  if(p == NULL)
+    return -1;
+  pS->pSeen = p + cap*(sizeof(uint64_t) + 3*sizeof(float));
+  if(pOld)
+  {
+    memcpy(p, pS->pTime, pS->End*sizeof(uint64_t));
+    memcpy(p + cap*sizeof(uint64_t), pS->pFreq, pS->End*sizeof(float));
+    memcpy(p + cap*(sizeof(uint64_t) + sizeof(float)), pS->pReal, pS->End*sizeof(float));
+    memcpy(p + cap*(sizeof(uint64_t) + 2*sizeof(float)), pS->pImage, pS->End*sizeof(float));
+    memcpy(pS->pSeen, pOld, pS->End);
+    free(pS->pTime);
+  }
+  pS->pTime = (uint64_t*)p;
+  pS->pFreq = (float*)(p + cap*sizeof(uint64_t));
+  pS->pReal = (float*)(p + cap*(sizeof(uint64_t) + sizeof(float)));
+  pS->pImage = (float*)(p + cap*(sizeof(uint64_t) + 2*sizeof(float)));
+  pS->Cap = cap;
+  return 0;
+}
+
+static void OnPoint(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamPoint_Type *pPoint)
+{
+  IngestWorker_Type *pW = pUser;
+  IngestDev_Type *pDev = pW->pCur;
+  IngestSweep_Type *pS = &pDev->Sweep;
+  uint16_t flags = pPoint->bHostTime ? EISARC_FLAG_HOSTTIME : 0;
+  uint32_t i = pPoint->SweepIndex;
+
+  pW->Points++;
+  pDev->FrameRec++;
+  if(i >= EISARC_MAX_POINTS || (i >= pS->Cap && SweepGrow(pS, i) != 0))
+  {
+    PointAdd(pW, pDev, flags, pPoint->TimeUs, pPoint->Freq, i, pPoint->Channel, pPoint->Z.Real, pPoint->Z.Image);
+    return;
+  }
+  if(pS->Have && (pS->pSeen[i] || i < pS->Last || pS->Flags != flags || pS->Channel != pPoint->Channel))
+    SweepFinish(pW, pDev, false);
+  pS->pSeen[i] = 1;
+  pS->pTime[i] = pPoint->TimeUs;
+  pS->pFreq[i] = pPoint->Freq;
+  pS->pReal[i] = pPoint->Z.Real;
+  pS->pImage[i] = pPoint->Z.Image;
+  pS->Have++;
+  pS->Last = i;
+  pS->Flags = flags;
+  pS->Channel = pPoint->Channel;
+  pS->LastRecvUs = pW->CurRecvUs;
+  if(i >= pS->End)
+    pS->End = i + 1;
+  if(pInfo->Flags & RSTREAM_FLAG_KKFAIL)
+    pS->bKKFail = true;
+  if((pInfo->Flags & RSTREAM_FLAG_SWEEPEND) && pDev->FrameRec == pInfo->Count)
+    SweepFinish(pW, pDev, true);
+}
+
+static IngestDev_Type *WorkerDevice(IngestWorker_Type *pW, const char *Id, uint32_t Board)
+{
+  uint32_t h, i;
+  IngestDev_Type *pDev;
+
+  if((pW->DevCount + 1)*2 > pW->DevSize)
+  {
+    uint32_t size = pW->DevSize ? pW->DevSize*2 : 256;
+    IngestDev_Type **pTab = calloc(size, sizeof(IngestDev_Type*));
+    if(pTab == NULL)
+      return NULL;
+    for(i=0; i<pW->DevSize; i++)
+    {
+      if(pW->pDev[i] == NULL)
+        continue;
+      h = HashStr(pW->pDev[i]->Id, pW->pDev[i]->Board)&(size - 1);
+      while(pTab[h])
+        h = (h + 1)&(size - 1);
+      pTab[h] = pW->pDev[i];
+    }
+    free(pW->pDev);
+    pW->pDev = pTab;
+    pW->DevSize = size;
+  }
+  h = HashStr(Id, Board)&(pW->DevSize - 1);
+  while(pW->pDev[h])
+  {
+    if(pW->pDev[h]->Board == Board && strcmp(pW->pDev[h]->Id, Id) == 0)
+      return pW->pDev[h];
+    h = (h + 1)&(pW->DevSize - 1);
+  }
+  pDev = calloc(1, sizeof(IngestDev_Type));
+  if(pDev == NULL)
+    return NULL;
+  strcpy(pDev->Id, Id);
+  pDev->Board = Board;
+  pDev->Plan = EISARC_NO_PLAN;
+  if(EisArcDevice(&Arc, Id, &pDev->Device) != 0)
+  {
+    free(pDev);
+    return NULL;
+  }
+  RStreamDecInit(&pDev->Dec, OnPoint, pW);
+  pW->pDev[h] = pDev;
+  pW->DevCount++;
+  return pDev;
+}
+
+/* Decode a payload of frames packed back to back */
+static void WorkerDecode(IngestWorker_Type *pW, IngestDev_Type *pDev, const uint8_t *p, uint32_t Len)
+{
+  const uint8_t *end = p + Len;
+  uint32_t frame_len;
+
+  pW->pCur = pDev;
+  while(end - p >= RSTREAM_HEADER_LEN)
+  {
+    frame_len = RSTREAM_HEADER_LEN + (p[6] | p[7] << 8) + RSTREAM_CRC_LEN;
+    pDev->FrameRec = 0;
+    if((p[0] | p[1] << 8) != RSTREAM_SYNC || frame_len > (uint32_t)(end - p) ||
+       RStreamDecFrame(&pDev->Dec, p, frame_len) != AD5940ERR_OK)
+    {
+      /* Resynchronize on next sync word */
+      pW->BadFrames++;
+      for(p++; end - p >= 2 && (p[0] | p[1] << 8) != RSTREAM_SYNC; p++);
+      continue;
+    }
+    pW->Frames++;
+    p += frame_len;
+  }
+  if(p < end)
+    pW->BadFrames++;          /* Truncated frame */
+}
+
+static void *WorkerMain(void *pArg)
+{
+  IngestWorker_Type *pW = pArg;
+  IngestMsg_Type *pMsg;
+  uint64_t last_scan = NowUs(), now;
+  bool closed = false;
+  uint32_t i;
+
+  while(!closed)
+  {
+    pMsg = QueuePop(&pW->Queue, INGEST_SCAN_MS, &closed);
+    if(pMsg)
+    {
+      IngestDev_Type *pDev = WorkerDevice(pW, pMsg->Id, pMsg->Board);
+      pW->Messages++;
+      if(pDev)
+      {
+        uint32_t lost = pDev->Dec.Lost;
+        pW->CurRecvUs = pMsg->RecvUs;
+        WorkerDecode(pW, pDev, pMsg->Data, pMsg->Len);
+        pW->Lost += pDev->Dec.Lost - lost;
+      }
+      free(pMsg);
+    }
+    now = NowUs();
+    if(now - last_scan < INGEST_SCAN_MS*1000 && !closed)
+      continue;
+    last_scan = now;
+    for(i=0; i<pW->DevSize; i++)
+    {
+      IngestDev_Type *pDev = pW->pDev[i];
+      if(pDev == NULL)
+        continue;
+      pW->CurRecvUs = now;
+      if(pDev->Sweep.Have && (closed || now - pDev->Sweep.LastRecvUs >= INGEST_SWEEP_IDLE_MS*1000ull))
+        SweepFinish(pW, pDev, false);
+      if(pDev->pBatch && (closed || now - pDev->pBatch->FirstRecvUs >= Cfg.BatchAgeMs*1000ull))
+        BatchFlush(pDev, &pDev->pBatch);
+      if(pDev->pSpec && (closed || now - pDev->pSpec->FirstRecvUs >= Cfg.BatchAgeMs*1000ull))
+        BatchFlush(pDev, &pDev->pSpec);
+    }
+  }
+  for(i=0; i<pW->DevSize; i++)
+  {
+    if(pW->pDev[i])
+      free(pW->pDev[i]->Sweep.pTime);
+    free(pW->pDev[i]);
+  }
+  free(pW->pDev);
+  for(i=0; i<pW->KKCount; i++)
+    EisKKPlanFree(&pW->pKK[i]);
+  free(pW->pKK);
+  return NULL;
+}
+
+/* ---------------------------------------------------------------- Writer */
+
+static void *WriterMain(void *pArg)
+{
+  IngestBatch_Type *pBatch;
+  EisArcBlock_Type block;
+  EisArcSpectra_Type spec;
+  uint64_t last_sync = NowUs(), last_compact = last_sync, now;
+  bool closed = false;
+  int ret;
+
+  (void)pArg;
+  while(!closed)
+  {
+    pBatch = QueuePop(&WriteQueue, INGEST_SCAN_MS, &closed);
+    now = NowUs();
+    if(pBatch)
+    {
+      if(pBatch->Kind == EISARC_KIND_SPECTRA)
+      {
+        spec.Device = pBatch->Device;
+        spec.Board = pBatch->Board;
+        spec.Flags = pBatch->Flags;
+        spec.Plan = pBatch->Plan;
+        spec.Points = pBatch->Points;
+        spec.Count = pBatch->Count;
+        spec.Lost = pBatch->Lost;
+        spec.pTime = pBatch->pTime;
+        spec.pDuration = pBatch->pDuration;
+        spec.pChannel = pBatch->pChannel;
+        spec.pReal = pBatch->pReal;
+        spec.pImage = pBatch->pImage;
+        ret = EisArcAppendSpectra(&Arc, &spec);
+      }
+      else
+      {
+        block.Device = pBatch->Device;
+        block.Board = pBatch->Board;
+        block.Flags = pBatch->Flags;
+        block.Count = pBatch->Count;
+        block.Lost = pBatch->Lost;
+        block.pTime = pBatch->pTime;
+        block.pFreq = pBatch->pFreq;
+        block.pSweep = pBatch->pSweep;
+        block.pChannel = pBatch->pChannel;
+        block.pReal = pBatch->pReal;
+        block.pImage = pBatch->pImage;
+        ret = EisArcAppend(&Arc, &block);
+      }
+      if(ret != 0)
+      {
+        if(WrErrors++ == 0)
+          perror("archive append");
+      }
+      else
+      {
+        uint64_t latency = now - pBatch->FirstRecvUs;
+        WrBatches++;
+        if(pBatch->Kind == EISARC_KIND_SPECTRA)
+        {
+          WrSpectra += pBatch->Count;
+          WrPoints += pBatch->Count*pBatch->Points;
+        }
+        else
+          WrPoints += pBatch->Count;
+        WrLatencySumUs += latency;
+        if(latency > WrLatencyMaxUs)
+          WrLatencyMaxUs = latency;
+      }
+      free(pBatch);
+    }
+    if(Cfg.SyncMs && now - last_sync >= Cfg.SyncMs*1000ull)
+    {
+      EisArcSync(&Arc);
+      last_sync = now;
+    }
+    /* Sorted index keeps lookups fast for readers, compaction syncs too */
+    if(Cfg.CompactS && now - last_compact >= Cfg.CompactS*1000000ull)
+    {
+      if(Arc.Sorted != Arc.IndexCount && EisArcCompact(&Arc) != 0)
+        perror("archive compact");
+      last_compact = last_sync = now;
+    }
+  }
+  return NULL;
+}
+
+/* ---------------------------------------------------------------- Receiver */
+
+/* Split eis/device/<id>/data/<board>. Returns false for other topics. */
+static bool ParseTopic(const MqttPublish_Type *pPub, char *pId, uint32_t *pBoard)
+{
+  static const char prefix[] = "eis/device/";
+  const char *p = pPub->pTopic, *end = p + pPub->TopicLen, *id;
+  uint32_t len;
+
+  if(!MqttTopicMatch(Cfg.Filter, pPub->pTopic, pPub->TopicLen) ||
+     pPub->TopicLen < sizeof(prefix) || memcmp(p, prefix, sizeof(prefix) - 1) != 0)
+    return false;
+  id = p += sizeof(prefix) - 1;
+  while(p < end && *p != '/')
+    p++;
+  len = p - id;
+  if(len == 0 || len >= EISARC_ID_LEN || end - p < 5 || memcmp(p, "/data", 5) != 0)
+    return false;
+  memcpy(pId, id, len);
+  pId[len] = 0;
+  p += 5;
+  if(end - p == 7 && memcmp(p, "/ad5940", 7) == 0)
+    *pBoard = 0;      /* BOARD_AD5940 */
+  else if(end - p == 7 && memcmp(p, "/ad5941", 7) == 0)
+    *pBoard = 1;      /* BOARD_AD5941 */
+  else
+    *pBoard = INGEST_BOARD_UNKNOWN;
+  return true;
+}
+
+/* Queue a data message. Returns false if it was dropped. */
+static bool Dispatch(const MqttPublish_Type *pPub)
+{
+  IngestMsg_Type *pMsg;
+  char id[EISARC_ID_LEN];
+  uint32_t board;
+
+  RxMessages++;
+  RxBytes += pPub->PayloadLen;
+  if(!ParseTopic(pPub, id, &board))
+  {
+    RxOther++;
+    return true;
+  }
+  pMsg = malloc(sizeof(IngestMsg_Type) + pPub->PayloadLen);
+  if(pMsg == NULL)
+    return false;
+  pMsg->RecvUs = NowUs();
+  pMsg->Board = board;
+  pMsg->Len = pPub->PayloadLen;
+  strcpy(pMsg->Id, id);
+  memcpy(pMsg->Data, pPub->pPayload, pPub->PayloadLen);
+  if(QueuePush(&Worker[HashStr(id, 0)%Cfg.Workers].Queue, pMsg, Cfg.bDrop) != 0)
+  {
+    free(pMsg);
+    return false;
+  }
+  return true;
+}
+
+/* Handle buffered packets of one connection. bBroker: peer is a real broker. */
+static void ServeConn(MqttConn_Type *pConn, bool bBroker)
+{
+  MqttPacket_Type pkt;
+  MqttPublish_Type pub;
+
+  while(MqttNext(pConn, &pkt))
+  {
+    switch(pkt.Type)
+    {
+      case MQTT_PKT_PUBLISH:
+        if(!MqttParsePublish(&pkt, &pub))
+        {
+          pConn->bError = true;
+          break;
+        }
+        Dispatch(&pub);
+        /* Acknowledged once handed over, a dropped message counts as delivered */
+        if(pub.Qos == 1)
+          MqttSendAck(pConn, MQTT_PKT_PUBACK, pub.Id);
+        break;
+      case MQTT_PKT_CONNECT:
+        if(!bBroker)
+          MqttSendConnack(pConn, 0);
+        break;
+      case MQTT_PKT_SUBSCRIBE:
+        if(!bBroker && pkt.Len >= 2)
+          MqttSendAck(pConn, MQTT_PKT_SUBACK, (uint16_t)(pkt.pBody[0] << 8 | pkt.pBody[1]));
+        break;
+      case MQTT_PKT_PINGREQ:
+        MqttSendEmpty(pConn, MQTT_PKT_PINGRESP);
+        break;
+      case MQTT_PKT_DISCONNECT:
+        pConn->bError = true;
+        break;
+      default:
+        break;
+    }
+    if(pConn->bError)
+      break;
+  }
+  MqttFlush(pConn);
+}
+
+static int RunBroker(void)
+{
+  MqttConn_Type conn;
+  char host[256], client_id[64];
+  uint16_t port = 1883;
+  char *colon;
+  uint64_t last_tx;
+  struct pollfd pfd;
+
+  snprintf(host, sizeof(host), "%s", Cfg.Broker);
+  colon = strrchr(host, ':');
+  if(colon)
+  {
+    *colon = 0;
+    port = (uint16_t)atoi(colon + 1);
+  }
+  snprintf(client_id, sizeof(client_id), "eis_ingest_%d", (int)getpid());
+  if(MqttConnInit(&conn, MqttTcpOpen(host, port), INGEST_RX_BUFF + MQTT_MAX_PACKET) != 0 || conn.Fd < 0)
+  {
+    fprintf(stderr, "cannot connect to %s:%u\n", host, port);
+    return -1;
+  }
+  if(MqttConnect(&conn, client_id, INGEST_KEEPALIVE_S) != 0 || MqttSubscribe(&conn, Cfg.Filter, 1) != 0)
+  {
+    fprintf(stderr, "broker refused connection\n");
+    MqttConnClose(&conn);
+    return -1;
+  }
+  RxConnections = 1;
+  last_tx = NowUs();
+  pfd.fd = conn.Fd;
+  pfd.events = POLLIN;
+  while(!bQuit && !conn.bError)
+  {
+    if(poll(&pfd, 1, 1000) > 0)
+    {
+      if(MqttFill(&conn) <= 0)
+        break;
+      ServeConn(&conn, true);
+    }
+    if(NowUs() - last_tx > INGEST_KEEPALIVE_S*500000ull)
+    {
+      MqttSendEmpty(&conn, MQTT_PKT_PINGREQ);
+      MqttFlush(&conn);
+      last_tx = NowUs();
+    }
+  }
+  if(!conn.bError)
+  {
+    MqttSendEmpty(&conn, MQTT_PKT_DISCONNECT);
+    MqttFlush(&conn);
+  }
+  MqttConnClose(&conn);
+  return bQuit ? 0 : -1;
+}
+
+static int RunListen(void)
+{
+  static struct pollfd pfd[INGEST_MAX_CONN + 1];
+  static MqttConn_Type *pConn[INGEST_MAX_CONN + 1];
+  uint32_t count = 1, i;
+  int fd;
+
+  pfd[0].fd = MqttTcpListen(Cfg.ListenPort);
+  pfd[0].events = POLLIN;
+  if(pfd[0].fd < 0)
+  {
+    fprintf(stderr, "cannot listen on port %u\n", Cfg.ListenPort);
+    return -1;
+  }
+  while(!bQuit)
+  {
+    if(poll(pfd, count, 1000) <= 0)
+      continue;
+    for(i=1; i<count; i++)
+    {
+      if((pfd[i].revents & (POLLIN|POLLHUP|POLLERR)) == 0)
+        continue;
+      if(MqttFill(pConn[i]) <= 0 || (ServeConn(pConn[i], false), pConn[i]->bError))
+      {
+        MqttConnClose(pConn[i]);
+        free(pConn[i]);
+        /* Move last connection here, look at slot i again */
+        count--;
+        pfd[i] = pfd[count];
+        pConn[i] = pConn[count];
+        i--;
+      }
+    }
+    if(pfd[0].revents & POLLIN)
+    {
+      fd = accept(pfd[0].fd, NULL, NULL);
+      if(fd < 0)
+        continue;
+      if(count > INGEST_MAX_CONN || (pConn[count] = malloc(sizeof(MqttConn_Type))) == NULL)
+      {
+        close(fd);
+        continue;
+      }
+      if(MqttConnInit(pConn[count], fd, INGEST_RX_BUFF) != 0)
+      {
+        MqttConnClose(pConn[count]);
+        free(pConn[count]);
+        continue;
+      }
+      pfd[count].fd = fd;
+      pfd[count].events = POLLIN;
+      pfd[count].revents = 0;
+      count++;
+      RxConnections++;
+    }
+  }
+  for(i=1; i<count; i++)
+  {
+    MqttConnClose(pConn[i]);
+    free(pConn[i]);
+  }
+  close(pfd[0].fd);
+  return 0;
+}
+
+static int RunFile(void)
+{
+  MqttConn_Type conn;
+  int fd = strcmp(Cfg.File, "-") == 0 ? 0 : open(Cfg.File, O_RDONLY);
+
+  if(fd < 0 || MqttConnInit(&conn, fd, INGEST_RX_BUFF + MQTT_MAX_PACKET) != 0)
+  {
+    perror(Cfg.File);
+    return -1;
+  }
+  /* Packets are only read, nothing is acknowledged */
+  while(!bQuit && !conn.bError && MqttFill(&conn) > 0)
+  {
+    while(!conn.bError)
+    {
+      MqttPacket_Type pkt;
+      MqttPublish_Type pub;
+      if(!MqttNext(&conn, &pkt))
+        break;
+      if(pkt.Type == MQTT_PKT_PUBLISH && MqttParsePublish(&pkt, &pub))
+        Dispatch(&pub);
+    }
+  }
+  if(conn.bError)
+    fprintf(stderr, "%s: malformed packet\n", Cfg.File);
+  MqttConnClose(&conn);
+  return 0;
+}
+
+/* ---------------------------------------------------------------- Statistics */
+
+typedef struct
+{
+  uint64_t Messages;
+  uint64_t Points;
+  uint64_t Bytes;
+  uint64_t Us;
+}IngestSnap_Type;
+
+static void PrintStats(IngestSnap_Type *pLast, bool bFinal)
+{
+  uint64_t now = NowUs(), frames = 0, points = 0, spectra = 0, rejected = 0, bad = 0, lost = 0, devices = 0;
+  uint64_t w_waits = 0, w_wait_us = 0, w_drop = 0;
+  uint32_t w_depth = 0, w_max = 0, i;
+  double dt = (now - pLast->Us)*1e-6;
+
+  for(i=0; i<Cfg.Workers; i++)
+  {
+    IngestQueue_Type *pQ = &Worker[i].Queue;
+    frames += Worker[i].Frames;
+    points += Worker[i].Points;
+    spectra += Worker[i].Spectra;
+    rejected += Worker[i].Rejected;
+    bad += Worker[i].BadFrames;
+    lost += Worker[i].Lost;
+    devices += Worker[i].DevCount;
+    pthread_mutex_lock(&pQ->Lock);
+    w_waits += pQ->FullWaits;
+    w_wait_us += pQ->WaitUs;
+    w_drop += pQ->Dropped;
+    if(pQ->Count > w_depth) w_depth = pQ->Count;
+    if(pQ->MaxDepth > w_max) w_max = pQ->MaxDepth;
+    pthread_mutex_unlock(&pQ->Lock);
+  }
+  pthread_mutex_lock(&WriteQueue.Lock);
+  fprintf(stderr,
+          "%s msgs %llu (%.0f/s, %.2f MB/s) points %llu (%.0f/s) spectra %llu rejected %llu frames %llu bad %llu lost %llu other %llu "
+          "devices %llu conns %llu | work queue depth %u max %u/%u full %llu wait %.1f ms drop %llu | "
+          "write queue depth %u max %u/%u full %llu wait %.1f ms | archive blocks %llu spectra %llu values %llu "
+          "plans %u %.1f MB errors %llu latency avg %.1f max %.1f ms\n",
+          bFinal ? "total" : "ingest",
+          (unsigned long long)RxMessages, dt > 0 ? (RxMessages - pLast->Messages)/dt : 0,
+          dt > 0 ? (RxBytes - pLast->Bytes)/dt*1e-6 : 0,
+          (unsigned long long)points, dt > 0 ? (points - pLast->Points)/dt : 0, (unsigned long long)spectra,
+          (unsigned long long)rejected, (unsigned long long)frames, (unsigned long long)bad, (unsigned long long)lost,
+          (unsigned long long)RxOther, (unsigned long long)devices, (unsigned long long)RxConnections,
+          w_depth, w_max, Cfg.QueueDepth, (unsigned long long)w_waits, w_wait_us*1e-3, (unsigned long long)w_drop,
+          WriteQueue.Count, WriteQueue.MaxDepth, WriteQueue.Size, (unsigned long long)WriteQueue.FullWaits,
+          WriteQueue.WaitUs*1e-3,
+          (unsigned long long)WrBatches, (unsigned long long)WrSpectra, (unsigned long long)WrPoints,
+          Arc.PlanCount, Arc.BytesWritten*1e-6,
+          (unsigned long long)WrErrors, WrBatches ? WrLatencySumUs*1e-3/WrBatches : 0, WrLatencyMaxUs*1e-3);
+  pthread_mutex_unlock(&WriteQueue.Lock);
+  pLast->Messages = RxMessages;
+  pLast->Points = points;
+  pLast->Bytes = RxBytes;
+  pLast->Us = now;
+}
+
+static void *StatsMain(void *pArg)
+{
+  IngestSnap_Type *pLast = pArg;
+  uint64_t next = NowUs() + Cfg.StatsS*1000000ull;
+
+  while(!bQuit)
+  {
+    usleep(100000);
+    if(NowUs() >= next)
+    {
+      PrintStats(pLast, false);
+      next += Cfg.StatsS*1000000ull;
+    }
+  }
+  return NULL;
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: eis_ingest [-b host[:port] | -l port | -f file] [-t filter] [-w workers] [-n points]\n"
+                  "                  [-a ms] [-q depth] [-d] [-s ms] [-c s] [-i s] [-k threshold] archive_dir\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  IngestSnap_Type last = {0}, total = {0};
+  pthread_t writer, stats;
+  struct sigaction sa;
+  int opt, ret;
+  uint32_t i;
+
+  while((opt = getopt(argc, argv, "b:l:f:t:w:n:a:q:ds:c:i:k:")) != -1)
+  {
+    switch(opt)
+    {
+      case 'b': Cfg.Broker = optarg; break;
+      case 'l': Cfg.ListenPort = (uint16_t)atoi(optarg); break;
+      case 'f': Cfg.File = optarg; break;
+      case 't': Cfg.Filter = optarg; break;
+      case 'w': Cfg.Workers = atoi(optarg); break;
+      case 'n': Cfg.BatchPoints = atoi(optarg); break;
+      case 'a': Cfg.BatchAgeMs = atoi(optarg); break;
+      case 'q': Cfg.QueueDepth = atoi(optarg); break;
+      case 'd': Cfg.bDrop = true; break;
+      case 's': Cfg.SyncMs = atoi(optarg); break;
+      case 'c': Cfg.CompactS = atoi(optarg); break;
+      case 'i': Cfg.StatsS = atoi(optarg); break;
+      case 'k': Cfg.KKThreshold = strtod(optarg, NULL); break;
+      default: Usage();
+    }
+  }
+  if(optind + 1 != argc || (!!Cfg.Broker + !!Cfg.ListenPort + !!Cfg.File) != 1 ||
+     Cfg.Workers < 1 || Cfg.Workers > INGEST_MAX_WORKERS || Cfg.BatchPoints < 1 || Cfg.QueueDepth < 1)
+    Usage();
+  Cfg.Dir = argv[optind];
+
+  if(EisArcOpen(&Arc, Cfg.Dir) != 0)
+  {
+    perror(Cfg.Dir);
+    return 1;
+  }
+  if(Arc.TornBytes)
+    fprintf(stderr, "%s: cut %llu bytes of an unfinished write\n", Cfg.Dir, (unsigned long long)Arc.TornBytes);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = OnSignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  /* Writer queue holds the batches of every worker running ahead by one queue */
+  if(QueueInit(&WriteQueue, Cfg.QueueDepth) != 0)
+    return 1;
+  pthread_create(&writer, NULL, WriterMain, NULL);
+  for(i=0; i<Cfg.Workers; i++)
+  {
+    Worker[i].Index = i;
+    if(QueueInit(&Worker[i].Queue, Cfg.QueueDepth) != 0)
+      return 1;
+    pthread_create(&Worker[i].Thread, NULL, WorkerMain, &Worker[i]);
+  }
+  last.Us = total.Us = NowUs();
+  if(Cfg.StatsS)
+    pthread_create(&stats, NULL, StatsMain, &last);
+
+  if(Cfg.Broker)
+    ret = RunBroker();
+  else if(Cfg.ListenPort)
+    ret = RunListen();
+  else
+    ret = RunFile();
+
+  /* Drain: workers flush every batch, then the writer empties its queue */
+  bQuit = 1;
+  for(i=0; i<Cfg.Workers; i++)
+    QueueClose(&Worker[i].Queue);
+  for(i=0; i<Cfg.Workers; i++)
+    pthread_join(Worker[i].Thread, NULL);
+  QueueClose(&WriteQueue);
+  pthread_join(writer, NULL);
+  if(Cfg.StatsS)
+    pthread_join(stats, NULL);
+  PrintStats(&total, true);
+  EisArcClose(&Arc);
+  return ret ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+/*!
+ *****************************************************************************
+ @file:    eis_kk.c
+ @brief:   Lin-KK test of archived spectra (EisKK.h).
+ -----------------------------------------------------------------------------
+
+ Usage: eis_kk [-M basis] [-t threshold] [-q] archive_dir [device [from_us [to_us]]]
+   -M basis        RC elements, default EISKK_PER_DECADE per decade of the plan
+   -t threshold    Largest residual relative to |Z| that passes, default 0.02
+   -q              Only write rows of spectra that fail
+
+ Tests every spectrum of the archive, or of one device and time range, and
+ writes one CSV row per spectrum to stdout: device, time, channel, plan,
+ points, RC elements, mu, largest and RMS residual and 1 if it passes.
+ The basis is computed once per frequency plan of the archive and kept
+ for all spectra on that plan. Spectra are read in place from the mapped
+ archive.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "EisArchive.h"
+#include "EisKK.h"
+
+static uint64_t NowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: eis_kk [-M basis] [-t threshold] [-q] archive_dir [device [from_us [to_us]]]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  EisArcReader_Type rd;
+  EisKKPlan_Type *pPlan;
+  const EisArcIndex_Type **ppEntry;
+  EisArcView_Type view;
+  EisKKResult_Type res;
+  double threshold = EISKK_THRESHOLD;
+  uint64_t from = 0, to = UINT64_MAX, t0, spectra = 0, failed = 0, skipped = 0;
+  uint32_t basis = 0, plans = 0, count, dev, i, j;
+  bool quiet = false;
+  int opt_c, device = -1;
+
+  while((opt_c = getopt(argc, argv, "M:t:q")) != -1)
+  {
+    switch(opt_c)
+    {
+      case 'M': basis = strtoul(optarg, NULL, 0); break;
+      case 't': threshold = strtod(optarg, NULL); break;
+      case 'q': quiet = true; break;
+      default: Usage();
+    }
+  }
+  if(optind >= argc || argc - optind > 4 || !(threshold > 0) || basis > EISKK_MAX_BASIS)
+    Usage();
+  if(EisArcReaderOpen(&rd, argv[optind]) != 0)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+  if(argc - optind > 1)
+  {
+    device = EisArcReaderDevice(&rd, argv[optind + 1]);
+    if(device < 0)
+    {
+      fprintf(stderr, "%s: no device %s\n", argv[optind], argv[optind + 1]);
+      EisArcReaderClose(&rd);
+      return 1;
+    }
+  }
+  if(argc - optind > 2)
+    from = strtoull(argv[optind + 2], NULL, 0);
+  if(argc - optind > 3)
+    to = strtoull(argv[optind + 3], NULL, 0);
+  /* One basis per plan, made when a plan is first seen */
+  pPlan = calloc(rd.PlanCount + 1, sizeof(EisKKPlan_Type));
+  if(pPlan == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    EisArcReaderClose(&rd);
+    return 1;
+  }
+
+  printf("device,time_us,channel,plan,points,basis,mu,max_res,rms_res,pass\n");
+  t0 = NowUs();
+  for(dev=0; dev<rd.DevCount; dev++)
+  {
+    if(device >= 0 && dev != (uint32_t)device)
+      continue;
+    count = EisArcQuery(&rd, dev, from, to, NULL, 0);
+    ppEntry = malloc((count + 1)*sizeof(*ppEntry));
+    if(ppEntry == NULL)
+    {
+      fprintf(stderr, "out of memory\n");
+      break;
+    }
+    EisArcQuery(&rd, dev, from, to, ppEntry, count);
+    for(i=0; i<count; i++)
+    {
+      uint32_t plan = ppEntry[i]->Plan;
+      if(EisArcView(&rd, ppEntry[i], &view) != 0 || view.Kind != EISARC_KIND_SPECTRA || plan >= rd.PlanCount)
+        continue;
+      if(pPlan[plan].pA == NULL && EisKKPlanInit(&pPlan[plan], view.pFreq, view.Points, basis) != 0)
+      {
+        skipped += view.Count;
+        continue;
+      }
+      for(j=0; j<view.Count; j++)
+      {
+        if(view.pTime[j] < from || view.pTime[j] > to)
+          continue;
+        if(EisKKTest(&pPlan[plan], view.Points, &view.pReal[(size_t)j*view.Points],
+                     &view.pImage[(size_t)j*view.Points], threshold, &res) != 0)
+        {
+          skipped++;
+          continue;
+        }
+        spectra++;
+        failed += res.bPass ? 0 : 1;
+        if(quiet && res.bPass)
+          continue;
+        printf("%s,%llu,%u,%u,%u,%u,%.4f,%.6g,%.6g,%u\n", EisArcReaderDeviceId(&rd, dev),
+               (unsigned long long)view.pTime[j], view.pChannel[j], plan, res.Points, pPlan[plan].Basis,
+               res.Mu, res.MaxRes, res.RmsRes, res.bPass ? 1 : 0);
+      }
+    }
+    free(ppEntry);
+  }
+  t0 = NowUs() - t0;
+  for(i=0; i<rd.PlanCount; i++)
+  {
+    plans += pPlan[i].pA ? 1 : 0;
+    EisKKPlanFree(&pPlan[i]);
+  }
+  fprintf(stderr, "%llu spectra in %.3f s (%.0f/s, %u plans), %llu failed, %llu skipped\n",
+          (unsigned long long)spectra, t0*1e-6, t0 ? spectra/(t0*1e-6) : 0, plans,
+          (unsigned long long)failed, (unsigned long long)skipped);
+  free(pPlan);
+  EisArcReaderClose(&rd);
+  return 0;
+}
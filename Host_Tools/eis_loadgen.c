@@ -0,0 +1,1111 @@
+/*!
+ *****************************************************************************
+ @file:    eis_loadgen.c
+ @brief:   Simulated device fleet for broker and ingest benchmarks.
+ -----------------------------------------------------------------------------
+
+ Usage: eis_loadgen [options]
+   -b host[:port]  Broker or eis_ingest -l to connect to, default localhost:1883
+   -w file         Write packets to a capture file for eis_ingest -f instead,
+                   as fast as possible on a simulated clock
+   -n devices      Simulated devices, default 100, one connection each
+   -T threads      Threads sharing the devices, default 1
+   -d seconds      Run time, default 10
+   -r rate         Sweeps per second per device, default 1
+   -p points       Points per sweep, default 51
+   -F start:stop   Sweep range in Hz, log spaced, default 1:100000
+   -m model        rc, randles, battery or mix (devices take turns), default mix
+   -f format       float or fixed result stream records, default float
+   -P mode         batch: pack frames into MQTT_MAX_PAYLOAD_SIZE messages like
+                   mqtt_publisher.c; frame: one frame of -k points per message
+   -k points       Records per frame in frame mode, default 1
+   -q qos          QoS of data messages, 0 or 1, default 1
+   -B board        ad5940 or ad5941 data topic, default ad5940
+   -H ms           Heartbeat interval, default MQTT_HEARTBEAT_INTERVAL_MS
+   -i prefix       Device ID prefix, default sim
+   -o              Also subscribe to the data topics and measure end-to-end
+                   latency and loss (needs a broker that forwards)
+   -s seconds      Statistics interval, default 1
+
+ Each device connects, announces itself on system/status, answers the
+ board selection and measurement status like test/main.c, and then runs
+ sweeps. Results are spectra of an equivalent circuit with per-device
+ parameters, slow drift and noise, encoded as result stream frames with
+ host clock time stamps. Devices answer cmd/board_select,
+ cmd/measurement_start, cmd/measurement_stop and cmd/time_sync.
+
+ Latency:
+   ack     Publish to PUBACK of QoS 1 data messages. Against eis_ingest
+           this is the time until the message is queued for decoding.
+   age     With -o: time from the first point of a message being measured
+           to its arrival at the observer, batching included.
+   transit With -o: the same for the last point, which is about the
+           transport time.
+ A device holds at most MQTT_DATA_MAX_INFLIGHT unacknowledged messages like
+ the firmware; data that finds the window full is dropped and counted.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <complex.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "ResultStream.h"
+#include "json_writer.h"
+#include "mqtt_config.h"
+#include "MqttLite.h"
+
+#define SIM_MAX_THREADS       64
+#define SIM_MAX_POINTS        1024
+#define SIM_RX_BUFF           4096
+#define SIM_KEEPALIVE_S       60
+#define SIM_LAT_BUCKETS       512
+#define SIM_DRAIN_MS          2000      /* Wait for acknowledgements and observer after the run */
+#define SIM_ID_LEN            32
+
+typedef struct
+{
+  const char *Name;
+  const char *Circuit;          /* For the record, in the notation of the MATLAB app */
+  int32_t ZExp;                 /* Fixed point exponent that suits the impedance range */
+  uint32_t NParam;
+  double Param[8];
+  double complex (*Eval)(const double *p, double w);
+}SimModel_Type;
+
+/* Log histogram, 8 buckets per octave */
+typedef struct
+{
+  uint64_t Count;
+  uint64_t SumUs;
+  uint64_t MaxUs;
+  uint32_t Bucket[SIM_LAT_BUCKETS];
+}SimHist_Type;
+
+typedef struct
+{
+  uint64_t Connected;
+  uint64_t ConnectFails;
+  uint64_t Disconnects;
+  uint64_t DataMsgs;
+  uint64_t OtherMsgs;
+  uint64_t Frames;
+  uint64_t Points;
+  uint64_t Bytes;
+  uint64_t Acked;
+  uint64_t DropMsgs;            /* Inflight window full */
+  uint64_t DropFrames;
+  uint64_t Commands;
+  uint64_t SendUs;              /* Time spent in socket writes, grows when the peer pushes back */
+  SimHist_Type AckLat;
+}SimStats_Type;
+
+typedef struct
+{
+  char Id[SIM_ID_LEN];
+  mqtt_topics_t Topics;
+  const char *pDataTopic;
+  MqttConn_Type Conn;
+  bool bUp;
+  bool bRunning;                /* Measurement on */
+  const SimModel_Type *pModel;
+  double Param[8];
+  double Phase;                 /* Of drift */
+  RStreamEnc_Type Enc;
+  uint8_t Payload[MQTT_MAX_PAYLOAD_SIZE];
+  uint32_t PayloadLen;
+  uint32_t PayloadFrames;
+  uint64_t PayloadUs;           /* Time first frame was added */
+  uint32_t Sweep;
+  uint32_t Point;
+  uint64_t NextPointUs;
+  uint64_t NextBeatUs;
+  uint64_t StartUs;
+  uint16_t AckId[MQTT_DATA_MAX_INFLIGHT];
+  uint64_t AckUs[MQTT_DATA_MAX_INFLIGHT];
+  uint32_t Inflight;
+  uint64_t Messages;
+  uint64_t Acked;
+  uint64_t DroppedFrames;
+}SimDev_Type;
+
+typedef struct
+{
+  pthread_t Thread;
+  SimDev_Type *pDev;
+  uint32_t Count;
+  SimStats_Type Stats;
+}SimThread_Type;
+
+typedef struct
+{
+  char Id[SIM_ID_LEN];
+  RStreamDec_Type Dec;
+}SimObsDev_Type;
+
+typedef struct
+{
+  pthread_t Thread;
+  MqttConn_Type Conn;
+  SimObsDev_Type *pDev;         /* Open addressing on ID */
+  uint32_t DevSize;
+  uint64_t MsgFirstUs;
+  uint64_t MsgLastUs;
+  uint64_t Messages;
+  uint64_t Frames;
+  uint64_t Points;
+  uint64_t BadFrames;
+  SimHist_Type AgeLat;
+  SimHist_Type TransitLat;
+}SimObserver_Type;
+
+static struct
+{
+  char Host[256];
+  uint16_t Port;
+  const char *Capture;
+  uint32_t Devices;
+  uint32_t Threads;
+  double DurationS;
+  double Rate;
+  uint32_t Points;
+  double FreqStart;
+  double FreqStop;
+  const char *Model;
+  uint32_t Type;
+  bool bFrameMode;
+  uint32_t FramePoints;
+  uint8_t Qos;
+  uint32_t Board;
+  uint32_t BeatMs;
+  const char *Prefix;
+  bool bObserve;
+  uint32_t StatsS;
+}Cfg = {
+  .Host = "localhost",
+  .Port = 1883,
+  .Devices = 100,
+  .Threads = 1,
+  .DurationS = 10,
+  .Rate = 1,
+  .Points = 51,
+  .FreqStart = 1,
+  .FreqStop = 100000,
+  .Model = "mix",
+  .Type = RSTREAM_TYPE_FLOAT,
+  .FramePoints = 1,
+  .Qos = 1,
+  .BeatMs = MQTT_HEARTBEAT_INTERVAL_MS,
+  .Prefix = "sim",
+  .StatsS = 1,
+};
+
+static SimThread_Type Thread[SIM_MAX_THREADS];
+static SimObserver_Type Observer;
+static double Freq[SIM_MAX_POINTS];
+static volatile sig_atomic_t bQuit;
+static volatile bool bRunDone;
+static int CaptureFd = -1;
+static __thread SimDev_Type *pCurDev;
+static __thread SimStats_Type *pCurStats;
+static __thread uint64_t SimNowUs;      /* Simulated clock of capture mode */
+
+/* ---------------------------------------------------------------- Circuit models */
+
+/* R0 + R1||C1 */
+static double complex EvalRc(const double *p, double w)
+{
+  return p[0] + p[1]/(1 + I*w*p[1]*p[2]);
+}
+
+/* Rs + Cdl||(Rct + W), semi-infinite Warburg sigma*(1-j)/sqrt(w) */
+static double complex EvalRandles(const double *p, double w)
+{
+  double complex zf = p[1] + p[3]*(1 - I)/sqrt(w);
+  return p[0] + zf/(1 + I*w*p[2]*zf);
+}
+
+/* L + R0 + R1||CPE1 + R2||CPE2, CPE Z = 1/(Q (jw)^a) */
+static double complex EvalBattery(const double *p, double w)
+{
+  double complex z1 = p[2]/(1 + p[2]*p[3]*cpow(I*w, p[4]));
+  double complex z2 = p[5]/(1 + p[5]*p[6]*cpow(I*w, p[7]));
+  return I*w*p[0] + p[1] + z1 + z2;
+}
+
+static const SimModel_Type Models[] = {
+  {"rc", "R0-p(R1,C1)", -3, 3, {10, 1000, 1e-6}, EvalRc},
+  {"randles", "R0-p(C1,R1-W1)", -3, 4, {50, 500, 2e-6, 100}, EvalRandles},
+  {"battery", "L0-R0-p(R1,CPE1)-p(R2,CPE2)", -6, 8, {1e-7, 0.02, 0.01, 5, 0.8, 0.005, 200, 0.9}, EvalBattery},
+};
+#define SIM_MODEL_COUNT (sizeof(Models)/sizeof(Models[0]))
+
+/* ---------------------------------------------------------------- Helpers */
+
+static uint64_t NowUs(void)
+{
+  struct timespec ts;
+  if(CaptureFd >= 0)
+    return SimNowUs;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static uint64_t WallUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void OnSignal(int Sig)
+{
+  (void)Sig;
+  bQuit = 1;
+}
+
+static double Uniform(unsigned *pSeed)
+{
+  return rand_r(pSeed)/(double)RAND_MAX;
+}
+
+static uint32_t HistIndex(uint64_t V)
+{
+  int e;
+  if(V < 8)
+    return (uint32_t)V;
+  e = 63 - __builtin_clzll(V);
+  return (e - 2)*8 + ((V >> (e - 3))&7);
+}
+
+static uint64_t HistValue(uint32_t Index)
+{
+  if(Index < 8)
+    return Index;
+  return (uint64_t)(8 + Index%8) << (Index/8 - 1);
+}
+
+static void HistAdd(SimHist_Type *pH, uint64_t Us)
+{
+  pH->Count++;
+  pH->SumUs += Us;
+  if(Us > pH->MaxUs)
+    pH->MaxUs = Us;
+  pH->Bucket[HistIndex(Us)]++;
+}
+
+static void HistMerge(SimHist_Type *pTo, const SimHist_Type *pFrom)
+{
+  uint32_t i;
+  pTo->Count += pFrom->Count;
+  pTo->SumUs += pFrom->SumUs;
+  if(pFrom->MaxUs > pTo->MaxUs)
+    pTo->MaxUs = pFrom->MaxUs;
+  for(i=0; i<SIM_LAT_BUCKETS; i++)
+    pTo->Bucket[i] += pFrom->Bucket[i];
+}
+
+/* Lower bound of bucket holding the given fraction, in ms */
+static double HistPct(const SimHist_Type *pH, double Frac)
+{
+  uint64_t want = (uint64_t)ceil(pH->Count*Frac), sum = 0;
+  uint32_t i;
+  if(pH->Count == 0)
+    return 0;
+  for(i=0; i<SIM_LAT_BUCKETS; i++)
+  {
+    sum += pH->Bucket[i];
+    if(sum >= want)
+      return HistValue(i)*1e-3;
+  }
+  return pH->MaxUs*1e-3;
+}
+
+static void HistPrint(const char *Name, const SimHist_Type *pH)
+{
+  if(pH->Count == 0)
+    return;
+  fprintf(stderr, " %s avg %.2f p50 %.2f p99 %.2f max %.2f ms", Name, pH->SumUs*1e-3/pH->Count,
+          HistPct(pH, 0.5), HistPct(pH, 0.99), pH->MaxUs*1e-3);
+}
+
+/* Time stamp for JSON like json_add_timestamp() of test/main.c */
+static void AddTimestamp(json_writer_t *w, const SimDev_Type *pDev)
+{
+  uint64_t now = NowUs();
+  char ts[40];
+  struct tm tm;
+  time_t sec = (time_t)(now/1000000);
+  size_t n;
+
+  gmtime_r(&sec, &tm);
+  n = strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+  snprintf(ts + n, sizeof(ts) - n, ".%06uZ", (unsigned)(now%1000000));
+  json_add_string(w, "timestamp", ts);
+  json_add_uint(w, "device_time_us", now - pDev->StartUs);
+}
+
+static void PublishJson(SimDev_Type *pDev, const char *Topic, json_writer_t *w)
+{
+  int len = json_writer_finish(w);
+  if(len > 0 && MqttPublish(&pDev->Conn, Topic, w->buf, len, 0) >= 0)
+    pCurStats->OtherMsgs++;
+}
+
+/* ---------------------------------------------------------------- Device messages */
+
+static const char *BoardName(uint32_t Board)
+{
+  return Board == 0 ? "AD5940" : "AD5941";
+}
+
+static void PublishBoardSelection(SimDev_Type *pDev, const char *Status, const char *Board, const char *ReqId)
+{
+  char buf[512];
+  json_writer_t w;
+
+  json_writer_init(&w, buf, sizeof(buf));
+  json_object_begin(&w, NULL);
+  json_add_string(&w, "status", Status);
+  json_add_string(&w, "selected_board", Board);
+  json_add_string(&w, "message", strcmp(Status, "success") == 0 ? "Board selected" : "Unknown board type");
+  AddTimestamp(&w, pDev);
+  if(ReqId)
+    json_add_string(&w, "request_id", ReqId);
+  json_object_begin(&w, "device_info");
+  json_add_string(&w, "device_id", pDev->Id);
+  json_add_string(&w, "board_type", Board);
+  json_add_string(&w, "firmware_version", "loadgen");
+  json_object_end(&w);
+  json_object_end(&w);
+  PublishJson(pDev, pDev->Topics.resp_board_select, &w);
+}
+
+static void PublishMeasurement(SimDev_Type *pDev, const char *Status)
+{
+  char buf[512];
+  json_writer_t w;
+
+  json_writer_init(&w, buf, sizeof(buf));
+  json_object_begin(&w, NULL);
+  json_add_string(&w, "status", Status);
+  json_add_string(&w, "measurement_id", "loadgen");
+  json_add_string(&w, "board_type", BoardName(Cfg.Board));
+  json_add_uint(&w, "sweeps_done", pDev->Sweep);
+  json_add_uint(&w, "repeat", 0);
+  json_add_uint(&w, "queued", 0);
+  AddTimestamp(&w, pDev);
+  json_object_end(&w);
+  PublishJson(pDev, pDev->Topics.resp_measurement, &w);
+}
+
+static void PublishHeartbeat(SimDev_Type *pDev)
+{
+  char buf[512];
+  json_writer_t w;
+
+  json_writer_init(&w, buf, sizeof(buf));
+  json_object_begin(&w, NULL);
+  json_add_string(&w, "status", "alive");
+  json_add_string(&w, "device_id", pDev->Id);
+  json_add_int(&w, "uptime", (NowUs() - pDev->StartUs)/1000000);
+  json_add_uint(&w, "free_heap", 200000);
+  json_add_uint(&w, "data_messages", pDev->Messages);
+  json_add_uint(&w, "data_acked", pDev->Acked);
+  json_add_uint(&w, "data_dropped_frames", pDev->DroppedFrames);
+  if(pDev->bRunning)
+  {
+    json_add_string(&w, "measurement_id", "loadgen");
+    json_add_uint(&w, "sweeps_done", pDev->Sweep);
+  }
+  json_add_uint(&w, "jobs_queued", 0);
+  json_object_end(&w);
+  PublishJson(pDev, pDev->Topics.system_heartbeat, &w);
+}
+
+static void PublishOnline(SimDev_Type *pDev)
+{
+  char buf[256];
+  json_writer_t w;
+
+  json_writer_init(&w, buf, sizeof(buf));
+  json_object_begin(&w, NULL);
+  json_add_string(&w, "status", "online");
+  json_add_string(&w, "device_id", pDev->Id);
+  json_add_string(&w, "firmware_version", "loadgen");
+  AddTimestamp(&w, pDev);
+  json_object_end(&w);
+  PublishJson(pDev, pDev->Topics.system_status, &w);
+  PublishBoardSelection(pDev, "success", BoardName(Cfg.Board), NULL);
+  PublishMeasurement(pDev, "running");
+}
+
+/* Send data payload, or drop it when the inflight window is full */
+static void PublishData(SimDev_Type *pDev)
+{
+  int id;
+
+  if(pDev->PayloadLen == 0)
+    return;
+  if(Cfg.Qos && pDev->Inflight == MQTT_DATA_MAX_INFLIGHT)
+  {
+    pCurStats->DropMsgs++;
+    pCurStats->DropFrames += pDev->PayloadFrames;
+    pDev->DroppedFrames += pDev->PayloadFrames;
+  }
+  else if((id = MqttPublish(&pDev->Conn, pDev->pDataTopic, pDev->Payload, pDev->PayloadLen, Cfg.Qos)) >= 0)
+  {
+    if(Cfg.Qos && CaptureFd < 0)
+    {
+      pDev->AckId[pDev->Inflight] = (uint16_t)id;
+      pDev->AckUs[pDev->Inflight] = NowUs();
+      pDev->Inflight++;
+    }
+    pDev->Messages++;
+    pCurStats->DataMsgs++;
+    pCurStats->Frames += pDev->PayloadFrames;
+    pCurStats->Bytes += pDev->PayloadLen;
+  }
+  pDev->PayloadLen = 0;
+  pDev->PayloadFrames = 0;
+}
+
+/* Result stream output, packs frames like mqtt_pub_write() */
+static void OnFrame(const uint8_t *pData, uint32_t Len)
+{
+  SimDev_Type *pDev = pCurDev;
+  bool sweep_end = (pData[3]&RSTREAM_FLAG_SWEEPEND) != 0;
+
+  if(pDev->PayloadLen + Len > MQTT_MAX_PAYLOAD_SIZE)
+    PublishData(pDev);
+  if(pDev->PayloadLen == 0)
+    pDev->PayloadUs = NowUs();
+  memcpy(pDev->Payload + pDev->PayloadLen, pData, Len);
+  pDev->PayloadLen += Len;
+  pDev->PayloadFrames++;
+  if(Cfg.bFrameMode || sweep_end)
+    PublishData(pDev);
+}
+
+static void MeasurePoint(SimDev_Type *pDev, unsigned *pSeed)
+{
+  RStreamPoint_Type point;
+  double p[8], drift = 1 + 0.05*sin(pDev->Sweep*0.01 + pDev->Phase);
+  double complex z;
+  uint32_t i;
+
+  for(i=0; i<pDev->pModel->NParam; i++)
+    p[i] = pDev->Param[i];
+  p[1] *= drift;                  /* Slow change of the main resistance */
+  z = pDev->pModel->Eval(p, 2*MATH_PI*Freq[pDev->Point]);
+  z *= 1 + 1e-3*(Uniform(pSeed) - 0.5);
+  point.Freq = (float)Freq[pDev->Point];
+  point.TimeUs = NowUs();
+  point.bHostTime = bTRUE;
+  point.SweepIndex = (uint16_t)pDev->Point;
+  point.Channel = 0;
+  point.Z.Real = (float)creal(z);
+  point.Z.Image = (float)cimag(z);
+  pCurDev = pDev;
+  RStreamAdd(&pDev->Enc, &point);
+  pCurStats->Points++;
+  if(++pDev->Point == Cfg.Points)
+  {
+    RStreamEndSweep(&pDev->Enc);
+    pDev->Point = 0;
+    pDev->Sweep++;
+  }
+}
+
+/* Points, batch timeout and heartbeat that are due */
+static void DeviceRun(SimDev_Type *pDev, uint64_t Now, unsigned *pSeed)
+{
+  uint64_t step = (uint64_t)(1e6/(Cfg.Rate*Cfg.Points));
+
+  while(pDev->bRunning && pDev->NextPointUs <= Now)
+  {
+    MeasurePoint(pDev, pSeed);
+    pDev->NextPointUs += step ? step : 1;
+  }
+  if(!pDev->bRunning)
+    pDev->NextPointUs = Now;
+  pCurDev = pDev;
+  if(pDev->PayloadLen && Now - pDev->PayloadUs >= MQTT_DATA_BATCH_TIMEOUT_MS*1000ull)
+    PublishData(pDev);
+  if(Now >= pDev->NextBeatUs)
+  {
+    PublishHeartbeat(pDev);
+    pDev->NextBeatUs += Cfg.BeatMs*1000ull;
+  }
+}
+
+static void DeviceCommand(SimDev_Type *pDev, const MqttPublish_Type *pPub, uint64_t RxUs)
+{
+  json_token_t tokens[JSON_MAX_TOKENS];
+  char json[512], str[64];
+  const char *cmd;
+  int count, t;
+  uint32_t len = pPub->PayloadLen < sizeof(json) - 1 ? pPub->PayloadLen : sizeof(json) - 1;
+
+  memcpy(json, pPub->pPayload, len);
+  json[len] = 0;
+  count = json_tokenize(json, len, tokens, JSON_MAX_TOKENS);
+  pCurStats->Commands++;
+  /* Last topic level */
+  for(cmd = pPub->pTopic + pPub->TopicLen; cmd > pPub->pTopic && cmd[-1] != '/'; cmd--);
+  len = pPub->pTopic + pPub->TopicLen - cmd;
+
+  if(len == 12 && memcmp(cmd, "board_select", 12) == 0)
+  {
+    char req[64];
+    bool has_req = count > 0 && (t = json_object_get(json, tokens, count, 0, "request_id")) >= 0 &&
+                   json_token_string(json, &tokens[t], req, sizeof(req)) >= 0;
+    if(count > 0 && (t = json_object_get(json, tokens, count, 0, "board_type")) >= 0 &&
+       json_token_string(json, &tokens[t], str, sizeof(str)) >= 0 &&
+       (strcmp(str, "AD5940") == 0 || strcmp(str, "AD5941") == 0))
+      PublishBoardSelection(pDev, "success", str, has_req ? req : NULL);
+    else
+      PublishBoardSelection(pDev, "error", "UNKNOWN", has_req ? req : NULL);
+  }
+  else if(len == 17 && memcmp(cmd, "measurement_start", 17) == 0)
+  {
+    pDev->bRunning = true;
+    PublishMeasurement(pDev, "running");
+  }
+  else if(len == 16 && memcmp(cmd, "measurement_stop", 16) == 0)
+  {
+    pDev->bRunning = false;
+    PublishMeasurement(pDev, "stopped");
+  }
+  else if(len == 9 && memcmp(cmd, "time_sync", 9) == 0)
+  {
+    char buf[256];
+    json_writer_t w;
+    int64_t t1;
+    if(count <= 0 || (t = json_object_get(json, tokens, count, 0, "host_tx_us")) < 0 ||
+       !json_token_int(json, &tokens[t], &t1))
+      return;
+    json_writer_init(&w, buf, sizeof(buf));
+    json_object_begin(&w, NULL);
+    json_add_int(&w, "host_tx_us", t1);
+    json_add_uint(&w, "device_rx_us", RxUs - pDev->StartUs);
+    json_add_bool(&w, "synced", false);
+    json_add_uint(&w, "device_tx_us", NowUs() - pDev->StartUs);
+    json_object_end(&w);
+    PublishJson(pDev, pDev->Topics.resp_time_sync, &w);
+  }
+}
+
+static void DeviceRead(SimDev_Type *pDev)
+{
+  MqttPacket_Type pkt;
+  MqttPublish_Type pub;
+  uint64_t now = NowUs();
+  uint32_t i;
+
+  if(MqttFill(&pDev->Conn) <= 0)
+  {
+    pDev->Conn.bError = true;
+    return;
+  }
+  while(MqttNext(&pDev->Conn, &pkt))
+  {
+    if(pkt.Type == MQTT_PKT_PUBACK && pkt.Len >= 2)
+    {
+      uint16_t id = (uint16_t)(pkt.pBody[0] << 8 | pkt.pBody[1]);
+      for(i=0; i<pDev->Inflight; i++)
+      {
+        if(pDev->AckId[i] != id)
+          continue;
+        HistAdd(&pCurStats->AckLat, now - pDev->AckUs[i]);
+        pDev->Inflight--;
+        pDev->AckId[i] = pDev->AckId[pDev->Inflight];
+        pDev->AckUs[i] = pDev->AckUs[pDev->Inflight];
+        pDev->Acked++;
+        pCurStats->Acked++;
+        break;
+      }
+    }
+    else if(pkt.Type == MQTT_PKT_PUBLISH && MqttParsePublish(&pkt, &pub))
+    {
+      DeviceCommand(pDev, &pub, now);
+      if(pub.Qos == 1)
+        MqttSendAck(&pDev->Conn, MQTT_PKT_PUBACK, pub.Id);
+    }
+  }
+}
+
+/* Topics of a device, as mqtt_init_topics() of test/main.c */
+static void DeviceTopics(mqtt_topics_t *pTopics, const char *Id)
+{
+  snprintf(pTopics->cmd_board_select, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_CMD_BOARD_SELECT, Id);
+  snprintf(pTopics->cmd_measurement, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_CMD_MEASUREMENT, Id);
+  snprintf(pTopics->cmd_stop, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_CMD_STOP, Id);
+  snprintf(pTopics->cmd_time_sync, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_CMD_TIME_SYNC, Id);
+  snprintf(pTopics->resp_board_select, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_RESP_BOARD_SELECT, Id);
+  snprintf(pTopics->resp_measurement, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_RESP_MEASUREMENT, Id);
+  snprintf(pTopics->resp_time_sync, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_RESP_TIME_SYNC, Id);
+  snprintf(pTopics->data_ad5940, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_DATA_AD5940, Id);
+  snprintf(pTopics->data_ad5941, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_DATA_AD5941, Id);
+  snprintf(pTopics->system_status, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_SYSTEM_STATUS, Id);
+  snprintf(pTopics->system_errors, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_SYSTEM_ERRORS, Id);
+  snprintf(pTopics->system_heartbeat, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_SYSTEM_HEARTBEAT, Id);
+}
+
+static int DeviceInit(SimDev_Type *pDev, uint32_t Index, unsigned *pSeed)
+{
+  uint32_t i;
+
+  memset(pDev, 0, sizeof(*pDev));
+  snprintf(pDev->Id, sizeof(pDev->Id), "%s%05u", Cfg.Prefix, Index);
+  DeviceTopics(&pDev->Topics, pDev->Id);
+  pDev->pDataTopic = Cfg.Board == 0 ? pDev->Topics.data_ad5940 : pDev->Topics.data_ad5941;
+  if(strcmp(Cfg.Model, "mix") == 0)
+    pDev->pModel = &Models[Index%SIM_MODEL_COUNT];
+  else
+    for(i=0; i<SIM_MODEL_COUNT; i++)
+      if(strcmp(Cfg.Model, Models[i].Name) == 0)
+        pDev->pModel = &Models[i];
+  if(pDev->pModel == NULL)
+    return -1;
+  /* Each device is a different cell: parameters within +-20% */
+  for(i=0; i<pDev->pModel->NParam; i++)
+    pDev->Param[i] = pDev->pModel->Param[i]*(0.8 + 0.4*Uniform(pSeed));
+  pDev->Phase = 2*MATH_PI*Uniform(pSeed);
+  RStreamEncInit(&pDev->Enc, Cfg.Type, pDev->pModel->ZExp, OnFrame);
+  if(Cfg.bFrameMode)
+    pDev->Enc.MaxRecords = Cfg.FramePoints;
+  pDev->bRunning = true;
+  return 0;
+}
+
+/* Connect device and subscribe to its commands */
+static int DeviceConnect(SimDev_Type *pDev, uint64_t Now, unsigned *pSeed)
+{
+  char filter[MQTT_MAX_TOPIC_LENGTH];
+  int fd = CaptureFd >= 0 ? dup(CaptureFd) : MqttTcpOpen(Cfg.Host, Cfg.Port);
+
+  if(fd < 0 || MqttConnInit(&pDev->Conn, fd, SIM_RX_BUFF) != 0)
+    return -1;
+  if(CaptureFd < 0)
+  {
+    snprintf(filter, sizeof(filter), MQTT_TOPIC_BASE "/cmd/#", pDev->Id);
+    if(MqttConnect(&pDev->Conn, pDev->Id, SIM_KEEPALIVE_S) != 0 || MqttSubscribe(&pDev->Conn, filter, 0) != 0)
+    {
+      MqttConnClose(&pDev->Conn);
+      return -1;
+    }
+  }
+  pDev->bUp = true;
+  pDev->StartUs = Now;
+  /* Spread devices over one sweep period, so they do not publish in step */
+  pDev->NextPointUs = Now + (uint64_t)(1e6/Cfg.Rate*Uniform(pSeed));
+  pDev->NextBeatUs = Now + (uint64_t)(Cfg.BeatMs*1000.0*Uniform(pSeed));
+  pCurDev = pDev;
+  PublishOnline(pDev);
+  return 0;
+}
+
+static void *ThreadMain(void *pArg)
+{
+  SimThread_Type *pT = pArg;
+  struct pollfd *pfd = calloc(pT->Count, sizeof(struct pollfd));
+  unsigned seed = (unsigned)(pT - Thread) + 1;
+  uint64_t now, end, flush_t0;
+  uint32_t i;
+
+  pCurStats = &pT->Stats;
+  SimNowUs = WallUs();
+  now = NowUs();
+  end = now + (uint64_t)(Cfg.DurationS*1e6);
+  for(i=0; i<pT->Count && !bQuit; i++)
+  {
+    if(DeviceConnect(&pT->pDev[i], now, &seed) != 0)
+      pT->Stats.ConnectFails++;
+    else
+      pT->Stats.Connected++;
+  }
+
+  while(!bQuit && (now = NowUs()) < end)
+  {
+    for(i=0; i<pT->Count; i++)
+    {
+      SimDev_Type *pDev = &pT->pDev[i];
+      if(!pDev->bUp)
+        continue;
+      DeviceRun(pDev, now, &seed);
+      flush_t0 = WallUs();
+      MqttFlush(&pDev->Conn);
+      pT->Stats.SendUs += WallUs() - flush_t0;
+      if(pDev->Conn.bError)
+      {
+        pDev->bUp = false;
+        pT->Stats.Disconnects++;
+        continue;
+      }
+      pfd[i].fd = pDev->Conn.Fd;
+      pfd[i].events = POLLIN;
+      pfd[i].revents = 0;
+    }
+    if(CaptureFd >= 0)
+    {
+      SimNowUs += 1000;
+      continue;
+    }
+    /* Unconnected devices keep their slot with a negative fd, poll skips them */
+    for(i=0; i<pT->Count; i++)
+      if(!pT->pDev[i].bUp)
+        pfd[i].fd = -1;
+    if(poll(pfd, pT->Count, 1) <= 0)
+      continue;
+    for(i=0; i<pT->Count; i++)
+    {
+      if(pfd[i].fd >= 0 && (pfd[i].revents & (POLLIN|POLLHUP|POLLERR)))
+      {
+        DeviceRead(&pT->pDev[i]);
+        MqttFlush(&pT->pDev[i].Conn);
+      }
+    }
+  }
+
+  /* Send what is batched, then wait for acknowledgements */
+  for(i=0; i<pT->Count; i++)
+  {
+    SimDev_Type *pDev = &pT->pDev[i];
+    if(!pDev->bUp)
+      continue;
+    pCurDev = pDev;
+    RStreamFlush(&pDev->Enc);
+    PublishData(pDev);
+    MqttFlush(&pDev->Conn);
+  }
+  end = WallUs() + SIM_DRAIN_MS*1000ull;
+  while(CaptureFd < 0 && WallUs() < end)
+  {
+    uint64_t waiting = 0;
+    for(i=0; i<pT->Count; i++)
+    {
+      pfd[i].fd = pT->pDev[i].bUp ? pT->pDev[i].Conn.Fd : -1;
+      pfd[i].events = POLLIN;
+      waiting += pT->pDev[i].bUp ? pT->pDev[i].Inflight : 0;
+    }
+    if(waiting == 0)
+      break;
+    if(poll(pfd, pT->Count, 10) <= 0)
+      continue;
+    for(i=0; i<pT->Count; i++)
+      if(pfd[i].fd >= 0 && (pfd[i].revents & (POLLIN|POLLHUP|POLLERR)))
+        DeviceRead(&pT->pDev[i]);
+  }
+  for(i=0; i<pT->Count; i++)
+  {
+    SimDev_Type *pDev = &pT->pDev[i];
+    if(pDev->Conn.pRx == NULL)
+      continue;
+    if(pDev->bUp && CaptureFd < 0)
+    {
+      MqttSendEmpty(&pDev->Conn, MQTT_PKT_DISCONNECT);
+      MqttFlush(&pDev->Conn);
+    }
+    MqttConnClose(&pDev->Conn);
+  }
+  free(pfd);
+  return NULL;
+}
+
+/* ---------------------------------------------------------------- Observer */
+
+static void ObsPoint(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamPoint_Type *pPoint)
+{
+  SimObserver_Type *pObs = pUser;
+  (void)pInfo;
+  if(pObs->MsgFirstUs == 0 || pPoint->TimeUs < pObs->MsgFirstUs)
+    pObs->MsgFirstUs = pPoint->TimeUs;
+  if(pPoint->TimeUs > pObs->MsgLastUs)
+    pObs->MsgLastUs = pPoint->TimeUs;
+  pObs->Points++;
+}
+
+static SimObsDev_Type *ObsDevice(SimObserver_Type *pObs, const char *pId, uint32_t Len)
+{
+  uint32_t h = 2166136261u, i;
+
+  if(Len >= SIM_ID_LEN)
+    return NULL;
+  for(i=0; i<Len; i++)
+    h = (h ^ (uint8_t)pId[i])*16777619u;
+  for(h &= pObs->DevSize - 1; pObs->pDev[h].Id[0]; h = (h + 1)&(pObs->DevSize - 1))
+    if(strncmp(pObs->pDev[h].Id, pId, Len) == 0 && pObs->pDev[h].Id[Len] == 0)
+      return &pObs->pDev[h];
+  memcpy(pObs->pDev[h].Id, pId, Len);
+  RStreamDecInit(&pObs->pDev[h].Dec, ObsPoint, pObs);
+  return &pObs->pDev[h];
+}
+
+static void *ObserverMain(void *pArg)
+{
+  SimObserver_Type *pObs = pArg;
+  MqttPacket_Type pkt;
+  MqttPublish_Type pub;
+  struct pollfd pfd = {pObs->Conn.Fd, POLLIN, 0};
+  uint64_t idle_since = 0;
+
+  while(!bQuit)
+  {
+    if(poll(&pfd, 1, 10) <= 0)
+    {
+      /* Stop once the run is over and the data stopped coming */
+      if(bRunDone && (idle_since || (idle_since = WallUs())) && WallUs() - idle_since > SIM_DRAIN_MS*1000ull)
+        break;
+      continue;
+    }
+    idle_since = 0;
+    if(MqttFill(&pObs->Conn) <= 0)
+      break;
+    while(MqttNext(&pObs->Conn, &pkt))
+    {
+      const char *id, *p;
+      SimObsDev_Type *pDev;
+      uint64_t now;
+      if(pkt.Type != MQTT_PKT_PUBLISH || !MqttParsePublish(&pkt, &pub) || pub.TopicLen < 11)
+        continue;
+      /* eis/device/<id>/data/... */
+      id = pub.pTopic + 11;
+      for(p = id; p < pub.pTopic + pub.TopicLen && *p != '/'; p++);
+      pDev = ObsDevice(pObs, id, p - id);
+      if(pDev == NULL)
+        continue;
+      pObs->Messages++;
+      pObs->MsgFirstUs = pObs->MsgLastUs = 0;
+      for(const uint8_t *f = pub.pPayload, *end = f + pub.PayloadLen; end - f >= RSTREAM_HEADER_LEN;)
+      {
+        uint32_t len = RSTREAM_HEADER_LEN + (f[6] | f[7] << 8) + RSTREAM_CRC_LEN;
+        if(len > (uint32_t)(end - f) || RStreamDecFrame(&pDev->Dec, f, len) != AD5940ERR_OK)
+        {
+          pObs->BadFrames++;
+          break;
+        }
+        pObs->Frames++;
+        f += len;
+      }
+      now = WallUs();
+      if(pObs->MsgFirstUs && now > pObs->MsgLastUs)
+      {
+        HistAdd(&pObs->AgeLat, now - pObs->MsgFirstUs);
+        HistAdd(&pObs->TransitLat, now - pObs->MsgLastUs);
+      }
+    }
+  }
+  return NULL;
+}
+
+/* ---------------------------------------------------------------- Main */
+
+static void Sum(SimStats_Type *pSum, bool bHist)
+{
+  uint32_t i;
+
+  memset(pSum, 0, sizeof(*pSum));
+  for(i=0; i<Cfg.Threads; i++)
+  {
+    const SimStats_Type *s = &Thread[i].Stats;
+    pSum->Connected += s->Connected;
+    pSum->ConnectFails += s->ConnectFails;
+    pSum->Disconnects += s->Disconnects;
+    pSum->DataMsgs += s->DataMsgs;
+    pSum->OtherMsgs += s->OtherMsgs;
+    pSum->Frames += s->Frames;
+    pSum->Points += s->Points;
+    pSum->Bytes += s->Bytes;
+    pSum->Acked += s->Acked;
+    pSum->DropMsgs += s->DropMsgs;
+    pSum->DropFrames += s->DropFrames;
+    pSum->Commands += s->Commands;
+    pSum->SendUs += s->SendUs;
+    if(bHist)
+      HistMerge(&pSum->AckLat, &s->AckLat);
+  }
+}
+
+static void PrintStats(const SimStats_Type *pNow, const SimStats_Type *pLast, double Dt, bool bFinal)
+{
+  fprintf(stderr, "%s devices %llu/%u fail %llu down %llu | data %llu msgs (%.0f/s, %.2f MB/s) points %llu (%.0f/s) "
+          "other %llu cmds %llu | acked %llu dropped %llu msgs %llu frames | send wait %.1f ms",
+          bFinal ? "total" : "loadgen",
+          (unsigned long long)pNow->Connected, Cfg.Devices, (unsigned long long)pNow->ConnectFails,
+          (unsigned long long)pNow->Disconnects, (unsigned long long)pNow->DataMsgs,
+          (pNow->DataMsgs - pLast->DataMsgs)/Dt, (pNow->Bytes - pLast->Bytes)/Dt*1e-6,
+          (unsigned long long)pNow->Points, (pNow->Points - pLast->Points)/Dt,
+          (unsigned long long)pNow->OtherMsgs, (unsigned long long)pNow->Commands,
+          (unsigned long long)pNow->Acked, (unsigned long long)pNow->DropMsgs, (unsigned long long)pNow->DropFrames,
+          (pNow->SendUs - pLast->SendUs)*1e-3);
+  if(bFinal)
+    HistPrint("| ack", &pNow->AckLat);
+  fprintf(stderr, "\n");
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: eis_loadgen [-b host[:port] | -w file] [-n devices] [-T threads] [-d s] [-r sweeps/s]\n"
+                  "                   [-p points] [-F start:stop] [-m rc|randles|battery|mix] [-f float|fixed]\n"
+                  "                   [-P batch|frame] [-k points] [-q 0|1] [-B ad5940|ad5941] [-H ms]\n"
+                  "                   [-i prefix] [-o] [-s s]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  SimStats_Type now, last;
+  SimDev_Type *pDev;
+  struct sigaction sa;
+  uint64_t t0, t_last;
+  unsigned seed = 1;
+  uint32_t i, per;
+  char *colon;
+  int opt;
+
+  while((opt = getopt(argc, argv, "b:w:n:T:d:r:p:F:m:f:P:k:q:B:H:i:os:")) != -1)
+  {
+    switch(opt)
+    {
+      case 'b':
+        snprintf(Cfg.Host, sizeof(Cfg.Host), "%s", optarg);
+        if((colon = strrchr(Cfg.Host, ':')) != NULL)
+        {
+          *colon = 0;
+          Cfg.Port = (uint16_t)atoi(colon + 1);
+        }
+        break;
+      case 'w': Cfg.Capture = optarg; break;
+      case 'n': Cfg.Devices = atoi(optarg); break;
+      case 'T': Cfg.Threads = atoi(optarg); break;
+      case 'd': Cfg.DurationS = atof(optarg); break;
+      case 'r': Cfg.Rate = atof(optarg); break;
+      case 'p': Cfg.Points = atoi(optarg); break;
+      case 'F': if(sscanf(optarg, "%lf:%lf", &Cfg.FreqStart, &Cfg.FreqStop) != 2) Usage(); break;
+      case 'm': Cfg.Model = optarg; break;
+      case 'f': Cfg.Type = strcmp(optarg, "fixed") == 0 ? RSTREAM_TYPE_FIXED : RSTREAM_TYPE_FLOAT; break;
+      case 'P': Cfg.bFrameMode = strcmp(optarg, "frame") == 0; break;
+      case 'k': Cfg.FramePoints = atoi(optarg); break;
+      case 'q': Cfg.Qos = (uint8_t)atoi(optarg); break;
+      case 'B': Cfg.Board = strcmp(optarg, "ad5941") == 0 ? 1 : 0; break;
+      case 'H': Cfg.BeatMs = atoi(optarg); break;
+      case 'i': Cfg.Prefix = optarg; break;
+      case 'o': Cfg.bObserve = true; break;
+      case 's': Cfg.StatsS = atoi(optarg); break;
+      default: Usage();
+    }
+  }
+  if(optind != argc || Cfg.Devices < 1 || Cfg.Threads < 1 || Cfg.Threads > SIM_MAX_THREADS ||
+     Cfg.Points < 2 || Cfg.Points > SIM_MAX_POINTS || Cfg.Rate <= 0 || Cfg.Qos > 1 || Cfg.FramePoints < 1 ||
+     Cfg.FreqStart <= 0 || Cfg.FreqStop <= 0 || Cfg.BeatMs < 1 || (Cfg.Capture && Cfg.bObserve))
+    Usage();
+  for(i=0; i<Cfg.Points; i++)
+    Freq[i] = Cfg.FreqStart*pow(Cfg.FreqStop/Cfg.FreqStart, i/(double)(Cfg.Points - 1));
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = OnSignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  if(Cfg.Capture)
+  {
+    CaptureFd = open(Cfg.Capture, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(CaptureFd < 0)
+    {
+      perror(Cfg.Capture);
+      return 1;
+    }
+    Cfg.Threads = 1;          /* One writer keeps packets whole */
+    Cfg.Qos = 0;
+  }
+
+  pDev = calloc(Cfg.Devices, sizeof(SimDev_Type));
+  if(pDev == NULL)
+    return 1;
+  for(i=0; i<Cfg.Devices; i++)
+  {
+    if(DeviceInit(&pDev[i], i, &seed) != 0)
+    {
+      fprintf(stderr, "unknown model %s\n", Cfg.Model);
+      return 2;
+    }
+  }
+
+  if(Cfg.bObserve)
+  {
+    int fd = MqttTcpOpen(Cfg.Host, Cfg.Port);
+    Observer.DevSize = 1;
+    while(Observer.DevSize < Cfg.Devices*2)
+      Observer.DevSize *= 2;
+    Observer.pDev = calloc(Observer.DevSize, sizeof(SimObsDev_Type));
+    if(fd < 0 || Observer.pDev == NULL || MqttConnInit(&Observer.Conn, fd, MQTT_MAX_PACKET + SIM_RX_BUFF) != 0 ||
+       MqttConnect(&Observer.Conn, "eis_loadgen_observer", SIM_KEEPALIVE_S) != 0 ||
+       MqttSubscribe(&Observer.Conn, "eis/device/+/data/#", 0) != 0)
+    {
+      fprintf(stderr, "observer cannot subscribe at %s:%u\n", Cfg.Host, Cfg.Port);
+      return 1;
+    }
+    pthread_create(&Observer.Thread, NULL, ObserverMain, &Observer);
+  }
+
+  per = (Cfg.Devices + Cfg.Threads - 1)/Cfg.Threads;
+  for(i=0; i<Cfg.Threads; i++)
+  {
+    uint32_t first = i*per;
+    Thread[i].pDev = pDev + (first < Cfg.Devices ? first : Cfg.Devices);
+    Thread[i].Count = first < Cfg.Devices ? (Cfg.Devices - first < per ? Cfg.Devices - first : per) : 0;
+    pthread_create(&Thread[i].Thread, NULL, ThreadMain, &Thread[i]);
+  }
+
+  memset(&last, 0, sizeof(last));
+  t0 = t_last = WallUs();
+  while(!bQuit && CaptureFd < 0 && WallUs() - t0 < Cfg.DurationS*1e6)
+  {
+    usleep(50000);
+    if(Cfg.StatsS && WallUs() - t_last >= Cfg.StatsS*1000000ull)
+    {
+      Sum(&now, false);
+      PrintStats(&now, &last, (WallUs() - t_last)*1e-6, false);
+      last = now;
+      t_last = WallUs();
+    }
+  }
+  for(i=0; i<Cfg.Threads; i++)
+    pthread_join(Thread[i].Thread, NULL);
+  bRunDone = true;
+  if(Cfg.bObserve)
+    pthread_join(Observer.Thread, NULL);
+
+  Sum(&now, true);
+  memset(&last, 0, sizeof(last));
+  PrintStats(&now, &last, CaptureFd >= 0 ? Cfg.DurationS : (WallUs() - t0)*1e-6, true);
+  if(Cfg.bObserve)
+  {
+    uint64_t lost = 0;
+    for(i=0; i<Observer.DevSize; i++)
+      lost += Observer.pDev[i].Dec.Lost;
+    fprintf(stderr, "observed %llu msgs %llu frames %llu points, bad %llu, lost %llu frames in sequence, "
+            "%lld of %llu sent frames missing (%.3f%%)",
+            (unsigned long long)Observer.Messages, (unsigned long long)Observer.Frames,
+            (unsigned long long)Observer.Points, (unsigned long long)Observer.BadFrames, (unsigned long long)lost,
+            (long long)(now.Frames - Observer.Frames), (unsigned long long)now.Frames,
+            now.Frames ? 100.0*((double)now.Frames - Observer.Frames)/now.Frames : 0);
+    HistPrint("| age", &Observer.AgeLat);
+    HistPrint("| transit", &Observer.TransitLat);
+    fprintf(stderr, "\n");
+    MqttConnClose(&Observer.Conn);
+  }
+  if(CaptureFd >= 0)
+    close(CaptureFd);
+  free(pDev);
+  return 0;
+}
@@ -0,0 +1,201 @@
+/*!
+ *****************************************************************************
+ @file:    goertzel_bench.c
+ @brief:   Speed and accuracy of the Goertzel bank (GoertzelBank.h) against a DFT.
+ -----------------------------------------------------------------------------
+
+ Usage: goertzel_bench [-n length] [-b bins] [-r rate] [-l low_hz] [-i blocks] [-w] [-s seed]
+   -n length       Samples per block, default 16384 as DFTNUM_16384
+   -b bins         Frequencies, default 16, at most GOERTZEL_MAX_BINS
+   -r rate         Sample rate in Hz, default 250000
+   -l low_hz       Lowest frequency, default 10 bins of the block
+   -i blocks       Blocks timed, default 20
+   -w              Hann window, as HanWinEn
+   -s seed         Random seed, default 1
+
+ Blocks are the sum of one tone at each frequency, log spaced from low_hz
+ to 0.4 times the rate, with random amplitude and phase, plus noise and
+ 16-bit quantization as the ADC gives. Frequencies are not on the DFT bin
+ grid. Each block is analysed by lib/GoertzelBank.c, compiled for the host
+ exactly as for the target, by a DFT at the same frequencies in float
+ with cosf/sinf per sample as a target would do it without the bank, and
+ by the same DFT in double as reference. Errors are the largest
+ difference from the reference relative to the largest tone amplitude.
+ The exit code is 1 if the bank error is above 1e-3.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "GoertzelBank.h"
+
+#define BENCH_MAX_ERR         1e-3
+
+static double Now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double Uniform(void)
+{
+  return (rand() + 0.5)/((double)RAND_MAX + 1);
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: goertzel_bench [-n length] [-b bins] [-r rate] [-l low_hz] [-i blocks] [-w] [-s seed]\n");
+  exit(2);
+}
+
+/* Window weight of sample n, periodic Hann as GoertzelBank */
+static double Window(int bHann, uint32_t n, uint32_t Length)
+{
+  return bHann ? 0.5 - 0.5*cos(2*M_PI*n/Length) : 1;
+}
+
+/* DFT at each frequency in double, scaled as GoertzelResult() */
+static void DftDouble(const float *pX, uint32_t Length, int bHann, const float *pFreq, uint32_t Bins, double Rate,
+                      double *pOut)
+{
+  uint32_t k, n;
+  double w, re, im, g, scale;
+
+  for(k=0; k<Bins; k++)
+  {
+    w = 2*M_PI*pFreq[k]/Rate;
+    re = 0;
+    im = 0;
+    for(n=0; n<Length; n++)
+    {
+      g = pX[n]*Window(bHann, n, Length);
+      re += g*cos(w*n);
+      im -= g*sin(w*n);
+    }
+    scale = (bHann ? 2.0 : 1.0)/Length*(pFreq[k] > 0 ? 2 : 1);
+    pOut[2*k] = re*scale;
+    pOut[2*k + 1] = im*scale;
+  }
+}
+
+/* Same in float with a window table, sine and cosine per sample */
+static void DftFloat(const float *pX, const float *pWin, uint32_t Length, const float *pFreq, uint32_t Bins,
+                     float Rate, float Scale, float *pOut)
+{
+  uint32_t k, n;
+  float w, re, im, g, a;
+
+  for(k=0; k<Bins; k++)
+  {
+    w = 2*(float)M_PI*pFreq[k]/Rate;
+    re = 0;
+    im = 0;
+    for(n=0; n<Length; n++)
+    {
+      g = pX[n]*pWin[n];
+      a = fmodf(w*n, 2*(float)M_PI);
+      re += g*cosf(a);
+      im -= g*sinf(a);
+    }
+    pOut[2*k] = re*Scale*(pFreq[k] > 0 ? 2 : 1);
+    pOut[2*k + 1] = im*Scale*(pFreq[k] > 0 ? 2 : 1);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static GoertzelBank_Type bank;
+  fImpCar_Type res[GOERTZEL_MAX_BINS];
+  float freq[GOERTZEL_MAX_BINS], amp[GOERTZEL_MAX_BINS], phase[GOERTZEL_MAX_BINS], dft_f[2*GOERTZEL_MAX_BINS];
+  double ref[2*GOERTZEL_MAX_BINS];
+  double rate = 250000, low = 0, t_bank = 0, t_float = 0, t0, err_bank = 0, err_float = 0, top, e;
+  uint32_t length = 16384, bins = 16, blocks = 20, i, k, n;
+  float *x, *win;
+  int opt_c, seed = 1, hann = 0;
+
+  while((opt_c = getopt(argc, argv, "n:b:r:l:i:ws:")) != -1)
+  {
+    switch(opt_c)
+    {
+      case 'n': length = strtoul(optarg, NULL, 0); break;
+      case 'b': bins = strtoul(optarg, NULL, 0); break;
+      case 'r': rate = strtod(optarg, NULL); break;
+      case 'l': low = strtod(optarg, NULL); break;
+      case 'i': blocks = strtoul(optarg, NULL, 0); break;
+      case 'w': hann = 1; break;
+      case 's': seed = atoi(optarg); break;
+      default: Usage();
+    }
+  }
+  if(low == 0)
+    low = 10*rate/length;
+  if(optind != argc || length < 16 || bins == 0 || bins > GOERTZEL_MAX_BINS || !(rate > 0) || !(low > 0) ||
+     !(low < 0.4*rate) || blocks == 0)
+    Usage();
+  srand(seed);
+  x = malloc(length*sizeof(float));
+  win = malloc(length*sizeof(float));
+  if(x == NULL || win == NULL)
+    return 1;
+  for(n=0; n<length; n++)
+    win[n] = (float)Window(hann, n, length);
+
+  GoertzelInit(&bank, (float)rate, length, hann ? bTRUE : bFALSE);
+  for(k=0; k<bins; k++)
+  {
+    freq[k] = (float)(bins > 1 ? low*pow(0.4*rate/low, k/(double)(bins - 1)) : low);
+    if(GoertzelAddBin(&bank, freq[k]) != AD5940ERR_OK)
+      Usage();
+  }
+  for(i=0; i<blocks; i++)
+  {
+    top = 0;
+    for(k=0; k<bins; k++)
+    {
+      amp[k] = (float)(1000*Uniform()/bins + 100.0/bins);
+      phase[k] = (float)(2*M_PI*Uniform());
+      top = amp[k] > top ? amp[k] : top;
+    }
+    for(n=0; n<length; n++)
+    {
+      double v = 5*(Uniform() - 0.5);
+      for(k=0; k<bins; k++)
+        v += amp[k]*cos(2*M_PI*freq[k]/rate*n + phase[k]);
+      x[n] = (float)lrint(v);
+    }
+    DftDouble(x, length, hann, freq, bins, rate, ref);
+
+    t0 = Now();
+    GoertzelReset(&bank);
+    GoertzelFeed(&bank, x, length);
+    GoertzelResult(&bank, res);
+    t_bank += Now() - t0;
+    t0 = Now();
+    DftFloat(x, win, length, freq, bins, (float)rate, (hann ? 2.0f : 1.0f)/length, dft_f);
+    t_float += Now() - t0;
+
+    for(k=0; k<bins; k++)
+    {
+      e = hypot(res[k].Real - ref[2*k], res[k].Image - ref[2*k + 1])/top;
+      err_bank = e > err_bank ? e : err_bank;
+      e = hypot(dft_f[2*k] - ref[2*k], dft_f[2*k + 1] - ref[2*k + 1])/top;
+      err_float = e > err_float ? e : err_float;
+    }
+  }
+
+  fprintf(stderr, "%u blocks of %u samples at %g Hz, %u frequencies %g to %g Hz, %s window\n", blocks, length, rate,
+          bins, freq[0], freq[bins-1], hann ? "Hann" : "rectangular");
+  fprintf(stderr, "goertzel bank: %.3f ms per block, %.2f ns per sample and frequency, largest error %.2g\n",
+          t_bank/blocks*1e3, t_bank/blocks/length/bins*1e9, err_bank);
+  fprintf(stderr, "float dft:     %.3f ms per block, %.2f ns per sample and frequency, largest error %.2g\n",
+          t_float/blocks*1e3, t_float/blocks/length/bins*1e9, err_float);
+  fprintf(stderr, "speedup %.1fx, memory %u bytes of GoertzelBank_Type for %u frequencies\n", t_float/t_bank,
+          (unsigned)sizeof(GoertzelBank_Type), GOERTZEL_MAX_BINS);
+  free(x);
+  free(win);
+  return err_bank > BENCH_MAX_ERR ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+/*!
+ *****************************************************************************
+ @file:    impfix_check.c
+ @brief:   Check the fixed point impedance path (ImpFixed.h) against float and double.
+ -----------------------------------------------------------------------------
+
+ Usage: impfix_check [-n results] [-s seed]
+   -n results      Random DFT result pairs, default 1000000
+   -s seed         Random seed, default 1
+
+ Each pair is an RCAL and a DUT DFT result of 18 bits with random phase,
+ the RCAL one at 2^10 to 2^17, the DUT one at 2^4 to 2^17 log spaced, and
+ a random RCAL value from 100 ohm to 200 kohm. lib/ImpFixed.c, compiled
+ for the host exactly as for the target, computes impedance, magnitude
+ and phase. The float path is the computation of AppIMPDataProcess with
+ IMP_FIXED_POINT 0. Both are compared with the exact value in double.
+ Magnitude errors are given in LSB of the fixed format (1/256 ohm) and
+ relative to the magnitude, phase errors in radian. The fixed phase error
+ is that of the CORDIC alone, against the rounded impedance ImpFixZ()
+ gives, as the rounding itself is up to 0.5 LSB on a small impedance.
+ The exit code is 1 if the fixed path is outside the bounds documented
+ in ImpFixed.h, or if a result that should saturate does not.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "ImpFixed.h"
+
+#define CHECK_LSB             (1.0/(1<<IMPFIX_ZFRAC))
+#define CHECK_PH_LSB          (1.0/(1L<<IMPFIX_PHFRAC))
+#define CHECK_Z_MAX           0.5       /* Bounds of ImpFixed.h: real and imaginary part, LSB */
+#define CHECK_MAG_LSB         1.0       /* Magnitude of the rounded Z, LSB plus CHECK_MAG_REL of itself */
+#define CHECK_MAG_REL         5e-8
+#define CHECK_PH_MAX          5e-8      /* Phase, radian */
+
+typedef struct
+{
+  iImpCar_Type Rcal;
+  iImpCar_Type Rz;
+  float RcalVal;
+}Pair_Type;
+
+static double Now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double Uniform(void)
+{
+  return (rand() + 0.5)/((double)RAND_MAX + 1);
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: impfix_check [-n results] [-s seed]\n");
+  exit(2);
+}
+
+static void RandomDft(iImpCar_Type *pDft, double LogMin, double LogMax)
+{
+  double mag = pow(2, LogMin + (LogMax - LogMin)*Uniform()), ph = 2*M_PI*Uniform();
+  pDft->Real = (int32_t)lrint(mag*cos(ph));
+  pDft->Image = (int32_t)lrint(mag*sin(ph));
+  if(pDft->Real > 131071)
+    pDft->Real = 131071;
+  if(pDft->Image > 131071)
+    pDft->Image = 131071;
+}
+
+/* AppIMPDataProcess without IMP_FIXED_POINT */
+static void FloatPath(const Pair_Type *pPair, fImpPol_Type *pRes)
+{
+  const iImpCar_Type *pDftRcal = &pPair->Rcal, *pDftRz = &pPair->Rz;
+  float RcalMag, RcalPhase, RzMag, RzPhase;
+
+  RcalMag = sqrt((float)pDftRcal->Real*pDftRcal->Real+(float)pDftRcal->Image*pDftRcal->Image);
+  RcalPhase = atan2(-pDftRcal->Image,pDftRcal->Real);
+  RzMag = sqrt((float)pDftRz->Real*pDftRz->Real+(float)pDftRz->Image*pDftRz->Image);
+  RzPhase = atan2(-pDftRz->Image,pDftRz->Real);
+  pRes->Magnitude = RcalMag/RzMag*pPair->RcalVal;
+  pRes->Phase = RcalPhase - RzPhase;
+}
+
+/* Exact value in double for the given RCAL value */
+static void Exact(const Pair_Type *pPair, double Rcal, double *pRe, double *pIm)
+{
+  double ar = pPair->Rcal.Real, ai = -pPair->Rcal.Image, br = pPair->Rz.Real, bi = -pPair->Rz.Image;
+  double den = br*br + bi*bi;
+  *pRe = Rcal*(ar*br + ai*bi)/den;
+  *pIm = Rcal*(ai*br - ar*bi)/den;
+}
+
+static double PhaseErr(double a, double b)
+{
+  double e = fmod(a - b, 2*M_PI);
+  if(e > M_PI)
+    e -= 2*M_PI;
+  if(e < -M_PI)
+    e += 2*M_PI;
+  return fabs(e);
+}
+
+int main(int argc, char **argv)
+{
+  Pair_Type *pair;
+  fImpPol_Type *res_f;
+  iImpCar_Type *res_z;
+  iImpPol_Type *res_p;
+  uint32_t n = 1000000, i, sat = 0, sat_miss = 0, valid = 0;
+  double t0, t_float, t_fixed, re, im, zr, zi, mag, e;
+  double err_z = 0, err_mag_fix = 0, err_rel_fix = 0, err_ph_fix = 0, over_mag = 0;
+  double err_mag_flt = 0, err_rel_flt = 0, err_ph_flt = 0;
+  int opt_c, seed = 1, fail = 0;
+
+  while((opt_c = getopt(argc, argv, "n:s:")) != -1)
+  {
+    switch(opt_c)
+    {
+      case 'n': n = strtoul(optarg, NULL, 0); break;
+      case 's': seed = atoi(optarg); break;
+      default: Usage();
+    }
+  }
+  if(optind != argc || n == 0)
+    Usage();
+  srand(seed);
+  pair = malloc(n*sizeof(*pair));
+  res_f = malloc(n*sizeof(*res_f));
+  res_z = malloc(n*sizeof(*res_z));
+  res_p = malloc(n*sizeof(*res_p));
+  if(pair == NULL || res_f == NULL || res_z == NULL || res_p == NULL)
+    return 1;
+  for(i=0; i<n; i++)
+  {
+    RandomDft(&pair[i].Rcal, 10, 17);
+    RandomDft(&pair[i].Rz, 4, 17);
+    if(pair[i].Rz.Real == 0 && pair[i].Rz.Image == 0)
+      pair[i].Rz.Real = 1;
+    pair[i].RcalVal = (float)(100*pow(2000, Uniform()));
+  }
+
+  t0 = Now();
+  for(i=0; i<n; i++)
+    FloatPath(&pair[i], &res_f[i]);
+  t_float = Now() - t0;
+  t0 = Now();
+  for(i=0; i<n; i++)
+  {
+    if(ImpFixZ(&pair[i].Rcal, &pair[i].Rz, ImpFixRcal(pair[i].RcalVal), &res_z[i]) != AD5940ERR_OK)
+      sat++;
+    ImpFixPolar(&res_z[i], &res_p[i]);
+  }
+  t_fixed = Now() - t0;
+
+  for(i=0; i<n; i++)
+  {
+    int32_t rcal = ImpFixRcal(pair[i].RcalVal);
+    /* Fixed path against the exact value with its rounded RCAL */
+    Exact(&pair[i], rcal*CHECK_LSB, &re, &im);
+    if(fabs(re) >= INT32_MAX*CHECK_LSB || fabs(im) >= INT32_MAX*CHECK_LSB)
+    {
+      if(res_z[i].Real != INT32_MAX && res_z[i].Real != -INT32_MAX && res_z[i].Image != INT32_MAX &&
+         res_z[i].Image != -INT32_MAX)
+        sat_miss++;
+      continue;
+    }
+    valid++;
+    mag = hypot(re, im);
+    e = fmax(fabs(res_z[i].Real*CHECK_LSB - re), fabs(res_z[i].Image*CHECK_LSB - im))/CHECK_LSB;
+    err_z = e > err_z ? e : err_z;
+    e = fabs(res_p[i].Magnitude*CHECK_LSB - mag);
+    err_mag_fix = e/CHECK_LSB > err_mag_fix ? e/CHECK_LSB : err_mag_fix;
+    if(mag > 1e4*CHECK_LSB)
+      err_rel_fix = e/mag > err_rel_fix ? e/mag : err_rel_fix;
+    /* CORDIC alone, against the rounded impedance it is given */
+    zr = res_z[i].Real*CHECK_LSB;
+    zi = res_z[i].Image*CHECK_LSB;
+    mag = hypot(zr, zi);
+    e = fabs(res_p[i].Magnitude*CHECK_LSB - mag) - CHECK_MAG_LSB*CHECK_LSB - CHECK_MAG_REL*mag;
+    over_mag = e > over_mag ? e : over_mag;
+    if(mag > 16*CHECK_LSB)
+    {
+      e = PhaseErr(res_p[i].Phase*CHECK_PH_LSB, atan2(zi, zr));
+      err_ph_fix = e > err_ph_fix ? e : err_ph_fix;
+    }
+
+    /* Float path against the exact value with its RCAL */
+    Exact(&pair[i], pair[i].RcalVal, &re, &im);
+    mag = hypot(re, im);
+    e = fabs(res_f[i].Magnitude - mag);
+    err_mag_flt = e/CHECK_LSB > err_mag_flt ? e/CHECK_LSB : err_mag_flt;
+    if(mag > 1e4*CHECK_LSB)
+      err_rel_flt = e/mag > err_rel_flt ? e/mag : err_rel_flt;
+    if(mag > 16*CHECK_LSB)
+    {
+      e = PhaseErr(res_f[i].Phase, atan2(im, re));
+      err_ph_flt = e > err_ph_flt ? e : err_ph_flt;
+    }
+  }
+
+  printf("%u results, %u saturated above %.0f ohm, %u in range\n", n, sat, INT32_MAX*CHECK_LSB, valid);
+  printf("fixed: real/imag error %.3f LSB, magnitude error %.3f LSB, %.2g relative above 1e4 LSB, phase error %.2g rad\n",
+         err_z, err_mag_fix, err_rel_fix, err_ph_fix);
+  printf("float: magnitude error %.3f LSB, %.2g relative above 1e4 LSB, phase error %.2g rad\n", err_mag_flt,
+         err_rel_flt, err_ph_flt);
+  printf("time per result on host: float %.1f ns, fixed %.1f ns\n", t_float/n*1e9,
+         t_fixed/n*1e9);
+  if(err_z > CHECK_Z_MAX + 1e-6 || over_mag > 0 || err_ph_fix > CHECK_PH_MAX || sat_miss)
+    fail = 1;
+  free(pair);
+  free(res_f);
+  free(res_z);
+  free(res_p);
+  return fail;
+}
@@ -0,0 +1,183 @@
+/*!
+ *****************************************************************************
+ @file:    kk_check.c
+ @brief:   Check the firmware Lin-KK test (LinKK.h) against EisKK.h.
+ -----------------------------------------------------------------------------
+
+ Usage: kk_check [-n spectra] [-p points] [-F start:stop] [-e noise] [-d drift] [-t threshold] [-s seed] [-v]
+   -n spectra      Synthetic spectra to test, default 1000
+   -p points       Points per spectrum, log spaced, default 50
+   -F start:stop   Frequency range in Hz, default 1:100000
+   -e noise        Relative noise added to each point, default 0.002
+   -d drift        Relative change of Rct from first to last point of the
+                   sweep, e.g. a cell that is not stationary, default 0
+   -t threshold    Largest residual relative to |Z| that passes, default 0.02
+   -s seed         Random seed, default 1
+   -v              CSV row per spectrum to stdout
+
+ Spectra are Rs-p(Rct-W,CPE) from RandlesFitEval() with parameters drawn
+ over several decades. Each is tested by lib/LinKK.c, compiled for the
+ host exactly as for the target, and by EisKKTest() in double precision
+ with the same number of RC elements and a plan made once. The summary
+ gives the fail rate of both, how far the largest residuals differ and
+ the time per test. The exit code is 1 if the two disagree on a spectrum
+ whose largest residual is more than 10% away from the threshold.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "LinKK.h"
+#include "RandlesFit.h"
+#include "EisKK.h"
+
+#define CHECK_MAX_POINTS      LINKK_MAX_POINTS
+#define CHECK_MARGIN          0.1     /* Disagreement is allowed this close to the threshold, relative */
+
+static uint64_t NowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: kk_check [-n spectra] [-p points] [-F start:stop] [-e noise] [-d drift] [-t threshold] [-s seed] [-v]\n");
+  exit(2);
+}
+
+static double Uniform(void)
+{
+  return (rand() + 0.5)/((double)RAND_MAX + 1);
+}
+
+/* Standard normal, Box-Muller */
+static double Gauss(void)
+{
+  return sqrt(-2*log(Uniform()))*cos(2*M_PI*Uniform());
+}
+
+static double LogUniform(double Lo, double Hi)
+{
+  return exp(log(Lo) + Uniform()*(log(Hi) - log(Lo)));
+}
+
+/* Parameters with the arc inside the frequency range, as randles_check */
+static void DrawParam(float *pParam, double Start, double Stop)
+{
+  double f_arc = LogUniform(Start*10, Stop/10);
+  pParam[RANDLES_RS] = LogUniform(1, 100);
+  pParam[RANDLES_RCT] = LogUniform(10, 10000);
+  pParam[RANDLES_N] = 0.7 + 0.3*Uniform();
+  pParam[RANDLES_Q] = 1/(pParam[RANDLES_RCT]*pow(2*M_PI*f_arc, pParam[RANDLES_N]));
+  pParam[RANDLES_SIGMA] = pParam[RANDLES_RCT]*LogUniform(0.01, 1)*sqrt(2*M_PI*Start);
+}
+
+int main(int argc, char **argv)
+{
+  static LinKK_Type kk;
+  EisKKPlan_Type plan;
+  EisKKResult_Type ref;
+  LinKKResult_Type res;
+  float freq[CHECK_MAX_POINTS], re[CHECK_MAX_POINTS], im[CHECK_MAX_POINTS], param[RANDLES_PARAMS];
+  double start = 1, stop = 100000, noise = 0.002, drift = 0, threshold = EISKK_THRESHOLD, diff, worst = 0;
+  uint64_t t0, t_fw = 0, t_ref = 0;
+  uint32_t spectra = 1000, points = 50, fail_fw = 0, fail_ref = 0, differ = 0, bad = 0, i, n;
+  int opt_c, seed = 1, verbose = 0;
+
+  while((opt_c = getopt(argc, argv, "n:p:F:e:d:t:s:v")) != -1)
+  {
+    switch(opt_c)
+    {
+      case 'n': spectra = strtoul(optarg, NULL, 0); break;
+      case 'p': points = strtoul(optarg, NULL, 0); break;
+      case 'F':
+        if(sscanf(optarg, "%lf:%lf", &start, &stop) != 2 || !(start > 0) || !(stop > start))
+          Usage();
+        break;
+      case 'e': noise = strtod(optarg, NULL); break;
+      case 'd': drift = strtod(optarg, NULL); break;
+      case 't': threshold = strtod(optarg, NULL); break;
+      case 's': seed = atoi(optarg); break;
+      case 'v': verbose = 1; break;
+      default: Usage();
+    }
+  }
+  if(optind != argc || spectra == 0 || points < 2 || points > CHECK_MAX_POINTS || !(threshold > 0))
+    Usage();
+  for(n=0; n<points; n++)
+    freq[n] = (float)(start*pow(stop/start, n/(double)(points - 1)));
+  srand(seed);
+  LinKKInit(&kk);
+  kk.Threshold = (float)threshold;
+  /* Same basis as the target picks for the sweep */
+  if(EisKKPlanInit(&plan, freq, points, 0) != 0)
+  {
+    fprintf(stderr, "kk_check: out of memory\n");
+    return 1;
+  }
+  if(plan.Basis > LINKK_MAX_BASIS)
+  {
+    EisKKPlanFree(&plan);
+    EisKKPlanInit(&plan, freq, points, LINKK_MAX_BASIS);
+  }
+  if(verbose)
+    printf("spectrum,max_res,ref_max_res,rms_res,ref_rms_res,pass,ref_pass\n");
+
+  for(i=0; i<spectra; i++)
+  {
+    DrawParam(param, start, stop);
+    for(n=0; n<points; n++)
+    {
+      float p[RANDLES_PARAMS];
+      fImpCar_Type z;
+      double mag;
+      memcpy(p, param, sizeof(p));
+      p[RANDLES_RCT] *= 1 + drift*n/(points - 1);
+      RandlesFitEval(p, freq[n], &z);
+      mag = hypot(z.Real, z.Image);
+      re[n] = (float)(z.Real + noise*mag*Gauss());
+      im[n] = (float)(z.Image + noise*mag*Gauss());
+    }
+
+    t0 = NowUs();
+    for(n=0; n<points; n++)
+    {
+      fImpCar_Type z = {re[n], im[n]};
+      LinKKAdd(&kk, freq[n], &z);
+    }
+    LinKKRun(&kk, &res);
+    t_fw += NowUs() - t0;
+    t0 = NowUs();
+    EisKKTest(&plan, points, re, im, threshold, &ref);
+    t_ref += NowUs() - t0;
+
+    fail_fw += res.bPass ? 0 : 1;
+    fail_ref += ref.bPass ? 0 : 1;
+    diff = fabs(res.MaxRes - ref.MaxRes);
+    worst = diff > worst ? diff : worst;
+    if((res.bPass ? 1 : 0) != (ref.bPass ? 1 : 0))
+    {
+      differ++;
+      if(fabs(ref.MaxRes - threshold) > CHECK_MARGIN*threshold)
+        bad++;
+    }
+    if(verbose)
+      printf("%u,%.6g,%.6g,%.6g,%.6g,%u,%u\n", i, res.MaxRes, ref.MaxRes, res.RmsRes, ref.RmsRes,
+             res.bPass ? 1 : 0, ref.bPass ? 1 : 0);
+  }
+
+  fprintf(stderr, "%u spectra of %u points, %u RC elements, noise %g, drift %g, threshold %g\n", spectra, points,
+          plan.Basis, noise, drift, threshold);
+  fprintf(stderr, "firmware test: %u failed, %.1f us per test\n", fail_fw, t_fw/(double)spectra);
+  fprintf(stderr, "reference test: %u failed, %.1f us per test with cached plan\n", fail_ref, t_ref/(double)spectra);
+  fprintf(stderr, "largest residual differs by at most %.2e, verdict differs on %u spectra, %u not near the threshold\n",
+          worst, differ, bad);
+  fprintf(stderr, "memory: %u bytes of LinKK_Type for %u points\n", (unsigned)sizeof(LinKK_Type), LINKK_MAX_POINTS);
+  EisKKPlanFree(&plan);
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+/*!
+ *****************************************************************************
+ @file:    pointstat_check.c
+ @brief:   Check combination of repeated points (PointStat.h) on repeats with spikes.
+ -----------------------------------------------------------------------------
+
+ Usage: pointstat_check [-n points] [-r repeats] [-e noise] [-p spike_prob] [-a spike_amp] [-k hampel_k] [-s seed]
+   -n points       Points, default 10000
+   -r repeats      Repeats per point, default 5, at most POINTSTAT_MAX_REPEAT
+   -e noise        Gaussian noise of real and imaginary part relative to |Z|, default 0.001
+   -p spike_prob   Probability that a repeat is hit by a spike, default 0.05
+   -a spike_amp    Spike amplitude relative to |Z|, default 0.2
+   -k hampel_k     Threshold of POINTSTAT_HAMPEL in sigmas, default 3
+   -s seed         Random seed, default 1
+
+ Each point is a random impedance measured repeats times with noise, and
+ some repeats get a spike of random phase added, as interference does to
+ a DFT result. lib/PointStat.c, compiled for the host exactly as for the
+ target, combines the repeats in each mode. Errors are relative to |Z|,
+ as RMS over the points where less than half of the repeats have a
+ spike, which a robust mode should recover, and over all points. Points
+ with an error above CHECK_BAD_NOISE times the noise are counted as bad.
+ The reported variance is compared with the noise on points without
+ spikes, and the points are sent through a RSTREAM_TYPE_STAT stream and
+ decoded again. The exit code is 1 if the Hampel filter has bad points
+ that it should recover or an error above twice the one of a spike free
+ mean there, if the variance is off by more than 20%, if it rejects more
+ than 20% above the spikes plus the Gaussian tail beyond hampel_k of the
+ other repeats, or if the stream does not give back what was sent.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "PointStat.h"
+#include "ResultStream.h"
+
+#define CHECK_MODES           3
+#define CHECK_MAX_FRAMES      64
+#define CHECK_BAD_NOISE       5
+#define CHECK_REJECT_MAX      1.2     /* Allowed Hampel rejects over spikes and Gaussian tail */
+
+static const char *ModeName[CHECK_MODES] = {"mean", "median", "hampel"};
+
+static uint8_t Capture[CHECK_MAX_FRAMES*RSTREAM_MAX_FRAME];
+static uint32_t CaptureLen;
+static uint32_t Decoded, Mismatch;
+static RStreamPoint_Type Sent[RSTREAM_MAX_RECORDS];
+
+static double Uniform(void)
+{
+  return (rand() + 0.5)/((double)RAND_MAX + 1);
+}
+
+static double Gauss(void)
+{
+  return sqrt(-2*log(Uniform()))*cos(2*M_PI*Uniform());
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: pointstat_check [-n points] [-r repeats] [-e noise] [-p spike_prob] [-a spike_amp] [-k hampel_k] [-s seed]\n");
+  exit(2);
+}
+
+static void StreamWrite(const uint8_t *pData, uint32_t Len)
+{
+  if(CaptureLen + Len <= sizeof(Capture))
+  {
+    memcpy(Capture + CaptureLen, pData, Len);
+    CaptureLen += Len;
+  }
+}
+
+static void OnPoint(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamPoint_Type *pPoint)
+{
+  const RStreamPoint_Type *p = &Sent[Decoded++ % RSTREAM_MAX_RECORDS];
+  (void)pUser;
+  if(pInfo->Type != RSTREAM_TYPE_STAT || pPoint->Z.Real != p->Z.Real || pPoint->Z.Image != p->Z.Image ||
+     pPoint->Var.Real != p->Var.Real || pPoint->Var.Image != p->Var.Image || pPoint->Used != p->Used ||
+     pPoint->Rejected != p->Rejected || pPoint->SweepIndex != p->SweepIndex)
+    Mismatch++;
+}
+
+int main(int argc, char **argv)
+{
+  static PointStat_Type stat;
+  PointStatResult_Type res;
+  RStreamEnc_Type enc;
+  RStreamDec_Type dec;
+  fImpCar_Type z, rep;
+  double noise = 0.001, prob = 0.05, amp = 0.2, hampel_k = 3, mag, ph, e;
+  double sum_err[CHECK_MODES] = {0}, rec_err[CHECK_MODES] = {0}, clean_err = 0, var_ratio = 0;
+  uint32_t bad[CHECK_MODES] = {0}, points = 10000, repeats = 5, i, r, m, spiked = 0, rejected = 0, clean = 0;
+  uint32_t recover = 0, sent = 0, spikes, added = 0;
+  int opt_c, seed = 1, fail = 0;
+  double expect_rej;
+
+  while((opt_c = getopt(argc, argv, "n:r:e:p:a:k:s:")) != -1)
+  {
+    switch(opt_c)
+    {
+      case 'n': points = strtoul(optarg, NULL, 0); break;
+      case 'r': repeats = strtoul(optarg, NULL, 0); break;
+      case 'e': noise = strtod(optarg, NULL); break;
+      case 'p': prob = strtod(optarg, NULL); break;
+      case 'a': amp = strtod(optarg, NULL); break;
+      case 'k': hampel_k = strtod(optarg, NULL); break;
+      case 's': seed = atoi(optarg); break;
+      default: Usage();
+    }
+  }
+  if(optind != argc || points == 0 || repeats < 3 || repeats > POINTSTAT_MAX_REPEAT || !(noise > 0) ||
+     prob < 0 || prob > 1 || !(hampel_k > 0))
+    Usage();
+  srand(seed);
+  RStreamEncInit(&enc, RSTREAM_TYPE_STAT, 0, StreamWrite);
+
+  for(i=0; i<points; i++)
+  {
+    mag = pow(10, 1 + 5*Uniform());
+    ph = -M_PI/2*Uniform();
+    z.Real = (float)(mag*cos(ph));
+    z.Image = (float)(mag*sin(ph));
+    PointStatClear(&stat);
+    for(r=0, spikes=0; r<repeats; r++)
+    {
+      rep.Real = (float)(z.Real + noise*mag*Gauss());
+      rep.Image = (float)(z.Image + noise*mag*Gauss());
+      if(Uniform() < prob)
+      {
+        double a = 2*M_PI*Uniform();
+        rep.Real += (float)(amp*mag*cos(a));
+        rep.Image += (float)(amp*mag*sin(a));
+        spikes++;
+      }
+      PointStatAdd(&stat, &rep);
+    }
+    spiked += spikes > 0;
+    added += spikes;
+    recover += 2*spikes < repeats;
+    for(m=0; m<CHECK_MODES; m++)
+    {
+      PointStatResult(&stat, m, (float)hampel_k, &res);
+      e = hypot(res.Z.Real - z.Real, res.Z.Image - z.Image)/mag;
+      sum_err[m] += e*e;
+      if(2*spikes < repeats)
+      {
+        rec_err[m] += e*e;
+        bad[m] += e > CHECK_BAD_NOISE*noise;
+      }
+      if(m == POINTSTAT_MEAN && spikes == 0)
+      {
+        clean_err += e*e;
+        var_ratio += (res.Var.Real + res.Var.Image)/(2*noise*noise*mag*mag);
+        clean++;
+      }
+      if(m == POINTSTAT_HAMPEL)
+        rejected += res.Rejected;
+    }
+
+    /* Stream the Hampel result of the first points */
+    if(i < RSTREAM_MAX_RECORDS)
+    {
+      RStreamPoint_Type *p = &Sent[sent++];
+      memset(p, 0, sizeof(*p));
+      p->Freq = 1000;
+      p->SweepIndex = (uint16_t)i;
+      p->Z = res.Z;
+      p->Var = res.Var;
+      p->Used = res.Used;
+      p->Rejected = res.Rejected;
+      RStreamAdd(&enc, p);
+    }
+  }
+  RStreamEndSweep(&enc);
+  RStreamDecInit(&dec, OnPoint, NULL);
+  RStreamDecFeed(&dec, Capture, CaptureLen);
+
+  printf("%u points of %u repeats, noise %g, %u points with spikes of %g, %u with less than half spikes\n", points,
+         repeats, noise, spiked, amp, recover);
+  for(m=0; m<CHECK_MODES; m++)
+    printf("%-7s rms error %.3g, %u bad of %u with less than half spikes, rms error %.3g of all\n", ModeName[m],
+           sqrt(rec_err[m]/recover), bad[m], recover, sqrt(sum_err[m]/points));
+  clean_err = clean ? sqrt(clean_err/clean) : 0;
+  var_ratio = clean ? var_ratio/clean : 1;
+  printf("mean without spikes: rms error %.3g, variance %.3f of the noise\n", clean_err, var_ratio);
+  /* Spikes plus the Gaussian tail beyond hampel_k sigma of the other repeats */
+  expect_rej = added + exp(-hampel_k*hampel_k/2)*((double)points*repeats - added);
+  printf("hampel rejected %u repeats, %u spikes were added, %.0f rejects expected\n", rejected, added, expect_rej);
+  printf("stream: %u of %u points decoded, %u differ, %lu frames\n", Decoded, sent, Mismatch,
+         (unsigned long)dec.FrameCount);
+
+  if(bad[POINTSTAT_HAMPEL] || sqrt(rec_err[POINTSTAT_HAMPEL]/recover) > 2*clean_err)
+    fail = 1;
+  if(fabs(var_ratio - 1) > 0.2)
+    fail = 1;
+  if(rejected > CHECK_REJECT_MAX*expect_rej)
+    fail = 1;
+  if(Decoded != sent || Mismatch)
+    fail = 1;
+  return fail;
+}
@@ -0,0 +1,259 @@
+/*!
+ *****************************************************************************
+ @file:    randles_check.c
+ @brief:   Check the firmware Randles fit (RandlesFit.h) against EisFit.h.
+ -----------------------------------------------------------------------------
+
+ Usage: randles_check [-n spectra] [-p points] [-F start:stop] [-e noise] [-s seed] [-w] [-v]
+   -n spectra      Synthetic spectra to fit, default 1000
+   -p points       Points per spectrum, log spaced, default 50
+   -F start:stop   Frequency range in Hz, default 1:100000
+   -e noise        Relative noise added to each point, default 0.002
+   -s seed         Random seed, default 1
+   -w              Spectra drift slowly and each fit starts from the one
+                   before, as on target. Default is a cold start each time.
+   -v              CSV row per spectrum to stdout
+
+ Spectra are Rs-p(Rct-W,CPE) with parameters drawn over several decades.
+ Each is fitted by lib/RandlesFit.c, compiled for the host exactly as for
+ the target, and the result is taken from the fit record it sends through
+ ResultStream encoder and decoder. The reference is EisFit() in double precision with the same circuit
+ s(R1,p(s(R1,W1),E2)) and weights, started from the true parameters. The
+ summary compares residual norms and parameters of both fits and the
+ time per fit. The exit code is 1 if the residual norm of any firmware fit
+ is more than 1% above that of the reference fit, give or take 1e-4 that
+ float resolves in noise-free spectra.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "RandlesFit.h"
+#include "EisFit.h"
+
+#define CHECK_MAX_POINTS      RANDLES_MAX_POINTS
+#define CHECK_COST_TOL        0.01    /* Allowed excess of firmware residual norm over reference */
+#define CHECK_NORM_FLOOR      1e-4    /* Residual norm float can resolve, matters for noise-free spectra */
+
+/* EisFit parameter order of s(R1,p(s(R1,W1),E2)) for each RANDLES_xxx */
+static const uint32_t EisOrder[RANDLES_PARAMS] = {0, 1, 3, 4, 2};
+static const char *ParamName[RANDLES_PARAMS] = {"rs", "rct", "q", "n", "sigma"};
+
+static RStreamDec_Type Dec;
+static RStreamFit_Type FitRec;
+
+static void OnFit(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamFit_Type *pFit)
+{
+  (void)pUser;
+  (void)pInfo;
+  FitRec = *pFit;
+}
+
+static void StreamWrite(const uint8_t *pData, uint32_t Len)
+{
+  RStreamDecFeed(&Dec, pData, Len);
+}
+
+static uint64_t NowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: randles_check [-n spectra] [-p points] [-F start:stop] [-e noise] [-s seed] [-w] [-v]\n");
+  exit(2);
+}
+
+static double Uniform(void)
+{
+  return (rand() + 0.5)/((double)RAND_MAX + 1);
+}
+
+/* Standard normal, Box-Muller */
+static double Gauss(void)
+{
+  return sqrt(-2*log(Uniform()))*cos(2*M_PI*Uniform());
+}
+
+static double LogUniform(double Lo, double Hi)
+{
+  return exp(log(Lo) + Uniform()*(log(Hi) - log(Lo)));
+}
+
+/* Parameters with the arc inside the frequency range */
+static void DrawParam(double *pParam, double Start, double Stop)
+{
+  double f_arc = LogUniform(Start*10, Stop/10);
+  pParam[RANDLES_RS] = LogUniform(1, 100);
+  pParam[RANDLES_RCT] = LogUniform(10, 10000);
+  pParam[RANDLES_N] = 0.7 + 0.3*Uniform();
+  pParam[RANDLES_Q] = 1/(pParam[RANDLES_RCT]*pow(2*M_PI*f_arc, pParam[RANDLES_N]));
+  pParam[RANDLES_SIGMA] = pParam[RANDLES_RCT]*LogUniform(0.01, 1)*sqrt(2*M_PI*Start);
+}
+
+static void Spectrum(const double *pParam, uint32_t Points, const float *pFreq, double Noise,
+                     float *pReal, float *pImage)
+{
+  float param[RANDLES_PARAMS];
+  fImpCar_Type z;
+  uint32_t n, k;
+
+  for(k=0; k<RANDLES_PARAMS; k++)
+    param[k] = (float)pParam[k];
+  for(n=0; n<Points; n++)
+  {
+    double mag;
+    RandlesFitEval(param, pFreq[n], &z);
+    mag = hypot(z.Real, z.Image);
+    pReal[n] = (float)(z.Real + Noise*mag*Gauss());
+    pImage[n] = (float)(z.Image + Noise*mag*Gauss());
+  }
+}
+
+static int CmpDouble(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+  static RandlesFit_Type fit;
+  static RStreamEnc_Type enc;
+  EisFitCircuit_Type circuit;
+  EisFitOpt_Type opt;
+  EisFitResult_Type ref;
+  float freq[CHECK_MAX_POINTS], re[CHECK_MAX_POINTS], im[CHECK_MAX_POINTS];
+  double truth[RANDLES_PARAMS], init[EISFIT_MAX_PARAM], start = 1, stop = 100000, noise = 0.002;
+  double *pDev[RANDLES_PARAMS], *pExcess, worst = -1;
+  uint64_t t0, t_fw = 0, t_ref = 0, iter = 0;
+  uint32_t spectra = 1000, points = 50, status[3] = {0}, bad = 0, i, n, k;
+  int opt_c, seed = 1, verbose = 0, warm = 0;
+  char err[128];
+
+  while((opt_c = getopt(argc, argv, "n:p:F:e:s:wv")) != -1)
+  {
+    switch(opt_c)
+    {
+      case 'n': spectra = strtoul(optarg, NULL, 0); break;
+      case 'p': points = strtoul(optarg, NULL, 0); break;
+      case 'F':
+        if(sscanf(optarg, "%lf:%lf", &start, &stop) != 2 || !(start > 0) || !(stop > start))
+          Usage();
+        break;
+      case 'e': noise = strtod(optarg, NULL); break;
+      case 's': seed = atoi(optarg); break;
+      case 'w': warm = 1; break;
+      case 'v': verbose = 1; break;
+      default: Usage();
+    }
+  }
+  if(optind != argc || spectra == 0 || points < RANDLES_PARAMS || points > CHECK_MAX_POINTS)
+    Usage();
+  if(EisFitParse("s(R1,p(s(R1,W1),E2))", &circuit, err, sizeof(err)) != 0)
+  {
+    fprintf(stderr, "%s\n", err);
+    return 1;
+  }
+  pExcess = malloc(spectra*sizeof(double));
+  for(k=0; k<RANDLES_PARAMS; k++)
+    pDev[k] = malloc(spectra*sizeof(double));
+  for(n=0; n<points; n++)
+    freq[n] = (float)(start*pow(stop/start, points > 1 ? n/(double)(points - 1) : 0));
+  srand(seed);
+  RStreamEncInit(&enc, RSTREAM_TYPE_FLOAT, 0, StreamWrite);
+  RStreamDecInit(&Dec, NULL, NULL);
+  Dec.pOnFit = OnFit;
+  RandlesFitInit(&fit);
+  fit.bWarmStart = warm ? bTRUE : bFALSE;
+  DrawParam(truth, start, stop);
+  if(verbose)
+  {
+    printf("spectrum,status,iter,res_norm,ref_res_norm");
+    for(k=0; k<RANDLES_PARAMS; k++)
+      printf(",%s,ref_%s", ParamName[k], ParamName[k]);
+    printf("\n");
+  }
+
+  for(i=0; i<spectra; i++)
+  {
+    double ref_norm;
+    if(warm)
+    {
+      /* Slow drift, e.g. a cell ageing between sweeps */
+      for(k=0; k<RANDLES_PARAMS; k++)
+        truth[k] *= k == RANDLES_N ? 1 : exp(0.01*Gauss());
+    }
+    else if(i)
+      DrawParam(truth, start, stop);
+    Spectrum(truth, points, freq, noise, re, im);
+
+    t0 = NowUs();
+    for(n=0; n<points; n++)
+    {
+      fImpCar_Type z = {re[n], im[n]};
+      RandlesFitAdd(&fit, 0, freq[n], &z);
+    }
+    FitRec.Model = 0;
+    RandlesFitSend(&fit, &enc, i, bFALSE, bFALSE);
+    t_fw += NowUs() - t0;
+    if(FitRec.Model != RSTREAM_FIT_RANDLES || FitRec.TimeUs != i || FitRec.Points != points)
+    {
+      fprintf(stderr, "spectrum %u: fit record missing or wrong\n", i);
+      return 1;
+    }
+    status[FitRec.Status < 3 ? FitRec.Status : RANDLES_FAIL]++;
+    iter += FitRec.Iter;
+
+    for(k=0; k<RANDLES_PARAMS; k++)
+      init[EisOrder[k]] = truth[k];
+    EisFitOptInit(&opt, &circuit, init);
+    opt.Lower[EisOrder[RANDLES_N]] = 0;
+    opt.Upper[EisOrder[RANDLES_N]] = 1;
+    t0 = NowUs();
+    EisFit(&circuit, &opt, NULL, points, freq, re, im, &ref);
+    t_ref += NowUs() - t0;
+    ref_norm = sqrt(ref.Cost/(2.0*ref.Points));
+
+    pExcess[i] = (FitRec.ResNorm - ref_norm)/(ref_norm + CHECK_NORM_FLOOR);
+    if(!(pExcess[i] <= CHECK_COST_TOL))
+      bad++;
+    if(!(pExcess[i] <= worst))
+      worst = pExcess[i];
+    for(k=0; k<RANDLES_PARAMS; k++)
+      pDev[k][i] = fabs(FitRec.Param[k]/ref.Param[EisOrder[k]] - 1);
+    if(verbose)
+    {
+      printf("%u,%u,%u,%.6g,%.6g", i, FitRec.Status, FitRec.Iter, FitRec.ResNorm, ref_norm);
+      for(k=0; k<RANDLES_PARAMS; k++)
+        printf(",%.6g,%.6g", FitRec.Param[k], ref.Param[EisOrder[k]]);
+      printf("\n");
+    }
+  }
+
+  fprintf(stderr, "%u spectra of %u points, %s start, noise %g\n", spectra, points, warm ? "warm" : "cold", noise);
+  fprintf(stderr, "firmware fit: %u converged, %u iteration limit, %u failed, %.1f iterations, %.1f us per fit\n",
+          status[RANDLES_OK], status[RANDLES_MAXITER], status[RANDLES_FAIL], iter/(double)spectra,
+          t_fw/(double)spectra);
+  fprintf(stderr, "reference fit: %.1f us per fit\n", t_ref/(double)spectra);
+  qsort(pExcess, spectra, sizeof(double), CmpDouble);
+  fprintf(stderr, "residual norm over reference: median %+.2e, max %+.2e, %u above %g\n",
+          pExcess[spectra/2], worst, bad, CHECK_COST_TOL);
+  for(k=0; k<RANDLES_PARAMS; k++)
+  {
+    qsort(pDev[k], spectra, sizeof(double), CmpDouble);
+    fprintf(stderr, "%-6s relative difference: median %.2e, 95%% %.2e\n", ParamName[k],
+            pDev[k][spectra/2], pDev[k][(uint32_t)(spectra*0.95)]);
+    free(pDev[k]);
+  }
+  fprintf(stderr, "memory: %u bytes of RandlesFit_Type for %u points\n", (unsigned)sizeof(RandlesFit_Type),
+          RANDLES_MAX_POINTS);
+  free(pExcess);
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+/*!
+ *****************************************************************************
+ @file:    rstream_dump.c
+ @brief:   Decode binary result stream (ResultStream.h) to CSV.
+ -----------------------------------------------------------------------------
+
+ Usage: rstream_dump [-f | -a] [capture file]
+ Reads from stdin if no file is given, e.g. from a serial port:
+   stty -F /dev/ttyUSB0 115200 raw && rstream_dump < /dev/ttyUSB0
+ CSV goes to stdout, frame statistics to stderr when input ends.
+ var_real and var_image are the variance of the repeats a point was
+ combined from on target (RSTREAM_TYPE_STAT, see PointStat.h), used and
+ rejected how many repeats were kept and dropped as outliers. Points
+ measured once have 0,0,1,0.
+ With -f the CSV has the fit records of the stream instead of the points,
+ one row per fitted sweep. kk_fail is 1 if the sweep failed the Lin-KK
+ test on target (RSTREAM_FLAG_KKFAIL).
+ With -a the CSV has the samples of ADC frames (see AdcStream.h), one row
+ per sample with its time from the frame time stamp and sample rate.
+ Samples missing from the stream are reported to stderr: gaps in the
+ sample index, and how many of them the target dropped.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "ResultStream.h"
+
+static void OnPoint(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamPoint_Type *pPoint)
+{
+  FILE *out = (FILE*)pUser;
+  fprintf(out, "%u,%llu,%u,%u,%u,%.4f,%.6g,%.6g,%.6g,%.6g,%u,%u\n", pInfo->Seq, (unsigned long long)pPoint->TimeUs,
+          pPoint->bHostTime == bTRUE, pPoint->SweepIndex, pPoint->Channel, pPoint->Freq, pPoint->Z.Real, pPoint->Z.Image,
+          pPoint->Var.Real, pPoint->Var.Image, pPoint->Used, pPoint->Rejected);
+}
+
+static void OnFit(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamFit_Type *pFit)
+{
+  FILE *out = (FILE*)pUser;
+  uint32_t k;
+
+  fprintf(out, "%u,%llu,%u,%u,%u,%u,%u,%u", pInfo->Seq, (unsigned long long)pFit->TimeUs, pFit->bHostTime == bTRUE,
+          pFit->Channel, pFit->Model, pFit->Status, pFit->Iter, pFit->Points);
+  for(k=0;k<RSTREAM_FIT_PARAMS;k++)
+    fprintf(out, ",%.6g", pFit->Param[k]);
+  fprintf(out, ",%.6g,%u\n", pFit->ResNorm, pFit->bKKFail == bTRUE);
+}
+
+/* Continuity of ADC samples */
+static struct
+{
+  int bValid;
+  uint32_t NextIndex;
+  uint64_t Samples;
+  uint64_t Missing;
+  uint32_t Gaps;
+  uint32_t Dropped;             /* Dropped on target, from last frame */
+}AdcStat;
+
+static void OnAdc(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamAdc_Type *pAdc, const int16_t *pSample)
+{
+  FILE *out = (FILE*)pUser;
+  uint32_t k;
+
+  if(AdcStat.bValid && pAdc->FirstIndex != AdcStat.NextIndex)
+  {
+    AdcStat.Gaps++;
+    AdcStat.Missing += (uint32_t)(pAdc->FirstIndex - AdcStat.NextIndex);
+  }
+  AdcStat.bValid = 1;
+  AdcStat.NextIndex = pAdc->FirstIndex + pAdc->Count;
+  AdcStat.Samples += pAdc->Count;
+  AdcStat.Dropped = pAdc->Dropped;
+  for(k=0;k<pAdc->Count;k++)
+    fprintf(out, "%u,%.1f,%u,%u,%u,%d,%.7g\n", pInfo->Seq, pAdc->TimeUs + k*1e6/pAdc->SampleRate,
+            pAdc->bHostTime == bTRUE, pAdc->Channel, pAdc->FirstIndex + k, pSample[k], pSample[k]*pAdc->Scale);
+}
+
+int main(int argc, char **argv)
+{
+  RStreamDec_Type dec;
+  uint8_t buff[1024];
+  size_t len;
+  FILE *in = stdin;
+  int fit = argc > 1 && strcmp(argv[1], "-f") == 0;
+  int adc = argc > 1 && strcmp(argv[1], "-a") == 0;
+  int opt = fit || adc;
+
+  if(argc > 1 + opt)
+  {
+    in = fopen(argv[1 + opt], "rb");
+    if(in == NULL)
+    {
+      perror(argv[1 + opt]);
+      return 1;
+    }
+  }
+  if(adc)
+  {
+    RStreamDecInit(&dec, NULL, stdout);
+    dec.pOnAdc = OnAdc;
+    printf("seq,time_us,host_time,channel,index,code,volt\n");
+  }
+  else if(fit)
+  {
+    /* Parameter columns of RSTREAM_FIT_RANDLES, the only model so far */
+    RStreamDecInit(&dec, NULL, stdout);
+    dec.pOnFit = OnFit;
+    printf("seq,time_us,host_time,channel,model,status,iter,points,rs,rct,q,n,sigma,res_norm,kk_fail\n");
+  }
+  else
+  {
+    RStreamDecInit(&dec, OnPoint, stdout);
+    printf("seq,time_us,host_time,sweep_index,channel,freq_hz,real,image,var_real,var_image,used,rejected\n");
+  }
+  while((len = fread(buff, 1, sizeof(buff), in)) > 0)
+  {
+    RStreamDecFeed(&dec, buff, (uint32_t)len);
+    fflush(stdout);
+  }
+  fprintf(stderr, "frames %lu, crc errors %lu, lost %lu, reordered %lu, skipped bytes %lu\n",
+          (unsigned long)dec.FrameCount, (unsigned long)dec.CrcErrors, (unsigned long)dec.Lost,
+          (unsigned long)dec.Reordered, (unsigned long)dec.SyncLost);
+  if(adc)
+    fprintf(stderr, "samples %llu, gaps %lu, missing %llu, dropped on target %lu\n",
+            (unsigned long long)AdcStat.Samples, (unsigned long)AdcStat.Gaps,
+            (unsigned long long)AdcStat.Missing, (unsigned long)AdcStat.Dropped);
+  if(in != stdin)
+    fclose(in);
+  return 0;
+}
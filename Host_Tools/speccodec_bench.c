@@ -0,0 +1,142 @@
+/*!
+ *****************************************************************************
+ @file:    speccodec_bench.c
+ @brief:   Compression ratio and speed of the spectrum codec (SpecCodec.h).
+ -----------------------------------------------------------------------------
+
+ Usage: speccodec_bench [sweeps]
+ Encodes and decodes a synthetic monitoring run: a Randles cell swept
+ 1 Hz to 100 kHz in 101 log points, with slow drift and measurement noise.
+ Noise is gaussian, 0.1 % and 1 mrad at mid band, rising to about 1 % and
+ 10 mrad at the low frequency end where few periods are integrated and at
+ 100 kHz. The ratio is set by the noise over the error bound: bounds well
+ below the noise pay for coding the noise, bounds at or above it reach the
+ floor of one varint byte per value, about 5.5 for this grid.
+ Typical 5000 sweeps: exact 2.0, 1e-5 3.6, 1e-4 5.2, 1e-3 and 1e-2 5.6. The last run uses the same grid as a pFreqList plan, so key frames
+ carry the frequency list.
+ Sizes are compared with raw (frequency, magnitude, phase) float points.
+
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "SpecCodec.h"
+
+#define BENCH_POINTS    101
+#define BENCH_KEY_INT   64
+
+static double Now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* Gaussian, unit sigma */
+static double Noise(void)
+{
+  double u1 = (rand() + 1.0)/((double)RAND_MAX + 2.0);
+  double u2 = rand()/(double)RAND_MAX;
+  return sqrt(-2*log(u1))*cos(2*MATH_PI*u2);
+}
+
+/* Relative noise of a point, higher at the band edges */
+static double NoiseLevel(float Freq)
+{
+  double lf = 10/Freq, hf = Freq/100000;
+  return 1e-3*(1 + 9*lf*lf/(1 + lf*lf) + 9*hf*hf);
+}
+
+/* Rs + (Rct || Cdl), parameters drift over the run */
+static void MakeSweep(const SpecPlan_Type *pPlan, uint32_t Sweep, fImpPol_Type *pImp)
+{
+  double rs = 50*(1 + 0.05*sin(Sweep*0.01));
+  double rct = 1000*(1 + 0.1*sin(Sweep*0.003));
+  double cdl = 1e-6;
+  for(uint32_t i=0; i<pPlan->Points; i++)
+  {
+    float f = SpecPlanFreq(pPlan, i);
+    double w = 2*MATH_PI*f;
+    double d = 1 + w*w*rct*rct*cdl*cdl;
+    double re = rs + rct/d;
+    double im = -w*rct*rct*cdl/d;
+    double n = NoiseLevel(f);
+    pImp[i].Magnitude = (float)(sqrt(re*re + im*im)*(1 + n*Noise()));
+    pImp[i].Phase = (float)(atan2(im, re) + n*Noise());
+  }
+}
+
+static void Run(const SpecPlan_Type *pPlan, uint32_t Sweeps, float MagRelErr, float PhaseErr)
+{
+  static SpecEnc_Type enc;
+  static SpecDec_Type dec;
+  static fImpPol_Type in[BENCH_POINTS], out[BENCH_POINTS];
+  static float freq[BENCH_POINTS];
+  static uint8_t frame[SPEC_MAX_FRAME(BENCH_POINTS)];
+  uint64_t bytes = 0;
+  double t_enc = 0, t_dec = 0, mag_err = 0, phase_err = 0;
+  uint32_t len, points, errors = 0;
+
+  srand(1);
+  SpecEncInit(&enc, MagRelErr, PhaseErr, BENCH_KEY_INT);
+  SpecDecInit(&dec);
+  for(uint32_t s=0; s<Sweeps; s++)
+  {
+    double t0, t1, t2;
+    MakeSweep(pPlan, s, in);
+    t0 = Now();
+    SpecEncode(&enc, pPlan, in, frame, sizeof(frame), &len);
+    t1 = Now();
+    if(SpecDecode(&dec, frame, len, freq, out, BENCH_POINTS, &points) != AD5940ERR_OK || points != pPlan->Points)
+      errors++;
+    t2 = Now();
+    t_enc += t1 - t0;
+    t_dec += t2 - t1;
+    bytes += len;
+    for(uint32_t i=0; i<pPlan->Points; i++)
+    {
+      double e = fabs(out[i].Magnitude/in[i].Magnitude - 1);
+      if(freq[i] != SpecPlanFreq(pPlan, i))
+        errors++;
+      if(e > mag_err) mag_err = e;
+      e = fabs(out[i].Phase - in[i].Phase);
+      if(e > phase_err) phase_err = e;
+    }
+  }
+  printf("%-10g %-10g %8.2f %8.2f %10.1f %10.1f %10.2e %10.2e %s\n", MagRelErr, PhaseErr,
+         (double)bytes/Sweeps, (double)Sweeps*pPlan->Points*12/bytes,
+         Sweeps*pPlan->Points/t_enc/1e6, Sweeps*pPlan->Points/t_dec/1e6,
+         mag_err, phase_err, errors ? "DECODE ERRORS" : "");
+}
+
+int main(int argc, char **argv)
+{
+  SoftSweepCfg_Type sweep = {0};
+  SpecPlan_Type plan, list_plan;
+  static float list[BENCH_POINTS];
+  uint32_t sweeps = argc > 1 ? (uint32_t)atoi(argv[1]) : 10000;
+
+  sweep.SweepEn = bTRUE;
+  sweep.SweepStart = 1;
+  sweep.SweepStop = 100000;
+  sweep.SweepPoints = BENCH_POINTS;
+  sweep.SweepLog = bTRUE;
+  SpecPlanFromSweep(&plan, &sweep);
+  printf("%lu sweeps of %lu points, plan 0x%04X, raw %lu bytes/sweep\n", (unsigned long)sweeps,
+         (unsigned long)plan.Points, plan.PlanId, (unsigned long)plan.Points*12);
+  printf("%-10s %-10s %8s %8s %10s %10s %10s %10s\n", "mag_rel", "phase_rad", "B/sweep", "ratio",
+         "enc Mpt/s", "dec Mpt/s", "max mag", "max phase");
+  Run(&plan, sweeps, 0, 0);
+  Run(&plan, sweeps, 1e-5f, 1e-5f);
+  Run(&plan, sweeps, 1e-4f, 1e-4f);
+  Run(&plan, sweeps, 1e-3f, 1e-3f);
+  Run(&plan, sweeps, 1e-2f, 1e-2f);
+  for(uint32_t i=0; i<BENCH_POINTS; i++)
+    list[i] = SpecPlanFreq(&plan, i);
+  sweep.pFreqList = list;
+  SpecPlanFromSweep(&list_plan, &sweep);
+  printf("pFreqList plan 0x%04X\n", list_plan.PlanId);
+  Run(&list_plan, sweeps, 1e-3f, 1e-3f);
+  return 0;
+}
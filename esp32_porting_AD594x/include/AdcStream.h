@@ -0,0 +1,88 @@
+/*!
+ *****************************************************************************
+ @file:    AdcStream.h
+ @brief:   Raw ADC sample stream through the data FIFO.
+ -----------------------------------------------------------------------------
+
+ Instead of DFT results, SINC3 or SINC2+notch output goes into the data
+ FIFO at the full filter rate and is sent as RSTREAM_TYPE_ADC frames (see
+ ResultStream.h) for time domain and broadband analysis on the host.
+
+ The sequencer is not used, so all 6kB of SRAM are data FIFO, 1536
+ samples. The FIFO threshold interrupt starts a drain: the FIFO is read
+ in chunks of ADCSTREAM_CHUNK words, each one SPI transfer in the
+ background (AD5940_ReadWriteNBytesStart, DMA on the ESP32). Two transfer
+ buffers alternate, so the samples of one chunk are unpacked while the
+ next one is on the bus. Samples go into a ring of frame sized blocks,
+ frames are sent from it only as fast as the link takes them
+ (AD5940_StreamRoom), so a slow link never stalls the drain.
+
+ Every lost sample is accounted for in Dropped:
+  - FIFO overflow: the FIFO keeps its oldest samples and discards new
+    ones. The samples lost are estimated from the time since the last
+    drain and the nominal sample rate.
+  - Full ring: the block being filled is dropped, counted exactly.
+ A gap closes the block being filled, so the samples of a frame are
+ always consecutive and FirstIndex of the next frame moves past the gap.
+
+ Rates with the 16MHz ADC clock: SINC3 800kHz/OSR, 160 to 400kSPS,
+ SINC2+notch a further OSR of 22 to 1333 lower. One sample is a 32-bit
+ FIFO word, so at 8MHz SPI the FIFO path reaches about 200kSPS; the link
+ to the host is usually slower than that and the ring takes up bursts
+ only. Frame time stamps are derived from the sample index at the
+ nominal rate, they drift with the AFE oscillator.
+
+*****************************************************************************/
+#ifndef _ADC_STREAM_H_
+#define _ADC_STREAM_H_
+#include "ad5940.h"
+#include "ResultStream.h"
+
+#ifndef ADCSTREAM_CHUNK
+#define ADCSTREAM_CHUNK       256     /* FIFO words per SPI transfer */
+#endif
+#ifndef ADCSTREAM_RING_BLOCKS
+#define ADCSTREAM_RING_BLOCKS 32      /* Ring size in frames of RSTREAM_ADC_MAX_SAMPLES samples */
+#endif
+
+typedef struct
+{
+/* Configuration */
+  uint32_t Source;              /* FIFOSRC_SINC3 or FIFOSRC_SINC2NOTCH */
+  uint32_t ADCMuxP;             /* ADCMUXP_xxx */
+  uint32_t ADCMuxN;             /* ADCMUXN_xxx */
+  uint32_t ADCPga;              /* ADCPGA_xxx */
+  uint32_t ADCRate;             /* ADCRATE_800KHZ, or ADCRATE_1P6MHZ with the 32MHz clock */
+  uint32_t ADCSinc3Osr;         /* ADCSINC3OSR_xxx */
+  uint32_t ADCSinc2Osr;         /* ADCSINC2OSR_xxx, FIFOSRC_SINC2NOTCH only */
+  BoolFlag BpNotch;             /* Only SINC2 of the SINC2+notch block */
+  uint32_t FifoThresh;          /* Words in FIFO that start a drain, up to 1023 */
+  uint16_t Channel;             /* Channel of the frames, change it with AppADCStreamChannel() while running */
+  RStreamEnc_Type *pStream;     /* Frames go out through this encoder */
+/* Statistics */
+  uint64_t Samples;             /* Read from FIFO */
+  uint64_t FifoLost;            /* Estimated samples lost to FIFO overflow */
+  uint64_t RingDropped;         /* Samples dropped with a full ring */
+  uint32_t FifoOverflows;
+  uint32_t Frames;              /* Frames sent */
+  uint32_t MaxRingUsed;         /* Most blocks waiting to be sent */
+/* Private variables for internal usage */
+  BoolFlag bRunning;
+  float SampleRate;
+  float Scale;
+  uint64_t StartUs;             /* Time of first sample */
+  uint64_t CntUs;               /* Time FIFO count was read last */
+  uint64_t Index;               /* Index of next sample */
+  uint32_t RingRd;              /* Next block to send */
+  uint32_t RingWr;              /* Block being filled */
+}AppADCStreamCfg_Type;
+
+int32_t   AppADCStreamGetCfg(void *pCfg);
+float     AppADCStreamRate(const AppADCStreamCfg_Type *pCfg);
+AD5940Err AppADCStreamInit(void);
+AD5940Err AppADCStreamStart(void);
+int32_t   AppADCStreamPoll(void);
+void      AppADCStreamChannel(uint16_t Channel);
+void      AppADCStreamStop(void);
+
+#endif
@@ -0,0 +1,40 @@
+/*!
+ *****************************************************************************
+ @file:    AppMain.h
+ @brief:   Measurement loops of AD5940Main.c and AD5941Main.c as start/poll/stop.
+ -----------------------------------------------------------------------------
+
+ AD5940_Main() and AD5941_Main() run the default sweep forever. A scheduler
+ instead boots the board once, then starts a sweep with the number of
+ sweeps it needs and calls the poll function until it reports
+ APPPOLL_DONE or APPPOLL_STOPPED. Each sweep starts from a freshly
+ generated sequence, so a stopped job leaves nothing behind for the next.
+
+*****************************************************************************/
+#ifndef _APP_MAIN_H_
+#define _APP_MAIN_H_
+#include "ad5940.h"
+
+/* Poll results */
+#define APPPOLL_IDLE          0   /* No interrupt from AFE */
+#define APPPOLL_DATA          1   /* Results of one point processed */
+#define APPPOLL_SWEEPEND      2   /* Last point of a sweep processed, next sweep started */
+#define APPPOLL_DONE          3   /* Requested sweeps finished, AFE idle */
+#define APPPOLL_STOPPED       4   /* Stopped on request, AFE idle */
+#define APPPOLL_ERROR         5   /* Start of next sweep failed, AFE idle */
+
+/* AD5940Main.c, impedance measurement */
+void      AD5940_Main(void);
+void      AD5940_ImpBoot(void);
+AD5940Err AD5940_ImpStart(const SoftSweepCfg_Type *pSweepCfg, uint32_t SweepCount);
+int32_t   AD5940_ImpPoll(void);
+void      AD5940_ImpStop(BoolFlag bNow);
+
+/* AD5941Main.c, battery impedance measurement */
+void      AD5941_Main(void);
+void      AD5941_BatBoot(void);
+AD5940Err AD5941_BatStart(const SoftSweepCfg_Type *pSweepCfg, uint32_t SweepCount);
+int32_t   AD5941_BatPoll(void);
+void      AD5941_BatStop(BoolFlag bNow);
+
+#endif
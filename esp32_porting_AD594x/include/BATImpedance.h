@@ -20,6 +20,7 @@ Analog Devices Software License Agreement.
 #include "stdio.h"
 #include "string.h"
 #include "math.h"
+#include "RcalStore.h"
 
 #define PRECHARGE_WAIT_MS   4000    //precharge time in ms.
 
@@ -71,6 +72,7 @@ typedef struct
   float SweepCurrFreq;
   float SweepNextFreq;
   float FreqofData;  
+  uint32_t IndexofData;         /* Sweep index of latest data */
   BoolFlag BATInited;           /* If the program run firstly, generated sequence commands */
   SEQInfo_Type InitSeqInfo;
   SEQInfo_Type MeasureSeqInfo;
@@ -78,8 +80,14 @@ typedef struct
   uint32_t FifoDataCount;       /* Count how many times impedance have been measured */
   uint32_t MeasSeqCycleCount;   /* How long the measurement sequence will take */
   float MaxODR;                 /* Max ODR for sampling in this config */
-  fImpCar_Type RcalVolt;        /* The measured Rcal resistor(R1) response voltage. */
-  float RcalVoltTable[100][2];    
+  fImpCar_Type RcalVolt;        /* The Rcal resistor(R1) response voltage at current frequency. */
+  BoolFlag RcalVoltValid;       /* RcalVolt is known for current frequency. Results are dropped without it */
+/* RCAL reference reuse */
+  uint32_t RcalAnchorStep;      /* Measure RCAL every N sweep points and interpolate the points between. 1 measures every point. */
+  uint32_t RcalMaxAge;          /* Re-measure RCAL after this many sweeps. 0 means never expire by age. */
+  float RcalMaxTempDrift;       /* Re-measure RCAL if temperature moved more than this in degC. 0.0 disables the check. */
+  float TempDegC;               /* Latest temperature reading, NAN if not available. Set it with BATCTRL_SETTEMP */
+  RcalStore_Type RcalStore;     /* RCAL response keyed by frequency. Sized from SweepPoints in AppBATInit */
 /* End */
 }AppBATCfg_Type;
 
@@ -89,6 +97,10 @@ typedef struct
 #define BATCTRL_SHUTDOWN       4   /* Note: shutdown here means turn off everything and put AFE to hibernate mode. The word 'SHUT DOWN' is only used here. */
 #define BATCTRL_MRCAL          5   /* Measure RCAL response voltage */
 #define BATCTRL_GETFREQ				 6
+#define BATCTRL_RCALCHECK      7   /* Measure RCAL again if stored data is stale. pPara(optional): BoolFlag* set to bTRUE when RCAL was measured */
+#define BATCTRL_SETTEMP        8   /* Update temperature used for RCAL drift check. pPara: float* in degC */
+#define BATCTRL_GETSWEEPIDX    9   /* Get sweep index of returned data. pPara: uint32_t* */
+#define BATCTRL_SWEEPRESTART   10  /* Go on with the first point of SweepCfg, e.g. after its frequency list changed. Sequences and RCAL data are kept */
 
 AD5940Err AppBATGetCfg(void *pCfg);
 AD5940Err AppBATInit(uint32_t *pBuffer, uint32_t BufferSize);
@@ -96,5 +108,6 @@ AD5940Err AppBATISR(void *pBuff, uint32_t *pCount);
 AD5940Err AppBATCtrl(int32_t BatCtrl, void *pPara);
 AD5940Err AppBATCheckFreq(float freq);
 AD5940Err AppBATMeasureRCAL(void);
+AD5940Err AppBATSweepRestart(void);
 
 #endif
@@ -0,0 +1,83 @@
+/*!
+ *****************************************************************************
+ @file:    BroadbandImp.h
+ @brief:   Broadband impedance from one periodic excitation and raw ADC samples.
+ -----------------------------------------------------------------------------
+
+ A sine sweep spends most of its time at low frequencies, every point
+ needs a few periods of its own. Here the waveform generator drives a
+ periodic trapezoid, a square wave with sloped edges, of fundamental Freq.
+ It excites all odd harmonics at once, with amplitudes falling as 1/k up
+ to about 1/(pi*edge time) and faster above. The HSTIA current is
+ streamed as raw ADC samples (AdcStream.h), alternately through RCAL and
+ the DUT as Impedance.c does at each frequency, and the host
+ (Host_Tools/eis_bb) takes the FFT of whole periods of each record:
+
+   Z(k*Freq) = RcalVal * I_rcal(k*Freq)/I_dut(k*Freq)
+
+ for every harmonic excited well enough. A spectrum from 1Hz up to the
+ ADC bandwidth takes 2*(SettlePeriods + Periods + 1) seconds instead of
+ minutes of sweep.
+
+ The trapezoid generator updates the DAC at SysClk/50, ADC samples come
+ at SysClk/(20*SINC3 OSR*SINC2 OSR) with the 800kHz ADC rate from the same
+ 16MHz oscillator. Freq is rounded so that a period is a whole number of
+ both, PeriodSamples samples. Samples of both records with equal index
+ modulo PeriodSamples are then at the same phase of the excitation, the
+ host starts its FFT windows at such indices. Switch matrix changes
+ happen while excitation and ADC keep running, the first SettlePeriods of
+ a record are not used. A period has at most 4*0xFFFFF DAC updates, so
+ Freq is at least about 0.08Hz.
+
+ Frames of a record go out with channel BBIMP_CH_RCAL or BBIMP_CH_DUT.
+ Harmonics near and above half the sample rate are attenuated by SINC2
+ and alias onto lower harmonics; they cancel in the ratio only as far as
+ Z is flat, so use SlopeFrac to keep them small.
+
+*****************************************************************************/
+#ifndef _BROADBAND_IMP_H_
+#define _BROADBAND_IMP_H_
+#include "ad5940.h"
+#include "ResultStream.h"
+
+#define BBIMP_CH_RCAL         0xBB00  /* Frame channel of current through RCAL */
+#define BBIMP_CH_DUT          0xBB01  /* Frame channel of current through DUT */
+
+typedef struct
+{
+/* Configuration */
+  float Freq;                   /* Fundamental in Hz, rounded by AppBBInit */
+  float DacVoltPP;              /* Step between the two levels in mV, up to 800 as DacVoltPP of Impedance.h */
+  float SlopeFrac;              /* Time of each edge as fraction of the period, below 0.5 */
+  uint32_t Periods;             /* Periods of a record used by the host */
+  uint32_t SettlePeriods;       /* Periods not used after a switch */
+  uint32_t Cycles;              /* RCAL and DUT record pairs, 0 to run until stopped */
+  float SysClkFreq;
+  float RcalVal;                /* Ohm, for the console only. The host is told with eis_bb -r */
+  uint32_t DswitchSel;
+  uint32_t PswitchSel;
+  uint32_t NswitchSel;
+  uint32_t TswitchSel;
+  uint32_t HstiaRtiaSel;
+  uint32_t ExcitBufGain;
+  uint32_t HsDacGain;
+  uint32_t AdcPgaGain;
+  uint32_t ADCSinc3Osr;
+  uint32_t ADCSinc2Osr;
+  RStreamEnc_Type *pStream;
+/* Statistics */
+  uint32_t CycleCount;          /* Record pairs finished */
+/* Private variables for internal usage */
+  BoolFlag bRunning;
+  uint32_t PeriodSamples;
+  uint32_t Record;              /* Even RCAL, odd DUT */
+  uint64_t RecordEnd;           /* Sample index of the next switch */
+}AppBBCfg_Type;
+
+int32_t   AppBBGetCfg(void *pCfg);
+AD5940Err AppBBInit(void);
+AD5940Err AppBBStart(void);
+int32_t   AppBBPoll(void);
+void      AppBBStop(void);
+
+#endif
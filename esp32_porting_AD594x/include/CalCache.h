@@ -0,0 +1,84 @@
+/*!
+ *****************************************************************************
+ @file:    CalCache.h
+ @brief:   Persisted cache for AD5940 calibration results.
+ -----------------------------------------------------------------------------
+
+ Results of AD5940_ADCPGACal, AD5940_HSDACCal, AD5940_HSRtiaCal and
+ AD5940_LPDACCal are stored by RTIA, gain, frequency band and chip ID.
+ The chip ID is REG_AFECON_CHIPID, the silicon revision, which is the
+ same on every part of a revision. It keeps results of an AD5940 from
+ being used on an AD5941 or another revision, not one board from
+ another: the cache belongs to the MCU it is stored on and the AFE wired
+ to it. Give each AFE its own Name, and erase the stored table when an
+ AFE is replaced by one of the same revision.
+ A cached result is applied straight away, even if it is stale. Stale
+ entries are queued and measured again by CalCacheService() when the
+ application has the AFE idle. The table is kept in NVS on target and in
+ a file on host builds.
+
+*****************************************************************************/
+#ifndef _CAL_CACHE_H_
+#define _CAL_CACHE_H_
+#include "ad5940.h"
+
+#define CALCACHE_MAX_ENTRY    16
+#define CALCACHE_NAME_LEN     16      /* NVS key on target, file name on host */
+
+#define CALTYPE_NONE          0       /* Free slot */
+#define CALTYPE_ADCPGA        1
+#define CALTYPE_HSDAC         2
+#define CALTYPE_HSRTIA        3
+#define CALTYPE_LPDAC         4
+
+typedef struct
+{
+  uint32_t Type;                /* CALTYPE_xxx */
+  uint32_t Rtia;                /* HSTIA RTIA for CALTYPE_HSRTIA, LPDAC selection for CALTYPE_LPDAC */
+  uint32_t Gain;                /* ADC PGA gain, or excitation buffer gain<<4|HSDAC gain */
+  uint32_t Band;                /* Frequency decade for RTIA, ADC clock or power mode for PGA and HSDAC */
+  uint32_t ChipId;              /* Silicon revision, results are never used on another part type or revision */
+  uint32_t Generation;          /* Cache generation when measured */
+  float TempDegC;               /* Temperature when measured, NAN if unknown */
+  BoolFlag bPending;            /* Recalibration queued for CalCacheService */
+  union
+  {
+    uint32_t Reg[2];            /* Calibration register values: gain and offset for PGA, offset for HSDAC */
+    fImpCar_Type Rtia;          /* RTIA impedance in cartesian form */
+    LPDACPara_Type LpDac;
+  }Result;
+  union                         /* Calibration settings, kept to measure the entry again */
+  {
+    ADCPGACal_Type AdcPga;
+    HSDACCal_Type HsDac;
+    HSRTIACal_Type HsRtia;
+    LPDACCal_Type LpDac;
+  }Cfg;
+}CalEntry_Type;
+
+typedef struct
+{
+/* Configuration */
+  char Name[CALCACHE_NAME_LEN]; /* Storage name */
+  uint32_t MaxGeneration;       /* Entries older than this many loads are recalibrated. 0 means never by age */
+  float MaxTempDrift;           /* Allowed temperature change in degC. 0.0 disables temperature check */
+/* Private variables for internal usage */
+  uint32_t ChipId;
+  uint32_t Generation;          /* Incremented each time the cache is loaded */
+  float TempDegC;               /* Current temperature, set by CalCacheSetTemp */
+  BoolFlag bDirty;              /* Changed since last save */
+  CalEntry_Type Entry[CALCACHE_MAX_ENTRY];
+}CalCache_Type;
+
+AD5940Err CalCacheInit(CalCache_Type *pCache, const char *pName);
+AD5940Err CalCacheLoad(CalCache_Type *pCache);
+AD5940Err CalCacheSave(CalCache_Type *pCache);
+void      CalCacheSetTemp(CalCache_Type *pCache, float TempDegC);
+AD5940Err CalCacheADCPGA(CalCache_Type *pCache, ADCPGACal_Type *pCalCfg);
+AD5940Err CalCacheHSDAC(CalCache_Type *pCache, HSDACCal_Type *pCalCfg);
+AD5940Err CalCacheHSRtia(CalCache_Type *pCache, HSRTIACal_Type *pCalCfg, void *pResult);
+AD5940Err CalCacheLPDAC(CalCache_Type *pCache, LPDACCal_Type *pCalCfg, LPDACPara_Type *pResult);
+BoolFlag  CalCachePending(CalCache_Type *pCache);
+BoolFlag  CalCacheService(CalCache_Type *pCache);
+
+#endif
@@ -0,0 +1,82 @@
+/*!
+ *****************************************************************************
+ @file:    GoertzelBank.h
+ @brief:   Complex amplitudes at a set of frequencies from raw samples, one pass.
+ -----------------------------------------------------------------------------
+
+ The hardware DFT gives one bin per measurement. With raw samples (e.g.
+ AdcStream.h) a block of Length samples is fed once through a bank of
+ Goertzel filters, one per frequency, so a multi-tone or broadband
+ excitation is resolved without a sweep step per frequency. Frequencies
+ need not be on the DFT bin grid of Length.
+
+ Per sample and frequency the filter costs one multiply and two adds.
+ Coefficients and filter states are kept as separate arrays over the
+ frequencies (structure of arrays), and the inner loop updates
+ GOERTZEL_LANES neighbouring frequencies at a time from values loaded
+ before any is stored, so host compilers turn it into SIMD operations;
+ on the ESP32 it runs from registers and cache. With HanWinEn the block
+ is weighted by a periodic Hann window over Length, as the DFT engine
+ does with HanWinEn, from a rotating phasor set exactly every
+ GOERTZEL_WIN_SYNC samples.
+
+ Filter states grow with the number of samples and a float Goertzel over
+ thousands of samples loses precision, most at low frequencies. The
+ filters are therefore restarted every GOERTZEL_SUB samples and the
+ partial DFTs summed with a phase rotator per frequency, a few operations
+ per GOERTZEL_SUB samples. Host_Tools/goertzel_bench measures the error
+ against a DFT in double.
+
+ GoertzelResult() gives each frequency as complex amplitude: a cosine of
+ amplitude A and phase p at sample 0 gives A*(cos p + j sin p).
+
+*****************************************************************************/
+#ifndef _GOERTZEL_BANK_H_
+#define _GOERTZEL_BANK_H_
+#include "ad5940.h"
+
+#ifndef GOERTZEL_MAX_BINS
+#define GOERTZEL_MAX_BINS     32      /* Frequencies of a bank, a multiple of GOERTZEL_LANES */
+#endif
+#define GOERTZEL_LANES        4       /* Frequencies updated together */
+#define GOERTZEL_SUB          128     /* Samples between filter restarts */
+#define GOERTZEL_WIN_SYNC     64      /* Samples between exact window values */
+
+typedef struct
+{
+/* Configuration */
+  float SampleRate;             /* Hz */
+  uint32_t Length;              /* Samples of a block */
+  BoolFlag HanWinEn;            /* Hann window over the block */
+  uint32_t Bins;                /* Frequencies added */
+  float Freq[GOERTZEL_MAX_BINS];
+/* Private variables for internal usage */
+  float Coef[GOERTZEL_MAX_BINS];    /* 2cos(w) */
+  float Cos[GOERTZEL_MAX_BINS];     /* cos(w) and sin(w) */
+  float Sin[GOERTZEL_MAX_BINS];
+  float SubRe[GOERTZEL_MAX_BINS];   /* exp(-jw(GOERTZEL_SUB-1)) */
+  float SubIm[GOERTZEL_MAX_BINS];
+  float LastRe[GOERTZEL_MAX_BINS];  /* exp(-jw(n-1)), n samples of the last sub-block */
+  float LastIm[GOERTZEL_MAX_BINS];
+  float StepRe[GOERTZEL_MAX_BINS];  /* exp(-jw GOERTZEL_SUB) */
+  float StepIm[GOERTZEL_MAX_BINS];
+  float RotRe[GOERTZEL_MAX_BINS];   /* exp(-jw m), m first sample of the sub-block */
+  float RotIm[GOERTZEL_MAX_BINS];
+  float AccRe[GOERTZEL_MAX_BINS];   /* DFT of the sub-blocks before */
+  float AccIm[GOERTZEL_MAX_BINS];
+  float S1[GOERTZEL_MAX_BINS];      /* Filter states */
+  float S2[GOERTZEL_MAX_BINS];
+  uint32_t Count;               /* Samples of the block fed so far */
+  float WinRe;                  /* exp(j2pi Count/Length) */
+  float WinIm;
+  float WinStepRe;              /* exp(j2pi/Length) */
+  float WinStepIm;
+}GoertzelBank_Type;
+
+void      GoertzelInit(GoertzelBank_Type *pBank, float SampleRate, uint32_t Length, BoolFlag HanWinEn);
+AD5940Err GoertzelAddBin(GoertzelBank_Type *pBank, float Freq);
+void      GoertzelReset(GoertzelBank_Type *pBank);
+uint32_t  GoertzelFeed(GoertzelBank_Type *pBank, const float *pSample, uint32_t Count);
+AD5940Err GoertzelResult(const GoertzelBank_Type *pBank, fImpCar_Type *pResult);
+
+#endif
@@ -0,0 +1,56 @@
+/*!
+ *****************************************************************************
+ @file:    ImpFixed.h
+ @brief:   Impedance from DFT results in fixed point, without libm.
+ -----------------------------------------------------------------------------
+
+ Integer version of the float computation of AppIMPDataProcess: from the
+ 18-bit DFT results of RCAL and DUT to impedance, and its magnitude and
+ phase. Selected with IMP_FIXED_POINT (see Impedance.h).
+
+ Formats:
+   Impedance      Q23.8 ohm in int32, real and imaginary part
+   Magnitude      Q24.8 ohm in uint32
+   Phase          Q3.28 radian in int32, -pi to pi as atan2
+   RCAL value     Q23.8 ohm, below IMPFIX_RCAL_MAX
+
+ ImpFixZ() computes Z = Rcal*conj(Dftrcal)/conj(Dftrz), the same as the
+ float path does with magnitudes and phase differences, as one complex
+ division in 64-bit integers. The DFT results are exact integers, so the
+ only error is the final rounding: each part is within 0.5 LSB (2 mohm)
+ of the exact quotient with the rounded Rcal. Quotients beyond int32
+ (above 8.3 Mohm, or a DUT result of 0) saturate.
+
+ ImpFixPolar() gets magnitude and phase with a CORDIC in vectoring mode.
+ The vector is first normalized to 28 to 29 bits, so small impedances
+ keep their precision. IMPFIX_CORDIC_ITER iterations, on 32-bit integers
+ only. Error against the exact magnitude and phase of the impedance it
+ is given, checked over 10^6 random inputs by Host_Tools/impfix_check:
+ magnitude within 1 LSB plus 5e-8 of itself, phase within 5e-8 rad
+ (about 13 LSB). That is the resolution of float. For a small impedance
+ the 0.5 LSB rounding of ImpFixZ() dominates instead, e.g. 7e-5 of the
+ magnitude at 40 ohm; the float path is no better there than 2e-7.
+
+*****************************************************************************/
+#ifndef _IMP_FIXED_H_
+#define _IMP_FIXED_H_
+#include "ad5940.h"
+
+#define IMPFIX_ZFRAC          8       /* Fraction bits of impedance and magnitude */
+#define IMPFIX_PHFRAC         28      /* Fraction bits of phase */
+#define IMPFIX_CORDIC_ITER    28
+#define IMPFIX_RCAL_MAX       (1L<<27)  /* Keeps Rcal times a DFT product in int64, 512 kohm */
+#define IMPFIX_OHM            (1.0f/(1L<<IMPFIX_ZFRAC))   /* Float ohm of one LSB */
+#define IMPFIX_RAD            (1.0f/(1L<<IMPFIX_PHFRAC))  /* Float radian of one LSB */
+
+typedef struct
+{
+  uint32_t Magnitude;           /* Q24.8 ohm */
+  int32_t Phase;                /* Q3.28 radian */
+}iImpPol_Type;
+
+int32_t   ImpFixRcal(float RcalVal);
+AD5940Err ImpFixZ(const iImpCar_Type *pDftRcal, const iImpCar_Type *pDftRz, int32_t Rcal, iImpCar_Type *pZ);
+void      ImpFixPolar(const iImpCar_Type *pZ, iImpPol_Type *pPol);
+
+#endif
@@ -18,6 +18,28 @@ Analog Devices Software License Agreement.
 #include <stdio.h>
 #include "string.h"
 #include "math.h"
+#include "PointStat.h"
+#include "ImpFixed.h"
+
+#define IMP_MAX_DUT     8       /* Maximum DUT measurements sharing one RCAL measurement */
+#define IMP_SWCMD_LEN   5       /* Sequencer commands written by AD5940_SWMatrixCfgS */
+
+/* Set to 1 (e.g. -DIMP_FIXED_POINT=1 in build_flags) to compute impedance from DFT results in fixed
+   point without libm calls in the data path, see ImpFixed.h. RcalVal must be below 512 kOhm then */
+#ifndef IMP_FIXED_POINT
+#define IMP_FIXED_POINT 0
+#endif
+#define IMP_SWEEP_TABLE 256     /* Sweep points precomputed with IMP_FIXED_POINT. Longer sweeps use AD5940_SweepNext */
+
+/* Electrode scan order */
+#define IMPSCAN_FREQFIRST   1   /* Measure up to IMP_MAX_DUT channels in sequencer at each frequency */
+#define IMPSCAN_CHANFIRST   2   /* Full sweep on one channel, then move to next channel */
+
+typedef struct
+{
+  SWMatrixCfg_Type SwCfg;                   /* Electrode switch matrix. SWT_TRTIA is added automatically */
+  uint32_t SeqCmd[IMP_SWCMD_LEN];           /* Private: precompiled sequencer commands of SwCfg */
+}AppIMPScanCh_Type;
 
 typedef struct
 {
@@ -26,7 +48,8 @@ typedef struct
   uint32_t SeqStartAddr;        /* Initialaztion sequence start address in SRAM of AD5940  */
   uint32_t MaxSeqLen;           /* Limit the maximum sequence.   */
   uint32_t SeqStartAddrCal;     /* Measurement sequence start address in SRAM of AD5940 */
-  uint32_t SeqWaitAddr[2];     
+  uint32_t SeqWaitAddr[1+IMP_MAX_DUT]; /* Offset of DFT wait commands, RCAL first. Patched by AppIMPCheckFreq */
+  uint32_t SeqWaitNum;
   uint32_t MaxSeqLenCal;
 /* Application related parameters */ 
   float ImpODR;                 /*  */
@@ -40,6 +63,14 @@ typedef struct
   uint32_t PswitchSel;
   uint32_t NswitchSel;
   uint32_t TswitchSel;
+  /* Shared RCAL measurement. Set DutNum to 0 to measure RCAL and the DUT above as a pair. */
+  uint32_t DutNum;              /* Number of DUT measurements per frequency point sharing one RCAL measurement, up to IMP_MAX_DUT */
+  SWMatrixCfg_Type DutSwCfg[IMP_MAX_DUT]; /* Switch matrix for each DUT measurement. SWT_TRTIA is added automatically. Repeat an entry to measure the same DUT again */
+  uint32_t DutSwitchWait;       /* Settling time in system clocks after switch matrix change. Excitation and ADC keep running. */
+  /* Electrode scan. Configured by AppIMPScanCfg(), which fills DutNum and DutSwCfg[] */
+  AppIMPScanCh_Type *pScanCh;   /* Channel list, NULL if scan is not used */
+  uint32_t ScanChNum;
+  uint32_t ScanOrder;           /* IMPSCAN_FREQFIRST or IMPSCAN_CHANFIRST after AppIMPScanCfg() */
   uint32_t PwrMod;              /* Control Chip power mode(LP/HP) */
   uint32_t HstiaRtiaSel;        /* Use internal RTIA, select from RTIA_INT_200, RTIA_INT_1K, RTIA_INT_5K, RTIA_INT_10K, RTIA_INT_20K, RTIA_INT_40K, RTIA_INT_80K, RTIA_INT_160K */
   uint32_t ExcitBufGain;        /* Select from  EXCTBUFGAIN_2, EXCTBUFGAIN_0P25 */     
@@ -57,17 +88,29 @@ typedef struct
   uint8_t ADCAvgNum;
   /* Sweep Function Control */
   SoftSweepCfg_Type SweepCfg;
-  uint32_t FifoThresh;           /* FIFO threshold. Should be N*4 */
+  uint32_t FifoThresh;           /* FIFO threshold. Set by AppIMPInit to the words of one point */
+  /* Repeats. Each point is measured RepeatNum times and returned once, see PointStat.h */
+  uint32_t RepeatNum;           /* Measurements per point, up to POINTSTAT_MAX_REPEAT. 1 measures once */
+  uint32_t RepeatMode;          /* POINTSTAT_MEAN, POINTSTAT_MEDIAN or POINTSTAT_HAMPEL */
+  float HampelK;                /* Outlier threshold of POINTSTAT_HAMPEL in sigmas */
 /* Private variables for internal usage */
 /* Private variables for internal usage */
   float SweepCurrFreq;
   float SweepNextFreq;
   float FreqofData;                         /* The frequency of latest data sampled */
+  uint32_t IndexofData;                     /* Sweep index of latest data sampled */
   BoolFlag IMPInited;                       /* If the program run firstly, generated sequence commands */
   SEQInfo_Type InitSeqInfo;
   SEQInfo_Type MeasureSeqInfo;
   BoolFlag StopRequired;          /* After FIFO is ready, stop the measurement sequence */
   uint32_t FifoDataCount;         /* Count how many times impedance have been measured */
+  uint32_t SeqSwAddr[IMP_MAX_DUT];  /* Offset of switch matrix commands of each DUT measurement */
+  uint32_t ScanGroupNum;          /* Channels are measured in groups of DutNum */
+  uint32_t ScanGroup;             /* Group loaded in sequencer SRAM */
+  uint32_t ScanGroupOfData;       /* Group of latest data */
+  uint32_t ScanPointCount;        /* Points of the current sweep measured with ScanGroup */
+  uint32_t RepeatCount;           /* Measurements of current point processed so far */
+  int32_t RcalFix;                /* RcalVal in Q23.8 with IMP_FIXED_POINT */
 }AppIMPCfg_Type;
 
 #define IMPCTRL_START          0
@@ -75,11 +118,18 @@ typedef struct
 #define IMPCTRL_STOPSYNC       2
 #define IMPCTRL_GETFREQ        3   /* Get Current frequency of returned data from ISR */
 #define IMPCTRL_SHUTDOWN       4   /* Note: shutdown here means turn off everything and put AFE to hibernate mode. The word 'SHUT DOWN' is only used here. */
+#define IMPCTRL_GETCHANNEL     5   /* Get scan channel index of first result returned from ISR */
+#define IMPCTRL_GETSWEEPIDX    6   /* Get sweep index of returned data from ISR */
+#define IMPCTRL_GETSTAT        7   /* Get PointStatResult_Type[IMP_MAX_DUT] of the last point returned from ISR, with RepeatNum > 1.
+                                      Only one point is kept. AppIMPInit sets FifoThresh to one point, so ISR normally returns one;
+                                      if it was called late and read several, earlier points have no statistics */
 
 
 int32_t AppIMPInit(uint32_t *pBuffer, uint32_t BufferSize);
 int32_t AppIMPGetCfg(void *pCfg);
 int32_t AppIMPISR(void *pBuff, uint32_t *pCount);
 int32_t AppIMPCtrl(uint32_t Command, void *pPara);
+AD5940Err AppIMPScanCfg(AppIMPScanCh_Type *pChannel, uint32_t ChannelNum, uint32_t Order);
+AD5940Err AppIMPSweepRestart(void);
 
 #endif
@@ -0,0 +1,55 @@
+/*!
+ *****************************************************************************
+ @file:    LinKK.h
+ @brief:   Linear Kramers-Kronig test of a sweep on target.
+ -----------------------------------------------------------------------------
+
+ Reduced form of Host_Tools/EisKK.h: the sweep is fitted by linear least
+ squares with a series R, L and C and Basis RC elements, tau log spaced
+ over the frequencies of the sweep, and fails when a residual is more
+ than Threshold of |Z|. Sweeps that are not stationary or too noisy fail.
+
+ Work is done in float and the basis is computed while fitting instead of
+ kept per frequency plan, so memory is the LinKK_Type, 12 bytes per point
+ of LINKK_MAX_POINTS, and a triangular matrix of at most
+ (LINKK_MAX_BASIS+3)^2 floats on stack. Rows are rotated into it one by
+ one (Givens QR) rather than solving the normal equations as the host
+ does, these lose too much in float.
+
+*****************************************************************************/
+#ifndef _LIN_KK_H_
+#define _LIN_KK_H_
+#include "ad5940.h"
+
+#ifndef LINKK_MAX_POINTS
+#define LINKK_MAX_POINTS      128     /* Points of a sweep kept for the test, later points are ignored */
+#endif
+#define LINKK_MAX_BASIS       16
+#define LINKK_PER_DECADE      3       /* RC elements per decade of the sweep if Basis is 0 */
+
+typedef struct
+{
+  float MaxRes;                 /* Largest residual of real or imaginary part, relative to |Z| */
+  float RmsRes;
+  uint32_t Points;
+  BoolFlag bPass;               /* Also bTRUE if there were too few points to test */
+}LinKKResult_Type;
+
+typedef struct
+{
+/* Configuration */
+  uint32_t Basis;               /* RC elements, 0 for LINKK_PER_DECADE per decade, at most LINKK_MAX_BASIS */
+  float Threshold;              /* Largest residual relative to |Z| that passes */
+/* Private variables for internal usage */
+  uint32_t Count;
+  float Omega[LINKK_MAX_POINTS];
+  float Real[LINKK_MAX_POINTS];
+  float Image[LINKK_MAX_POINTS];
+}LinKK_Type;
+
+void      LinKKInit(LinKK_Type *pKK);
+AD5940Err LinKKAdd(LinKK_Type *pKK, float Freq, const fImpCar_Type *pZ);
+void      LinKKClear(LinKK_Type *pKK);
+BoolFlag  LinKKRun(LinKK_Type *pKK, LinKKResult_Type *pResult);
+
+#endif
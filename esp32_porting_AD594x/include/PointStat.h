@@ -0,0 +1,63 @@
+/*!
+ *****************************************************************************
+ @file:    PointStat.h
+ @brief:   Robust combination of repeated measurements of one point.
+ -----------------------------------------------------------------------------
+
+ A point measured N times is combined into one value and the variance of
+ the repeats, so a single glitch (interference spike, double interrupt)
+ does not corrupt the point and one point is sent instead of N.
+
+ Mean and variance are updated per repeat with Welford's method, which
+ stays accurate in float where a sum of squares would cancel. The repeats
+ are also kept, up to POINTSTAT_MAX_REPEAT, for the robust modes:
+
+   POINTSTAT_MEAN     Mean of all repeats
+   POINTSTAT_MEDIAN   Median of real and imaginary part separately
+   POINTSTAT_HAMPEL   Hampel filter on the complex plane: a repeat is
+                      rejected if its distance from the median is more
+                      than HampelK sigma, sigma estimated as 0.8493 times
+                      the median of these distances (1/sqrt(2 ln2) for
+                      Gaussian noise on both parts), scaled up for few
+                      repeats so clean ones are rejected at the Gaussian
+                      tail rate, about 1% at HampelK 3. The result is the
+                      mean of the others.
+
+ The variance is the sample variance of real and imaginary part over the
+ repeats the result is made of, all of them for POINTSTAT_MEDIAN. Divide
+ by Used for the variance of the result itself. With fewer than 3
+ repeats nothing is rejected.
+
+*****************************************************************************/
+#ifndef _POINT_STAT_H_
+#define _POINT_STAT_H_
+#include "ad5940.h"
+
+#define POINTSTAT_MAX_REPEAT  16
+
+#define POINTSTAT_MEAN        0
+#define POINTSTAT_MEDIAN      1
+#define POINTSTAT_HAMPEL      2
+
+typedef struct
+{
+/* Private variables for internal usage */
+  uint32_t Count;               /* Repeats added */
+  fImpCar_Type Mean;            /* Welford mean and sum of squared deviations */
+  fImpCar_Type M2;
+  fImpCar_Type Value[POINTSTAT_MAX_REPEAT];
+}PointStat_Type;
+
+typedef struct
+{
+  fImpCar_Type Z;               /* Combined value */
+  fImpCar_Type Var;             /* Sample variance of Real and Image over the repeats used, 0 for one repeat */
+  uint8_t Used;                 /* Repeats the result is made of */
+  uint8_t Rejected;             /* Repeats rejected as outliers */
+}PointStatResult_Type;
+
+void      PointStatClear(PointStat_Type *pStat);
+void      PointStatAdd(PointStat_Type *pStat, const fImpCar_Type *pZ);
+AD5940Err PointStatResult(const PointStat_Type *pStat, uint32_t Mode, float HampelK, PointStatResult_Type *pRes);
+
+#endif
@@ -0,0 +1,87 @@
+/*!
+ *****************************************************************************
+ @file:    RandlesFit.h
+ @brief:   Randles circuit fit of a sweep on target.
+ -----------------------------------------------------------------------------
+
+ Model Rs-p(Rct-W,CPE), in Zfit notation s(R1,p(s(R1,W1),E2)):
+
+   Z = Rs + Zf/(1 + Y Zf),  Zf = Rct + Sigma(1-j)/sqrt(w),  Y = Q(jw)^n
+
+ Points of a sweep are collected with RandlesFitAdd() and fitted with
+ RandlesFitRun() when the sweep ends. RandlesFitSend() fits and sends the
+ result as a RSTREAM_TYPE_FIT record of the result stream. The fit is
+ Levenberg-Marquardt on the analytic Jacobian, in float, with residuals
+ relative to |Z| as EISFIT_WEIGHT_PROP of Host_Tools/EisFit.h. Rs, Rct, Q and Sigma are
+ fitted on a log scale, n on a linear scale in [RANDLES_N_MIN, 1]. The
+ first fit starts from a guess read off the spectrum, later fits of the
+ same channel start from the previous result.
+
+ Nothing is allocated. Memory is the RandlesFit_Type, about 20 bytes per
+ point of RANDLES_MAX_POINTS, and well under 1 kB of stack. Each
+ iteration evaluates the model at every point a few times, up to MaxIter
+ iterations.
+
+*****************************************************************************/
+#ifndef _RANDLES_FIT_H_
+#define _RANDLES_FIT_H_
+#include "ad5940.h"
+#include "ResultStream.h"
+
+#ifndef RANDLES_MAX_POINTS
+#define RANDLES_MAX_POINTS    128     /* Points of a sweep kept for the fit, later points are ignored */
+#endif
+#define RANDLES_MAX_ITER      255     /* Limit of MaxIter, iteration count is sent as 8 bits */
+#define RANDLES_N_MIN         0.4f    /* Lower bound of CPE exponent */
+
+/* Parameter order */
+#define RANDLES_RS            0
+#define RANDLES_RCT           1
+#define RANDLES_Q             2
+#define RANDLES_N             3
+#define RANDLES_SIGMA         4
+#define RANDLES_PARAMS        5
+
+/* Fit status, same values as EISFIT_xxx */
+#define RANDLES_OK            0       /* Converged */
+#define RANDLES_MAXITER       1       /* Stopped at MaxIter, result is best so far */
+#define RANDLES_FAIL          2       /* Too few points or no finite cost */
+
+typedef struct
+{
+  float Param[RANDLES_PARAMS];  /* Rs, Rct, Q, n, Sigma in units of the impedance, e.g. Ohm, 1/Ohm*s^n, Ohm/sqrt(s) */
+  float ResNorm;                /* RMS of residuals relative to |Z| */
+  uint16_t Channel;
+  uint32_t Points;              /* Points used */
+  uint32_t Iter;
+  uint32_t Status;              /* RANDLES_xxx */
+}RandlesResult_Type;
+
+typedef struct
+{
+/* Configuration */
+  uint32_t MaxIter;             /* Iteration limit per sweep, at most RANDLES_MAX_ITER */
+  float Tol;                    /* Stop at this relative decrease of cost */
+  BoolFlag bWarmStart;          /* Start from result of previous sweep of the same channel */
+/* Private variables for internal usage */
+  uint32_t Count;
+  uint16_t Channel;
+  BoolFlag bLastValid;
+  uint16_t LastChannel;
+  float Last[RANDLES_PARAMS];
+  float Omega[RANDLES_MAX_POINTS];
+  float LnOmega[RANDLES_MAX_POINTS];
+  float Real[RANDLES_MAX_POINTS];
+  float Image[RANDLES_MAX_POINTS];
+  float Weight[RANDLES_MAX_POINTS];   /* 1/|Z| */
+}RandlesFit_Type;
+
+void      RandlesFitInit(RandlesFit_Type *pFit);
+AD5940Err RandlesFitAdd(RandlesFit_Type *pFit, uint16_t Channel, float Freq, const fImpCar_Type *pZ);
+void      RandlesFitClear(RandlesFit_Type *pFit);
+uint32_t  RandlesFitRun(RandlesFit_Type *pFit, RandlesResult_Type *pResult);
+void      RandlesFitEval(const float *pParam, float Freq, fImpCar_Type *pZ);
+AD5940Err RandlesFitSend(RandlesFit_Type *pFit, RStreamEnc_Type *pEnc, uint64_t TimeUs, BoolFlag bHostTime,
+                         BoolFlag bKKFail);
+
+#endif
@@ -0,0 +1,49 @@
+/*!
+ *****************************************************************************
+ @file:    RcalStore.h
+ @brief:   Frequency keyed RCAL reference store shared across sweeps.
+ -----------------------------------------------------------------------------
+
+ The store holds the RCAL response voltage measured at a subset of sweep
+ points (anchors). Response at any other frequency is interpolated from the
+ two neighbouring anchors of the same filter band. Stored data is reused by
+ following sweeps until it gets older than MaxAge sweeps or the temperature
+ moved more than MaxTempDrift since it was measured.
+
+*****************************************************************************/
+#ifndef _RCAL_STORE_H_
+#define _RCAL_STORE_H_
+#include "ad5940.h"
+
+typedef struct
+{
+  float Freq;                   /* Anchor frequency in Hz */
+  uint32_t Band;                /* Filter band the anchor was measured in. Never interpolate across bands. */
+  float Magnitude;              /* RCAL response magnitude */
+  float Phase;                  /* RCAL response phase in radian */
+}RcalAnchor_Type;
+
+typedef struct
+{
+/* Configuration */
+  uint32_t MaxAge;              /* Number of sweeps the data stays valid. 0 means never expire by age. */
+  float MaxTempDrift;           /* Allowed temperature change in degC. 0.0 disables temperature check. */
+  BoolFlag bLogInterp;          /* Interpolate on log10(freq) instead of linear frequency */
+/* Private variables for internal usage */
+  RcalAnchor_Type *pAnchor;     /* Anchors sorted by frequency, allocated to hold one entry per sweep point */
+  uint32_t Capacity;
+  uint32_t AnchorCount;
+  uint32_t Age;                 /* Sweeps completed since anchors were measured */
+  float TempDegC;               /* Temperature when anchors were measured. NAN if unknown */
+  BoolFlag bValid;
+}RcalStore_Type;
+
+AD5940Err RcalStoreInit(RcalStore_Type *pStore, uint32_t Capacity);
+void      RcalStoreFree(RcalStore_Type *pStore);
+void      RcalStoreClear(RcalStore_Type *pStore, float TempDegC);
+AD5940Err RcalStoreAdd(RcalStore_Type *pStore, float Freq, uint32_t Band, fImpCar_Type *pVolt);
+AD5940Err RcalStoreLookup(RcalStore_Type *pStore, float Freq, uint32_t Band, fImpCar_Type *pVolt);
+void      RcalStoreSweepDone(RcalStore_Type *pStore);
+BoolFlag  RcalStoreIsStale(RcalStore_Type *pStore, float TempDegC);
+
+#endif
@@ -0,0 +1,198 @@
+/*!
+ *****************************************************************************
+ @file:    ResultStream.h
+ @brief:   Binary framed measurement result stream.
+ -----------------------------------------------------------------------------
+
+ Frame layout, all fields little endian:
+
+   offset  size  field
+   0       2     Sync word RSTREAM_SYNC
+   2       1     Version RSTREAM_VERSION
+   3       1     Record type RSTREAM_TYPE_xxx, ORed with RSTREAM_FLAG_xxx
+   4       2     Sequence number, incremented for every frame
+   6       2     Payload length in bytes
+   8       1     Number of records
+   9       1     Impedance exponent of fixed point records, Z = value*10^exp
+   10      n     Records
+   10+n    2     CRC16-CCITT of bytes 2 to 10+n-1
+
+ Float record (24 bytes): float Freq, uint64 TimeUs, uint16 SweepIndex,
+ uint16 Channel, float Real, float Image.
+ Fixed record (24 bytes): uint32 Freq in mHz, uint64 TimeUs, uint16
+ SweepIndex, uint16 Channel, int32 Real, int32 Image.
+ Stat record (36 bytes): float record followed by float VarReal, float
+ VarImage, uint8 Used, uint8 Rejected, uint16 reserved. It carries a
+ point combined from repeated measurements (see PointStat.h) with the
+ variance of the repeats and how many of them were used and rejected.
+
+ Fit record (40 bytes): uint64 TimeUs, uint16 Channel, uint16 Points,
+ uint8 Model, uint8 Status, uint8 Iter, uint8 ParamCount, float
+ Param[RSTREAM_FIT_PARAMS], float ResNorm. A fit frame carries the model
+ fitted to one sweep instead of its points (see RandlesFit.h), with the
+ time of the last point of the sweep. It shares the sequence numbers of
+ the stream it is sent in.
+
+ ADC frame: a record of 28 bytes, uint64 TimeUs, uint32 FirstIndex,
+ uint32 Dropped, uint16 Channel, uint8 Source, uint8 reserved, float
+ SampleRate, float Scale, followed by int16 samples. The number of records
+ byte holds the sample count. A frame carries consecutive raw ADC samples
+ of a stream (see AdcStream.h), TimeUs is the time of the first one.
+ FirstIndex counts samples since the stream started, so a gap in it shows
+ samples that never reached the host: Dropped of later frames tells how
+ many of them were lost on target, the rest were frames lost on the link.
+
+ RSTREAM_FLAG_KKFAIL is set on the last frame of a sweep, with
+ RSTREAM_FLAG_SWEEPEND, and on its fit frame if the target found the
+ sweep not Kramers-Kronig consistent. Such a sweep is not stationary or
+ too noisy, and its fit should not be trusted.
+
+ TimeUs is the time of the AFE interrupt that delivered the result. It is
+ microseconds of the device monotonic clock, or microseconds since the Unix
+ epoch on the host clock if the frame has RSTREAM_FLAG_HOSTTIME (see
+ TimeSync.h). The decoder also reads version 1 frames, which had 20 byte
+ records with a uint32 TimeMs.
+
+ The same file holds the encoder used on target and the decoder used by
+ host tools.
+
+*****************************************************************************/
+#ifndef _RESULT_STREAM_H_
+#define _RESULT_STREAM_H_
+#include "ad5940.h"
+
+#define RSTREAM_SYNC          0xA55A
+#define RSTREAM_VERSION       2
+#define RSTREAM_HEADER_LEN    10
+#define RSTREAM_CRC_LEN       2
+#define RSTREAM_MAX_FRAME     512     /* Header, records and CRC */
+#define RSTREAM_MAX_RECORDS   255
+
+#define RSTREAM_TYPE_FLOAT    1
+#define RSTREAM_TYPE_FIXED    2
+#define RSTREAM_TYPE_FIT      3       /* Fitted model of a sweep, see RStreamAddFit() */
+#define RSTREAM_TYPE_ADC      4       /* Raw ADC samples, see RStreamAddAdc() */
+#define RSTREAM_TYPE_STAT     5       /* Float records with variance of repeats */
+#define RSTREAM_TYPE_MSK      0x0F
+#define RSTREAM_FLAG_SWEEPEND 0x80    /* Last frame of a sweep */
+#define RSTREAM_FLAG_HOSTTIME 0x40    /* Time stamps are on host clock */
+#define RSTREAM_FLAG_KKFAIL   0x20    /* Sweep failed the Kramers-Kronig test on target, see LinKK.h */
+
+#define RSTREAM_REC_LEN       24
+#define RSTREAM_REC_LEN_V1    20
+#define RSTREAM_STAT_REC_LEN  36
+#define RSTREAM_FIT_REC_LEN   40
+#define RSTREAM_ADC_REC_LEN   28      /* Before the samples */
+#define RSTREAM_ADC_MAX_SAMPLES ((RSTREAM_MAX_FRAME - RSTREAM_HEADER_LEN - RSTREAM_CRC_LEN - RSTREAM_ADC_REC_LEN)/2)
+
+#define RSTREAM_FIT_PARAMS    5
+#define RSTREAM_FIT_RANDLES   1       /* Rs, Rct, Q, n, Sigma of RandlesFit.h */
+
+#define RSTREAM_ADC_SINC3     0       /* Source of ADC samples */
+#define RSTREAM_ADC_SINC2NOTCH 1
+
+typedef struct
+{
+  float Freq;                   /* Hz */
+  uint64_t TimeUs;              /* Time stamp in us */
+  BoolFlag bHostTime;           /* TimeUs is on host clock. Points on different clocks go to different frames */
+  uint16_t SweepIndex;          /* Index of point in sweep */
+  uint16_t Channel;             /* DUT or scan channel */
+  fImpCar_Type Z;               /* Complex impedance */
+  fImpCar_Type Var;             /* Variance of Real and Image over repeats. Sent with RSTREAM_TYPE_STAT only */
+  uint8_t Used;                 /* Repeats Z is made of, 1 for other record types */
+  uint8_t Rejected;             /* Repeats rejected as outliers */
+}RStreamPoint_Type;
+
+typedef struct
+{
+  uint64_t TimeUs;              /* Time stamp in us */
+  BoolFlag bHostTime;           /* TimeUs is on host clock */
+  BoolFlag bKKFail;             /* The sweep failed the Kramers-Kronig test */
+  uint16_t Channel;
+  uint16_t Points;              /* Points of the sweep used by the fit */
+  uint8_t Model;                /* RSTREAM_FIT_xxx */
+  uint8_t Status;               /* Fit status of the model, e.g. RANDLES_xxx */
+  uint8_t Iter;
+  uint8_t ParamCount;
+  float Param[RSTREAM_FIT_PARAMS];
+  float ResNorm;                /* RMS of residuals relative to |Z| */
+}RStreamFit_Type;
+
+typedef struct
+{
+  uint64_t TimeUs;              /* Time stamp of first sample in us */
+  BoolFlag bHostTime;           /* TimeUs is on host clock */
+  uint32_t FirstIndex;          /* Samples since start of stream before the first one */
+  uint32_t Dropped;             /* Samples lost on target since start of stream */
+  uint16_t Channel;
+  uint8_t Source;               /* RSTREAM_ADC_xxx */
+  float SampleRate;             /* Hz */
+  float Scale;                  /* Volt per LSB, ADC input voltage is sample*Scale */
+  uint32_t Count;               /* Samples, at most RSTREAM_ADC_MAX_SAMPLES */
+}RStreamAdc_Type;
+
+typedef void (*RStreamWrite_Func)(const uint8_t *pData, uint32_t Len);
+
+typedef struct
+{
+/* Configuration */
+  uint32_t Type;                /* RSTREAM_TYPE_FLOAT, RSTREAM_TYPE_FIXED or RSTREAM_TYPE_STAT */
+  int32_t ZExp;                 /* Decimal exponent of fixed point impedance, e.g. -3 for milli unit */
+  uint32_t MaxRecords;          /* Send frame when it holds this many records. 0 uses all room in buffer */
+  RStreamWrite_Func pWrite;     /* Output of finished frames */
+/* Private variables for internal usage */
+  uint16_t Seq;
+  uint32_t Count;
+  uint32_t Flags;               /* RSTREAM_FLAG_xxx of frame being built */
+  uint8_t Buff[RSTREAM_MAX_FRAME];
+}RStreamEnc_Type;
+
+typedef struct
+{
+  uint16_t Seq;
+  uint32_t Type;
+  uint32_t Flags;
+  int32_t ZExp;
+  uint32_t Count;
+}RStreamFrameInfo_Type;
+
+typedef void (*RStreamPoint_Func)(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamPoint_Type *pPoint);
+typedef void (*RStreamFit_Func)(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamFit_Type *pFit);
+typedef void (*RStreamAdc_Func)(void *pUser, const RStreamFrameInfo_Type *pInfo, const RStreamAdc_Type *pAdc,
+                                const int16_t *pSample);
+
+typedef struct
+{
+  RStreamPoint_Func pOnPoint;   /* Called for every record of a valid frame */
+  RStreamFit_Func pOnFit;       /* Called for every fit record. Set after RStreamDecInit, NULL skips them */
+  RStreamAdc_Func pOnAdc;       /* Called for every ADC frame. Set after RStreamDecInit, NULL skips them */
+  void *pUser;
+/* Statistics */
+  uint32_t FrameCount;          /* Valid frames */
+  uint32_t CrcErrors;
+  uint32_t SyncLost;            /* Bytes skipped while searching sync word */
+  uint32_t Lost;                /* Frames missing in sequence. Reduced again when a late frame arrives */
+  uint32_t Reordered;           /* Frames that arrived after a later one */
+/* Private variables for internal usage */
+  BoolFlag bSeqValid;
+  uint16_t NextSeq;
+  uint32_t Fill;
+  uint8_t Buff[RSTREAM_MAX_FRAME];
+}RStreamDec_Type;
+
+uint16_t  RStreamCrc16(const uint8_t *pData, uint32_t Len);
+void      RStreamEncInit(RStreamEnc_Type *pEnc, uint32_t Type, int32_t ZExp, RStreamWrite_Func pWrite);
+AD5940Err RStreamAdd(RStreamEnc_Type *pEnc, const RStreamPoint_Type *pPoint);
+uint32_t  RStreamFinish(RStreamEnc_Type *pEnc, const uint8_t **ppFrame);
+void      RStreamFlush(RStreamEnc_Type *pEnc);
+void      RStreamEndSweep(RStreamEnc_Type *pEnc);
+void      RStreamEndSweepFlags(RStreamEnc_Type *pEnc, uint32_t Flags);
+AD5940Err RStreamAddFit(RStreamEnc_Type *pEnc, const RStreamFit_Type *pFit);
+AD5940Err RStreamAddAdc(RStreamEnc_Type *pEnc, const RStreamAdc_Type *pAdc, const int16_t *pSample);
+
+void      RStreamDecInit(RStreamDec_Type *pDec, RStreamPoint_Func pOnPoint, void *pUser);
+void      RStreamDecFeed(RStreamDec_Type *pDec, const uint8_t *pData, uint32_t Len);
+AD5940Err RStreamDecFrame(RStreamDec_Type *pDec, const uint8_t *pFrame, uint32_t Len);
+
+#endif
@@ -0,0 +1,100 @@
+/*!
+ *****************************************************************************
+ @file:    SpecCodec.h
+ @brief:   Compact coding of complete impedance sweeps for uplink.
+ -----------------------------------------------------------------------------
+
+ Frequencies are not sent. A sweep refers to a plan, the SoftSweepCfg_Type
+ start, stop, point count and scale, or its pFreqList, by a 16-bit plan ID.
+ The plan itself is sent only in key frames, a frequency list as Points
+ floats. Magnitude is quantized in log domain with a relative error bound
+ and phase with an absolute error bound. An error bound of 0 keeps the
+ exact float values. Key frames are sent for a new plan or new error
+ bounds and code each point against the previous point. Other frames code
+ each point against the same point of the previous sweep. All differences
+ are zigzag varints.
+
+ Frame layout, little endian:
+   u8  SPEC_MAGIC
+   u8  Flags SPEC_FLAG_xxx
+   u16 Plan ID
+   u16 Sweep sequence number
+   u16 Points
+   f32 Magnitude step in ln(Ohm), 0 for exact values
+   f32 Phase step in rad, 0 for exact values
+   [f32 Start, f32 Stop, u8 Log]   only with SPEC_FLAG_PLAN
+   [f32 Freq[Points]]              instead, with SPEC_FLAG_PLAN|SPEC_FLAG_LIST
+   varint pairs (magnitude, phase) for each point
+
+*****************************************************************************/
+#ifndef _SPEC_CODEC_H_
+#define _SPEC_CODEC_H_
+#include "ad5940.h"
+
+#define SPEC_MAX_POINTS       256
+#define SPEC_MAX_PLANS        8       /* Plans remembered by decoder */
+#define SPEC_MAGIC            0xEC
+#define SPEC_HEADER_LEN       16
+#define SPEC_PLAN_LEN         9
+#define SPEC_FLAG_KEY         0x01    /* Values coded without previous sweep */
+#define SPEC_FLAG_PLAN        0x02    /* Plan definition follows header */
+#define SPEC_FLAG_LIST        0x04    /* Plan definition is a frequency list */
+/* Worst case frame length for a number of points */
+#define SPEC_MAX_FRAME(points)  (SPEC_HEADER_LEN + SPEC_PLAN_LEN + (points)*4 + (points)*2*5)
+
+typedef struct
+{
+  uint16_t PlanId;
+  float Start;
+  float Stop;
+  uint32_t Points;
+  BoolFlag bLog;
+  const float *pFreqList;       /* Points frequencies, NULL for Start/Stop grid. Must stay valid while the plan is used */
+}SpecPlan_Type;
+
+typedef struct
+{
+/* Configuration */
+  float MagRelErr;              /* Max relative magnitude error, e.g. 1e-4. 0 for exact values */
+  float PhaseErr;               /* Max phase error in rad. 0 for exact values */
+  uint32_t KeyInterval;         /* Send a key frame every N sweeps so a receiver can join or recover. 0: only first */
+/* Private variables for internal usage */
+  uint16_t PlanId;
+  uint16_t SweepSeq;
+  uint32_t SinceKey;
+  float MagStep;                /* Steps of the previous sweep. A change needs a key frame */
+  float PhaseStep;
+  BoolFlag bValid;              /* Prev holds a sweep of current plan and steps */
+  int32_t PrevMag[SPEC_MAX_POINTS];
+  int32_t PrevPhase[SPEC_MAX_POINTS];
+}SpecEnc_Type;
+
+typedef struct
+{
+/* Statistics */
+  uint32_t Frames;
+  uint32_t NeedKey;             /* Delta frames dropped because previous sweep is missing */
+/* Private variables for internal usage */
+  SpecPlan_Type Plan[SPEC_MAX_PLANS];
+  float PlanFreq[SPEC_MAX_PLANS][SPEC_MAX_POINTS];  /* Frequency lists of Plan[] */
+  uint32_t PlanCount;
+  uint32_t PlanNext;            /* Plan replaced next when table is full */
+  uint16_t PlanId;
+  uint16_t SweepSeq;
+  float MagStep;
+  float PhaseStep;
+  BoolFlag bValid;
+  int32_t PrevMag[SPEC_MAX_POINTS];
+  int32_t PrevPhase[SPEC_MAX_POINTS];
+}SpecDec_Type;
+
+void      SpecPlanFromSweep(SpecPlan_Type *pPlan, const SoftSweepCfg_Type *pSweepCfg);
+float     SpecPlanFreq(const SpecPlan_Type *pPlan, uint32_t Index);
+void      SpecEncInit(SpecEnc_Type *pEnc, float MagRelErr, float PhaseErr, uint32_t KeyInterval);
+AD5940Err SpecEncode(SpecEnc_Type *pEnc, const SpecPlan_Type *pPlan, const fImpPol_Type *pImp,
+                     uint8_t *pOut, uint32_t MaxLen, uint32_t *pLen);
+void      SpecDecInit(SpecDec_Type *pDec);
+AD5940Err SpecDecode(SpecDec_Type *pDec, const uint8_t *pData, uint32_t Len, float *pFreq,
+                     fImpPol_Type *pImp, uint32_t MaxPoints, uint32_t *pPoints);
+
+#endif
@@ -0,0 +1,64 @@
+/*!
+ *****************************************************************************
+ @file:    StoreFwd.h
+ @brief:   Store-and-forward log for result frames while the network is down.
+ -----------------------------------------------------------------------------
+
+ Frames are appended to a ring of flash sectors, the "sfwd" partition on
+ target and a file of the same layout on host builds. Each entry has a
+ header with a 32-bit sequence number and a CRC. An entry is never
+ rewritten. Once sent, it is marked by clearing bits in its state word,
+ which flash allows without an erase. A sector is erased only when the
+ ring wraps into it, so wear spreads evenly over the partition. After a
+ reset the log is rebuilt by scanning the sectors.
+
+ Replay never sends an entry twice. Before an entry is handed to the send
+ function its state is marked as sending, which persists the last sent
+ sequence number. After a reset every entry up to it counts as sent, even
+ if it was not marked sent yet. The price is that an entry whose send
+ failed is lost if a reset comes before the retry, so check with
+ StoreFwdPeek that the sender can take the next entry before replaying.
+
+*****************************************************************************/
+#ifndef _STORE_FWD_H_
+#define _STORE_FWD_H_
+#include "ad5940.h"
+#include <stdio.h>
+
+#define SFWD_SECTOR_SIZE      4096
+#define SFWD_HOST_SIZE        (64*1024)   /* Size of log file on host builds */
+#define SFWD_NAME_LEN         16          /* Partition label on target, file name on host */
+#define SFWD_MAX_DATA         1024        /* Largest record, one full MQTT payload */
+
+typedef BoolFlag (*StoreFwdSend_Func)(void *pUser, uint32_t Stream, uint32_t Seq, const uint8_t *pData, uint32_t Len);
+
+typedef struct
+{
+  char Name[SFWD_NAME_LEN];
+/* Statistics */
+  uint32_t Stored;              /* Entries appended */
+  uint32_t Replayed;            /* Entries handed to send function */
+  uint32_t Dropped;             /* Unsent entries lost when the ring wrapped */
+/* Private variables for internal usage */
+  uint32_t Size;                /* Log size, multiple of SFWD_SECTOR_SIZE */
+  uint32_t Head;                /* Offset where next entry is written */
+  uint32_t Tail;                /* Offset of oldest unsent entry */
+  uint32_t Pending;             /* Unsent entries. Head equals tail both when empty and when full */
+  uint32_t NextSeq;
+  uint32_t SentSeq;             /* Highest sequence handed to the send function, rebuilt from the sending marks */
+  BoolFlag bOpen;
+#ifdef ESP_PLATFORM
+  const void *pPart;            /* esp_partition_t */
+#else
+  FILE *pFile;
+#endif
+}StoreFwd_Type;
+
+AD5940Err StoreFwdOpen(StoreFwd_Type *pLog, const char *pName);
+void      StoreFwdClose(StoreFwd_Type *pLog);
+AD5940Err StoreFwdAppend(StoreFwd_Type *pLog, uint32_t Stream, const uint8_t *pData, uint32_t Len);
+BoolFlag  StoreFwdEmpty(StoreFwd_Type *pLog);
+AD5940Err StoreFwdPeek(StoreFwd_Type *pLog, uint32_t *pStream);
+uint32_t  StoreFwdReplay(StoreFwd_Type *pLog, StoreFwdSend_Func pSend, void *pUser, uint32_t MaxEntries);
+
+#endif
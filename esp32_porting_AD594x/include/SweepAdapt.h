@@ -0,0 +1,62 @@
+/*!
+ *****************************************************************************
+ @file:    SweepAdapt.h
+ @brief:   Adaptive frequency refinement of a sweep.
+ -----------------------------------------------------------------------------
+
+ A sweep is measured in passes. The first pass is the grid of the
+ SoftSweepCfg_Type, kept coarse. After each pass the measured points are
+ sorted by frequency and every interval between two neighbours is rated:
+
+  - phase change of Z between the two points, against PhaseTol
+  - curvature: distance of a point from the straight line through its
+    neighbours (on log frequency for log sweeps) relative to |Z|, against
+    CurvTol. It rates both intervals next to the point.
+
+ Intervals over tolerance get a point in their middle in the next pass,
+ worst first, until the sweep has MaxPoints points. The sweep ends when
+ no interval is over tolerance, after MaxPasses refinement passes or when
+ the budget is used. Points end up where the spectrum has structure, e.g.
+ arcs and their ends, instead of evenly spaced slow low frequency points.
+
+ Each pass is run as a sweep over a frequency list (SoftSweepCfg_Type
+ pFreqList = PassFreq, SweepPoints = PassCount). Points are reported in
+ the order they are measured, so frequencies of a finished sweep are not
+ sorted; Freq[] and Z[] hold them sorted. Memory is the SweepAdapt_Type,
+ 16 bytes per point of SWEEP_ADAPT_MAX_POINTS, and 4 bytes per point on
+ stack.
+
+*****************************************************************************/
+#ifndef _SWEEP_ADAPT_H_
+#define _SWEEP_ADAPT_H_
+#include "ad5940.h"
+
+#ifndef SWEEP_ADAPT_MAX_POINTS
+#define SWEEP_ADAPT_MAX_POINTS  128     /* Points of a sweep, all passes */
+#endif
+
+typedef struct
+{
+/* Configuration */
+  uint32_t MaxPoints;           /* Point budget of a sweep including the first pass, at most SWEEP_ADAPT_MAX_POINTS */
+  uint32_t MaxPasses;           /* Refinement passes after the first one */
+  float PhaseTol;               /* Largest phase change between neighbours in rad */
+  float CurvTol;                /* Largest distance of a point from the line through its neighbours, relative to |Z| */
+  float MinRatio;               /* Intervals with a frequency ratio below this are not split */
+/* Private variables for internal usage */
+  BoolFlag bLog;                /* Midpoints on log frequency */
+  BoolFlag bDown;               /* Passes run from high to low frequency */
+  uint32_t Pass;                /* 0 for the first pass */
+  uint32_t Count;               /* Points measured so far */
+  float Freq[SWEEP_ADAPT_MAX_POINTS];   /* Measured points, ascending frequency */
+  fImpCar_Type Z[SWEEP_ADAPT_MAX_POINTS];
+  uint32_t PassCount;
+  float PassFreq[SWEEP_ADAPT_MAX_POINTS];   /* Frequencies of current pass in measurement order */
+}SweepAdapt_Type;
+
+void      SweepAdaptInit(SweepAdapt_Type *pAdapt);
+uint32_t  SweepAdaptBegin(SweepAdapt_Type *pAdapt, const SoftSweepCfg_Type *pSweepCfg);
+AD5940Err SweepAdaptAdd(SweepAdapt_Type *pAdapt, float Freq, const fImpCar_Type *pZ);
+uint32_t  SweepAdaptRefine(SweepAdapt_Type *pAdapt);
+
+#endif
@@ -0,0 +1,60 @@
+/*!
+ *****************************************************************************
+ @file:    TimeSync.h
+ @brief:   Map device monotonic microseconds to a host clock.
+ -----------------------------------------------------------------------------
+
+ The host runs a two-way exchange like NTP over any message channel:
+ it sends its time T1, the device answers with its receive and transmit
+ times T2 and T3, and the host notes the receive time T4. The host then
+ hands the four times back to the device. Each exchange gives one offset
+ sample, ((T1-T2)+(T4-T3))/2, with an error of at most half the round trip
+ time (T4-T1)-(T3-T2).
+
+ The device keeps the last TSYNC_MAX_SAMPLES samples and fits
+ host = device + offset + drift*(device - reference) by least squares.
+ Only samples with a round trip close to the shortest one seen are used,
+ because delays over a network are rarely symmetric when they are long.
+
+*****************************************************************************/
+#ifndef _TIME_SYNC_H_
+#define _TIME_SYNC_H_
+#include "ad5940.h"
+
+#define TSYNC_MAX_SAMPLES     16
+#define TSYNC_RTT_MARGIN_US   500     /* Use samples with round trip up to shortest one plus this */
+
+typedef struct
+{
+  uint64_t DevUs;               /* Device time of sample, middle of T2 and T3 */
+  int64_t OffsetUs;             /* Host minus device */
+  uint32_t RttUs;               /* Round trip time */
+}TSyncSample_Type;
+
+typedef struct
+{
+/* Statistics */
+  uint32_t Exchanges;           /* Exchanges added */
+  uint32_t Rejected;            /* Exchanges with inconsistent times */
+/* Clock model, valid if bSynced */
+  BoolFlag bSynced;
+  uint64_t RefUs;               /* Device time the model is centered on */
+  double OffsetUs;              /* Host minus device at RefUs */
+  double DriftPpm;              /* Host clock rate minus device clock rate */
+  uint32_t ErrUs;               /* Half the shortest round trip among fitted samples */
+  uint32_t Used;                /* Samples used in fit */
+/* Private variables for internal usage */
+  TSyncSample_Type Sample[TSYNC_MAX_SAMPLES];
+  uint32_t Count;
+  uint32_t Next;
+}TSync_Type;
+
+/* Clock model of this device, used to stamp results */
+extern TSync_Type AppTimeSync;
+
+void      TSyncInit(TSync_Type *pSync);
+AD5940Err TSyncAddExchange(TSync_Type *pSync, int64_t HostTxUs, uint64_t DevRxUs, uint64_t DevTxUs, int64_t HostRxUs);
+BoolFlag  TSyncToHost(const TSync_Type *pSync, uint64_t DevUs, int64_t *pHostUs);
+BoolFlag  TSyncStamp(uint64_t DevUs, uint64_t *pTimeUs);
+
+#endif
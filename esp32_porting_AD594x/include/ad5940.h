@@ -4709,6 +4709,7 @@ typedef struct
   uint32_t SweepPoints;     /**< How many points from START to STOP frequency */
   BoolFlag SweepLog;        /**< The step is linear or logarithmic. 0: Linear, 1: Logarithmic*/
   uint32_t SweepIndex;      /**< Current position of sweep */
+  const float *pFreqList;   /**< If not NULL, sweep these SweepPoints frequencies in list order. SweepStart, SweepStop and SweepLog are not used then. */
 }SoftSweepCfg_Type;
 
 /**
@@ -4763,6 +4764,9 @@ typedef struct
 void      AD5940_WriteReg(uint16_t RegAddr, uint32_t RegData);
 uint32_t  AD5940_ReadReg(uint16_t RegAddr);
 void      AD5940_FIFORd(uint32_t *pBuffer,uint32_t uiReadCount);
+void      AD5940_SPIBatchStart(void);   /* Collect register writes and send them in groups */
+void      AD5940_SPIBatchEnd(void);
+void      AD5940_SPIBatchFlush(void);
 
 /* 2. AD5940 Top Control functions */
 void      AD5940_Initialize(void); /* Call this function firstly once AD5940 power on or come from soft reset */
@@ -4862,6 +4866,7 @@ uint32_t  AD5940_GetADIID(void);   /* Read ADIID */
 uint32_t  AD5940_GetChipID(void);  /* Read Chip ID */
 AD5940Err AD5940_SoftRst(void);
 void      AD5940_HWReset(void);       /* Do hardware reset to AD5940 using RESET pin */
+AD5940Err AD5940_HWResetPoll(uint32_t TimeOut10us);  /* Hardware reset and wait until AD5940 answers */
 /* Calibration functions */
 /* 8. Calibration */
 AD5940Err AD5940_ADCPGACal(ADCPGACal_Type *ADCPGACal);
@@ -4884,6 +4889,7 @@ AD5940Err AD5940_SEQGenFetchSeq(const uint32_t **ppSeqCmd, uint32_t *pSeqCount);
 void      AD5940_ClksCalculate(ClksCalInfo_Type *pFilterInfo, uint32_t *pClocks);
 uint32_t  AD5940_SEQCycleTime(void);
 void      AD5940_SweepNext(SoftSweepCfg_Type *pSweepCfg, float *pNextFreq);
+float     AD5940_SweepFirstFreq(const SoftSweepCfg_Type *pSweepCfg);
 void      AD5940_StructInit(void *pStruct, uint32_t StructSize);
 float     AD5940_ADCCode2Volt(uint32_t code, uint32_t ADCPga, float VRef1p82); /* Calculate ADC code to voltage */
 BoolFlag  AD5940_Notch50HzAvailable(ADCFilterCfg_Type *pFilterInfo, uint8_t *dl);
@@ -4917,6 +4923,13 @@ void      AD5940_MCUGpioWrite(uint32_t data);   /*  */
 uint32_t  AD5940_MCUGpioRead(uint32_t);
 void      AD5940_MCUGpioCtrl(uint32_t, BoolFlag);
 void      AD5940_ReadWriteNBytes(unsigned char *pSendBuffer,unsigned char *pRecvBuff,unsigned long length);
+void      AD5940_WriteNFrames(unsigned char *pSendBuffer, const uint16_t *pFrameLen, uint32_t FrameCount); /* Write frames back to back, each framed by CS */
+uint64_t  AD5940_GetTimeUs(void);   /* Free running microsecond time, 0 if not available */
+uint64_t  AD5940_GetMCUIntTimeUs(void);  /* Time of last MCU interrupt, captured in ISR */
+void      AD5940_StreamWrite(const uint8_t *pData, uint32_t Len);  /* Send binary result data to host, unmodified */
+uint32_t  AD5940_StreamRoom(void);  /* Bytes AD5940_StreamWrite takes without blocking, 0xFFFFFFFF if unknown */
+void      AD5940_ReadWriteNBytesStart(unsigned char *pSendBuffer, unsigned char *pRecvBuff, unsigned long length); /* Start transfer, CPU is free until AD5940_ReadWriteNBytesWait */
+void      AD5940_ReadWriteNBytesWait(void);
 /* Below functions are frequently used in example code but not necessary for library */
 uint32_t  AD5940_GetMCUIntFlag(void);
 uint32_t  AD5940_ClrMCUIntFlag(void);
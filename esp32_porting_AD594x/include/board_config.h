@@ -13,6 +13,14 @@ typedef struct {
     void (*Delay10us)(uint32_t time);
     void (*ReadWriteNBytes)(unsigned char *pSendBuffer, unsigned char *pRecvBuff, unsigned long length);
     uint32_t (*MCUResourceInit)(void *pCfg);
+    /* Optional, leave NULL if the port does not provide them */
+    void (*WriteNFrames)(unsigned char *pSendBuffer, const uint16_t *pFrameLen, uint32_t FrameCount);
+    uint64_t (*GetTimeUs)(void);
+    uint64_t (*GetIntTimeUs)(void);     /* Time captured in ISR when MCU interrupt flag was set */
+    void (*StreamWrite)(const uint8_t *pData, uint32_t Len);
+    uint32_t (*StreamRoom)(void);       /* Bytes StreamWrite takes now without blocking */
+    void (*ReadWriteNBytesStart)(unsigned char *pSendBuffer, unsigned char *pRecvBuff, unsigned long length);  /* Transfer in background, e.g. by DMA */
+    void (*ReadWriteNBytesWait)(void);  /* Wait for transfer of ReadWriteNBytesStart */
 } board_interface_t;
 
 extern board_interface_t ad5940_interface;
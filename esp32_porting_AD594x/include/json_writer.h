@@ -0,0 +1,65 @@
+/*
+Allocation-free JSON writer and tokenizer
+
+The writer formats compact JSON straight into a caller buffer, such as one of
+MQTT_JSON_BUFFER_SIZE bytes. Output that does not fit sets an error flag
+instead of being cut silently.
+The tokenizer splits an incoming message into tokens that point into the
+original data, so commands are read without copying or heap allocation.
+*/
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define JSON_MAX_DEPTH          8       // Nesting levels supported by the writer
+#define JSON_MAX_TOKENS         32      // Tokens per incoming command
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    bool error;                         // Buffer too small or bad nesting
+    uint8_t depth;
+    bool has_item[JSON_MAX_DEPTH];      // Current container already has an item, next needs a comma
+} json_writer_t;
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size);
+void json_object_begin(json_writer_t *w, const char *key);
+void json_object_end(json_writer_t *w);
+void json_array_begin(json_writer_t *w, const char *key);
+void json_array_end(json_writer_t *w);
+void json_add_string(json_writer_t *w, const char *key, const char *value);
+void json_add_int(json_writer_t *w, const char *key, int64_t value);
+void json_add_uint(json_writer_t *w, const char *key, uint64_t value);
+void json_add_double(json_writer_t *w, const char *key, double value);
+void json_add_bool(json_writer_t *w, const char *key, bool value);
+void json_add_null(json_writer_t *w, const char *key);
+int  json_writer_finish(json_writer_t *w);
+
+typedef enum {
+    JSON_TOK_OBJECT = 1,
+    JSON_TOK_ARRAY,
+    JSON_TOK_STRING,                    // start/end exclude the quotes, escapes are not decoded
+    JSON_TOK_PRIMITIVE                  // Number, true, false or null
+} json_tok_type_t;
+
+typedef struct {
+    json_tok_type_t type;
+    uint16_t start;                     // Offset of first character in input
+    uint16_t end;                       // Offset after last character
+    uint16_t size;                      // Direct children: members of object, items of array
+    int16_t parent;                     // Index of parent token, -1 for root
+} json_token_t;
+
+int  json_tokenize(const char *json, size_t len, json_token_t *tokens, int max_tokens);
+int  json_object_get(const char *json, const json_token_t *tokens, int count, int object, const char *key);
+bool json_token_equals(const char *json, const json_token_t *tok, const char *str);
+int  json_token_string(const char *json, const json_token_t *tok, char *out, size_t out_size);
+bool json_token_int(const char *json, const json_token_t *tok, int64_t *value);
+bool json_token_double(const char *json, const json_token_t *tok, double *value);
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,63 @@
+/*
+Measurement job scheduler
+
+Sweep jobs are queued with a board, a sweep configuration, a repeat count
+and a priority. The scheduler task runs the highest priority job first,
+jobs of equal priority in the order they were submitted, and starts the
+next job as soon as one ends. A job of higher priority preempts the
+running one: the running job stops after its current point (STOPSYNC)
+and goes back to the queue with the sweeps it still has to do. The
+interrupted sweep is measured again from the start.
+
+Progress is reported through a callback on the scheduler task when a job
+starts, after each sweep and when it ends.
+*/
+
+#ifndef MEAS_SCHEDULER_H
+#define MEAS_SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "ad5940.h"
+#include "board_config.h"
+
+#define MEAS_SCHED_MAX_JOBS     8       // Queued jobs, not counting the running one
+#define MEAS_JOB_ID_LEN         32
+#define MEAS_STOP_TIMEOUT_MS    5000    // Stop at once if the current point does not finish in time
+
+typedef enum {
+    MEAS_JOB_QUEUED = 0,
+    MEAS_JOB_RUNNING,
+    MEAS_JOB_DONE,
+    MEAS_JOB_STOPPED,                   // Removed by meas_sched_stop
+    MEAS_JOB_PREEMPTED,                 // Back in queue for a job of higher priority
+    MEAS_JOB_FAILED
+} meas_job_state_t;
+
+typedef struct {
+    char id[MEAS_JOB_ID_LEN];
+    board_type_t board;
+    bool default_sweep;                 // Use board defaults from AD594xMain.c instead of sweep
+    SoftSweepCfg_Type sweep;            // SweepEn = bFALSE measures at SweepStart only
+    uint32_t repeat;                    // Sweeps to run, 0 runs until stopped
+    int32_t priority;                   // Higher runs first
+    // Filled in by scheduler
+    meas_job_state_t state;
+    uint32_t sweeps_done;
+    uint32_t points_done;               // Points of current sweep
+    uint32_t order;                     // Submission order
+} meas_job_t;
+
+// Called on scheduler task, must not call meas_sched_run
+typedef void (*meas_progress_cb_t)(const meas_job_t *job, void *user);
+
+void meas_sched_init(meas_progress_cb_t cb, void *user);
+esp_err_t meas_sched_submit(const meas_job_t *job);
+esp_err_t meas_sched_stop(const char *id);
+uint32_t meas_sched_queued(void);
+bool meas_sched_current(meas_job_t *job);
+bool meas_sched_board_busy(board_type_t board);
+void meas_sched_run(void);
+
+#endif // MEAS_SCHEDULER_H
@@ -52,10 +52,12 @@ This software is proprietary to Analog Devices, Inc. and its licensors.
 #define MQTT_TOPIC_CMD_BOARD_SELECT    "eis/device/%s/cmd/board_select"
 #define MQTT_TOPIC_CMD_MEASUREMENT     "eis/device/%s/cmd/measurement_start"
 #define MQTT_TOPIC_CMD_STOP            "eis/device/%s/cmd/measurement_stop"
+#define MQTT_TOPIC_CMD_TIME_SYNC       "eis/device/%s/cmd/time_sync"
 
 // Response Topics (ESP32 → Server) 
 #define MQTT_TOPIC_RESP_BOARD_SELECT   "eis/device/%s/status/board_selection"
 #define MQTT_TOPIC_RESP_MEASUREMENT    "eis/device/%s/status/measurement"
+#define MQTT_TOPIC_RESP_TIME_SYNC      "eis/device/%s/status/time_sync"
 
 // Data Topics (ESP32 → Server)
 #define MQTT_TOPIC_DATA_AD5940         "eis/device/%s/data/ad5940"
@@ -69,7 +71,12 @@ This software is proprietary to Analog Devices, Inc. and its licensors.
 // Message Publishing Intervals
 #define MQTT_HEARTBEAT_INTERVAL_MS     30000        // 30 seconds
 #define MQTT_STATUS_UPDATE_INTERVAL_MS 60000        // 60 seconds
-#define MQTT_DATA_PUBLISH_IMMEDIATE    true         // Publish measurement data immediately
+#define MQTT_DATA_PUBLISH_IMMEDIATE    false        // Publish measurement data immediately, one message per frame
+#define MQTT_DATA_BATCH_TIMEOUT_MS     1000         // Publish batched data that waited this long
+#define MQTT_DATA_MAX_INFLIGHT         8            // QoS1 data messages waiting for PUBACK
+#define MQTT_DATA_ACK_TIMEOUT_MS       30000        // Give up waiting for PUBACK after this time
+#define MQTT_STORE_PARTITION           "sfwd"       // Flash partition for data kept while offline
+#define MQTT_STORE_REPLAY_PER_POLL     2            // Stored payloads published per publisher poll (100 ms)
 
 // Buffer Sizes
 #define MQTT_TOPIC_BUFFER_SIZE         128          // Topic string buffer
@@ -94,8 +101,10 @@ typedef struct {
     char cmd_board_select[MQTT_MAX_TOPIC_LENGTH];
     char cmd_measurement[MQTT_MAX_TOPIC_LENGTH]; 
     char cmd_stop[MQTT_MAX_TOPIC_LENGTH];
+    char cmd_time_sync[MQTT_MAX_TOPIC_LENGTH];
     char resp_board_select[MQTT_MAX_TOPIC_LENGTH];
     char resp_measurement[MQTT_MAX_TOPIC_LENGTH];
+    char resp_time_sync[MQTT_MAX_TOPIC_LENGTH];
     char data_ad5940[MQTT_MAX_TOPIC_LENGTH];
     char data_ad5941[MQTT_MAX_TOPIC_LENGTH];
     char system_status[MQTT_MAX_TOPIC_LENGTH];
@@ -0,0 +1,81 @@
+/*
+Batched MQTT publisher for measurement data
+
+Result stream frames (see ResultStream.h) are packed back to back into one
+MQTT payload of at most MQTT_MAX_PAYLOAD_SIZE bytes. The payload is published
+when the next frame does not fit, when the oldest frame has waited
+MQTT_DATA_BATCH_TIMEOUT_MS, or when a frame marks the end of a sweep.
+QoS1 messages are tracked until the broker acknowledges them. The
+acknowledgement arrives in the MQTT task while it holds the client's lock,
+so mqtt_pub_on_ack only queues the msg_id; mqtt_pub_poll matches it.
+
+With a StoreFwd log attached, batches that cannot be published while the
+client is offline are written to flash as whole payloads. They are replayed
+in order and rate limited once the connection is back. New data goes to the
+log as well until it is empty, so the broker sees everything in order.
+A disconnect only sets a flag from the MQTT event handler; mqtt_pub_poll
+moves what is buffered to the log, so flash is only touched by the caller
+of mqtt_pub_poll and the event handler never takes the publisher lock.
+*/
+
+#ifndef MQTT_PUBLISHER_H
+#define MQTT_PUBLISHER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "mqtt_client.h"
+#include "mqtt_config.h"
+#include "StoreFwd.h"
+
+#define MQTT_PUB_MAX_PUBLISHERS 4       // Publisher index is the stream ID in the log
+
+// In-flight message record, kept until PUBACK
+typedef struct {
+    int msg_id;                 // 0 if slot is free
+    uint16_t first_seq;         // Result stream sequence numbers carried by the message
+    uint16_t last_seq;
+    uint32_t sent_ms;
+} mqtt_pub_inflight_t;
+
+typedef struct {
+    uint32_t messages;          // Messages handed to MQTT client
+    uint32_t frames;            // Result stream frames published
+    uint32_t bytes;             // Payload bytes published
+    uint32_t acked;             // Messages acknowledged by broker
+    uint32_t ack_timeouts;      // Messages never acknowledged within MQTT_DATA_ACK_TIMEOUT_MS
+    uint32_t dropped_frames;    // Frames lost because buffer was full while offline
+    uint32_t stored;            // Payloads written to store-and-forward log
+    uint32_t replayed;          // Payloads published from the log
+    uint32_t publish_errors;    // esp_mqtt_client_publish failures
+} mqtt_pub_stats_t;
+
+typedef struct {
+    esp_mqtt_client_handle_t client;
+    const char *topic;
+    int qos;
+    uint32_t stream;            // Index in publisher table
+    uint8_t payload[MQTT_MAX_PAYLOAD_SIZE];
+    uint32_t len;
+    uint32_t frame_count;
+    uint16_t first_seq;
+    uint16_t last_seq;
+    uint32_t first_ms;          // Time the oldest frame in payload was added
+    uint32_t offline_seen;      // Disconnects already handled by mqtt_pub_poll
+    mqtt_pub_inflight_t inflight[MQTT_DATA_MAX_INFLIGHT];
+    mqtt_pub_stats_t stats;
+} mqtt_publisher_t;
+
+void mqtt_pub_init(mqtt_publisher_t *pub, esp_mqtt_client_handle_t client, const char *topic, int qos);
+void mqtt_pub_write(mqtt_publisher_t *pub, const uint8_t *frame, uint32_t len);
+void mqtt_pub_flush(mqtt_publisher_t *pub);
+void mqtt_pub_poll(mqtt_publisher_t *pub);
+void mqtt_pub_on_ack(int msg_id);
+void mqtt_pub_get_stats(mqtt_publisher_t *pub, mqtt_pub_stats_t *stats);
+void mqtt_pub_set_store(StoreFwd_Type *store);
+void mqtt_pub_set_online(bool online);
+uint32_t mqtt_pub_replay(uint32_t max_payloads);
+
+#endif // MQTT_PUBLISHER_H
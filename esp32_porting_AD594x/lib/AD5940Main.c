@@ -13,6 +13,14 @@ Analog Devices Software License Agreement.
  
 *****************************************************************************/
 #include "Impedance.h"
+#include "ResultStream.h"
+#include "RandlesFit.h"
+#include "LinKK.h"
+#include "SweepAdapt.h"
+#include "AdcStream.h"
+#include "BroadbandImp.h"
+#include "AppMain.h"
+#include "TimeSync.h"
 
 /**
    User could configure following parameters
@@ -21,19 +29,191 @@ Analog Devices Software License Agreement.
 #define APPBUFF_SIZE 512
 uint32_t AppBuff[APPBUFF_SIZE];
 
+/* Set to 1 to send results as binary frames (see ResultStream.h) instead of text */
+#ifndef APP_RESULT_BINARY
+#define APP_RESULT_BINARY   0
+#endif
+
+/* With binary results, fit a Randles circuit to every sweep (see RandlesFit.h) and send
+   it as a fit record. 1 sends points and fit, 2 sends only the fit of sweeps.
+   With several channels per point, the first one is fitted */
+#ifndef APP_RESULT_FIT
+#define APP_RESULT_FIT      0
+#endif
+
+/* With binary results, run the Lin-KK test on every sweep (see LinKK.h). A sweep that
+   fails is sent with RSTREAM_FLAG_KKFAIL on its last frame and fit record */
+#ifndef APP_SWEEP_KK
+#define APP_SWEEP_KK        0
+#endif
+
+/* Refine sweeps where the spectrum changes fast (see SweepAdapt.h). SweepPoints is the first,
+   coarse pass, points are added up to this many per sweep. 0 measures the configured grid.
+   Refinement follows the first channel, scans of several channel groups are not refined */
+#ifndef APP_SWEEP_ADAPT
+#define APP_SWEEP_ADAPT     0
+#endif
+
+/* Measure every point this many times and return one point combined from the repeats, with
+   their variance (see PointStat.h). Binary results are then sent as RSTREAM_TYPE_STAT records.
+   0 or 1 measures each point once. APP_SWEEP_REPEAT_MODE is POINTSTAT_MEAN, POINTSTAT_MEDIAN
+   or POINTSTAT_HAMPEL */
+#ifndef APP_SWEEP_REPEAT
+#define APP_SWEEP_REPEAT    0
+#endif
+#ifndef APP_SWEEP_REPEAT_MODE
+#define APP_SWEEP_REPEAT_MODE POINTSTAT_HAMPEL
+#endif
+
+/* Stream raw ADC samples instead of measuring impedance (see AdcStream.h), needs APP_RESULT_BINARY.
+   1 streams SINC3 output, 2 SINC2+notch output */
+#ifndef APP_ADC_STREAM
+#define APP_ADC_STREAM      0
+#endif
+
+#if APP_ADC_STREAM && !APP_RESULT_BINARY
+#error "APP_ADC_STREAM needs APP_RESULT_BINARY"
+#endif
+
+/* Measure broadband spectra with a trapezoid excitation instead of sweeps (see BroadbandImp.h),
+   needs APP_RESULT_BINARY. The value is the fundamental in Hz, switches and gains are the ones
+   of the sweep. Host_Tools/eis_bb computes the spectra */
+#ifndef APP_BROADBAND
+#define APP_BROADBAND       0
+#endif
+
+#if APP_BROADBAND && !APP_RESULT_BINARY
+#error "APP_BROADBAND needs APP_RESULT_BINARY"
+#endif
+
+#if APP_RESULT_BINARY
+RStreamEnc_Type AppIMPStream;
+#if APP_RESULT_FIT
+RandlesFit_Type AppIMPFit;
+#endif
+#if APP_SWEEP_KK
+LinKK_Type AppIMPKK;
+#endif
+#endif
+
+#if APP_SWEEP_ADAPT
+SweepAdapt_Type AppIMPAdapt;
+static SoftSweepCfg_Type AppIMPSweepUser;   /* Sweep as configured, SweepCfg holds the current pass */
+#endif
+static BoolFlag AppIMPAdaptOn = bFALSE;     /* Current sweep is refined */
+static BoolFlag AppIMPAdaptMore = bFALSE;   /* Another pass follows the current one */
+
+/* Device time of the AFE interrupt that delivered current results */
+static uint64_t AppIMPIntTimeUs;
+
+#if APP_RESULT_BINARY && APP_SWEEP_ADAPT
+/* Points of all passes in frequency order for the sweep test and fit */
+static void AD5940ImpAdaptFeed(uint32_t Channel)
+{
+  uint32_t i;
+#if APP_SWEEP_KK
+  LinKKClear(&AppIMPKK);
+  for(i=0; i<AppIMPAdapt.Count; i++)
+    LinKKAdd(&AppIMPKK, AppIMPAdapt.Freq[i], &AppIMPAdapt.Z[i]);
+#endif
+#if APP_RESULT_FIT
+  RandlesFitClear(&AppIMPFit);
+  for(i=0; i<AppIMPAdapt.Count; i++)
+    RandlesFitAdd(&AppIMPFit, Channel, AppIMPAdapt.Freq[i], &AppIMPAdapt.Z[i]);
+#endif
+  (void)i;
+}
+#endif
+
 /* It's your choice here how to do with the data. Here is just an example to print them to UART */
 int32_t ImpedanceShowResult(uint32_t *pData, uint32_t DataCount)
 {
   float freq;
+  uint32_t channel;
+#if APP_SWEEP_REPEAT > 1
+  PointStatResult_Type stat[IMP_MAX_DUT];
+  AppIMPCtrl(IMPCTRL_GETSTAT, stat);
+#endif
 
   fImpPol_Type *pImp = (fImpPol_Type*)pData;
   AppIMPCtrl(IMPCTRL_GETFREQ, &freq);
+  AppIMPCtrl(IMPCTRL_GETCHANNEL, &channel);
 
+#if APP_RESULT_BINARY
+  {
+    AppIMPCfg_Type *pImpedanceCfg;
+    RStreamPoint_Type point;
+    uint32_t index;
+    AppIMPGetCfg(&pImpedanceCfg);
+    AppIMPCtrl(IMPCTRL_GETSWEEPIDX, &index);
+    point.Freq = freq;
+    point.bHostTime = TSyncStamp(AppIMPIntTimeUs, &point.TimeUs);
+    point.SweepIndex = (uint16_t)index;
+#if APP_SWEEP_ADAPT
+    if(AppIMPAdaptOn == bTRUE)
+      point.SweepIndex = (uint16_t)(AppIMPAdapt.Count - 1);   /* Order of measurement over all passes */
+#endif
+    for(uint32_t i=0;i<DataCount;i++)
+    {
+      point.Channel = (uint16_t)(channel + i);
+      point.Z.Real = pImp[i].Magnitude*cosf(pImp[i].Phase);
+      point.Z.Image = pImp[i].Magnitude*sinf(pImp[i].Phase);
+#if APP_SWEEP_REPEAT > 1
+      point.Var = stat[i].Var;
+      point.Used = stat[i].Used;
+      point.Rejected = stat[i].Rejected;
+#endif
+#if APP_SWEEP_KK
+      if(pImpedanceCfg->SweepCfg.SweepEn == bTRUE && i == 0)
+        LinKKAdd(&AppIMPKK, freq, &point.Z);
+#endif
+#if APP_RESULT_FIT
+      if(pImpedanceCfg->SweepCfg.SweepEn == bTRUE && i == 0)
+      {
+        RandlesFitAdd(&AppIMPFit, point.Channel, freq, &point.Z);
+        if(APP_RESULT_FIT == 2)
+          continue;
+      }
+#endif
+      RStreamAdd(&AppIMPStream, &point);
+    }
+    /* One frame per frequency point, so a lost frame costs one point */
+    if(pImpedanceCfg->SweepCfg.SweepEn == bFALSE ||
+       (index == pImpedanceCfg->SweepCfg.SweepPoints - 1 && AppIMPAdaptMore == bFALSE))
+    {
+      uint32_t sweep_flags = 0;
+#if APP_SWEEP_ADAPT
+      if(AppIMPAdaptOn == bTRUE)
+        AD5940ImpAdaptFeed(channel);
+#endif
+#if APP_SWEEP_KK
+      LinKKResult_Type kk;
+      if(pImpedanceCfg->SweepCfg.SweepEn == bTRUE && LinKKRun(&AppIMPKK, &kk) == bFALSE)
+        sweep_flags = RSTREAM_FLAG_KKFAIL;
+#endif
+      RStreamEndSweepFlags(&AppIMPStream, sweep_flags);
+#if APP_RESULT_FIT
+      if(pImpedanceCfg->SweepCfg.SweepEn == bTRUE)
+        RandlesFitSend(&AppIMPFit, &AppIMPStream, point.TimeUs, point.bHostTime, sweep_flags ? bTRUE : bFALSE);
+#endif
+    }
+    else
+      RStreamFlush(&AppIMPStream);
+    return 0;
+  }
+#endif
   printf("Freq:%.2f ", freq);
   /*Process data*/
-  for(int i=0;i<DataCount;i++)
+  for(uint32_t i=0;i<DataCount;i++)
   {
+    if(DataCount > 1)
+      printf("CH%d ", (int)(channel + i));
+#if APP_SWEEP_REPEAT > 1
+    printf("RzMag: %f Ohm , RzPhase: %f , RzStd: %f Ohm , Used: %d , Rejected: %d \n",pImp[i].Magnitude,
+           pImp[i].Phase*180/MATH_PI,sqrtf(stat[i].Var.Real+stat[i].Var.Image),stat[i].Used,stat[i].Rejected);
+#else
     printf("RzMag: %f Ohm , RzPhase: %f \n",pImp[i].Magnitude,pImp[i].Phase*180/MATH_PI);
+#endif
   }
   return 0;
 }
@@ -44,8 +224,13 @@ static int32_t AD5940PlatformCfg(void)
   FIFOCfg_Type fifo_cfg;
   AGPIOCfg_Type gpio_cfg;
 
-  /* Use hardware reset */
-  AD5940_HWReset();
+  uint64_t boot_start = AD5940_GetTimeUs();   /* Reported as boot to ready time, 0 without a port timer */
+
+  /* Use hardware reset. Poll until AD5940 answers rather than waiting a fixed time. */
+  if(AD5940_HWResetPoll(500) != AD5940ERR_OK)
+    printf("AD5940 does not leave reset\n");
+  /* Initialization table and platform configuration are sent as batched register writes */
+  AD5940_SPIBatchStart();
   AD5940_Initialize();
   /* Platform configuration */
   /* Step1. Configure clock */
@@ -59,18 +244,15 @@ static int32_t AD5940PlatformCfg(void)
   clk_cfg.LFOSCEn = bTRUE;
   AD5940_CLKCfg(&clk_cfg);
   /* Step2. Configure FIFO and Sequencer*/
-  fifo_cfg.FIFOEn = bFALSE;
+  fifo_cfg.FIFOEn = bTRUE;                                /* AD5940_FIFOCfg disables FIFO before applying new settings */
   fifo_cfg.FIFOMode = FIFOMODE_FIFO;
   fifo_cfg.FIFOSize = FIFOSIZE_4KB;                       /* 4kB for FIFO, The reset 2kB for sequencer */
   fifo_cfg.FIFOSrc = FIFOSRC_DFT;
   fifo_cfg.FIFOThresh = 4;//AppIMPCfg.FifoThresh;        /* DFT result. One pair for RCAL, another for Rz. One DFT result have real part and imaginary part */
   AD5940_FIFOCfg(&fifo_cfg);
-  fifo_cfg.FIFOEn = bTRUE;
-  AD5940_FIFOCfg(&fifo_cfg);
   
   /* Step3. Interrupt controller */
   AD5940_INTCCfg(AFEINTC_1, AFEINTSRC_ALLINT, bTRUE);   /* Enable all interrupt in INTC1, so we can check INTC flags */
-  AD5940_INTCClrFlag(AFEINTSRC_ALLINT);
   AD5940_INTCCfg(AFEINTC_0, AFEINTSRC_DATAFIFOTHRESH, bTRUE); 
   AD5940_INTCClrFlag(AFEINTSRC_ALLINT);
   /* Step4: Reconfigure GPIO */
@@ -81,6 +263,8 @@ static int32_t AD5940PlatformCfg(void)
   gpio_cfg.PullEnSet = 0;
   AD5940_AGPIOCfg(&gpio_cfg);
   AD5940_SleepKeyCtrlS(SLPKEY_UNLOCK);  /* Allow AFE to enter sleep mode. */
+  AD5940_SPIBatchEnd();
+  printf("AFE boot to ready: %lu us\n", (unsigned long)(AD5940_GetTimeUs() - boot_start));
   return 0;
 }
 
@@ -103,6 +287,11 @@ void AD5940ImpedanceStructInit(void)
 	pImpedanceCfg->PswitchSel = SWP_RE0;
 	pImpedanceCfg->NswitchSel = SWN_SE0;
 	pImpedanceCfg->TswitchSel = SWT_SE0LOAD;
+	/* To measure several electrodes against one RCAL measurement per frequency, list their
+	   switch settings in DutSwCfg[] and set DutNum. Excitation keeps running between them. */
+	pImpedanceCfg->DutNum = 0;
+	/* For an electrode array, fill an AppIMPScanCh_Type list and call AppIMPScanCfg(list, num, IMPSCAN_FREQFIRST)
+	   after this function. It sets DutNum and walks through all channels without re-initialization. */
 	/* The dummy sensor is as low as 5kOhm. We need to make sure RTIA is small enough that HSTIA won't be saturated. */
 	pImpedanceCfg->HstiaRtiaSel = HSTIARTIA_5K;	
 	
@@ -118,26 +307,289 @@ void AD5940ImpedanceStructInit(void)
 	pImpedanceCfg->ADCSinc3Osr = ADCSINC3OSR_2;		/* Sample rate is 800kSPS/2 = 400kSPS */
   pImpedanceCfg->DftNum = DFTNUM_16384;
   pImpedanceCfg->DftSrc = DFTSRC_SINC3;
+  /* Repeats of each point against interference spikes */
+  pImpedanceCfg->RepeatNum = APP_SWEEP_REPEAT > 1 ? APP_SWEEP_REPEAT : 1;
+  pImpedanceCfg->RepeatMode = APP_SWEEP_REPEAT_MODE;
 }
 
-void AD5940_Main(void)
+static uint32_t AppIMPSweepsLeft;   /* Sweeps still to run including current one, 0 to run until stopped */
+static BoolFlag AppIMPRunning = bFALSE;
+
+#if APP_SWEEP_ADAPT
+/* Keep the first result of a point for refinement, plan the next pass when a pass is done */
+static void AD5940ImpAdaptPoint(const fImpPol_Type *pImp, uint32_t Index)
 {
-  uint32_t temp;  
+  AppIMPCfg_Type *pImpedanceCfg;
+  fImpCar_Type z;
+  float freq;
+
+  AppIMPAdaptMore = bFALSE;
+  if(AppIMPAdaptOn == bFALSE)
+    return;
+  AppIMPGetCfg(&pImpedanceCfg);
+  AppIMPCtrl(IMPCTRL_GETFREQ, &freq);
+  z.Real = pImp->Magnitude*cosf(pImp->Phase);
+  z.Image = pImp->Magnitude*sinf(pImp->Phase);
+  SweepAdaptAdd(&AppIMPAdapt, freq, &z);
+  if(Index == pImpedanceCfg->SweepCfg.SweepPoints - 1 && SweepAdaptRefine(&AppIMPAdapt) > 0)
+    AppIMPAdaptMore = bTRUE;
+}
+#endif
+
+/* Start the pass again from its first point. Sequences are only generated when needed,
+   otherwise the ones in SRAM are restarted and the scan group loaded last is kept */
+static AD5940Err AD5940ImpPassStart(void)
+{
+  AppIMPCfg_Type *pImpedanceCfg;
+  AD5940Err error;
+
+  AppIMPGetCfg(&pImpedanceCfg);
+  pImpedanceCfg->SweepCfg.SweepIndex = 0;
+  pImpedanceCfg->NumOfData = pImpedanceCfg->SweepCfg.SweepEn ? pImpedanceCfg->SweepCfg.SweepPoints : 1;  /* AFE stops after one sweep */
+  if(pImpedanceCfg->IMPInited == bFALSE || pImpedanceCfg->bParaChanged == bTRUE)
+    error = AppIMPInit(AppBuff, APPBUFF_SIZE);
+  else
+    error = AppIMPSweepRestart();
+  if(error != AD5940ERR_OK)
+    return error;
+  return AppIMPCtrl(IMPCTRL_START, 0);
+}
+
+/* Start a sweep, with its first pass if it is refined */
+static AD5940Err AD5940ImpSweepStart(void)
+{
+#if APP_SWEEP_ADAPT
+  AppIMPCfg_Type *pImpedanceCfg;
+
+  AppIMPGetCfg(&pImpedanceCfg);
+  pImpedanceCfg->SweepCfg = AppIMPSweepUser;
+  AppIMPAdaptOn = bFALSE;
+  AppIMPAdaptMore = bFALSE;
+  if((pImpedanceCfg->pScanCh == 0 || pImpedanceCfg->ScanGroupNum <= 1) && SweepAdaptBegin(&AppIMPAdapt, &AppIMPSweepUser) > 0)
+  {
+    pImpedanceCfg->SweepCfg.SweepPoints = AppIMPAdapt.PassCount;
+    pImpedanceCfg->SweepCfg.pFreqList = AppIMPAdapt.PassFreq;
+    AppIMPAdaptOn = bTRUE;
+  }
+#endif
+  return AD5940ImpPassStart();
+}
+
+/* Platform and application defaults, call once after AD5940_MCUResourceInit */
+void AD5940_ImpBoot(void)
+{
+  AppIMPCfg_Type *pImpedanceCfg;
+
   AD5940PlatformCfg();
   AD5940ImpedanceStructInit();
-  
-  AppIMPInit(AppBuff, APPBUFF_SIZE);    /* Initialize IMP application. Provide a buffer, which is used to store sequencer commands */
-  AppIMPCtrl(IMPCTRL_START, 0);          /* Control IMP measurement to start. Second parameter has no meaning with this command. */
- 
+  AppIMPGetCfg(&pImpedanceCfg);
+  pImpedanceCfg->bParaChanged = bTRUE;  /* Sequences in SRAM are lost after a reset */
+#if APP_RESULT_BINARY
+  RStreamEncInit(&AppIMPStream, APP_SWEEP_REPEAT > 1 ? RSTREAM_TYPE_STAT : RSTREAM_TYPE_FLOAT, 0, AD5940_StreamWrite);
+#if APP_RESULT_FIT
+  RandlesFitInit(&AppIMPFit);
+#endif
+#if APP_SWEEP_KK
+  LinKKInit(&AppIMPKK);
+#endif
+#endif
+#if APP_SWEEP_ADAPT
+  SweepAdaptInit(&AppIMPAdapt);
+  AppIMPAdapt.MaxPoints = APP_SWEEP_ADAPT;
+#endif
+}
+
+/**
+ * @brief Start measurement.
+ * @param pSweepCfg: Sweep to run, NULL keeps current settings. With SweepEn set to bFALSE, SweepStart is the frequency.
+ * @param SweepCount: Number of sweeps, 0 to run until AD5940_ImpStop.
+*/
+AD5940Err AD5940_ImpStart(const SoftSweepCfg_Type *pSweepCfg, uint32_t SweepCount)
+{
+  AppIMPCfg_Type *pImpedanceCfg;
+  AD5940Err error;
+
+  AppIMPGetCfg(&pImpedanceCfg);
+  if(pSweepCfg)
+  {
+    pImpedanceCfg->SweepCfg = *pSweepCfg;
+    if(pSweepCfg->SweepEn == bFALSE)
+      pImpedanceCfg->SinFreq = pSweepCfg->SweepStart;
+  }
+#if APP_SWEEP_ADAPT
+  if(pImpedanceCfg->SweepCfg.pFreqList != AppIMPAdapt.PassFreq)
+    AppIMPSweepUser = pImpedanceCfg->SweepCfg;    /* Not a pass of an earlier sweep */
+#endif
+  AppIMPSweepsLeft = SweepCount;
+#if APP_RESULT_BINARY && APP_RESULT_FIT
+  RandlesFitClear(&AppIMPFit);      /* Points of a sweep stopped right away */
+#endif
+#if APP_RESULT_BINARY && APP_SWEEP_KK
+  LinKKClear(&AppIMPKK);
+#endif
+  error = AD5940ImpSweepStart();
+  AppIMPRunning = (error == AD5940ERR_OK) ? bTRUE : bFALSE;
+  return error;
+}
+
+/**
+ * @brief Process AFE interrupt if there is one. Call this in a loop.
+ * @return APPPOLL_xxx
+*/
+int32_t AD5940_ImpPoll(void)
+{
+  AppIMPCfg_Type *pImpedanceCfg;
+  uint32_t temp, index;
+
+  if(AppIMPRunning == bFALSE || AD5940_GetMCUIntFlag() == 0)
+    return APPPOLL_IDLE;
+  AppIMPIntTimeUs = AD5940_GetMCUIntTimeUs();
+  AD5940_ClrMCUIntFlag();
+  temp = APPBUFF_SIZE;
+  AppIMPISR(AppBuff, &temp);
+  if(temp == 0)
+    return APPPOLL_IDLE;
+  AppIMPGetCfg(&pImpedanceCfg);
+  AppIMPCtrl(IMPCTRL_GETSWEEPIDX, &index);
+#if APP_SWEEP_ADAPT
+  AD5940ImpAdaptPoint((fImpPol_Type*)AppBuff, index);
+#endif
+  ImpedanceShowResult(AppBuff, temp);
+  if(pImpedanceCfg->StopRequired == bTRUE)
+  {
+    AppIMPRunning = bFALSE;
+#if APP_RESULT_BINARY
+    RStreamEndSweep(&AppIMPStream);   /* Send partial sweep */
+#if APP_RESULT_FIT
+    RandlesFitClear(&AppIMPFit);      /* but don't fit it */
+#endif
+#if APP_SWEEP_KK
+    LinKKClear(&AppIMPKK);
+#endif
+#endif
+    return APPPOLL_STOPPED;
+  }
+  if(pImpedanceCfg->SweepCfg.SweepEn == bTRUE && index != pImpedanceCfg->SweepCfg.SweepPoints - 1)
+    return APPPOLL_DATA;
+#if APP_SWEEP_ADAPT
+  if(AppIMPAdaptMore == bTRUE)
+  {
+    pImpedanceCfg->SweepCfg.SweepPoints = AppIMPAdapt.PassCount;
+    if(AD5940ImpPassStart() != AD5940ERR_OK)
+    {
+      AppIMPRunning = bFALSE;
+      return APPPOLL_ERROR;
+    }
+    return APPPOLL_DATA;
+  }
+#endif
+  if(AppIMPSweepsLeft == 1)
+  {
+    AppIMPRunning = bFALSE;
+    return APPPOLL_DONE;
+  }
+  if(AppIMPSweepsLeft)
+    AppIMPSweepsLeft--;
+  if(AD5940ImpSweepStart() != AD5940ERR_OK)
+  {
+    AppIMPRunning = bFALSE;
+    return APPPOLL_ERROR;
+  }
+  return APPPOLL_SWEEPEND;
+}
+
+/**
+ * @brief Stop measurement. With bNow set to bFALSE, the point being measured finishes and
+ *        AD5940_ImpPoll reports APPPOLL_STOPPED. Otherwise the AFE is stopped right away.
+*/
+void AD5940_ImpStop(BoolFlag bNow)
+{
+  if(AppIMPRunning == bFALSE)
+    return;
+  if(bNow)
+  {
+    AppIMPCtrl(IMPCTRL_STOPNOW, 0);
+    AppIMPRunning = bFALSE;
+  }
+  else
+    AppIMPCtrl(IMPCTRL_STOPSYNC, 0);
+}
+
+#if APP_ADC_STREAM
+/* Stream until reset, with statistics every 10s */
+static void AD5940AdcStreamRun(void)
+{
+  AppADCStreamCfg_Type *pStreamCfg;
+  uint64_t report_us = AD5940_GetTimeUs();
+
+  AppADCStreamGetCfg(&pStreamCfg);
+  pStreamCfg->pStream = &AppIMPStream;
+  if(APP_ADC_STREAM == 2)
+    pStreamCfg->Source = FIFOSRC_SINC2NOTCH;
+  if(AppADCStreamInit() != AD5940ERR_OK || AppADCStreamStart() != AD5940ERR_OK)
+  {
+    printf("ADC stream start failed\n");
+    return;
+  }
+  printf("ADC stream: %.0f samples/s\n", pStreamCfg->SampleRate);
   while(1)
   {
-    if(AD5940_GetMCUIntFlag())
+    AppADCStreamPoll();
+    if(AD5940_GetTimeUs() - report_us >= 10000000)
     {
-      AD5940_ClrMCUIntFlag();
-      temp = APPBUFF_SIZE;
-      AppIMPISR(AppBuff, &temp);
-      ImpedanceShowResult(AppBuff, temp);
+      report_us += 10000000;
+      printf("ADC stream: %llu samples, %lu frames, %lu FIFO overflows, %llu lost, %llu dropped, ring %lu of %u\n",
+             (unsigned long long)pStreamCfg->Samples, (unsigned long)pStreamCfg->Frames,
+             (unsigned long)pStreamCfg->FifoOverflows, (unsigned long long)pStreamCfg->FifoLost,
+             (unsigned long long)pStreamCfg->RingDropped, (unsigned long)pStreamCfg->MaxRingUsed, ADCSTREAM_RING_BLOCKS);
     }
   }
 }
+#endif
+
+#if APP_BROADBAND
+/* Broadband spectra until reset */
+static void AD5940BroadbandRun(void)
+{
+  AppIMPCfg_Type *pImpedanceCfg;
+  AppBBCfg_Type *pBBCfg;
+
+  AppIMPGetCfg(&pImpedanceCfg);
+  AppBBGetCfg(&pBBCfg);
+  pBBCfg->Freq = APP_BROADBAND;
+  pBBCfg->RcalVal = pImpedanceCfg->RcalVal;
+  pBBCfg->DswitchSel = pImpedanceCfg->DswitchSel;
+  pBBCfg->PswitchSel = pImpedanceCfg->PswitchSel;
+  pBBCfg->NswitchSel = pImpedanceCfg->NswitchSel;
+  pBBCfg->TswitchSel = pImpedanceCfg->TswitchSel;
+  pBBCfg->HstiaRtiaSel = pImpedanceCfg->HstiaRtiaSel;
+  pBBCfg->AdcPgaGain = pImpedanceCfg->AdcPgaGain;
+  pBBCfg->pStream = &AppIMPStream;
+  if(AppBBInit() != AD5940ERR_OK || AppBBStart() != AD5940ERR_OK)
+  {
+    printf("Broadband start failed\n");
+    return;
+  }
+  printf("Broadband: %.4f Hz, %lu samples per period, RCAL %.1f Ohm\n", pBBCfg->Freq,
+         (unsigned long)pBBCfg->PeriodSamples, pBBCfg->RcalVal);
+  while(1)
+  {
+    if(AppBBPoll() == APPPOLL_SWEEPEND)
+      printf("Broadband: spectrum %lu\n", (unsigned long)pBBCfg->CycleCount);
+  }
+}
+#endif
 
+void AD5940_Main(void)
+{
+  AD5940_ImpBoot();
+#if APP_ADC_STREAM
+  AD5940AdcStreamRun();
+#endif
+#if APP_BROADBAND
+  AD5940BroadbandRun();
+#endif
+  AD5940_ImpStart(NULL, 0);   /* Run configured sweep until reset */
+  while(1)
+    AD5940_ImpPoll();
+}
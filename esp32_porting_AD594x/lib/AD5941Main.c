@@ -21,9 +21,85 @@ Analog Devices Software License Agreement.
 #include "string.h"
 #include "math.h"
 #include "BATImpedance.h"
+#include "CalCache.h"
+#include "ResultStream.h"
+#include "RandlesFit.h"
+#include "LinKK.h"
+#include "SweepAdapt.h"
+#include "AppMain.h"
+#include "TimeSync.h"
 
 #define APPBUFF_SIZE 512
 uint32_t AppBATBuff[APPBUFF_SIZE];
+CalCache_Type AppBATCalCache;
+
+/* Set to 1 to send results as binary frames (see ResultStream.h) instead of text */
+#ifndef APP_RESULT_BINARY
+#define APP_RESULT_BINARY   0
+#endif
+
+/* With binary results, fit a Randles circuit to every sweep (see RandlesFit.h) and send
+   it as a fit record. 1 sends points and fit, 2 sends only the fit of sweeps */
+#ifndef APP_RESULT_FIT
+#define APP_RESULT_FIT      0
+#endif
+
+/* With binary results, run the Lin-KK test on every sweep (see LinKK.h). A sweep that
+   fails is sent with RSTREAM_FLAG_KKFAIL on its last frame and fit record */
+#ifndef APP_SWEEP_KK
+#define APP_SWEEP_KK        0
+#endif
+
+/* Refine sweeps where the spectrum changes fast (see SweepAdapt.h). SweepPoints is the first,
+   coarse pass, points are added up to this many per sweep. 0 measures the configured grid.
+   RCAL is measured on the first pass only; every pass counts as a sweep for RcalMaxAge */
+#ifndef APP_SWEEP_ADAPT
+#define APP_SWEEP_ADAPT     0
+#endif
+
+#if APP_RESULT_BINARY
+RStreamEnc_Type AppBATStream;
+#if APP_RESULT_FIT
+RandlesFit_Type AppBATFit;
+#endif
+#if APP_SWEEP_KK
+LinKK_Type AppBATKK;
+#endif
+#endif
+
+#if APP_SWEEP_ADAPT
+SweepAdapt_Type AppBATAdapt;
+static SoftSweepCfg_Type AppBATSweepUser;   /* Sweep as configured, SweepCfg holds the current pass */
+#endif
+static BoolFlag AppBATAdaptOn = bFALSE;     /* Current sweep is refined */
+static BoolFlag AppBATAdaptMore = bFALSE;   /* Another pass follows the current one */
+
+/* Device time of the AFE interrupt that delivered current results */
+static uint64_t AppBATIntTimeUs;
+
+#if APP_RESULT_BINARY && APP_SWEEP_ADAPT
+/* Points of all passes in frequency order for the sweep test and fit */
+static void AD5941BatAdaptFeed(void)
+{
+  uint32_t i;
+#if APP_SWEEP_KK
+  LinKKClear(&AppBATKK);
+  for(i=0; i<AppBATAdapt.Count; i++)
+    LinKKAdd(&AppBATKK, AppBATAdapt.Freq[i], &AppBATAdapt.Z[i]);
+#endif
+#if APP_RESULT_FIT
+  RandlesFitClear(&AppBATFit);
+  for(i=0; i<AppBATAdapt.Count; i++)
+    RandlesFitAdd(&AppBATFit, 0, AppBATAdapt.Freq[i], &AppBATAdapt.Z[i]);
+#endif
+  (void)i;
+}
+#endif
+
+/* Wait after each point before the next one is triggered */
+#ifndef APP_BAT_POINT_DELAY_10US
+#define APP_BAT_POINT_DELAY_10US  100000
+#endif
 
 /* It's your choice here how to do with the data. Here is just an example to print them to UART */
 int32_t BATShowResult(uint32_t *pData, uint32_t DataCount)
@@ -31,8 +107,63 @@ int32_t BATShowResult(uint32_t *pData, uint32_t DataCount)
   fImpCar_Type *pImp = (fImpCar_Type*)pData;
 	float freq;
 	AppBATCtrl(BATCTRL_GETFREQ, &freq);
+#if APP_RESULT_BINARY
+  {
+    AppBATCfg_Type *pBATCfg;
+    RStreamPoint_Type point;
+    uint32_t index;
+    AppBATGetCfg(&pBATCfg);
+    AppBATCtrl(BATCTRL_GETSWEEPIDX, &index);
+    point.Freq = freq;
+    point.bHostTime = TSyncStamp(AppBATIntTimeUs, &point.TimeUs);
+    point.SweepIndex = (uint16_t)index;
+#if APP_SWEEP_ADAPT
+    if(AppBATAdaptOn == bTRUE)
+      point.SweepIndex = (uint16_t)(AppBATAdapt.Count - 1);   /* Order of measurement over all passes */
+#endif
+    point.Channel = 0;
+    for(uint32_t i=0;i<DataCount;i++)
+    {
+      point.Z = pImp[i];
+#if APP_SWEEP_KK
+      if(pBATCfg->SweepCfg.SweepEn == bTRUE && i == 0)
+        LinKKAdd(&AppBATKK, freq, &point.Z);
+#endif
+#if APP_RESULT_FIT
+      if(pBATCfg->SweepCfg.SweepEn == bTRUE && i == 0)
+      {
+        RandlesFitAdd(&AppBATFit, point.Channel, freq, &point.Z);
+        if(APP_RESULT_FIT == 2)
+          continue;
+      }
+#endif
+      RStreamAdd(&AppBATStream, &point);
+    }
+    /* Points are packed into frames, send what is left when the sweep ends */
+    if(pBATCfg->SweepCfg.SweepEn == bFALSE ||
+       (index == pBATCfg->SweepCfg.SweepPoints - 1 && AppBATAdaptMore == bFALSE))
+    {
+      uint32_t sweep_flags = 0;
+#if APP_SWEEP_ADAPT
+      if(AppBATAdaptOn == bTRUE)
+        AD5941BatAdaptFeed();
+#endif
+#if APP_SWEEP_KK
+      LinKKResult_Type kk;
+      if(pBATCfg->SweepCfg.SweepEn == bTRUE && LinKKRun(&AppBATKK, &kk) == bFALSE)
+        sweep_flags = RSTREAM_FLAG_KKFAIL;
+#endif
+      RStreamEndSweepFlags(&AppBATStream, sweep_flags);
+#if APP_RESULT_FIT
+      if(pBATCfg->SweepCfg.SweepEn == bTRUE)
+        RandlesFitSend(&AppBATFit, &AppBATStream, point.TimeUs, point.bHostTime, sweep_flags ? bTRUE : bFALSE);
+#endif
+    }
+    return 0;
+  }
+#endif
   /*Process data*/
-  for(int i=0;i<DataCount;i++)
+  for(uint32_t i=0;i<DataCount;i++)
   {
     printf("Freq: %f (real, image) = ,%f , %f ,mOhm \n",freq, pImp[i].Real,pImp[i].Image);
   }
@@ -45,9 +176,13 @@ static int32_t AD5940PlatformCfg(void)
   CLKCfg_Type clk_cfg;
   FIFOCfg_Type fifo_cfg;
   AGPIOCfg_Type gpio_cfg;
-  /* Use hardware reset */
-  AD5940_HWReset();
-  /* Platform configuration */
+  uint64_t boot_start = AD5940_GetTimeUs();   /* Reported as boot to ready time, 0 without a port timer */
+
+  /* Use hardware reset. Poll until AD5940 answers rather than waiting a fixed time. */
+  if(AD5940_HWResetPoll(500) != AD5940ERR_OK)
+    printf("AD5941 does not leave reset\n");
+  /* Platform configuration. Initialization table and platform settings are sent as batched register writes */
+  AD5940_SPIBatchStart();
   AD5940_Initialize();
   /* Step1. Configure clock */
   clk_cfg.ADCClkDiv = ADCCLKDIV_1;
@@ -60,14 +195,12 @@ static int32_t AD5940PlatformCfg(void)
   clk_cfg.LFOSCEn = bTRUE;
   AD5940_CLKCfg(&clk_cfg);
   /* Step2. Configure FIFO and Sequencer*/
-  fifo_cfg.FIFOEn = bFALSE;
+  fifo_cfg.FIFOEn = bTRUE;                                /* AD5940_FIFOCfg disables FIFO before applying new settings */
   fifo_cfg.FIFOMode = FIFOMODE_FIFO;
   fifo_cfg.FIFOSize = FIFOSIZE_4KB;                       /* 4kB for FIFO, The reset 2kB for sequencer */
   fifo_cfg.FIFOSrc = FIFOSRC_DFT;
   fifo_cfg.FIFOThresh = 4;//AppBATCfg.FifoThresh;        /* DFT result. One pair for RCAL, another for Rz. One DFT result have real part and imaginary part */
-  AD5940_FIFOCfg(&fifo_cfg);                             /* Disable to reset FIFO. */
-  fifo_cfg.FIFOEn = bTRUE;  
-  AD5940_FIFOCfg(&fifo_cfg);                             /* Enable FIFO here */
+  AD5940_FIFOCfg(&fifo_cfg);
   
   /* Step3. Interrupt controller */
   AD5940_INTCCfg(AFEINTC_1, AFEINTSRC_ALLINT, bTRUE);           /* Enable all interrupt in Interrupt Controller 1, so we can check INTC flags */
@@ -81,6 +214,8 @@ static int32_t AD5940PlatformCfg(void)
   gpio_cfg.PullEnSet = 0;
   AD5940_AGPIOCfg(&gpio_cfg);
   AD5940_SleepKeyCtrlS(SLPKEY_UNLOCK);  /* Allow AFE to enter sleep mode. */
+  AD5940_SPIBatchEnd();
+  printf("AFE boot to ready: %lu us\n", (unsigned long)(AD5940_GetTimeUs() - boot_start));
   return 0;
 }
 
@@ -104,32 +239,298 @@ void AD5940BATStructInit(void)
 	pBATCfg->SweepCfg.SweepStop = 50000.0f;	/* Finish sweep at 1000Hz */
 	pBATCfg->SweepCfg.SweepPoints = 50;			/* 100 frequencies in the sweep */
 	pBATCfg->SweepCfg.SweepLog = bTRUE;			/* Set to bTRUE to use LOG scale. Set bFALSE to use linear scale */
+
+	pBATCfg->RcalAnchorStep = 4;						/* Measure RCAL on every 4th point, interpolate the others */
+	pBATCfg->RcalMaxAge = 10;								/* Reuse RCAL data for 10 sweeps before measuring it again */
+	pBATCfg->RcalMaxTempDrift = 2.0f;				/* Or earlier if temperature changes more than 2degC (see BATCTRL_SETTEMP) */
 	
 }
 
-void AD5941_Main(void)
+/* Calibrate ADC PGA and HSDAC used by battery measurement. Results from last boot are applied
+   right away, stale ones are measured again later by CalCacheService. */
+static void AD5940BATCalibrate(void)
+{
+  ADCPGACal_Type pga_cal;
+  HSDACCal_Type dac_cal;
+
+  CalCacheInit(&AppBATCalCache, "bat");
+  CalCacheLoad(&AppBATCalCache);  /* Fails on first boot, cache starts empty */
+
+  pga_cal.AdcClkFreq = 16e6;
+  pga_cal.SysClkFreq = 16e6;
+  pga_cal.ADCSinc3Osr = ADCSINC3OSR_4;
+  pga_cal.ADCSinc2Osr = ADCSINC2OSR_22;
+  pga_cal.VRef1p11 = 1.11f;
+  pga_cal.VRef1p82 = 1.82f;
+  pga_cal.ADCPga = ADCPGA_1P5;
+  pga_cal.PGACalType = PGACALTYPE_OFFSETGAIN;
+  pga_cal.TimeOut10us = 1000;
+  if(CalCacheADCPGA(&AppBATCalCache, &pga_cal) != AD5940ERR_OK)
+    printf("ADC PGA calibration failed\n");
+
+  dac_cal.fRcal = 50.0f;
+  dac_cal.SysClkFreq = 16e6;
+  dac_cal.AdcClkFreq = 16e6;
+  dac_cal.AfePwrMode = AFEPWR_LP;
+  dac_cal.ExcitBufGain = EXCITBUFGAIN_2;
+  dac_cal.HsDacGain = HSDACGAIN_1;
+  dac_cal.ADCSinc3Osr = ADCSINC3OSR_4;
+  dac_cal.ADCSinc2Osr = ADCSINC2OSR_22;
+  if(CalCacheHSDAC(&AppBATCalCache, &dac_cal) != AD5940ERR_OK)
+    printf("HSDAC calibration failed\n");
+  CalCacheSave(&AppBATCalCache);
+}
+
+static uint32_t AppBATSweepsLeft;   /* Sweeps still to run including current one, 0 to run until stopped */
+static BoolFlag AppBATRunning = bFALSE;
+static BoolFlag AppBATStopReq = bFALSE;
+static SoftSweepCfg_Type AppBATSweepLast;   /* Sweep of the last job, sequences and RCAL store were set up for it */
+static float AppBATSinLast;
+
+#if APP_SWEEP_ADAPT
+/* Load the first pass of a sweep into SweepCfg if the sweep is refined */
+static void AD5941BatAdaptBegin(AppBATCfg_Type *pBATCfg)
 {
-  uint32_t temp;
+  pBATCfg->SweepCfg = AppBATSweepUser;
+  AppBATAdaptOn = bFALSE;
+  AppBATAdaptMore = bFALSE;
+  if(SweepAdaptBegin(&AppBATAdapt, &AppBATSweepUser) > 0)
+  {
+    pBATCfg->SweepCfg.SweepPoints = AppBATAdapt.PassCount;
+    pBATCfg->SweepCfg.pFreqList = AppBATAdapt.PassFreq;
+    AppBATAdaptOn = bTRUE;
+  }
+}
+
+/* Keep a point for refinement, plan the next pass when a pass is done */
+static void AD5941BatAdaptPoint(const fImpCar_Type *pImp, uint32_t Index)
+{
+  AppBATCfg_Type *pBATCfg;
+  float freq;
+
+  AppBATAdaptMore = bFALSE;
+  if(AppBATAdaptOn == bFALSE)
+    return;
+  AppBATGetCfg(&pBATCfg);
+  AppBATCtrl(BATCTRL_GETFREQ, &freq);
+  SweepAdaptAdd(&AppBATAdapt, freq, pImp);
+  if(Index == pBATCfg->SweepCfg.SweepPoints - 1 && SweepAdaptRefine(&AppBATAdapt) > 0)
+    AppBATAdaptMore = bTRUE;
+}
+#endif
+
+/* Platform, application defaults and calibration, call once after AD5940_MCUResourceInit */
+void AD5941_BatBoot(void)
+{
+  AppBATCfg_Type *pBATCfg;
+
   AD5940PlatformCfg();
-  
   AD5940BATStructInit(); /* Configure your parameters in this function */
-  
-  AppBATInit(AppBATBuff, APPBUFF_SIZE);    /* Initialize BAT application. Provide a buffer, which is used to store sequencer commands */
-  AppBATCtrl(BATCTRL_MRCAL, 0);     /* Measur RCAL each point in sweep */
-	AppBATCtrl(BATCTRL_START, 0); 
-  while(1)
+  AppBATGetCfg(&pBATCfg);
+  pBATCfg->bParaChanged = bTRUE;  /* Sequences in SRAM are lost after a reset */
+  AD5940BATCalibrate();
+#if APP_RESULT_BINARY
+  RStreamEncInit(&AppBATStream, RSTREAM_TYPE_FIXED, -3, AD5940_StreamWrite);  /* Impedance in mOhm with 3 decimals */
+#if APP_RESULT_FIT
+  RandlesFitInit(&AppBATFit);
+#endif
+#if APP_SWEEP_KK
+  LinKKInit(&AppBATKK);
+#endif
+#endif
+#if APP_SWEEP_ADAPT
+  SweepAdaptInit(&AppBATAdapt);
+  AppBATAdapt.MaxPoints = APP_SWEEP_ADAPT;
+#endif
+}
+
+/* Sweeps measure the same frequencies. A frequency list may have changed in place, so it never matches */
+static BoolFlag AD5941BatSweepSame(const SoftSweepCfg_Type *pA, const SoftSweepCfg_Type *pB)
+{
+  if(pA->SweepEn != pB->SweepEn)
+    return bFALSE;
+  if(pA->SweepEn == bFALSE)
+    return bTRUE;
+  if(pA->pFreqList || pB->pFreqList)
+    return bFALSE;
+  return (pA->SweepStart == pB->SweepStart && pA->SweepStop == pB->SweepStop &&
+          pA->SweepPoints == pB->SweepPoints && pA->SweepLog == pB->SweepLog) ? bTRUE : bFALSE;
+}
+
+/**
+ * @brief Start measurement.
+ * @param pSweepCfg: Sweep to run, NULL keeps current settings. With SweepEn set to bFALSE, SweepStart is the frequency.
+ * @param SweepCount: Number of sweeps, 0 to run until AD5941_BatStop.
+*/
+AD5940Err AD5941_BatStart(const SoftSweepCfg_Type *pSweepCfg, uint32_t SweepCount)
+{
+  AppBATCfg_Type *pBATCfg;
+  SoftSweepCfg_Type *pUser;
+  AD5940Err error;
+
+  AppBATGetCfg(&pBATCfg);
+  if(pSweepCfg)
+  {
+    pBATCfg->SweepCfg = *pSweepCfg;
+    if(pSweepCfg->SweepEn == bFALSE)
+      pBATCfg->SinFreq = pSweepCfg->SweepStart;
+  }
+#if APP_SWEEP_ADAPT
+  if(pBATCfg->SweepCfg.pFreqList != AppBATAdapt.PassFreq)
+    AppBATSweepUser = pBATCfg->SweepCfg;    /* Not a pass of an earlier sweep */
+  AD5941BatAdaptBegin(pBATCfg);
+#endif
+  pUser = &pBATCfg->SweepCfg;
+#if APP_SWEEP_ADAPT
+  pUser = &AppBATSweepUser;
+#endif
+  if(AD5941BatSweepSame(pUser, &AppBATSweepLast) == bFALSE ||
+     (pUser->SweepEn == bFALSE && pBATCfg->SinFreq != AppBATSinLast))
+    pBATCfg->bParaChanged = bTRUE;    /* Regenerate sequences and start with an empty RCAL store */
+  AppBATSweepLast = *pUser;
+  AppBATSinLast = pBATCfg->SinFreq;
+  pBATCfg->SweepCfg.SweepIndex = 0;
+  AppBATRunning = bFALSE;
+  AppBATStopReq = bFALSE;
+  AppBATSweepsLeft = SweepCount;
+#if APP_RESULT_BINARY && APP_RESULT_FIT
+  RandlesFitClear(&AppBATFit);      /* Points of a sweep stopped right away */
+#endif
+#if APP_RESULT_BINARY && APP_SWEEP_KK
+  LinKKClear(&AppBATKK);
+#endif
+  if(pBATCfg->BATInited == bFALSE || pBATCfg->bParaChanged == bTRUE)
+    error = AppBATInit(AppBATBuff, APPBUFF_SIZE);    /* Initialize BAT application. Provide a buffer, which is used to store sequencer commands */
+  else
+  {
+    /* Same sweep as the last job, start the sequences in SRAM from the first point */
+    error = AppBATSweepRestart();
+    if(error != AD5940ERR_WAKEUP)
+      error = AD5940ERR_OK;           /* First point missing from the store, RcalVoltValid is cleared */
+  }
+  if(error == AD5940ERR_OK)
+    error = AppBATCtrl(pBATCfg->RcalVoltValid == bTRUE ? BATCTRL_RCALCHECK : BATCTRL_MRCAL, 0);  /* Measure RCAL only when stored data is outdated */
+  if(error == AD5940ERR_OK)
+    error = AppBATCtrl(BATCTRL_START, 0);
+  AppBATRunning = (error == AD5940ERR_OK) ? bTRUE : bFALSE;
+  return error;
+}
+
+/**
+ * @brief Process AFE interrupt if there is one and trigger next point. Call this in a loop.
+ * @return APPPOLL_xxx
+*/
+int32_t AD5941_BatPoll(void)
+{
+  AppBATCfg_Type *pBATCfg;
+  uint32_t temp, index;
+  BoolFlag bRcalMeasured, bRcalCheck, bPassEnd, bSweepEnd;
+
+  if(AppBATRunning == bFALSE || AD5940_GetMCUIntFlag() == 0)
+    return APPPOLL_IDLE;
+  AppBATIntTimeUs = AD5940_GetMCUIntTimeUs();
+  AD5940_ClrMCUIntFlag(); 				/* Clear this flag */
+  temp = APPBUFF_SIZE;
+  AppBATISR(AppBATBuff, &temp); 			/* Deal with it and provide a buffer to store data we got */
+  AD5940_Delay10us(APP_BAT_POINT_DELAY_10US);
+  AppBATGetCfg(&pBATCfg);
+  AppBATCtrl(BATCTRL_GETSWEEPIDX, &index);
+#if APP_SWEEP_ADAPT
+  if(temp)
+    AD5941BatAdaptPoint((fImpCar_Type*)AppBATBuff, index);
+#endif
+  BATShowResult(AppBATBuff, temp);		/* Print measurement results over UART */
+  bPassEnd = (temp && (pBATCfg->SweepCfg.SweepEn == bFALSE || index == pBATCfg->SweepCfg.SweepPoints - 1)) ? bTRUE : bFALSE;
+  bSweepEnd = (bPassEnd == bTRUE && AppBATAdaptMore == bFALSE) ? bTRUE : bFALSE;
+  /* Next point is triggered by MCU, so the AFE is idle here */
+  if(AppBATStopReq == bTRUE)
   {
-    /* Check if interrupt flag which will be set when interrupt occurred. */
-    if(AD5940_GetMCUIntFlag())
+    AppBATRunning = bFALSE;
+#if APP_RESULT_BINARY
+    RStreamEndSweep(&AppBATStream);   /* Send partial sweep */
+#if APP_RESULT_FIT
+    RandlesFitClear(&AppBATFit);      /* but don't fit it */
+#endif
+#if APP_SWEEP_KK
+    LinKKClear(&AppBATKK);
+#endif
+#endif
+    return APPPOLL_STOPPED;
+  }
+  if(bSweepEnd == bTRUE)
+  {
+    if(AppBATSweepsLeft == 1)
+    {
+      AppBATRunning = bFALSE;
+      return APPPOLL_DONE;
+    }
+    if(AppBATSweepsLeft)
+      AppBATSweepsLeft--;
+  }
+  bRcalCheck = bTRUE;
+#if APP_SWEEP_ADAPT
+  if(bPassEnd == bTRUE && AppBATAdaptOn == bTRUE)
+  {
+    /* Next pass of this sweep or first pass of the next one */
+    if(AppBATAdaptMore == bTRUE)
+      pBATCfg->SweepCfg.SweepPoints = AppBATAdapt.PassCount;
+    else
+      AD5941BatAdaptBegin(pBATCfg);
+    if(AppBATCtrl(BATCTRL_SWEEPRESTART, 0) != AD5940ERR_OK)
     {
-				AD5940_ClrMCUIntFlag(); 				/* Clear this flag */
-				temp = APPBUFF_SIZE;
-				AppBATISR(AppBATBuff, &temp); 			/* Deal with it and provide a buffer to store data we got */
-				AD5940_Delay10us(100000);
-				BATShowResult(AppBATBuff, temp);		/* Print measurement results over UART */		
-				AD5940_SEQMmrTrig(SEQID_0);  		/* Trigger next measurement ussing MMR write*/      
-   }
+      AppBATRunning = bFALSE;
+      return APPPOLL_ERROR;
+    }
   }
+  /* RCAL anchors stay on the grid of the first pass, refinement points are interpolated from them */
+  if(AppBATAdaptOn == bTRUE && AppBATAdapt.Pass > 0)
+    bRcalCheck = bFALSE;
+#endif
+  bRcalMeasured = bFALSE;
+  if(bRcalCheck == bTRUE && AppBATCtrl(BATCTRL_RCALCHECK, &bRcalMeasured) != AD5940ERR_OK)	/* Measure RCAL again only when stored data is outdated */
+  {
+    AppBATRunning = bFALSE;
+    return APPPOLL_ERROR;
+  }
+  if(bRcalMeasured == bTRUE)
+  {
+    /* Sweep boundary, refresh one stale calibration while AFE is idle */
+    if(CalCacheService(&AppBATCalCache) == bTRUE)
+    {
+      CalCacheSave(&AppBATCalCache);
+      AppBATInit(AppBATBuff, APPBUFF_SIZE);	/* Restore AFE settings changed by calibration */
+      AppBATCtrl(BATCTRL_MRCAL, 0);		/* RCAL must be measured with the new calibration */
+    }
+    AppBATCtrl(BATCTRL_START, 0);		/* Switch back to battery and trigger measurement */
+  }
+  else
+    AD5940_SEQMmrTrig(SEQID_0);  		/* Trigger next measurement ussing MMR write*/
+  return bSweepEnd ? APPPOLL_SWEEPEND : APPPOLL_DATA;
+}
+
+/**
+ * @brief Stop measurement. With bNow set to bFALSE, the point being measured finishes and
+ *        AD5941_BatPoll reports APPPOLL_STOPPED. Otherwise measurement is abandoned right away.
+*/
+void AD5941_BatStop(BoolFlag bNow)
+{
+  if(AppBATRunning == bFALSE)
+    return;
+  AppBATCtrl(BATCTRL_STOPSYNC, 0);
+  AppBATStopReq = bTRUE;
+  if(bNow)
+  {
+    AppBATCtrl(BATCTRL_STOPNOW, 0);
+    AppBATRunning = bFALSE;
+  }
+}
+
+void AD5941_Main(void)
+{
+  AD5941_BatBoot();
+  AD5941_BatStart(NULL, 0);   /* Run configured sweep until reset */
+  while(1)
+    AD5941_BatPoll();
 }
 
 /**
@@ -0,0 +1,406 @@
+/*!
+ *****************************************************************************
+ @file:    AdcStream.c
+ @brief:   Raw ADC sample stream through the data FIFO.
+ -----------------------------------------------------------------------------
+
+ Host_Tools/rstream_dump -a writes the samples of a captured stream as
+ CSV and reports gaps and drops.
+
+*****************************************************************************/
+#include "AdcStream.h"
+#include "AppMain.h"
+#include "TimeSync.h"
+#include <string.h>
+
+#if ADCSTREAM_CHUNK < 6
+#error "ADCSTREAM_CHUNK must be at least 6, a FIFO transfer reads 3 words or more"
+#endif
+
+#define ADCSTREAM_FIFO_WORDS  1536    /* 6kB data FIFO */
+#define ADCSTREAM_XFER_LEN(n) (7 + 4*(n))   /* Command, 6 dummy bytes and n words */
+#define ADCSTREAM_XFER_WORDS  ((ADCSTREAM_XFER_LEN(ADCSTREAM_CHUNK) + 3)/4)
+
+typedef struct
+{
+  uint64_t FirstIndex;
+  uint32_t Count;
+  uint16_t Channel;
+  int16_t Sample[RSTREAM_ADC_MAX_SAMPLES];
+}AdcStreamBlock_Type;
+
+AppADCStreamCfg_Type AppADCStreamCfg =
+{
+  .Source = FIFOSRC_SINC3,
+  .ADCMuxP = ADCMUXP_AIN1,
+  .ADCMuxN = ADCMUXN_VSET1P1,
+  .ADCPga = ADCPGA_1,
+  .ADCRate = ADCRATE_800KHZ,
+  .ADCSinc3Osr = ADCSINC3OSR_4,     /* 200kSPS */
+  .ADCSinc2Osr = ADCSINC2OSR_22,
+  .BpNotch = bTRUE,
+  .FifoThresh = 768,
+  .Channel = 0,
+  .pStream = 0,
+  .bRunning = bFALSE,
+};
+
+static AdcStreamBlock_Type AdcStreamRing[ADCSTREAM_RING_BLOCKS];
+/* Transfer buffers are words so DMA gets them aligned */
+static uint32_t AdcStreamTx[ADCSTREAM_XFER_WORDS];
+static uint32_t AdcStreamRx[2][ADCSTREAM_XFER_WORDS];
+static uint32_t AdcStreamTail;      /* Offset of the non-zero offset bytes in AdcStreamTx */
+
+int32_t AppADCStreamGetCfg(void *pCfg)
+{
+  if(pCfg)
+  {
+    *(AppADCStreamCfg_Type**)pCfg = &AppADCStreamCfg;
+    return AD5940ERR_OK;
+  }
+  return AD5940ERR_PARA;
+}
+
+/**
+ * @brief Nominal rate of samples going into the FIFO with the given filter settings.
+ * @return Samples per second.
+*/
+float AppADCStreamRate(const AppADCStreamCfg_Type *pCfg)
+{
+  static const uint16_t sinc2_osr[] = {22, 44, 89, 178, 267, 533, 640, 667, 800, 889, 1067, 1333};
+  float rate = pCfg->ADCRate == ADCRATE_1P6MHZ ? 1.6e6f : 800e3f;
+
+  if(pCfg->ADCSinc3Osr == ADCSINC3OSR_2)
+    rate /= 2;
+  else if(pCfg->ADCSinc3Osr == ADCSINC3OSR_4)
+    rate /= 4;
+  else
+    rate /= 5;
+  if(pCfg->Source == FIFOSRC_SINC2NOTCH && pCfg->ADCSinc2Osr < sizeof(sinc2_osr)/sizeof(sinc2_osr[0]))
+    rate /= sinc2_osr[pCfg->ADCSinc2Osr];
+  return rate;
+}
+
+/* Read Count FIFO words into receive buffer Buff in the background */
+static void AdcStreamRdStart(uint32_t Buff, uint32_t Count)
+{
+  uint8_t *pTx = (uint8_t*)AdcStreamTx;
+  uint32_t len = ADCSTREAM_XFER_LEN(Count);
+
+  /* Last two words are read with a non-zero offset, as AD5940_FIFORd does */
+  memset(pTx + AdcStreamTail, 0, 8);
+  AdcStreamTail = len - 8;
+  memset(pTx + AdcStreamTail, 0x44, 8);
+  AD5940_CsClr();
+  AD5940_ReadWriteNBytesStart(pTx, (uint8_t*)AdcStreamRx[Buff], len);
+}
+
+static void AdcStreamRdWait(void)
+{
+  AD5940_ReadWriteNBytesWait();
+  AD5940_CsSet();
+}
+
+/* Words of the next transfer, so that no transfer is left with less than 3 */
+static uint32_t AdcStreamChunk(uint32_t Left)
+{
+  uint32_t n = Left < ADCSTREAM_CHUNK ? Left : ADCSTREAM_CHUNK;
+  if(Left - n > 0 && Left - n < 3)
+    n = Left - 3;
+  return n;
+}
+
+/* End the block being filled. With a full ring it is dropped */
+static void AdcStreamClose(void)
+{
+  AppADCStreamCfg_Type *pCfg = &AppADCStreamCfg;
+  AdcStreamBlock_Type *pBlk = &AdcStreamRing[pCfg->RingWr%ADCSTREAM_RING_BLOCKS];
+
+  if(pBlk->Count == 0)
+    return;
+  if(pCfg->RingWr + 1 - pCfg->RingRd < ADCSTREAM_RING_BLOCKS)
+  {
+    pCfg->RingWr++;
+    if(pCfg->RingWr - pCfg->RingRd > pCfg->MaxRingUsed)
+      pCfg->MaxRingUsed = pCfg->RingWr - pCfg->RingRd;
+    AdcStreamRing[pCfg->RingWr%ADCSTREAM_RING_BLOCKS].Count = 0;
+  }
+  else
+  {
+    pCfg->RingDropped += pBlk->Count;
+    pBlk->Count = 0;
+  }
+}
+
+/* Samples of a transfer into the ring. FIFO words are big endian, ADC code in the low 16 bits */
+static void AdcStreamPut(const uint8_t *pData, uint32_t Count)
+{
+  AppADCStreamCfg_Type *pCfg = &AppADCStreamCfg;
+  AdcStreamBlock_Type *pBlk;
+  uint32_t i;
+
+  for(i=0; i<Count; i++, pData += 4)
+  {
+    pBlk = &AdcStreamRing[pCfg->RingWr%ADCSTREAM_RING_BLOCKS];
+    if(pBlk->Count == 0)
+    {
+      pBlk->FirstIndex = pCfg->Index;
+      pBlk->Channel = pCfg->Channel;
+    }
+    pBlk->Sample[pBlk->Count++] = (int16_t)(uint16_t)(((pData[2]<<8)|pData[3])^0x8000);   /* Code - 32768 */
+    pCfg->Index++;
+    if(pBlk->Count == RSTREAM_ADC_MAX_SAMPLES)
+      AdcStreamClose();
+  }
+  pCfg->Samples += Count;
+}
+
+/* Read all samples in FIFO, the ones of a transfer are unpacked while the next one is on the bus */
+static void AdcStreamDrain(void)
+{
+  AppADCStreamCfg_Type *pCfg = &AppADCStreamCfg;
+  uint32_t left, n[2], cur = 0, done;
+  uint64_t now, lost = 0;
+  float produced;
+
+  if(AD5940_INTCTestFlag(AFEINTC_1, AFEINTSRC_DATAFIFOOF) == bTRUE)
+  {
+    AD5940_INTCClrFlag(AFEINTSRC_DATAFIFOOF);
+    pCfg->FifoOverflows++;
+    lost = 1;
+  }
+  left = AD5940_FIFOGetCnt();
+  now = AD5940_GetTimeUs();
+  if(lost)
+  {
+    /* All samples up to the last drain were read, the ones since then not in FIFO are lost */
+    produced = (float)(now - pCfg->CntUs)*pCfg->SampleRate/1e6f;
+    lost = produced > left ? (uint64_t)(produced - left + 0.5f) : 0;
+  }
+  pCfg->CntUs = now;
+  if(left >= 3)
+  {
+    n[cur] = AdcStreamChunk(left);
+    left -= n[cur];
+    AdcStreamRdStart(cur, n[cur]);
+    while(n[cur])
+    {
+      AdcStreamRdWait();
+      done = cur;
+      cur ^= 1;
+      n[cur] = AdcStreamChunk(left);
+      if(n[cur])
+      {
+        left -= n[cur];
+        AdcStreamRdStart(cur, n[cur]);
+      }
+      AdcStreamPut((uint8_t*)AdcStreamRx[done] + 7, n[done]);
+    }
+  }
+  AD5940_INTCClrFlag(AFEINTSRC_DATAFIFOTHRESH);
+  if(lost)
+  {
+    /* Lost samples came after the ones in FIFO */
+    AdcStreamClose();
+    pCfg->Index += lost;
+    pCfg->FifoLost += lost;
+  }
+}
+
+/* Send finished blocks while the link has room for them, or all of them */
+static void AdcStreamSend(BoolFlag bAll)
+{
+  AppADCStreamCfg_Type *pCfg = &AppADCStreamCfg;
+  AdcStreamBlock_Type *pBlk;
+  RStreamAdc_Type adc;
+
+  adc.Source = pCfg->Source == FIFOSRC_SINC2NOTCH ? RSTREAM_ADC_SINC2NOTCH : RSTREAM_ADC_SINC3;
+  adc.SampleRate = pCfg->SampleRate;
+  adc.Scale = pCfg->Scale;
+  while(pCfg->RingRd != pCfg->RingWr)
+  {
+    pBlk = &AdcStreamRing[pCfg->RingRd%ADCSTREAM_RING_BLOCKS];
+    if(bAll == bFALSE &&
+       AD5940_StreamRoom() < RSTREAM_HEADER_LEN + RSTREAM_ADC_REC_LEN + 2*pBlk->Count + RSTREAM_CRC_LEN)
+      break;
+    adc.bHostTime = TSyncStamp(pCfg->StartUs + (uint64_t)(pBlk->FirstIndex*1e6/pCfg->SampleRate), &adc.TimeUs);
+    adc.Channel = pBlk->Channel;
+    adc.FirstIndex = (uint32_t)pBlk->FirstIndex;
+    adc.Dropped = (uint32_t)(pCfg->FifoLost + pCfg->RingDropped);
+    adc.Count = pBlk->Count;
+    RStreamAddAdc(pCfg->pStream, &adc, pBlk->Sample);
+    pCfg->Frames++;
+    pCfg->RingRd++;
+  }
+}
+
+/**
+ * @brief Configure ADC, filters and FIFO for streaming. Excitation and switch matrix are
+ *        left as they are, so a stream can follow a waveform set up before.
+ * @return AD5940ERR_PARA without an encoder.
+*/
+AD5940Err AppADCStreamInit(void)
+{
+  AppADCStreamCfg_Type *pCfg = &AppADCStreamCfg;
+  AFERefCfg_Type aferef_cfg;
+  ADCBaseCfg_Type adc_base;
+  ADCFilterCfg_Type adc_filter;
+  SEQCfg_Type seq_cfg;
+  FIFOCfg_Type fifo_cfg;
+  uint8_t *pTx = (uint8_t*)AdcStreamTx;
+
+  if(pCfg->pStream == 0)
+    return AD5940ERR_PARA;
+  if(pCfg->FifoThresh < 3 || pCfg->FifoThresh > 1023)
+    pCfg->FifoThresh = 768;
+  if(AD5940_WakeUp(10) > 10)  /* Wakeup AFE by read register, read 10 times at most */
+    return AD5940ERR_WAKEUP;
+  AD5940_SleepKeyCtrlS(SLPKEY_LOCK);  /* AFE stays active while streaming */
+
+  /* Sequencer is not used, all SRAM is data FIFO */
+  seq_cfg.SeqMemSize = SEQMEMSIZE_32B;
+  seq_cfg.SeqBreakEn = bFALSE;
+  seq_cfg.SeqIgnoreEn = bTRUE;
+  seq_cfg.SeqCntCRCClr = bTRUE;
+  seq_cfg.SeqEnable = bFALSE;
+  seq_cfg.SeqWrTimer = 0;
+  AD5940_SEQCfg(&seq_cfg);
+
+  aferef_cfg.HpBandgapEn = bTRUE;
+  aferef_cfg.Hp1V1BuffEn = bTRUE;
+  aferef_cfg.Hp1V8BuffEn = bTRUE;
+  aferef_cfg.Disc1V1Cap = bFALSE;
+  aferef_cfg.Disc1V8Cap = bFALSE;
+  aferef_cfg.Hp1V8ThemBuff = bFALSE;
+  aferef_cfg.Hp1V8Ilimit = bFALSE;
+  aferef_cfg.Lp1V1BuffEn = bFALSE;
+  aferef_cfg.Lp1V8BuffEn = bFALSE;
+  aferef_cfg.LpBandgapEn = bFALSE;
+  aferef_cfg.LpRefBufEn = bFALSE;
+  aferef_cfg.LpRefBoostEn = bFALSE;
+  aferef_cfg.HSDACRefEn = bTRUE;
+  AD5940_REFCfgS(&aferef_cfg);
+
+  adc_base.ADCMuxP = pCfg->ADCMuxP;
+  adc_base.ADCMuxN = pCfg->ADCMuxN;
+  adc_base.ADCPga = pCfg->ADCPga;
+  AD5940_ADCBaseCfgS(&adc_base);
+  adc_filter.ADCSinc3Osr = pCfg->ADCSinc3Osr;
+  adc_filter.ADCSinc2Osr = pCfg->ADCSinc2Osr;
+  adc_filter.ADCAvgNum = ADCAVGNUM_16;    /* DFT only */
+  adc_filter.ADCRate = pCfg->ADCRate;
+  adc_filter.BpNotch = pCfg->BpNotch;
+  adc_filter.BpSinc3 = bFALSE;
+  adc_filter.Sinc2NotchEnable = pCfg->Source == FIFOSRC_SINC2NOTCH ? bTRUE : bFALSE;
+  AD5940_ADCFilterCfgS(&adc_filter);
+
+  AD5940_FIFOCtrlS(pCfg->Source, bFALSE);
+  fifo_cfg.FIFOEn = bTRUE;
+  fifo_cfg.FIFOMode = FIFOMODE_FIFO;      /* Keeps oldest samples when full */
+  fifo_cfg.FIFOSize = FIFOSIZE_6KB;
+  fifo_cfg.FIFOSrc = pCfg->Source;
+  fifo_cfg.FIFOThresh = pCfg->FifoThresh;
+  AD5940_FIFOCfg(&fifo_cfg);
+  AD5940_INTCCfg(AFEINTC_0, AFEINTSRC_DATAFIFOTHRESH, bTRUE);
+  AD5940_INTCCfg(AFEINTC_1, AFEINTSRC_DATAFIFOOF, bTRUE);
+  AD5940_INTCClrFlag(AFEINTSRC_ALLINT);
+
+  pCfg->SampleRate = AppADCStreamRate(pCfg);
+  pCfg->Scale = AD5940_ADCCode2Volt(32768 + 1, pCfg->ADCPga, 1.82f);
+  memset(pTx, 0, sizeof(AdcStreamTx));
+  pTx[0] = SPICMD_READFIFO;
+  AdcStreamTail = 1;
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Start conversions. Statistics and sample index start from 0.
+*/
+AD5940Err AppADCStreamStart(void)
+{
+  AppADCStreamCfg_Type *pCfg = &AppADCStreamCfg;
+
+  if(AD5940_WakeUp(10) > 10)
+    return AD5940ERR_WAKEUP;
+  pCfg->Samples = 0;
+  pCfg->FifoLost = 0;
+  pCfg->RingDropped = 0;
+  pCfg->FifoOverflows = 0;
+  pCfg->Frames = 0;
+  pCfg->MaxRingUsed = 0;
+  pCfg->Index = 0;
+  pCfg->RingRd = 0;
+  pCfg->RingWr = 0;
+  AdcStreamRing[0].Count = 0;
+  AD5940_FIFOCtrlS(pCfg->Source, bFALSE);   /* Empty FIFO */
+  AD5940_FIFOCtrlS(pCfg->Source, bTRUE);
+  AD5940_AFECtrlS(AFECTRL_ADCPWR|(pCfg->Source == FIFOSRC_SINC2NOTCH ? AFECTRL_SINC2NOTCH : 0), bTRUE);
+  AD5940_Delay10us(25);    /* ADC power up */
+  AD5940_INTCClrFlag(AFEINTSRC_ALLINT);
+  AD5940_ClrMCUIntFlag();
+  AD5940_AFECtrlS(AFECTRL_ADCCNV, bTRUE);
+  pCfg->StartUs = AD5940_GetTimeUs();
+  pCfg->CntUs = pCfg->StartUs;
+  pCfg->bRunning = bTRUE;
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Drain the FIFO on its threshold interrupt and send what the link takes. Call this in a loop.
+ *        The FIFO is also drained if no interrupt came by the time it is half way from threshold to full.
+ * @return APPPOLL_DATA if the FIFO was read, APPPOLL_IDLE otherwise.
+*/
+int32_t AppADCStreamPoll(void)
+{
+  AppADCStreamCfg_Type *pCfg = &AppADCStreamCfg;
+  uint64_t late_us;
+
+  if(pCfg->bRunning == bFALSE)
+    return APPPOLL_IDLE;
+  late_us = (uint64_t)((pCfg->FifoThresh + ADCSTREAM_FIFO_WORDS)/2*1e6f/pCfg->SampleRate);
+  if(AD5940_GetMCUIntFlag() == 0 && AD5940_GetTimeUs() - pCfg->CntUs < late_us)
+  {
+    AdcStreamSend(bFALSE);
+    return APPPOLL_IDLE;
+  }
+  AD5940_ClrMCUIntFlag();
+  AdcStreamDrain();
+  AdcStreamSend(bFALSE);
+  return APPPOLL_DATA;
+}
+
+/**
+ * @brief Label samples from now on with another channel, e.g. after a switch matrix change.
+ *        The FIFO is drained first, samples converted before keep the old channel.
+*/
+void AppADCStreamChannel(uint16_t Channel)
+{
+  AppADCStreamCfg_Type *pCfg = &AppADCStreamCfg;
+
+  if(pCfg->bRunning == bTRUE)
+  {
+    AdcStreamDrain();
+    AdcStreamClose();
+  }
+  pCfg->Channel = Channel;
+}
+
+/**
+ * @brief Stop conversions and send everything that is left, waiting for the link if needed.
+ *        Impedance applications set up FIFO and sequencer again when they start.
+*/
+void AppADCStreamStop(void)
+{
+  AppADCStreamCfg_Type *pCfg = &AppADCStreamCfg;
+
+  if(pCfg->bRunning == bFALSE)
+    return;
+  AD5940_AFECtrlS(AFECTRL_ADCCNV, bFALSE);
+  AdcStreamDrain();
+  AD5940_AFECtrlS(AFECTRL_ADCPWR|AFECTRL_SINC2NOTCH, bFALSE);
+  AdcStreamClose();
+  AdcStreamSend(bTRUE);
+  AD5940_FIFOCtrlS(FIFOSRC_DFT, bFALSE);
+  AD5940_SleepKeyCtrlS(SLPKEY_UNLOCK);
+  pCfg->bRunning = bFALSE;
+}
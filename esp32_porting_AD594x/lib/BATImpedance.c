@@ -57,6 +57,11 @@ AppBATCfg_Type AppBATCfg =
   .SweepCfg.SweepPoints = 101,
   .SweepCfg.SweepLog = bFALSE,
   .SweepCfg.SweepIndex = 0,
+
+  .RcalAnchorStep = 4,
+  .RcalMaxAge = 10,
+  .RcalMaxTempDrift = 2.0f,
+  .TempDegC = NAN,
 };
 
 /**
@@ -119,6 +124,7 @@ AD5940Err AppBATCtrl(int32_t BatCtrl, void *pPara)
       /* Trigger sequence using MMR write */
 			AD5940_SEQMmrTrig(SEQID_0);
       AppBATCfg.FifoDataCount = 0;  /* restart */
+      AppBATCfg.StopRequired = bFALSE;
       
       break;
     }
@@ -147,6 +153,10 @@ AD5940Err AppBATCtrl(int32_t BatCtrl, void *pPara)
         *(float*)pPara = AppBATCfg.SinFreq;
     }
 		break;
+    case BATCTRL_GETSWEEPIDX:
+    if(pPara)
+      *(uint32_t*)pPara = AppBATCfg.IndexofData;
+    break;
     case BATCTRL_SHUTDOWN:
     {
       AppBATCtrl(BATCTRL_STOPNOW, 0);  /* Stop the measurement if it's running. */
@@ -175,7 +185,27 @@ AD5940Err AppBATCtrl(int32_t BatCtrl, void *pPara)
                 AFECTRL_WG|AFECTRL_DACREFPWR|AFECTRL_HSDACPWR|\
                 AFECTRL_SINC2NOTCH, bTRUE);
 		AD5940_Delay10us(10000);
-		AppBATMeasureRCAL();
+		return AppBATMeasureRCAL();
+    case BATCTRL_RCALCHECK:
+    {
+      BoolFlag bMeasured = bFALSE;
+      if(RcalStoreIsStale(&AppBATCfg.RcalStore, AppBATCfg.TempDegC) == bTRUE)
+      {
+        AD5940Err error = AppBATCtrl(BATCTRL_MRCAL, 0);
+        if(error != AD5940ERR_OK)
+          return error;
+        bMeasured = bTRUE;
+      }
+      if(pPara)
+        *(BoolFlag*)pPara = bMeasured;
+    }
+    break;
+    case BATCTRL_SWEEPRESTART:
+      return AppBATSweepRestart();
+    case BATCTRL_SETTEMP:
+      if(pPara == 0)
+        return AD5940ERR_PARA;
+      AppBATCfg.TempDegC = *(float*)pPara;
     break;
     default:
     break;
@@ -235,8 +265,9 @@ static AD5940Err AppBATSeqCfgGen(void)
   hs_loop.WgCfg.OffsetCalEn = bFALSE;
 	if(AppBATCfg.SweepCfg.SweepEn == bTRUE)
   {
-    AppBATCfg.FreqofData = AppBATCfg.SweepCfg.SweepStart;
-    AppBATCfg.SweepCurrFreq = AppBATCfg.SweepCfg.SweepStart;
+    AppBATCfg.FreqofData = AD5940_SweepFirstFreq(&AppBATCfg.SweepCfg);
+    AppBATCfg.IndexofData = 0;
+    AppBATCfg.SweepCurrFreq = AppBATCfg.FreqofData;
 		AD5940_SweepNext(&AppBATCfg.SweepCfg, &AppBATCfg.SweepNextFreq);
 		sin_freq = AppBATCfg.SweepCurrFreq;    
   }
@@ -244,6 +275,7 @@ static AD5940Err AppBATSeqCfgGen(void)
   {
     sin_freq = AppBATCfg.SinFreq;
     AppBATCfg.FreqofData = sin_freq;
+    AppBATCfg.IndexofData = 0;
   }
   hs_loop.WgCfg.SinCfg.SinFreqWord = AD5940_WGFreqWordCal(sin_freq, AppBATCfg.SysClkFreq);
   hs_loop.WgCfg.SinCfg.SinAmplitudeWord = (uint32_t)(AppBATCfg.ACVoltPP/800.0f*2047 + 0.5f);
@@ -410,6 +442,12 @@ AD5940Err AppBATInit(uint32_t *pBuffer, uint32_t BufferSize)
     /* Generate measurement sequence */
     error = AppBATSeqMeasureGen();
     if(error != AD5940ERR_OK) return error;
+    /* RCAL reference store holds at most one anchor per sweep point */
+    error = RcalStoreInit(&AppBATCfg.RcalStore, AppBATCfg.SweepCfg.SweepEn?AppBATCfg.SweepCfg.SweepPoints:1);
+    if(error != AD5940ERR_OK) return error;
+    AppBATCfg.RcalStore.MaxAge = AppBATCfg.RcalMaxAge;
+    AppBATCfg.RcalStore.MaxTempDrift = AppBATCfg.RcalMaxTempDrift;
+    AppBATCfg.RcalStore.bLogInterp = AppBATCfg.SweepCfg.SweepLog;
     AppBATCfg.bParaChanged = bFALSE; /* Clear this flag as we already implemented the new configuration */
   }
   /* Initialization sequencer  */
@@ -421,7 +459,7 @@ AD5940Err AppBATInit(uint32_t *pBuffer, uint32_t BufferSize)
   while(AD5940_INTCTestFlag(AFEINTC_1, AFEINTSRC_ENDSEQ) == bFALSE);
   
   if(AppBATCfg.SweepCfg.SweepEn == bTRUE)
-		AppBATCheckFreq(AppBATCfg.SweepCfg.SweepStart);
+		AppBATCheckFreq(AD5940_SweepFirstFreq(&AppBATCfg.SweepCfg));
 	else
 		AppBATCheckFreq(AppBATCfg.SinFreq);
   /* Measurement sequence  */
@@ -436,6 +474,16 @@ AD5940Err AppBATInit(uint32_t *pBuffer, uint32_t BufferSize)
   return AD5940ERR_OK;
 }
 
+/* Filter band of a frequency, AppBATCheckFreq sets the filters by it. RCAL response is only comparable within one band.
+   Above 450 Hz SINC3 feeds the DFT directly, so the high band needs no settings of its own. */
+static uint32_t AppBATFreqBand(float freq)
+{
+  if(freq < 0.51) return 0;
+  if(freq < 5) return 1;
+  if(freq < 450) return 2;
+  return 3;
+}
+
 /* Depending on frequency of Sin wave set optimum filter settings */
 AD5940Err AppBATCheckFreq(float freq)
 {
@@ -445,26 +493,28 @@ AD5940Err AppBATCheckFreq(float freq)
 	uint32_t SeqCmdBuff[2];
 	uint32_t SRAMAddr = 0;;
 	/* Step 1: Check Frequency */
-	if(freq < 0.51)
+	switch(AppBATFreqBand(freq))
 	{
+	case 0:
 		AppBATCfg.ADCSinc2Osr = ADCSINC2OSR_1067;
 		AppBATCfg.ADCSinc3Osr = ADCSINC3OSR_4;
 		AppBATCfg.DftSrc = DFTSRC_SINC2NOTCH;
-	}else if(freq < 5 )
-	{
+		break;
+	case 1:
 		AppBATCfg.ADCSinc2Osr = ADCSINC2OSR_640;
 		AppBATCfg.ADCSinc3Osr= ADCSINC3OSR_4;
 		AppBATCfg.DftSrc = DFTSRC_SINC2NOTCH;
-	}else if(freq <450)
-	{
+		break;
+	case 2:
 		AppBATCfg.ADCSinc2Osr = ADCSINC2OSR_178;
 		AppBATCfg.ADCSinc3Osr = ADCSINC3OSR_4;
 		AppBATCfg.DftSrc = DFTSRC_SINC2NOTCH;
-	}else if(freq < 80000)
-	{
+		break;
+	default:
 		AppBATCfg.ADCSinc3Osr = ADCSINC3OSR_4;
 		AppBATCfg.ADCSinc2Osr = ADCSINC2OSR_178;
 		AppBATCfg.DftSrc = DFTSRC_SINC3;
+		break;
 	}
 	/* Step 2: Adjust ADCFILTERCON  */
 	dsp_cfg.ADCBaseCfg.ADCMuxN = ADCMUXN_AIN2;
@@ -510,7 +560,7 @@ static AD5940Err AppBATRegModify(int32_t * const pData, uint32_t *pDataCount)
   if(AppBATCfg.NumOfData > 0)
   {
     AppBATCfg.FifoDataCount += *pDataCount/4;
-    if(AppBATCfg.FifoDataCount >= AppBATCfg.NumOfData)
+    if(AppBATCfg.FifoDataCount >= (uint32_t)AppBATCfg.NumOfData)
     {
       AD5940_WUPTCtrl(bFALSE);
       return AD5940ERR_OK;
@@ -529,9 +579,23 @@ static AD5940Err AppBATRegModify(int32_t * const pData, uint32_t *pDataCount)
   return AD5940ERR_OK;
 }
 
+/* Convert DFT result to int32_t type */
+static void AppBATDftConvert(int32_t * const pData, uint32_t DataCount)
+{
+  for(uint32_t i=0; i<DataCount; i++)
+  {
+    pData[i] &= 0x3ffff;
+    if(pData[i]&(1<<17)) /* Bit17 is sign bit */
+    {
+      pData[i] |= 0xfffc0000; /* Data is 18bit in two's complement, bit17 is the sign bit */
+    }
+  }
+}
+
 /* Depending on the data type, do appropriate data pre-process before return back to controller */
 static AD5940Err AppBATDataProcess(int32_t * const pData, uint32_t *pDataCount)
 {
+  AD5940Err error = AD5940ERR_OK;
   uint32_t DataCount = *pDataCount;
   uint32_t DftResCount = DataCount/2;
 
@@ -541,15 +605,7 @@ static AD5940Err AppBATDataProcess(int32_t * const pData, uint32_t *pDataCount)
   *pDataCount = 0;
   DataCount = (DataCount/2)*2;  /* We expect both Real and imaginary result.  */
 
-  /* Convert DFT result to int32_t type */
-  for(uint32_t i=0; i<DataCount; i++)
-  {
-    pData[i] &= 0x3ffff;
-    if(pData[i]&(1<<17)) /* Bit17 is sign bit */
-    {
-      pData[i] |= 0xfffc0000; /* Data is 18bit in two's complement, bit17 is the sign bit */
-    }
-  }
+  AppBATDftConvert(pData, DataCount);
   if(AppBATCfg.state == STATE_RCAL)
   {
     /* Calculate the average voltage. */
@@ -562,8 +618,14 @@ static AD5940Err AppBATDataProcess(int32_t * const pData, uint32_t *pDataCount)
     }
     AppBATCfg.RcalVolt.Real /= DftResCount;
     AppBATCfg.RcalVolt.Image /= DftResCount;
+    AppBATCfg.RcalVoltValid = bTRUE;
     *pDataCount = 0;  /* Report no result to upper application */
   }
+  else if(AppBATCfg.state == STATE_BATTERY && AppBATCfg.RcalVoltValid == bFALSE)
+  {
+    *pDataCount = 0;  /* No RCAL reference for this point, a stale one would give a wrong impedance */
+    error = AD5940ERR_APPERROR;
+  }
   else if(AppBATCfg.state == STATE_BATTERY)
   {
     for(uint32_t i=0; i<DftResCount; i++)
@@ -579,26 +641,31 @@ static AD5940Err AppBATDataProcess(int32_t * const pData, uint32_t *pDataCount)
 		//	printf("i: %d , %.2f , %.2f , %.2f , %.2f , %.2f , %.2f , %.2f\n",AppBATCfg.SweepCfg.SweepIndex, AppBATCfg.SweepCurrFreq, BatImp.Real, BatImp.Image, AppBATCfg.RcalVolt.Real, AppBATCfg.RcalVolt.Image, AppBATCfg.RcalVoltTable[AppBATCfg.SweepCfg.SweepIndex][0], AppBATCfg.RcalVoltTable[AppBATCfg.SweepCfg.SweepIndex][1]);
     }
     *pDataCount = DftResCount;
+    if(AppBATCfg.SweepCfg.SweepEn == bFALSE)
+      RcalStoreSweepDone(&AppBATCfg.RcalStore);   /* Without sweep every point counts as one sweep */
   }
 	/* Calculate next frequency point */
 		if(AppBATCfg.SweepCfg.SweepEn == bTRUE)
 		{
 			AppBATCfg.FreqofData = AppBATCfg.SweepCurrFreq;
+			AppBATCfg.IndexofData = (AppBATCfg.SweepCfg.SweepIndex + AppBATCfg.SweepCfg.SweepPoints - 1)%AppBATCfg.SweepCfg.SweepPoints;
 			AppBATCfg.SweepCurrFreq = AppBATCfg.SweepNextFreq;
 			if(AppBATCfg.state == STATE_BATTERY)
 			{
-				AppBATCfg.RcalVolt.Real = AppBATCfg.RcalVoltTable[AppBATCfg.SweepCfg.SweepIndex][0];
-				AppBATCfg.RcalVolt.Image = AppBATCfg.RcalVoltTable[AppBATCfg.SweepCfg.SweepIndex][1];
+				if(AppBATCfg.SweepCfg.SweepIndex == 0)   /* Wrapped to the first point, one sweep is done */
+					RcalStoreSweepDone(&AppBATCfg.RcalStore);
+				AppBATCfg.RcalVoltValid = RcalStoreLookup(&AppBATCfg.RcalStore, AppBATCfg.SweepCurrFreq, AppBATFreqBand(AppBATCfg.SweepCurrFreq), &AppBATCfg.RcalVolt) == AD5940ERR_OK ? bTRUE : bFALSE;
 			}
 			AD5940_SweepNext(&AppBATCfg.SweepCfg, &AppBATCfg.SweepNextFreq);		
 		}
-  return AD5940ERR_OK;
+  return error;
 }
 
 /**
 */
 AD5940Err AppBATISR(void *pBuff, uint32_t *pCount)
 {
+  AD5940Err error;
   uint32_t FifoCnt;
   if(AppBATCfg.BATInited == bFALSE)
     return AD5940ERR_APPERROR;
@@ -617,44 +684,137 @@ AD5940Err AppBATISR(void *pBuff, uint32_t *pCount)
     //AD5940_EnterSleepS();  /* Manually put AFE back to hibernate mode. */
     AD5940_SleepKeyCtrlS(SLPKEY_UNLOCK);  /* Allow AFE to enter hibernate mode */
     /* Process data */ 
-    AppBATDataProcess((int32_t*)pBuff,&FifoCnt); 
+    error = AppBATDataProcess((int32_t*)pBuff,&FifoCnt); 
     *pCount = FifoCnt;
-    return 0;
+    return error;
   }
   
   return 0;
 }
 
+/* Measure RCAL response at one frequency. AFE is already switched to RCAL by BATCTRL_MRCAL. */
+static AD5940Err AppBATMeasureRCALPoint(float freq, fImpCar_Type *pVolt)
+{
+  uint32_t buff[32];
+  uint32_t FifoCnt;
+  iImpCar_Type *pDft = (iImpCar_Type*)buff;
+
+  AD5940_WGFreqCtrlS(freq, AppBATCfg.SysClkFreq);
+  AppBATCheckFreq(freq);
+  AD5940_SEQMmrTrig(SEQID_0);
+  while(AD5940_INTCTestFlag(AFEINTC_1, AFEINTSRC_DATAFIFOTHRESH) == bFALSE);
+  FifoCnt = (AD5940_FIFOGetCnt()/2)*2;
+  if(FifoCnt > 32) FifoCnt = 32;
+  AD5940_FIFORd(buff, FifoCnt);
+  AD5940_INTCClrFlag(AFEINTSRC_DATAFIFOTHRESH);
+  if(FifoCnt == 0)
+    return AD5940ERR_ERROR;
+  AppBATDftConvert((int32_t*)buff, FifoCnt);
+  /* Calculate the average voltage. */
+  pVolt->Real = 0;
+  pVolt->Image = 0;
+  for(uint32_t i=0;i<FifoCnt/2;i++)
+  {
+    pVolt->Real += pDft[i].Real;
+    pVolt->Image += pDft[i].Image;
+  }
+  pVolt->Real /= FifoCnt/2;
+  pVolt->Image /= FifoCnt/2;
+  return AD5940ERR_OK;
+}
+
+static AD5940Err AppBATMeasureRCALAnchor(uint32_t index, float freq, uint32_t band)
+{
+  fImpCar_Type RcalVolt;
+  AD5940Err error;
+
+  error = AppBATMeasureRCALPoint(freq, &RcalVolt);
+  if(error != AD5940ERR_OK)
+    return error;
+  printf("i: %lu   Freq: %.2f  RcalVolt:(%f,%f)\n", (unsigned long)index, freq, RcalVolt.Real, RcalVolt.Image);
+  AD5940_Delay10us(10000);
+  return RcalStoreAdd(&AppBATCfg.RcalStore, freq, band, &RcalVolt);
+}
+
+/**
+  Continue with the first point of SweepCfg instead of the point that follows. Used to load
+  a new frequency list between two points of a running measurement. The measurement is
+  triggered by MCU, so only the excitation frequency and RCAL reference need to change.
+*/
+AD5940Err AppBATSweepRestart(void)
+{
+  AD5940Err error;
+
+  if(AppBATCfg.SweepCfg.SweepEn == bFALSE)
+    return AD5940ERR_OK;
+  if(AD5940_WakeUp(10) > 10)
+    return AD5940ERR_WAKEUP;
+  AppBATCfg.SweepCfg.SweepIndex = 0;
+  AppBATCfg.SweepCurrFreq = AD5940_SweepFirstFreq(&AppBATCfg.SweepCfg);
+  AD5940_SweepNext(&AppBATCfg.SweepCfg, &AppBATCfg.SweepNextFreq);
+  AD5940_WGFreqCtrlS(AppBATCfg.SweepCurrFreq, AppBATCfg.SysClkFreq);
+  AppBATCheckFreq(AppBATCfg.SweepCurrFreq);
+  error = RcalStoreLookup(&AppBATCfg.RcalStore, AppBATCfg.SweepCurrFreq, AppBATFreqBand(AppBATCfg.SweepCurrFreq), &AppBATCfg.RcalVolt);
+  AppBATCfg.RcalVoltValid = error == AD5940ERR_OK ? bTRUE : bFALSE;
+  return error;
+}
+
+/**
+  Measure RCAL response. With sweep enabled only every RcalAnchorStep point and both
+  sides of a filter band change are measured, other points are interpolated from the
+  store. Result is kept until RcalStoreIsStale reports it is outdated.
+*/
 AD5940Err AppBATMeasureRCAL(void)
 {
-	uint32_t buff[100];
-	uint32_t temp;
+	AD5940Err error = AD5940ERR_OK;
 	AD5940_INTCCfg(AFEINTC_0, AFEINTSRC_DATAFIFOTHRESH, bFALSE); /* Disable INT0 interrupt for RCAL measurement. */
 	AppBATCfg.state = STATE_RCAL;
+	AppBATCfg.RcalVoltValid = bFALSE;
+	RcalStoreClear(&AppBATCfg.RcalStore, AppBATCfg.TempDegC);
 	if(AppBATCfg.SweepCfg.SweepEn)
 	{
+		SoftSweepCfg_Type sweep = AppBATCfg.SweepCfg;
+		uint32_t step = AppBATCfg.RcalAnchorStep?AppBATCfg.RcalAnchorStep:1;
+		float freq = AD5940_SweepFirstFreq(&sweep), PrevFreq = 0;
+		uint32_t band, PrevBand = 0;
+		BoolFlag bAnchor, bPrevAnchor = bTRUE;
 		uint32_t i;
-    for(i=0;i<AppBATCfg.SweepCfg.SweepPoints;i++)
-    {
-      AD5940_SEQMmrTrig(SEQID_0);
-			while(AD5940_INTCTestFlag(AFEINTC_1, AFEINTSRC_DATAFIFOTHRESH) == bFALSE);
-			printf("i: %lu   Freq: %.2f ",AppBATCfg.SweepCfg.SweepIndex, AppBATCfg.SweepCurrFreq);
-			AppBATISR(buff, &temp);
-			AppBATCfg.RcalVoltTable[i][0] = AppBATCfg.RcalVolt.Real;
-			AppBATCfg.RcalVoltTable[i][1] = AppBATCfg.RcalVolt.Image;
-			printf(" RcalVolt:(%f,%f)\n",  AppBATCfg.RcalVoltTable[i][0], AppBATCfg.RcalVoltTable[i][1]);
-			AD5940_Delay10us(10000);
-    }
-		AppBATCfg.RcalVolt.Real = AppBATCfg.RcalVoltTable[0][0];
-		AppBATCfg.RcalVolt.Image = AppBATCfg.RcalVoltTable[0][1];
+
+		sweep.SweepIndex = 0;
+		for(i=0;i<sweep.SweepPoints;i++)
+		{
+			band = AppBATFreqBand(freq);
+			bAnchor = ((i%step) == 0 || i == sweep.SweepPoints-1)?bTRUE:bFALSE;
+			if(i > 0 && band != PrevBand)
+			{
+				/* Filter settings change here, measure both sides of the edge */
+				if(bPrevAnchor == bFALSE)
+					error = AppBATMeasureRCALAnchor(i-1, PrevFreq, PrevBand);
+				bAnchor = bTRUE;
+			}
+			if(error == AD5940ERR_OK && bAnchor == bTRUE)
+				error = AppBATMeasureRCALAnchor(i, freq, band);
+			if(error != AD5940ERR_OK)
+				break;
+			bPrevAnchor = bAnchor;
+			PrevFreq = freq;
+			PrevBand = band;
+			AD5940_SweepNext(&sweep, &freq);
+		}
+		/* Restore the frequency battery measurement continues with */
+		AD5940_WGFreqCtrlS(AppBATCfg.SweepCurrFreq, AppBATCfg.SysClkFreq);
+		AppBATCheckFreq(AppBATCfg.SweepCurrFreq);
+		if(error == AD5940ERR_OK)
+			error = RcalStoreLookup(&AppBATCfg.RcalStore, AppBATCfg.SweepCurrFreq, AppBATFreqBand(AppBATCfg.SweepCurrFreq), &AppBATCfg.RcalVolt);
 	}else
 	{
-		AD5940_SEQMmrTrig(SEQID_0);
-		while(AD5940_INTCTestFlag(AFEINTC_1, AFEINTSRC_DATAFIFOTHRESH) == bFALSE);
-		AppBATISR(buff, &temp);
+		error = AppBATMeasureRCALPoint(AppBATCfg.SinFreq, &AppBATCfg.RcalVolt);
+		if(error == AD5940ERR_OK)
+			error = RcalStoreAdd(&AppBATCfg.RcalStore, AppBATCfg.SinFreq, AppBATFreqBand(AppBATCfg.SinFreq), &AppBATCfg.RcalVolt);
 	}
+	AppBATCfg.RcalVoltValid = error == AD5940ERR_OK ? bTRUE : bFALSE;
 	AD5940_INTCCfg(AFEINTC_0, AFEINTSRC_DATAFIFOTHRESH, bTRUE);
-	return 0;
+	return error;
 }
 
 /**
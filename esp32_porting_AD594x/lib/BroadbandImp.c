@@ -0,0 +1,251 @@
+/*!
+ *****************************************************************************
+ @file:    BroadbandImp.c
+ @brief:   Broadband impedance from one periodic excitation and raw ADC samples.
+ -----------------------------------------------------------------------------
+
+ Host_Tools/eis_bb computes the spectra from a captured stream.
+
+*****************************************************************************/
+#include "BroadbandImp.h"
+#include "AdcStream.h"
+#include "AppMain.h"
+
+#define BBIMP_TRAPZ_DIV       50      /* SysClk cycles per trapezoid DAC update */
+#define BBIMP_TRAPZ_MAX       0xFFFFF /* Delay and slope registers */
+
+AppBBCfg_Type AppBBCfg =
+{
+  .Freq = 1.0f,
+  .DacVoltPP = 800.0f,
+  .SlopeFrac = 0.01f,
+  .Periods = 4,
+  .SettlePeriods = 1,
+  .Cycles = 0,
+  .SysClkFreq = 16000000.0f,
+  .RcalVal = 10000.0f,
+
+  .DswitchSel = SWD_CE0,
+  .PswitchSel = SWP_AIN1,
+  .NswitchSel = SWN_AIN3,
+  .TswitchSel = SWT_AIN2,
+
+  .HstiaRtiaSel = HSTIARTIA_5K,
+  .ExcitBufGain = EXCITBUFGAIN_2,
+  .HsDacGain = HSDACGAIN_1,
+  .AdcPgaGain = ADCPGA_1,
+  .ADCSinc3Osr = ADCSINC3OSR_5,
+  .ADCSinc2Osr = ADCSINC2OSR_640,     /* 250SPS */
+  .pStream = 0,
+  .bRunning = bFALSE,
+};
+
+int32_t AppBBGetCfg(void *pCfg)
+{
+  if(pCfg)
+  {
+    *(AppBBCfg_Type**)pCfg = &AppBBCfg;
+    return AD5940ERR_OK;
+  }
+  return AD5940ERR_PARA;
+}
+
+/* SysClk cycles per ADC sample at the 800kHz ADC rate */
+static uint32_t AppBBSampleClocks(void)
+{
+  static const uint16_t sinc2_osr[] = {22, 44, 89, 178, 267, 533, 640, 667, 800, 889, 1067, 1333};
+  uint32_t osr3 = AppBBCfg.ADCSinc3Osr == ADCSINC3OSR_2 ? 2 : AppBBCfg.ADCSinc3Osr == ADCSINC3OSR_4 ? 4 : 5;
+
+  if(AppBBCfg.ADCSinc2Osr >= sizeof(sinc2_osr)/sizeof(sinc2_osr[0]))
+    return 0;
+  return 20*osr3*sinc2_osr[AppBBCfg.ADCSinc2Osr];
+}
+
+/* Record boundary: label following samples and switch RCAL or DUT in */
+static void AppBBSwitch(void)
+{
+  AppBBCfg_Type *pCfg = &AppBBCfg;
+  AppADCStreamCfg_Type *pStreamCfg;
+  SWMatrixCfg_Type sw_cfg;
+
+  AppADCStreamGetCfg(&pStreamCfg);
+  if(pCfg->Record & 1)
+  {
+    AppADCStreamChannel(BBIMP_CH_DUT);
+    sw_cfg.Dswitch = pCfg->DswitchSel;
+    sw_cfg.Pswitch = pCfg->PswitchSel;
+    sw_cfg.Nswitch = pCfg->NswitchSel;
+    sw_cfg.Tswitch = SWT_TRTIA|pCfg->TswitchSel;
+  }
+  else
+  {
+    AppADCStreamChannel(BBIMP_CH_RCAL);
+    sw_cfg.Dswitch = SWD_RCAL0;
+    sw_cfg.Pswitch = SWP_RCAL0;
+    sw_cfg.Nswitch = SWN_RCAL1;
+    sw_cfg.Tswitch = SWT_RCAL1|SWT_TRTIA;
+  }
+  AD5940_SWMatrixCfgS(&sw_cfg);
+  pCfg->RecordEnd = pStreamCfg->Index + (uint64_t)(pCfg->SettlePeriods + pCfg->Periods + 1)*pCfg->PeriodSamples;
+}
+
+/**
+ * @brief Set up excitation, HSTIA and ADC stream. Freq is rounded to a whole number of samples per period.
+ * @return AD5940ERR_PARA if the period does not fit the trapezoid registers or there is no encoder.
+*/
+AD5940Err AppBBInit(void)
+{
+  AppBBCfg_Type *pCfg = &AppBBCfg;
+  AppADCStreamCfg_Type *pStreamCfg;
+  HSLoopCfg_Type HsLoopCfg;
+  AD5940Err error;
+  uint32_t clocks, step, updates, slope, half, a, b, t;
+  float rate;
+
+  clocks = AppBBSampleClocks();
+  if(clocks == 0 || pCfg->pStream == 0 || !(pCfg->Freq > 0) || pCfg->Periods == 0 ||
+     !(pCfg->SlopeFrac >= 0) || !(pCfg->SlopeFrac < 0.5f))
+    return AD5940ERR_PARA;
+  /* Samples per period must be a multiple of step for a whole number of DAC updates */
+  a = clocks;
+  b = BBIMP_TRAPZ_DIV;
+  while(b)
+  {
+    t = a%b;
+    a = b;
+    b = t;
+  }
+  step = BBIMP_TRAPZ_DIV/a;
+  rate = pCfg->SysClkFreq/clocks;
+  pCfg->PeriodSamples = (uint32_t)(rate/pCfg->Freq/step + 0.5f)*step;
+  if(pCfg->PeriodSamples < 2*step)
+    pCfg->PeriodSamples = 2*step;
+  updates = (uint32_t)((uint64_t)pCfg->PeriodSamples*clocks/BBIMP_TRAPZ_DIV);
+  slope = (uint32_t)(updates*pCfg->SlopeFrac + 0.5f);
+  if(slope == 0)
+    slope = 1;
+  half = updates/2;
+  if(slope >= half || half - slope > BBIMP_TRAPZ_MAX || updates - half - slope > BBIMP_TRAPZ_MAX)
+    return AD5940ERR_PARA;
+  pCfg->Freq = rate/pCfg->PeriodSamples;
+
+  AppADCStreamGetCfg(&pStreamCfg);
+  pStreamCfg->Source = FIFOSRC_SINC2NOTCH;
+  pStreamCfg->ADCMuxP = ADCMUXP_HSTIA_P;
+  pStreamCfg->ADCMuxN = ADCMUXN_HSTIA_N;
+  pStreamCfg->ADCPga = pCfg->AdcPgaGain;
+  pStreamCfg->ADCRate = ADCRATE_800KHZ;
+  pStreamCfg->ADCSinc3Osr = pCfg->ADCSinc3Osr;
+  pStreamCfg->ADCSinc2Osr = pCfg->ADCSinc2Osr;
+  pStreamCfg->BpNotch = bTRUE;
+  /* Drains often enough to switch within a small part of a period */
+  pStreamCfg->FifoThresh = pCfg->PeriodSamples/8 < 3 ? 3 : pCfg->PeriodSamples/8 > 1023 ? 1023 : pCfg->PeriodSamples/8;
+  pStreamCfg->pStream = pCfg->pStream;
+  AD5940_AFECtrlS(AFECTRL_ALL, bFALSE);
+  error = AppADCStreamInit();
+  if(error != AD5940ERR_OK)
+    return error;
+
+  HsLoopCfg.HsDacCfg.ExcitBufGain = pCfg->ExcitBufGain;
+  HsLoopCfg.HsDacCfg.HsDacGain = pCfg->HsDacGain;
+  HsLoopCfg.HsDacCfg.HsDacUpdateRate = 7;
+  HsLoopCfg.HsTiaCfg.DiodeClose = bFALSE;
+  HsLoopCfg.HsTiaCfg.HstiaBias = HSTIABIAS_1P1;
+  HsLoopCfg.HsTiaCfg.HstiaCtia = 31; /* 31pF + 2pF */
+  HsLoopCfg.HsTiaCfg.HstiaDeRload = HSTIADERLOAD_OPEN;
+  HsLoopCfg.HsTiaCfg.HstiaDeRtia = HSTIADERTIA_OPEN;
+  HsLoopCfg.HsTiaCfg.HstiaRtiaSel = pCfg->HstiaRtiaSel;
+  HsLoopCfg.SWMatCfg.Dswitch = SWD_RCAL0;
+  HsLoopCfg.SWMatCfg.Pswitch = SWP_RCAL0;
+  HsLoopCfg.SWMatCfg.Nswitch = SWN_RCAL1;
+  HsLoopCfg.SWMatCfg.Tswitch = SWT_RCAL1|SWT_TRTIA;
+  HsLoopCfg.WgCfg.WgType = WGTYPE_TRAPZ;
+  HsLoopCfg.WgCfg.GainCalEn = bTRUE;
+  HsLoopCfg.WgCfg.OffsetCalEn = bTRUE;
+  a = (uint32_t)(pCfg->DacVoltPP/800.0f*2047 + 0.5f);   /* Half the step, as SinAmplitudeWord */
+  if(a > 2047)
+    a = 2047;
+  HsLoopCfg.WgCfg.TrapzCfg.WGTrapzDCLevel1 = 0x800 - a;
+  HsLoopCfg.WgCfg.TrapzCfg.WGTrapzDCLevel2 = 0x800 + a;
+  HsLoopCfg.WgCfg.TrapzCfg.WGTrapzDelay1 = half - slope;
+  HsLoopCfg.WgCfg.TrapzCfg.WGTrapzSlope1 = slope;
+  HsLoopCfg.WgCfg.TrapzCfg.WGTrapzDelay2 = updates - half - slope;
+  HsLoopCfg.WgCfg.TrapzCfg.WGTrapzSlope2 = slope;
+  HsLoopCfg.WgCfg.WgCode = 0;
+  HsLoopCfg.WgCfg.SinCfg.SinFreqWord = 0;
+  HsLoopCfg.WgCfg.SinCfg.SinAmplitudeWord = 0;
+  HsLoopCfg.WgCfg.SinCfg.SinOffsetWord = 0;
+  HsLoopCfg.WgCfg.SinCfg.SinPhaseWord = 0;
+  AD5940_HSLoopCfgS(&HsLoopCfg);
+  AD5940_AFECtrlS(AFECTRL_HSTIAPWR|AFECTRL_INAMPPWR|AFECTRL_EXTBUFPWR|\
+                  AFECTRL_DACREFPWR|AFECTRL_HSDACPWR, bTRUE);
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Start the excitation and the first RCAL record.
+*/
+AD5940Err AppBBStart(void)
+{
+  AppBBCfg_Type *pCfg = &AppBBCfg;
+  AD5940Err error;
+
+  pCfg->CycleCount = 0;
+  pCfg->Record = 0;
+  AD5940_AFECtrlS(AFECTRL_WG, bTRUE);
+  error = AppADCStreamStart();
+  if(error != AD5940ERR_OK)
+  {
+    AD5940_AFECtrlS(AFECTRL_WG, bFALSE);
+    return error;
+  }
+  AppBBSwitch();
+  pCfg->bRunning = bTRUE;
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Stream samples and switch between RCAL and DUT at the end of each record. Call this in a loop.
+ * @return APPPOLL_SWEEPEND when a record pair is finished, APPPOLL_DONE after Cycles pairs,
+ *         otherwise as AppADCStreamPoll().
+*/
+int32_t AppBBPoll(void)
+{
+  AppBBCfg_Type *pCfg = &AppBBCfg;
+  AppADCStreamCfg_Type *pStreamCfg;
+  int32_t ret;
+
+  if(pCfg->bRunning == bFALSE)
+    return APPPOLL_IDLE;
+  AppADCStreamGetCfg(&pStreamCfg);
+  ret = AppADCStreamPoll();
+  if(pStreamCfg->Index < pCfg->RecordEnd)
+    return ret;
+  pCfg->Record++;
+  if((pCfg->Record & 1) == 0)
+  {
+    pCfg->CycleCount++;
+    if(pCfg->Cycles && pCfg->CycleCount >= pCfg->Cycles)
+    {
+      AppBBStop();
+      return APPPOLL_DONE;
+    }
+  }
+  AppBBSwitch();
+  return (pCfg->Record & 1) ? APPPOLL_DATA : APPPOLL_SWEEPEND;
+}
+
+/**
+ * @brief Stop excitation and stream, everything captured is sent.
+*/
+void AppBBStop(void)
+{
+  AppBBCfg_Type *pCfg = &AppBBCfg;
+
+  if(pCfg->bRunning == bFALSE)
+    return;
+  AppADCStreamStop();
+  AD5940_AFECtrlS(AFECTRL_HSTIAPWR|AFECTRL_INAMPPWR|AFECTRL_EXTBUFPWR|\
+                  AFECTRL_WG|AFECTRL_DACREFPWR|AFECTRL_HSDACPWR, bFALSE);
+  pCfg->bRunning = bFALSE;
+}
@@ -0,0 +1,376 @@
+/*!
+ *****************************************************************************
+ @file:    CalCache.c
+ @brief:   Persisted cache for AD5940 calibration results.
+ -----------------------------------------------------------------------------
+
+ ADC PGA and HSDAC calibrations end up in AFE calibration registers, so
+ applying a cached result is only a few register writes. RTIA and LPDAC
+ results are returned to the caller like the calibration functions do.
+
+*****************************************************************************/
+#include "CalCache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "string.h"
+#include "math.h"
+#ifdef ESP_PLATFORM
+#include "nvs.h"
+#define CALCACHE_NVS_NAMESPACE  "calcache"
+#endif
+
+#define CALCACHE_MAGIC      0x43414C43    /* 'CALC' */
+#define CALCACHE_VERSION    1
+
+typedef struct
+{
+  uint32_t Magic;
+  uint32_t Version;
+  uint32_t Generation;
+  uint32_t EntrySize;         /* Catch layout changes between firmware builds */
+}CalCacheHeader_Type;
+
+static const struct
+{
+  uint16_t gain_reg;
+  uint16_t offset_reg;
+}CalCachePgaReg[] = {
+  {REG_AFE_ADCGAINGN1,REG_AFE_ADCOFFSETGN1},
+  {REG_AFE_ADCGAINGN1P5,REG_AFE_ADCOFFSETGN1P5},
+  {REG_AFE_ADCGAINGN2,REG_AFE_ADCOFFSETGN2},
+  {REG_AFE_ADCGAINGN4,REG_AFE_ADCOFFSETGN4},
+  {REG_AFE_ADCGAINGN9,REG_AFE_ADCOFFSETGN9},
+};
+
+/* Same register selection as AD5940_HSDACCal */
+static uint32_t CalCacheDacReg(HSDACCal_Type *pCalCfg)
+{
+  BoolFlag bHPMode = pCalCfg->AfePwrMode == AFEPWR_HP?bTRUE:bFALSE;
+  if(pCalCfg->ExcitBufGain == EXCITBUFGAIN_2)
+    return bHPMode?REG_AFE_DACOFFSETHP:REG_AFE_DACOFFSET;
+  return bHPMode?REG_AFE_DACOFFSETATTENHP:REG_AFE_DACOFFSETATTEN;
+}
+
+/* Frequency decade used as band of RTIA results */
+static uint32_t CalCacheFreqBand(float Freq)
+{
+  if(Freq < 1.0f)
+    return 0;
+  return (uint32_t)log10f(Freq) + 1;
+}
+
+AD5940Err CalCacheInit(CalCache_Type *pCache, const char *pName)
+{
+  if(pCache == NULL || pName == NULL) return AD5940ERR_NULLP;
+  memset(pCache, 0, sizeof(CalCache_Type));
+  strncpy(pCache->Name, pName, CALCACHE_NAME_LEN-1);
+  pCache->MaxGeneration = 20;
+  pCache->MaxTempDrift = 5.0f;
+  pCache->TempDegC = NAN;
+  pCache->ChipId = AD5940_ReadReg(REG_AFECON_CHIPID);
+  return AD5940ERR_OK;
+}
+
+void CalCacheSetTemp(CalCache_Type *pCache, float TempDegC)
+{
+  pCache->TempDegC = TempDegC;
+}
+
+static BoolFlag CalCacheIsStale(CalCache_Type *pCache, CalEntry_Type *pEntry)
+{
+  if(pCache->MaxGeneration != 0 && pCache->Generation - pEntry->Generation >= pCache->MaxGeneration)
+    return bTRUE;
+  if(pCache->MaxTempDrift > 0.0f && !isnan(pCache->TempDegC) && !isnan(pEntry->TempDegC))
+  {
+    if(fabsf(pCache->TempDegC - pEntry->TempDegC) > pCache->MaxTempDrift)
+      return bTRUE;
+  }
+  return bFALSE;
+}
+
+/* Find entry of this key, or a slot for it. The oldest entry is replaced when the table is full. */
+static CalEntry_Type *CalCacheFind(CalCache_Type *pCache, uint32_t Type, uint32_t Rtia, uint32_t Gain, uint32_t Band, BoolFlag *pbFound)
+{
+  CalEntry_Type *pFree = NULL, *pOldest = &pCache->Entry[0];
+
+  for(uint32_t i=0; i<CALCACHE_MAX_ENTRY; i++)
+  {
+    CalEntry_Type *pEntry = &pCache->Entry[i];
+    if(pEntry->Type == CALTYPE_NONE)
+    {
+      if(pFree == NULL) pFree = pEntry;
+      continue;
+    }
+    if(pEntry->Type == Type && pEntry->Rtia == Rtia && pEntry->Gain == Gain &&\
+       pEntry->Band == Band && pEntry->ChipId == pCache->ChipId)
+    {
+      *pbFound = bTRUE;
+      return pEntry;
+    }
+    if(pEntry->Generation < pOldest->Generation)
+      pOldest = pEntry;
+  }
+  *pbFound = bFALSE;
+  return pFree?pFree:pOldest;
+}
+
+/* Run calibration of the entry with its stored settings. The entry keeps its old result if calibration fails */
+static AD5940Err CalCacheRun(CalCache_Type *pCache, CalEntry_Type *pEntry)
+{
+  AD5940Err error = AD5940ERR_PARA;
+  CalEntry_Type entry = *pEntry;
+
+  switch(entry.Type)
+  {
+    case CALTYPE_ADCPGA:
+      error = AD5940_ADCPGACal(&entry.Cfg.AdcPga);
+      if(error == AD5940ERR_OK)
+      {
+        entry.Result.Reg[0] = AD5940_ReadReg(CalCachePgaReg[entry.Cfg.AdcPga.ADCPga].gain_reg);
+        entry.Result.Reg[1] = AD5940_ReadReg(CalCachePgaReg[entry.Cfg.AdcPga.ADCPga].offset_reg);
+      }
+    break;
+    case CALTYPE_HSDAC:
+      error = AD5940_HSDACCal(&entry.Cfg.HsDac);
+      if(error == AD5940ERR_OK)
+        entry.Result.Reg[0] = AD5940_ReadReg(CalCacheDacReg(&entry.Cfg.HsDac));
+    break;
+    case CALTYPE_HSRTIA:
+      entry.Cfg.HsRtia.bPolarResult = bFALSE;   /* Always store cartesian result */
+      error = AD5940_HSRtiaCal(&entry.Cfg.HsRtia, &entry.Result.Rtia);
+    break;
+    case CALTYPE_LPDAC:
+      error = AD5940_LPDACCal(&entry.Cfg.LpDac, &entry.Result.LpDac);
+    break;
+    default:
+    break;
+  }
+  pEntry->bPending = bFALSE;
+  if(error == AD5940ERR_OK)
+  {
+    entry.bPending = bFALSE;
+    entry.Generation = pCache->Generation;
+    entry.TempDegC = pCache->TempDegC;
+    *pEntry = entry;
+    pCache->bDirty = bTRUE;
+  }
+  return error;
+}
+
+/* Write cached calibration registers back to AFE */
+static void CalCacheApply(CalEntry_Type *pEntry)
+{
+  AD5940_WriteReg(REG_AFE_CALDATLOCK, KEY_CALDATLOCK);  /* Unlock KEY */
+  if(pEntry->Type == CALTYPE_ADCPGA)
+  {
+    AD5940_WriteReg(CalCachePgaReg[pEntry->Cfg.AdcPga.ADCPga].gain_reg, pEntry->Result.Reg[0]);
+    AD5940_WriteReg(CalCachePgaReg[pEntry->Cfg.AdcPga.ADCPga].offset_reg, pEntry->Result.Reg[1]);
+  }
+  else if(pEntry->Type == CALTYPE_HSDAC)
+    AD5940_WriteReg(CalCacheDacReg(&pEntry->Cfg.HsDac), pEntry->Result.Reg[0]);
+  AD5940_WriteReg(REG_AFE_CALDATLOCK, 0);  /* Lock KEY */
+}
+
+/* Use cached result if there is one, otherwise calibrate now. Stale results are used and queued for recalibration. */
+static AD5940Err CalCacheGet(CalCache_Type *pCache, uint32_t Type, uint32_t Rtia, uint32_t Gain, uint32_t Band,
+                             const void *pCalCfg, uint32_t CfgSize, CalEntry_Type **ppEntry)
+{
+  AD5940Err error;
+  BoolFlag bFound;
+  CalEntry_Type entry, *pEntry = CalCacheFind(pCache, Type, Rtia, Gain, Band, &bFound);
+
+  *ppEntry = pEntry;
+  if(bFound == bTRUE)
+  {
+    memcpy(&pEntry->Cfg, pCalCfg, CfgSize);   /* Recalibration uses latest settings */
+    CalCacheApply(pEntry);
+    if(CalCacheIsStale(pCache, pEntry) == bTRUE)
+      pEntry->bPending = bTRUE;
+    return AD5940ERR_OK;
+  }
+  /* Calibrate into a new entry. The slot, possibly holding the oldest good result, is only replaced on success */
+  memset(&entry, 0, sizeof(entry));
+  entry.Type = Type;
+  entry.Rtia = Rtia;
+  entry.Gain = Gain;
+  entry.Band = Band;
+  entry.ChipId = pCache->ChipId;
+  memcpy(&entry.Cfg, pCalCfg, CfgSize);
+  error = CalCacheRun(pCache, &entry);
+  if(error == AD5940ERR_OK)
+    *pEntry = entry;
+  return error;
+}
+
+AD5940Err CalCacheADCPGA(CalCache_Type *pCache, ADCPGACal_Type *pCalCfg)
+{
+  CalEntry_Type *pEntry;
+
+  if(pCache == NULL || pCalCfg == NULL) return AD5940ERR_NULLP;
+  if(pCalCfg->ADCPga > ADCPGA_9) return AD5940ERR_PARA;
+  return CalCacheGet(pCache, CALTYPE_ADCPGA, 0, pCalCfg->ADCPga, pCalCfg->AdcClkFreq > (32000000*0.8),
+                     pCalCfg, sizeof(ADCPGACal_Type), &pEntry);
+}
+
+AD5940Err CalCacheHSDAC(CalCache_Type *pCache, HSDACCal_Type *pCalCfg)
+{
+  CalEntry_Type *pEntry;
+
+  if(pCache == NULL || pCalCfg == NULL) return AD5940ERR_NULLP;
+  if(pCalCfg->ExcitBufGain > 1 || pCalCfg->HsDacGain > 1) return AD5940ERR_PARA;
+  return CalCacheGet(pCache, CALTYPE_HSDAC, 0, (pCalCfg->ExcitBufGain<<4)|pCalCfg->HsDacGain, pCalCfg->AfePwrMode,
+                     pCalCfg, sizeof(HSDACCal_Type), &pEntry);
+}
+
+AD5940Err CalCacheHSRtia(CalCache_Type *pCache, HSRTIACal_Type *pCalCfg, void *pResult)
+{
+  AD5940Err error;
+  CalEntry_Type *pEntry;
+
+  if(pCache == NULL || pCalCfg == NULL || pResult == NULL) return AD5940ERR_NULLP;
+  error = CalCacheGet(pCache, CALTYPE_HSRTIA, pCalCfg->HsTiaCfg.HstiaRtiaSel, 0, CalCacheFreqBand(pCalCfg->fFreq),
+                      pCalCfg, sizeof(HSRTIACal_Type), &pEntry);
+  if(error != AD5940ERR_OK)
+    return error;
+  if(pCalCfg->bPolarResult == bFALSE)
+    *(fImpCar_Type*)pResult = pEntry->Result.Rtia;
+  else
+  {
+    ((fImpPol_Type*)pResult)->Magnitude = AD5940_ComplexMag(&pEntry->Result.Rtia);
+    ((fImpPol_Type*)pResult)->Phase = AD5940_ComplexPhase(&pEntry->Result.Rtia);
+  }
+  return AD5940ERR_OK;
+}
+
+AD5940Err CalCacheLPDAC(CalCache_Type *pCache, LPDACCal_Type *pCalCfg, LPDACPara_Type *pResult)
+{
+  AD5940Err error;
+  CalEntry_Type *pEntry;
+
+  if(pCache == NULL || pCalCfg == NULL || pResult == NULL) return AD5940ERR_NULLP;
+  error = CalCacheGet(pCache, CALTYPE_LPDAC, pCalCfg->LpdacSel, 0, 0, pCalCfg, sizeof(LPDACCal_Type), &pEntry);
+  if(error == AD5940ERR_OK)
+    *pResult = pEntry->Result.LpDac;
+  return error;
+}
+
+BoolFlag CalCachePending(CalCache_Type *pCache)
+{
+  for(uint32_t i=0; i<CALCACHE_MAX_ENTRY; i++)
+  {
+    if(pCache->Entry[i].Type != CALTYPE_NONE && pCache->Entry[i].bPending == bTRUE)
+      return bTRUE;
+  }
+  return bFALSE;
+}
+
+/**
+ * @brief Recalibrate one queued stale entry.
+ * @note Calibration reconfigures the AFE. Call it only when the application is idle and
+ *       restore application settings afterwards if it returns bTRUE.
+ * @return bTRUE if a calibration was run.
+*/
+BoolFlag CalCacheService(CalCache_Type *pCache)
+{
+  for(uint32_t i=0; i<CALCACHE_MAX_ENTRY; i++)
+  {
+    CalEntry_Type *pEntry = &pCache->Entry[i];
+    if(pEntry->Type != CALTYPE_NONE && pEntry->bPending == bTRUE)
+    {
+      if(CalCacheRun(pCache, pEntry) != AD5940ERR_OK)
+        CalCacheApply(pEntry);    /* Keep the old result */
+      return bTRUE;
+    }
+  }
+  return bFALSE;
+}
+
+AD5940Err CalCacheLoad(CalCache_Type *pCache)
+{
+  CalCacheHeader_Type *pHeader;
+  uint32_t size = sizeof(CalCacheHeader_Type) + sizeof(pCache->Entry);
+  AD5940Err error = AD5940ERR_OK;
+  uint8_t *pBuff = malloc(size);
+
+  if(pBuff == NULL) return AD5940ERR_BUFF;
+#ifdef ESP_PLATFORM
+  nvs_handle_t handle;
+  size_t len = size;
+  if(nvs_open(CALCACHE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    error = AD5940ERR_ERROR;
+  else
+  {
+    if(nvs_get_blob(handle, pCache->Name, pBuff, &len) != ESP_OK || len != size)
+      error = AD5940ERR_ERROR;
+    nvs_close(handle);
+  }
+#else
+  FILE *fp = fopen(pCache->Name, "rb");
+  if(fp == NULL)
+    error = AD5940ERR_ERROR;
+  else
+  {
+    if(fread(pBuff, 1, size, fp) != size)
+      error = AD5940ERR_ERROR;
+    fclose(fp);
+  }
+#endif
+  pHeader = (CalCacheHeader_Type*)pBuff;
+  if(error == AD5940ERR_OK && pHeader->Magic == CALCACHE_MAGIC && pHeader->Version == CALCACHE_VERSION &&\
+     pHeader->EntrySize == sizeof(CalEntry_Type))
+  {
+    memcpy(pCache->Entry, pBuff + sizeof(CalCacheHeader_Type), sizeof(pCache->Entry));
+    pCache->Generation = pHeader->Generation + 1;
+    for(uint32_t i=0; i<CALCACHE_MAX_ENTRY; i++)
+      pCache->Entry[i].bPending = bFALSE;
+    pCache->bDirty = bTRUE;   /* Record the new generation on next save */
+  }
+  else
+    error = AD5940ERR_ERROR;  /* Nothing stored yet, start with empty cache */
+  free(pBuff);
+  return error;
+}
+
+AD5940Err CalCacheSave(CalCache_Type *pCache)
+{
+  CalCacheHeader_Type *pHeader;
+  uint32_t size = sizeof(CalCacheHeader_Type) + sizeof(pCache->Entry);
+  AD5940Err error = AD5940ERR_OK;
+  uint8_t *pBuff;
+
+  if(pCache->bDirty == bFALSE)
+    return AD5940ERR_OK;
+  pBuff = malloc(size);
+  if(pBuff == NULL) return AD5940ERR_BUFF;
+  pHeader = (CalCacheHeader_Type*)pBuff;
+  pHeader->Magic = CALCACHE_MAGIC;
+  pHeader->Version = CALCACHE_VERSION;
+  pHeader->Generation = pCache->Generation;
+  pHeader->EntrySize = sizeof(CalEntry_Type);
+  memcpy(pBuff + sizeof(CalCacheHeader_Type), pCache->Entry, sizeof(pCache->Entry));
+#ifdef ESP_PLATFORM
+  nvs_handle_t handle;
+  if(nvs_open(CALCACHE_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    error = AD5940ERR_ERROR;
+  else
+  {
+    if(nvs_set_blob(handle, pCache->Name, pBuff, size) != ESP_OK || nvs_commit(handle) != ESP_OK)
+      error = AD5940ERR_ERROR;
+    nvs_close(handle);
+  }
+#else
+  FILE *fp = fopen(pCache->Name, "wb");
+  if(fp == NULL)
+    error = AD5940ERR_ERROR;
+  else
+  {
+    if(fwrite(pBuff, 1, size, fp) != size)
+      error = AD5940ERR_ERROR;
+    fclose(fp);
+  }
+#endif
+  free(pBuff);
+  if(error == AD5940ERR_OK)
+    pCache->bDirty = bFALSE;
+  return error;
+}
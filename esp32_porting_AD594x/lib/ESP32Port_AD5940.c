@@ -6,6 +6,7 @@
 
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
+#include "driver/uart.h"
 #include "rom/ets_sys.h"
 
 #ifdef CONFIG_IDF_TARGET_ESP32
@@ -40,6 +41,7 @@
 static spi_device_handle_t spi_handle_ad5940; // AD5940 specific handle
 
 volatile static uint8_t ucInterrupted = 0;       /* Flag to indicate interrupt occurred */
+volatile static uint64_t ullIntTimeUs = 0;       /* Time of last accepted interrupt */
 
 /**
  * @brief Pull !CS pin high
@@ -89,13 +91,15 @@ static void IRAM_ATTR ad5940_gpio0_isr_handler(void* arg)
     // Sometimes due to interference or ringing or something, we get two irqs after eachother. This is solved by
     // looking at the time between interrupts and refusing any interrupt too close to another one.
     static uint32_t lastisrtime_us;
-    uint32_t currtime_us = esp_timer_get_time();
+    int64_t now_us = esp_timer_get_time();
+    uint32_t currtime_us = (uint32_t)now_us;
     uint32_t diff = currtime_us - lastisrtime_us;
     if (diff < 1000) {
         return; //ignore everything <1ms after an earlier irq
     }
     lastisrtime_us = currtime_us;
 
+    ullIntTimeUs = (uint64_t)now_us;    // Time stamp of the data behind this interrupt
     ucInterrupted = 1;
 }
 
@@ -154,6 +158,115 @@ void AD5940_ReadWriteNBytes_AD5940(unsigned char *pSendBuffer,unsigned char *pRe
     // }
 }
 
+/**
+  @brief Write several CS framed transfers while holding the SPI bus.
+  @param pSendBuffer: Frames stored back to back
+  @param pFrameLen: Length of each frame in bytes
+  @param FrameCount: Number of frames
+  @note Polling transmit avoids the interrupt and task switch of spi_device_transmit for these short frames.
+  @return None
+**/
+void AD5940_WriteNFrames_AD5940(unsigned char *pSendBuffer, const uint16_t *pFrameLen, uint32_t FrameCount)
+{
+    spi_transaction_t t;
+
+    spi_device_acquire_bus(spi_handle_ad5940, portMAX_DELAY);
+    for(uint32_t i = 0; i < FrameCount; i++)
+    {
+        memset(&t, 0, sizeof(t));
+        t.tx_buffer = pSendBuffer;
+        t.length = pFrameLen[i]*8;
+        gpio_set_level(AD5940_CS_PIN, 0);
+        spi_device_polling_transmit(spi_handle_ad5940, &t);
+        gpio_set_level(AD5940_CS_PIN, 1);
+        pSendBuffer += pFrameLen[i];
+    }
+    spi_device_release_bus(spi_handle_ad5940);
+}
+
+uint64_t AD5940_GetTimeUs_AD5940(void)
+{
+    return (uint64_t)esp_timer_get_time();
+}
+
+/**
+ * @brief Time of last interrupt from AD5940 GP0, captured in the ISR.
+*/
+uint64_t AD5940_GetIntTimeUs_AD5940(void)
+{
+    uint64_t t;
+    // 64-bit value is written in two parts by the ISR, read until stable
+    do {
+        t = ullIntTimeUs;
+    } while (t != ullIntTimeUs);
+    return t;
+}
+
+static spi_transaction_t ad5940_async_trans;   /* Transfer of ReadWriteNBytesStart, owned by the driver until waited for */
+static bool ad5940_async_busy = false;
+
+/**
+  @brief Queue a transfer and return while the SPI DMA moves the data.
+  @note The bus stays acquired until AD5940_ReadWriteNBytesWait_AD5940. CS is left to the caller.
+        The driver copies through a bounce buffer if a buffer is not word aligned or its length
+        not a multiple of 4 bytes.
+  @return None
+**/
+void AD5940_ReadWriteNBytesStart_AD5940(unsigned char *pSendBuffer, unsigned char *pRecvBuff, unsigned long length)
+{
+    memset(&ad5940_async_trans, 0, sizeof(ad5940_async_trans));
+    ad5940_async_trans.tx_buffer = pSendBuffer;
+    ad5940_async_trans.rx_buffer = pRecvBuff;
+    ad5940_async_trans.length = length*8;
+
+    spi_device_acquire_bus(spi_handle_ad5940, portMAX_DELAY);
+    spi_device_queue_trans(spi_handle_ad5940, &ad5940_async_trans, portMAX_DELAY);
+    ad5940_async_busy = true;
+}
+
+/**
+  @brief Wait for the transfer of AD5940_ReadWriteNBytesStart_AD5940 and release the bus.
+**/
+void AD5940_ReadWriteNBytesWait_AD5940(void)
+{
+    spi_transaction_t *pDone;
+
+    if (!ad5940_async_busy)
+        return;
+    spi_device_get_trans_result(spi_handle_ad5940, &pDone, portMAX_DELAY);
+    spi_device_release_bus(spi_handle_ad5940);
+    ad5940_async_busy = false;
+}
+
+/**
+  @brief Send binary result frames on the console UART.
+         stdout would turn 0x0A into CR LF, so bytes go through the UART driver instead.
+**/
+void AD5940_StreamWrite_AD5940(const uint8_t *pData, uint32_t Len)
+{
+    if (!uart_is_driver_installed(CONFIG_ESP_CONSOLE_UART_NUM)) {
+        uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM, 256, 2048, 0, NULL, 0);
+    }
+    fflush(stdout);     /* Keep text and frames in order */
+    uart_write_bytes(CONFIG_ESP_CONSOLE_UART_NUM, pData, Len);
+}
+
+/**
+  @brief Room in the UART transmit buffer, so a sender can skip a frame instead of blocking.
+**/
+uint32_t AD5940_StreamRoom_AD5940(void)
+{
+    size_t room;
+
+    if (!uart_is_driver_installed(CONFIG_ESP_CONSOLE_UART_NUM)) {
+        return 0xFFFFFFFF;      /* Installed by the first write */
+    }
+    if (uart_get_tx_buffer_free_size(CONFIG_ESP_CONSOLE_UART_NUM, &room) != ESP_OK) {
+        return 0xFFFFFFFF;
+    }
+    return (uint32_t)room;
+}
+
 /**
   @brief Initialise SPI and GPIO peripherals for ESP32. 
   @param pCfg: Optional configuration flags.
@@ -243,5 +356,12 @@ board_interface_t ad5940_interface = {
     .ClrMCUIntFlag = AD5940_ClrMCUIntFlag_AD5940,
     .Delay10us = AD5940_Delay10us_AD5940,
     .ReadWriteNBytes = AD5940_ReadWriteNBytes_AD5940,
-    .MCUResourceInit = AD5940_MCUResourceInit_AD5940
+    .MCUResourceInit = AD5940_MCUResourceInit_AD5940,
+    .WriteNFrames = AD5940_WriteNFrames_AD5940,
+    .GetTimeUs = AD5940_GetTimeUs_AD5940,
+    .GetIntTimeUs = AD5940_GetIntTimeUs_AD5940,
+    .StreamWrite = AD5940_StreamWrite_AD5940,
+    .StreamRoom = AD5940_StreamRoom_AD5940,
+    .ReadWriteNBytesStart = AD5940_ReadWriteNBytesStart_AD5940,
+    .ReadWriteNBytesWait = AD5940_ReadWriteNBytesWait_AD5940
 };
\ No newline at end of file
@@ -0,0 +1,190 @@
+/*!
+ *****************************************************************************
+ @file:    GoertzelBank.c
+ @brief:   Complex amplitudes at a set of frequencies from raw samples, one pass.
+ -----------------------------------------------------------------------------
+
+ Host_Tools/goertzel_bench.c compiles this file on the host and compares
+ it with a DFT in double and in float.
+
+*****************************************************************************/
+#include "GoertzelBank.h"
+#include <string.h>
+#include <math.h>
+
+#define GOERTZEL_MATH_PI      3.14159265358979323846
+
+#if GOERTZEL_LANES != 4 || GOERTZEL_MAX_BINS%GOERTZEL_LANES
+#error "GoertzelFeed updates 4 frequencies at a time, GOERTZEL_MAX_BINS must be a multiple of 4"
+#endif
+
+/**
+ * @brief Empty bank for blocks of Length samples at SampleRate.
+*/
+void GoertzelInit(GoertzelBank_Type *pBank, float SampleRate, uint32_t Length, BoolFlag HanWinEn)
+{
+  memset(pBank, 0, sizeof(*pBank));
+  pBank->SampleRate = SampleRate;
+  pBank->Length = Length;
+  pBank->HanWinEn = HanWinEn;
+  if(Length)
+  {
+    pBank->WinStepRe = (float)cos(2*GOERTZEL_MATH_PI/Length);
+    pBank->WinStepIm = (float)sin(2*GOERTZEL_MATH_PI/Length);
+  }
+  GoertzelReset(pBank);
+}
+
+/* exp(-j*Phase) with Phase reduced in double */
+static void GoertzelPhasor(double Phase, float *pRe, float *pIm)
+{
+  Phase = fmod(Phase, 2*GOERTZEL_MATH_PI);
+  *pRe = (float)cos(Phase);
+  *pIm = (float)-sin(Phase);
+}
+
+/**
+ * @brief Add a frequency. Coefficients are computed in double, this is the only place.
+ * @return AD5940ERR_PARA if the bank is full or Freq is not in 0 to SampleRate/2.
+*/
+AD5940Err GoertzelAddBin(GoertzelBank_Type *pBank, float Freq)
+{
+  uint32_t k = pBank->Bins, last;
+  double w;
+
+  if(k >= GOERTZEL_MAX_BINS || !(Freq >= 0) || !(Freq <= pBank->SampleRate/2) || pBank->Length == 0)
+    return AD5940ERR_PARA;
+  w = 2*GOERTZEL_MATH_PI*Freq/pBank->SampleRate;
+  last = pBank->Length - (pBank->Length - 1)/GOERTZEL_SUB*GOERTZEL_SUB;
+  pBank->Freq[k] = Freq;
+  pBank->Coef[k] = (float)(2*cos(w));
+  pBank->Cos[k] = (float)cos(w);
+  pBank->Sin[k] = (float)sin(w);
+  GoertzelPhasor(w*(GOERTZEL_SUB - 1), &pBank->SubRe[k], &pBank->SubIm[k]);
+  GoertzelPhasor(w*(last - 1), &pBank->LastRe[k], &pBank->LastIm[k]);
+  GoertzelPhasor(w*GOERTZEL_SUB, &pBank->StepRe[k], &pBank->StepIm[k]);
+  pBank->Bins++;
+  GoertzelReset(pBank);
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Start a new block with the same frequencies.
+*/
+void GoertzelReset(GoertzelBank_Type *pBank)
+{
+  uint32_t k;
+
+  for(k=0; k<GOERTZEL_MAX_BINS; k++)
+  {
+    pBank->RotRe[k] = 1;
+    pBank->RotIm[k] = 0;
+  }
+  memset(pBank->AccRe, 0, sizeof(pBank->AccRe));
+  memset(pBank->AccIm, 0, sizeof(pBank->AccIm));
+  memset(pBank->S1, 0, sizeof(pBank->S1));
+  memset(pBank->S2, 0, sizeof(pBank->S2));
+  pBank->Count = 0;
+  pBank->WinRe = 1;
+  pBank->WinIm = 0;
+}
+
+/* End of a sub-block: add its DFT and restart the filters */
+static void GoertzelFlush(GoertzelBank_Type *pBank)
+{
+  const float *pEndRe = pBank->Count == pBank->Length ? pBank->LastRe : pBank->SubRe;
+  const float *pEndIm = pBank->Count == pBank->Length ? pBank->LastIm : pBank->SubIm;
+  float yr, yi, er, ei, rr;
+  uint32_t k;
+
+  for(k=0; k<pBank->Bins; k++)
+  {
+    /* y = s1 - exp(-jw)s2 is the DFT of the sub-block at w times exp(jw(n-1)) */
+    yr = pBank->S1[k] - pBank->Cos[k]*pBank->S2[k];
+    yi = pBank->Sin[k]*pBank->S2[k];
+    er = yr*pEndRe[k] - yi*pEndIm[k];
+    ei = yr*pEndIm[k] + yi*pEndRe[k];
+    pBank->AccRe[k] += er*pBank->RotRe[k] - ei*pBank->RotIm[k];
+    pBank->AccIm[k] += er*pBank->RotIm[k] + ei*pBank->RotRe[k];
+    rr = pBank->RotRe[k]*pBank->StepRe[k] - pBank->RotIm[k]*pBank->StepIm[k];
+    pBank->RotIm[k] = pBank->RotRe[k]*pBank->StepIm[k] + pBank->RotIm[k]*pBank->StepRe[k];
+    pBank->RotRe[k] = rr;
+  }
+  memset(pBank->S1, 0, sizeof(pBank->S1));
+  memset(pBank->S2, 0, sizeof(pBank->S2));
+}
+
+/**
+ * @brief Feed samples of the block. Samples past Length are not used.
+ * @return Samples used.
+*/
+uint32_t GoertzelFeed(GoertzelBank_Type *pBank, const float *pSample, uint32_t Count)
+{
+  float *s1 = pBank->S1, *s2 = pBank->S2;
+  const float *c = pBank->Coef;
+  uint32_t bins = pBank->Bins, i = 0, n, k;
+  float x, re, a, p0, p1, p2, p3, q0, q1, q2, q3;
+
+  if(Count > pBank->Length - pBank->Count)
+    Count = pBank->Length - pBank->Count;
+  while(i < Count)
+  {
+    n = GOERTZEL_SUB - pBank->Count%GOERTZEL_SUB;
+    n = n < Count - i ? i + n : Count;
+    for(; i<n; i++)
+    {
+      x = pSample[i];
+      if(pBank->HanWinEn == bTRUE)
+      {
+        if(pBank->Count%GOERTZEL_WIN_SYNC == 0)
+        {
+          a = 2*MATH_PI*((float)pBank->Count/pBank->Length);
+          pBank->WinRe = cosf(a);
+          pBank->WinIm = sinf(a);
+        }
+        x *= 0.5f - 0.5f*pBank->WinRe;
+        re = pBank->WinRe*pBank->WinStepRe - pBank->WinIm*pBank->WinStepIm;
+        pBank->WinIm = pBank->WinRe*pBank->WinStepIm + pBank->WinIm*pBank->WinStepRe;
+        pBank->WinRe = re;
+      }
+      /* GOERTZEL_LANES frequencies at a time, all loads before the stores */
+      for(k=0; k<bins; k+=GOERTZEL_LANES)
+      {
+        p0 = s1[k];     p1 = s1[k+1];   p2 = s1[k+2];   p3 = s1[k+3];
+        q0 = s2[k];     q1 = s2[k+1];   q2 = s2[k+2];   q3 = s2[k+3];
+        s1[k] = x + c[k]*p0 - q0;
+        s1[k+1] = x + c[k+1]*p1 - q1;
+        s1[k+2] = x + c[k+2]*p2 - q2;
+        s1[k+3] = x + c[k+3]*p3 - q3;
+        s2[k] = p0;     s2[k+1] = p1;   s2[k+2] = p2;   s2[k+3] = p3;
+      }
+      pBank->Count++;
+    }
+    if(pBank->Count%GOERTZEL_SUB == 0 || pBank->Count == pBank->Length)
+      GoertzelFlush(pBank);
+  }
+  return Count;
+}
+
+/**
+ * @brief Complex amplitude at each frequency, in the order they were added.
+ * @param pResult: Bins values.
+ * @return AD5940ERR_PARA if the block is not complete.
+*/
+AD5940Err GoertzelResult(const GoertzelBank_Type *pBank, fImpCar_Type *pResult)
+{
+  float scale;
+  uint32_t k;
+
+  if(pBank->Count != pBank->Length || pBank->Length == 0)
+    return AD5940ERR_PARA;
+  /* Sum of window weights, Length/2 for the periodic Hann window */
+  scale = pBank->HanWinEn == bTRUE ? 2.0f/pBank->Length : 1.0f/pBank->Length;
+  for(k=0; k<pBank->Bins; k++)
+  {
+    /* A cosine of amplitude A gives A/2 at +w */
+    pResult[k].Real = pBank->AccRe[k]*scale*(pBank->Freq[k] > 0 ? 2 : 1);
+    pResult[k].Image = pBank->AccIm[k]*scale*(pBank->Freq[k] > 0 ? 2 : 1);
+  }
+  return AD5940ERR_OK;
+}
@@ -0,0 +1,146 @@
+/*!
+ *****************************************************************************
+ @file:    ImpFixed.c
+ @brief:   Impedance from DFT results in fixed point, without libm.
+ -----------------------------------------------------------------------------
+
+ Host_Tools/impfix_check.c compiles this file on the host and compares it
+ with the float path and with double.
+
+*****************************************************************************/
+#include "ImpFixed.h"
+
+#define IMPFIX_PI             843314857           /* pi in Q3.28 */
+#define IMPFIX_CORDIC_KINV    0x9B74EDA8UL        /* 1/CORDIC gain of IMPFIX_CORDIC_ITER iterations, Q0.32 */
+#define IMPFIX_NORM_LOW       (1L<<28)            /* Vector is normalized to this range before CORDIC */
+#define IMPFIX_NORM_HIGH      (1L<<29)
+
+/* atan(2^-i) in Q3.28 radian */
+static const int32_t ImpFixAtan[IMPFIX_CORDIC_ITER] =
+{
+  210828714, 124459457, 65760959, 33381290, 16755422, 8385879, 4193963, 2097109,
+  1048571, 524287, 262144, 131072, 65536, 32768, 16384, 8192,
+  4096, 2048, 1024, 512, 256, 128, 64, 32,
+  16, 8, 4, 2,
+};
+
+/**
+ * @brief RCAL value in Q23.8 ohm. Call it once when configuration changes, not per result.
+ * @return 0 if RcalVal is not in 0 to IMPFIX_RCAL_MAX.
+*/
+int32_t ImpFixRcal(float RcalVal)
+{
+  double v = (double)RcalVal*(1L<<IMPFIX_ZFRAC) + 0.5;
+  if(!(v >= 1) || v >= IMPFIX_RCAL_MAX)
+    return 0;
+  return (int32_t)v;
+}
+
+/* Num/Den rounded to nearest, Den > 0. Saturates to int32 */
+static int32_t ImpFixDiv(int64_t Num, int64_t Den, BoolFlag *pSat)
+{
+  int64_t q = Num >= 0 ? (Num + Den/2)/Den : -((-Num + Den/2)/Den);
+  if(q > INT32_MAX || q < -INT32_MAX)
+  {
+    *pSat = bTRUE;
+    return q > 0 ? INT32_MAX : -INT32_MAX;
+  }
+  return (int32_t)q;
+}
+
+/**
+ * @brief Impedance of the DUT from the DFT results of RCAL and DUT of the same point.
+ * @param pDftRcal, pDftRz: Sign extended 18-bit DFT results.
+ * @param Rcal: RCAL value from ImpFixRcal().
+ * @param pZ: Impedance in Q23.8 ohm.
+ * @return AD5940ERR_ERROR if the result saturated, e.g. the DUT result is 0.
+*/
+AD5940Err ImpFixZ(const iImpCar_Type *pDftRcal, const iImpCar_Type *pDftRz, int32_t Rcal, iImpCar_Type *pZ)
+{
+  int64_t den, re, im;
+  BoolFlag sat = bFALSE;
+
+  /* Rcal*conj(Dftrcal)/conj(Dftrz) = Rcal*conj(Dftrcal)*Dftrz/|Dftrz|^2. Products of 18-bit values fit 36 bits */
+  den = (int64_t)pDftRz->Real*pDftRz->Real + (int64_t)pDftRz->Image*pDftRz->Image;
+  re = (int64_t)pDftRcal->Real*pDftRz->Real + (int64_t)pDftRcal->Image*pDftRz->Image;
+  im = (int64_t)pDftRcal->Real*pDftRz->Image - (int64_t)pDftRcal->Image*pDftRz->Real;
+  if(den == 0)
+  {
+    pZ->Real = re ? (re > 0 ? INT32_MAX : -INT32_MAX) : 0;
+    pZ->Image = im ? (im > 0 ? INT32_MAX : -INT32_MAX) : 0;
+    return AD5940ERR_ERROR;
+  }
+  pZ->Real = ImpFixDiv(re*Rcal, den, &sat);
+  pZ->Image = ImpFixDiv(im*Rcal, den, &sat);
+  return sat == bTRUE ? AD5940ERR_ERROR : AD5940ERR_OK;
+}
+
+/**
+ * @brief Magnitude and phase of an impedance by CORDIC.
+ * @param pZ: Impedance in Q23.8 ohm.
+ * @param pPol: Magnitude in Q24.8 ohm and phase in Q3.28 radian.
+*/
+void ImpFixPolar(const iImpCar_Type *pZ, iImpPol_Type *pPol)
+{
+  int64_t x = pZ->Real, y = pZ->Image;
+  int64_t m = x < 0 ? -x : x;
+  int32_t xs, ys, t, phase = 0;
+  int32_t shift = 0, i;
+  uint64_t mag;
+
+  if((y < 0 ? -y : y) > m)
+    m = y < 0 ? -y : y;
+
+  if(m == 0)
+  {
+    pPol->Magnitude = 0;
+    pPol->Phase = 0;
+    return;
+  }
+  /* Normalize to 28 to 29 bits: full precision for small values, no overflow with the CORDIC gain */
+  for(; m < IMPFIX_NORM_LOW; m <<= 1)
+    shift++;
+  for(; m >= IMPFIX_NORM_HIGH; m >>= 1)
+    shift--;
+  if(shift >= 0)
+  {
+    xs = (int32_t)(x<<shift);
+    ys = (int32_t)(y<<shift);
+  }
+  else
+  {
+    xs = (int32_t)((x + (1L<<(-shift-1)))>>-shift);
+    ys = (int32_t)((y + (1L<<(-shift-1)))>>-shift);
+  }
+  /* Rotate left half plane by pi */
+  if(xs < 0)
+  {
+    phase = ys >= 0 ? IMPFIX_PI : -IMPFIX_PI;
+    xs = -xs;
+    ys = -ys;
+  }
+  /* Vectoring: rotate onto the x axis, the angles turned add up to the phase */
+  for(i=0; i<IMPFIX_CORDIC_ITER; i++)
+  {
+    if(ys > 0)
+    {
+      t = xs + (ys>>i);
+      ys -= xs>>i;
+      phase += ImpFixAtan[i];
+    }
+    else
+    {
+      t = xs - (ys>>i);
+      ys += xs>>i;
+      phase -= ImpFixAtan[i];
+    }
+    xs = t;
+  }
+  mag = ((uint64_t)xs*IMPFIX_CORDIC_KINV + (1UL<<31))>>32;
+  if(shift > 0)
+    mag = (mag + (1UL<<(shift-1)))>>shift;
+  else
+    mag <<= -shift;
+  pPol->Magnitude = mag > UINT32_MAX ? UINT32_MAX : (uint32_t)mag;
+  pPol->Phase = phase;
+}
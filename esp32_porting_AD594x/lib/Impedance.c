@@ -47,6 +47,10 @@ AppIMPCfg_Type AppIMPCfg =
   .PswitchSel = SWP_AIN1,
   .NswitchSel = SWN_AIN3,
   .TswitchSel = SWT_AIN2,
+  .DutNum = 0,
+  .DutSwitchWait = 16*10,
+  .pScanCh = 0,
+  .ScanChNum = 0,
 
   .PwrMod = AFEPWR_HP,
 
@@ -78,10 +82,41 @@ AppIMPCfg_Type AppIMPCfg =
   .SweepCfg.SweepIndex = 0,
 
   .FifoThresh = 4,
+  .RepeatNum = 1,
+  .RepeatMode = POINTSTAT_HAMPEL,
+  .HampelK = 3.0f,
   .IMPInited = bFALSE,
   .StopRequired = bFALSE,
 };
 
+/* Repeats of the point being measured per DUT result, and the statistics of the last point returned.
+   Only one point is kept, so IMPCTRL_GETSTAT is exact while each interrupt delivers one point (FifoThresh) */
+static PointStat_Type AppIMPRepeat[IMP_MAX_DUT];
+static PointStatResult_Type AppIMPStat[IMP_MAX_DUT];
+
+#if IMP_FIXED_POINT
+/* Frequencies of the sweep by index, so the data path needs no pow/log10 */
+static float AppIMPSweepTable[IMP_SWEEP_TABLE];
+static uint32_t AppIMPSweepTableNum;
+
+static void AppIMPSweepTableFill(void)
+{
+  SoftSweepCfg_Type sweep = AppIMPCfg.SweepCfg;
+  float freq;
+
+  AppIMPSweepTableNum = 0;
+  if(sweep.pFreqList || sweep.SweepPoints > IMP_SWEEP_TABLE)
+    return;   /* A list needs no table, longer sweeps use AD5940_SweepNext */
+  /* SweepPoints steps visit every index once */
+  for(uint32_t i=0; i<sweep.SweepPoints; i++)
+  {
+    AD5940_SweepNext(&sweep, &freq);
+    AppIMPSweepTable[sweep.SweepIndex] = freq;
+  }
+  AppIMPSweepTableNum = sweep.SweepPoints;
+}
+#endif
+
 /**
    This function is provided for upper controllers that want to change 
    application parameters specially for user defined parameters.
@@ -118,6 +153,7 @@ int32_t AppIMPCtrl(uint32_t Command, void *pPara)
       AD5940_WUPTCfg(&wupt_cfg);
       
       AppIMPCfg.FifoDataCount = 0;  /* restart */
+      AppIMPCfg.StopRequired = bFALSE;
       break;
     }
     case IMPCTRL_STOPNOW:
@@ -146,6 +182,30 @@ int32_t AppIMPCtrl(uint32_t Command, void *pPara)
           *(float*)pPara = AppIMPCfg.SinFreq;
       }
     break;
+    case IMPCTRL_GETCHANNEL:
+      {
+        if(pPara == 0)
+          return AD5940ERR_PARA;
+        if(AppIMPCfg.pScanCh)
+          *(uint32_t*)pPara = AppIMPCfg.ScanGroupOfData*AppIMPCfg.DutNum;
+        else
+          *(uint32_t*)pPara = 0;
+      }
+    break;
+    case IMPCTRL_GETSWEEPIDX:
+      {
+        if(pPara == 0)
+          return AD5940ERR_PARA;
+        *(uint32_t*)pPara = AppIMPCfg.IndexofData;
+      }
+    break;
+    case IMPCTRL_GETSTAT:
+      {
+        if(pPara == 0)
+          return AD5940ERR_PARA;
+        memcpy(pPara, AppIMPStat, sizeof(AppIMPStat));
+      }
+    break;
     case IMPCTRL_SHUTDOWN:
     {
       AppIMPCtrl(IMPCTRL_STOPNOW, 0);  /* Stop the measurement if it's running. */
@@ -165,6 +225,101 @@ int32_t AppIMPCtrl(uint32_t Command, void *pPara)
   return AD5940ERR_OK;
 }
 
+/* DUT measurements in each frequency point */
+static uint32_t AppIMPDutPerPoint(void)
+{
+  return AppIMPCfg.DutNum?AppIMPCfg.DutNum:1;
+}
+
+/* Measurements per returned point */
+static uint32_t AppIMPRepeatNum(void)
+{
+  return AppIMPCfg.RepeatNum > 1 ? AppIMPCfg.RepeatNum : 1;
+}
+
+/* FIFO words of one frequency point: RCAL and each DUT have real and imaginary part */
+static uint32_t AppIMPWordsPerPoint(void)
+{
+  return 2*(1 + AppIMPDutPerPoint());
+}
+
+/* Results of current data that belong to real channels. The last scan group may be padded. */
+static uint32_t AppIMPValidPerPoint(void)
+{
+  uint32_t first;
+
+  if(AppIMPCfg.pScanCh == 0)
+    return AppIMPDutPerPoint();
+  first = AppIMPCfg.ScanGroupOfData*AppIMPCfg.DutNum;
+  if(AppIMPCfg.ScanChNum - first < AppIMPCfg.DutNum)
+    return AppIMPCfg.ScanChNum - first;
+  return AppIMPCfg.DutNum;
+}
+
+/* Load switch settings of scan group into DutSwCfg[]. Patch sequencer SRAM too if the sequence is already there */
+static void AppIMPScanLoadGroup(uint32_t Group, BoolFlag bPatchSeq)
+{
+  for(uint32_t k=0; k<AppIMPCfg.DutNum; k++)
+  {
+    uint32_t ch = Group*AppIMPCfg.DutNum + k;
+    if(ch >= AppIMPCfg.ScanChNum)
+      ch = AppIMPCfg.ScanChNum - 1;   /* Pad last group. Its result is dropped. */
+    AppIMPCfg.DutSwCfg[k] = AppIMPCfg.pScanCh[ch].SwCfg;
+    if(bPatchSeq)
+      AD5940_SEQCmdWrite(AppIMPCfg.MeasureSeqInfo.SeqRamAddr + AppIMPCfg.SeqSwAddr[k], AppIMPCfg.pScanCh[ch].SeqCmd, IMP_SWCMD_LEN);
+  }
+}
+
+/**
+ * @brief Configure an electrode scan over the switch matrix.
+ * @details Switch matrix writes of every channel are compiled once here. Up to IMP_MAX_DUT
+ *          channels are measured inside one sequence against a shared RCAL measurement. When
+ *          there are more channels, the switch commands in SRAM are rewritten after each sweep,
+ *          so no re-initialization is needed. Call it before AppIMPInit.
+ * @param pChannel: Channel list, must stay valid during measurement. Set to NULL to disable scan.
+ * @param ChannelNum: Number of channels in list.
+ * @param Order: IMPSCAN_FREQFIRST or IMPSCAN_CHANFIRST. FREQFIRST needs fewer register writes and
+ *               RCAL measurements. CHANFIRST measures each channel against its own RCAL result.
+ * @return AD5940ERR_OK or AD5940ERR_PARA.
+*/
+AD5940Err AppIMPScanCfg(AppIMPScanCh_Type *pChannel, uint32_t ChannelNum, uint32_t Order)
+{
+  uint32_t group_max;
+
+  if(pChannel == 0 || ChannelNum == 0)
+  {
+    AppIMPCfg.pScanCh = 0;
+    AppIMPCfg.ScanChNum = 0;
+    AppIMPCfg.DutNum = 0;
+    AppIMPCfg.ScanPointCount = 0;
+    AppIMPCfg.bParaChanged = bTRUE;
+    return AD5940ERR_OK;
+  }
+  if(Order != IMPSCAN_FREQFIRST && Order != IMPSCAN_CHANFIRST)
+    return AD5940ERR_PARA;
+  for(uint32_t i=0; i<ChannelNum; i++)
+  {
+    SWMatrixCfg_Type *pSw = &pChannel[i].SwCfg;
+    pChannel[i].SeqCmd[0] = SEQ_WR(REG_AFE_DSWFULLCON, pSw->Dswitch);
+    pChannel[i].SeqCmd[1] = SEQ_WR(REG_AFE_PSWFULLCON, pSw->Pswitch);
+    pChannel[i].SeqCmd[2] = SEQ_WR(REG_AFE_NSWFULLCON, pSw->Nswitch);
+    pChannel[i].SeqCmd[3] = SEQ_WR(REG_AFE_TSWFULLCON, pSw->Tswitch|SWT_TRTIA);
+    pChannel[i].SeqCmd[4] = SEQ_WR(REG_AFE_SWCON, BITM_AFE_SWCON_SWSOURCESEL);
+  }
+  group_max = ChannelNum<IMP_MAX_DUT?ChannelNum:IMP_MAX_DUT;
+  AppIMPCfg.pScanCh = pChannel;
+  AppIMPCfg.ScanChNum = ChannelNum;
+  AppIMPCfg.ScanOrder = Order;
+  AppIMPCfg.DutNum = (Order == IMPSCAN_FREQFIRST)?group_max:1;
+  AppIMPCfg.ScanGroupNum = (ChannelNum + AppIMPCfg.DutNum - 1)/AppIMPCfg.DutNum;
+  AppIMPCfg.ScanGroup = 0;
+  AppIMPCfg.ScanGroupOfData = 0;
+  AppIMPCfg.ScanPointCount = 0;
+  AppIMPScanLoadGroup(0, bFALSE);
+  AppIMPCfg.bParaChanged = bTRUE;
+  return AD5940ERR_OK;
+}
+
 /* generated code snnipet */
 float AppIMPGetCurrFreq(void)
 {
@@ -236,8 +391,12 @@ static AD5940Err AppIMPSeqCfgGen(void)
   HsLoopCfg.WgCfg.OffsetCalEn = bTRUE;
   if(AppIMPCfg.SweepCfg.SweepEn == bTRUE)
   {
-    AppIMPCfg.FreqofData = AppIMPCfg.SweepCfg.SweepStart;
-    AppIMPCfg.SweepCurrFreq = AppIMPCfg.SweepCfg.SweepStart;
+#if IMP_FIXED_POINT
+    AppIMPSweepTableFill();
+#endif
+    AppIMPCfg.FreqofData = AD5940_SweepFirstFreq(&AppIMPCfg.SweepCfg);
+    AppIMPCfg.IndexofData = 0;
+    AppIMPCfg.SweepCurrFreq = AppIMPCfg.FreqofData;
     AD5940_SweepNext(&AppIMPCfg.SweepCfg, &AppIMPCfg.SweepNextFreq);
     sin_freq = AppIMPCfg.SweepCurrFreq;
   }
@@ -245,6 +404,7 @@ static AD5940Err AppIMPSeqCfgGen(void)
   {
     sin_freq = AppIMPCfg.SinFreq;
     AppIMPCfg.FreqofData = sin_freq;
+    AppIMPCfg.IndexofData = 0;
   }
   HsLoopCfg.WgCfg.SinCfg.SinFreqWord = AD5940_WGFreqWordCal(sin_freq, AppIMPCfg.SysClkFreq);
   HsLoopCfg.WgCfg.SinCfg.SinAmplitudeWord = (uint32_t)(AppIMPCfg.DacVoltPP/800.0f*2047 + 0.5f);
@@ -360,23 +520,49 @@ static AD5940Err AppIMPSeqMeasureGen(void)
   AD5940_SEQGenInsert(SEQ_WAIT(WaitClks/2));
    AD5940_SEQGenInsert(SEQ_WAIT(WaitClks/2));
  
-  //wait for first data ready
-  AD5940_AFECtrlS(AFECTRL_ADCPWR|AFECTRL_ADCCNV|AFECTRL_DFT|AFECTRL_WG, bFALSE);  /* Stop ADC convert and DFT */
-
-  /* Configure matrix for external Rz */
-  sw_cfg.Dswitch = AppIMPCfg.DswitchSel;
-  sw_cfg.Pswitch = AppIMPCfg.PswitchSel;
-  sw_cfg.Nswitch = AppIMPCfg.NswitchSel;
-  sw_cfg.Tswitch = SWT_TRTIA|AppIMPCfg.TswitchSel;
-  AD5940_SWMatrixCfgS(&sw_cfg);
-  AD5940_AFECtrlS(AFECTRL_ADCPWR|AFECTRL_WG, bTRUE);  /* Enable Waveform generator */
-  AD5940_SEQGenInsert(SEQ_WAIT(16*10));  //delay for signal settling DFT_WAIT
-  AD5940_AFECtrlS(AFECTRL_ADCCNV|AFECTRL_DFT, bTRUE);  /* Start ADC convert and DFT */
-	
-	AD5940_SEQGenFetchSeq(NULL, &AppIMPCfg.SeqWaitAddr[1]); /* Record the start address of next command */
-       
-  AD5940_SEQGenInsert(SEQ_WAIT(WaitClks/2));
-   AD5940_SEQGenInsert(SEQ_WAIT(WaitClks/2));
+  if(AppIMPCfg.DutNum == 0)
+  {
+    //wait for first data ready
+    AD5940_AFECtrlS(AFECTRL_ADCPWR|AFECTRL_ADCCNV|AFECTRL_DFT|AFECTRL_WG, bFALSE);  /* Stop ADC convert and DFT */
+
+    /* Configure matrix for external Rz */
+    sw_cfg.Dswitch = AppIMPCfg.DswitchSel;
+    sw_cfg.Pswitch = AppIMPCfg.PswitchSel;
+    sw_cfg.Nswitch = AppIMPCfg.NswitchSel;
+    sw_cfg.Tswitch = SWT_TRTIA|AppIMPCfg.TswitchSel;
+    AD5940_SWMatrixCfgS(&sw_cfg);
+    AD5940_AFECtrlS(AFECTRL_ADCPWR|AFECTRL_WG, bTRUE);  /* Enable Waveform generator */
+    AD5940_SEQGenInsert(SEQ_WAIT(16*10));  //delay for signal settling DFT_WAIT
+    AD5940_AFECtrlS(AFECTRL_ADCCNV|AFECTRL_DFT, bTRUE);  /* Start ADC convert and DFT */
+    
+    AD5940_SEQGenFetchSeq(NULL, &AppIMPCfg.SeqWaitAddr[1]); /* Record the start address of next command */
+         
+    AD5940_SEQGenInsert(SEQ_WAIT(WaitClks/2));
+    AD5940_SEQGenInsert(SEQ_WAIT(WaitClks/2));
+    AppIMPCfg.SeqWaitNum = 2;
+  }
+  else
+  {
+    /* RCAL is measured once. Keep WG and ADC running and only restart the DFT for each DUT */
+    if(AppIMPCfg.DutNum > IMP_MAX_DUT)
+      return AD5940ERR_PARA;
+    for(uint32_t i=0; i<AppIMPCfg.DutNum; i++)
+    {
+      AD5940_AFECtrlS(AFECTRL_ADCCNV|AFECTRL_DFT, bFALSE);  /* Stop ADC convert and DFT */
+      sw_cfg = AppIMPCfg.DutSwCfg[i];
+      sw_cfg.Tswitch |= SWT_TRTIA;
+      AD5940_SEQGenFetchSeq(NULL, &AppIMPCfg.SeqSwAddr[i]); /* Scan rewrites these IMP_SWCMD_LEN commands */
+      AD5940_SWMatrixCfgS(&sw_cfg);
+      AD5940_SEQGenInsert(SEQ_WAIT(AppIMPCfg.DutSwitchWait));  /* Settling after switch change */
+      AD5940_AFECtrlS(AFECTRL_ADCCNV|AFECTRL_DFT, bTRUE);  /* Start ADC convert and DFT */
+
+      AD5940_SEQGenFetchSeq(NULL, &AppIMPCfg.SeqWaitAddr[1+i]); /* Record the start address of next command */
+
+      AD5940_SEQGenInsert(SEQ_WAIT(WaitClks/2));
+      AD5940_SEQGenInsert(SEQ_WAIT(WaitClks/2));
+    }
+    AppIMPCfg.SeqWaitNum = 1 + AppIMPCfg.DutNum;
+  }
 
   AD5940_AFECtrlS(AFECTRL_ADCCNV|AFECTRL_DFT|AFECTRL_WG|AFECTRL_ADCPWR, bFALSE);  /* Stop ADC convert and DFT */
     AD5940_AFECtrlS(AFECTRL_HSTIAPWR|AFECTRL_INAMPPWR|AFECTRL_EXTBUFPWR|\
@@ -415,6 +601,7 @@ AD5940Err AppIMPCheckFreq(float freq)
   FreqParams_Type freq_params;
   uint32_t SeqCmdBuff[32];
   uint32_t SRAMAddr = 0;;
+  uint32_t i;
   /* Step 1: Check Frequency */
   freq_params = AD5940_GetFreqParameters(freq);
   
@@ -525,19 +712,14 @@ AD5940Err AppIMPCheckFreq(float freq)
   AD5940_ClksCalculate(&clks_cal, &WaitClks);		
 	
 	
-	  SRAMAddr = AppIMPCfg.MeasureSeqInfo.SeqRamAddr + AppIMPCfg.SeqWaitAddr[0];
-	   
-           SeqCmdBuff[0] =SEQ_WAIT(WaitClks/2);
-           SeqCmdBuff[1] =SEQ_WAIT(WaitClks/2);
-      
-		AD5940_SEQCmdWrite(SRAMAddr, SeqCmdBuff, 2);
-		
-		SRAMAddr = AppIMPCfg.MeasureSeqInfo.SeqRamAddr + AppIMPCfg.SeqWaitAddr[1];
-		  
-           SeqCmdBuff[0] =SEQ_WAIT(WaitClks/2);
-           SeqCmdBuff[1] =SEQ_WAIT(WaitClks/2);
-
-		AD5940_SEQCmdWrite(SRAMAddr, SeqCmdBuff, 2);
+  /* RCAL and every DUT measurement use the same DFT wait time */
+  SeqCmdBuff[0] =SEQ_WAIT(WaitClks/2);
+  SeqCmdBuff[1] =SEQ_WAIT(WaitClks/2);
+  for(i=0; i<AppIMPCfg.SeqWaitNum; i++)
+  {
+    SRAMAddr = AppIMPCfg.MeasureSeqInfo.SeqRamAddr + AppIMPCfg.SeqWaitAddr[i];
+    AD5940_SEQCmdWrite(SRAMAddr, SeqCmdBuff, 2);
+  }
 
 		
   return AD5940ERR_OK;
@@ -551,6 +733,13 @@ int32_t AppIMPInit(uint32_t *pBuffer, uint32_t BufferSize)
   SEQCfg_Type seq_cfg;
   FIFOCfg_Type fifo_cfg;
 
+  if(AppIMPCfg.RepeatNum > POINTSTAT_MAX_REPEAT || AppIMPCfg.RepeatMode > POINTSTAT_HAMPEL)
+    return AD5940ERR_PARA;
+#if IMP_FIXED_POINT
+  AppIMPCfg.RcalFix = ImpFixRcal(AppIMPCfg.RcalVal);
+  if(AppIMPCfg.RcalFix == 0)
+    return AD5940ERR_PARA;
+#endif
   if(AD5940_WakeUp(10) > 10)  /* Wakeup AFE by read register, read 10 times at most */
     return AD5940ERR_WAKEUP;  /* Wakeup Failed */
 
@@ -566,6 +755,7 @@ int32_t AppIMPInit(uint32_t *pBuffer, uint32_t BufferSize)
   
   /* Reconfigure FIFO */
   AD5940_FIFOCtrlS(FIFOSRC_DFT, bFALSE);									/* Disable FIFO firstly */
+  AppIMPCfg.FifoThresh = AppIMPWordsPerPoint();           /* One RCAL result plus one result per DUT, the ISR reads whole points */
   fifo_cfg.FIFOEn = bTRUE;
   fifo_cfg.FIFOMode = FIFOMODE_FIFO;
   fifo_cfg.FIFOSize = FIFOSIZE_4KB;                       /* 4kB for FIFO, The reset 2kB for sequencer */
@@ -592,6 +782,7 @@ int32_t AppIMPInit(uint32_t *pBuffer, uint32_t BufferSize)
     if(error != AD5940ERR_OK) return error;
 
     AppIMPCfg.bParaChanged = bFALSE; /* Clear this flag as we already implemented the new configuration */
+    AppIMPCfg.ScanPointCount = 0;    /* Sweep starts again, with the group in SRAM */
   }
 
   /* Initialization sequencer  */
@@ -607,6 +798,9 @@ int32_t AppIMPInit(uint32_t *pBuffer, uint32_t BufferSize)
   AD5940_SEQInfoCfg(&AppIMPCfg.MeasureSeqInfo);
   
   AppIMPCheckFreq(AppIMPCfg.FreqofData);
+  AppIMPCfg.RepeatCount = 0;
+  for(uint32_t k=0; k<IMP_MAX_DUT; k++)
+    PointStatClear(&AppIMPRepeat[k]);
 
   seq_cfg.SeqEnable = bTRUE;
   AD5940_SEQCfg(&seq_cfg);  /* Enable sequencer, and wait for trigger */
@@ -618,13 +812,73 @@ int32_t AppIMPInit(uint32_t *pBuffer, uint32_t BufferSize)
   return AD5940ERR_OK;
 }
 
+/**
+  Start again from the first point of SweepCfg, or at SinFreq without sweep, with the
+  sequences already in SRAM. Used between sweeps instead of AppIMPInit, so the scan group
+  loaded by AppIMPRegModify is kept. Call it while the wakeup timer is stopped, then IMPCTRL_START.
+*/
+AD5940Err AppIMPSweepRestart(void)
+{
+  float freq;
+
+  if(AppIMPCfg.IMPInited == bFALSE || AppIMPCfg.bParaChanged == bTRUE)
+    return AD5940ERR_APPERROR;
+  if(AD5940_WakeUp(10) > 10)
+    return AD5940ERR_WAKEUP;
+  if(AppIMPCfg.SweepCfg.SweepEn == bTRUE)
+  {
+#if IMP_FIXED_POINT
+    AppIMPSweepTableFill();   /* SweepCfg may have changed with the same point count */
+#endif
+    AppIMPCfg.SweepCfg.SweepIndex = 0;
+    AppIMPCfg.SweepCurrFreq = AD5940_SweepFirstFreq(&AppIMPCfg.SweepCfg);
+    AD5940_SweepNext(&AppIMPCfg.SweepCfg, &AppIMPCfg.SweepNextFreq);
+    freq = AppIMPCfg.SweepCurrFreq;
+  }
+  else
+    freq = AppIMPCfg.SinFreq;
+  AppIMPCfg.FreqofData = freq;
+  AppIMPCfg.IndexofData = 0;
+  AD5940_WGFreqCtrlS(freq, AppIMPCfg.SysClkFreq);
+  AppIMPCheckFreq(freq);
+  /* Drop results of the previous sweep that were not read */
+  AD5940_FIFOCtrlS(FIFOSRC_DFT, bFALSE);
+  AD5940_FIFOCtrlS(FIFOSRC_DFT, bTRUE);
+  AD5940_INTCClrFlag(AFEINTSRC_ALLINT);
+  AD5940_ClrMCUIntFlag();
+  AppIMPCfg.ScanPointCount = 0;
+  AppIMPCfg.RepeatCount = 0;
+  for(uint32_t k=0; k<IMP_MAX_DUT; k++)
+    PointStatClear(&AppIMPRepeat[k]);
+  return AD5940ERR_OK;
+}
+
 /* Modify registers when AFE wakeup */
 int32_t AppIMPRegModify(int32_t * const pData, uint32_t *pDataCount)
 {
+  uint32_t points = *pDataCount/AppIMPWordsPerPoint();
+  BoolFlag bPointDone;
+
+  (void)pData;
+  /* The data just read was measured with the group in SRAM. AppIMPDataProcess runs after this */
+  if(AppIMPCfg.pScanCh)
+    AppIMPCfg.ScanGroupOfData = AppIMPCfg.ScanGroup;
+  bPointDone = (AppIMPCfg.RepeatCount + points >= AppIMPRepeatNum()) ? bTRUE : bFALSE;
+  if(bPointDone == bTRUE && AppIMPCfg.pScanCh && AppIMPCfg.ScanGroupNum > 1)
+  {
+    /* Move to next group of channels once the group has measured every point of the sweep.
+       Done before the stop checks below, so a sweep started later continues with that group. */
+    if(++AppIMPCfg.ScanPointCount >= (AppIMPCfg.SweepCfg.SweepEn ? AppIMPCfg.SweepCfg.SweepPoints : 1))
+    {
+      AppIMPCfg.ScanPointCount = 0;
+      AppIMPCfg.ScanGroup = (AppIMPCfg.ScanGroup + 1)%AppIMPCfg.ScanGroupNum;
+      AppIMPScanLoadGroup(AppIMPCfg.ScanGroup, bTRUE);
+    }
+  }
   if(AppIMPCfg.NumOfData > 0)
   {
-    AppIMPCfg.FifoDataCount += *pDataCount/4;
-    if(AppIMPCfg.FifoDataCount >= AppIMPCfg.NumOfData)
+    AppIMPCfg.FifoDataCount += points;
+    if(AppIMPCfg.FifoDataCount >= AppIMPCfg.NumOfData*AppIMPRepeatNum())
     {
       AD5940_WUPTCtrl(bFALSE);
       return AD5940ERR_OK;
@@ -635,6 +889,9 @@ int32_t AppIMPRegModify(int32_t * const pData, uint32_t *pDataCount)
     AD5940_WUPTCtrl(bFALSE);
     return AD5940ERR_OK;
   }
+  /* Next measurement repeats the current point, channels and frequency stay */
+  if(bPointDone == bFALSE)
+    return AD5940ERR_OK;
   if(AppIMPCfg.SweepCfg.SweepEn) /* Need to set new frequency and set power mode */
   {
     AD5940_WGFreqCtrlS(AppIMPCfg.SweepNextFreq, AppIMPCfg.SysClkFreq);
@@ -643,18 +900,87 @@ int32_t AppIMPRegModify(int32_t * const pData, uint32_t *pDataCount)
   return AD5940ERR_OK;
 }
 
+#if IMP_FIXED_POINT
+/* Fixed point result to the float polar result of the ISR */
+static void AppIMPFixPolar(const iImpCar_Type *pZ, fImpPol_Type *pPol)
+{
+  iImpPol_Type pol;
+
+  ImpFixPolar(pZ, &pol);
+  pPol->Magnitude = pol.Magnitude*IMPFIX_OHM;
+  pPol->Phase = pol.Phase*IMPFIX_RAD;
+}
+
+/* Float ohm to Q23.8, saturated */
+static int32_t AppIMPFixOhm(float Val)
+{
+  Val *= 1L<<IMPFIX_ZFRAC;
+  if(!(Val > -2147483520.0f))   /* Largest float below 2^31, NaN goes here too */
+    return -INT32_MAX;
+  if(Val > 2147483520.0f)
+    return INT32_MAX;
+  return (int32_t)(Val >= 0 ? Val + 0.5f : Val - 0.5f);
+}
+#endif
+
+/* Polar form of a combined point */
+static void AppIMPPolar(const fImpCar_Type *pZ, fImpPol_Type *pPol)
+{
+#if IMP_FIXED_POINT
+  iImpCar_Type z;
+
+  z.Real = AppIMPFixOhm(pZ->Real);
+  z.Image = AppIMPFixOhm(pZ->Image);
+  AppIMPFixPolar(&z, pPol);
+#else
+  pPol->Magnitude = sqrtf(pZ->Real*pZ->Real + pZ->Image*pZ->Image);
+  pPol->Phase = atan2f(pZ->Image, pZ->Real);
+#endif
+}
+
+/* Next frequency of the sweep. With IMP_FIXED_POINT from the table AppIMPSeqCfgGen filled, without libm */
+static void AppIMPSweepNext(float *pNextFreq)
+{
+#if IMP_FIXED_POINT
+  SoftSweepCfg_Type *pSweep = &AppIMPCfg.SweepCfg;
+
+  if(AppIMPSweepTableNum != 0 && AppIMPSweepTableNum == pSweep->SweepPoints && pSweep->pFreqList == 0)
+  {
+    /* Index steps as in AD5940_SweepNext */
+    if(pSweep->SweepStart < pSweep->SweepStop)
+    {
+      if(++pSweep->SweepIndex >= pSweep->SweepPoints)
+        pSweep->SweepIndex = 0;
+    }
+    else
+    {
+      pSweep->SweepIndex--;
+      if(pSweep->SweepIndex >= pSweep->SweepPoints)
+        pSweep->SweepIndex = pSweep->SweepPoints - 1;
+    }
+    *pNextFreq = AppIMPSweepTable[pSweep->SweepIndex];
+    return;
+  }
+#endif
+  AD5940_SweepNext(&AppIMPCfg.SweepCfg, pNextFreq);
+}
+
 /* Depending on the data type, do appropriate data pre-process before return back to controller */
 int32_t AppIMPDataProcess(int32_t * const pData, uint32_t *pDataCount)
 {
   uint32_t DataCount = *pDataCount;
-  uint32_t ImpResCount = DataCount/4;
+  uint32_t DutPerPoint = AppIMPDutPerPoint();
+  uint32_t ValidPerPoint = AppIMPValidPerPoint();
+  uint32_t ImpResCount = DataCount/AppIMPWordsPerPoint();
+  uint32_t RepeatNum = AppIMPRepeatNum();
+  uint32_t OutCount = 0;
 
   fImpPol_Type * const pOut = (fImpPol_Type*)pData;
   iImpCar_Type * pSrcData = (iImpCar_Type*)pData;
 
   *pDataCount = 0;
 
-  DataCount = (DataCount/4)*4;/* We expect RCAL data together with Rz data. One DFT result has two data in FIFO, real part and imaginary part.  */
+  DataCount = ImpResCount*AppIMPWordsPerPoint();/* We expect RCAL data together with Rz data. One DFT result has two data in FIFO, real part and imaginary part.  */
 
   /* Convert DFT result to int32_t type */
   for(uint32_t i=0; i<DataCount; i++)
@@ -668,32 +994,89 @@ int32_t AppIMPDataProcess(int32_t * const pData, uint32_t *pDataCount)
   for(uint32_t i=0; i<ImpResCount; i++)
   {
     iImpCar_Type *pDftRcal, *pDftRz;
+#if !IMP_FIXED_POINT
+    float RcalMag, RcalPhase;
+#endif
 
+    /* All DUT results of this point are referenced to the same RCAL result */
     pDftRcal = pSrcData++;
-    pDftRz = pSrcData++;
-    float RzMag,RzPhase;
-    float RcalMag, RcalPhase;
-    
+#if !IMP_FIXED_POINT
     RcalMag = sqrt((float)pDftRcal->Real*pDftRcal->Real+(float)pDftRcal->Image*pDftRcal->Image);
     RcalPhase = atan2(-pDftRcal->Image,pDftRcal->Real);
-    RzMag = sqrt((float)pDftRz->Real*pDftRz->Real+(float)pDftRz->Image*pDftRz->Image);
-    RzPhase = atan2(-pDftRz->Image,pDftRz->Real);
+#endif
+    for(uint32_t k=0; k<DutPerPoint; k++)
+    {
+      fImpPol_Type *pRes = &pOut[i*ValidPerPoint + k];
+      fImpCar_Type z;
 
-    RzMag = RcalMag/RzMag*AppIMPCfg.RcalVal;
-    RzPhase = RcalPhase - RzPhase;
-    //printf("V:%d,%d,I:%d,%d ",pDftRcal->Real,pDftRcal->Image, pDftRz->Real, pDftRz->Image);
-    
-    pOut[i].Magnitude = RzMag;
-    pOut[i].Phase = RzPhase;
+      pDftRz = pSrcData++;
+      if(k >= ValidPerPoint)
+        continue;   /* Padding of last scan group */
+#if IMP_FIXED_POINT
+      {
+        iImpCar_Type zfix;
+
+        ImpFixZ(pDftRcal, pDftRz, AppIMPCfg.RcalFix, &zfix);
+        if(RepeatNum == 1)
+        {
+          AppIMPFixPolar(&zfix, pRes);
+          continue;
+        }
+        z.Real = zfix.Real*IMPFIX_OHM;
+        z.Image = zfix.Image*IMPFIX_OHM;
+      }
+#else
+      float RzMag,RzPhase;
+
+      RzMag = sqrt((float)pDftRz->Real*pDftRz->Real+(float)pDftRz->Image*pDftRz->Image);
+      RzPhase = atan2(-pDftRz->Image,pDftRz->Real);
+
+      RzMag = RcalMag/RzMag*AppIMPCfg.RcalVal;
+      RzPhase = RcalPhase - RzPhase;
+      //printf("V:%d,%d,I:%d,%d ",pDftRcal->Real,pDftRcal->Image, pDftRz->Real, pDftRz->Image);
+
+      if(RepeatNum == 1)
+      {
+        pRes->Magnitude = RzMag;
+        pRes->Phase = RzPhase;
+        continue;
+      }
+      z.Real = RzMag*cosf(RzPhase);
+      z.Image = RzMag*sinf(RzPhase);
+#endif
+      /* Repeats are combined on the complex plane, phase wrap does not matter there */
+      PointStatAdd(&AppIMPRepeat[k], &z);
+    }
+    if(RepeatNum == 1)
+    {
+      OutCount++;
+      continue;
+    }
+    /* Return the point when all repeats are in, or with the repeats so far if the AFE stops */
+    AppIMPCfg.RepeatCount++;
+    if(AppIMPCfg.RepeatCount < RepeatNum && AppIMPCfg.StopRequired == bFALSE)
+      continue;
+    for(uint32_t k=0; k<ValidPerPoint; k++)
+    {
+      PointStatResult(&AppIMPRepeat[k], AppIMPCfg.RepeatMode, AppIMPCfg.HampelK, &AppIMPStat[k]);
+      PointStatClear(&AppIMPRepeat[k]);
+      AppIMPPolar(&AppIMPStat[k].Z, &pOut[OutCount*ValidPerPoint + k]);
+    }
+    AppIMPCfg.RepeatCount = 0;
+    OutCount++;
   }
-  *pDataCount = ImpResCount; 
+  *pDataCount = OutCount*ValidPerPoint;
+  if(OutCount == 0)
+    return 0;   /* Repeats of the point are still being measured */
   AppIMPCfg.FreqofData = AppIMPCfg.SweepCurrFreq;
   /* Calculate next frequency point */
   if(AppIMPCfg.SweepCfg.SweepEn == bTRUE)
   {
     AppIMPCfg.FreqofData = AppIMPCfg.SweepCurrFreq;
+    /* SweepIndex already points to SweepNextFreq */
+    AppIMPCfg.IndexofData = (AppIMPCfg.SweepCfg.SweepIndex + AppIMPCfg.SweepCfg.SweepPoints - 1)%AppIMPCfg.SweepCfg.SweepPoints;
     AppIMPCfg.SweepCurrFreq = AppIMPCfg.SweepNextFreq;
-    AD5940_SweepNext(&AppIMPCfg.SweepCfg, &AppIMPCfg.SweepNextFreq);
+    AppIMPSweepNext(&AppIMPCfg.SweepNextFreq);
   }
 
   return 0;
@@ -716,8 +1099,8 @@ int32_t AppIMPISR(void *pBuff, uint32_t *pCount)
 
   if(AD5940_INTCTestFlag(AFEINTC_0, AFEINTSRC_DATAFIFOTHRESH) == bTRUE)
   {
-    /* Now there should be 4 data in FIFO */
-    FifoCnt = (AD5940_FIFOGetCnt()/4)*4;
+    /* Now there should be RCAL and DUT results of one point in FIFO */
+    FifoCnt = (AD5940_FIFOGetCnt()/AppIMPWordsPerPoint())*AppIMPWordsPerPoint();
     
     if(FifoCnt > BuffCount)
     {
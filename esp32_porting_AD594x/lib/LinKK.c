@@ -0,0 +1,183 @@
+/*!
+ *****************************************************************************
+ @file:    LinKK.c
+ @brief:   Linear Kramers-Kronig test of a sweep on target.
+ -----------------------------------------------------------------------------
+
+ Same basis and weights as EisKKTest() of Host_Tools/EisKK.c, in float.
+ Host_Tools/kk_check.c compiles this file on the host and compares it
+ with EisKKTest().
+
+*****************************************************************************/
+#include "LinKK.h"
+#include <string.h>
+#include <math.h>
+
+#define LINKK_MATH_PI         3.14159265f
+#define LINKK_RIDGE           1e-3f   /* Damping of the scaled problem, basis columns are close to dependent */
+#define LINKK_COL_RC          3       /* First RC column, after R, L and C */
+#define LINKK_MAX_COLS        (LINKK_MAX_BASIS + LINKK_COL_RC)
+
+/* Basis row of real and imaginary part at angular frequency w */
+static void LinKKRow(float Omega, float WMin, float WMax, float LnStep, uint32_t Basis, float *pRe, float *pIm)
+{
+  float wt;
+  uint32_t k;
+
+  pRe[0] = 1;             pIm[0] = 0;
+  pRe[1] = 0;             pIm[1] = Omega/WMax;
+  pRe[2] = 0;             pIm[2] = -WMin/Omega;
+  for(k=0; k<Basis; k++)
+  {
+    wt = Basis > 1 ? Omega/WMax*expf(k*LnStep) : Omega/sqrtf(WMin*WMax);
+    pRe[LINKK_COL_RC + k] = 1/(1 + wt*wt);
+    pIm[LINKK_COL_RC + k] = -wt/(1 + wt*wt);
+  }
+}
+
+/* Rotate weighted row a, b into upper triangular R and right side y by Givens rotations */
+static void LinKKRotate(float *pR, float *pY, float *pA, float B, uint32_t P)
+{
+  float c, s, r, t;
+  uint32_t i, k;
+
+  for(i=0; i<P; i++)
+  {
+    if(pA[i] == 0)
+      continue;
+    r = hypotf(pR[i*P + i], pA[i]);
+    c = pR[i*P + i]/r;
+    s = pA[i]/r;
+    pR[i*P + i] = r;
+    for(k=i+1; k<P; k++)
+    {
+      t = pR[i*P + k];
+      pR[i*P + k] = c*t + s*pA[k];
+      pA[k] = c*pA[k] - s*t;
+    }
+    t = pY[i];
+    pY[i] = c*t + s*B;
+    B = c*B - s*t;
+  }
+}
+
+void LinKKInit(LinKK_Type *pKK)
+{
+  pKK->Basis = 0;
+  pKK->Threshold = 0.02f;
+  pKK->Count = 0;
+}
+
+/**
+ * @brief Drop collected points, e.g. of a sweep that was stopped.
+*/
+void LinKKClear(LinKK_Type *pKK)
+{
+  pKK->Count = 0;
+}
+
+/**
+ * @brief Collect one point of the sweep.
+ * @return AD5940ERR_BUFF if LINKK_MAX_POINTS are collected already,
+ *         AD5940ERR_PARA if the point can't be used.
+*/
+AD5940Err LinKKAdd(LinKK_Type *pKK, float Freq, const fImpCar_Type *pZ)
+{
+  float mag2 = pZ->Real*pZ->Real + pZ->Image*pZ->Image;
+  uint32_t n = pKK->Count;
+
+  if(n >= LINKK_MAX_POINTS)
+    return AD5940ERR_BUFF;
+  if(!(Freq > 0) || !(mag2 > 0) || !isfinite(mag2))
+    return AD5940ERR_PARA;
+  pKK->Omega[n] = 2*LINKK_MATH_PI*Freq;
+  pKK->Real[n] = pZ->Real;
+  pKK->Image[n] = pZ->Image;
+  pKK->Count++;
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Test the collected sweep and clear it for the next one.
+ * @return pResult->bPass.
+*/
+BoolFlag LinKKRun(LinKK_Type *pKK, LinKKResult_Type *pResult)
+{
+  float r[LINKK_MAX_COLS*LINKK_MAX_COLS], x[LINKK_MAX_COLS];
+  float re[LINKK_MAX_COLS], im[LINKK_MAX_COLS];
+  float w_min = INFINITY, w_max = 0, ln_step = 0, z_max = 0, mag, sum_res = 0;
+  uint32_t basis = pKK->Basis, cols, n, k, l;
+
+  memset(pResult, 0, sizeof(*pResult));
+  pResult->bPass = bTRUE;
+  for(n=0; n<pKK->Count; n++)
+  {
+    w_min = pKK->Omega[n] < w_min ? pKK->Omega[n] : w_min;
+    w_max = pKK->Omega[n] > w_max ? pKK->Omega[n] : w_max;
+  }
+  if(basis == 0 && pKK->Count)
+    basis = (uint32_t)ceilf(log10f(w_max/w_min)*LINKK_PER_DECADE) + 1;
+  if(basis > LINKK_MAX_BASIS)
+    basis = LINKK_MAX_BASIS;
+  cols = basis + LINKK_COL_RC;
+  if(pKK->Count*2 < cols || !(w_max > w_min))
+  {
+    pKK->Count = 0;
+    return pResult->bPass;
+  }
+  if(basis > 1)
+    ln_step = logf(w_max/w_min)/(basis - 1);
+
+  /* Least squares by QR, rows weighted by 1/|Z| and unknowns scaled by the largest |Z| */
+  memset(r, 0, sizeof(r));
+  memset(x, 0, sizeof(x));
+  for(n=0; n<pKK->Count; n++)
+  {
+    mag = sqrtf(pKK->Real[n]*pKK->Real[n] + pKK->Image[n]*pKK->Image[n]);
+    z_max = mag > z_max ? mag : z_max;
+  }
+  for(k=0; k<cols; k++)
+    r[k*cols + k] = LINKK_RIDGE;
+  for(n=0; n<pKK->Count; n++)
+  {
+    LinKKRow(pKK->Omega[n], w_min, w_max, ln_step, basis, re, im);
+    mag = sqrtf(pKK->Real[n]*pKK->Real[n] + pKK->Image[n]*pKK->Image[n]);
+    for(k=0; k<cols; k++)
+    {
+      re[k] *= z_max/mag;
+      im[k] *= z_max/mag;
+    }
+    LinKKRotate(r, x, re, pKK->Real[n]/mag, cols);
+    LinKKRotate(r, x, im, pKK->Image[n]/mag, cols);
+  }
+  for(k=cols; k-- > 0;)
+  {
+    for(l=k+1; l<cols; l++)
+      x[k] -= r[k*cols + l]*x[l];
+    x[k] /= r[k*cols + k];
+  }
+  for(k=0; k<cols; k++)
+    x[k] *= z_max;
+
+  for(n=0; n<pKK->Count; n++)
+  {
+    float zr = 0, zi = 0, dr, di;
+    LinKKRow(pKK->Omega[n], w_min, w_max, ln_step, basis, re, im);
+    for(k=0; k<cols; k++)
+    {
+      zr += re[k]*x[k];
+      zi += im[k]*x[k];
+    }
+    mag = sqrtf(pKK->Real[n]*pKK->Real[n] + pKK->Image[n]*pKK->Image[n]);
+    dr = fabsf(pKK->Real[n] - zr)/mag;
+    di = fabsf(pKK->Image[n] - zi)/mag;
+    sum_res += dr*dr + di*di;
+    pResult->MaxRes = dr > pResult->MaxRes ? dr : pResult->MaxRes;
+    pResult->MaxRes = di > pResult->MaxRes ? di : pResult->MaxRes;
+  }
+  pResult->Points = pKK->Count;
+  pResult->RmsRes = sqrtf(sum_res/(2*pKK->Count));
+  pResult->bPass = pResult->MaxRes <= pKK->Threshold ? bTRUE : bFALSE;
+  pKK->Count = 0;
+  return pResult->bPass;
+}
@@ -0,0 +1,132 @@
+/*!
+ *****************************************************************************
+ @file:    PointStat.c
+ @brief:   Robust combination of repeated measurements of one point.
+ -----------------------------------------------------------------------------
+
+ Host_Tools/pointstat_check.c compiles this file on the host and checks
+ the modes on repeats with spikes.
+
+*****************************************************************************/
+#include "PointStat.h"
+#include <string.h>
+#include <math.h>
+
+#define POINTSTAT_MAD_SIGMA   0.8493f   /* sigma/MAD of the distance of complex Gaussian noise, 1/sqrt(2ln2) */
+
+/* Small sample scale of the threshold by repeat count, from 3. With few repeats the distances are
+   taken from a median of the same repeats and their median scatters, so the plain estimate
+   rejects clean repeats far more often than the Gaussian tail. These factors give clean Gaussian
+   repeats the large sample rejection rate exp(-K^2/2) at HampelK 3, from simulation. */
+#if POINTSTAT_MAX_REPEAT != 16
+#error "PointStatHampelScale needs a factor for each repeat count"
+#endif
+static const float PointStatHampelScale[POINTSTAT_MAX_REPEAT - 2] =
+{
+  3.290f, 1.705f, 1.738f, 1.425f, 1.431f, 1.303f, 1.307f,
+  1.238f, 1.239f, 1.195f, 1.194f, 1.166f, 1.165f, 1.143f,
+};
+
+/* Welford update of mean and squared deviations with one value */
+static void PointStatWelford(uint32_t n, fImpCar_Type *pMean, fImpCar_Type *pM2, const fImpCar_Type *pZ)
+{
+  float dr = pZ->Real - pMean->Real, di = pZ->Image - pMean->Image;
+  pMean->Real += dr/n;
+  pMean->Image += di/n;
+  pM2->Real += dr*(pZ->Real - pMean->Real);
+  pM2->Image += di*(pZ->Image - pMean->Image);
+}
+
+/* Median of Count values, sorted in place */
+static float PointStatMedian(float *pVal, uint32_t Count)
+{
+  uint32_t i, j;
+  float v;
+
+  for(i=1; i<Count; i++)
+  {
+    v = pVal[i];
+    for(j=i; j>0 && pVal[j-1] > v; j--)
+      pVal[j] = pVal[j-1];
+    pVal[j] = v;
+  }
+  return (Count&1) ? pVal[Count/2] : 0.5f*(pVal[Count/2 - 1] + pVal[Count/2]);
+}
+
+/**
+ * @brief Start a new point.
+*/
+void PointStatClear(PointStat_Type *pStat)
+{
+  memset(pStat, 0, sizeof(*pStat));
+}
+
+/**
+ * @brief Add one repeat. Repeats past POINTSTAT_MAX_REPEAT are ignored.
+*/
+void PointStatAdd(PointStat_Type *pStat, const fImpCar_Type *pZ)
+{
+  if(pStat->Count >= POINTSTAT_MAX_REPEAT)
+    return;
+  pStat->Value[pStat->Count++] = *pZ;
+  PointStatWelford(pStat->Count, &pStat->Mean, &pStat->M2, pZ);
+}
+
+/**
+ * @brief Combine the repeats added so far.
+ * @param Mode: POINTSTAT_MEAN, POINTSTAT_MEDIAN or POINTSTAT_HAMPEL.
+ * @param HampelK: Rejection threshold of POINTSTAT_HAMPEL in estimated sigmas, typically 3.
+ * @return AD5940ERR_PARA if there are no repeats or Mode is unknown.
+*/
+AD5940Err PointStatResult(const PointStat_Type *pStat, uint32_t Mode, float HampelK, PointStatResult_Type *pRes)
+{
+  float re[POINTSTAT_MAX_REPEAT], im[POINTSTAT_MAX_REPEAT];
+  fImpCar_Type med, mean, m2;
+  float lim;
+  uint32_t n = pStat->Count, i, used;
+
+  if(n == 0 || Mode > POINTSTAT_HAMPEL)
+    return AD5940ERR_PARA;
+  pRes->Z = pStat->Mean;
+  pRes->Used = (uint8_t)n;
+  pRes->Rejected = 0;
+  pRes->Var.Real = n > 1 ? pStat->M2.Real/(n - 1) : 0;
+  pRes->Var.Image = n > 1 ? pStat->M2.Image/(n - 1) : 0;
+  if(Mode == POINTSTAT_MEAN || n < 3)
+    return AD5940ERR_OK;
+
+  for(i=0; i<n; i++)
+  {
+    re[i] = pStat->Value[i].Real;
+    im[i] = pStat->Value[i].Image;
+  }
+  med.Real = PointStatMedian(re, n);
+  med.Image = PointStatMedian(im, n);
+  if(Mode == POINTSTAT_MEDIAN)
+  {
+    pRes->Z = med;
+    return AD5940ERR_OK;
+  }
+
+  /* Distances from the median, re[] keeps them in order of the repeats */
+  for(i=0; i<n; i++)
+  {
+    re[i] = hypotf(pStat->Value[i].Real - med.Real, pStat->Value[i].Image - med.Image);
+    im[i] = re[i];
+  }
+  lim = HampelK*PointStatHampelScale[n - 3]*POINTSTAT_MAD_SIGMA*PointStatMedian(im, n);
+  memset(&mean, 0, sizeof(mean));
+  memset(&m2, 0, sizeof(m2));
+  for(i=0, used=0; i<n; i++)
+  {
+    if(re[i] > lim)
+      continue;
+    PointStatWelford(++used, &mean, &m2, &pStat->Value[i]);
+  }
+  pRes->Z = mean;
+  pRes->Used = (uint8_t)used;
+  pRes->Rejected = (uint8_t)(n - used);
+  pRes->Var.Real = used > 1 ? m2.Real/(used - 1) : 0;
+  pRes->Var.Image = used > 1 ? m2.Image/(used - 1) : 0;
+  return AD5940ERR_OK;
+}
@@ -0,0 +1,420 @@
+/*!
+ *****************************************************************************
+ @file:    RandlesFit.c
+ @brief:   Randles circuit fit of a sweep on target.
+ -----------------------------------------------------------------------------
+
+ Same method as EisFit() of Host_Tools/EisFit.c, for one fixed circuit and
+ in float so it runs on the FPU of the ESP32. Host_Tools/randles_check.c
+ compiles this file on the host and compares it with EisFit().
+
+*****************************************************************************/
+#include "RandlesFit.h"
+#include <string.h>
+#include <math.h>
+
+#define RANDLES_MATH_PI       3.14159265f
+#define RANDLES_LAMBDA_INIT   1e-3f
+#define RANDLES_LAMBDA_MAX    1e8f
+#define RANDLES_STEP_TOL      1e-5f   /* Converged when no parameter moves more, log scale is relative */
+#define RANDLES_GUESS_TRIES   8       /* Other points tried as top of the arc for a cold start */
+
+static fImpCar_Type RandlesMul(fImpCar_Type a, fImpCar_Type b)
+{
+  fImpCar_Type r = {a.Real*b.Real - a.Image*b.Image, a.Real*b.Image + a.Image*b.Real};
+  return r;
+}
+
+static fImpCar_Type RandlesDiv(fImpCar_Type a, fImpCar_Type b)
+{
+  float d = b.Real*b.Real + b.Image*b.Image;
+  fImpCar_Type r = {(a.Real*b.Real + a.Image*b.Image)/d, (a.Image*b.Real - a.Real*b.Image)/d};
+  return r;
+}
+
+/* Model at angular frequency w, with dZ/dx on the fit scale of every parameter if pD is not NULL */
+static fImpCar_Type RandlesZ(const float *pParam, float Omega, float LnOmega, fImpCar_Type *pD)
+{
+  float s = 1.0f/sqrtf(Omega), wn = expf(pParam[RANDLES_N]*LnOmega);
+  float arg = pParam[RANDLES_N]*RANDLES_MATH_PI/2;
+  fImpCar_Type zf = {pParam[RANDLES_RCT] + pParam[RANDLES_SIGMA]*s, -pParam[RANDLES_SIGMA]*s};
+  fImpCar_Type y = {pParam[RANDLES_Q]*wn*cosf(arg), pParam[RANDLES_Q]*wn*sinf(arg)};
+  fImpCar_Type den = RandlesMul(y, zf), zp, z, dzf, zpy;
+
+  den.Real += 1;
+  zp = RandlesDiv(zf, den);
+  z.Real = pParam[RANDLES_RS] + zp.Real;
+  z.Image = zp.Image;
+  if(pD)
+  {
+    /* dZp/dZf = 1/den^2, dZp/dY = -Zp^2 */
+    dzf = RandlesDiv(RandlesMul(zp, zp), RandlesMul(zf, zf));
+    zpy = RandlesMul(RandlesMul(zp, zp), y);
+    pD[RANDLES_RS].Real = pParam[RANDLES_RS];
+    pD[RANDLES_RS].Image = 0;
+    pD[RANDLES_RCT].Real = pParam[RANDLES_RCT]*dzf.Real;
+    pD[RANDLES_RCT].Image = pParam[RANDLES_RCT]*dzf.Image;
+    pD[RANDLES_Q].Real = -zpy.Real;
+    pD[RANDLES_Q].Image = -zpy.Image;
+    /* dY/dn = Y ln(jw) */
+    pD[RANDLES_N].Real = -(zpy.Real*LnOmega - zpy.Image*RANDLES_MATH_PI/2);
+    pD[RANDLES_N].Image = -(zpy.Image*LnOmega + zpy.Real*RANDLES_MATH_PI/2);
+    /* Sigma s (1-j) dZp/dZf */
+    pD[RANDLES_SIGMA].Real = pParam[RANDLES_SIGMA]*s*(dzf.Real + dzf.Image);
+    pD[RANDLES_SIGMA].Image = pParam[RANDLES_SIGMA]*s*(dzf.Image - dzf.Real);
+  }
+  return z;
+}
+
+/* Fit scale to parameters, n is linear and the rest logarithmic */
+static void RandlesParam(const float *pX, float *pParam)
+{
+  uint32_t k;
+  for(k=0; k<RANDLES_PARAMS; k++)
+    pParam[k] = k == RANDLES_N ? pX[k] : expf(pX[k]);
+}
+
+/* Cost at x, with gradient g = J'r and A = J'J if pA is not NULL */
+static float RandlesCost(const RandlesFit_Type *pFit, const float *pX, float *pA, float *pG)
+{
+  float param[RANDLES_PARAMS], jr[RANDLES_PARAMS], ji[RANDLES_PARAMS];
+  fImpCar_Type dz[RANDLES_PARAMS], z;
+  float cost = 0, rr, ri;
+  uint32_t n, k, l;
+
+  RandlesParam(pX, param);
+  if(pA)
+  {
+    memset(pA, 0, RANDLES_PARAMS*RANDLES_PARAMS*sizeof(float));
+    memset(pG, 0, RANDLES_PARAMS*sizeof(float));
+  }
+  for(n=0; n<pFit->Count; n++)
+  {
+    z = RandlesZ(param, pFit->Omega[n], pFit->LnOmega[n], pA ? dz : NULL);
+    rr = (z.Real - pFit->Real[n])*pFit->Weight[n];
+    ri = (z.Image - pFit->Image[n])*pFit->Weight[n];
+    cost += rr*rr + ri*ri;
+    if(pA == NULL)
+      continue;
+    for(k=0; k<RANDLES_PARAMS; k++)
+    {
+      jr[k] = dz[k].Real*pFit->Weight[n];
+      ji[k] = dz[k].Image*pFit->Weight[n];
+      pG[k] += jr[k]*rr + ji[k]*ri;
+    }
+    for(k=0; k<RANDLES_PARAMS; k++)
+      for(l=0; l<=k; l++)
+        pA[k*RANDLES_PARAMS + l] += jr[k]*jr[l] + ji[k]*ji[l];
+  }
+  if(pA)
+    for(k=0; k<RANDLES_PARAMS; k++)
+      for(l=0; l<k; l++)
+        pA[l*RANDLES_PARAMS + k] = pA[k*RANDLES_PARAMS + l];
+  return isfinite(cost) ? cost : INFINITY;
+}
+
+/* Solve A x = b for symmetric positive definite A by Cholesky, A is overwritten */
+static AD5940Err RandlesSolve(float *pA, const float *pB, float *pX)
+{
+  const uint32_t P = RANDLES_PARAMS;
+  uint32_t i, j, k;
+  float s;
+
+  for(j=0; j<P; j++)
+  {
+    s = pA[j*P + j];
+    for(k=0; k<j; k++)
+      s -= pA[j*P + k]*pA[j*P + k];
+    if(!(s > 0))
+      return AD5940ERR_ERROR;
+    pA[j*P + j] = sqrtf(s);
+    for(i=j+1; i<P; i++)
+    {
+      s = pA[i*P + j];
+      for(k=0; k<j; k++)
+        s -= pA[i*P + k]*pA[j*P + k];
+      pA[i*P + j] = s/pA[j*P + j];
+    }
+  }
+  for(i=0; i<P; i++)
+  {
+    s = pB[i];
+    for(k=0; k<i; k++)
+      s -= pA[i*P + k]*pX[k];
+    pX[i] = s/pA[i*P + i];
+  }
+  for(i=P; i-- > 0;)
+  {
+    s = pX[i];
+    for(k=i+1; k<P; k++)
+      s -= pA[k*P + i]*pX[k];
+    pX[i] = s/pA[i*P + i];
+  }
+  return AD5940ERR_OK;
+}
+
+/* Start with the top of the arc at point Top */
+static void RandlesStart(const RandlesFit_Type *pFit, uint32_t Top, uint32_t Lf, float Rs, float ZMax, float *pX)
+{
+  float rct, sigma, floor_w = ZMax*1e-3f*sqrtf(pFit->Omega[Lf]);
+
+  rct = 2*(pFit->Real[Top] - Rs);
+  if(rct < ZMax*1e-3f)
+    rct = pFit->Real[Lf] - Rs;
+  if(rct < ZMax*1e-3f)
+    rct = ZMax*1e-3f;
+  sigma = (pFit->Real[Lf] - Rs - rct)*sqrtf(pFit->Omega[Lf]);
+  pX[RANDLES_RS] = logf(Rs);
+  pX[RANDLES_RCT] = logf(rct);
+  pX[RANDLES_Q] = -logf(rct) - 0.9f*pFit->LnOmega[Top];
+  pX[RANDLES_N] = 0.9f;
+  pX[RANDLES_SIGMA] = logf(sigma > floor_w ? sigma : floor_w);
+}
+
+/**
+ * @brief Starting point and bounds on the fit scale from the collected spectrum.
+ *        Rs is the smallest real part, Rct follows from the real part at the
+ *        top of the arc, Q from the frequency there and Sigma from what is
+ *        left of the real part at the lowest frequency. The top of the arc
+ *        is the first maximum of -Im coming from high frequencies, as the
+ *        Warburg tail rises again below it. Sweeps are expected in
+ *        frequency order, up or down. Where the tail hides the top, a few
+ *        other points are tried as top and the start with the lowest cost
+ *        is taken.
+*/
+static void RandlesGuess(const RandlesFit_Type *pFit, float *pX, float *pLo, float *pHi)
+{
+  uint32_t n, hf = 0, lf = 0, pk, i;
+  float zmax = 0, rs, m, cost, best;
+  float x[RANDLES_PARAMS];
+
+  rs = pFit->Real[0];
+  for(n=0; n<pFit->Count; n++)
+  {
+    m = 1.0f/pFit->Weight[n];
+    if(m > zmax) zmax = m;
+    if(pFit->Omega[n] > pFit->Omega[hf]) hf = n;
+    if(pFit->Omega[n] < pFit->Omega[lf]) lf = n;
+    if(pFit->Real[n] < rs) rs = pFit->Real[n];
+  }
+  if(rs < zmax*1e-4f)
+    rs = zmax*1e-4f;
+  pk = hf;
+  for(n=1; n<pFit->Count; n++)
+  {
+    i = hf == 0 ? n : pFit->Count - 1 - n;
+    if(-pFit->Image[i] > -pFit->Image[pk])
+      pk = i;
+    else if(pFit->Image[i] - pFit->Image[pk] > -0.1f*pFit->Image[pk] + 0.01f*zmax)
+      break;      /* Clearly past the top, not just noise */
+  }
+  RandlesStart(pFit, pk, lf, rs, zmax, pX);
+  best = RandlesCost(pFit, pX, NULL, NULL);
+  for(n=0; n<RANDLES_GUESS_TRIES; n++)
+  {
+    RandlesStart(pFit, n*pFit->Count/RANDLES_GUESS_TRIES, lf, rs, zmax, x);
+    cost = RandlesCost(pFit, x, NULL, NULL);
+    if(cost < best)
+    {
+      best = cost;
+      memcpy(pX, x, sizeof(x));
+    }
+  }
+
+  pLo[RANDLES_RS] = logf(zmax*1e-6f);
+  pHi[RANDLES_RS] = logf(zmax*10);
+  pLo[RANDLES_RCT] = logf(zmax*1e-6f);
+  pHi[RANDLES_RCT] = logf(zmax*1e4f);
+  pLo[RANDLES_Q] = logf(1e-15f);
+  pHi[RANDLES_Q] = logf(1e3f);
+  pLo[RANDLES_N] = RANDLES_N_MIN;
+  pHi[RANDLES_N] = 1;
+  pLo[RANDLES_SIGMA] = logf(zmax*1e-6f*sqrtf(pFit->Omega[lf]));
+  pHi[RANDLES_SIGMA] = logf(zmax*1e4f*sqrtf(pFit->Omega[hf]));
+}
+
+/**
+ * @brief Initialize fit with default settings: 50 iterations, tolerance 1e-5, warm start.
+*/
+void RandlesFitInit(RandlesFit_Type *pFit)
+{
+  pFit->MaxIter = 50;
+  pFit->Tol = 1e-5f;
+  pFit->bWarmStart = bTRUE;
+  pFit->Count = 0;
+  pFit->Channel = 0;
+  pFit->bLastValid = bFALSE;
+}
+
+/**
+ * @brief Drop collected points, e.g. of a sweep that was stopped.
+*/
+void RandlesFitClear(RandlesFit_Type *pFit)
+{
+  pFit->Count = 0;
+}
+
+/**
+ * @brief Collect one point of the sweep. Points of another channel start a new sweep.
+ * @return AD5940ERR_BUFF if RANDLES_MAX_POINTS are collected already,
+ *         AD5940ERR_PARA if the point can't be used.
+*/
+AD5940Err RandlesFitAdd(RandlesFit_Type *pFit, uint16_t Channel, float Freq, const fImpCar_Type *pZ)
+{
+  float mag = sqrtf(pZ->Real*pZ->Real + pZ->Image*pZ->Image);
+  uint32_t n = pFit->Count;
+
+  if(n && Channel != pFit->Channel)
+    n = pFit->Count = 0;
+  pFit->Channel = Channel;
+  if(n >= RANDLES_MAX_POINTS)
+    return AD5940ERR_BUFF;
+  if(!(Freq > 0) || !(mag > 0) || !isfinite(mag))
+    return AD5940ERR_PARA;
+  pFit->Omega[n] = 2*RANDLES_MATH_PI*Freq;
+  pFit->LnOmega[n] = logf(pFit->Omega[n]);
+  pFit->Real[n] = pZ->Real;
+  pFit->Image[n] = pZ->Image;
+  pFit->Weight[n] = 1.0f/mag;
+  pFit->Count++;
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Fit the collected sweep and clear it for the next one.
+ * @return pResult->Status.
+*/
+uint32_t RandlesFitRun(RandlesFit_Type *pFit, RandlesResult_Type *pResult)
+{
+  const uint32_t P = RANDLES_PARAMS;
+  float x[RANDLES_PARAMS], xn[RANDLES_PARAMS], lo[RANDLES_PARAMS], hi[RANDLES_PARAMS];
+  float a[RANDLES_PARAMS*RANDLES_PARAMS], m[RANDLES_PARAMS*RANDLES_PARAMS];
+  float g[RANDLES_PARAMS], d[RANDLES_PARAMS], rhs[RANDLES_PARAMS];
+  float lambda = RANDLES_LAMBDA_INIT, cost, cost_n = 0, dmax;
+  uint32_t max_iter = pFit->MaxIter > RANDLES_MAX_ITER ? RANDLES_MAX_ITER : pFit->MaxIter;
+  uint32_t k, l;
+  BoolFlag bDone = bFALSE;
+
+  memset(pResult, 0, sizeof(*pResult));
+  pResult->Status = RANDLES_FAIL;
+  pResult->Channel = pFit->Channel;
+  pResult->Points = pFit->Count;
+  if(pFit->Count < P)
+  {
+    pFit->Count = 0;
+    return pResult->Status;
+  }
+  RandlesGuess(pFit, x, lo, hi);
+  if(pFit->bWarmStart && pFit->bLastValid && pFit->LastChannel == pFit->Channel)
+    memcpy(x, pFit->Last, sizeof(x));
+  for(k=0; k<P; k++)
+    x[k] = x[k] < lo[k] ? lo[k] : x[k] > hi[k] ? hi[k] : x[k];
+
+  cost = RandlesCost(pFit, x, a, g);
+  while(bDone == bFALSE && pResult->Iter < max_iter && isfinite(cost))
+  {
+    pResult->Iter++;
+    /* Raise damping until a step lowers the cost */
+    for(;;)
+    {
+      dmax = 0;
+      for(k=0; k<P; k++)
+        if(a[k*P + k] > dmax)
+          dmax = a[k*P + k];
+      memcpy(m, a, sizeof(m));
+      for(k=0; k<P; k++)
+      {
+        m[k*P + k] += lambda*(a[k*P + k] > dmax*1e-6f ? a[k*P + k] : dmax*1e-6f + 1e-30f);
+        rhs[k] = -g[k];
+      }
+      /* Hold parameters on a bound that the gradient pushes outwards */
+      for(k=0; k<P; k++)
+      {
+        if(!((x[k] <= lo[k] && g[k] > 0) || (x[k] >= hi[k] && g[k] < 0)))
+          continue;
+        for(l=0; l<P; l++)
+          m[k*P + l] = m[l*P + k] = 0;
+        m[k*P + k] = 1;
+        rhs[k] = 0;
+      }
+      if(RandlesSolve(m, rhs, d) == AD5940ERR_OK)
+      {
+        for(k=0; k<P; k++)
+        {
+          xn[k] = x[k] + d[k];
+          xn[k] = xn[k] < lo[k] ? lo[k] : xn[k] > hi[k] ? hi[k] : xn[k];
+        }
+        cost_n = RandlesCost(pFit, xn, NULL, NULL);
+        if(cost_n < cost)
+          break;
+      }
+      lambda *= 10;
+      if(lambda > RANDLES_LAMBDA_MAX)
+      {
+        /* No step helps: at a minimum, possibly on a bound */
+        bDone = bTRUE;
+        break;
+      }
+    }
+    if(bDone)
+      break;
+    /* Converged when the cost or the parameters stop changing */
+    bDone = (cost - cost_n <= pFit->Tol*cost || cost_n == 0) ? bTRUE : bFALSE;
+    for(k=0; k<P && bDone == bFALSE; k++)
+      if(fabsf(xn[k] - x[k]) > RANDLES_STEP_TOL*(1 + fabsf(x[k])))
+        break;
+    if(k == P)
+      bDone = bTRUE;
+    memcpy(x, xn, sizeof(x));
+    cost = RandlesCost(pFit, x, a, g);
+    lambda = lambda > 1e-7f ? lambda/10 : lambda;
+  }
+
+  RandlesParam(x, pResult->Param);
+  pResult->ResNorm = sqrtf(cost/(2*pFit->Count));
+  pResult->Status = !isfinite(cost) ? RANDLES_FAIL : bDone ? RANDLES_OK : RANDLES_MAXITER;
+  pFit->bLastValid = pResult->Status == RANDLES_FAIL ? bFALSE : bTRUE;
+  pFit->LastChannel = pFit->Channel;
+  memcpy(pFit->Last, x, sizeof(x));
+  pFit->Count = 0;
+  return pResult->Status;
+}
+
+/**
+ * @brief Impedance of the model at a frequency in Hz.
+ * @param pParam: RANDLES_PARAMS parameters, as in RandlesResult_Type.
+*/
+void RandlesFitEval(const float *pParam, float Freq, fImpCar_Type *pZ)
+{
+  float w = 2*RANDLES_MATH_PI*Freq;
+  *pZ = RandlesZ(pParam, w, logf(w), NULL);
+}
+
+/**
+ * @brief Fit the collected sweep and send the result as a fit record (see ResultStream.h).
+ * @param TimeUs, bHostTime: Time stamp of the record, e.g. of the last point of the sweep.
+ * @param bKKFail: The sweep failed LinKKRun(), the record is marked with RSTREAM_FLAG_KKFAIL.
+ * @return AD5940ERR_BUFF if the encoder has no write function.
+*/
+AD5940Err RandlesFitSend(RandlesFit_Type *pFit, RStreamEnc_Type *pEnc, uint64_t TimeUs, BoolFlag bHostTime,
+                         BoolFlag bKKFail)
+{
+  RandlesResult_Type res;
+  RStreamFit_Type rec;
+  uint32_t k;
+
+  RandlesFitRun(pFit, &res);
+  rec.TimeUs = TimeUs;
+  rec.bHostTime = bHostTime;
+  rec.bKKFail = bKKFail;
+  rec.Channel = res.Channel;
+  rec.Points = (uint16_t)res.Points;
+  rec.Model = RSTREAM_FIT_RANDLES;
+  rec.Status = (uint8_t)res.Status;
+  rec.Iter = (uint8_t)res.Iter;
+  rec.ParamCount = RANDLES_PARAMS;
+  for(k=0; k<RANDLES_PARAMS; k++)
+    rec.Param[k] = res.Param[k];
+  rec.ResNorm = res.ResNorm;
+  return RStreamAddFit(pEnc, &rec);
+}
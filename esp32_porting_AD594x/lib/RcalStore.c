@@ -0,0 +1,154 @@
+/*!
+ *****************************************************************************
+ @file:    RcalStore.c
+ @brief:   Frequency keyed RCAL reference store shared across sweeps.
+ -----------------------------------------------------------------------------
+
+ Anchors are kept in polar form. The RCAL response phase turns with
+ frequency because of the filter group delay, interpolating real and
+ imaginary parts separately would shrink the magnitude between anchors.
+
+*****************************************************************************/
+#include "RcalStore.h"
+#include <stdlib.h>
+
+AD5940Err RcalStoreInit(RcalStore_Type *pStore, uint32_t Capacity)
+{
+  if(pStore == 0 || Capacity == 0)
+    return AD5940ERR_PARA;
+  if(pStore->pAnchor == 0 || pStore->Capacity < Capacity)
+  {
+    RcalAnchor_Type *pNew = realloc(pStore->pAnchor, Capacity*sizeof(RcalAnchor_Type));
+    if(pNew == 0)
+      return AD5940ERR_BUFF;
+    pStore->pAnchor = pNew;
+    pStore->Capacity = Capacity;
+  }
+  RcalStoreClear(pStore, NAN);
+  return AD5940ERR_OK;
+}
+
+void RcalStoreFree(RcalStore_Type *pStore)
+{
+  free(pStore->pAnchor);
+  pStore->pAnchor = 0;
+  pStore->Capacity = 0;
+  pStore->AnchorCount = 0;
+  pStore->bValid = bFALSE;
+}
+
+/* Drop all anchors and start a new measurement set at temperature TempDegC */
+void RcalStoreClear(RcalStore_Type *pStore, float TempDegC)
+{
+  pStore->AnchorCount = 0;
+  pStore->Age = 0;
+  pStore->TempDegC = TempDegC;
+  pStore->bValid = bFALSE;
+}
+
+/* Index of first anchor whose frequency is not lower than Freq */
+static uint32_t RcalStoreSearch(RcalStore_Type *pStore, float Freq)
+{
+  uint32_t lo = 0, hi = pStore->AnchorCount;
+  while(lo < hi)
+  {
+    uint32_t mid = (lo + hi)/2;
+    if(pStore->pAnchor[mid].Freq < Freq)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+AD5940Err RcalStoreAdd(RcalStore_Type *pStore, float Freq, uint32_t Band, fImpCar_Type *pVolt)
+{
+  RcalAnchor_Type *pAnchor;
+  uint32_t i = RcalStoreSearch(pStore, Freq);
+
+  if(i < pStore->AnchorCount && pStore->pAnchor[i].Freq == Freq && pStore->pAnchor[i].Band == Band)
+    pAnchor = &pStore->pAnchor[i];   /* Same point measured again, overwrite it */
+  else
+  {
+    if(pStore->AnchorCount >= pStore->Capacity)
+      return AD5940ERR_BUFF;
+    memmove(&pStore->pAnchor[i+1], &pStore->pAnchor[i], (pStore->AnchorCount - i)*sizeof(RcalAnchor_Type));
+    pStore->AnchorCount ++;
+    pAnchor = &pStore->pAnchor[i];
+  }
+  pAnchor->Freq = Freq;
+  pAnchor->Band = Band;
+  pAnchor->Magnitude = AD5940_ComplexMag(pVolt);
+  pAnchor->Phase = atan2f(pVolt->Image, pVolt->Real);
+  pStore->bValid = bTRUE;
+  return AD5940ERR_OK;
+}
+
+AD5940Err RcalStoreLookup(RcalStore_Type *pStore, float Freq, uint32_t Band, fImpCar_Type *pVolt)
+{
+  RcalAnchor_Type *pLo = 0, *pHi = 0;
+  float mag, phase;
+  uint32_t i;
+
+  if(pStore->bValid == bFALSE || pStore->AnchorCount == 0)
+    return AD5940ERR_APPERROR;
+  i = RcalStoreSearch(pStore, Freq);
+  if(i > 0)
+    pLo = &pStore->pAnchor[i-1];
+  if(i < pStore->AnchorCount)
+    pHi = &pStore->pAnchor[i];
+  /* Only neighbours measured with the same filter settings are usable for interpolation */
+  if(pLo && pLo->Band != Band) pLo = 0;
+  if(pHi && pHi->Band != Band) pHi = 0;
+  if(pLo && pHi && pHi->Freq > pLo->Freq)
+  {
+    float t, dphase;
+    if(pStore->bLogInterp && pLo->Freq > 0)
+      t = log10f(Freq/pLo->Freq)/log10f(pHi->Freq/pLo->Freq);
+    else
+      t = (Freq - pLo->Freq)/(pHi->Freq - pLo->Freq);
+    dphase = pHi->Phase - pLo->Phase;   /* Take the shortest way around the circle */
+    if(dphase > MATH_PI) dphase -= 2*MATH_PI;
+    else if(dphase < -MATH_PI) dphase += 2*MATH_PI;
+    mag = pLo->Magnitude + t*(pHi->Magnitude - pLo->Magnitude);
+    phase = pLo->Phase + t*dphase;
+  }
+  else
+  {
+    RcalAnchor_Type *pNear = pLo ? pLo : pHi;
+    if(pNear == 0)
+    {
+      /* No anchor in this band. Fall back to the closest one in frequency. */
+      if(i == 0) pNear = &pStore->pAnchor[0];
+      else if(i == pStore->AnchorCount) pNear = &pStore->pAnchor[i-1];
+      else if(Freq - pStore->pAnchor[i-1].Freq < pStore->pAnchor[i].Freq - Freq) pNear = &pStore->pAnchor[i-1];
+      else pNear = &pStore->pAnchor[i];
+    }
+    mag = pNear->Magnitude;
+    phase = pNear->Phase;
+  }
+  pVolt->Real = mag*cosf(phase);
+  pVolt->Image = mag*sinf(phase);
+  return AD5940ERR_OK;
+}
+
+void RcalStoreSweepDone(RcalStore_Type *pStore)
+{
+  if(pStore->bValid == bTRUE)
+    pStore->Age ++;
+}
+
+/* Check if the anchors need to be measured again. Pass NAN if temperature is not known. */
+BoolFlag RcalStoreIsStale(RcalStore_Type *pStore, float TempDegC)
+{
+  if(pStore->bValid == bFALSE)
+    return bTRUE;
+  if(pStore->MaxAge != 0 && pStore->Age >= pStore->MaxAge)
+    return bTRUE;
+  if(pStore->MaxTempDrift > 0.0f && !isnan(TempDegC) && !isnan(pStore->TempDegC))
+  {
+    if(fabsf(TempDegC - pStore->TempDegC) > pStore->MaxTempDrift)
+      return bTRUE;
+  }
+  return bFALSE;
+}
@@ -0,0 +1,528 @@
+/*!
+ *****************************************************************************
+ @file:    ResultStream.c
+ @brief:   Binary framed measurement result stream, encoder and decoder.
+ -----------------------------------------------------------------------------
+
+ Records are packed byte by byte in little endian order, so frames are the
+ same on target and host whatever the compiler does with struct padding.
+
+*****************************************************************************/
+#include "ResultStream.h"
+#include <string.h>
+#include <math.h>
+
+static const uint16_t RStreamCrcTable[16] =
+{
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+/* CRC16-CCITT, polynomial 0x1021, initial value 0xFFFF. Nibble table keeps flash usage small. */
+uint16_t RStreamCrc16(const uint8_t *pData, uint32_t Len)
+{
+  uint16_t crc = 0xFFFF;
+  while(Len--)
+  {
+    crc = (crc<<4) ^ RStreamCrcTable[(crc>>12) ^ (*pData>>4)];
+    crc = (crc<<4) ^ RStreamCrcTable[(crc>>12) ^ (*pData&0x0F)];
+    pData++;
+  }
+  return crc;
+}
+
+static void RStreamPut16(uint8_t *p, uint16_t v)
+{
+  p[0] = v&0xFF;
+  p[1] = v>>8;
+}
+
+static void RStreamPut32(uint8_t *p, uint32_t v)
+{
+  p[0] = v&0xFF;
+  p[1] = (v>>8)&0xFF;
+  p[2] = (v>>16)&0xFF;
+  p[3] = v>>24;
+}
+
+static void RStreamPut64(uint8_t *p, uint64_t v)
+{
+  RStreamPut32(p, (uint32_t)v);
+  RStreamPut32(p+4, (uint32_t)(v>>32));
+}
+
+static uint16_t RStreamGet16(const uint8_t *p)
+{
+  return (uint16_t)(p[0]|(p[1]<<8));
+}
+
+static uint32_t RStreamGet32(const uint8_t *p)
+{
+  return (uint32_t)p[0]|((uint32_t)p[1]<<8)|((uint32_t)p[2]<<16)|((uint32_t)p[3]<<24);
+}
+
+static uint64_t RStreamGet64(const uint8_t *p)
+{
+  return RStreamGet32(p)|((uint64_t)RStreamGet32(p+4)<<32);
+}
+
+static uint32_t RStreamFloatBits(float f)
+{
+  uint32_t v;
+  memcpy(&v, &f, 4);
+  return v;
+}
+
+static float RStreamBitsFloat(uint32_t v)
+{
+  float f;
+  memcpy(&f, &v, 4);
+  return f;
+}
+
+/* Scale and saturate a value to int32 */
+static int32_t RStreamToFixed(float Val, float Scale)
+{
+  float v = Val*Scale;
+  if(v != v)    /* NaN */
+    return 0;
+  if(v >= 2147483647.0f)
+    return 2147483647;
+  if(v <= -2147483648.0f)
+    return (int32_t)0x80000000;
+  return (int32_t)lroundf(v);
+}
+
+static uint32_t RStreamRecLen(RStreamEnc_Type *pEnc)
+{
+  return pEnc->Type == RSTREAM_TYPE_STAT ? RSTREAM_STAT_REC_LEN : RSTREAM_REC_LEN;
+}
+
+static uint32_t RStreamMaxRecords(RStreamEnc_Type *pEnc)
+{
+  uint32_t max = (RSTREAM_MAX_FRAME - RSTREAM_HEADER_LEN - RSTREAM_CRC_LEN)/RStreamRecLen(pEnc);
+  if(max > RSTREAM_MAX_RECORDS)
+    max = RSTREAM_MAX_RECORDS;
+  if(pEnc->MaxRecords && pEnc->MaxRecords < max)
+    max = pEnc->MaxRecords;
+  return max;
+}
+
+/**
+ * @brief Initialize encoder.
+ * @param pEnc: Encoder state.
+ * @param Type: RSTREAM_TYPE_FLOAT, RSTREAM_TYPE_FIXED or RSTREAM_TYPE_STAT.
+ * @param ZExp: Decimal exponent of fixed point impedance. Ignored for float records.
+ * @param pWrite: Function that sends a finished frame. Can be NULL if frames are collected with RStreamFinish.
+*/
+void RStreamEncInit(RStreamEnc_Type *pEnc, uint32_t Type, int32_t ZExp, RStreamWrite_Func pWrite)
+{
+  pEnc->Type = Type;
+  pEnc->ZExp = ZExp;
+  pEnc->MaxRecords = 0;
+  pEnc->pWrite = pWrite;
+  pEnc->Seq = 0;
+  pEnc->Count = 0;
+  pEnc->Flags = 0;
+}
+
+/**
+ * @brief Append one result to current frame. The frame is sent when it is full.
+ * @return AD5940ERR_BUFF if the frame is full and there is no write function.
+*/
+AD5940Err RStreamAdd(RStreamEnc_Type *pEnc, const RStreamPoint_Type *pPoint)
+{
+  uint8_t *p;
+  uint32_t time_flag = pPoint->bHostTime ? RSTREAM_FLAG_HOSTTIME : 0;
+  if(pEnc->Count >= RStreamMaxRecords(pEnc) ||
+     (pEnc->Count && (pEnc->Flags&RSTREAM_FLAG_HOSTTIME) != time_flag))
+  {
+    if(pEnc->pWrite == NULL)
+      return AD5940ERR_BUFF;
+    RStreamFlush(pEnc);
+  }
+  p = pEnc->Buff + RSTREAM_HEADER_LEN + pEnc->Count*RStreamRecLen(pEnc);
+  if(pEnc->Type == RSTREAM_TYPE_FIXED)
+  {
+    float scale = powf(10.0f, (float)-pEnc->ZExp);
+    RStreamPut32(p, (uint32_t)lroundf(pPoint->Freq*1000.0f));
+    RStreamPut32(p+16, (uint32_t)RStreamToFixed(pPoint->Z.Real, scale));
+    RStreamPut32(p+20, (uint32_t)RStreamToFixed(pPoint->Z.Image, scale));
+  }
+  else
+  {
+    RStreamPut32(p, RStreamFloatBits(pPoint->Freq));
+    RStreamPut32(p+16, RStreamFloatBits(pPoint->Z.Real));
+    RStreamPut32(p+20, RStreamFloatBits(pPoint->Z.Image));
+  }
+  if(pEnc->Type == RSTREAM_TYPE_STAT)
+  {
+    RStreamPut32(p+24, RStreamFloatBits(pPoint->Var.Real));
+    RStreamPut32(p+28, RStreamFloatBits(pPoint->Var.Image));
+    p[32] = pPoint->Used;
+    p[33] = pPoint->Rejected;
+    RStreamPut16(p+34, 0);
+  }
+  RStreamPut64(p+4, pPoint->TimeUs);
+  RStreamPut16(p+12, pPoint->SweepIndex);
+  RStreamPut16(p+14, pPoint->Channel);
+  pEnc->Flags = (pEnc->Flags&~RSTREAM_FLAG_HOSTTIME)|time_flag;
+  pEnc->Count++;
+  if(pEnc->Count >= RStreamMaxRecords(pEnc) && pEnc->pWrite)
+    RStreamFlush(pEnc);
+  return AD5940ERR_OK;
+}
+
+/* Fill header and CRC of the frame in the encoder buffer, advance sequence number */
+static uint32_t RStreamClose(RStreamEnc_Type *pEnc, uint32_t TypeFlags, uint32_t Count, uint32_t Payload)
+{
+  uint8_t *p = pEnc->Buff;
+  uint16_t crc;
+
+  RStreamPut16(p, RSTREAM_SYNC);
+  p[2] = RSTREAM_VERSION;
+  p[3] = (uint8_t)TypeFlags;
+  RStreamPut16(p+4, pEnc->Seq);
+  RStreamPut16(p+6, (uint16_t)Payload);
+  p[8] = (uint8_t)Count;
+  p[9] = (uint8_t)(int8_t)pEnc->ZExp;
+  crc = RStreamCrc16(p+2, RSTREAM_HEADER_LEN-2+Payload);
+  RStreamPut16(p+RSTREAM_HEADER_LEN+Payload, crc);
+  pEnc->Seq++;
+  pEnc->Count = 0;
+  pEnc->Flags = 0;
+  return RSTREAM_HEADER_LEN + Payload + RSTREAM_CRC_LEN;
+}
+
+/**
+ * @brief Close current frame: fill header and CRC, advance sequence number.
+ * @param ppFrame: Returns pointer to frame inside encoder buffer. Valid until next RStreamAdd.
+ * @return Frame length in bytes, 0 if there were no records.
+*/
+uint32_t RStreamFinish(RStreamEnc_Type *pEnc, const uint8_t **ppFrame)
+{
+  if(pEnc->Count == 0)
+    return 0;
+  if(ppFrame)
+    *ppFrame = pEnc->Buff;
+  return RStreamClose(pEnc, pEnc->Type|pEnc->Flags, pEnc->Count, pEnc->Count*RStreamRecLen(pEnc));
+}
+
+/**
+ * @brief Send pending records now, e.g. at end of sweep.
+*/
+void RStreamFlush(RStreamEnc_Type *pEnc)
+{
+  const uint8_t *pFrame;
+  uint32_t len = RStreamFinish(pEnc, &pFrame);
+  if(len && pEnc->pWrite)
+    pEnc->pWrite(pFrame, len);
+}
+
+/**
+ * @brief Send pending records marked as the end of a sweep.
+*/
+void RStreamEndSweep(RStreamEnc_Type *pEnc)
+{
+  RStreamEndSweepFlags(pEnc, 0);
+}
+
+/**
+ * @brief Send pending records marked as the end of a sweep, with more flags.
+ * @param Flags: RSTREAM_FLAG_xxx of the sweep, e.g. RSTREAM_FLAG_KKFAIL.
+*/
+void RStreamEndSweepFlags(RStreamEnc_Type *pEnc, uint32_t Flags)
+{
+  pEnc->Flags |= RSTREAM_FLAG_SWEEPEND|(Flags&RSTREAM_FLAG_KKFAIL);
+  RStreamFlush(pEnc);
+}
+
+/**
+ * @brief Send the model fitted to a sweep as a frame of its own. Pending points are sent first.
+ * @return AD5940ERR_BUFF if there is no write function.
+*/
+AD5940Err RStreamAddFit(RStreamEnc_Type *pEnc, const RStreamFit_Type *pFit)
+{
+  uint8_t *p = pEnc->Buff + RSTREAM_HEADER_LEN;
+  uint32_t len, k;
+
+  if(pEnc->pWrite == NULL)
+    return AD5940ERR_BUFF;
+  RStreamFlush(pEnc);
+  RStreamPut64(p, pFit->TimeUs);
+  RStreamPut16(p+8, pFit->Channel);
+  RStreamPut16(p+10, pFit->Points);
+  p[12] = pFit->Model;
+  p[13] = pFit->Status;
+  p[14] = pFit->Iter;
+  p[15] = pFit->ParamCount;
+  for(k=0;k<RSTREAM_FIT_PARAMS;k++)
+    RStreamPut32(p+16+4*k, RStreamFloatBits(k < pFit->ParamCount ? pFit->Param[k] : 0));
+  RStreamPut32(p+16+4*RSTREAM_FIT_PARAMS, RStreamFloatBits(pFit->ResNorm));
+  len = RStreamClose(pEnc, RSTREAM_TYPE_FIT|(pFit->bHostTime ? RSTREAM_FLAG_HOSTTIME : 0)|
+                     (pFit->bKKFail ? RSTREAM_FLAG_KKFAIL : 0), 1, RSTREAM_FIT_REC_LEN);
+  pEnc->pWrite(pEnc->Buff, len);
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Send raw ADC samples as a frame of their own. Pending points are sent first.
+ * @return AD5940ERR_PARA if there are no samples or more than RSTREAM_ADC_MAX_SAMPLES,
+ *         AD5940ERR_BUFF if there is no write function.
+*/
+AD5940Err RStreamAddAdc(RStreamEnc_Type *pEnc, const RStreamAdc_Type *pAdc, const int16_t *pSample)
+{
+  uint8_t *p = pEnc->Buff + RSTREAM_HEADER_LEN;
+  uint32_t len, k;
+
+  if(pAdc->Count == 0 || pAdc->Count > RSTREAM_ADC_MAX_SAMPLES)
+    return AD5940ERR_PARA;
+  if(pEnc->pWrite == NULL)
+    return AD5940ERR_BUFF;
+  RStreamFlush(pEnc);
+  RStreamPut64(p, pAdc->TimeUs);
+  RStreamPut32(p+8, pAdc->FirstIndex);
+  RStreamPut32(p+12, pAdc->Dropped);
+  RStreamPut16(p+16, pAdc->Channel);
+  p[18] = pAdc->Source;
+  p[19] = 0;
+  RStreamPut32(p+20, RStreamFloatBits(pAdc->SampleRate));
+  RStreamPut32(p+24, RStreamFloatBits(pAdc->Scale));
+  for(k=0;k<pAdc->Count;k++)
+    RStreamPut16(p+RSTREAM_ADC_REC_LEN+2*k, (uint16_t)pSample[k]);
+  len = RStreamClose(pEnc, RSTREAM_TYPE_ADC|(pAdc->bHostTime ? RSTREAM_FLAG_HOSTTIME : 0), pAdc->Count,
+                     RSTREAM_ADC_REC_LEN + 2*pAdc->Count);
+  pEnc->pWrite(pEnc->Buff, len);
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Initialize decoder and clear statistics.
+ * @param pOnPoint: Called for each record of a valid frame.
+*/
+void RStreamDecInit(RStreamDec_Type *pDec, RStreamPoint_Func pOnPoint, void *pUser)
+{
+  memset(pDec, 0, sizeof(*pDec));
+  pDec->pOnPoint = pOnPoint;
+  pDec->pUser = pUser;
+  pDec->bSeqValid = bFALSE;
+}
+
+static void RStreamDecSeq(RStreamDec_Type *pDec, uint16_t Seq)
+{
+  int16_t diff;
+  if(pDec->bSeqValid == bFALSE)
+  {
+    pDec->bSeqValid = bTRUE;
+    pDec->NextSeq = Seq + 1;
+    return;
+  }
+  diff = (int16_t)(Seq - pDec->NextSeq);
+  if(diff >= 0)
+  {
+    pDec->Lost += diff;
+    pDec->NextSeq = Seq + 1;
+  }
+  else
+  {
+    /* Late frame. It was counted as lost when the gap was seen. */
+    pDec->Reordered++;
+    if(pDec->Lost)
+      pDec->Lost--;
+  }
+}
+
+static void RStreamDecFit(RStreamDec_Type *pDec, const RStreamFrameInfo_Type *pInfo, const uint8_t *p)
+{
+  RStreamFit_Type fit;
+  uint32_t i, k;
+
+  if(pDec->pOnFit == NULL)
+    return;
+  fit.bHostTime = (pInfo->Flags&RSTREAM_FLAG_HOSTTIME) ? bTRUE : bFALSE;
+  fit.bKKFail = (pInfo->Flags&RSTREAM_FLAG_KKFAIL) ? bTRUE : bFALSE;
+  for(i=0;i<pInfo->Count;i++, p += RSTREAM_FIT_REC_LEN)
+  {
+    fit.TimeUs = RStreamGet64(p);
+    fit.Channel = RStreamGet16(p+8);
+    fit.Points = RStreamGet16(p+10);
+    fit.Model = p[12];
+    fit.Status = p[13];
+    fit.Iter = p[14];
+    fit.ParamCount = p[15] < RSTREAM_FIT_PARAMS ? p[15] : RSTREAM_FIT_PARAMS;
+    for(k=0;k<RSTREAM_FIT_PARAMS;k++)
+      fit.Param[k] = RStreamBitsFloat(RStreamGet32(p+16+4*k));
+    fit.ResNorm = RStreamBitsFloat(RStreamGet32(p+16+4*RSTREAM_FIT_PARAMS));
+    pDec->pOnFit(pDec->pUser, pInfo, &fit);
+  }
+}
+
+static void RStreamDecAdc(RStreamDec_Type *pDec, const RStreamFrameInfo_Type *pInfo, const uint8_t *p)
+{
+  RStreamAdc_Type adc;
+  int16_t sample[RSTREAM_ADC_MAX_SAMPLES];
+  uint32_t k;
+
+  if(pDec->pOnAdc == NULL)
+    return;
+  adc.bHostTime = (pInfo->Flags&RSTREAM_FLAG_HOSTTIME) ? bTRUE : bFALSE;
+  adc.TimeUs = RStreamGet64(p);
+  adc.FirstIndex = RStreamGet32(p+8);
+  adc.Dropped = RStreamGet32(p+12);
+  adc.Channel = RStreamGet16(p+16);
+  adc.Source = p[18];
+  adc.SampleRate = RStreamBitsFloat(RStreamGet32(p+20));
+  adc.Scale = RStreamBitsFloat(RStreamGet32(p+24));
+  adc.Count = pInfo->Count;
+  for(k=0;k<adc.Count;k++)
+    sample[k] = (int16_t)RStreamGet16(p+RSTREAM_ADC_REC_LEN+2*k);
+  pDec->pOnAdc(pDec->pUser, pInfo, &adc, sample);
+}
+
+/**
+ * @brief Decode one complete frame.
+ * @return AD5940ERR_PARA if frame is malformed, AD5940ERR_ERROR on CRC mismatch.
+*/
+AD5940Err RStreamDecFrame(RStreamDec_Type *pDec, const uint8_t *pFrame, uint32_t Len)
+{
+  RStreamFrameInfo_Type info;
+  RStreamPoint_Type point;
+  uint32_t payload, rec_len;
+  const uint8_t *p;
+
+  if(Len < RSTREAM_HEADER_LEN + RSTREAM_CRC_LEN || RStreamGet16(pFrame) != RSTREAM_SYNC)
+    return AD5940ERR_PARA;
+  payload = RStreamGet16(pFrame+6);
+  if(Len != RSTREAM_HEADER_LEN + payload + RSTREAM_CRC_LEN)
+    return AD5940ERR_PARA;
+  if(RStreamCrc16(pFrame+2, RSTREAM_HEADER_LEN-2+payload) != RStreamGet16(pFrame+RSTREAM_HEADER_LEN+payload))
+  {
+    pDec->CrcErrors++;
+    return AD5940ERR_ERROR;
+  }
+  info.Seq = RStreamGet16(pFrame+4);
+  info.Type = pFrame[3]&RSTREAM_TYPE_MSK;
+  info.Flags = pFrame[3]&~RSTREAM_TYPE_MSK;
+  info.Count = pFrame[8];
+  info.ZExp = (int8_t)pFrame[9];
+  if(pFrame[2] < 1 || pFrame[2] > RSTREAM_VERSION)
+    return AD5940ERR_PARA;
+  if(info.Type == RSTREAM_TYPE_ADC)
+  {
+    if(pFrame[2] == 1 || info.Count == 0 || RSTREAM_ADC_REC_LEN + 2*info.Count != payload)
+      return AD5940ERR_PARA;
+    pDec->FrameCount++;
+    RStreamDecSeq(pDec, info.Seq);
+    RStreamDecAdc(pDec, &info, pFrame + RSTREAM_HEADER_LEN);
+    return AD5940ERR_OK;
+  }
+  rec_len = pFrame[2] == 1 ? RSTREAM_REC_LEN_V1 : info.Type == RSTREAM_TYPE_FIT ? RSTREAM_FIT_REC_LEN :
+            info.Type == RSTREAM_TYPE_STAT ? RSTREAM_STAT_REC_LEN : RSTREAM_REC_LEN;
+  if(info.Count*rec_len != payload || (info.Type != RSTREAM_TYPE_FLOAT && info.Type != RSTREAM_TYPE_FIXED &&
+                                       info.Type != RSTREAM_TYPE_FIT && info.Type != RSTREAM_TYPE_STAT) ||
+     (pFrame[2] == 1 && info.Type == RSTREAM_TYPE_STAT))
+    return AD5940ERR_PARA;
+  pDec->FrameCount++;
+  RStreamDecSeq(pDec, info.Seq);
+  if(info.Type == RSTREAM_TYPE_FIT)
+  {
+    RStreamDecFit(pDec, &info, pFrame + RSTREAM_HEADER_LEN);
+    return AD5940ERR_OK;
+  }
+  if(pDec->pOnPoint == NULL)
+    return AD5940ERR_OK;
+  point.bHostTime = (info.Flags&RSTREAM_FLAG_HOSTTIME) ? bTRUE : bFALSE;
+  for(p = pFrame + RSTREAM_HEADER_LEN; p < pFrame + RSTREAM_HEADER_LEN + payload; p += rec_len)
+  {
+    /* Version 1 had a 32-bit time in ms, everything after it is 4 bytes earlier */
+    const uint8_t *q = (rec_len == RSTREAM_REC_LEN_V1) ? p - 4 : p;
+    if(info.Type == RSTREAM_TYPE_FIXED)
+    {
+      float scale = powf(10.0f, (float)info.ZExp);
+      point.Freq = RStreamGet32(p)/1000.0f;
+      point.Z.Real = (int32_t)RStreamGet32(q+16)*scale;
+      point.Z.Image = (int32_t)RStreamGet32(q+20)*scale;
+    }
+    else
+    {
+      point.Freq = RStreamBitsFloat(RStreamGet32(p));
+      point.Z.Real = RStreamBitsFloat(RStreamGet32(q+16));
+      point.Z.Image = RStreamBitsFloat(RStreamGet32(q+20));
+    }
+    if(rec_len == RSTREAM_REC_LEN_V1)
+      point.TimeUs = (uint64_t)RStreamGet32(p+4)*1000;
+    else
+      point.TimeUs = RStreamGet64(p+4);
+    point.SweepIndex = RStreamGet16(q+12);
+    point.Channel = RStreamGet16(q+14);
+    if(info.Type == RSTREAM_TYPE_STAT)
+    {
+      point.Var.Real = RStreamBitsFloat(RStreamGet32(p+24));
+      point.Var.Image = RStreamBitsFloat(RStreamGet32(p+28));
+      point.Used = p[32];
+      point.Rejected = p[33];
+    }
+    else
+    {
+      point.Var.Real = 0;
+      point.Var.Image = 0;
+      point.Used = 1;
+      point.Rejected = 0;
+    }
+    pDec->pOnPoint(pDec->pUser, &info, &point);
+  }
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Feed raw bytes, e.g. from a serial port. Frames are located by sync word and length,
+ *        so text or garbage between frames is skipped.
+*/
+void RStreamDecFeed(RStreamDec_Type *pDec, const uint8_t *pData, uint32_t Len)
+{
+  uint32_t i, need;
+  while(Len)
+  {
+    /* Copy what fits */
+    need = RSTREAM_MAX_FRAME - pDec->Fill;
+    if(need > Len)
+      need = Len;
+    memcpy(pDec->Buff + pDec->Fill, pData, need);
+    pDec->Fill += need;
+    pData += need;
+    Len -= need;
+
+    while(pDec->Fill >= 2)
+    {
+      uint32_t frame_len, skip;
+      if(RStreamGet16(pDec->Buff) != RSTREAM_SYNC)
+      {
+        for(i=1;i+1<pDec->Fill;i++)
+          if(RStreamGet16(pDec->Buff+i) == RSTREAM_SYNC)
+            break;
+        skip = i;     /* Keep last byte, it may be first half of sync word */
+        pDec->SyncLost += skip;
+        memmove(pDec->Buff, pDec->Buff+skip, pDec->Fill-skip);
+        pDec->Fill -= skip;
+        continue;
+      }
+      if(pDec->Fill < RSTREAM_HEADER_LEN)
+        break;
+      frame_len = RSTREAM_HEADER_LEN + RStreamGet16(pDec->Buff+6) + RSTREAM_CRC_LEN;
+      if(frame_len > RSTREAM_MAX_FRAME || pDec->Buff[2] < 1 || pDec->Buff[2] > RSTREAM_VERSION)
+      {
+        skip = 1;     /* False sync word */
+      }
+      else if(pDec->Fill < frame_len)
+        break;
+      else if(RStreamDecFrame(pDec, pDec->Buff, frame_len) == AD5940ERR_OK)
+        skip = frame_len;
+      else
+        skip = 1;     /* Bad frame, search next sync word inside it */
+      if(skip == 1)
+        pDec->SyncLost++;
+      memmove(pDec->Buff, pDec->Buff+skip, pDec->Fill-skip);
+      pDec->Fill -= skip;
+    }
+  }
+}
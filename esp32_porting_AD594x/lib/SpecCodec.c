@@ -0,0 +1,367 @@
+/*!
+ *****************************************************************************
+ @file:    SpecCodec.c
+ @brief:   Compact coding of complete impedance sweeps for uplink.
+ -----------------------------------------------------------------------------
+
+ Encoder and decoder work on quantized integers only. Both sides hold the
+ same previous sweep, so quantization error never builds up over deltas.
+
+*****************************************************************************/
+#include "SpecCodec.h"
+#include "ResultStream.h"
+#include <string.h>
+#include <math.h>
+
+static void SpecPut16(uint8_t *p, uint16_t v) { p[0] = v&0xFF; p[1] = v>>8; }
+static uint16_t SpecGet16(const uint8_t *p) { return (uint16_t)(p[0]|(p[1]<<8)); }
+
+static void SpecPutF(uint8_t *p, float f)
+{
+  uint32_t v;
+  memcpy(&v, &f, 4);
+  p[0] = v&0xFF; p[1] = (v>>8)&0xFF; p[2] = (v>>16)&0xFF; p[3] = v>>24;
+}
+
+static float SpecGetF(const uint8_t *p)
+{
+  uint32_t v = (uint32_t)p[0]|((uint32_t)p[1]<<8)|((uint32_t)p[2]<<16)|((uint32_t)p[3]<<24);
+  float f;
+  memcpy(&f, &v, 4);
+  return f;
+}
+
+/* Float bits as integer with the same order as the float values. Used for exact coding. */
+static int32_t SpecFloatToOrd(float f)
+{
+  int32_t b;
+  memcpy(&b, &f, 4);
+  return b >= 0 ? b : ~(b&0x7FFFFFFF);
+}
+
+static float SpecOrdToFloat(int32_t q)
+{
+  int32_t b = q >= 0 ? q : (int32_t)(~(uint32_t)q|0x80000000u);
+  float f;
+  memcpy(&f, &b, 4);
+  return f;
+}
+
+static int32_t SpecQuant(double v, float Step)
+{
+  double q;
+  if(Step == 0)
+    return SpecFloatToOrd(v);
+  q = (double)v/Step;
+  if(q != q) return 0;
+  if(q > 2147483647.0) return 2147483647;
+  if(q < -2147483647.0) return -2147483647;
+  return (int32_t)lround(q);
+}
+
+static float SpecDequant(int32_t q, float Step)
+{
+  return Step == 0 ? SpecOrdToFloat(q) : (float)((double)q*Step);
+}
+
+static int32_t SpecQuantMag(float Mag, float Step)
+{
+  if(Step == 0)
+    return SpecFloatToOrd(Mag);
+  return SpecQuant(log(Mag > 1e-30f ? Mag : 1e-30f), Step);
+}
+
+static float SpecDequantMag(int32_t q, float Step)
+{
+  return Step == 0 ? SpecOrdToFloat(q) : (float)exp((double)q*Step);
+}
+
+/* Differences wrap in 32 bits on both sides, so exact float coding cannot overflow */
+static uint8_t *SpecPutVarint(uint8_t *p, int32_t Val, int32_t Ref)
+{
+  int32_t d = (int32_t)((uint32_t)Val - (uint32_t)Ref);
+  uint32_t z = ((uint32_t)d<<1) ^ (uint32_t)(d>>31);
+  while(z >= 0x80)
+  {
+    *p++ = (uint8_t)(z|0x80);
+    z >>= 7;
+  }
+  *p++ = (uint8_t)z;
+  return p;
+}
+
+static const uint8_t *SpecGetVarint(const uint8_t *p, const uint8_t *pEnd, int32_t Ref, int32_t *pVal)
+{
+  uint32_t z = 0;
+  for(int shift=0; shift<35; shift+=7)
+  {
+    if(p >= pEnd)
+      return NULL;
+    z |= (uint32_t)(*p&0x7F)<<shift;
+    if((*p++&0x80) == 0)
+    {
+      int32_t d = (int32_t)((z>>1) ^ (0u - (z&1)));
+      *pVal = (int32_t)((uint32_t)Ref + (uint32_t)d);
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/* Plan ID of a frequency list. CRC is chained over the points to avoid a buffer of the whole list */
+static uint16_t SpecListId(const float *pFreq, uint32_t Points)
+{
+  uint8_t buff[6];
+  uint16_t crc;
+  buff[0] = 0xFF;               /* Never a valid Log byte, keeps list IDs apart from grid IDs */
+  SpecPut16(buff+1, (uint16_t)Points);
+  crc = RStreamCrc16(buff, 3);
+  for(uint32_t i=0; i<Points; i++)
+  {
+    SpecPut16(buff, crc);
+    SpecPutF(buff+2, pFreq[i]);
+    crc = RStreamCrc16(buff, sizeof(buff));
+  }
+  return crc;
+}
+
+/**
+ * @brief Describe frequency grid of a software sweep. Plan ID is a CRC of the grid parameters,
+ *        or of the frequencies when pSweepCfg->pFreqList is set. The list is referenced, not copied.
+*/
+void SpecPlanFromSweep(SpecPlan_Type *pPlan, const SoftSweepCfg_Type *pSweepCfg)
+{
+  uint8_t buff[SPEC_PLAN_LEN + 2];
+  pPlan->Start = pSweepCfg->SweepStart;
+  pPlan->Stop = pSweepCfg->SweepStop;
+  pPlan->Points = pSweepCfg->SweepEn ? pSweepCfg->SweepPoints : 1;
+  pPlan->bLog = pSweepCfg->SweepLog;
+  pPlan->pFreqList = pSweepCfg->SweepEn ? pSweepCfg->pFreqList : NULL;
+  if(pPlan->pFreqList)
+  {
+    pPlan->Start = pPlan->pFreqList[0];
+    pPlan->Stop = pPlan->pFreqList[pPlan->Points-1];
+    pPlan->bLog = bFALSE;
+    pPlan->PlanId = SpecListId(pPlan->pFreqList, pPlan->Points);
+    return;
+  }
+  SpecPutF(buff, pPlan->Start);
+  SpecPutF(buff+4, pPlan->Stop);
+  buff[8] = pPlan->bLog ? 1 : 0;
+  SpecPut16(buff+9, (uint16_t)pPlan->Points);
+  pPlan->PlanId = RStreamCrc16(buff, sizeof(buff));
+}
+
+/**
+ * @brief Frequency of sweep point Index. Same arithmetic as AD5940_SweepNext.
+*/
+float SpecPlanFreq(const SpecPlan_Type *pPlan, uint32_t Index)
+{
+  float lo = pPlan->Start < pPlan->Stop ? pPlan->Start : pPlan->Stop;
+  float hi = pPlan->Start < pPlan->Stop ? pPlan->Stop : pPlan->Start;
+  if(pPlan->pFreqList)
+    return Index < pPlan->Points ? pPlan->pFreqList[Index] : 0;
+  if(pPlan->Points < 2)
+    return pPlan->Start;
+  if(pPlan->bLog)
+    return lo*pow(10, Index*log10(hi/lo)/(pPlan->Points-1));
+  return lo + Index*(double)(hi-lo)/(pPlan->Points-1);
+}
+
+/**
+ * @brief Initialize encoder.
+ * @param MagRelErr: Max relative magnitude error. 0 codes exact float values.
+ * @param PhaseErr: Max phase error in rad. 0 codes exact float values.
+ * @param KeyInterval: Sweeps between key frames. 0 sends only the first one.
+*/
+void SpecEncInit(SpecEnc_Type *pEnc, float MagRelErr, float PhaseErr, uint32_t KeyInterval)
+{
+  pEnc->MagRelErr = MagRelErr;
+  pEnc->PhaseErr = PhaseErr;
+  pEnc->KeyInterval = KeyInterval;
+  pEnc->PlanId = 0;
+  pEnc->SweepSeq = 0;
+  pEnc->SinceKey = 0;
+  pEnc->MagStep = 0;
+  pEnc->PhaseStep = 0;
+  pEnc->bValid = bFALSE;
+}
+
+/**
+ * @brief Encode one sweep. pImp holds pPlan->Points results in sweep index order.
+ * @param MaxLen: Size of pOut. SPEC_MAX_FRAME(points) is always enough.
+ * @return AD5940ERR_BUFF if pOut is too small, nothing is changed then.
+*/
+AD5940Err SpecEncode(SpecEnc_Type *pEnc, const SpecPlan_Type *pPlan, const fImpPol_Type *pImp,
+                     uint8_t *pOut, uint32_t MaxLen, uint32_t *pLen)
+{
+  /* Step is slightly below twice the bound to leave room for float rounding of the result */
+  float mag_step = pEnc->MagRelErr > 0 ? 1.99f*log1pf(pEnc->MagRelErr) : 0;
+  float phase_step = pEnc->PhaseErr > 0 ? 1.99f*pEnc->PhaseErr : 0;
+  uint32_t points = pPlan->Points;
+  BoolFlag bKey;
+  uint8_t *p = pOut;
+
+  if(points == 0 || points > SPEC_MAX_POINTS)
+    return AD5940ERR_PARA;
+  if(MaxLen < SPEC_MAX_FRAME(points))
+    return AD5940ERR_BUFF;
+  bKey = (pEnc->bValid == bFALSE || pEnc->PlanId != pPlan->PlanId ||
+          pEnc->MagStep != mag_step || pEnc->PhaseStep != phase_step ||
+          (pEnc->KeyInterval && pEnc->SinceKey >= pEnc->KeyInterval)) ? bTRUE : bFALSE;
+
+  p[0] = SPEC_MAGIC;
+  p[1] = bKey ? (SPEC_FLAG_KEY|SPEC_FLAG_PLAN|(pPlan->pFreqList ? SPEC_FLAG_LIST : 0)) : 0;
+  SpecPut16(p+2, pPlan->PlanId);
+  SpecPut16(p+4, pEnc->SweepSeq);
+  SpecPut16(p+6, (uint16_t)points);
+  SpecPutF(p+8, mag_step);
+  SpecPutF(p+12, phase_step);
+  p += SPEC_HEADER_LEN;
+  if(bKey && pPlan->pFreqList)
+  {
+    for(uint32_t i=0; i<points; i++)
+      SpecPutF(p + i*4, pPlan->pFreqList[i]);
+    p += points*4;
+  }
+  else if(bKey)
+  {
+    SpecPutF(p, pPlan->Start);
+    SpecPutF(p+4, pPlan->Stop);
+    p[8] = pPlan->bLog ? 1 : 0;
+    p += SPEC_PLAN_LEN;
+  }
+  for(uint32_t i=0; i<points; i++)
+  {
+    int32_t qm = SpecQuantMag(pImp[i].Magnitude, mag_step);
+    int32_t qp = SpecQuant(pImp[i].Phase, phase_step);
+    int32_t rm = bKey ? (i ? pEnc->PrevMag[i-1] : 0) : pEnc->PrevMag[i];
+    int32_t rp = bKey ? (i ? pEnc->PrevPhase[i-1] : 0) : pEnc->PrevPhase[i];
+    p = SpecPutVarint(p, qm, rm);
+    p = SpecPutVarint(p, qp, rp);
+    pEnc->PrevMag[i] = qm;
+    pEnc->PrevPhase[i] = qp;
+  }
+  pEnc->PlanId = pPlan->PlanId;
+  pEnc->MagStep = mag_step;
+  pEnc->PhaseStep = phase_step;
+  pEnc->bValid = bTRUE;
+  pEnc->SweepSeq++;
+  pEnc->SinceKey = bKey ? 1 : pEnc->SinceKey + 1;
+  *pLen = (uint32_t)(p - pOut);
+  return AD5940ERR_OK;
+}
+
+void SpecDecInit(SpecDec_Type *pDec)
+{
+  memset(pDec, 0, sizeof(*pDec));
+  pDec->bValid = bFALSE;
+}
+
+static SpecPlan_Type *SpecDecFindPlan(SpecDec_Type *pDec, uint16_t PlanId)
+{
+  for(uint32_t i=0; i<pDec->PlanCount; i++)
+    if(pDec->Plan[i].PlanId == PlanId)
+      return &pDec->Plan[i];
+  return NULL;
+}
+
+/**
+ * @brief Decode one frame.
+ * @param pFreq: Frequency of each point, can be NULL.
+ * @return AD5940ERR_APPERROR if a delta frame arrives without its previous sweep. Wait for next key frame.
+*/
+AD5940Err SpecDecode(SpecDec_Type *pDec, const uint8_t *pData, uint32_t Len, float *pFreq,
+                     fImpPol_Type *pImp, uint32_t MaxPoints, uint32_t *pPoints)
+{
+  const uint8_t *p = pData + SPEC_HEADER_LEN;
+  const uint8_t *pEnd = pData + Len;
+  SpecPlan_Type *pPlan;
+  uint16_t plan_id, seq;
+  uint32_t points, flags;
+  float mag_step, phase_step;
+
+  if(Len < SPEC_HEADER_LEN || pData[0] != SPEC_MAGIC)
+    return AD5940ERR_PARA;
+  flags = pData[1];
+  plan_id = SpecGet16(pData+2);
+  seq = SpecGet16(pData+4);
+  points = SpecGet16(pData+6);
+  mag_step = SpecGetF(pData+8);
+  phase_step = SpecGetF(pData+12);
+  if(points == 0 || points > SPEC_MAX_POINTS || points > MaxPoints)
+    return AD5940ERR_BUFF;
+  if(flags&SPEC_FLAG_PLAN)
+  {
+    uint32_t plan_len = (flags&SPEC_FLAG_LIST) ? points*4 : SPEC_PLAN_LEN;
+    float *pList;
+    if(Len < SPEC_HEADER_LEN + plan_len)
+      return AD5940ERR_PARA;
+    pPlan = SpecDecFindPlan(pDec, plan_id);
+    if(pPlan == NULL)
+    {
+      /* Replace oldest plan when table is full */
+      if(pDec->PlanCount < SPEC_MAX_PLANS)
+        pPlan = &pDec->Plan[pDec->PlanCount++];
+      else
+        pPlan = &pDec->Plan[pDec->PlanNext++ % SPEC_MAX_PLANS];
+    }
+    pList = pDec->PlanFreq[pPlan - pDec->Plan];
+    pPlan->PlanId = plan_id;
+    pPlan->Points = points;
+    if(flags&SPEC_FLAG_LIST)
+    {
+      for(uint32_t i=0; i<points; i++)
+        pList[i] = SpecGetF(p + i*4);
+      pPlan->Start = pList[0];
+      pPlan->Stop = pList[points-1];
+      pPlan->bLog = bFALSE;
+      pPlan->pFreqList = pList;
+    }
+    else
+    {
+      pPlan->Start = SpecGetF(p);
+      pPlan->Stop = SpecGetF(p+4);
+      pPlan->bLog = p[8] ? bTRUE : bFALSE;
+      pPlan->pFreqList = NULL;
+    }
+    p += plan_len;
+  }
+  pPlan = SpecDecFindPlan(pDec, plan_id);
+  if(pPlan == NULL || pPlan->Points != points)
+  {
+    pDec->NeedKey++;
+    return AD5940ERR_APPERROR;
+  }
+  if((flags&SPEC_FLAG_KEY) == 0 && (pDec->bValid == bFALSE || pDec->PlanId != plan_id ||
+     (uint16_t)(pDec->SweepSeq + 1) != seq || pDec->MagStep != mag_step || pDec->PhaseStep != phase_step))
+  {
+    pDec->NeedKey++;
+    pDec->bValid = bFALSE;
+    return AD5940ERR_APPERROR;
+  }
+  for(uint32_t i=0; i<points; i++)
+  {
+    int32_t rm = (flags&SPEC_FLAG_KEY) ? (i ? pDec->PrevMag[i-1] : 0) : pDec->PrevMag[i];
+    int32_t rp = (flags&SPEC_FLAG_KEY) ? (i ? pDec->PrevPhase[i-1] : 0) : pDec->PrevPhase[i];
+    p = SpecGetVarint(p, pEnd, rm, &pDec->PrevMag[i]);
+    if(p) p = SpecGetVarint(p, pEnd, rp, &pDec->PrevPhase[i]);
+    if(p == NULL)
+    {
+      pDec->bValid = bFALSE;
+      return AD5940ERR_PARA;
+    }
+    pImp[i].Magnitude = SpecDequantMag(pDec->PrevMag[i], mag_step);
+    pImp[i].Phase = SpecDequant(pDec->PrevPhase[i], phase_step);
+    if(pFreq)
+      pFreq[i] = SpecPlanFreq(pPlan, i);
+  }
+  pDec->PlanId = plan_id;
+  pDec->SweepSeq = seq;
+  pDec->MagStep = mag_step;
+  pDec->PhaseStep = phase_step;
+  pDec->bValid = bTRUE;
+  pDec->Frames++;
+  *pPoints = points;
+  return AD5940ERR_OK;
+}
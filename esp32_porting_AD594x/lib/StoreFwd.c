@@ -0,0 +1,375 @@
+/*!
+ *****************************************************************************
+ @file:    StoreFwd.c
+ @brief:   Store-and-forward log for result frames while the network is down.
+ -----------------------------------------------------------------------------
+
+ Entry layout: 16-byte header followed by data padded to 4 bytes. Entries
+ never cross a sector boundary. The rest of a sector that cannot hold the
+ next entry stays erased and is skipped by replay and scan.
+ Functions are not reentrant, call them from one task.
+
+*****************************************************************************/
+#include "StoreFwd.h"
+#include <string.h>
+#include <stddef.h>
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+#endif
+
+#define SFWD_MAGIC          0x5346      /* 'SF' */
+#define SFWD_STATE_UNSENT   0xFFFFFFFF
+#define SFWD_STATE_SENDING  0x0000FFFF  /* Written before the send function is called */
+#define SFWD_STATE_SENT     0x00000000
+
+typedef struct
+{
+  uint16_t Magic;
+  uint16_t Len;                 /* Data length without padding */
+  uint32_t Seq;
+  uint8_t Stream;
+  uint8_t Rsvd;
+  uint16_t Crc;                 /* CRC16 of Len, Seq, Stream and data */
+  uint32_t State;               /* Cleared to SFWD_STATE_SENDING, then SFWD_STATE_SENT without erase */
+}SFEntry_Type;
+
+static uint8_t SFBuff[SFWD_MAX_DATA];
+
+static uint16_t SFCrc16(uint16_t crc, const uint8_t *pData, uint32_t Len)
+{
+  while(Len--)
+  {
+    crc ^= (uint16_t)(*pData++)<<8;
+    for(int i=0;i<8;i++)
+      crc = (crc&0x8000)?(crc<<1)^0x1021:(crc<<1);
+  }
+  return crc;
+}
+
+static uint16_t SFEntryCrc(const SFEntry_Type *pEntry, const uint8_t *pData)
+{
+  uint16_t crc = SFCrc16(0xFFFF, (const uint8_t*)&pEntry->Len, 8);  /* Len, Seq, Stream, Rsvd */
+  return SFCrc16(crc, pData, pEntry->Len);
+}
+
+static uint32_t SFEntrySize(uint32_t Len)
+{
+  return sizeof(SFEntry_Type) + ((Len + 3)&~3u);
+}
+
+static uint32_t SFNextSector(StoreFwd_Type *pLog, uint32_t Offset)
+{
+  Offset = (Offset/SFWD_SECTOR_SIZE + 1)*SFWD_SECTOR_SIZE;
+  return Offset >= pLog->Size ? 0 : Offset;
+}
+
+/* Storage access. Target uses the flash partition, host a file with erased bytes set to 0xFF. */
+static AD5940Err SFRead(StoreFwd_Type *pLog, uint32_t Offset, void *pBuff, uint32_t Len)
+{
+#ifdef ESP_PLATFORM
+  return esp_partition_read(pLog->pPart, Offset, pBuff, Len) == ESP_OK ? AD5940ERR_OK : AD5940ERR_ERROR;
+#else
+  if(fseek(pLog->pFile, Offset, SEEK_SET) != 0 || fread(pBuff, 1, Len, pLog->pFile) != Len)
+    return AD5940ERR_ERROR;
+  return AD5940ERR_OK;
+#endif
+}
+
+static AD5940Err SFWrite(StoreFwd_Type *pLog, uint32_t Offset, const void *pData, uint32_t Len)
+{
+#ifdef ESP_PLATFORM
+  return esp_partition_write(pLog->pPart, Offset, pData, Len) == ESP_OK ? AD5940ERR_OK : AD5940ERR_ERROR;
+#else
+  if(fseek(pLog->pFile, Offset, SEEK_SET) != 0 || fwrite(pData, 1, Len, pLog->pFile) != Len)
+    return AD5940ERR_ERROR;
+  fflush(pLog->pFile);
+  return AD5940ERR_OK;
+#endif
+}
+
+static AD5940Err SFEraseSector(StoreFwd_Type *pLog, uint32_t Offset)
+{
+#ifdef ESP_PLATFORM
+  return esp_partition_erase_range(pLog->pPart, Offset, SFWD_SECTOR_SIZE) == ESP_OK ? AD5940ERR_OK : AD5940ERR_ERROR;
+#else
+  uint8_t erased[256];
+  memset(erased, 0xFF, sizeof(erased));
+  for(uint32_t i=0; i<SFWD_SECTOR_SIZE; i+=sizeof(erased))
+    if(SFWrite(pLog, Offset + i, erased, sizeof(erased)) != AD5940ERR_OK)
+      return AD5940ERR_ERROR;
+  return AD5940ERR_OK;
+#endif
+}
+
+/**
+ * Read and check entry at Offset.
+ * @return AD5940ERR_OK for a valid entry, AD5940ERR_PARA if space is erased, AD5940ERR_ERROR if corrupted.
+ *         Data is left in SFBuff.
+*/
+static AD5940Err SFReadEntry(StoreFwd_Type *pLog, uint32_t Offset, SFEntry_Type *pEntry)
+{
+  uint32_t sector_end = (Offset/SFWD_SECTOR_SIZE + 1)*SFWD_SECTOR_SIZE;
+  if(Offset + sizeof(SFEntry_Type) > sector_end)
+    return AD5940ERR_PARA;
+  if(SFRead(pLog, Offset, pEntry, sizeof(SFEntry_Type)) != AD5940ERR_OK)
+    return AD5940ERR_ERROR;
+  if(pEntry->Magic == 0xFFFF && pEntry->Len == 0xFFFF)
+    return AD5940ERR_PARA;
+  if(pEntry->Magic != SFWD_MAGIC || pEntry->Len > SFWD_MAX_DATA || Offset + SFEntrySize(pEntry->Len) > sector_end)
+    return AD5940ERR_ERROR;
+  if(SFRead(pLog, Offset + sizeof(SFEntry_Type), SFBuff, pEntry->Len) != AD5940ERR_OK)
+    return AD5940ERR_ERROR;
+  if(SFEntryCrc(pEntry, SFBuff) != pEntry->Crc)
+    return AD5940ERR_ERROR;
+  return AD5940ERR_OK;
+}
+
+/* Rebuild head, tail and sequence numbers from flash contents */
+static void SFScan(StoreFwd_Type *pLog)
+{
+  SFEntry_Type entry;
+  uint32_t max_seq = 0, min_unsent = 0xFFFFFFFF, sent_max = 0, pending = 0;
+  uint32_t head = 0, tail = 0;
+  BoolFlag head_bad = bFALSE;
+
+  for(uint32_t sector=0; sector<pLog->Size; sector+=SFWD_SECTOR_SIZE)
+  {
+    uint32_t offset = sector;
+    BoolFlag bad = bFALSE;
+    while(offset < sector + SFWD_SECTOR_SIZE)
+    {
+      AD5940Err error = SFReadEntry(pLog, offset, &entry);
+      if(error == AD5940ERR_PARA)
+        break;
+      if(error != AD5940ERR_OK)
+      {
+        bad = bTRUE;    /* Write interrupted by reset. Nothing after it in this sector is trusted. */
+        break;
+      }
+      if(entry.Seq > max_seq)
+      {
+        max_seq = entry.Seq;
+        head = offset + SFEntrySize(entry.Len);
+      }
+      if(entry.State == SFWD_STATE_UNSENT)
+      {
+        pending++;
+        if(entry.Seq < min_unsent)
+        {
+          min_unsent = entry.Seq;
+          tail = offset;
+        }
+      }
+      else if(entry.Seq > sent_max)
+        sent_max = entry.Seq;     /* Sending or sent */
+      offset += SFEntrySize(entry.Len);
+    }
+    if(head > sector && head <= sector + SFWD_SECTOR_SIZE)
+      head_bad = bad;
+  }
+  if(head_bad)
+    head = SFNextSector(pLog, head - 1);
+  if(head >= pLog->Size)
+    head = 0;
+  pLog->Head = head;
+  pLog->Tail = min_unsent != 0xFFFFFFFF ? tail : head;
+  pLog->NextSeq = max_seq + 1;
+  pLog->SentSeq = sent_max;
+  pLog->Pending = pending;
+}
+
+/**
+ * @brief Open log and recover its state.
+ * @param pName: Partition label on target, file name on host. The file is created if missing.
+*/
+AD5940Err StoreFwdOpen(StoreFwd_Type *pLog, const char *pName)
+{
+  memset(pLog, 0, sizeof(*pLog));
+  strncpy(pLog->Name, pName, SFWD_NAME_LEN - 1);
+#ifdef ESP_PLATFORM
+  const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, pLog->Name);
+  if(part == NULL)
+    return AD5940ERR_PARA;
+  pLog->pPart = part;
+  pLog->Size = part->size/SFWD_SECTOR_SIZE*SFWD_SECTOR_SIZE;
+#else
+  pLog->Size = SFWD_HOST_SIZE;
+  pLog->pFile = fopen(pLog->Name, "r+b");
+  if(pLog->pFile == NULL)
+  {
+    pLog->pFile = fopen(pLog->Name, "w+b");
+    if(pLog->pFile == NULL)
+      return AD5940ERR_ERROR;
+    for(uint32_t i=0; i<pLog->Size; i+=SFWD_SECTOR_SIZE)
+      SFEraseSector(pLog, i);
+  }
+#endif
+  if(pLog->Size < 2*SFWD_SECTOR_SIZE)
+    return AD5940ERR_PARA;
+  SFScan(pLog);
+  pLog->bOpen = bTRUE;
+  return AD5940ERR_OK;
+}
+
+void StoreFwdClose(StoreFwd_Type *pLog)
+{
+#ifndef ESP_PLATFORM
+  if(pLog->pFile)
+    fclose(pLog->pFile);
+  pLog->pFile = NULL;
+#endif
+  pLog->bOpen = bFALSE;
+}
+
+BoolFlag StoreFwdEmpty(StoreFwd_Type *pLog)
+{
+  return (pLog->bOpen == bFALSE || pLog->Pending == 0) ? bTRUE : bFALSE;
+}
+
+/* Sector at Offset is about to be erased. Count unsent entries lost and move tail past it. */
+static void SFDropSector(StoreFwd_Type *pLog, uint32_t Offset)
+{
+  SFEntry_Type entry;
+  uint32_t off = pLog->Tail;
+
+  if(pLog->Pending == 0 || pLog->Tail/SFWD_SECTOR_SIZE != Offset/SFWD_SECTOR_SIZE)
+    return;
+  while(pLog->Pending && SFReadEntry(pLog, off, &entry) == AD5940ERR_OK)
+  {
+    if(entry.State != SFWD_STATE_SENT && entry.Seq > pLog->SentSeq)
+    {
+      pLog->Dropped++;
+      pLog->Pending--;
+    }
+    off += SFEntrySize(entry.Len);
+  }
+  pLog->Tail = SFNextSector(pLog, Offset);
+}
+
+/**
+ * @brief Append one record, e.g. a result stream frame.
+ * @param Stream: Caller defined source ID, returned on replay.
+*/
+AD5940Err StoreFwdAppend(StoreFwd_Type *pLog, uint32_t Stream, const uint8_t *pData, uint32_t Len)
+{
+  SFEntry_Type entry;
+  uint32_t size = SFEntrySize(Len);
+  uint32_t pos = pLog->Head;
+  BoolFlag bWasEmpty = StoreFwdEmpty(pLog);
+
+  if(pLog->bOpen == bFALSE)
+    return AD5940ERR_APPERROR;
+  if(Len > SFWD_MAX_DATA || Stream > 0xFF)
+    return AD5940ERR_PARA;
+  if(pos%SFWD_SECTOR_SIZE + size > SFWD_SECTOR_SIZE)
+    pos = SFNextSector(pLog, pos);
+  if(pos%SFWD_SECTOR_SIZE == 0)
+  {
+    if(bWasEmpty == bFALSE)
+      SFDropSector(pLog, pos);
+    if(SFEraseSector(pLog, pos) != AD5940ERR_OK)
+      return AD5940ERR_ERROR;
+  }
+  entry.Magic = SFWD_MAGIC;
+  entry.Len = (uint16_t)Len;
+  entry.Seq = pLog->NextSeq;
+  entry.Stream = (uint8_t)Stream;
+  entry.Rsvd = 0xFF;
+  entry.Crc = SFEntryCrc(&entry, pData);
+  entry.State = SFWD_STATE_UNSENT;
+  /* Data first. A reset before the header is written leaves no valid entry. */
+  if(SFWrite(pLog, pos + sizeof(entry), pData, Len) != AD5940ERR_OK ||
+     SFWrite(pLog, pos, &entry, sizeof(entry)) != AD5940ERR_OK)
+    return AD5940ERR_ERROR;
+  pLog->NextSeq++;
+  pLog->Head = pos + size;
+  if(pLog->Head >= pLog->Size)
+    pLog->Head = 0;
+  if(bWasEmpty == bTRUE)
+    pLog->Tail = pos;
+  pLog->Pending++;
+  pLog->Stored++;
+  return AD5940ERR_OK;
+}
+
+/* Move tail to the next entry still to send and read it. Entries up to SentSeq are marked sent on the way. */
+static AD5940Err SFNextUnsent(StoreFwd_Type *pLog, SFEntry_Type *pEntry)
+{
+  const uint32_t sent = SFWD_STATE_SENT;
+  uint32_t steps = 0;
+
+  while(StoreFwdEmpty(pLog) == bFALSE)
+  {
+    if(++steps > pLog->Size/sizeof(SFEntry_Type))
+    {
+      pLog->Pending = 0;    /* Went round the ring without finding them, counter is wrong */
+      break;
+    }
+    uint32_t off = pLog->Tail;
+    if(SFReadEntry(pLog, off, pEntry) != AD5940ERR_OK)
+    {
+      /* End of entries in this sector, continue at next one */
+      pLog->Tail = SFNextSector(pLog, off);
+      continue;
+    }
+    if(pEntry->State != SFWD_STATE_SENT)
+    {
+      if(pEntry->Seq > pLog->SentSeq)
+        return AD5940ERR_OK;
+      /* Handed to the send function before a reset, but not marked sent */
+      SFWrite(pLog, off + offsetof(SFEntry_Type, State), &sent, sizeof(sent));
+      if(pEntry->State == SFWD_STATE_UNSENT)
+        pLog->Pending--;    /* Only unsent entries are counted */
+    }
+    pLog->Tail = off + SFEntrySize(pEntry->Len);
+    if(pLog->Tail >= pLog->Size)
+      pLog->Tail = 0;
+  }
+  return AD5940ERR_PARA;
+}
+
+/**
+ * @brief Stream of the record StoreFwdReplay sends next, so the caller can check it is ready for it.
+ * @return AD5940ERR_PARA if there is nothing to send.
+*/
+AD5940Err StoreFwdPeek(StoreFwd_Type *pLog, uint32_t *pStream)
+{
+  SFEntry_Type entry;
+
+  if(SFNextUnsent(pLog, &entry) != AD5940ERR_OK)
+    return AD5940ERR_PARA;
+  *pStream = entry.Stream;
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Send up to MaxEntries unsent records in order. Limiting MaxEntries per call sets the replay rate.
+ * @param pSend: Returns bFALSE if the record could not be sent. Replay stops there and resumes on next call,
+ *               the record is lost if a reset comes first.
+ * @return Number of records sent.
+*/
+uint32_t StoreFwdReplay(StoreFwd_Type *pLog, StoreFwdSend_Func pSend, void *pUser, uint32_t MaxEntries)
+{
+  SFEntry_Type entry;
+  uint32_t count = 0;
+  const uint32_t sending = SFWD_STATE_SENDING, sent = SFWD_STATE_SENT;
+
+  while(count < MaxEntries && SFNextUnsent(pLog, &entry) == AD5940ERR_OK)
+  {
+    uint32_t off = pLog->Tail;
+    /* Persist the mark first, a reset after pSend must not send the entry again */
+    if(entry.State == SFWD_STATE_UNSENT)
+      SFWrite(pLog, off + offsetof(SFEntry_Type, State), &sending, sizeof(sending));
+    if(pSend(pUser, entry.Stream, entry.Seq, SFBuff, entry.Len) == bFALSE)
+      break;
+    pLog->SentSeq = entry.Seq;
+    pLog->Replayed++;
+    count++;
+    SFWrite(pLog, off + offsetof(SFEntry_Type, State), &sent, sizeof(sent));
+    pLog->Pending--;
+    pLog->Tail = off + SFEntrySize(entry.Len);
+    if(pLog->Tail >= pLog->Size)
+      pLog->Tail = 0;
+  }
+  return count;
+}
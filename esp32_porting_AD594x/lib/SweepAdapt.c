@@ -0,0 +1,153 @@
+/*!
+ *****************************************************************************
+ @file:    SweepAdapt.c
+ @brief:   Adaptive frequency refinement of a sweep.
+ -----------------------------------------------------------------------------
+
+ Host_Tools/adapt_check.c compiles this file on the host and compares the
+ refined sweeps of synthetic spectra with fixed grids.
+
+*****************************************************************************/
+#include "SweepAdapt.h"
+#include <string.h>
+#include <math.h>
+
+/* Phase change from Z a to Z b in rad, arg(b conj(a)) */
+static float SweepAdaptPhase(const fImpCar_Type *pA, const fImpCar_Type *pB)
+{
+  return fabsf(atan2f(pB->Image*pA->Real - pB->Real*pA->Image, pB->Real*pA->Real + pB->Image*pA->Image));
+}
+
+/* Distance of point i from the line through its neighbours, relative to |Z| */
+static float SweepAdaptCurv(const SweepAdapt_Type *pAdapt, uint32_t i)
+{
+  const fImpCar_Type *pLo = &pAdapt->Z[i-1], *pHi = &pAdapt->Z[i+1], *pZ = &pAdapt->Z[i];
+  float t, re, im, mag;
+
+  if(pAdapt->bLog)
+    t = logf(pAdapt->Freq[i]/pAdapt->Freq[i-1])/logf(pAdapt->Freq[i+1]/pAdapt->Freq[i-1]);
+  else
+    t = (pAdapt->Freq[i] - pAdapt->Freq[i-1])/(pAdapt->Freq[i+1] - pAdapt->Freq[i-1]);
+  re = pZ->Real - (pLo->Real + t*(pHi->Real - pLo->Real));
+  im = pZ->Image - (pLo->Image + t*(pHi->Image - pLo->Image));
+  mag = hypotf(pZ->Real, pZ->Image);
+  return mag > 0 ? hypotf(re, im)/mag : 0;
+}
+
+/**
+ * @brief Initialize with default settings: 64 points, 4 refinement passes, 5 degree phase
+ *        change, 1% curvature, intervals down to 2% of frequency are split.
+*/
+void SweepAdaptInit(SweepAdapt_Type *pAdapt)
+{
+  memset(pAdapt, 0, sizeof(*pAdapt));
+  pAdapt->MaxPoints = 64;
+  pAdapt->MaxPasses = 4;
+  pAdapt->PhaseTol = 5*MATH_PI/180;
+  pAdapt->CurvTol = 0.01f;
+  pAdapt->MinRatio = 1.02f;
+}
+
+/**
+ * @brief Start a sweep with the grid of pSweepCfg as first pass, same frequencies as
+ *        AD5940_SweepNext gives for it.
+ * @return Points of the first pass, 0 if pSweepCfg can't be refined: no sweep, a frequency
+ *         list or more than SWEEP_ADAPT_MAX_POINTS points.
+*/
+uint32_t SweepAdaptBegin(SweepAdapt_Type *pAdapt, const SoftSweepCfg_Type *pSweepCfg)
+{
+  float start = pSweepCfg->SweepStart, stop = pSweepCfg->SweepStop;
+  uint32_t points = pSweepCfg->SweepPoints, i;
+
+  pAdapt->Pass = 0;
+  pAdapt->Count = 0;
+  pAdapt->PassCount = 0;
+  if(pSweepCfg->SweepEn == bFALSE || pSweepCfg->pFreqList || points < 2 || points > SWEEP_ADAPT_MAX_POINTS ||
+     !(start > 0) || !(stop > 0) || start == stop)
+    return 0;
+  pAdapt->bLog = pSweepCfg->SweepLog;
+  pAdapt->bDown = start > stop ? bTRUE : bFALSE;
+  for(i=0; i<points; i++)
+  {
+    if(pAdapt->bLog)
+      pAdapt->PassFreq[i] = start*pow(10, i*log10(stop/start)/(points-1));
+    else
+      pAdapt->PassFreq[i] = start + i*(double)(stop-start)/(points-1);
+  }
+  pAdapt->PassCount = points;
+  return points;
+}
+
+/**
+ * @brief Add a measured point of the current pass.
+ * @return AD5940ERR_BUFF if SWEEP_ADAPT_MAX_POINTS points are already there.
+*/
+AD5940Err SweepAdaptAdd(SweepAdapt_Type *pAdapt, float Freq, const fImpCar_Type *pZ)
+{
+  uint32_t i = pAdapt->Count;
+
+  if(pAdapt->Count >= SWEEP_ADAPT_MAX_POINTS)
+    return AD5940ERR_BUFF;
+  while(i > 0 && pAdapt->Freq[i-1] > Freq)
+    i--;
+  memmove(&pAdapt->Freq[i+1], &pAdapt->Freq[i], (pAdapt->Count - i)*sizeof(float));
+  memmove(&pAdapt->Z[i+1], &pAdapt->Z[i], (pAdapt->Count - i)*sizeof(fImpCar_Type));
+  pAdapt->Freq[i] = Freq;
+  pAdapt->Z[i] = *pZ;
+  pAdapt->Count++;
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Plan the next pass from the points measured so far. Call when a pass is done.
+ * @return Points of the next pass in PassFreq, 0 if the sweep is done.
+*/
+uint32_t SweepAdaptRefine(SweepAdapt_Type *pAdapt)
+{
+  float score[SWEEP_ADAPT_MAX_POINTS];
+  uint32_t n = pAdapt->Count, max = pAdapt->MaxPoints, budget, best, i, k;
+  float c;
+
+  pAdapt->PassCount = 0;
+  if(max > SWEEP_ADAPT_MAX_POINTS)
+    max = SWEEP_ADAPT_MAX_POINTS;
+  if(n < 2 || n >= max || pAdapt->Pass >= pAdapt->MaxPasses)
+    return 0;
+  budget = max - n;
+  /* Rate each interval i between points i and i+1, over 1 is over tolerance */
+  for(i=0; i+1<n; i++)
+    score[i] = SweepAdaptPhase(&pAdapt->Z[i], &pAdapt->Z[i+1])/pAdapt->PhaseTol;
+  for(i=1; i+1<n; i++)
+  {
+    c = SweepAdaptCurv(pAdapt, i)/pAdapt->CurvTol;
+    score[i-1] = c > score[i-1] ? c : score[i-1];
+    score[i] = c > score[i] ? c : score[i];
+  }
+  for(i=0; i+1<n; i++)
+    if(pAdapt->Freq[i+1] < pAdapt->Freq[i]*pAdapt->MinRatio)
+      score[i] = 0;
+  /* Worst intervals first, selected ones are marked with -1 */
+  for(k=0; k<budget; k++)
+  {
+    best = 0;
+    for(i=1; i+1<n; i++)
+      best = score[i] > score[best] ? i : best;
+    if(!(score[best] > 1))
+      break;
+    score[best] = -1;
+  }
+  /* Pass runs in the direction of the sweep */
+  for(k=0; k+1<n; k++)
+  {
+    i = pAdapt->bDown ? n - 2 - k : k;
+    if(score[i] >= 0)
+      continue;
+    if(pAdapt->bLog)
+      pAdapt->PassFreq[pAdapt->PassCount++] = sqrtf(pAdapt->Freq[i]*pAdapt->Freq[i+1]);
+    else
+      pAdapt->PassFreq[pAdapt->PassCount++] = (pAdapt->Freq[i] + pAdapt->Freq[i+1])/2;
+  }
+  if(pAdapt->PassCount)
+    pAdapt->Pass++;
+  return pAdapt->PassCount;
+}
@@ -0,0 +1,145 @@
+/*!
+ *****************************************************************************
+ @file:    TimeSync.c
+ @brief:   Map device monotonic microseconds to a host clock.
+ -----------------------------------------------------------------------------
+
+ One task adds exchanges while others convert time stamps. The model is
+ guarded by a sequence counter: it is odd while the model is written and
+ readers retry until they see the same even value before and after.
+
+*****************************************************************************/
+#include "TimeSync.h"
+#include <string.h>
+
+TSync_Type AppTimeSync;
+
+static volatile uint32_t TSyncVersion;
+
+void TSyncInit(TSync_Type *pSync)
+{
+  memset(pSync, 0, sizeof(*pSync));
+  pSync->bSynced = bFALSE;
+}
+
+/* Least squares fit of offset over device time, using samples with short round trip */
+static void TSyncFit(TSync_Type *pSync)
+{
+  uint32_t min_rtt = 0xFFFFFFFF, n = 0, i;
+  double x_mean = 0, y_mean = 0, sxx = 0, sxy = 0;
+  uint64_t x0 = 0;
+  int64_t y0 = 0;
+  TSyncSample_Type *pS;
+
+  for(i=0; i<pSync->Count; i++)
+    if(pSync->Sample[i].RttUs < min_rtt)
+      min_rtt = pSync->Sample[i].RttUs;
+  /* Values relative to first used sample keep double precision well below 1 us */
+  for(i=0; i<pSync->Count; i++)
+  {
+    pS = &pSync->Sample[i];
+    if(pS->RttUs > min_rtt + TSYNC_RTT_MARGIN_US)
+      continue;
+    if(n == 0)
+    {
+      x0 = pS->DevUs;
+      y0 = pS->OffsetUs;
+    }
+    x_mean += (double)(int64_t)(pS->DevUs - x0);
+    y_mean += (double)(pS->OffsetUs - y0);
+    n++;
+  }
+  x_mean /= n;
+  y_mean /= n;
+  for(i=0; i<pSync->Count; i++)
+  {
+    double dx, dy;
+    pS = &pSync->Sample[i];
+    if(pS->RttUs > min_rtt + TSYNC_RTT_MARGIN_US)
+      continue;
+    dx = (double)(int64_t)(pS->DevUs - x0) - x_mean;
+    dy = (double)(pS->OffsetUs - y0) - y_mean;
+    sxx += dx*dx;
+    sxy += dx*dy;
+  }
+
+  TSyncVersion++;
+  __sync_synchronize();
+  pSync->RefUs = x0 + (int64_t)x_mean;
+  pSync->OffsetUs = (double)y0 + y_mean;
+  /* Drift needs samples spread over at least a second, otherwise noise dominates */
+  pSync->DriftPpm = (sxx/n > 1e11) ? sxy/sxx*1e6 : 0;
+  pSync->ErrUs = min_rtt/2;
+  pSync->Used = n;
+  pSync->bSynced = bTRUE;
+  __sync_synchronize();
+  TSyncVersion++;
+}
+
+/**
+ * @brief Add one completed exchange and update clock model.
+ * @param HostTxUs: T1, host time request was sent.
+ * @param DevRxUs: T2, device time request was received.
+ * @param DevTxUs: T3, device time answer was sent.
+ * @param HostRxUs: T4, host time answer was received.
+ * @return AD5940ERR_PARA if times are inconsistent.
+*/
+AD5940Err TSyncAddExchange(TSync_Type *pSync, int64_t HostTxUs, uint64_t DevRxUs, uint64_t DevTxUs, int64_t HostRxUs)
+{
+  int64_t rtt = (HostRxUs - HostTxUs) - (int64_t)(DevTxUs - DevRxUs);
+  TSyncSample_Type *pS;
+
+  if(DevTxUs < DevRxUs || HostRxUs < HostTxUs || rtt < 0 || rtt > 0xFFFFFFFF)
+  {
+    pSync->Rejected++;
+    return AD5940ERR_PARA;
+  }
+  pS = &pSync->Sample[pSync->Next];
+  pS->DevUs = DevRxUs + (DevTxUs - DevRxUs)/2;
+  pS->OffsetUs = ((HostTxUs - (int64_t)DevRxUs) + (HostRxUs - (int64_t)DevTxUs))/2;
+  pS->RttUs = (uint32_t)rtt;
+  pSync->Next = (pSync->Next + 1)%TSYNC_MAX_SAMPLES;
+  if(pSync->Count < TSYNC_MAX_SAMPLES)
+    pSync->Count++;
+  pSync->Exchanges++;
+  TSyncFit(pSync);
+  return AD5940ERR_OK;
+}
+
+/**
+ * @brief Convert device time to host time.
+ * @return bFALSE if there is no clock model yet, *pHostUs is not changed then.
+*/
+BoolFlag TSyncToHost(const TSync_Type *pSync, uint64_t DevUs, int64_t *pHostUs)
+{
+  uint32_t version;
+  double offset;
+
+  do
+  {
+    version = TSyncVersion;
+    __sync_synchronize();
+    if(pSync->bSynced == bFALSE)
+      return bFALSE;
+    offset = pSync->OffsetUs + pSync->DriftPpm*1e-6*(double)(int64_t)(DevUs - pSync->RefUs);
+    __sync_synchronize();
+  }while((version&1) || version != TSyncVersion);
+  *pHostUs = (int64_t)DevUs + (int64_t)(offset >= 0 ? offset + 0.5 : offset - 0.5);
+  return bTRUE;
+}
+
+/**
+ * @brief Time stamp for a result: host time once AppTimeSync has a clock model, device time before.
+ * @return bTRUE if *pTimeUs is host time.
+*/
+BoolFlag TSyncStamp(uint64_t DevUs, uint64_t *pTimeUs)
+{
+  int64_t host_us;
+  if(TSyncToHost(&AppTimeSync, DevUs, &host_us) == bTRUE && host_us >= 0)
+  {
+    *pTimeUs = (uint64_t)host_us;
+    return bTRUE;
+  }
+  *pTimeUs = DevUs;
+  return bFALSE;
+}
@@ -570,6 +570,13 @@ void AD5940_SweepNext(SoftSweepCfg_Type *pSweepCfg, float *pNextFreq)
 {
    float frequency;
 
+   if(pSweepCfg->pFreqList)/* Frequency list */
+   {
+      if(++pSweepCfg->SweepIndex >= pSweepCfg->SweepPoints)
+         pSweepCfg->SweepIndex = 0;
+      *pNextFreq = pSweepCfg->pFreqList[pSweepCfg->SweepIndex];
+      return;
+   }
    if(pSweepCfg->SweepLog)/* Log step */
    {
       if(pSweepCfg->SweepStart<pSweepCfg->SweepStop) /* Normal */
@@ -607,6 +614,18 @@ void AD5940_SweepNext(SoftSweepCfg_Type *pSweepCfg, float *pNextFreq)
    *pNextFreq = frequency;
 }
 
+/**
+   @brief float AD5940_SweepFirstFreq(const SoftSweepCfg_Type *pSweepCfg)
+          Frequency a sweep starts with, SweepStart or first entry of the frequency list.
+   @return Return first frequency point in Hz.
+*/
+float AD5940_SweepFirstFreq(const SoftSweepCfg_Type *pSweepCfg)
+{
+   if(pSweepCfg->pFreqList)
+      return pSweepCfg->pFreqList[0];
+   return pSweepCfg->SweepStart;
+}
+
 /**
   @brief Initialize Structure members to zero
   @param pStruct: Pointer to the structure. 
@@ -868,6 +887,11 @@ void AD5940_FIFORd(uint32_t *pBuffer, uint32_t uiReadCount)
   while(uiReadCount--)
     *pBuffer++ = *(volatile uint32_t *)(0x400c206C);
 }
+
+/* Register access is memory mapped on ADuCM355, there is nothing to batch. */
+void AD5940_SPIBatchStart(void){}
+void AD5940_SPIBatchEnd(void){}
+void AD5940_SPIBatchFlush(void){}
 #else
 /**
  * @defgroup SPI_Block
@@ -930,6 +954,81 @@ static uint32_t AD5940_ReadWrite32B(uint32_t data)
    return (((uint32_t)RecvBuffer[0])<<24)|(((uint32_t)RecvBuffer[1])<<16)|(((uint32_t)RecvBuffer[2])<<8)|RecvBuffer[3];
 }
 
+/* Pending register writes of a SPI batch. Each write is a SETADDR frame followed by a WRITEREG frame. */
+#define SPIBATCH_MAXREG   32
+static struct
+{
+  BoolFlag bActive;
+  uint32_t FrameCount;
+  uint32_t ByteCount;
+  uint16_t FrameLen[SPIBATCH_MAXREG*2];
+  uint8_t Buff[SPIBATCH_MAXREG*8];
+}SPIBatch;
+
+/* Append SETADDR and WRITEREG frames of one register write to batch buffer */
+static void AD5940_SPIBatchAppend(uint16_t RegAddr, uint32_t RegData)
+{
+  uint8_t *p = &SPIBatch.Buff[SPIBatch.ByteCount];
+
+  p[0] = SPICMD_SETADDR;
+  p[1] = RegAddr>>8;
+  p[2] = RegAddr&0xff;
+  SPIBatch.FrameLen[SPIBatch.FrameCount++] = 3;
+  p[3] = SPICMD_WRITEREG;
+  if(((RegAddr>=0x1000)&&(RegAddr<=0x3014)))
+  {
+    p[4] = (RegData>>24)&0xff;
+    p[5] = (RegData>>16)&0xff;
+    p[6] = (RegData>> 8)&0xff;
+    p[7] = (RegData    )&0xff;
+    SPIBatch.FrameLen[SPIBatch.FrameCount++] = 5;
+  }
+  else
+  {
+    p[4] = (RegData>> 8)&0xff;
+    p[5] = (RegData    )&0xff;
+    SPIBatch.FrameLen[SPIBatch.FrameCount++] = 3;
+  }
+  SPIBatch.ByteCount += 3 + SPIBatch.FrameLen[SPIBatch.FrameCount-1];
+}
+
+/**
+ * @brief Send all register writes collected in batch buffer.
+ * @note It's called automatically before any register read, FIFO read or delay, so the
+ *       order of SPI accesses is kept.
+ * @return Return None.
+**/
+void AD5940_SPIBatchFlush(void)
+{
+  if(SPIBatch.FrameCount == 0)
+    return;
+  AD5940_WriteNFrames(SPIBatch.Buff, SPIBatch.FrameLen, SPIBatch.FrameCount);
+  SPIBatch.FrameCount = 0;
+  SPIBatch.ByteCount = 0;
+}
+
+/**
+ * @brief Start collecting register writes. They are sent in one bus transaction group
+ *        when buffer is full, a read is needed or AD5940_SPIBatchEnd is called.
+ * @return Return None.
+**/
+void AD5940_SPIBatchStart(void)
+{
+  SPIBatch.FrameCount = 0;
+  SPIBatch.ByteCount = 0;
+  SPIBatch.bActive = bTRUE;
+}
+
+/**
+ * @brief Send pending register writes and go back to writing registers one by one.
+ * @return Return None.
+**/
+void AD5940_SPIBatchEnd(void)
+{
+  AD5940_SPIBatchFlush();
+  SPIBatch.bActive = bFALSE;
+}
+
 /**
  * @brief Write register through SPI.
  * @param RegAddr: The register address.
@@ -938,19 +1037,26 @@ static uint32_t AD5940_ReadWrite32B(uint32_t data)
 **/
 static void AD5940_SPIWriteReg(uint16_t RegAddr, uint32_t RegData)
 {  
-  /* Set register address */
-  AD5940_CsClr();
-  AD5940_ReadWrite8B(SPICMD_SETADDR);
-  AD5940_ReadWrite16B(RegAddr);
-  AD5940_CsSet();
-  /* Add delay here to meet the SPI timing. */
-  AD5940_CsClr();
-  AD5940_ReadWrite8B(SPICMD_WRITEREG);
-  if(((RegAddr>=0x1000)&&(RegAddr<=0x3014)))
-    AD5940_ReadWrite32B(RegData);
-  else
-    AD5940_ReadWrite16B(RegData);
-  AD5940_CsSet();
+  if(SPIBatch.bActive == bFALSE)
+  {
+    /* Set register address */
+    AD5940_CsClr();
+    AD5940_ReadWrite8B(SPICMD_SETADDR);
+    AD5940_ReadWrite16B(RegAddr);
+    AD5940_CsSet();
+    /* Add delay here to meet the SPI timing. */
+    AD5940_CsClr();
+    AD5940_ReadWrite8B(SPICMD_WRITEREG);
+    if(((RegAddr>=0x1000)&&(RegAddr<=0x3014)))
+      AD5940_ReadWrite32B(RegData);
+    else
+      AD5940_ReadWrite16B(RegData);
+    AD5940_CsSet();
+    return;
+  }
+  if(SPIBatch.FrameCount >= SPIBATCH_MAXREG*2)
+    AD5940_SPIBatchFlush();
+  AD5940_SPIBatchAppend(RegAddr, RegData);
 }
 
 /**
@@ -961,6 +1067,7 @@ static void AD5940_SPIWriteReg(uint16_t RegAddr, uint32_t RegData)
 static uint32_t AD5940_SPIReadReg(uint16_t RegAddr)
 {  
   uint32_t Data = 0;
+  AD5940_SPIBatchFlush();   /* Pending writes go first */
   /* Set register address that we want to read */
   AD5940_CsClr();
   AD5940_ReadWrite8B(SPICMD_SETADDR);
@@ -990,6 +1097,7 @@ void AD5940_FIFORd(uint32_t *pBuffer, uint32_t uiReadCount)
   /* Use function AD5940_SPIReadReg to read REG_AFE_DATAFIFORD is also one method. */
    uint32_t i;
    
+   AD5940_SPIBatchFlush();
    if(uiReadCount < 3)
    {
       /* This method is more efficient when readcount < 3 */
@@ -3016,6 +3124,27 @@ void AD5940_HWReset(void)
 #endif
 }
 
+/**
+ * @brief Hardware reset AD5940 and poll ADIID until it answers instead of waiting a fixed time.
+ * @param TimeOut10us: Maximum time to wait for AD5940 to leave reset, in 10us unit.
+ * @return AD5940ERR_OK, or AD5940ERR_TIMEOUT if ADIID is never read back.
+**/
+AD5940Err AD5940_HWResetPoll(uint32_t TimeOut10us)
+{
+#ifndef CHIPSEL_M355
+  AD5940_RstClr();
+  AD5940_Delay10us(1);    /* Reset pulse */
+  AD5940_RstSet();
+  while(AD5940_ReadReg(REG_AFECON_ADIID) != AD5940_ADIID)
+  {
+    if(TimeOut10us-- == 0)
+      return AD5940ERR_TIMEOUT;
+    AD5940_Delay10us(1);
+  }
+#endif
+  return AD5940ERR_OK;
+}
+
 /**
  * @} MISC_Block_Functions
  * @} MISC_Block
@@ -1,5 +1,7 @@
 #include "board_config.h"
 #include "ad5940.h"
+#include <stddef.h>
+#include <stdio.h>
 
 // Wrapper functions that delegate to the selected board implementation
 void AD5940_CsSet(void) {
@@ -41,6 +43,7 @@ uint32_t AD5940_ClrMCUIntFlag(void) {
 }
 
 void AD5940_Delay10us(uint32_t time) {
+    AD5940_SPIBatchFlush(); // Batched register writes must reach the chip before the delay starts
     if (current_board) {
         current_board->Delay10us(time);
     }
@@ -52,6 +55,72 @@ void AD5940_ReadWriteNBytes(unsigned char *pSendBuffer, unsigned char *pRecvBuff
     }
 }
 
+void AD5940_WriteNFrames(unsigned char *pSendBuffer, const uint16_t *pFrameLen, uint32_t FrameCount) {
+    if (current_board == NULL) {
+        return;
+    }
+    if (current_board->WriteNFrames) {
+        current_board->WriteNFrames(pSendBuffer, pFrameLen, FrameCount);
+        return;
+    }
+    // Fallback: one transfer per frame
+    for (uint32_t i = 0; i < FrameCount; i++) {
+        current_board->CsClr();
+        current_board->ReadWriteNBytes(pSendBuffer, NULL, pFrameLen[i]);
+        current_board->CsSet();
+        pSendBuffer += pFrameLen[i];
+    }
+}
+
+uint64_t AD5940_GetTimeUs(void) {
+    if (current_board && current_board->GetTimeUs) {
+        return current_board->GetTimeUs();
+    }
+    return 0;
+}
+
+uint64_t AD5940_GetMCUIntTimeUs(void) {
+    if (current_board && current_board->GetIntTimeUs) {
+        return current_board->GetIntTimeUs();
+    }
+    return AD5940_GetTimeUs();  // Fallback: time the flag is handled
+}
+
+void AD5940_StreamWrite(const uint8_t *pData, uint32_t Len) {
+    if (current_board && current_board->StreamWrite) {
+        current_board->StreamWrite(pData, Len);
+        return;
+    }
+    // Fallback: stdout must not translate line endings
+    fwrite(pData, 1, Len, stdout);
+    fflush(stdout);
+}
+
+uint32_t AD5940_StreamRoom(void) {
+    if (current_board && current_board->StreamRoom) {
+        return current_board->StreamRoom();
+    }
+    return 0xFFFFFFFF;  // Unknown, writes may block
+}
+
+void AD5940_ReadWriteNBytesStart(unsigned char *pSendBuffer, unsigned char *pRecvBuff, unsigned long length) {
+    if (current_board == NULL) {
+        return;
+    }
+    if (current_board->ReadWriteNBytesStart) {
+        current_board->ReadWriteNBytesStart(pSendBuffer, pRecvBuff, length);
+        return;
+    }
+    // Fallback: transfer now, there is nothing to wait for
+    current_board->ReadWriteNBytes(pSendBuffer, pRecvBuff, length);
+}
+
+void AD5940_ReadWriteNBytesWait(void) {
+    if (current_board && current_board->ReadWriteNBytesStart && current_board->ReadWriteNBytesWait) {
+        current_board->ReadWriteNBytesWait();
+    }
+}
+
 uint32_t AD5940_MCUResourceInit(void *pCfg) {
     if (current_board) {
         return current_board->MCUResourceInit(pCfg);
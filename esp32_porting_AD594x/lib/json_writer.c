@@ -0,0 +1,428 @@
+/*
+Allocation-free JSON writer and tokenizer
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "json_writer.h"
+
+/* ------------------------------------------------------------------------- */
+/* Writer                                                                     */
+/* ------------------------------------------------------------------------- */
+
+static void jw_put(json_writer_t *w, const char *s, size_t n)
+{
+    if (w->error) {
+        return;
+    }
+    if (w->len + n >= w->size) {    // Keep room for terminating NUL
+        w->error = true;
+        return;
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static void jw_putc(json_writer_t *w, char c)
+{
+    jw_put(w, &c, 1);
+}
+
+static void jw_put_escaped(json_writer_t *w, const char *s)
+{
+    char esc[8];
+
+    jw_putc(w, '"');
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        switch (c) {
+            case '"':  jw_put(w, "\\\"", 2); break;
+            case '\\': jw_put(w, "\\\\", 2); break;
+            case '\n': jw_put(w, "\\n", 2); break;
+            case '\r': jw_put(w, "\\r", 2); break;
+            case '\t': jw_put(w, "\\t", 2); break;
+            default:
+                if (c < 0x20) {
+                    snprintf(esc, sizeof(esc), "\\u%04x", c);
+                    jw_put(w, esc, 6);
+                } else {
+                    jw_putc(w, (char)c);
+                }
+                break;
+        }
+    }
+    jw_putc(w, '"');
+}
+
+// Separator and key before a value
+static void jw_prefix(json_writer_t *w, const char *key)
+{
+    if (w->depth > 0) {
+        if (w->has_item[w->depth - 1]) {
+            jw_putc(w, ',');
+        }
+        w->has_item[w->depth - 1] = true;
+    }
+    if (key) {
+        jw_put_escaped(w, key);
+        jw_putc(w, ':');
+    }
+}
+
+static void jw_open(json_writer_t *w, const char *key, char c)
+{
+    jw_prefix(w, key);
+    if (w->depth >= JSON_MAX_DEPTH) {
+        w->error = true;
+        return;
+    }
+    jw_putc(w, c);
+    w->has_item[w->depth++] = false;
+}
+
+static void jw_close(json_writer_t *w, char c)
+{
+    if (w->depth == 0) {
+        w->error = true;
+        return;
+    }
+    w->depth--;
+    jw_putc(w, c);
+}
+
+/**
+ * @brief Start writing into buf. Nothing is allocated, buf must outlive the writer.
+ */
+void json_writer_init(json_writer_t *w, char *buf, size_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->error = (buf == NULL || size == 0);
+    w->depth = 0;
+}
+
+// key is NULL for the root value and for array items
+void json_object_begin(json_writer_t *w, const char *key) { jw_open(w, key, '{'); }
+void json_object_end(json_writer_t *w)                    { jw_close(w, '}'); }
+void json_array_begin(json_writer_t *w, const char *key)  { jw_open(w, key, '['); }
+void json_array_end(json_writer_t *w)                     { jw_close(w, ']'); }
+
+void json_add_string(json_writer_t *w, const char *key, const char *value)
+{
+    if (value == NULL) {
+        json_add_null(w, key);
+        return;
+    }
+    jw_prefix(w, key);
+    jw_put_escaped(w, value);
+}
+
+void json_add_int(json_writer_t *w, const char *key, int64_t value)
+{
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%lld", (long long)value);
+    jw_prefix(w, key);
+    jw_put(w, num, n);
+}
+
+void json_add_uint(json_writer_t *w, const char *key, uint64_t value)
+{
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%llu", (unsigned long long)value);
+    jw_prefix(w, key);
+    jw_put(w, num, n);
+}
+
+// NaN and infinity are not valid JSON and are written as null
+void json_add_double(json_writer_t *w, const char *key, double value)
+{
+    char num[32];
+    if (isnan(value) || isinf(value)) {
+        json_add_null(w, key);
+        return;
+    }
+    int n = snprintf(num, sizeof(num), "%.9g", value);
+    jw_prefix(w, key);
+    jw_put(w, num, n);
+}
+
+void json_add_bool(json_writer_t *w, const char *key, bool value)
+{
+    jw_prefix(w, key);
+    if (value) {
+        jw_put(w, "true", 4);
+    } else {
+        jw_put(w, "false", 5);
+    }
+}
+
+void json_add_null(json_writer_t *w, const char *key)
+{
+    jw_prefix(w, key);
+    jw_put(w, "null", 4);
+}
+
+/**
+ * @brief Terminate output with NUL.
+ * @return Length of JSON text, -1 if it did not fit or containers were left open.
+ */
+int json_writer_finish(json_writer_t *w)
+{
+    if (w->depth != 0) {
+        w->error = true;
+    }
+    if (w->size) {
+        w->buf[w->error ? 0 : w->len] = '\0';
+    }
+    return w->error ? -1 : (int)w->len;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Tokenizer                                                                  */
+/* ------------------------------------------------------------------------- */
+
+static int jt_alloc(json_token_t *tokens, int *count, int max_tokens, json_tok_type_t type,
+                    size_t start, int parent)
+{
+    if (*count >= max_tokens) {
+        return -1;
+    }
+    json_token_t *t = &tokens[*count];
+    t->type = type;
+    t->start = (uint16_t)start;
+    t->end = 0;
+    t->size = 0;
+    t->parent = (int16_t)parent;
+    return (*count)++;
+}
+
+/**
+ * @brief Split JSON text into tokens. Object members are a key string token followed by
+ *        its value, whose parent is the key.
+ * @return Number of tokens, -1 if there are more than max_tokens, -2 for invalid
+ *         and -3 for incomplete input.
+ */
+int json_tokenize(const char *json, size_t len, json_token_t *tokens, int max_tokens)
+{
+    int count = 0;
+    int cur = -1;               // Innermost open object or array
+    int key = -1;               // Key waiting for its value
+    bool expect_key = false;
+    size_t pos;
+
+    if (len > 0xFFFF) {
+        return -2;
+    }
+    for (pos = 0; pos < len && json[pos]; pos++) {
+        char c = json[pos];
+        int parent = key >= 0 ? key : cur;
+        int idx;
+
+        switch (c) {
+            case ' ': case '\t': case '\r': case '\n': case ',':
+                if (c == ',' && cur >= 0 && tokens[cur].type == JSON_TOK_OBJECT) {
+                    expect_key = true;
+                }
+                break;
+
+            case ':':
+                if (count == 0 || tokens[count - 1].type != JSON_TOK_STRING || cur < 0 ||
+                    tokens[cur].type != JSON_TOK_OBJECT) {
+                    return -2;
+                }
+                key = count - 1;
+                break;
+
+            case '{': case '[':
+                if (expect_key || (cur >= 0 && tokens[cur].type == JSON_TOK_OBJECT && key < 0)) {
+                    return -2;
+                }
+                idx = jt_alloc(tokens, &count, max_tokens, c == '{' ? JSON_TOK_OBJECT : JSON_TOK_ARRAY, pos, parent);
+                if (idx < 0) {
+                    return -1;
+                }
+                if (key >= 0) {
+                    tokens[key].size = 1;
+                } else if (cur >= 0) {
+                    tokens[cur].size++;
+                }
+                key = -1;
+                cur = idx;
+                expect_key = (c == '{');
+                break;
+
+            case '}': case ']':
+                if (cur < 0 || key >= 0 || tokens[cur].type != (c == '}' ? JSON_TOK_OBJECT : JSON_TOK_ARRAY)) {
+                    return -2;
+                }
+                tokens[cur].end = (uint16_t)(pos + 1);
+                cur = tokens[cur].parent;
+                if (cur >= 0 && tokens[cur].type == JSON_TOK_STRING) {
+                    cur = tokens[cur].parent;     // Value of a key, go up to the object
+                }
+                expect_key = false;
+                break;
+
+            case '"': {
+                size_t start = ++pos;
+                for (; pos < len && json[pos] != '"'; pos++) {
+                    if (json[pos] == '\\') {
+                        pos++;
+                    }
+                }
+                if (pos >= len) {
+                    return -3;
+                }
+                if (cur >= 0 && tokens[cur].type == JSON_TOK_OBJECT && key < 0 && !expect_key) {
+                    return -2;
+                }
+                idx = jt_alloc(tokens, &count, max_tokens, JSON_TOK_STRING, start, expect_key ? cur : parent);
+                if (idx < 0) {
+                    return -1;
+                }
+                tokens[idx].end = (uint16_t)pos;
+                if (expect_key || key < 0) {
+                    if (cur >= 0) {
+                        tokens[cur].size++;
+                    }
+                } else {
+                    tokens[key].size = 1;
+                }
+                if (!expect_key) {
+                    key = -1;
+                }
+                expect_key = false;
+                break;
+            }
+
+            default: {
+                size_t start = pos;
+                if (!strchr("-0123456789tfn", c) || expect_key ||
+                    (cur >= 0 && tokens[cur].type == JSON_TOK_OBJECT && key < 0)) {
+                    return -2;
+                }
+                while (pos < len && json[pos] && !strchr(" \t\r\n,]}", json[pos])) {
+                    pos++;
+                }
+                idx = jt_alloc(tokens, &count, max_tokens, JSON_TOK_PRIMITIVE, start, parent);
+                if (idx < 0) {
+                    return -1;
+                }
+                tokens[idx].end = (uint16_t)pos;
+                if (key >= 0) {
+                    tokens[key].size = 1;
+                } else if (cur >= 0) {
+                    tokens[cur].size++;
+                }
+                key = -1;
+                pos--;      // Let the loop see the delimiter
+                break;
+            }
+        }
+    }
+    if (cur >= 0 || key >= 0) {
+        return -3;
+    }
+    return count;
+}
+
+bool json_token_equals(const char *json, const json_token_t *tok, const char *str)
+{
+    size_t n = tok->end - tok->start;
+    return strlen(str) == n && strncmp(json + tok->start, str, n) == 0;
+}
+
+/**
+ * @brief Find member of an object.
+ * @return Index of the value token, -1 if the key is missing.
+ */
+int json_object_get(const char *json, const json_token_t *tokens, int count, int object, const char *key)
+{
+    if (object < 0 || object >= count || tokens[object].type != JSON_TOK_OBJECT) {
+        return -1;
+    }
+    for (int i = object + 1; i + 1 < count && tokens[i].start < tokens[object].end; i++) {
+        if (tokens[i].parent == object && tokens[i].type == JSON_TOK_STRING &&
+            json_token_equals(json, &tokens[i], key)) {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Copy string token to out and decode escapes. \\u escapes outside ASCII become '?'.
+ * @return String length, -1 if token is not a string or out is too small.
+ */
+int json_token_string(const char *json, const json_token_t *tok, char *out, size_t out_size)
+{
+    size_t n = 0;
+
+    if (tok->type != JSON_TOK_STRING || out_size == 0) {
+        return -1;
+    }
+    for (size_t i = tok->start; i < tok->end; i++) {
+        char c = json[i];
+        if (c == '\\' && i + 1 < tok->end) {
+            c = json[++i];
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u':
+                    if (i + 4 < tok->end) {
+                        char hex[5];
+                        memcpy(hex, json + i + 1, 4);
+                        hex[4] = '\0';
+                        long u = strtol(hex, NULL, 16);
+                        c = u < 0x80 ? (char)u : '?';
+                        i += 4;
+                    }
+                    break;
+                default: break;     // '"', '\\' and '/' stand for themselves
+            }
+        }
+        if (n + 1 >= out_size) {
+            out[0] = '\0';
+            return -1;
+        }
+        out[n++] = c;
+    }
+    out[n] = '\0';
+    return (int)n;
+}
+
+bool json_token_int(const char *json, const json_token_t *tok, int64_t *value)
+{
+    char num[24];
+    char *end;
+    size_t n = tok->end - tok->start;
+
+    if (tok->type != JSON_TOK_PRIMITIVE || n == 0 || n >= sizeof(num)) {
+        return false;
+    }
+    memcpy(num, json + tok->start, n);
+    num[n] = '\0';
+    *value = strtoll(num, &end, 10);
+    return *end == '\0';
+}
+
+bool json_token_double(const char *json, const json_token_t *tok, double *value)
+{
+    char num[32];
+    char *end;
+    size_t n = tok->end - tok->start;
+
+    if (tok->type != JSON_TOK_PRIMITIVE || n == 0 || n >= sizeof(num)) {
+        return false;
+    }
+    memcpy(num, json + tok->start, n);
+    num[n] = '\0';
+    *value = strtod(num, &end);
+    return *end == '\0';
+}
@@ -0,0 +1,345 @@
+/*
+Measurement job scheduler
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "meas_scheduler.h"
+#include "AppMain.h"
+
+static const char *TAG = "MEAS_SCHED";
+
+// Measurement loop of each board, see AppMain.h
+typedef struct {
+    void (*boot)(void);
+    AD5940Err (*start)(const SoftSweepCfg_Type *sweep, uint32_t count);
+    int32_t (*poll)(void);
+    void (*stop)(BoolFlag now);
+} meas_runner_t;
+
+static const meas_runner_t s_runners[] = {
+    [BOARD_AD5940] = { AD5940_ImpBoot, AD5940_ImpStart, AD5940_ImpPoll, AD5940_ImpStop },
+    [BOARD_AD5941] = { AD5941_BatBoot, AD5941_BatStart, AD5941_BatPoll, AD5941_BatStop },
+};
+#define MEAS_BOARD_COUNT (sizeof(s_runners) / sizeof(s_runners[0]))
+
+static SemaphoreHandle_t s_lock;
+static SemaphoreHandle_t s_wake;                // Given when a job is submitted or stopped
+// One spare entry so a preempted job always fits back in
+static meas_job_t s_queue[MEAS_SCHED_MAX_JOBS + 1];
+static uint32_t s_count;
+static uint32_t s_order;
+static meas_job_t s_current;
+static bool s_running;
+static bool s_stop_req;                         // Stop running job for good
+static bool s_preempt_req;                      // Stop running job and queue it again
+static meas_progress_cb_t s_cb;
+static void *s_cb_user;
+// Both ports drive the same SPI bus and pins, so queued and running jobs share one board.
+// Cleared when the queue drains, so the board can be swapped between jobs.
+static int s_hw_board = -1;
+static int s_booted_board = -1;                 // Board the AFE was last set up for
+
+static uint32_t sched_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void sched_report(const meas_job_t *job)
+{
+    if (s_cb) {
+        s_cb(job, s_cb_user);
+    }
+}
+
+// Highest priority first, then submission order. Caller holds the lock.
+static int sched_pick_locked(void)
+{
+    int best = -1;
+
+    for (uint32_t i = 0; i < s_count; i++) {
+        if (best < 0 || s_queue[i].priority > s_queue[best].priority ||
+            (s_queue[i].priority == s_queue[best].priority && s_queue[i].order < s_queue[best].order)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void sched_remove_locked(uint32_t index, meas_job_t *job)
+{
+    *job = s_queue[index];
+    memmove(&s_queue[index], &s_queue[index + 1], (s_count - index - 1) * sizeof(meas_job_t));
+    s_count--;
+}
+
+/**
+ * @brief Initialize scheduler. Call before any other function.
+ * @param cb: Progress callback, can be NULL.
+ */
+void meas_sched_init(meas_progress_cb_t cb, void *user)
+{
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutex();
+        s_wake = xSemaphoreCreateBinary();
+    }
+    s_cb = cb;
+    s_cb_user = user;
+}
+
+/**
+ * @brief Queue a job. Only board, default_sweep, sweep, repeat, priority and id are used.
+ * @return ESP_ERR_INVALID_ARG for a bad sweep, ESP_ERR_NO_MEM if the queue is full,
+ *         ESP_ERR_NOT_SUPPORTED for a board other than the one of queued or running jobs.
+ */
+esp_err_t meas_sched_submit(const meas_job_t *job)
+{
+    esp_err_t err = ESP_OK;
+
+    if ((uint32_t)job->board >= MEAS_BOARD_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!job->default_sweep) {
+        const SoftSweepCfg_Type *sw = &job->sweep;
+        if (sw->SweepStart <= 0 || (sw->SweepEn && (sw->SweepStop <= 0 || sw->SweepPoints < 2))) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_count >= MEAS_SCHED_MAX_JOBS) {
+        err = ESP_ERR_NO_MEM;
+    } else if (s_hw_board >= 0 && (int)job->board != s_hw_board) {
+        err = ESP_ERR_NOT_SUPPORTED;
+    } else {
+        s_hw_board = job->board;
+        meas_job_t *q = &s_queue[s_count++];
+        *q = *job;
+        q->state = MEAS_JOB_QUEUED;
+        q->sweeps_done = 0;
+        q->points_done = 0;
+        q->order = s_order++;
+        if (s_running && q->priority > s_current.priority) {
+            s_preempt_req = true;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    if (err == ESP_OK) {
+        xSemaphoreGive(s_wake);
+    }
+    return err;
+}
+
+/**
+ * @brief Stop a job. A running job stops after its current point, a queued one is removed.
+ * @param id: Job to stop, NULL or "" stops the running job and clears the queue.
+ * @return ESP_ERR_NOT_FOUND if no job matched.
+ */
+esp_err_t meas_sched_stop(const char *id)
+{
+    bool all = (id == NULL || id[0] == 0);
+    bool found = false;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_running && (all || strcmp(s_current.id, id) == 0)) {
+        s_stop_req = true;
+        found = true;
+    }
+    // Removed by scheduler task, so the progress callback reports it
+    for (uint32_t i = 0; i < s_count; i++) {
+        if (all || strcmp(s_queue[i].id, id) == 0) {
+            s_queue[i].state = MEAS_JOB_STOPPED;
+            found = true;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_wake);
+    return found ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+uint32_t meas_sched_queued(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint32_t count = s_count;
+    xSemaphoreGive(s_lock);
+    return count;
+}
+
+/**
+ * @brief Copy of running job.
+ * @return false if no job is running.
+ */
+bool meas_sched_current(meas_job_t *job)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool running = s_running;
+    if (running) {
+        *job = s_current;
+    }
+    xSemaphoreGive(s_lock);
+    return running;
+}
+
+/**
+ * @brief Check before switching boards. The scheduler calls board_select itself before each job.
+ * @return true if jobs of another board are queued or running.
+ */
+bool meas_sched_board_busy(board_type_t board)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool busy = s_hw_board >= 0 && s_hw_board != (int)board;
+    xSemaphoreGive(s_lock);
+    return busy;
+}
+
+// Take next job from queue and start it. Returns false if there is nothing to run.
+static bool sched_start_next(void)
+{
+    meas_job_t job;
+    int index;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    // Report stopped jobs first
+    for (uint32_t i = 0; i < s_count; i++) {
+        if (s_queue[i].state == MEAS_JOB_STOPPED) {
+            sched_remove_locked(i, &job);
+            xSemaphoreGive(s_lock);
+            sched_report(&job);
+            return true;
+        }
+    }
+    index = sched_pick_locked();
+    if (index < 0) {
+        s_hw_board = -1;                // Idle, next job may use another board
+        xSemaphoreGive(s_lock);
+        return false;
+    }
+    sched_remove_locked(index, &job);
+    xSemaphoreGive(s_lock);
+
+    board_select(job.board);
+    if (s_booted_board != (int)job.board) {
+        // Set up again after the other board was used, the AFE may have been swapped
+        AD5940_MCUResourceInit(NULL);
+        s_runners[job.board].boot();
+        s_booted_board = job.board;
+    }
+
+    uint32_t remaining = job.repeat ? job.repeat - job.sweeps_done : 0;
+    job.points_done = 0;
+    if (s_runners[job.board].start(job.default_sweep ? NULL : &job.sweep, remaining) != AD5940ERR_OK) {
+        ESP_LOGE(TAG, "Job %s: start failed", job.id);
+        job.state = MEAS_JOB_FAILED;
+        sched_report(&job);
+        return true;
+    }
+    job.state = MEAS_JOB_RUNNING;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_current = job;
+    s_running = true;
+    s_stop_req = false;
+    // A job of higher priority may have arrived while this one was starting
+    index = sched_pick_locked();
+    s_preempt_req = index >= 0 && s_queue[index].priority > job.priority;
+    xSemaphoreGive(s_lock);
+    ESP_LOGI(TAG, "Job %s: running, %lu of %lu sweeps done", job.id,
+             (unsigned long)job.sweeps_done, (unsigned long)job.repeat);
+    sched_report(&job);
+    return true;
+}
+
+// Running job ended. Caller does not hold the lock.
+static void sched_finish(meas_job_state_t state)
+{
+    meas_job_t job;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    job = s_current;
+    job.state = state;
+    s_running = false;
+    if (state == MEAS_JOB_PREEMPTED) {
+        meas_job_t *q = &s_queue[s_count++];
+        *q = job;
+        q->state = MEAS_JOB_QUEUED;     // Keeps its order, so it resumes before newer jobs
+        q->points_done = 0;
+    }
+    xSemaphoreGive(s_lock);
+    ESP_LOGI(TAG, "Job %s: state %d after %lu sweeps", job.id, state, (unsigned long)job.sweeps_done);
+    sched_report(&job);
+}
+
+/**
+ * @brief Scheduler loop, body of the measurement task. Never returns.
+ */
+void meas_sched_run(void)
+{
+    uint32_t stop_ms = 0;
+    bool stop_issued = false;
+
+    while (1) {
+        if (!s_running) {
+            stop_issued = false;
+            if (!sched_start_next()) {
+                xSemaphoreTake(s_wake, portMAX_DELAY);
+            }
+            continue;
+        }
+
+        const meas_runner_t *runner = &s_runners[s_current.board];
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        bool stop = s_stop_req;
+        bool preempt = s_preempt_req;
+        xSemaphoreGive(s_lock);
+
+        int32_t result;
+        if ((stop || preempt) && !stop_issued) {
+            runner->stop(bFALSE);       // STOPSYNC, current point completes
+            stop_issued = true;
+            stop_ms = sched_now_ms();
+        }
+        if (stop_issued && sched_now_ms() - stop_ms > MEAS_STOP_TIMEOUT_MS) {
+            ESP_LOGW(TAG, "Job %s: no interrupt after stop request, stopping now", s_current.id);
+            runner->stop(bTRUE);
+            result = APPPOLL_STOPPED;
+        } else {
+            result = runner->poll();
+        }
+
+        switch (result) {
+            case APPPOLL_IDLE:
+                vTaskDelay(1);
+                break;
+            case APPPOLL_DATA:
+                xSemaphoreTake(s_lock, portMAX_DELAY);
+                s_current.points_done++;
+                xSemaphoreGive(s_lock);
+                break;
+            case APPPOLL_SWEEPEND: {
+                xSemaphoreTake(s_lock, portMAX_DELAY);
+                s_current.sweeps_done++;
+                s_current.points_done = 0;
+                meas_job_t job = s_current;
+                xSemaphoreGive(s_lock);
+                sched_report(&job);
+                break;
+            }
+            case APPPOLL_DONE:
+                xSemaphoreTake(s_lock, portMAX_DELAY);
+                s_current.sweeps_done++;
+                s_current.points_done = 0;
+                xSemaphoreGive(s_lock);
+                sched_finish(MEAS_JOB_DONE);
+                break;
+            case APPPOLL_STOPPED:
+                sched_finish(stop ? MEAS_JOB_STOPPED : MEAS_JOB_PREEMPTED);
+                break;
+            default:
+                ESP_LOGE(TAG, "Job %s: measurement error", s_current.id);
+                sched_finish(MEAS_JOB_FAILED);
+                break;
+        }
+    }
+}
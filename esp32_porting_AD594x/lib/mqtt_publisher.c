@@ -0,0 +1,323 @@
+/*
+Batched MQTT publisher for measurement data
+*/
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt_publisher.h"
+#include "ResultStream.h"
+
+static const char *TAG = "MQTT_PUB";
+
+// One lock for all publishers and the shared store-and-forward log
+static SemaphoreHandle_t s_lock;
+static mqtt_publisher_t *s_publishers[MQTT_PUB_MAX_PUBLISHERS];
+static uint32_t s_publisher_count;
+static StoreFwd_Type *s_store;
+static QueueHandle_t s_ack_queue;       // msg_id of PUBACKs, from the MQTT event handler to mqtt_pub_poll
+static volatile bool s_online;
+static volatile uint32_t s_offline_count;   // Disconnects so far, each publisher spills once per disconnect
+
+static uint32_t pub_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static mqtt_pub_inflight_t *pub_free_slot(mqtt_publisher_t *pub)
+{
+    for (int i = 0; i < MQTT_DATA_MAX_INFLIGHT; i++) {
+        if (pub->inflight[i].msg_id == 0) {
+            return &pub->inflight[i];
+        }
+    }
+    return NULL;
+}
+
+// Sequence numbers of first and last result stream frame in a payload
+static void pub_seq_range(const uint8_t *data, uint32_t len, uint16_t *first, uint16_t *last)
+{
+    uint32_t off = 0;
+
+    *first = *last = (uint16_t)(data[4] | (data[5] << 8));
+    while (off + RSTREAM_HEADER_LEN <= len) {
+        *last = (uint16_t)(data[off + 4] | (data[off + 5] << 8));
+        off += RSTREAM_HEADER_LEN + (data[off + 6] | (data[off + 7] << 8)) + RSTREAM_CRC_LEN;
+    }
+}
+
+// Online with a free in-flight slot. Caller holds the lock.
+static bool pub_ready_locked(mqtt_publisher_t *pub)
+{
+    return s_online && (pub->qos == 0 || pub_free_slot(pub) != NULL);
+}
+
+// Hand one payload to the MQTT client. Caller holds the lock.
+static bool pub_publish_locked(mqtt_publisher_t *pub, const uint8_t *data, uint32_t len)
+{
+    mqtt_pub_inflight_t *slot = NULL;
+
+    if (!pub_ready_locked(pub)) {
+        return false;       // Offline, or wait for broker to catch up
+    }
+    if (pub->qos > 0) {
+        slot = pub_free_slot(pub);
+    }
+    int msg_id = esp_mqtt_client_publish(pub->client, pub->topic, (const char *)data, len, pub->qos, false);
+    if (msg_id < 0) {
+        pub->stats.publish_errors++;
+        return false;
+    }
+    if (slot && msg_id > 0) {
+        slot->msg_id = msg_id;
+        pub_seq_range(data, len, &slot->first_seq, &slot->last_seq);
+        slot->sent_ms = pub_now_ms();
+    }
+    pub->stats.messages++;
+    pub->stats.bytes += len;
+    return true;
+}
+
+// Publish buffered payload. Returns false if data is still buffered.
+static bool pub_send_locked(mqtt_publisher_t *pub)
+{
+    if (pub->len == 0) {
+        return true;
+    }
+    if (s_store && !StoreFwdEmpty(s_store)) {
+        return false;   // Stored data goes first
+    }
+    if (!pub_publish_locked(pub, pub->payload, pub->len)) {
+        return false;
+    }
+    pub->stats.frames += pub->frame_count;
+    pub->len = 0;
+    pub->frame_count = 0;
+    return true;
+}
+
+// Move buffered payload to the log. Returns false if there is no log or it failed.
+static bool pub_spill_locked(mqtt_publisher_t *pub)
+{
+    if (pub->len == 0) {
+        return true;
+    }
+    if (s_store == NULL || StoreFwdAppend(s_store, pub->stream, pub->payload, pub->len) != AD5940ERR_OK) {
+        return false;
+    }
+    pub->stats.stored++;
+    pub->len = 0;
+    pub->frame_count = 0;
+    return true;
+}
+
+// Publish now, or keep in log if that is not possible while offline or behind stored data
+static void pub_flush_locked(mqtt_publisher_t *pub)
+{
+    if (!pub_send_locked(pub) && s_store && (!s_online || !StoreFwdEmpty(s_store))) {
+        pub_spill_locked(pub);
+    }
+}
+
+/**
+ * @brief Initialize publisher for one data topic.
+ * @param qos: 0 publishes without tracking, 1 keeps messages in-flight until PUBACK.
+ */
+void mqtt_pub_init(mqtt_publisher_t *pub, esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutex();
+        s_ack_queue = xQueueCreate(MQTT_PUB_MAX_PUBLISHERS * MQTT_DATA_MAX_INFLIGHT, sizeof(int));
+    }
+    memset(pub, 0, sizeof(*pub));
+    pub->client = client;
+    pub->topic = topic;
+    pub->qos = qos;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_publisher_count < MQTT_PUB_MAX_PUBLISHERS) {
+        pub->stream = s_publisher_count;
+        s_publishers[s_publisher_count++] = pub;
+    } else {
+        ESP_LOGE(TAG, "%s: no stream ID left, data will not be stored offline", topic);
+        pub->stream = MQTT_PUB_MAX_PUBLISHERS;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+/**
+ * @brief Queue one complete result stream frame.
+ */
+void mqtt_pub_write(mqtt_publisher_t *pub, const uint8_t *frame, uint32_t len)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (len < RSTREAM_HEADER_LEN || len > MQTT_MAX_PAYLOAD_SIZE) {
+        pub->stats.dropped_frames++;
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    if (pub->len + len > MQTT_MAX_PAYLOAD_SIZE && !pub_send_locked(pub) && !pub_spill_locked(pub)) {
+        // Cannot send and no room left: drop oldest batch, newest data is more useful
+        ESP_LOGW(TAG, "%s: dropping %lu frames", pub->topic, (unsigned long)pub->frame_count);
+        pub->stats.dropped_frames += pub->frame_count;
+        pub->len = 0;
+        pub->frame_count = 0;
+    }
+    uint16_t seq = (uint16_t)(frame[4] | (frame[5] << 8));
+    if (pub->frame_count == 0) {
+        pub->first_seq = seq;
+        pub->first_ms = pub_now_ms();
+    }
+    pub->last_seq = seq;
+    memcpy(pub->payload + pub->len, frame, len);
+    pub->len += len;
+    pub->frame_count++;
+    if (MQTT_DATA_PUBLISH_IMMEDIATE || (frame[3] & RSTREAM_FLAG_SWEEPEND)) {
+        pub_flush_locked(pub);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+/**
+ * @brief Publish buffered frames now.
+ */
+void mqtt_pub_flush(mqtt_publisher_t *pub)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    pub_flush_locked(pub);
+    xSemaphoreGive(s_lock);
+}
+
+// Free in-flight slots of queued acknowledgements, whichever publisher they belong to
+static void pub_take_acks_locked(void)
+{
+    int msg_id;
+
+    while (xQueueReceive(s_ack_queue, &msg_id, 0) == pdTRUE) {
+        bool found = false;
+        for (uint32_t p = 0; p < s_publisher_count && !found; p++) {
+            mqtt_publisher_t *pub = s_publishers[p];
+            for (int i = 0; i < MQTT_DATA_MAX_INFLIGHT; i++) {
+                if (pub->inflight[i].msg_id == msg_id) {
+                    pub->inflight[i].msg_id = 0;
+                    pub->stats.acked++;
+                    found = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Call periodically. Takes queued acknowledgements, publishes data older than
+ *        MQTT_DATA_BATCH_TIMEOUT_MS, retries batches held back by a full in-flight table
+ *        and expires lost acknowledgements.
+ */
+void mqtt_pub_poll(mqtt_publisher_t *pub)
+{
+    uint32_t now = pub_now_ms();
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    pub_take_acks_locked();
+    for (int i = 0; i < MQTT_DATA_MAX_INFLIGHT; i++) {
+        if (pub->inflight[i].msg_id && now - pub->inflight[i].sent_ms > MQTT_DATA_ACK_TIMEOUT_MS) {
+            ESP_LOGW(TAG, "%s: no PUBACK for msg_id=%d (seq %u-%u)", pub->topic, pub->inflight[i].msg_id,
+                     pub->inflight[i].first_seq, pub->inflight[i].last_seq);
+            pub->inflight[i].msg_id = 0;
+            pub->stats.ack_timeouts++;
+        }
+    }
+    if (pub->offline_seen != s_offline_count) {
+        pub->offline_seen = s_offline_count;
+        if (!s_online) {
+            pub_spill_locked(pub);      // Disconnected: keep what is buffered in the log
+        }
+    }
+    if (pub->len && now - pub->first_ms >= MQTT_DATA_BATCH_TIMEOUT_MS) {
+        pub_flush_locked(pub);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+/**
+ * @brief Call from MQTT_EVENT_PUBLISHED. Never blocks and takes no lock: the event handler runs
+ *        in the MQTT task holding the client's lock, which a publishing task may be waiting for.
+ *        If the queue is full the message is counted as an ack timeout later.
+ */
+void mqtt_pub_on_ack(int msg_id)
+{
+    if (s_ack_queue) {
+        xQueueSend(s_ack_queue, &msg_id, 0);
+    }
+}
+
+void mqtt_pub_get_stats(mqtt_publisher_t *pub, mqtt_pub_stats_t *stats)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = pub->stats;
+    xSemaphoreGive(s_lock);
+}
+
+/**
+ * @brief Attach store-and-forward log shared by all publishers. NULL drops data while offline.
+ */
+void mqtt_pub_set_store(StoreFwd_Type *store)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_store = store;
+    xSemaphoreGive(s_lock);
+}
+
+/**
+ * @brief Call on MQTT connect and disconnect, from the MQTT event handler. Only sets flags, the
+ *        next mqtt_pub_poll of each publisher moves its pending batch to the log.
+ */
+void mqtt_pub_set_online(bool online)
+{
+    s_online = online;
+    if (!online) {
+        s_offline_count++;
+    }
+}
+
+static BoolFlag pub_replay_one(void *user, uint32_t stream, uint32_t seq, const uint8_t *data, uint32_t len)
+{
+    (void)user;
+    (void)seq;
+    if (stream >= s_publisher_count) {
+        return bTRUE;       // Publisher no longer exists, discard
+    }
+    mqtt_publisher_t *pub = s_publishers[stream];
+    if (!pub_publish_locked(pub, data, len)) {
+        return bFALSE;
+    }
+    pub->stats.replayed++;
+    return bTRUE;
+}
+
+/**
+ * @brief Publish up to max_payloads stored payloads in the order they were stored.
+ *        Call periodically, max_payloads sets the replay rate.
+ * @return Number of payloads published.
+ */
+uint32_t mqtt_pub_replay(uint32_t max_payloads)
+{
+    uint32_t count = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_store && s_online && !StoreFwdEmpty(s_store)) {
+        uint32_t stream;
+        // An entry handed to StoreFwdReplay counts as sent after a reset, so only replay what can go out now
+        while (count < max_payloads && StoreFwdPeek(s_store, &stream) == AD5940ERR_OK &&
+               (stream >= s_publisher_count || pub_ready_locked(s_publishers[stream])) &&
+               StoreFwdReplay(s_store, pub_replay_one, NULL, 1) == 1) {
+            count++;
+        }
+        if (StoreFwdEmpty(s_store)) {
+            ESP_LOGI(TAG, "Stored data replayed (%lu stored, %lu dropped)",
+                     (unsigned long)s_store->Stored, (unsigned long)s_store->Dropped);
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return count;
+}
@@ -23,6 +23,7 @@ This software is proprietary to Analog Devices, Inc. and its licensors.
 // AD5940 includes
 #include "ad5940.h"
 #include "board_config.h"
+#include "meas_scheduler.h"
 
 static const char *TAG = "DUAL_BOARD_MAIN";
 
@@ -98,23 +99,18 @@ void ad5941_battery_task(void *pvParameters)
     vTaskDelete(NULL);
 }
 
-// Production-ready measurement task that can switch between boards
+// Production measurement task: runs queued measurement jobs back to back.
+// Jobs come from meas_sched_submit(), e.g. from MQTT commands (see test/main.c).
 void measurement_task(void *pvParameters)
 {
     ESP_LOGI(TAG, "=== Production Measurement Task Ready ===");
-    ESP_LOGI(TAG, "Waiting for board selection and start commands from server/MATLAB...");
-    
-    // In production, this task would:
-    // 1. Wait for MQTT/server commands to select board
-    // 2. Call board_select(BOARD_AD5940) or board_select(BOARD_AD5941) 
-    // 3. Initialize and run the appropriate measurement function
-    // 4. Stream data back via MQTT/server
-    
-    // For now, just keep the task alive and ready
-    while (1) {
-        ESP_LOGI(TAG, "Measurement system ready - awaiting server integration");
-        vTaskDelay(pdMS_TO_TICKS(10000)); // 10 second heartbeat
-    }
+    meas_sched_run();
+}
+
+static void measurement_progress(const meas_job_t *job, void *user)
+{
+    ESP_LOGI(TAG, "Job %s on %s: state %d, %lu sweeps done", job->id,
+             job->board == BOARD_AD5940 ? "AD5940" : "AD5941", job->state, (unsigned long)job->sweeps_done);
 }
 
 // Main ESP-IDF application entry point
@@ -142,6 +138,7 @@ void app_main(void)
     ESP_LOGI(TAG, "========================================");
     
     // Create production measurement task (ready for server integration)
+    meas_sched_init(measurement_progress, NULL);
     BaseType_t task_created = xTaskCreate(
         measurement_task,         // Task function
         "measurement_task",       // Task name
@@ -158,7 +155,16 @@ void app_main(void)
     
     ESP_LOGI(TAG, "Production measurement task created - both AD5940 and AD5941 functionality available");
     
-    // For individual board testing during development, uncomment one of these:
+    // Without a server, measure the AD5941 battery board with its default sweep until reset
+    meas_job_t job = {
+        .id = "default",
+        .board = BOARD_AD5941,
+        .default_sweep = true,
+        .repeat = 0,
+    };
+    meas_sched_submit(&job);
+    
+    // For individual board testing during development, remove the job above and uncomment one of these:
     // xTaskCreate(ad5940_impedance_task, "ad5940_task", 8192, NULL, 5, NULL);  // AD5940 only
-    xTaskCreate(ad5941_battery_task, "ad5941_task", 8192, NULL, 5, NULL);    // AD5941 only
+    // xTaskCreate(ad5941_battery_task, "ad5941_task", 8192, NULL, 5, NULL);    // AD5941 only
 }
\ No newline at end of file
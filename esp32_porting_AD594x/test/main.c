@@ -11,11 +11,13 @@ This software is proprietary to Analog Devices, Inc. and its licensors.
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "nvs_flash.h"
@@ -28,9 +30,12 @@ This software is proprietary to Analog Devices, Inc. and its licensors.
 #include "ad5940.h"
 #include "board_config.h"
 #include "mqtt_config.h"
+#include "mqtt_publisher.h"
+#include "meas_scheduler.h"
+#include "TimeSync.h"
 
-// JSON library for message formatting
-#include "cJSON.h"
+// Allocation-free JSON formatting and command parsing
+#include "json_writer.h"
 
 static const char *TAG = "MQTT_TEST";
 
@@ -42,6 +47,13 @@ extern void AD5941_Main(void);  // From AD5941Main.c (BATImpedance.c functionali
 static mqtt_config_t g_mqtt_config;
 static esp_mqtt_client_handle_t g_mqtt_client = NULL;
 
+// Measurement data publishers, one per data topic
+static mqtt_publisher_t g_pub_ad5940;
+static mqtt_publisher_t g_pub_ad5941;
+
+// Flash log keeping measurement data while MQTT is disconnected
+static StoreFwd_Type g_store;
+
 // WiFi event group
 static EventGroupHandle_t s_wifi_event_group;
 #define WIFI_CONNECTED_BIT BIT0
@@ -50,8 +62,12 @@ static EventGroupHandle_t s_wifi_event_group;
 // Current board state
 static board_type_t g_current_board = BOARD_AD5940;
 static bool g_board_selected = false;
-static bool g_measurement_active = false;
-static char g_measurement_id[32] = {0};
+
+// JSON output buffers. Responses are built in the MQTT event task, heartbeats and
+// job progress in their own tasks.
+static char g_resp_json[MQTT_JSON_BUFFER_SIZE];
+static char g_heartbeat_json[MQTT_JSON_BUFFER_SIZE];
+static char g_progress_json[MQTT_JSON_BUFFER_SIZE];
 
 // ESP32 specific initialization
 uint32_t MCUPlatformInit(void *pCfg)
@@ -116,118 +132,344 @@ static void wifi_init(void)
     ESP_LOGI(TAG, "WiFi init finished");
 }
 
-// Create JSON message for board selection response
-static char* create_board_selection_response(const char* status, const char* board, const char* message, const char* request_id)
+// Result stream output of each board goes to its data topic.
+// Build the Main files with APP_RESULT_BINARY=1 so results are sent as frames.
+static void stream_write_ad5940(const uint8_t *pData, uint32_t Len)
+{
+    mqtt_pub_write(&g_pub_ad5940, pData, Len);
+}
+
+static void stream_write_ad5941(const uint8_t *pData, uint32_t Len)
+{
+    mqtt_pub_write(&g_pub_ad5941, pData, Len);
+}
+
+// Publishes batches that waited too long and expires lost acknowledgements
+static void publish_task(void *pvParameters)
+{
+    while (1) {
+        mqtt_pub_poll(&g_pub_ad5940);
+        mqtt_pub_poll(&g_pub_ad5941);
+        mqtt_pub_replay(MQTT_STORE_REPLAY_PER_POLL);
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+// Add host clock time once time sync has a clock model, and device time for reference
+static void json_add_timestamp(json_writer_t *w)
 {
-    cJSON *json = cJSON_CreateObject();
-    cJSON *device_info = cJSON_CreateObject();
+    uint64_t dev_us = esp_timer_get_time();
+    int64_t host_us;
     
-    cJSON_AddStringToObject(json, "status", status);
-    cJSON_AddStringToObject(json, "selected_board", board);
-    cJSON_AddStringToObject(json, "message", message);
-    cJSON_AddStringToObject(json, "timestamp", "2024-01-01T00:00:00Z"); // TODO: Add real timestamp
+    if (TSyncToHost(&AppTimeSync, dev_us, &host_us) == bTRUE && host_us >= 0) {
+        char ts[32];
+        struct tm tm;
+        time_t sec = (time_t)(host_us / 1000000);
+        gmtime_r(&sec, &tm);
+        size_t n = strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+        snprintf(ts + n, sizeof(ts) - n, ".%06ldZ", (long)(host_us % 1000000));
+        json_add_string(w, "timestamp", ts);
+    } else {
+        json_add_null(w, "timestamp");      // Not synced, see cmd/time_sync
+    }
+    json_add_uint(w, "device_time_us", dev_us);
+}
+
+// Create JSON message for board selection response in g_resp_json. Returns length, -1 if it does not fit.
+static int create_board_selection_response(const char* status, const char* board, const char* message, const char* request_id)
+{
+    json_writer_t w;
+    json_writer_init(&w, g_resp_json, sizeof(g_resp_json));
+    
+    json_object_begin(&w, NULL);
+    json_add_string(&w, "status", status);
+    json_add_string(&w, "selected_board", board);
+    json_add_string(&w, "message", message);
+    json_add_timestamp(&w);
     
     if (request_id) {
-        cJSON_AddStringToObject(json, "request_id", request_id);
+        json_add_string(&w, "request_id", request_id);
     }
     
-    cJSON_AddStringToObject(device_info, "device_id", g_mqtt_config.device_info.device_id);
-    cJSON_AddStringToObject(device_info, "board_type", board);
-    cJSON_AddStringToObject(device_info, "firmware_version", g_mqtt_config.device_info.firmware_version);
-    cJSON_AddItemToObject(json, "device_info", device_info);
-    
-    char *json_string = cJSON_Print(json);
-    cJSON_Delete(json);
+    json_object_begin(&w, "device_info");
+    json_add_string(&w, "device_id", g_mqtt_config.device_info.device_id);
+    json_add_string(&w, "board_type", board);
+    json_add_string(&w, "firmware_version", g_mqtt_config.device_info.firmware_version);
+    json_object_end(&w);
+    json_object_end(&w);
     
-    return json_string;
+    return json_writer_finish(&w);
+}
+
+static void publish_board_selection_response(const char* status, const char* board, const char* message, const char* request_id)
+{
+    int len = create_board_selection_response(status, board, message, request_id);
+    if (len < 0) {
+        ESP_LOGE(TAG, "Board selection response exceeds %d bytes", MQTT_JSON_BUFFER_SIZE);
+        return;
+    }
+    esp_mqtt_client_publish(g_mqtt_client, g_mqtt_config.topics.resp_board_select, g_resp_json, len, MQTT_QOS_LEVEL, false);
 }
 
 // Process board selection command
-static void process_board_selection_command(cJSON *json)
+static void process_board_selection_command(const char *json, const json_token_t *tokens, int count)
 {
-    cJSON *board_type = cJSON_GetObjectItem(json, "board_type");
-    cJSON *request_id = cJSON_GetObjectItem(json, "request_id");
+    char board_str[16];
+    char req_buf[64];
+    const char *req_id = NULL;
+    
+    int board_type = json_object_get(json, tokens, count, 0, "board_type");
+    int request_id = json_object_get(json, tokens, count, 0, "request_id");
     
-    if (!cJSON_IsString(board_type)) {
+    if (board_type < 0 || json_token_string(json, &tokens[board_type], board_str, sizeof(board_str)) < 0) {
         ESP_LOGE(TAG, "Invalid board selection command - missing board_type");
         return;
     }
-    
-    const char* board_str = board_type->valuestring;
-    const char* req_id = request_id ? request_id->valuestring : NULL;
+    if (request_id >= 0 && json_token_string(json, &tokens[request_id], req_buf, sizeof(req_buf)) >= 0) {
+        req_id = req_buf;
+    }
     
     ESP_LOGI(TAG, "Processing board selection: %s", board_str);
     
-    // Select the board
+    board_type_t board;
     if (strcmp(board_str, "AD5940") == 0) {
-        board_select(BOARD_AD5940);
-        g_current_board = BOARD_AD5940;
-        g_board_selected = true;
-        
-        char* response = create_board_selection_response("success", "AD5940", "AD5940 board selected", req_id);
-        esp_mqtt_client_publish(g_mqtt_client, g_mqtt_config.topics.resp_board_select, response, 0, MQTT_QOS_LEVEL, false);
-        free(response);
-        
+        board = BOARD_AD5940;
     } else if (strcmp(board_str, "AD5941") == 0) {
-        board_select(BOARD_AD5941);
-        g_current_board = BOARD_AD5941;
-        g_board_selected = true;
-        
-        char* response = create_board_selection_response("success", "AD5941", "AD5941 board selected", req_id);
-        esp_mqtt_client_publish(g_mqtt_client, g_mqtt_config.topics.resp_board_select, response, 0, MQTT_QOS_LEVEL, false);
-        free(response);
-        
+        board = BOARD_AD5941;
     } else {
         char error_msg[128];
         snprintf(error_msg, sizeof(error_msg), "Unknown board type: %s", board_str);
         
-        char* response = create_board_selection_response("error", "UNKNOWN", error_msg, req_id);
-        esp_mqtt_client_publish(g_mqtt_client, g_mqtt_config.topics.resp_board_select, response, 0, MQTT_QOS_LEVEL, false);
-        free(response);
+        publish_board_selection_response("error", "UNKNOWN", error_msg, req_id);
+        return;
     }
+    // Jobs of the other board still use the SPI bus. The scheduler calls board_select before each job.
+    if (meas_sched_board_busy(board)) {
+        publish_board_selection_response("error", board_str, "Measurement on the other board is queued or running", req_id);
+        return;
+    }
+    g_current_board = board;
+    g_board_selected = true;
+    
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%s board selected", board_str);
+    publish_board_selection_response("success", board_str, msg, req_id);
 }
 
-// Process measurement start command
-static void process_measurement_command(cJSON *json)
+static const char *board_name(board_type_t board)
 {
-    if (!g_board_selected) {
-        ESP_LOGE(TAG, "Cannot start measurement - no board selected");
-        return;
+    return board == BOARD_AD5940 ? "AD5940" : "AD5941";
+}
+
+static const char *job_state_name(meas_job_state_t state)
+{
+    switch (state) {
+        case MEAS_JOB_QUEUED:    return "queued";
+        case MEAS_JOB_RUNNING:   return "running";
+        case MEAS_JOB_DONE:      return "completed";
+        case MEAS_JOB_STOPPED:   return "stopped";
+        case MEAS_JOB_PREEMPTED: return "preempted";
+        default:                 return "failed";
     }
+}
+
+// Publish measurement status of one job, from MQTT event task or scheduler task
+static void publish_measurement_status(char *buf, const char *status, const char *id, board_type_t board,
+                                       uint32_t sweeps_done, uint32_t repeat, const char *message)
+{
+    json_writer_t w;
+    json_writer_init(&w, buf, MQTT_JSON_BUFFER_SIZE);
+    json_object_begin(&w, NULL);
+    json_add_string(&w, "status", status);
+    json_add_string(&w, "measurement_id", id);
+    json_add_string(&w, "board_type", board_name(board));
+    json_add_uint(&w, "sweeps_done", sweeps_done);
+    json_add_uint(&w, "repeat", repeat);
+    json_add_uint(&w, "queued", meas_sched_queued());
+    if (message) {
+        json_add_string(&w, "message", message);
+    }
+    json_add_timestamp(&w);
+    json_object_end(&w);
     
-    cJSON *measurement_type = cJSON_GetObjectItem(json, "measurement_type");
-    cJSON *request_id = cJSON_GetObjectItem(json, "request_id");
+    int len = json_writer_finish(&w);
+    if (len > 0) {
+        esp_mqtt_client_publish(g_mqtt_client, g_mqtt_config.topics.resp_measurement, buf, len, MQTT_QOS_LEVEL, false);
+    }
+}
+
+// Job progress from scheduler: start, each sweep and end of a job
+static void measurement_progress(const meas_job_t *job, void *user)
+{
+    (void)user;
+    publish_measurement_status(g_progress_json, job->state == MEAS_JOB_RUNNING && job->sweeps_done ? "progress" : job_state_name(job->state),
+                               job->id, job->board, job->sweeps_done, job->repeat, NULL);
+}
+
+// Read optional number member of an object
+static bool json_get_double(const char *json, const json_token_t *tokens, int count, int object, const char *key, double *value)
+{
+    int t = json_object_get(json, tokens, count, object, key);
+    return t >= 0 && json_token_double(json, &tokens[t], value);
+}
+
+// Process measurement start command. The job is queued and runs as soon as the jobs before it are done.
+static void process_measurement_command(const char *json, const json_token_t *tokens, int count)
+{
+    char type_str[32];
+    char board_str[16];
+    meas_job_t job;
+    double value;
+    
+    memset(&job, 0, sizeof(job));
+    job.board = g_current_board;
+    job.repeat = 1;
+    job.default_sweep = true;
     
-    if (!cJSON_IsString(measurement_type)) {
+    int measurement_type = json_object_get(json, tokens, count, 0, "measurement_type");
+    
+    if (measurement_type < 0 || json_token_string(json, &tokens[measurement_type], type_str, sizeof(type_str)) < 0) {
         ESP_LOGE(TAG, "Invalid measurement command - missing measurement_type");
         return;
     }
     
-    // Generate measurement ID
-    snprintf(g_measurement_id, sizeof(g_measurement_id), "meas_%ld", esp_timer_get_time() / 1000);
-    g_measurement_active = true;
+    // Board of this job, selected board if not given
+    int board_type = json_object_get(json, tokens, count, 0, "board_type");
+    if (board_type >= 0 && json_token_string(json, &tokens[board_type], board_str, sizeof(board_str)) >= 0) {
+        if (strcmp(board_str, "AD5940") == 0) {
+            job.board = BOARD_AD5940;
+        } else if (strcmp(board_str, "AD5941") == 0) {
+            job.board = BOARD_AD5941;
+        } else {
+            ESP_LOGE(TAG, "Unknown board type: %s", board_str);
+            return;
+        }
+    } else if (!g_board_selected) {
+        ESP_LOGE(TAG, "Cannot start measurement - no board selected");
+        return;
+    }
+    
+    int id = json_object_get(json, tokens, count, 0, "measurement_id");
+    if (id < 0 || json_token_string(json, &tokens[id], job.id, sizeof(job.id)) <= 0) {
+        snprintf(job.id, sizeof(job.id), "meas_%lld", (long long)(esp_timer_get_time() / 1000));
+    }
+    if (json_get_double(json, tokens, count, 0, "repeat", &value) && value >= 0) {
+        job.repeat = (uint32_t)value;       // 0 runs until measurement_stop
+    }
+    if (json_get_double(json, tokens, count, 0, "priority", &value)) {
+        job.priority = (int32_t)value;
+    }
+    
+    // Optional sweep: {"start_hz", "stop_hz", "points", "log"}, or "frequency_hz" for one frequency
+    int sweep = json_object_get(json, tokens, count, 0, "sweep");
+    if (sweep >= 0 && tokens[sweep].type == JSON_TOK_OBJECT) {
+        job.default_sweep = false;
+        job.sweep.SweepEn = bTRUE;
+        job.sweep.SweepLog = bTRUE;
+        if (json_get_double(json, tokens, count, sweep, "start_hz", &value)) job.sweep.SweepStart = value;
+        if (json_get_double(json, tokens, count, sweep, "stop_hz", &value)) job.sweep.SweepStop = value;
+        if (json_get_double(json, tokens, count, sweep, "points", &value)) job.sweep.SweepPoints = (uint32_t)value;
+        int log = json_object_get(json, tokens, count, sweep, "log");
+        if (log >= 0 && json_token_equals(json, &tokens[log], "false")) {
+            job.sweep.SweepLog = bFALSE;
+        }
+    } else if (json_get_double(json, tokens, count, 0, "frequency_hz", &value)) {
+        job.default_sweep = false;
+        job.sweep.SweepEn = bFALSE;
+        job.sweep.SweepStart = value;
+    }
     
-    ESP_LOGI(TAG, "Starting measurement: %s on board %s", 
-             measurement_type->valuestring, 
-             g_current_board == BOARD_AD5940 ? "AD5940" : "AD5941");
+    esp_err_t err = meas_sched_submit(&job);
+    ESP_LOGI(TAG, "Queue measurement %s: %s on board %s, %lu sweeps, priority %ld: %s", job.id, type_str,
+             board_name(job.board), (unsigned long)job.repeat, (long)job.priority, esp_err_to_name(err));
     
-    // TODO: Start actual measurement task based on selected board
-    // For now, just acknowledge the command
-    cJSON *response = cJSON_CreateObject();
-    cJSON_AddStringToObject(response, "status", "started");
-    cJSON_AddStringToObject(response, "measurement_id", g_measurement_id);
-    cJSON_AddStringToObject(response, "board_type", g_current_board == BOARD_AD5940 ? "AD5940" : "AD5941");
+    if (err == ESP_OK) {
+        publish_measurement_status(g_resp_json, "queued", job.id, job.board, 0, job.repeat, NULL);
+    } else {
+        publish_measurement_status(g_resp_json, "error", job.id, job.board, 0, job.repeat,
+                                   err == ESP_ERR_NO_MEM ? "Job queue full" :
+                                   err == ESP_ERR_NOT_SUPPORTED ? "Other board already in use" : "Invalid sweep");
+    }
+}
+
+// Process measurement stop command. Without measurement_id the running job stops and the queue is cleared.
+static void process_stop_command(const char *json, const json_token_t *tokens, int count)
+{
+    char id_str[MEAS_JOB_ID_LEN] = {0};
+    
+    int id = json_object_get(json, tokens, count, 0, "measurement_id");
+    if (id >= 0) {
+        json_token_string(json, &tokens[id], id_str, sizeof(id_str));
+    }
+    // Stopped jobs are reported by the progress callback
+    if (meas_sched_stop(id_str) != ESP_OK) {
+        ESP_LOGW(TAG, "No measurement to stop: %s", id_str[0] ? id_str : "all");
+    }
+}
+
+// Process time sync command, one step of a two-way exchange (see TimeSync.h).
+// {"host_tx_us": T1} is answered with device receive and transmit times T2 and T3.
+// {"host_tx_us": T1, "device_rx_us": T2, "device_tx_us": T3, "host_rx_us": T4} adds
+// the completed exchange to the clock model. Both can be combined in one message.
+static void process_time_sync_command(const char *json, const json_token_t *tokens, int count, uint64_t rx_us)
+{
+    int64_t t1, t2, t3, t4;
     
-    char *response_str = cJSON_Print(response);
-    esp_mqtt_client_publish(g_mqtt_client, g_mqtt_config.topics.resp_measurement, response_str, 0, MQTT_QOS_LEVEL, false);
+    int tok = json_object_get(json, tokens, count, 0, "host_tx_us");
+    if (tok < 0 || !json_token_int(json, &tokens[tok], &t1)) {
+        ESP_LOGE(TAG, "Invalid time sync command - missing host_tx_us");
+        return;
+    }
+    int prev_t1 = json_object_get(json, tokens, count, 0, "prev_host_tx_us");
+    int dev_rx = json_object_get(json, tokens, count, 0, "device_rx_us");
+    int dev_tx = json_object_get(json, tokens, count, 0, "device_tx_us");
+    int host_rx = json_object_get(json, tokens, count, 0, "host_rx_us");
+    if (dev_rx >= 0 && dev_tx >= 0 && host_rx >= 0 &&
+        json_token_int(json, &tokens[dev_rx], &t2) && json_token_int(json, &tokens[dev_tx], &t3) &&
+        json_token_int(json, &tokens[host_rx], &t4)) {
+        // Completed exchange may come with a new request, then its T1 is in prev_host_tx_us
+        int64_t ex_t1 = t1;
+        if (prev_t1 >= 0) {
+            json_token_int(json, &tokens[prev_t1], &ex_t1);
+        }
+        if (TSyncAddExchange(&AppTimeSync, ex_t1, (uint64_t)t2, (uint64_t)t3, t4) != AD5940ERR_OK) {
+            ESP_LOGW(TAG, "Time sync exchange rejected");
+        }
+    }
     
-    free(response_str);
-    cJSON_Delete(response);
+    json_writer_t w;
+    json_writer_init(&w, g_resp_json, sizeof(g_resp_json));
+    json_object_begin(&w, NULL);
+    json_add_int(&w, "host_tx_us", t1);
+    json_add_uint(&w, "device_rx_us", rx_us);
+    json_add_bool(&w, "synced", AppTimeSync.bSynced == bTRUE);
+    if (AppTimeSync.bSynced == bTRUE) {
+        json_add_double(&w, "offset_us", AppTimeSync.OffsetUs);
+        json_add_uint(&w, "offset_ref_us", AppTimeSync.RefUs);
+        json_add_double(&w, "drift_ppm", AppTimeSync.DriftPpm);
+        json_add_uint(&w, "error_us", AppTimeSync.ErrUs);
+        json_add_uint(&w, "samples", AppTimeSync.Used);
+    }
+    // T3 last, as close to sending as the JSON writer allows
+    json_add_uint(&w, "device_tx_us", esp_timer_get_time());
+    json_object_end(&w);
+    int len = json_writer_finish(&w);
+    if (len > 0) {
+        esp_mqtt_client_publish(g_mqtt_client, g_mqtt_config.topics.resp_time_sync, g_resp_json, len, 0, false);
+    }
+}
+
+// Compare end of a topic that is not NUL terminated
+static bool topic_ends_with(const char *topic, int topic_len, const char *suffix)
+{
+    int n = strlen(suffix);
+    return topic_len >= n && memcmp(topic + topic_len - n, suffix, n) == 0;
 }
 
 // MQTT event handler
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
+    uint64_t rx_us = esp_timer_get_time();     // Receive time for time sync, before any processing
     esp_mqtt_event_handle_t event = event_data;
     esp_mqtt_client_handle_t client = event->client;
     
@@ -240,38 +482,51 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
             esp_mqtt_client_subscribe(client, g_mqtt_config.topics.cmd_board_select, MQTT_QOS_LEVEL);
             esp_mqtt_client_subscribe(client, g_mqtt_config.topics.cmd_measurement, MQTT_QOS_LEVEL);
             esp_mqtt_client_subscribe(client, g_mqtt_config.topics.cmd_stop, MQTT_QOS_LEVEL);
+            esp_mqtt_client_subscribe(client, g_mqtt_config.topics.cmd_time_sync, 0);
             
             g_mqtt_config.state = MQTT_STATE_SUBSCRIBED;
             ESP_LOGI(TAG, "Subscribed to command topics");
+            mqtt_pub_set_online(true);      // Stored data is replayed by publish_task
             break;
             
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT Disconnected");
             g_mqtt_config.state = MQTT_STATE_DISCONNECTED;
+            mqtt_pub_set_online(false);     // Keep data in flash until broker is back
             break;
             
         case MQTT_EVENT_SUBSCRIBED:
             ESP_LOGI(TAG, "MQTT Subscribed to topic, msg_id=%d", event->msg_id);
             break;
             
+        case MQTT_EVENT_PUBLISHED:
+            // PUBACK for a QoS1 message, matched by publish_task
+            mqtt_pub_on_ack(event->msg_id);
+            break;
+            
         case MQTT_EVENT_DATA:
             ESP_LOGI(TAG, "MQTT Data received: topic=%.*s", event->topic_len, event->topic);
             
-            // Parse incoming JSON command
-            cJSON *json = cJSON_ParseWithLength(event->data, event->data_len);
-            if (json == NULL) {
-                ESP_LOGE(TAG, "Failed to parse JSON command");
-                break;
+            // Tokenize incoming JSON command in place, tokens point into event->data
+            {
+                json_token_t tokens[JSON_MAX_TOKENS];
+                int count = json_tokenize(event->data, event->data_len, tokens, JSON_MAX_TOKENS);
+                if (count <= 0 || tokens[0].type != JSON_TOK_OBJECT) {
+                    ESP_LOGE(TAG, "Failed to parse JSON command (%d)", count);
+                    break;
+                }
+                
+                // Route command based on topic. The topic is not NUL terminated.
+                if (topic_ends_with(event->topic, event->topic_len, "/cmd/board_select")) {
+                    process_board_selection_command(event->data, tokens, count);
+                } else if (topic_ends_with(event->topic, event->topic_len, "/cmd/measurement_start")) {
+                    process_measurement_command(event->data, tokens, count);
+                } else if (topic_ends_with(event->topic, event->topic_len, "/cmd/measurement_stop")) {
+                    process_stop_command(event->data, tokens, count);
+                } else if (topic_ends_with(event->topic, event->topic_len, "/cmd/time_sync")) {
+                    process_time_sync_command(event->data, tokens, count, rx_us);
+                }
             }
-            
-            // Route command based on topic
-            if (strstr(event->topic, "/cmd/board_select")) {
-                process_board_selection_command(json);
-            } else if (strstr(event->topic, "/cmd/measurement_start")) {
-                process_measurement_command(json);
-            }
-            
-            cJSON_Delete(json);
             break;
             
         case MQTT_EVENT_ERROR:
@@ -310,6 +565,21 @@ static void mqtt_init(void)
     };
     
     g_mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
+    
+    // Data publishers must exist before the first MQTT event
+    mqtt_pub_init(&g_pub_ad5940, g_mqtt_client, g_mqtt_config.topics.data_ad5940, MQTT_QOS_LEVEL);
+    mqtt_pub_init(&g_pub_ad5941, g_mqtt_client, g_mqtt_config.topics.data_ad5941, MQTT_QOS_LEVEL);
+    if (StoreFwdOpen(&g_store, MQTT_STORE_PARTITION) == AD5940ERR_OK) {
+        ESP_LOGI(TAG, "Store-and-forward log: %lu entries waiting", (unsigned long)g_store.Pending);
+        mqtt_pub_set_store(&g_store);
+    } else {
+        ESP_LOGW(TAG, "No '%s' partition, data is dropped while offline", MQTT_STORE_PARTITION);
+    }
+    ad5940_interface.StreamWrite = stream_write_ad5940;
+    ad5941_interface.StreamWrite = stream_write_ad5941;
+    meas_sched_init(measurement_progress, NULL);
+    TSyncInit(&AppTimeSync);
+    
     esp_mqtt_client_register_event(g_mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(g_mqtt_client);
     
@@ -322,8 +592,10 @@ void mqtt_init_topics(mqtt_topics_t *topics, const char *device_id)
     snprintf(topics->cmd_board_select, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_CMD_BOARD_SELECT, device_id);
     snprintf(topics->cmd_measurement, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_CMD_MEASUREMENT, device_id);
     snprintf(topics->cmd_stop, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_CMD_STOP, device_id);
+    snprintf(topics->cmd_time_sync, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_CMD_TIME_SYNC, device_id);
     snprintf(topics->resp_board_select, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_RESP_BOARD_SELECT, device_id);
     snprintf(topics->resp_measurement, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_RESP_MEASUREMENT, device_id);
+    snprintf(topics->resp_time_sync, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_RESP_TIME_SYNC, device_id);
     snprintf(topics->data_ad5940, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_DATA_AD5940, device_id);
     snprintf(topics->data_ad5941, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_DATA_AD5941, device_id);
     snprintf(topics->system_status, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_SYSTEM_STATUS, device_id);
@@ -331,22 +603,44 @@ void mqtt_init_topics(mqtt_topics_t *topics, const char *device_id)
     snprintf(topics->system_heartbeat, MQTT_MAX_TOPIC_LENGTH, MQTT_TOPIC_SYSTEM_HEARTBEAT, device_id);
 }
 
+// Runs queued measurement jobs back to back
+static void measurement_task(void *pvParameters)
+{
+    meas_sched_run();
+}
+
 // Heartbeat task
 void heartbeat_task(void *pvParameters)
 {
     while (1) {
         if (g_mqtt_config.state == MQTT_STATE_SUBSCRIBED) {
-            cJSON *heartbeat = cJSON_CreateObject();
-            cJSON_AddStringToObject(heartbeat, "status", "alive");
-            cJSON_AddStringToObject(heartbeat, "device_id", g_mqtt_config.device_info.device_id);
-            cJSON_AddNumberToObject(heartbeat, "uptime", esp_timer_get_time() / 1000000);
-            cJSON_AddNumberToObject(heartbeat, "free_heap", esp_get_free_heap_size());
+            json_writer_t w;
+            json_writer_init(&w, g_heartbeat_json, sizeof(g_heartbeat_json));
+            json_object_begin(&w, NULL);
+            json_add_string(&w, "status", "alive");
+            json_add_string(&w, "device_id", g_mqtt_config.device_info.device_id);
+            json_add_int(&w, "uptime", esp_timer_get_time() / 1000000);
+            json_add_uint(&w, "free_heap", esp_get_free_heap_size());
             
-            char *heartbeat_str = cJSON_Print(heartbeat);
-            esp_mqtt_client_publish(g_mqtt_client, g_mqtt_config.topics.system_heartbeat, heartbeat_str, 0, 0, false);
+            mqtt_pub_stats_t stats;
+            mqtt_publisher_t *pub = g_current_board == BOARD_AD5940 ? &g_pub_ad5940 : &g_pub_ad5941;
+            mqtt_pub_get_stats(pub, &stats);
+            json_add_uint(&w, "data_messages", stats.messages);
+            json_add_uint(&w, "data_acked", stats.acked);
+            json_add_uint(&w, "data_dropped_frames", stats.dropped_frames);
             
-            free(heartbeat_str);
-            cJSON_Delete(heartbeat);
+            meas_job_t job;
+            if (meas_sched_current(&job)) {
+                json_add_string(&w, "measurement_id", job.id);
+                json_add_uint(&w, "sweeps_done", job.sweeps_done);
+            }
+            json_add_uint(&w, "jobs_queued", meas_sched_queued());
+            json_object_end(&w);
+            
+            int len = json_writer_finish(&w);
+            if (len > 0) {
+                esp_mqtt_client_publish(g_mqtt_client, g_mqtt_config.topics.system_heartbeat, g_heartbeat_json, len, 0, false);
+            }
         }
         
         vTaskDelay(pdMS_TO_TICKS(MQTT_HEARTBEAT_INTERVAL_MS));
@@ -383,8 +677,10 @@ void app_main(void)
         // Initialize MQTT
         mqtt_init();
         
-        // Create heartbeat task
+        // Create heartbeat and data publishing tasks
         xTaskCreate(heartbeat_task, "heartbeat", 4096, NULL, 3, NULL);
+        xTaskCreate(publish_task, "data_publish", 3072, NULL, 4, NULL);
+        xTaskCreate(measurement_task, "measurement", 8192, NULL, 5, NULL);
         
         ESP_LOGI(TAG, "=== MQTT Test System Ready ===");
         ESP_LOGI(TAG, "Device ID: %s", g_mqtt_config.device_info.device_id);